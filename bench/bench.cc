@@ -0,0 +1,377 @@
+/**
+ * \file bench/bench.cc
+ *
+ * Microbenchmarks of the hot paths: beatmap parsing, slider paths, audio
+ * mixing, library scanning, and slider painting.
+ *
+ * Each benchmark runs until it has been running for at least the minimum time,
+ * and the results are written as JSON, in the same layout as Google
+ * Benchmark, so that the usual comparison tools work on it.
+ *
+ * ```
+ * oshu-bench [--filter=SUBSTRING] [--min-time=SECONDS] [--json=FILE] BEATMAP.osu
+ * ```
+ */
+
+#include "config.h"
+
+#include "audio/mix.h"
+#include "audio/sample.h"
+#include "audio/track.h"
+#include "beatmap/beatmap.h"
+#include "library/beatmaps.h"
+#include "ui/osu.h"
+#include "video/paint.h"
+
+#include <SDL2/SDL.h>
+
+#include <chrono>
+#include <dirent.h>
+#include <fstream>
+#include <functional>
+#include <getopt.h>
+#include <iostream>
+#include <map>
+#include <math.h>
+#include <sstream>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+struct result {
+	std::string name;
+	long iterations;
+	double seconds;
+	double items;
+	double bytes;
+};
+
+static double min_time = .5;
+static std::string filter;
+static std::vector<result> results;
+
+/**
+ * Keep the optimizer from discarding the benchmarked computations.
+ */
+static volatile double sink;
+
+/**
+ * Run *f* repeatedly, after a warm-up call, until the minimal time elapsed.
+ *
+ * *f* returns the number of items it processed, and *bytes* is the number of
+ * bytes processed by every call.
+ */
+static void measure(const std::string &name, double bytes, const std::function<double()> &f)
+{
+	if (!filter.empty() && name.find(filter) == std::string::npos)
+		return;
+	sink = f();
+	long iterations = 0;
+	double items = 0;
+	double elapsed;
+	auto start = std::chrono::steady_clock::now();
+	do {
+		items += f();
+		++iterations;
+		elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	} while (elapsed < min_time);
+	results.push_back(result {name, iterations, elapsed, items, bytes * iterations});
+	fprintf(stderr, "%-36s %12.3f µs %14.0f items/s\n", name.c_str(), elapsed / iterations * 1e6, items / elapsed);
+}
+
+static std::string json_string(const std::string &s)
+{
+	std::string out = "\"";
+	for (char c : s) {
+		if (c == '"' || c == '\\')
+			out += '\\';
+		out += c;
+	}
+	return out + "\"";
+}
+
+static void write_json(std::ostream &os)
+{
+	char date[32];
+	time_t now = time(NULL);
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+	os << "{\n";
+	os << "  \"context\": {\n";
+	os << "    \"date\": " << json_string(date) << ",\n";
+	os << "    \"version\": " << json_string(PROJECT_VERSION) << ",\n";
+	os << "    \"num_cpus\": " << std::thread::hardware_concurrency() << ",\n";
+	os << "    \"mix_kernels\": " << json_string(oshu::mix_kernels()) << "\n";
+	os << "  },\n";
+	os << "  \"benchmarks\": [\n";
+	for (size_t i = 0; i < results.size(); ++i) {
+		const result &r = results[i];
+		os << "    {\n";
+		os << "      \"name\": " << json_string(r.name) << ",\n";
+		os << "      \"iterations\": " << r.iterations << ",\n";
+		os << "      \"real_time\": " << r.seconds / r.iterations * 1e9 << ",\n";
+		os << "      \"time_unit\": \"ns\",\n";
+		os << "      \"items_per_second\": " << r.items / r.seconds;
+		if (r.bytes > 0)
+			os << ",\n      \"bytes_per_second\": " << r.bytes / r.seconds;
+		os << "\n    }" << (i + 1 < results.size() ? "," : "") << "\n";
+	}
+	os << "  ]\n";
+	os << "}\n";
+}
+
+static void bench_parser(const char *path)
+{
+	struct stat s;
+	double size = stat(path, &s) == 0 ? s.st_size : 0;
+	measure("load_beatmap", size, [&] {
+		oshu::beatmap beatmap;
+		if (oshu::load_beatmap(path, &beatmap) < 0)
+			throw std::runtime_error("could not load the beatmap");
+		oshu::destroy_beatmap(&beatmap);
+		return 1.;
+	});
+	measure("load_beatmap_headers", size, [&] {
+		oshu::beatmap beatmap;
+		if (oshu::load_beatmap_headers(path, &beatmap) < 0)
+			throw std::runtime_error("could not load the beatmap");
+		oshu::destroy_beatmap(&beatmap);
+		return 1.;
+	});
+}
+
+/**
+ * Write a beatmap with *count* sliders of each path type, based on the real
+ * beatmap's headers.
+ */
+static void write_synthetic_beatmap(const char *model, const std::string &path, int count)
+{
+	std::ifstream in(model);
+	std::ofstream out(path);
+	std::string line;
+	while (std::getline(in, line)) {
+		out << line << '\n';
+		if (line.compare(0, 12, "[HitObjects]") == 0)
+			break;
+	}
+	const char *curves[] = {
+		"L|200:100",
+		"P|150:50|200:100",
+		"B|150:50|200:150|250:100|300:200",
+		"C|150:50|200:150|250:100",
+	};
+	int time = 1000;
+	for (int i = 0; i < count; ++i) {
+		for (const char *curve : curves) {
+			out << 100 + i % 50 << ",100," << time << ",2,0," << curve << ",1," << 100 + i % 100 << '\n';
+			time += 500;
+		}
+	}
+}
+
+static void remove_tree(const std::string &path)
+{
+	DIR *dir = opendir(path.c_str());
+	if (dir) {
+		while (struct dirent *entry = readdir(dir)) {
+			if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+				continue;
+			remove_tree(path + "/" + entry->d_name);
+		}
+		closedir(dir);
+		rmdir(path.c_str());
+	} else {
+		unlink(path.c_str());
+	}
+}
+
+static const char *type_name(enum oshu::path_type type)
+{
+	switch (type) {
+	case oshu::LINEAR_PATH: return "linear";
+	case oshu::PERFECT_PATH: return "perfect";
+	case oshu::BEZIER_PATH: return "bezier";
+	case oshu::CATMULL_PATH: return "catmull";
+	}
+	return "unknown";
+}
+
+/**
+ * Benchmark the paths and the slider painting, grouped by path type.
+ *
+ * Catmull paths are converted to Bézier paths when they're loaded, so they
+ * show up as such.
+ */
+static void bench_sliders(const std::string &path)
+{
+	oshu::beatmap beatmap;
+	if (oshu::load_beatmap(path.c_str(), &beatmap) < 0)
+		throw std::runtime_error("could not load the synthetic beatmap");
+	std::map<enum oshu::path_type, std::vector<oshu::hit*>> sliders;
+	for (oshu::hit *hit = beatmap.hits->next; hit->next; hit = hit->next) {
+		if (hit->type & oshu::SLIDER_HIT)
+			sliders[hit->slider.path.type].push_back(hit);
+	}
+	const int steps = 1000;
+	for (auto &group : sliders) {
+		std::vector<oshu::hit*> &hits = group.second;
+		std::string type = type_name(group.first);
+		measure("path_at/" + type, 0, [&] {
+			double sum = 0;
+			for (oshu::hit *hit : hits) {
+				for (int i = 0; i < steps; ++i)
+					sum += std::real(oshu::path_at(&hit->slider.path, (double) i / steps));
+			}
+			sink = sum;
+			return (double) hits.size() * steps;
+		});
+		std::vector<double> ts(steps);
+		std::vector<oshu::point> points(steps);
+		for (int i = 0; i < steps; ++i)
+			ts[i] = (double) i / steps;
+		measure("path_at_many/" + type, 0, [&] {
+			double sum = 0;
+			for (oshu::hit *hit : hits) {
+				oshu::path_at_many(&hit->slider.path, ts.data(), points.data(), steps);
+				sum += std::real(points[steps / 2]);
+			}
+			sink = sum;
+			return (double) hits.size() * steps;
+		});
+		measure("normalize_path/" + type, 0, [&] {
+			for (oshu::hit *hit : hits)
+				oshu::normalize_path(&hit->slider.path, hit->slider.length);
+			return (double) hits.size();
+		});
+		double radius = beatmap.difficulty.circle_radius;
+		measure("osu_sketch_slider/" + type, 0, [&] {
+			for (oshu::hit *hit : hits) {
+				oshu::painter painter;
+				oshu::point origin;
+				if (oshu::osu_sketch_slider(hit, radius, 1., false, &painter, &origin) == 0)
+					oshu::discard_painting(&painter);
+			}
+			return (double) hits.size();
+		});
+	}
+	oshu::destroy_beatmap(&beatmap);
+}
+
+static void bench_mixer()
+{
+	const int rate = 44100;
+	const int buffer_size = 4096;
+	std::vector<float> pcm(2 * rate);
+	for (int i = 0; i < rate; ++i)
+		pcm[2 * i] = pcm[2 * i + 1] = sin(i * 2. * M_PI * 440. / rate);
+	oshu::sample sample {pcm.data(), (uint32_t) (pcm.size() * sizeof(float)), rate};
+	std::vector<float> buffer(2 * buffer_size);
+	oshu::track track {};
+	oshu::start_track(&track, &sample, .5, 1);
+	measure("mix_track", 0, [&] {
+		oshu::mix_track(&track, buffer.data(), buffer_size);
+		return (double) buffer_size;
+	});
+	measure("clip_samples", 0, [&] {
+		oshu::clip_samples(buffer.data(), buffer.size());
+		return (double) buffer.size();
+	});
+}
+
+/**
+ * Scan a library of *sets* beatmap sets, with 4 beatmaps each.
+ */
+static void bench_library(const char *model, const std::string &root, int sets)
+{
+	mkdir(root.c_str(), 0755);
+	for (int i = 0; i < sets; ++i) {
+		std::string set = root + "/" + std::to_string(i) + " Artist - Title";
+		mkdir(set.c_str(), 0755);
+		for (int j = 0; j < 4; ++j) {
+			std::ifstream in(model, std::ios::binary);
+			std::ofstream out(set + "/Artist - Title (Mapper) [" + std::to_string(j) + "].osu", std::ios::binary);
+			out << in.rdbuf();
+		}
+	}
+	measure("find_beatmap_sets", 0, [&] {
+		std::vector<oshu::beatmap_set> library = oshu::find_beatmap_sets(root);
+		sink = library.size();
+		return sets * 4.;
+	});
+}
+
+enum option_values {
+	OPT_FILTER = 0x10000,
+	OPT_JSON = 0x10001,
+	OPT_MIN_TIME = 0x10002,
+};
+
+static struct option options[] = {
+	{"filter", required_argument, 0, OPT_FILTER},
+	{"json", required_argument, 0, OPT_JSON},
+	{"min-time", required_argument, 0, OPT_MIN_TIME},
+	{0, 0, 0, 0},
+};
+
+static const char *usage =
+	"Usage: oshu-bench [--filter=SUBSTRING] [--min-time=SECONDS] [--json=FILE] BEATMAP.osu\n";
+
+int main(int argc, char **argv)
+{
+	std::string json;
+	for (;;) {
+		int c = getopt_long(argc, argv, "", options, NULL);
+		if (c == -1)
+			break;
+		switch (c) {
+		case OPT_FILTER:
+			filter = optarg;
+			break;
+		case OPT_JSON:
+			json = optarg;
+			break;
+		case OPT_MIN_TIME:
+			min_time = atof(optarg);
+			break;
+		default:
+			fputs(usage, stderr);
+			return 2;
+		}
+	}
+	if (argc - optind != 1) {
+		fputs(usage, stderr);
+		return 2;
+	}
+	const char *model = argv[optind];
+	SDL_LogSetAllPriority(SDL_LOG_PRIORITY_WARN);
+
+	char scratch[] = "/tmp/oshu-bench.XXXXXX";
+	if (!mkdtemp(scratch)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	int rc = 0;
+	try {
+		bench_parser(model);
+		std::string synthetic = std::string(scratch) + "/synthetic.osu";
+		write_synthetic_beatmap(model, synthetic, 50);
+		bench_sliders(synthetic);
+		bench_mixer();
+		bench_library(model, std::string(scratch) + "/library", 100);
+	} catch (std::exception &e) {
+		std::cerr << e.what() << std::endl;
+		rc = 1;
+	}
+	remove_tree(scratch);
+
+	if (json.empty()) {
+		write_json(std::cout);
+	} else {
+		std::ofstream out(json);
+		write_json(out);
+	}
+	return rc;
+}
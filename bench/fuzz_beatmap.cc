@@ -0,0 +1,57 @@
+/**
+ * \file bench/fuzz_beatmap.cc
+ *
+ * libFuzzer target for the beatmap parser.
+ *
+ * Every input is parsed as a whole `.osu` file with #oshu::parse_beatmap, and
+ * the paths of the sliders it yields are sampled, since they're built by the
+ * parser from the input's points.
+ *
+ * It is only built when the OSHU_FUZZ option is set, with clang:
+ *
+ * ```
+ * CXX=clang++ cmake -DOSHU_FUZZ=ON ..
+ * make oshu-fuzz-beatmap
+ * ./bench/oshu-fuzz-beatmap -max_len=65536 CORPUS_DIRECTORY
+ * ```
+ *
+ * The beatmaps of a library make a good initial corpus. The inputs the fuzzer
+ * found crashes with are kept in `bench/corpus`, which should be part of it:
+ *
+ * ```
+ * ./bench/oshu-fuzz-beatmap CORPUS_DIRECTORY ../bench/corpus
+ * ```
+ */
+
+#include "beatmap/beatmap.h"
+#include "core/log.h"
+
+#include <SDL2/SDL.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+extern "C" int LLVMFuzzerInitialize(int *argc, char ***argv)
+{
+	/* The parser warns about every odd line, and the fuzzer feeds it little
+	 * else. */
+	oshu::log_priority = oshu::log_level::critical;
+	SDL_LogSetAllPriority(SDL_LOG_PRIORITY_CRITICAL);
+	return 0;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	oshu::beatmap beatmap;
+	if (oshu::parse_beatmap((const char*) data, size, "fuzz.osu", &beatmap) < 0)
+		return 0;
+	for (oshu::hit *hit = beatmap.hits->next; hit && hit->next; hit = hit->next) {
+		if (hit->type & oshu::SLIDER_HIT) {
+			oshu::path_at(&hit->slider.path, 0);
+			oshu::path_at(&hit->slider.path, .5);
+			oshu::path_at(&hit->slider.path, 1);
+		}
+	}
+	oshu::destroy_beatmap(&beatmap);
+	return 0;
+}
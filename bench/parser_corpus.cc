@@ -0,0 +1,342 @@
+/**
+ * \file bench/parser_corpus.cc
+ *
+ * Throughput of the beatmap parser over a corpus of real beatmaps, like a
+ * copy of an osu! library, and over synthetic inputs that grow in the
+ * directions the parser is the most likely to scale badly in.
+ *
+ * ```
+ * oshu-parser-corpus [--slow=FACTOR] [--min-time=SECONDS] [PATH...]
+ * ```
+ *
+ * Every `.osu` file under the paths is read into memory, and parsed with
+ * #oshu::parse_beatmap until the minimum time elapsed. One line is printed per
+ * file with its parse time, its throughput, its longest line, and its largest
+ * slider point list. Files parsed more than *FACTOR* times slower than the
+ * median throughput are flagged, and listed again at the end.
+ *
+ * The synthetic inputs are parsed at a base size and at 8 times that size.
+ * The time should grow 8 times too, so a growth exponent above 1.5 is flagged
+ * as superlinear.
+ *
+ * The exit status is 1 when anything was flagged.
+ */
+
+#include "beatmap/beatmap.h"
+#include "core/log.h"
+
+#include <SDL2/SDL.h>
+
+#include <algorithm>
+#include <chrono>
+#include <dirent.h>
+#include <fstream>
+#include <functional>
+#include <getopt.h>
+#include <iostream>
+#include <math.h>
+#include <sstream>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <vector>
+
+struct corpus_file {
+	std::string path;
+	std::string contents;
+	/**
+	 * Length of the longest line, in bytes.
+	 */
+	size_t longest_line;
+	/**
+	 * Most points in a single line, counted by their `|` separators.
+	 */
+	size_t most_points;
+	double seconds;
+	bool failed;
+};
+
+static double min_time = .01;
+static double slow_factor = 4;
+
+/**
+ * Exponent above which the growth of the synthetic inputs is flagged.
+ */
+static const double superlinear_exponent = 1.5;
+
+static bool has_suffix(const std::string &s, const char *suffix)
+{
+	size_t n = strlen(suffix);
+	return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+static void find_files(const std::string &path, std::vector<std::string> *files)
+{
+	struct stat s;
+	if (stat(path.c_str(), &s) < 0) {
+		perror(path.c_str());
+		return;
+	}
+	if (!S_ISDIR(s.st_mode)) {
+		files->push_back(path);
+		return;
+	}
+	DIR *dir = opendir(path.c_str());
+	if (!dir) {
+		perror(path.c_str());
+		return;
+	}
+	while (struct dirent *entry = readdir(dir)) {
+		if (entry->d_name[0] == '.')
+			continue;
+		std::string child = path + "/" + entry->d_name;
+		if (stat(child.c_str(), &s) == 0 && S_ISDIR(s.st_mode))
+			find_files(child, files);
+		else if (has_suffix(child, ".osu"))
+			files->push_back(child);
+	}
+	closedir(dir);
+}
+
+static void measure_shape(corpus_file *file)
+{
+	file->longest_line = 0;
+	file->most_points = 0;
+	size_t start = 0;
+	while (start < file->contents.size()) {
+		size_t end = file->contents.find('\n', start);
+		if (end == std::string::npos)
+			end = file->contents.size();
+		file->longest_line = std::max(file->longest_line, end - start);
+		size_t points = std::count(file->contents.begin() + start, file->contents.begin() + end, '|');
+		file->most_points = std::max(file->most_points, points);
+		start = end + 1;
+	}
+}
+
+/**
+ * Parse *contents* repeatedly until the minimum time elapsed, and return the
+ * average time of one parse, in seconds, or a negative number if it failed.
+ */
+static double time_parse(const std::string &contents, const char *name)
+{
+	long iterations = 0;
+	double elapsed;
+	auto start = std::chrono::steady_clock::now();
+	do {
+		oshu::beatmap beatmap;
+		if (oshu::parse_beatmap(contents.data(), contents.size(), name, &beatmap) < 0)
+			return -1;
+		oshu::destroy_beatmap(&beatmap);
+		++iterations;
+		elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	} while (elapsed < min_time);
+	return elapsed / iterations;
+}
+
+static void print_file(const corpus_file &file, const char *flag)
+{
+	if (file.failed) {
+		printf("%10s %10zu %10s %8zu %8zu  failed  %s\n", "-", file.contents.size(), "-",
+		       file.longest_line, file.most_points, file.path.c_str());
+		return;
+	}
+	printf("%10.1f %10zu %10.2f %8zu %8zu %7s  %s\n",
+	       file.seconds * 1e6, file.contents.size(), file.contents.size() / file.seconds / 1e6,
+	       file.longest_line, file.most_points, flag, file.path.c_str());
+}
+
+/**
+ * Parse every file of the corpus, and return how many were flagged as slow.
+ */
+static int bench_corpus(const std::vector<std::string> &paths)
+{
+	std::vector<std::string> names;
+	for (const std::string &path : paths)
+		find_files(path, &names);
+	if (names.empty())
+		return 0;
+	std::sort(names.begin(), names.end());
+
+	printf("%10s %10s %10s %8s %8s %7s  %s\n", "µs", "bytes", "MB/s", "line", "points", "", "file");
+	std::vector<corpus_file> files;
+	for (const std::string &name : names) {
+		std::ifstream in(name, std::ios::binary);
+		std::ostringstream contents;
+		contents << in.rdbuf();
+		corpus_file file {name, contents.str(), 0, 0, 0, false};
+		measure_shape(&file);
+		file.seconds = time_parse(file.contents, name.c_str());
+		file.failed = file.seconds < 0;
+		print_file(file, "");
+		files.push_back(std::move(file));
+	}
+
+	std::vector<double> throughputs;
+	size_t total_bytes = 0;
+	double total_seconds = 0;
+	for (const corpus_file &file : files) {
+		if (file.failed || file.contents.empty())
+			continue;
+		throughputs.push_back(file.contents.size() / file.seconds);
+		total_bytes += file.contents.size();
+		total_seconds += file.seconds;
+	}
+	if (throughputs.empty())
+		return 0;
+	std::nth_element(throughputs.begin(), throughputs.begin() + throughputs.size() / 2, throughputs.end());
+	double median = throughputs[throughputs.size() / 2];
+	printf("\n%zu files, %.1f MB in %.3f s, %.2f MB/s overall, %.2f MB/s median\n",
+	       files.size(), total_bytes / 1e6, total_seconds, total_bytes / total_seconds / 1e6, median / 1e6);
+
+	int flagged = 0;
+	for (const corpus_file &file : files) {
+		if (file.failed || file.contents.empty())
+			continue;
+		if (file.contents.size() / file.seconds * slow_factor < median) {
+			if (flagged++ == 0)
+				printf("\nslower than %g times the median throughput:\n", slow_factor);
+			print_file(file, "slow");
+		}
+	}
+	return flagged;
+}
+
+/**
+ * The headers of the synthetic beatmaps.
+ */
+static const char *synthetic_headers =
+	"osu file format v14\n"
+	"\n"
+	"[General]\n"
+	"AudioFilename: audio.mp3\n"
+	"Mode: 0\n"
+	"\n"
+	"[Metadata]\n"
+	"Title:Synthetic\n"
+	"Artist:oshu!\n"
+	"Version:Probe\n"
+	"\n"
+	"[Difficulty]\n"
+	"CircleSize:4\n"
+	"SliderMultiplier:1.4\n"
+	"\n"
+	"[TimingPoints]\n"
+	"0,500,4,2,0,100,1,0\n"
+	"\n"
+	"[HitObjects]\n";
+
+/**
+ * Write a slider of type *type* with *n* points.
+ *
+ * The points zigzag so that no two consecutive ones repeat, which would cut a
+ * Bézier path into segments.
+ */
+static std::string slider_line(char type, int n)
+{
+	std::ostringstream line;
+	line << "100,100,1000,2,0," << type;
+	for (int i = 0; i < n; ++i)
+		line << '|' << 100 + i % 7 * 10 << ':' << 100 + i % 5 * 10;
+	line << ",1," << 10 * n << '\n';
+	return line.str();
+}
+
+/**
+ * The synthetic inputs, each a function from a size to a beatmap.
+ */
+static const std::vector<std::pair<const char*, std::function<std::string(int)>>> probes = {
+	{"long metadata line", [](int n) {
+		std::string b = synthetic_headers;
+		b.insert(b.find("Title:") + 6, std::string(n * 400, 'x'));
+		return b + "100,100,1000,1,0\n";
+	}},
+	{"long unknown line", [](int n) {
+		return synthetic_headers + std::string(n * 400, 'x') + "\n100,100,1000,1,0\n";
+	}},
+	{"many hit objects", [](int n) {
+		std::string b = synthetic_headers;
+		for (int i = 0; i < n * 40; ++i)
+			b += "100,100," + std::to_string(1000 + i * 10) + ",1,0\n";
+		return b;
+	}},
+	{"many timing points", [](int n) {
+		std::string b = synthetic_headers;
+		std::string points;
+		for (int i = 0; i < n * 40; ++i)
+			points += std::to_string(i * 10) + ",-100,4,2,0,100,0,0\n";
+		b.insert(b.find("[TimingPoints]\n") + 15, points);
+		return b + "100,100,1000,1,0\n";
+	}},
+	{"linear slider points", [](int n) { return synthetic_headers + slider_line('L', n); }},
+	{"bezier slider points", [](int n) { return synthetic_headers + slider_line('B', n); }},
+	{"catmull slider points", [](int n) { return synthetic_headers + slider_line('C', n); }},
+};
+
+/**
+ * Parse the synthetic inputs at two sizes, and return how many grew
+ * superlinearly.
+ */
+static int bench_probes()
+{
+	const int base = 16;
+	const int growth = 8;
+	printf("\n%-24s %12s %12s %9s\n", "synthetic input", "µs", "µs ×8", "exponent");
+	int flagged = 0;
+	for (auto &probe : probes) {
+		double small = time_parse(probe.second(base), probe.first);
+		double large = time_parse(probe.second(base * growth), probe.first);
+		if (small < 0 || large < 0) {
+			printf("%-24s %12s %12s %9s  failed\n", probe.first, "-", "-", "-");
+			++flagged;
+			continue;
+		}
+		double exponent = log(large / small) / log(growth);
+		bool superlinear = exponent > superlinear_exponent;
+		printf("%-24s %12.1f %12.1f %9.2f%s\n", probe.first, small * 1e6, large * 1e6, exponent,
+		       superlinear ? "  superlinear" : "");
+		flagged += superlinear;
+	}
+	return flagged;
+}
+
+enum option_values {
+	OPT_SLOW = 0x10000,
+	OPT_MIN_TIME = 0x10001,
+};
+
+static struct option options[] = {
+	{"slow", required_argument, 0, OPT_SLOW},
+	{"min-time", required_argument, 0, OPT_MIN_TIME},
+	{0, 0, 0, 0},
+};
+
+static const char *usage =
+	"Usage: oshu-parser-corpus [--slow=FACTOR] [--min-time=SECONDS] [PATH...]\n";
+
+int main(int argc, char **argv)
+{
+	for (;;) {
+		int c = getopt_long(argc, argv, "", options, NULL);
+		if (c == -1)
+			break;
+		switch (c) {
+		case OPT_SLOW:
+			slow_factor = atof(optarg);
+			break;
+		case OPT_MIN_TIME:
+			min_time = atof(optarg);
+			break;
+		default:
+			fputs(usage, stderr);
+			return 2;
+		}
+	}
+	oshu::log_priority = oshu::log_level::critical;
+	SDL_LogSetAllPriority(SDL_LOG_PRIORITY_CRITICAL);
+
+	std::vector<std::string> paths(argv + optind, argv + argc);
+	int flagged = bench_corpus(paths);
+	flagged += bench_probes();
+	return flagged > 0 ? 1 : 0;
+}
@@ -11,11 +11,20 @@
 
 #pragma once
 
+#include "audio/pcm.h"
+#include "audio/ring.h"
 #include "audio/sample.h"
 #include "audio/stream.h"
+#include "audio/stretch.h"
 #include "audio/track.h"
+#include "audio/voice.h"
 
 #include <SDL2/SDL.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
 
 namespace oshu {
 
@@ -42,15 +51,23 @@ namespace oshu {
  *
  * 1. SDL requests for audio samples by calling the callback function
  *    mentionned on device initialization.
- * 2. The callback function copies data from the current frame into SDL's
- *    supplied buffer, and requests more frames until the buffer is full.
- * 3. Frames are read from libavcodec, which keeps returning frames until the
- *    current page is completely read. Request a new page is the current one is
+ * 2. The callback function copies decoded samples from the ring buffer into
+ *    SDL's supplied buffer, and mixes the sound effects on top of them.
+ * 3. Meanwhile, a decoder thread keeps the ring buffer full by requesting
+ *    frames from libavcodec, which keeps returning frames until the current
+ *    page is completely read. Request a new page is the current one is
  *    completely consumed.
  * 4. Packets are read from libavformat, which reads data from the audio file,
  *    and returns pages until *EOF*. The packets are then passed to libavcodec
  *    for decoding.
  *
+ * The callback runs in SDL's real-time audio thread, and must never wait. This
+ * is why decoding happens on a separate thread, which can afford to be slowed
+ * down by the disk without causing audible underruns, as long as the ring
+ * buffer has enough samples in advance. See \ref audio_ring. When the music
+ * plays faster or slower, the decoder thread also stretches it before writing
+ * it into the ring. See \ref audio_stretch.
+ *
  * If this is not clear, here a few elements of structure and ffmpeg
  * terminology you should know:
  *
@@ -119,8 +136,7 @@ namespace oshu {
  *
  * ```c
  * SDL_Init(SDL_AUDIO|...);
- * oshu::audio audio;
- * memset(&audio, 0, sizeof(audio));
+ * oshu::audio audio {};
  * oshu::open_audio("file.ogg", &audio);
  * oshu::play_audio(&audio);
  * do_things();
@@ -146,14 +162,110 @@ namespace oshu {
  * \{
  */
 
+/**
+ * A request sent to the decoder thread.
+ *
+ * The requester waits until the decoder sets #done.
+ */
+struct audio_command {
+	/**
+	 * Position to seek the music to, in seconds.
+	 */
+	double seek_target;
+	/**
+	 * Playback rate of the music from the seek target on.
+	 *
+	 * \sa oshu::audio::rate
+	 */
+	double rate;
+	/**
+	 * \sa oshu::audio::keep_pitch
+	 */
+	bool keep_pitch;
+	/**
+	 * Return value of #oshu::seek_stream.
+	 */
+	int result;
+	/**
+	 * Whether the decoder processed the command.
+	 */
+	bool done;
+};
+
+/**
+ * A request from the game thread to the audio callback, to start or stop a
+ * sound effect.
+ *
+ * \sa oshu::audio::sound_commands
+ */
+struct sound_command {
+	enum kind {
+		PLAY_SAMPLE,
+		PLAY_LOOP,
+		STOP_LOOP,
+		SCHEDULE_SAMPLE,
+	};
+	kind type;
+	/**
+	 * The sample to play, or null for #STOP_LOOP.
+	 */
+	oshu::sample *sample;
+	float volume;
+	oshu::voice_priority priority;
+	/**
+	 * When the command was issued, as returned by
+	 * `SDL_GetPerformanceCounter`.
+	 *
+	 * The audio callback uses it to start the sample at the matching
+	 * position in its buffer.
+	 */
+	Uint64 time;
+	/**
+	 * For #SCHEDULE_SAMPLE, the position in the music at which the sample
+	 * must start, in seconds.
+	 */
+	double timestamp;
+	/**
+	 * For #PLAY_LOOP and #STOP_LOOP, the handle returned by
+	 * #oshu::play_loop.
+	 */
+	int loop;
+};
+
+/**
+ * Maximum number of looping samples playing at the same time.
+ *
+ * Each slider may loop its slide and whistle samples, and sliders overlap in
+ * 2B maps.
+ */
+static const int max_loops = 16;
+
+/**
+ * Capacity of #oshu::audio::sound_commands.
+ *
+ * Commands are drained at every audio callback, so this is plenty.
+ */
+static const size_t sound_queue_size = 256;
+
+/**
+ * Maximum number of samples waiting in #oshu::audio::scheduled.
+ *
+ * Samples should be scheduled shortly before they're due, so only a handful
+ * should be waiting at a given time.
+ */
+static const int max_scheduled_samples = 64;
+
 /**
  * The full audio pipeline.
  *
- * This structure is mainly accessed through an audio thread, and should be
- * locked using SDL's `SDL_LockAudioDevice` and `SDL_UnlockAudioDevice`
- * procedures in order to be accessed peacefully from another thread. You don't
- * need to bother with locking when using the accessors defined in this module
- * though. Only lock when accessing multiple fields directly.
+ * This structure is shared by three threads: the caller's, SDL's audio
+ * thread, and the decoder thread. The music stream is owned by the decoder
+ * thread, and must not be accessed directly; use #oshu::music_position to know
+ * what part of it is playing.
+ *
+ * The effect tracks belong to SDL's audio thread. Other threads control them
+ * by sending commands through a wait-free queue, so that neither side ever
+ * waits for the other. Use the accessors defined in this module.
  *
  * \todo
  * Rename this to oshu::audio::engine.
@@ -164,24 +276,11 @@ struct audio {
 	 */
 	oshu::stream music;
 	/**
-	 * Tracks for playing sound effects on top of the music.
-	 *
-	 * Up to 8 samples may be played at a time.
-	 *
-	 * When the need for looping samples arise, it would be smart to
-	 * dedicate a track for them.
+	 * Voices for playing sound effects on top of the music.
 	 *
 	 * \sa oshu::play_sample
 	 */
-	oshu::track effects[16];
-	/**
-	 * Special track for the looping sample.
-	 *
-	 * As you can see, only one loop is supported.
-	 *
-	 * \sa oshu::play_loop
-	 */
-	oshu::track looping;
+	oshu::voice_pool voices;
 	/**
 	 * A device ID returned by SDL, and required by most SDL audio
 	 * functions.
@@ -192,13 +291,227 @@ struct audio {
 	 * output device.
 	 *
 	 * This is useful for loading samples with #oshu::load_sample.
+	 *
+	 * Its buffer size is the one SDL actually picked, which may differ
+	 * from the one we requested.
 	 */
 	SDL_AudioSpec device_spec;
+	/**
+	 * Delay between the moment samples are sent to SDL, and the moment
+	 * they're heard, in seconds.
+	 *
+	 * SDL doesn't report the latency of the sound card itself, so this is
+	 * the duration of the device buffer we obtained. It is what
+	 * #oshu::music_position is ahead of the speakers.
+	 *
+	 * The buffer size is controlled by the *OSHU_AUDIO_LATENCY* environment
+	 * variable, which may be *low*, *medium*, or *high* for 256, 1024, and
+	 * 2048 samples. The default is *high*, because small buffers may crackle
+	 * on slow systems.
+	 */
+	double latency;
+	/**
+	 * Tempo of the music, relative to its normal speed.
+	 *
+	 * The music is stretched by the decoder thread, so a second of samples
+	 * in the #ring holds *rate* seconds of music. The latency and the
+	 * other durations of the device stay in real time.
+	 *
+	 * It is 1 after #oshu::open_audio, and only changes with
+	 * #oshu::set_music_rate, which only the thread controlling the music
+	 * may call.
+	 */
+	double rate;
+	/**
+	 * Whether the pitch of the music is preserved when the #rate isn't 1.
+	 */
+	bool keep_pitch;
+	/**
+	 * The stage stretching the music to the #rate, owned by the decoder
+	 * thread.
+	 */
+	oshu::stretcher stretcher;
+	/**
+	 * Decoded music samples, ahead of the playback.
+	 *
+	 * The decoder thread writes into it, and the audio callback reads from
+	 * it.
+	 */
+	oshu::sample_ring ring;
+	/**
+	 * Set by the decoder thread once the whole music is in #ring, so that
+	 * the audio callback can tell an underrun from the end of the song.
+	 */
+	std::atomic<bool> music_drained;
+	/**
+	 * The thread decoding #music into #ring.
+	 */
+	std::thread decoder;
+	/**
+	 * Protects #commands and #stopping.
+	 *
+	 * The audio callback never takes it.
+	 */
+	std::mutex command_mutex;
+	/**
+	 * Wakes the decoder when a command arrives, and the requesters when
+	 * their command is done.
+	 */
+	std::condition_variable command_signal;
+	/**
+	 * Pending requests for the decoder thread.
+	 */
+	std::deque<oshu::audio_command*> commands;
+	/**
+	 * Set to ask the decoder thread to exit.
+	 */
+	bool stopping;
+	/**
+	 * Sequence lock for #seek_position, #seek_timestamp and #seek_rate.
+	 *
+	 * It is odd while the decoder is updating them, and even otherwise.
+	 * Every seek increases it by 2.
+	 */
+	std::atomic<unsigned> seek_sequence;
+	/**
+	 * Position in #ring where the samples of the last seek start.
+	 *
+	 * Everything before is stale, and the audio callback skips it.
+	 */
+	std::atomic<size_t> seek_position;
+	/**
+	 * Timestamp of the music at #seek_position, in seconds.
+	 */
+	std::atomic<double> seek_timestamp;
+	/**
+	 * The #rate of the samples from #seek_position on.
+	 */
+	std::atomic<double> seek_rate;
+	/**
+	 * The last #seek_sequence the audio callback handled.
+	 *
+	 * Only the audio callback accesses it.
+	 */
+	unsigned seek_handled;
+	/**
+	 * The #seek_position, #seek_timestamp and #seek_rate of the last seek
+	 * the audio callback handled, to map music timestamps to positions in
+	 * #ring.
+	 *
+	 * Only the audio callback accesses them.
+	 */
+	size_t handled_position;
+	double handled_timestamp;
+	double handled_rate;
+	/**
+	 * Queue of sound effects commands, drained at the beginning of every
+	 * audio callback.
+	 *
+	 * It is a single-producer, single-consumer queue, so sound effects must
+	 * all be played from the same thread.
+	 *
+	 * \sa oshu::play_sample
+	 */
+	oshu::sound_command sound_commands[sound_queue_size];
+	/**
+	 * Total number of commands pushed into #sound_commands.
+	 */
+	std::atomic<size_t> sound_head;
+	/**
+	 * Total number of commands the audio callback popped.
+	 */
+	std::atomic<size_t> sound_tail;
+	/**
+	 * When the previous audio callback started, as returned by
+	 * `SDL_GetPerformanceCounter`, or 0 before the first one.
+	 *
+	 * Only the audio callback accesses it.
+	 */
+	Uint64 previous_callback;
+	/**
+	 * Sequence lock for #timing_tail, #timing_counter and #timing_samples,
+	 * written by the audio callback like #seek_sequence.
+	 */
+	std::atomic<unsigned> timing_sequence;
+	/**
+	 * Position of #ring's tail at the end of the last audio callback.
+	 */
+	std::atomic<size_t> timing_tail;
+	/**
+	 * When the last audio callback started, like #previous_callback.
+	 */
+	std::atomic<Uint64> timing_counter;
+	/**
+	 * Number of samples per channel the last audio callback produced.
+	 */
+	std::atomic<int> timing_samples;
+	/**
+	 * Samples sent by #oshu::schedule_sample that are not due yet.
+	 *
+	 * They are dropped when the music is seeked.
+	 *
+	 * Only the audio callback accesses them.
+	 */
+	oshu::sound_command scheduled[max_scheduled_samples];
+	int scheduled_count;
+	/**
+	 * Which loop handles are in use.
+	 *
+	 * Only the thread calling #oshu::play_loop accesses it.
+	 */
+	bool loop_taken[max_loops];
+	/**
+	 * The index in #voices playing each loop handle, or -1.
+	 *
+	 * Only the audio callback accesses it.
+	 */
+	int loop_voices[max_loops];
+	/**
+	 * The fully decoded music, when the PCM cache is enabled.
+	 *
+	 * It is only valid once #pcm_ready is set.
+	 *
+	 * \sa audio_pcm
+	 */
+	oshu::pcm_cache pcm;
+	/**
+	 * Set once #pcm is mapped, either when the audio is opened if the
+	 * cache file already exists, or when #pcm_builder is done.
+	 */
+	std::atomic<bool> pcm_ready;
+	/**
+	 * Thread decoding the whole music into a new PCM cache file.
+	 */
+	std::thread pcm_builder;
+	/**
+	 * Set to abort #pcm_builder.
+	 */
+	std::atomic<bool> pcm_cancel;
+	/**
+	 * Timestamp of the first sample of #pcm, in seconds.
+	 */
+	double pcm_origin;
+	/**
+	 * Whether the decoder thread reads from #pcm rather than #music.
+	 *
+	 * It switches to the PCM cache on the first seek after it's ready,
+	 * since a seek breaks the continuity of the music anyway.
+	 *
+	 * Only the decoder thread accesses it, along with #pcm_cursor.
+	 */
+	bool pcm_active;
+	/**
+	 * Position of the decoder in #pcm, in samples per channel.
+	 */
+	size_t pcm_cursor;
 };
 
 /**
  * Open a file and initialize everything needed to play it.
  *
+ * This starts the decoder thread, which fills the ring buffer right away, so
+ * that the first samples are ready by the time #oshu::play_audio is called.
+ *
  * \param url Path or URL to the audio file to play.
  * \param audio Null-initialized #oshu::audio object.
  *
@@ -208,6 +521,30 @@ struct audio {
  */
 int open_audio(const char *url, oshu::audio *audio);
 
+/**
+ * Open a file like #oshu::open_audio, but without an audio device, so that
+ * the audio is mixed offline with #oshu::render_audio.
+ *
+ * The output has the sample rate of the music, and no latency.
+ *
+ * \return 0 on success. On error, -1 is returned and everything is freed.
+ */
+int open_offline_audio(const char *url, oshu::audio *audio);
+
+/**
+ * Produce the next *nb_samples* samples per channel of an offline audio,
+ * exactly like the audio callback would for the sound card.
+ *
+ * Unlike the audio callback, it waits for the decoder thread rather than
+ * filling the buffer with silence, so it can run as fast as the music is
+ * decoded. The sound effects requested since the previous call start at the
+ * beginning of the buffer, while the scheduled ones start at their exact
+ * sample.
+ *
+ * *nb_samples* must not exceed the capacity of #oshu::audio::ring.
+ */
+void render_audio(oshu::audio *audio, float *samples, int nb_samples);
+
 /**
  * Start playing!
  *
@@ -231,43 +568,116 @@ void pause_audio(oshu::audio *audio);
  *
  * Multiple samples may be played at once, but there's still a limit to the
  * number of samples that can be played simultaneously. When that number is
- * reached because all the effects tracks are used, the playback of one of
- * the samples is stopped to play the new sample.
+ * reached because all the voices are used, the oldest sample of the lowest
+ * priority is stopped to play the new sample. See \ref audio_voice.
+ *
+ * The sample is started by the next audio callback, delayed within its buffer
+ * by the time elapsed since the previous callback. This way, the latency
+ * between the call and the sound is constant instead of depending on where
+ * the call falls relative to the buffer boundaries.
+ *
+ * This function never blocks. If the command queue is full, the sample is
+ * dropped.
  */
-void play_sample(oshu::audio *audio, oshu::sample *sample, float volume);
+void play_sample(oshu::audio *audio, oshu::sample *sample, float volume, oshu::voice_priority priority = oshu::NORMAL_VOICE);
 
 /**
- * Play a looping sample.
+ * Play a sample on top of the background music, starting exactly when the
+ * music reaches *timestamp*, in seconds.
+ *
+ * Unlike #oshu::play_sample, the timing doesn't depend on when this function
+ * is called, nor on the size of the audio buffer: the sample is mixed from the
+ * exact sample of the music it is scheduled for. It must however be scheduled
+ * before the music at *timestamp* is sent to SDL, which happens
+ * #oshu::audio::latency ahead of the playback. Late samples are started as soon
+ * as possible.
+ *
+ * This makes it suitable for events known in advance, like autoplay hits.
  *
- * Currently, only one looping sample may be played at a time. Calling this
- * function cancels any other looping sample.
+ * Scheduled samples are cancelled by #oshu::seek_music.
+ */
+void schedule_sample(oshu::audio *audio, oshu::sample *sample, float volume, double timestamp, oshu::voice_priority priority = oshu::NORMAL_VOICE);
+
+/**
+ * Play a looping sample, and return a handle to stop it.
+ *
+ * Up to #oshu::max_loops samples may loop at the same time, each on its own
+ * voice. Their voices are never stolen by other sounds. The sample fades in
+ * over a few milliseconds to avoid clicks.
+ *
+ * \return A handle for #oshu::stop_loop, or -1 if too many samples are
+ * already looping.
  *
  * \sa oshu::play_sample
  * \sa oshu::stop_loop
  */
-void play_loop(oshu::audio *audio, oshu::sample *sample, float volume);
+int play_loop(oshu::audio *audio, oshu::sample *sample, float volume);
 
 /**
  * Seek the music stream to the specifed target position in seconds.
  *
  * See #oshu::seek_stream for details.
  *
- * It is similar to #oshu::seek_stream, with the different that this function
- * locks the audio thread, and stops all the currently playing sound effects,
- * which is definitely what you want.
+ * The seek is performed by the decoder thread, and this function waits until
+ * it's done, without ever locking the audio thread. When the PCM cache is
+ * ready, seeking is immediate and exact. The samples decoded before
+ * the seek are dropped, and all the currently playing sound effects are
+ * stopped, which is definitely what you want.
  */
 int seek_music(oshu::audio *audio, double target);
 
 /**
- * Stop the looping sample.
+ * Change the tempo of the music, from its current position.
+ *
+ * A *rate* of 1.5 plays the music 50% faster, and 0.75 plays it 25% slower.
+ * When *keep_pitch* is true, the pitch stays the same, otherwise it changes
+ * with the tempo. See \ref audio_stretch.
+ *
+ * Like #oshu::seek_music, it drops the samples decoded ahead and the sound
+ * effects, and waits for the decoder thread. It is best called before the
+ * music starts.
+ *
+ * \return 0 on success, -1 on error, in which case the rate is unchanged.
+ */
+int set_music_rate(oshu::audio *audio, double rate, bool keep_pitch);
+
+/**
+ * Return the position of the music being played, in seconds.
+ *
+ * This is the timestamp of the last sample sent to SDL. Right after
+ * #oshu::seek_music, it is the seek target. Subtract #oshu::audio::latency to
+ * get the position of what is heard.
+ */
+double music_position(oshu::audio *audio);
+
+/**
+ * Return the position of the music like #oshu::music_position, but
+ * interpolated between the audio callbacks.
+ *
+ * #oshu::music_position only moves when the audio callback consumes a buffer,
+ * which is every 5 to 45 ms depending on the latency. Since the device plays
+ * the buffer at a steady rate, this function adds the time elapsed since the
+ * last callback, measured with `SDL_GetPerformanceCounter`, up to the
+ * duration of the samples it produced. When the device is paused, or stalls,
+ * the position stops there rather than drifting away.
+ *
+ * *counter* is the time of the query, as returned by
+ * `SDL_GetPerformanceCounter`.
+ */
+double precise_music_position(oshu::audio *audio, Uint64 counter);
+
+/**
+ * Fade out and stop a looping sample.
+ *
+ * The handle is then free for another loop. Invalid handles, like -1, are
+ * ignored.
  *
- * Since only one sample may be played at a time, it's not ambiguous. In the
- * future, if more looping samples are supported, this function's prototype
- * would change.
+ * Seeking the music stops all the loops, but their handles must still be
+ * released with this function.
  *
  * \sa oshu::play_loop
  */
-void stop_loop(oshu::audio *audio);
+void stop_loop(oshu::audio *audio, int loop);
 
 /**
  * Close the audio stream and free everything associated to it.
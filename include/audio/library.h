@@ -5,16 +5,20 @@
 
 #pragma once
 
+#include "audio/sample.h"
 #include "beatmap/beatmap.h"
 
+#include <deque>
+#include <stdint.h>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 struct SDL_AudioSpec;
 
 namespace oshu {
 
 struct audio;
-struct sample;
 
 /**
  * \defgroup audio_library Library
@@ -23,27 +27,16 @@ struct sample;
  * \brief
  * Manage a collection of sound samples.
  *
- * The library is organized into rooms, one for each sample set family (normal,
- * soft, drum). Each room contains shelves, even though some rooms are
- * sometimes empty. Shelves are identified by their index number. Each shelf
- * contains up to 4 samples.
- *
- * Here's an idea of the library's map:
- *
- * \dot
- * digraph {
- * 	rankdir=TB
- * 	node [shape=rect]
- * 	Hall -> "Normal room"
- * 	Hall -> "Soft room"
- * 	Hall -> "Drum room"
- * 	"Normal room" -> "Shelf #1"
- * 	"Shelf #1" -> "Normal sound"
- * 	"Shelf #1" -> "Whistle sound"
- * 	"Shelf #1" -> "Finish sound"
- * 	"Shelf #1" -> "Clap sound"
- * }
- * \enddot
+ * The library maps a sample set family (normal, soft, drum), a shelf index,
+ * and a sound type (hit normal, hit clap, slider slide, …) to a sample. The
+ * shelf index is the custom sample index of the beatmap, like the 2 in
+ * `soft-hitclap2.wav`, and the special shelf 0 holds the default samples
+ * of the skin.
+ *
+ * Lookups happen for every hit sound played, so the library is a flat
+ * open-addressing hash table keyed by these three values, rather than a tree
+ * of rooms and shelves. The PCM data of all the samples is stored one after
+ * another in a single buffer.
  *
  * \todo
  * This module should be moved to oshu::skin in the library module.
@@ -51,10 +44,6 @@ struct sample;
  * \todo
  * The audio module should not depend on the beatmap module.
  *
- * \todo
- * The data structure used in this module should just become a simple STL
- * unordered map.
- *
  * \{
  */
 
@@ -70,72 +59,28 @@ enum sound_shelf_index {
 };
 
 /**
- * Each sample in a shelf is a pointer to a sample.
- *
- * These pointers are NULL when no sample is available.
- */
-struct sound_shelf {
-	oshu::sample *hit_normal;
-	oshu::sample *hit_whistle;
-	oshu::sample *hit_finish;
-	oshu::sample *hit_clap;
-	oshu::sample *slider_slide;
-	oshu::sample *slider_whistle;
-};
-
-/**
- * A room is a collection of shelves. Each shelf is indexed by a number. No two
- * shelves may share the same index. The index space is not necessarily
- * contiguous. You may see in practice the default 0 shelf, and some 99 shelf
- * popping out of nowhere.
- *
- * More concretely, a room is a dynamically-sized array of shelves.
+ * An entry of the #oshu::sound_library::table hash table.
  */
-struct sound_room {
+struct sound_slot {
 	/**
-	 * Location of the shelves.
+	 * The sample set, shelf index and sound type packed together.
 	 *
-	 * The elements are sorted in an arbitrary order, so you must use
-	 * #indices to find the shelf you're looking for.
-	 *
-	 * \sa size
+	 * 0 marks an empty slot, because the type is never 0.
 	 */
-	oshu::sound_shelf *shelves;
+	uint64_t key;
 	/**
-	 * Indices of the shelves.
-	 *
-	 * `indices[i]` is the index of `shelves[i]`.
+	 * The sample, or NULL when no sample file was found for the key.
 	 *
-	 * The same index should not appear more than once, and not every index
-	 * may appear.
-	 *
-	 * Since the structure is not indexed beyond that, you have to browse
-	 * the whole array every time you're looking for a specific shelf.
-	 *
-	 * \sa size
+	 * Remembering the missing samples saves looking for them again on the
+	 * filesystem.
 	 */
-	int *indices;
-	/**
-	 * Number of shelves.
-	 *
-	 * This is also the minimum size of the #shelves and #indices arrays.
-	 */
-	int size;
-	/**
-	 * Actual size of the memory block of #shelves and #indices.
-	 *
-	 * Rooms may grow using a spatio-temporal expansion often called
-	 * *realloc*.
-	 */
-	int capacity;
+	oshu::sample *sample;
 };
 
 /**
  * The sound sample library.
  *
- * The library is composed of 3 rooms, one per sample set family.
- *
- * \sa oshu::sample_set_family
+ * The library object must be zero-initalized, or value-initialized.
  */
 struct sound_library {
 	/**
@@ -153,13 +98,50 @@ struct sound_library {
 	 * It may, but should not, end with a trailing slash.
 	 */
 	std::string skin_directory;
+	/**
+	 * Directory where the beatmap's own samples are looked up, or the
+	 * current directory when empty.
+	 *
+	 * Like the current directory, it may be an .osz archive.
+	 */
+	std::string beatmap_directory;
 	/**
 	 * Format of the samples in the library.
 	 */
 	struct SDL_AudioSpec *format;
-	oshu::sound_room normal;
-	oshu::sound_room soft;
-	oshu::sound_room drum;
+	/**
+	 * Hash table of the registered samples, with linear probing.
+	 *
+	 * Its size is a power of 2, and it is kept at most half full.
+	 */
+	std::vector<oshu::sound_slot> table;
+	/**
+	 * Number of used slots in the #table.
+	 */
+	size_t count;
+	/**
+	 * The sample objects the #table points to.
+	 *
+	 * A deque is used so that their address never changes, since the audio
+	 * tracks keep pointers to them.
+	 */
+	std::deque<oshu::sample> samples;
+	/**
+	 * Map the content hash of every loaded file to its sample, so that
+	 * identical files under different names share their data.
+	 */
+	std::unordered_map<uint64_t, oshu::sample*> contents;
+	/**
+	 * Position of each of the #samples in #pcm, in floats.
+	 */
+	std::vector<size_t> offsets;
+	/**
+	 * The PCM data of all the #samples, one after another.
+	 *
+	 * When it grows, the #samples are pointed to the new buffer, so no
+	 * sample must be registered while the audio is playing.
+	 */
+	std::vector<float> pcm;
 };
 
 /**
@@ -204,16 +186,46 @@ void register_sound(oshu::sound_library *library, oshu::hit_sound *sound);
  */
 void populate_library(oshu::sound_library *library, oshu::beatmap *beatmap);
 
+/**
+ * The looping samples started by #oshu::play_sound for one slider.
+ *
+ * \sa oshu::stop_sound
+ */
+struct sound_loops {
+	/**
+	 * Handles returned by #oshu::play_loop, one per sound type.
+	 */
+	int handles[4];
+	int count;
+};
+
 /**
  * Play all the samples associated to the hit sound.
  *
  * If one of the required samples wasn't found, it is ignored.
  *
- * If the sound is for a slider, its sample is looped until you call #oshu::stop_loop.
+ * If the sound is for a slider, its samples are looped until you call
+ * #oshu::stop_sound with *loops*. Any loop previously held by *loops* is
+ * stopped first. Without *loops*, slider sounds are ignored.
  *
  * \sa oshu_find_sample
  */
-void play_sound(oshu::sound_library *library, oshu::hit_sound *sound, oshu::audio *audio);
+void play_sound(oshu::sound_library *library, oshu::hit_sound *sound, oshu::audio *audio, oshu::sound_loops *loops = NULL);
+
+/**
+ * Stop the looping samples started by #oshu::play_sound.
+ */
+void stop_sound(oshu::audio *audio, oshu::sound_loops *loops);
+
+/**
+ * Schedule all the samples associated to the hit sound, to start when the
+ * music reaches *timestamp*.
+ *
+ * Looping slider sounds cannot be scheduled, and are ignored.
+ *
+ * \sa oshu::schedule_sample
+ */
+void schedule_sound(oshu::sound_library *library, oshu::hit_sound *sound, oshu::audio *audio, double timestamp);
 
 /** \} */
 
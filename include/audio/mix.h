@@ -0,0 +1,56 @@
+/**
+ * \file audio/mix.h
+ * \ingroup audio_mix
+ */
+
+#pragma once
+
+namespace oshu {
+
+/**
+ * \defgroup audio_mix Mix
+ * \ingroup audio
+ *
+ * \brief
+ * Vectorized kernels for the audio callback.
+ *
+ * The audio callback spends most of its time adding tracks together and
+ * clipping the result. These loops are tiny but run for every sample of every
+ * track, so they're written with SIMD instructions when the CPU supports them:
+ * AVX2 and FMA, or SSE2 on x86, and NEON on ARM. Otherwise, a scalar version
+ * is used.
+ *
+ * The best implementation is picked once at startup, according to what the
+ * running CPU supports rather than what the compiler targeted, so that a
+ * generic build still uses AVX2 when available.
+ *
+ * The buffers are plain float arrays, and their sizes are expressed in floats,
+ * not in samples per channel.
+ *
+ * \{
+ */
+
+/**
+ * Add `input × volume` to *output*, for *count* floats.
+ *
+ * This operation is called multiply-accumulate (MAC), and dedicated
+ * instructions perform it in a single step, with less rounding error.
+ */
+void mix_samples(float *output, const float *input, float volume, int count);
+
+/**
+ * Clip a buffer of float audio samples to ensure every sample's value is
+ * normalized between -1 and 1.
+ *
+ * Without this, some audio cards emit an awful noise.
+ */
+void clip_samples(float *samples, int count);
+
+/**
+ * Name of the kernels in use, like *avx2* or *scalar*, for diagnostics.
+ */
+const char *mix_kernels();
+
+/** \} */
+
+}
@@ -0,0 +1,114 @@
+/**
+ * \file audio/pcm.h
+ * \ingroup audio_pcm
+ */
+
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <string>
+
+namespace oshu {
+
+/**
+ * \defgroup audio_pcm PCM cache
+ * \ingroup audio
+ *
+ * \brief
+ * Fully decoded music, mapped from the disk.
+ *
+ * Seeking in a compressed stream is slow, and imprecise for formats like MP3.
+ * When the whole song is decoded in advance, seeking is only a matter of
+ * moving a pointer, which makes retries and rewinds instantaneous.
+ *
+ * The decoded samples are saved in `~/.oshu/cache/pcm`, in files named after
+ * the hash of the audio file's content, and ending with `.pcm`. They contain
+ * a small header followed by packed stereo float samples, and are mapped in
+ * memory rather than read.
+ *
+ * Decoded audio is big: about 20 MiB per minute at 44.1 kHz. This is why the
+ * cache is disabled by default, and limited in size. See
+ * #oshu::pcm_cache_limit.
+ *
+ * \{
+ */
+
+/**
+ * A mapped PCM cache file.
+ *
+ * \sa oshu::open_pcm_cache
+ * \sa oshu::close_pcm_cache
+ */
+struct pcm_cache {
+	/**
+	 * The packed stereo samples, `2 * nb_samples` floats long.
+	 */
+	const float *samples;
+	/**
+	 * Number of samples per channel.
+	 */
+	size_t nb_samples;
+	/**
+	 * Sample rate of the decoded audio, in Hz.
+	 */
+	int sample_rate;
+	/**
+	 * The base address and size of the mapping, for unmapping it.
+	 */
+	void *mapping;
+	size_t mapping_size;
+};
+
+/**
+ * Read the maximum size of a PCM cache file, in bytes, from the
+ * *OSHU_PCM_CACHE* environment variable, expressed in MiB.
+ *
+ * Return 0, meaning the cache is disabled, when the variable is unset or
+ * invalid.
+ */
+size_t pcm_cache_limit();
+
+/**
+ * Return the path to the PCM cache file of an audio file decoded at
+ * *sample_rate*, or an empty string if it can't be determined, like when the
+ * audio file is a URL.
+ */
+std::string pcm_cache_path(const char *url, int sample_rate);
+
+/**
+ * Map a PCM cache file, checking it was decoded at *sample_rate*.
+ *
+ * \return 0 on success, -1 on failure, in which case the cache object is left
+ * empty.
+ */
+int open_pcm_cache(const char *path, int sample_rate, oshu::pcm_cache *pcm);
+
+/**
+ * Decode the audio file at *url* entirely, resampled to *sample_rate*, and
+ * save it as a PCM cache file at *path*.
+ *
+ * The file is written atomically. If it would be larger than *max_size*
+ * bytes, the decoding is aborted.
+ *
+ * This may take a few seconds, so it is meant to be run on a background
+ * thread. Set *cancel* to true from another thread to abort it.
+ *
+ * \return 0 on success, -1 on failure or cancellation.
+ */
+int build_pcm_cache(const char *url, const char *path, int sample_rate, size_t max_size, const std::atomic<bool> *cancel);
+
+/**
+ * Copy up to *nb_samples* samples from *position*, and return how many were
+ * copied.
+ */
+size_t read_pcm_cache(oshu::pcm_cache *pcm, size_t position, float *samples, size_t nb_samples);
+
+/**
+ * Unmap the cache file.
+ */
+void close_pcm_cache(oshu::pcm_cache *pcm);
+
+/** \} */
+
+}
@@ -0,0 +1,109 @@
+/**
+ * \file audio/ring.h
+ * \ingroup audio_ring
+ */
+
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+
+namespace oshu {
+
+/**
+ * \defgroup audio_ring Ring
+ * \ingroup audio
+ *
+ * \brief
+ * Pass decoded samples from one thread to another without locking.
+ *
+ * The ring is a circular buffer of packed stereo float samples, with exactly
+ * one writer thread and one reader thread. Neither side ever blocks: writing
+ * to a full ring or reading from an empty one simply transfers fewer samples
+ * than requested.
+ *
+ * This is what lets the audio callback run without calling ffmpeg: a decoder
+ * thread keeps the ring full, and the callback only copies from it.
+ *
+ * Positions are expressed as the total number of samples per channel written
+ * or read since the ring was opened, so that they never wrap around in
+ * practice and can be compared directly.
+ *
+ * \{
+ */
+
+/**
+ * A single-producer, single-consumer ring buffer.
+ *
+ * \sa oshu::open_ring
+ * \sa oshu::close_ring
+ */
+struct sample_ring {
+	/**
+	 * The interleaved samples, `2 * capacity` floats long.
+	 */
+	float *buffer;
+	/**
+	 * Number of samples per channel the ring can hold.
+	 *
+	 * It is a power of 2, so that positions map to indices with a mask.
+	 */
+	size_t capacity;
+	/**
+	 * Position of the next sample to write.
+	 *
+	 * Only the writer modifies it.
+	 */
+	std::atomic<size_t> head;
+	/**
+	 * Position of the next sample to read.
+	 *
+	 * Only the reader modifies it. It never goes past #head.
+	 */
+	std::atomic<size_t> tail;
+};
+
+/**
+ * Allocate a zero-initialized ring for at least *capacity* samples per
+ * channel.
+ *
+ * \return 0 on success, -1 on failure.
+ */
+int open_ring(oshu::sample_ring *ring, size_t capacity);
+
+/**
+ * Copy up to *nb_samples* samples into the ring.
+ *
+ * Only the writer thread may call this function.
+ *
+ * \return The number of samples per channel actually written.
+ */
+size_t write_ring(oshu::sample_ring *ring, const float *samples, size_t nb_samples);
+
+/**
+ * Copy up to *nb_samples* samples out of the ring.
+ *
+ * Only the reader thread may call this function.
+ *
+ * \return The number of samples per channel actually read.
+ */
+size_t read_ring(oshu::sample_ring *ring, float *samples, size_t nb_samples);
+
+/**
+ * Drop every sample before *position*, as if they had been read.
+ *
+ * Positions behind the current #oshu::sample_ring::tail are ignored, and
+ * positions beyond the #oshu::sample_ring::head are clamped to it.
+ *
+ * Only the reader thread may call this function.
+ */
+void skip_ring(oshu::sample_ring *ring, size_t position);
+
+/**
+ * Free the ring's buffer.
+ */
+void close_ring(oshu::sample_ring *ring);
+
+/** \} */
+
+}
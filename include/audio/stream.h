@@ -5,6 +5,8 @@
 
 #pragma once
 
+#include <vector>
+
 /*
  * Forward declaration of the ffmpeg structures to avoid including big headers.
  */
@@ -14,9 +16,12 @@ struct AVStream;
 struct AVCodecContext;
 struct AVFrame;
 struct SwrContext;
+struct AVIOContext;
 
 namespace oshu {
 
+struct stream_source;
+
 /**
  * \defgroup audio_stream Stream
  * \ingroup audio
@@ -31,7 +36,9 @@ namespace oshu {
  * audio is systematically transcoded to a uniform output format:
  *
  * - Stereo output: 2 channels.
- * - The sample rate is the same as the input stream. Usually 44.1 KHz or 48 KHz.
+ * - The sample rate is the one asked for when opening the stream, usually the
+ *   rate of the audio device, or by default the same as the input stream.
+ *   Usually 44.1 KHz or 48 KHz.
  * - The sample format is 32-bit float, also named FLT or F32 for SDL.
  * - The samples are packed, meaning they're interlaced like LRLRLR, as opposed to planar LLLRRR.
  *
@@ -50,6 +57,12 @@ namespace oshu {
  * }
  * \enddot
  *
+ * Finding the stream parameters makes libavformat read and decode the
+ * beginning of the file, which is slow for big FLAC or Vorbis files. The
+ * parameters it finds are saved in `~/.oshu/cache/streams`, keyed by the hash
+ * of the file, so that only the first opening of a file pays for it. The
+ * decoders that support it decode on several threads.
+ *
  * \{
  */
 
@@ -65,6 +78,17 @@ struct stream {
 	 * The libavformat demuxer, handling the I/O aspects.
 	 */
 	struct AVFormatContext *demuxer;
+	/**
+	 * The custom I/O context of the #demuxer, when the file is read from an
+	 * archive, as described in \ref core_vfs.
+	 *
+	 * Otherwise, it's null and ffmpeg opens the file itself.
+	 */
+	struct AVIOContext *io;
+	/**
+	 * The archived file read by #io.
+	 */
+	oshu::stream_source *source;
 	/**
 	 * Pointer to the best audio stream we've found in the media file, from
 	 * the demuxer's point of view.
@@ -111,10 +135,19 @@ struct stream {
 	 * The sample rate of the output stream when read with
 	 * #oshu::read_stream.
 	 *
-	 * It is set by the #converter, and in practice will always be the same
-	 * as the sample rate of the #decoder.
+	 * It is set by the #converter. When it differs from the sample rate of
+	 * the #decoder, the converter resamples every #frame into #resampled.
 	 */
 	int sample_rate;
+	/**
+	 * The current #frame, resampled to #sample_rate, as packed stereo
+	 * samples.
+	 *
+	 * It's only used when resampling, because the resampler doesn't
+	 * produce as many samples as it consumes. Otherwise the frames are
+	 * converted straight into the output of #oshu::read_stream.
+	 */
+	std::vector<float> resampled;
 	/**
 	 * The factor by which we must multiply ffmpeg timestamps to obtain
 	 * seconds. Because it won't change for a given stream, compute it
@@ -164,10 +197,13 @@ struct stream {
  *
  * \param url Path or URL to the media you want to play.
  * \param stream A null-initialized stream object.
+ * \param sample_rate The sample rate to read the stream at, or 0 to keep
+ * the rate of the file. The quality of the resampling is set by the
+ * *OSHU_RESAMPLING* environment variable, to *fast*, *medium* or *best*.
  *
  * \sa oshu::close_stream
  */
-int open_stream(const char *url, oshu::stream *stream);
+int open_stream(const char *url, oshu::stream *stream, int sample_rate = 0);
 
 /**
  * Read *nb_samples* float samples from an audio stream.
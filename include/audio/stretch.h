@@ -0,0 +1,167 @@
+/**
+ * \file audio/stretch.h
+ * \ingroup audio_stretch
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <vector>
+
+struct SwrContext;
+
+namespace oshu {
+
+/**
+ * \defgroup audio_stretch Stretch
+ * \ingroup audio
+ *
+ * \brief
+ * Change the tempo of the music.
+ *
+ * The stretcher sits in the decoder thread, between the music stream and the
+ * ring, so that the audio callback keeps copying samples without doing any
+ * more work. It works in two modes:
+ *
+ * - Without pitch correction, the music is simply resampled by libswresample,
+ *   as if the record was spun faster. The pitch goes up with the tempo.
+ * - With pitch correction, it uses WSOLA: frames of the input are picked every
+ *   *rate* hops and overlapped, each one shifted by a few milliseconds to
+ *   match the waveform of the previous one, so that the overlap doesn't sound
+ *   like an echo.
+ *
+ * In both modes, the *n*-th output sample matches the input sample
+ * *n × rate*, so a position in the output maps to a music timestamp without
+ * any delay to compensate.
+ *
+ * At a rate of 1, the stretcher does nothing, and the samples don't go
+ * through it at all.
+ *
+ * \{
+ */
+
+/**
+ * State of the time-stretching stage.
+ *
+ * \sa oshu::open_stretcher
+ * \sa oshu::close_stretcher
+ */
+struct stretcher {
+	/**
+	 * Tempo of the output relative to the input. 1.5 makes the music play
+	 * 50% faster.
+	 */
+	double rate;
+	/**
+	 * Whether the pitch is preserved with WSOLA, rather than changed with
+	 * the tempo.
+	 */
+	bool keep_pitch;
+	/**
+	 * Resampler, when the pitch isn't preserved.
+	 */
+	struct SwrContext *resampler;
+	/**
+	 * Number of samples per channel between two WSOLA frames in the
+	 * output, which is half a frame.
+	 */
+	int hop;
+	/**
+	 * How far, in samples per channel, a WSOLA frame may be shifted from
+	 * its nominal position to match the previous one.
+	 */
+	int tolerance;
+	/**
+	 * The first half of a Hann window of `2 * hop` samples. The second half
+	 * is 1 minus the first, so that overlapped frames sum to 1.
+	 */
+	std::vector<float> window;
+	/**
+	 * Packed stereo input samples the WSOLA frames are taken from.
+	 */
+	std::vector<float> input;
+	/**
+	 * Nominal position of the next frame in #input, in samples per
+	 * channel. It advances by `hop * rate` at every frame.
+	 */
+	double nominal;
+	/**
+	 * Position in #input of the continuation of the previous frame, which
+	 * the next frame is matched against.
+	 *
+	 * It is negative before the first frame.
+	 */
+	long natural;
+	/**
+	 * Windowed second half of the previous frame, to add to the first half
+	 * of the next one.
+	 */
+	std::vector<float> overlap;
+	/**
+	 * Packed stereo samples ready to be read with #oshu::read_stretcher.
+	 */
+	std::vector<float> output;
+	/**
+	 * Number of samples per channel of #output already read.
+	 */
+	size_t output_read;
+	/**
+	 * Set by #oshu::flush_stretcher, when no more input will come.
+	 */
+	bool flushed;
+};
+
+/**
+ * Prepare a stretcher for stereo float samples at *sample_rate*.
+ *
+ * \return 0 on success, -1 on error.
+ */
+int open_stretcher(oshu::stretcher *stretcher, int sample_rate, double rate, bool keep_pitch);
+
+/**
+ * Whether the samples must go through the stretcher, which is when the rate
+ * isn't 1.
+ */
+bool stretching(oshu::stretcher *stretcher);
+
+/**
+ * Stretch *nb_samples* input samples per channel.
+ *
+ * The resulting samples are read with #oshu::read_stretcher.
+ *
+ * \return 0 on success, -1 on error.
+ */
+int feed_stretcher(oshu::stretcher *stretcher, const float *samples, int nb_samples);
+
+/**
+ * Signal the end of the input, and output whatever the stretcher still has.
+ */
+int flush_stretcher(oshu::stretcher *stretcher);
+
+/**
+ * Copy up to *nb_samples* samples per channel of stretched output into
+ * *samples*.
+ *
+ * \return The number of samples per channel read.
+ */
+int read_stretcher(oshu::stretcher *stretcher, float *samples, int nb_samples);
+
+/**
+ * Whether the stretcher was flushed and all its output read.
+ */
+bool stretcher_drained(oshu::stretcher *stretcher);
+
+/**
+ * Drop everything buffered, to start stretching another part of the music,
+ * like after a seek.
+ */
+int reset_stretcher(oshu::stretcher *stretcher);
+
+/**
+ * Free the resampler and the buffers.
+ */
+void close_stretcher(oshu::stretcher *stretcher);
+
+/** \} */
+
+}
@@ -20,6 +20,9 @@ struct sample;
  * dumb data buffers, a track remembers its position, its volume, and is able
  * to loop the sample.
  *
+ * Changing the volume of a track abruptly makes an audible click, so volume
+ * changes may be spread over a few milliseconds with #oshu::ramp_track.
+ *
  * Multiple tracks may share the same sample.
  *
  * \{
@@ -60,6 +63,32 @@ struct track {
 	 * #oshu::stop_track is called.
 	 */
 	int loop;
+	/**
+	 * Number of samples per channel to leave untouched before the sample
+	 * starts.
+	 *
+	 * This lets a sample start in the middle of a buffer passed to
+	 * #oshu::mix_track, rather than at its beginning. It is reset to 0 by
+	 * #oshu::start_track.
+	 */
+	int delay;
+	/**
+	 * Number of samples per channel left before the end of the current
+	 * volume ramp, or 0 when the volume is stable.
+	 *
+	 * \sa oshu::ramp_track
+	 */
+	int ramp_left;
+	/**
+	 * Volume change per sample during a ramp.
+	 */
+	float ramp_step;
+	/**
+	 * Volume at the end of the ramp.
+	 *
+	 * When it is 0, the track stops once the ramp is over.
+	 */
+	float ramp_target;
 };
 
 /**
@@ -81,6 +110,16 @@ void start_track(oshu::track *track, oshu::sample *sample, float volume, int loo
  */
 void stop_track(oshu::track *track);
 
+/**
+ * Change the volume of a track linearly over *nb_samples* samples per channel.
+ *
+ * If the target volume is 0, the track stops at the end of the ramp, which is
+ * how looping samples fade out.
+ *
+ * When *nb_samples* is 0 or less, the volume changes immediately.
+ */
+void ramp_track(oshu::track *track, float volume, int nb_samples);
+
 /**
  * Mix a track on top of an audio stream.
  *
@@ -89,15 +128,17 @@ void stop_track(oshu::track *track);
  * The *samples* buffer must contain at least 2 × *nb_samples* floats, already
  * filled with audio data. The samples of the track are added on top of it.
  *
- * The operation performed for mixing the samples is called multiply-accumulate
- * (MAC) and when dealing with audio, there are specialized hardware units to
- * handle it. The *fmaf* function in math.h should be able to perform the
- * operation in a single step, with less rounding error.
+ * The samples are mixed with #oshu::mix_samples, which uses the CPU's vector
+ * instructions when available.
+ *
+ * If the track has a #oshu::track::delay, the beginning of the buffer is
+ * skipped first. During a volume ramp, the samples are mixed one by one, but
+ * ramps are short.
  *
  * \return
- * The number of samples per channel that were added to the buffer. It may be 0
- * when the stream is inactive, or less than *nb_samples* when the sample has
- * reached an end.
+ * The number of samples per channel that were added to the buffer, counting
+ * the skipped ones. It may be 0 when the stream is inactive, or less than
+ * *nb_samples* when the sample has reached an end.
  */
 int mix_track(oshu::track *track, float *samples, int nb_samples);
 
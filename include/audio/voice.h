@@ -0,0 +1,136 @@
+/**
+ * \file audio/voice.h
+ * \ingroup audio_voice
+ */
+
+#pragma once
+
+#include "audio/track.h"
+
+#include <vector>
+
+namespace oshu {
+
+/**
+ * \defgroup audio_voice Voice
+ * \ingroup audio
+ *
+ * \brief
+ * Allocate tracks for the sound effects.
+ *
+ * A voice is a track that can be allocated for playing one sample. Voices come
+ * from a pool whose size is set once, so that the audio callback never
+ * allocates memory.
+ *
+ * When every voice is taken, a new sample steals the oldest voice of the
+ * lowest priority. Finish sounds are protected from normal hit sounds, because
+ * cutting them off is what's most noticeable, and looping sounds are never
+ * stolen.
+ *
+ * Both allocating and releasing a voice take constant time: free voices are
+ * kept in a free list, and active ones in one list per priority, sorted by
+ * age.
+ *
+ * \{
+ */
+
+/**
+ * Voice priorities, from the least to the most important.
+ */
+enum voice_priority {
+	/**
+	 * Regular hit sounds.
+	 */
+	NORMAL_VOICE = 0,
+	/**
+	 * Sounds that only normal voices may not steal, like finishes.
+	 */
+	PROTECTED_VOICE = 1,
+	/**
+	 * Looping sounds, which are never stolen.
+	 */
+	LOOPING_VOICE = 2,
+};
+
+/**
+ * Number of #oshu::voice_priority levels.
+ */
+static const int voice_priorities = 3;
+
+/**
+ * One voice of a #oshu::voice_pool.
+ */
+struct voice {
+	oshu::track track;
+	oshu::voice_priority priority;
+	/**
+	 * Whether the voice is in use.
+	 */
+	bool active;
+	/**
+	 * Neighbours in the active list of the voice's priority, or in the
+	 * free list, as indices in #oshu::voice_pool::voices.
+	 *
+	 * -1 marks the end of a list.
+	 */
+	int previous;
+	int next;
+};
+
+/**
+ * A fixed-size set of voices.
+ *
+ * \sa oshu::open_voice_pool
+ */
+struct voice_pool {
+	std::vector<oshu::voice> voices;
+	/**
+	 * First free voice, or -1.
+	 */
+	int free;
+	/**
+	 * Oldest and newest active voices for each priority, or -1.
+	 */
+	int oldest[voice_priorities];
+	int newest[voice_priorities];
+};
+
+/**
+ * Allocate a pool of *size* voices, all free.
+ */
+void open_voice_pool(oshu::voice_pool *pool, int size);
+
+/**
+ * Take a voice to play a sample with the given priority, and return its
+ * index.
+ *
+ * If no voice is free, the oldest voice of the lowest priority not higher than
+ * *priority* is stopped and reused. Looping voices are never reused.
+ *
+ * The track of the voice must be started by the caller.
+ *
+ * \return The index of the voice, or -1 if every voice is more important.
+ */
+int acquire_voice(oshu::voice_pool *pool, oshu::voice_priority priority);
+
+/**
+ * Return a voice to the free list.
+ */
+void release_voice(oshu::voice_pool *pool, int index);
+
+/**
+ * Mix all the active voices into *samples*, and release the ones that are
+ * done playing.
+ *
+ * \sa oshu::mix_track
+ */
+void mix_voices(oshu::voice_pool *pool, float *samples, int nb_samples);
+
+/**
+ * Stop and release every voice.
+ */
+void stop_voices(oshu::voice_pool *pool);
+
+/** \} */
+
+}
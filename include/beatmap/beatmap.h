@@ -6,6 +6,7 @@
 #pragma once
 
 #include "beatmap/path.h"
+#include "core/arena.h"
 
 namespace oshu {
 
@@ -538,11 +539,9 @@ struct hit {
 	/**
 	 * Graphical texture for the hit object.
 	 *
-	 * It is up to the game module to decide how to allocate it, draw it,
-	 * and free it.
-	 *
-	 * \todo
-	 * The GUI module should manage its own texture cache.
+	 * It is up to the UI module to decide how to allocate it, draw it,
+	 * and free it. The osu! view keeps the slider textures in a
+	 * #oshu::texture_cache.
 	 */
 	oshu::texture *texture;
 	/**
@@ -775,6 +774,15 @@ struct difficulty {
 	 * size and whatever other variable.
 	 */
 	double slider_tolerance;
+	/**
+	 * Number of columns of an osu!mania beatmap.
+	 *
+	 * osu!mania reuses the `CircleSize` field for it, in which case the
+	 * #circle_radius keeps its default value.
+	 *
+	 * Defaults to 4.
+	 */
+	int key_count;
 };
 
 /**
@@ -854,7 +862,8 @@ struct beatmap {
 	 */
 	enum oshu::sample_set_family sample_set;
 	/**
-	 * The game mode. Today, only the standard osu! game is supported.
+	 * The game mode. Today, only the standard osu! game and osu!mania are
+	 * supported.
 	 *
 	 * It is written as a number between 0 and 3, and matches the values in
 	 * #oshu::mode.
@@ -874,18 +883,44 @@ struct beatmap {
 	 * It is extracted from the [Events] section, with a line looking like
 	 * `0,0,"BG.jpg",0,0`.
 	 *
-	 * The section may contain other effects and break information, but
-	 * until we figure it out, let's keep only this crucial property.
+	 * The section may contain break information, which is ignored, and
+	 * the storyboard, which is loaded separately by #oshu::read_storyboard.
 	 *
 	 * May be NULL.
 	 */
 	char *background_filename;
+	/**
+	 * \brief Path to the background video.
+	 *
+	 * It is extracted from the [Events] section, with a line looking like
+	 * `Video,-200,"video.avi"`.
+	 *
+	 * May be NULL.
+	 */
+	char *video_filename;
+	/**
+	 * \brief When the video starts, in seconds.
+	 *
+	 * It may be negative, in which case the video is already playing when
+	 * the song starts.
+	 */
+	double video_offset;
 	/**
 	 * \brief [TimingPoints] section.
 	 *
 	 * It's a linked list, in chronological order.
 	 */
 	oshu::timing_point *timing_points;
+	/**
+	 * Array of all the #timing_points, in the same chronological order.
+	 *
+	 * It allows dichotomic searches with #oshu::timing_at.
+	 */
+	oshu::timing_point **timing_index;
+	/**
+	 * Number of timing points, which is the size of #timing_index.
+	 */
+	int timing_point_count;
 	/**
 	 * \brief [Colours] section.
 	 *
@@ -910,6 +945,28 @@ struct beatmap {
 	 * is never null.
 	 */
 	oshu::hit *hits;
+	/**
+	 * \brief Content of the beatmap file, as read by the loader.
+	 *
+	 * The parser splits it into lines in place, and every string of the
+	 * beatmap, including #audio_filename, #background_filename and the
+	 * #metadata, points inside it. These strings must therefore not be
+	 * freed individually, nor outlive the beatmap.
+	 */
+	char *contents;
+	/**
+	 * \brief Storage for the timing points, colors and hit objects.
+	 *
+	 * All the objects of the #timing_points, #colors and #hits lists are
+	 * allocated from this arena, and freed at once by
+	 * #oshu::destroy_beatmap. They are usually contiguous in memory.
+	 */
+	oshu::arena arena;
+	/**
+	 * The bytes allocated outside of the #arena, like the #contents and the
+	 * slider paths, as accounted by #oshu::track_beatmap_memory.
+	 */
+	size_t memory;
 };
 
 /**
@@ -920,6 +977,16 @@ struct beatmap {
  */
 int load_beatmap(const char *path, oshu::beatmap *beatmap);
 
+/**
+ * Parse a beatmap from memory, like #oshu::load_beatmap does from a file.
+ *
+ * The *size* bytes of *data* are copied, and need not be null-terminated.
+ * *name* only appears in the log messages.
+ *
+ * This is the entry point of the parser's fuzzing target.
+ */
+int parse_beatmap(const char *data, size_t size, const char *name, oshu::beatmap *beatmap);
+
 /**
  * Parse the first sections of a beatmap to get the metadata and difficulty
  * information.
@@ -937,15 +1004,41 @@ int load_beatmap(const char *path, oshu::beatmap *beatmap);
  *
  * The aim of this function, compared to #oshu::load_beatmap, is not to load the
  * timing points, colors, and hit objects, which contain most of the beatmap's
- * data.
+ * data. Their lists are left NULL, including the sentinel hits.
+ *
+ * It is implemented with an #oshu::builder that stops the parser right after
+ * the headers.
  */
 int load_beatmap_headers(const char *path, oshu::beatmap *beatmap);
 
+/**
+ * Account for the memory of a loaded beatmap outside of its arena, in the
+ * beatmap category of \ref core_memory: the *contents_size* bytes of its
+ * #oshu::beatmap::contents, and the sounds and paths of its sliders.
+ *
+ * The loaders call it once the hits are complete, and #oshu::destroy_beatmap
+ * releases it.
+ */
+void track_beatmap_memory(oshu::beatmap *beatmap, size_t contents_size);
+
 /**
  * Free any object dynamically allocated inside the beatmap.
  */
 void destroy_beatmap(oshu::beatmap *beatmap);
 
+/**
+ * Find the timing point in effect at *t*, in seconds.
+ *
+ * This is the last timing point whose offset is lower or equal to *t*. Before
+ * the first timing point, return the first one. If the beatmap has no timing
+ * points, return NULL.
+ *
+ * It performs a dichotomic search in #oshu::beatmap::timing_index, in
+ * logarithmic time. If you query increasing times, like the game does, pass
+ * the previous result as *hint* to make it constant time in the common case.
+ */
+oshu::timing_point* timing_at(oshu::beatmap *beatmap, double t, oshu::timing_point *hint = nullptr);
+
 /**
  * Return a numeric value between 0 (no hits) and 1 (perfect) based on the
  * player's hit/miss ratio.
@@ -0,0 +1,121 @@
+/**
+ * \file beatmap/builder.h
+ * \ingroup beatmap
+ */
+
+#pragma once
+
+#include "beatmap/beatmap.h"
+
+namespace oshu {
+
+/**
+ * \ingroup beatmap
+ * \{
+ */
+
+/**
+ * SAX-like interface to the beatmap parser.
+ *
+ * Rather than building the whole #oshu::beatmap, the parser emits events as it
+ * reads the file, and lets the builder decide what to keep. This makes it easy
+ * to build a fast parser that, say, only stores the metadata.
+ *
+ * The key-value sections, namely [General], [Metadata] and [Difficulty], are
+ * still parsed into the #oshu::beatmap passed to #oshu::load_beatmap, because
+ * they're cheap and later sections depend on them. Likewise for the
+ * background of the [Events] section.
+ *
+ * The parser keeps no copy of the objects it emits, so builders that wish to
+ * receive hit objects must store the timing points and colors, because every
+ * hit refers to one of each.
+ *
+ * Every callback is optional.
+ */
+struct builder {
+
+	virtual ~builder() = default;
+
+	/**
+	 * Called once the beatmap headers are parsed, that is when one of the
+	 * [TimingPoints], [Colours] or [HitObjects] sections begins, or at the
+	 * end of the file if none of them was found.
+	 *
+	 * Return false to stop the parsing right there.
+	 */
+	virtual bool headers(oshu::beatmap&) { return true; }
+
+	/**
+	 * Hint that up to *count* timing points are about to be emitted.
+	 *
+	 * The count is the number of lines of the [TimingPoints] section, so
+	 * it is an upper bound, though usually a tight one. Use it to
+	 * preallocate your storage.
+	 */
+	virtual void expect_timing_points(size_t) {}
+
+	/**
+	 * Like #expect_timing_points, for the [HitObjects] section.
+	 */
+	virtual void expect_hit_objects(size_t) {}
+
+	/**
+	 * Receive a new timing point, in chronological order.
+	 *
+	 * The beat duration of inherited timing points is already resolved,
+	 * and its #oshu::timing_point::next field is NULL.
+	 *
+	 * Return the address of the stored timing point, which must remain
+	 * valid until the end of the parsing, or NULL to drop it. Hit objects
+	 * will only ever refer to stored timing points.
+	 */
+	virtual oshu::timing_point* timing_point(const oshu::timing_point&) { return nullptr; }
+
+	/**
+	 * Receive a new combo color, in index order.
+	 *
+	 * Like #timing_point, return the address of the stored color, or NULL.
+	 *
+	 * When the beatmap defines no color, a default one is generated before
+	 * the first hit object.
+	 */
+	virtual oshu::color* color(const oshu::color&) { return nullptr; }
+
+	/**
+	 * Receive a new hit object, in chronological order.
+	 *
+	 * Its #oshu::hit::timing_point and #oshu::hit::color fields point to
+	 * objects previously returned by #timing_point and #color. The
+	 * #oshu::hit::previous and #oshu::hit::next fields are NULL.
+	 *
+	 * The hit lives in a scratch buffer of the parser. To keep it, copy it
+	 * bitwise into your own storage and return true: you then own its
+	 * slider path and sounds. Otherwise, return false and the parser will
+	 * free them.
+	 */
+	virtual bool hit_object(oshu::hit&) { return false; }
+
+	/**
+	 * Called at the end of the parsing, whether it succeeded or not,
+	 * unless #headers asked to stop.
+	 */
+	virtual void end() {}
+
+};
+
+/**
+ * Take a path to a `.osu` file, open it and parse it, emitting the parser's
+ * events to *builder*.
+ *
+ * The beatmap receives the header sections, and owns the strings they
+ * contain. Whether the loading succeeded or not, destroy it with
+ * #oshu::destroy_beatmap when done, along with any object your builder has
+ * stored in it.
+ *
+ * Return 0 on success, -1 on failure.
+ */
+int load_beatmap(const char *path, oshu::beatmap *beatmap, oshu::builder *builder);
+
+/** \} */
+
+}
@@ -0,0 +1,76 @@
+/**
+ * \file beatmap/cache.h
+ * \ingroup beatmap_cache
+ */
+
+#pragma once
+
+#include "beatmap/beatmap.h"
+
+namespace oshu {
+
+/**
+ * \defgroup beatmap_cache Cache
+ * \ingroup beatmap
+ *
+ * \brief
+ * Binary serialization of parsed beatmaps.
+ *
+ * Parsing a beatmap, in particular normalizing its slider paths, takes time.
+ * This module saves fully-parsed beatmaps in a compact binary format, whose
+ * files end with `.oshub`, so that the next load is hardly more than reading
+ * the file.
+ *
+ * The cache files live in `~/.oshu/cache/beatmaps`, and are named after the
+ * content hash of the .osu file they were built from, so each beatmap keeps
+ * its cache when it's moved, copied, or read from an archive. The hash is
+ * also recorded in the file, and checked against the .osu file's when
+ * loading, which is cheap because #oshu::hash_file remembers it.
+ *
+ * The format is not portable, and is only meant to be read by the same build
+ * of oshu! that wrote it. A stale or unreadable cache file is never an error:
+ * the caller just falls back to parsing the .osu file.
+ *
+ * \{
+ */
+
+/**
+ * Write a beatmap to a cache file.
+ *
+ * It must be called right after loading the beatmap, because the game state
+ * stored in the hits isn't saved.
+ *
+ * The file is written atomically, so that concurrent readers never see a
+ * partial file.
+ *
+ * Return 0 on success, -1 on failure.
+ */
+int save_beatmap_cache(const char *cache_path, const char *source_path, oshu::beatmap *beatmap);
+
+/**
+ * Load a beatmap from a cache file, if it is still fresh with respect to the
+ * .osu file at *source_path*.
+ *
+ * The beatmap must be destroyed with #oshu::destroy_beatmap, like the ones
+ * created with #oshu::load_beatmap.
+ *
+ * Return 0 on success, -1 if the cache could not be used, in which case the
+ * beatmap is left empty.
+ */
+int load_beatmap_cache(const char *cache_path, const char *source_path, oshu::beatmap *beatmap);
+
+/**
+ * Load a beatmap through the cache.
+ *
+ * If a fresh cache file exists, use it. Otherwise, parse the beatmap with
+ * #oshu::load_beatmap and refresh the cache. When the cache directory is not
+ * available, this is the same as #oshu::load_beatmap.
+ *
+ * Set the *OSHU_BEATMAP_CACHE* environment variable to *0* to disable the
+ * cache altogether.
+ */
+int load_cached_beatmap(const char *path, oshu::beatmap *beatmap);
+
+/** \} */
+
+}
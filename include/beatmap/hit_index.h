@@ -0,0 +1,160 @@
+/**
+ * \file beatmap/hit_index.h
+ * \ingroup beatmap_hit_index
+ */
+
+#pragma once
+
+#include "beatmap/beatmap.h"
+
+#include <stdint.h>
+#include <vector>
+
+namespace oshu {
+
+/**
+ * \defgroup beatmap_hit_index Hit index
+ * \ingroup beatmap
+ *
+ * \brief
+ * Find hits by time and position without walking the list.
+ *
+ * The hits of a beatmap form a linked list sorted by time, which is perfect
+ * for the game loop, but makes any search linear. Marathon maps, or dense
+ * streams with all their objects stacked, leave dozens of hits in the time
+ * window of a click.
+ *
+ * The index is built once after loading the beatmap. It stores the list in an
+ * array, along with the start times for dichotomic searches, and puts the
+ * clickable hits in a coarse uniform grid, so that a click only looks at the
+ * hits near the cursor.
+ *
+ * It also mirrors the few fields of the hits that the game reads at every
+ * frame, in parallel arrays: times, positions, types and states. A #oshu::hit
+ * is a few hundred bytes because of its slider and sound data, so filtering
+ * the hits through the arrays touches a handful of cache lines instead of one
+ * or more per hit, and the loops over them are simple enough to vectorize.
+ * The states change during the game, and the mirror must be kept in sync with
+ * #oshu::sync_hit_state.
+ *
+ * \{
+ */
+
+struct hit_index {
+	/**
+	 * All the hits of the beatmap, including the two sentinels, in order.
+	 */
+	std::vector<oshu::hit*> hits;
+	/**
+	 * The start time of every hit in #hits.
+	 */
+	std::vector<double> times;
+	/**
+	 * For every hit in #hits, the highest end time among it and all the
+	 * hits before it.
+	 *
+	 * End times are not sorted, because long spinners and sliders overlap
+	 * the next hits. This running maximum is sorted, though.
+	 */
+	std::vector<double> end_times;
+	/**
+	 * The end time of every hit in #hits, as returned by
+	 * #oshu::hit_end_time.
+	 */
+	std::vector<double> ends;
+	/**
+	 * The position of every hit in #hits.
+	 */
+	std::vector<float> xs;
+	std::vector<float> ys;
+	/**
+	 * The #oshu::hit::type of every hit in #hits.
+	 */
+	std::vector<int> types;
+	/**
+	 * A copy of the #oshu::hit::state of every hit in #hits.
+	 */
+	std::vector<uint8_t> states;
+	/**
+	 * Top-left corner of the grid, in osu! pixels.
+	 */
+	oshu::point origin;
+	/**
+	 * Width and height of a cell, in osu! pixels.
+	 */
+	double cell_size;
+	int columns;
+	int rows;
+	/**
+	 * For every cell, in row-major order, the indices in #hits of the
+	 * circles and sliders whose start circle overlaps the cell, in
+	 * increasing order.
+	 */
+	std::vector<std::vector<int>> cells;
+};
+
+/**
+ * Index the hits of a loaded beatmap.
+ *
+ * The index holds pointers to the hits, so it is valid as long as the beatmap
+ * is.
+ */
+void build_hit_index(oshu::beatmap *beatmap, oshu::hit_index *index);
+
+/**
+ * Return the position of a hit in #oshu::hit_index::hits, or -1 if it's not
+ * there.
+ */
+int hit_position(const oshu::hit_index *index, const oshu::hit *hit);
+
+/**
+ * Copy the current state of a hit into #oshu::hit_index::states.
+ *
+ * Call it whenever the state of a hit changes.
+ */
+void sync_hit_state(oshu::hit_index *index, const oshu::hit *hit);
+
+/**
+ * Find the range of hits that may be visible between *start* and *end*,
+ * as positions in #oshu::hit_index::hits.
+ *
+ * Every hit that ends after *start* and starts before *end* is in the [*first*,
+ * *last*) range. Hits in that range may still fall outside the window,
+ * because they ended before *start* although a longer hit before them didn't,
+ * so check #oshu::hit_index::ends too.
+ */
+void hit_range(const oshu::hit_index *index, double start, double end, int *first, int *last);
+
+/**
+ * Find the first hit whose end time is greater or equal to *t*.
+ *
+ * Return the end sentinel if there's none.
+ */
+oshu::hit* first_hit_ending_after(const oshu::hit_index *index, double t);
+
+/**
+ * Find the first hit starting exactly at *t*, or else the last hit starting
+ * before *t*.
+ *
+ * Return the start sentinel if there's none.
+ */
+oshu::hit* last_hit_starting_before(const oshu::hit_index *index, double t);
+
+/**
+ * Find the oldest circle or slider in the #oshu::INITIAL_HIT state, whose
+ * start time is in the [*start*, *end*] range, and whose center is at most
+ * *radius* pixels away from *p*.
+ *
+ * The *start* bound applies to the end time of the hits, like in
+ * #oshu::first_hit_ending_after.
+ *
+ * *radius* must not exceed the circle radius of the beatmap the index was
+ * built for.
+ *
+ * Return NULL if no hit matches.
+ */
+oshu::hit* find_hit_at(const oshu::hit_index *index, oshu::point p, double radius, double start, double end);
+
+/** \} */
+
+}
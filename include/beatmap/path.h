@@ -189,19 +189,50 @@ struct bezier {
 	 */
 	std::vector<oshu::point> control_points;
 	/**
-	 * Translation map from l-coordinates to t-coordinates.
+	 * \brief Cumulative lengths of the segments, in pixels.
 	 *
-	 * Let's say we have n pieces, and n+1 anchors. Then for every 0 ≤ i ≤ n,
-	 * `anchors[i]` holds the t-coordinate for the point at l = i / n.
+	 * `lengths[i]` is the length of the path from its start to the start
+	 * of the *i*th segment, so there are as many entries as in #indices,
+	 * and the last one is the length of the whole curve, including the
+	 * segment added when the path had to be extended.
 	 *
-	 * For any point such that i / n ≤ l ≤ (i + 1) / n, compute a weighted
-	 * average between anchors[i] and anchors[i+1].
+	 * The lengths are integrated once with a Gauss–Legendre quadrature,
+	 * so finding the segment at some distance is a binary search.
 	 *
 	 * \sa oshu::normalize_path
 	 */
-	std::array<double, 64> anchors;
+	std::vector<double> lengths;
+	/**
+	 * The length of the slider, which is l = 1.
+	 *
+	 * It is shorter than the last of #lengths when the curve is cut.
+	 */
+	double length;
+	/**
+	 * \brief Points of the path, uniformly spaced in l-coordinates.
+	 *
+	 * For n points, `lut[i]` is the point at l = i / (n - 1), such that
+	 * #oshu::path_at only needs to interpolate linearly between two entries.
+	 * The spacing between two points is about #lut_spacing pixels.
+	 *
+	 * It is built by #oshu::normalize_path, from #lengths. When it's empty,
+	 * #oshu::path_at falls back on evaluating the curve.
+	 */
+	std::vector<oshu::point> lut;
 };
 
+/**
+ * Target distance in pixels between two consecutive points of
+ * #oshu::bezier::lut.
+ *
+ * Interpolating linearly between two points of a curve of radius r that are h
+ * pixels apart deviates from the curve by at most h² / 8r. For h = 2 and the
+ * tightest curves you'd see on a slider, about 10 pixels of radius, this is
+ * 0.05 pixel. On the test beatmap, the table never strays more than 0.15 pixel
+ * from the direct evaluation, which is invisible at any slider size.
+ */
+static const double lut_spacing = 2.;
+
 /**
  * The curve types for a slider.
  *
@@ -239,6 +270,16 @@ struct path {
 		oshu::arc arc; /**< For #oshu::PERFECT_PATH. */
 		oshu::bezier bezier; /**< For #oshu::BEZIER_PATH. */
 	};
+	/**
+	 * The path flattened into a polyline by #oshu::flatten_path.
+	 *
+	 * The #oshu::line::distance of each point is its l-coordinate on the
+	 * curve, so that walking the polyline follows the slider's timing.
+	 *
+	 * Unlike the union above, it must be constructed before the type is set,
+	 * because #oshu::path_at and the destructors depend on it.
+	 */
+	oshu::line polyline;
 };
 
 /**
@@ -253,6 +294,36 @@ struct path {
  */
 void normalize_path(oshu::path *path, double length);
 
+/**
+ * Count the bytes held by the vectors of a path, including its polyline, for
+ * \ref core_memory.
+ *
+ * *allocations* is incremented for every vector holding memory.
+ */
+size_t path_memory(const oshu::path *path, int *allocations);
+
+/**
+ * Maximum distance in pixels between a flattened path and the actual curve.
+ *
+ * This is what #oshu::normalize_path uses.
+ */
+static const double flatten_tolerance = .25;
+
+/**
+ * Approximate the path with a polyline, and store it in
+ * #oshu::path::polyline.
+ *
+ * The curve is recursively split in halves until the middle of every piece is
+ * no further than *tolerance* pixels from the chord, so that straight parts
+ * get few points and tight curves many.
+ *
+ * This polyline is what the game uses to draw the slider and follow the
+ * slider ball. It is computed
+ * once, by #oshu::normalize_path, so you only need to call this function if
+ * you want another tolerance.
+ */
+void flatten_path(oshu::path *path, double tolerance);
+
 /**
  * Express the path in floating t-coordinates.
  *
@@ -290,9 +361,23 @@ void normalize_path(oshu::path *path, double length);
  * This behavior is obtained by taking the absolute value of the `remainder`,
  * defined in the C standard library, by 2.
  *
+ * When the path was flattened, the point is taken from the polyline, to match
+ * exactly what is drawn on screen.
+ *
  */
 oshu::point path_at(oshu::path *path, double t);
 
+/**
+ * Compute `out[i] = path_at(path, t[i])` for the *n* values of *t*.
+ *
+ * The type of the path is looked at once for the whole batch, rather than for
+ * every point. When *t* grows from one point to the next, which is how
+ * sliders are usually sampled, the point is found by walking the polyline from
+ * the previous one instead of searching it from scratch, making the whole
+ * batch linear in the size of the polyline plus *n*.
+ */
+void path_at_many(oshu::path *path, const double *t, oshu::point *out, size_t n);
+
 /**
  * Compute the smallest box such that the path fits in.
  *
@@ -304,6 +389,10 @@ oshu::point path_at(oshu::path *path, double t);
  * 1. ∀t real(top_left) ≤ real(at(t)) ≤ real(bottom_right)
  * 2. ∀t imag(top_left) ≤ imag(at(t)) ≤ imag(bottom_right)
  *
+ * The box is computed from the curve, not from its polyline: the boxes of the
+ * Bézier curves and of the arcs come exactly from their extrema, rather than
+ * from their control points. Since the points of the polyline are on the
+ * curve, the box contains it too.
  */
 void path_bounding_box(oshu::path *path, oshu::point *top_left, oshu::point *bottom_right);
 
@@ -0,0 +1,140 @@
+/**
+ * \file beatmap/stars.h
+ * \ingroup beatmap_stars
+ */
+
+#pragma once
+
+#include "beatmap/beatmap.h"
+
+#include <vector>
+
+namespace oshu {
+
+/**
+ * \defgroup beatmap_stars Star rating
+ * \ingroup beatmap
+ *
+ * \brief
+ * Compute the difficulty of a beatmap from its hit objects.
+ *
+ * The overall difficulty declared by the beatmap only affects the timing
+ * windows, and says little about how hard the beatmap is. The star rating is
+ * computed instead from the spacing and timing of the objects, after the
+ * strain model osu! used in 2019:
+ *
+ * - Every object adds to two strains, one for *aim*, growing with the distance
+ *   the cursor travels, and one for *speed*, growing with the tapping rate.
+ *   Both decay exponentially over time.
+ * - The strains are sampled at their peak every 400 ms, and the peaks are
+ *   summed from the highest down, with geometrically decreasing weights, so
+ *   that the hardest parts of the beatmap weigh the most.
+ * - The two skills are then combined into the star rating, between 0 and 10
+ *   for most beatmaps.
+ *
+ * The slider's cursor movement is measured on their flattened path, with a
+ * cursor that only moves as much as needed to stay within the follow circle.
+ *
+ * Distances are normalized to a circle radius of 52 osu!pixels, so that the
+ * rating doesn't depend on the circle size. Spinners are ignored.
+ *
+ * The rating is computed incrementally, hit after hit, so that it can be fed
+ * by a #oshu::builder without storing the hits.
+ *
+ * \{
+ */
+
+/**
+ * Version of the star rating algorithm.
+ *
+ * Increment it whenever the results change, to invalidate the ratings cached
+ * in the library manifest.
+ */
+static const int star_rating_version = 1;
+
+/**
+ * One of the skills the star rating is made of.
+ */
+struct strain {
+	/**
+	 * How much an object adds to the strain, for a difficulty of 1.
+	 */
+	double multiplier;
+	/**
+	 * What remains of the strain after one second.
+	 */
+	double decay;
+	double value = 0;
+	/**
+	 * Time of the last object, in milliseconds.
+	 */
+	double last_time = 0;
+	/**
+	 * End of the current section, in milliseconds.
+	 */
+	double section_end = 0;
+	/**
+	 * Highest strain in the current section.
+	 */
+	double peak = 0;
+	/**
+	 * Peak strain of every finished section.
+	 */
+	std::vector<double> peaks;
+};
+
+/**
+ * State of the star rating computation.
+ *
+ * Start it with #oshu::start_star_rating, feed it every hit in order with
+ * #oshu::rate_hit, and get the result from #oshu::finish_star_rating.
+ */
+struct star_rating {
+	/**
+	 * Factor from osu!pixels to normalized distances.
+	 */
+	double scale;
+	/**
+	 * Radius of the circle the cursor must stay in while following a
+	 * slider, in normalized units.
+	 */
+	double follow_radius;
+	bool started = false;
+	/**
+	 * Where the cursor was last, in normalized units.
+	 */
+	oshu::point cursor;
+	/**
+	 * Distance travelled along the last object, if it was a slider.
+	 */
+	double travel = 0;
+	/**
+	 * When the last object started, in milliseconds.
+	 */
+	double last_time;
+	oshu::strain aim;
+	oshu::strain speed;
+};
+
+void start_star_rating(oshu::star_rating *rating, double circle_radius);
+
+/**
+ * Account for a hit, which must come after all the hits previously rated.
+ *
+ * Its slider path must be flattened, as it is once parsed.
+ */
+void rate_hit(oshu::star_rating *rating, oshu::hit *hit);
+
+/**
+ * Compute the final rating.
+ */
+double finish_star_rating(oshu::star_rating *rating);
+
+/**
+ * Compute the star rating of a loaded beatmap.
+ */
+double compute_star_rating(oshu::beatmap *beatmap);
+
+/** \} */
+
+}
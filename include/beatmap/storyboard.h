@@ -0,0 +1,282 @@
+/**
+ * \file beatmap/storyboard.h
+ * \ingroup beatmap_storyboard
+ */
+
+#pragma once
+
+#include "core/geometry.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace oshu {
+
+/**
+ * \defgroup beatmap_storyboard Storyboard
+ * \ingroup beatmap
+ *
+ * \brief
+ * Sprites animated along the song, from the [Events] section.
+ *
+ * A storyboard is made of sprites, each a picture of the beatmap set placed on
+ * a 640×480 screen, and moved, scaled, rotated, faded and tinted by commands.
+ * It is read from the [Events] section of the .osu file, and from the .osb
+ * file the difficulties of a set share, which follows the same syntax:
+ *
+ * ```
+ * Sprite,Foreground,Centre,"sb/star.png",320,240
+ *  F,0,1000,1500,0,1
+ *  M,2,1000,3000,320,240,320,100
+ *  L,4000,8
+ *   R,0,0,500,0,3.1416
+ * ```
+ *
+ * Every command is split into one command per property it animates, like the
+ * *M* above into a command on *x* and another on *y*, and loops are unrolled
+ * while parsing. The commands of a sprite are then stored in one array per
+ * property, sorted by time, so that an #oshu::storyboard_player only needs to
+ * move a cursor forward in each of them as the song plays.
+ *
+ * The sprites themselves are sorted by the time of their first command, which
+ * lets the player activate them in order, and forget them after their last
+ * command. That way, a frame only costs as much as the number of sprites
+ * visible at that moment, however long the storyboard is.
+ *
+ * Triggers, which play commands when the player hits a note or fails, aren't
+ * supported, and their commands are ignored. So are the samples and the
+ * videos.
+ *
+ * The storyboard format is documented there:
+ * https://osu.ppy.sh/wiki/en/Storyboard/Scripting
+ *
+ * \{
+ */
+
+/**
+ * The layers of a storyboard, drawn from the bottom to the top.
+ *
+ * Within a layer, the sprites are drawn in the order they were declared.
+ */
+enum storyboard_layer {
+	STORYBOARD_BACKGROUND,
+	/**
+	 * Shown instead of #STORYBOARD_PASS when the player is failing, which
+	 * never happens in oshu!.
+	 */
+	STORYBOARD_FAIL,
+	STORYBOARD_PASS,
+	STORYBOARD_FOREGROUND,
+	/**
+	 * Drawn above the hit objects.
+	 */
+	STORYBOARD_OVERLAY,
+};
+
+/**
+ * The properties of a sprite animated by the commands.
+ *
+ * The first ones hold numbers, and the last three, set by the *P* command,
+ * are flags.
+ */
+enum storyboard_track {
+	FADE_TRACK,
+	X_TRACK,
+	Y_TRACK,
+	/**
+	 * The uniform scale of *S*, which multiplies the vector scale of *V*.
+	 */
+	SCALE_TRACK,
+	SCALE_X_TRACK,
+	SCALE_Y_TRACK,
+	/**
+	 * Clockwise, in radians.
+	 */
+	ROTATION_TRACK,
+	/**
+	 * The color components, in [0, 1].
+	 */
+	RED_TRACK,
+	GREEN_TRACK,
+	BLUE_TRACK,
+	FLIP_H_TRACK,
+	FLIP_V_TRACK,
+	ADDITIVE_TRACK,
+	TRACK_COUNT,
+};
+
+/**
+ * A change of a property of a sprite, from one value to another.
+ *
+ * Before #start, the property is #from, and after #end, it stays #to until the
+ * next command of the same property starts.
+ *
+ * The flags are on from #start to #end, or from #start on forever when both
+ * times are the same.
+ */
+struct storyboard_command {
+	/**
+	 * In seconds.
+	 */
+	double start;
+	double end;
+	float from;
+	float to;
+	/**
+	 * The curve of the transition, numbered like osu! does, from 0 for
+	 * linear to 34 for *BounceInOut*.
+	 */
+	uint8_t easing;
+};
+
+struct storyboard_sprite {
+	enum oshu::storyboard_layer layer;
+	/**
+	 * The point of the picture that is placed at #position, relative to
+	 * its size: 0 is the top-left corner, and *(.5, .5)* the center.
+	 */
+	oshu::point origin;
+	/**
+	 * The position in the 640×480 storyboard screen, unless commands move
+	 * the sprite.
+	 */
+	oshu::point position;
+	/**
+	 * Index of the picture in #oshu::storyboard::images.
+	 *
+	 * The frames of an animation follow it.
+	 */
+	int image;
+	int frame_count;
+	/**
+	 * How long each frame of an animation lasts, in seconds.
+	 */
+	double frame_delay;
+	/**
+	 * Whether the animation stops at its last frame instead of looping.
+	 */
+	bool loop_once;
+	/**
+	 * When the first command starts, and when the last one ends, in
+	 * seconds. The sprite is only shown in between.
+	 */
+	double start;
+	double end;
+	/**
+	 * The order of the sprite in the storyboard, to draw the sprites of a
+	 * layer in that order.
+	 */
+	uint32_t depth;
+	/**
+	 * The commands of the sprite, in #oshu::storyboard::commands.
+	 *
+	 * The commands of track *t* are in `[tracks[t], tracks[t + 1])`,
+	 * sorted by their start time.
+	 */
+	uint32_t tracks[TRACK_COUNT + 1];
+};
+
+struct storyboard {
+	/**
+	 * Sorted by start time.
+	 */
+	std::vector<oshu::storyboard_sprite> sprites;
+	std::vector<oshu::storyboard_command> commands;
+	/**
+	 * The paths of the pictures, relative to the directory of the
+	 * beatmap set, with forward slashes.
+	 */
+	std::vector<std::string> images;
+};
+
+/**
+ * Parse the [Events] and [Variables] sections of an .osu or .osb file, and add
+ * their sprites to the storyboard.
+ *
+ * The sprites are drawn above the ones already in the storyboard, which is
+ * why the .osb file should be parsed before the .osu file.
+ *
+ * The other sections are skipped, and so are the invalid lines, which are
+ * only logged.
+ */
+void parse_storyboard(const char *text, size_t size, oshu::storyboard *storyboard);
+
+/**
+ * Read a file with #oshu::open_file, and parse it with
+ * #oshu::parse_storyboard.
+ *
+ * \return 0 on success, -1 if the file couldn't be read.
+ */
+int read_storyboard(const char *path, oshu::storyboard *storyboard);
+
+/**
+ * The properties of a sprite at some point in time.
+ */
+struct sprite_state {
+	oshu::point position;
+	oshu::vector scale;
+	double rotation;
+	float red, green, blue, alpha;
+	bool flip_h, flip_v, additive;
+	/**
+	 * The picture to show, which is the current frame for an animation.
+	 */
+	int image;
+};
+
+/**
+ * Track the sprites that are visible as a storyboard plays.
+ *
+ * \sa oshu::start_storyboard
+ * \sa oshu::update_storyboard
+ */
+struct storyboard_player {
+	const oshu::storyboard *storyboard = nullptr;
+	double now;
+	/**
+	 * The next sprite to activate.
+	 */
+	size_t next;
+	/**
+	 * The sprites between their first and last command, in drawing order:
+	 * by layer, then by depth.
+	 */
+	std::vector<uint32_t> active;
+	/**
+	 * The current command of every track of every sprite, relative to the
+	 * first command of the track.
+	 *
+	 * The cursors of sprite *i* start at `cursors[i * TRACK_COUNT]`.
+	 */
+	std::vector<uint32_t> cursors;
+};
+
+/**
+ * Start playing a storyboard from the beginning.
+ *
+ * The storyboard must outlive the player, and not change while it's being
+ * played.
+ */
+void start_storyboard(const oshu::storyboard *storyboard, oshu::storyboard_player *player);
+
+/**
+ * Move the player to *now*, in seconds, and update its #active sprites.
+ *
+ * It only looks at the sprites that start or end since the last update, so
+ * it's cheap to call on every frame. Going backward is slower, since the
+ * player has to start again from the beginning.
+ */
+void update_storyboard(oshu::storyboard_player *player, double now);
+
+/**
+ * Compute the properties of an active sprite at the time of the last update.
+ *
+ * \return false when the sprite is invisible, because it's transparent or
+ * scaled to nothing, in which case *state* is incomplete.
+ */
+bool evaluate_sprite(oshu::storyboard_player *player, uint32_t sprite, oshu::sprite_state *state);
+
+/** \} */
+
+}
@@ -0,0 +1,93 @@
+/**
+ * \file include/core/arena.h
+ * \ingroup core_arena
+ */
+
+#pragma once
+
+#include "core/memory.h"
+
+#include <stddef.h>
+
+namespace oshu {
+
+/**
+ * \defgroup core_arena Arena
+ * \ingroup core
+ *
+ * \brief
+ * Region-based memory allocator.
+ *
+ * An arena hands out memory from big blocks, one after the other, and frees
+ * everything at once when it is destroyed. This is handy for objects sharing
+ * the same lifetime, like all the hit objects of a beatmap, as they end up
+ * contiguous in memory and can't leak individually.
+ *
+ * Objects allocated in an arena have no destructor called. If they own
+ * dynamic memory, like an STL container, you must destroy them yourself
+ * before destroying the arena.
+ *
+ * \{
+ */
+
+/**
+ * One contiguous memory block, with its header.
+ *
+ * The data follows the header right away.
+ */
+struct arena_block {
+	oshu::arena_block *next;
+	size_t size; /**< Allocatable bytes, excluding this header. */
+	size_t used;
+};
+
+/**
+ * A zero-initialized arena is empty and ready to use.
+ */
+struct arena {
+	/**
+	 * Linked list of blocks, the most recently allocated first.
+	 *
+	 * Only the first block is used for new allocations.
+	 */
+	oshu::arena_block *blocks;
+	/**
+	 * Where the blocks are accounted, see \ref core_memory.
+	 */
+	oshu::memory_category category;
+};
+
+/**
+ * Allocate *size* bytes of zeroed memory, aligned for any scalar type.
+ *
+ * It never fails: on memory exhaustion, the program aborts.
+ */
+void* arena_alloc(oshu::arena *arena, size_t size);
+
+/**
+ * Make sure the next *size* bytes of allocations will fit in the current
+ * block, to keep them contiguous.
+ *
+ * Call it when you know how many objects are coming.
+ */
+void arena_reserve(oshu::arena *arena, size_t size);
+
+/**
+ * Free all the blocks of the arena at once, and reset it to the empty state.
+ */
+void destroy_arena(oshu::arena *arena);
+
+/**
+ * Allocate a zeroed object of type *T* in the arena.
+ *
+ * No constructor is called, just like with *calloc*.
+ */
+template <typename T>
+T* arena_new(oshu::arena *arena)
+{
+	return static_cast<T*>(arena_alloc(arena, sizeof(T)));
+}
+
+/** \} */
+
+}
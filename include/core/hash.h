@@ -0,0 +1,48 @@
+/**
+ * \file include/core/hash.h
+ * \ingroup core_hash
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace oshu {
+
+/**
+ * \defgroup core_hash Hash
+ * \ingroup core
+ *
+ * \brief
+ * Fast non-cryptographic content hashing.
+ *
+ * The hash function is XXH64, from the xxHash family. It is fast enough that
+ * hashing a file costs about as much as reading it, and good enough to
+ * identify files by their content.
+ *
+ * \{
+ */
+
+/**
+ * Compute the 64-bit hash of a memory buffer.
+ */
+uint64_t hash_bytes(const void *data, size_t size, uint64_t seed = 0);
+
+/**
+ * Compute the hash of a whole file.
+ *
+ * The file may be inside an archive, as described in \ref core_vfs.
+ *
+ * Each file is hashed once per process: the hash is remembered along with
+ * the file's inode, size and modification time, and computed again only when
+ * they change. This makes the hash cheap enough to serve as the key of all
+ * the caches, and as the identity of beatmaps in replays.
+ *
+ * Return 0 on success, -1 on failure, and log an error in that case.
+ */
+int hash_file(const char *path, uint64_t *hash);
+
+/** \} */
+
+}
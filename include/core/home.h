@@ -0,0 +1,64 @@
+/**
+ * \file include/core/home.h
+ * \ingroup core_home
+ */
+
+#pragma once
+
+#include <string>
+
+namespace oshu {
+
+/**
+ * \defgroup core_home Home
+ * \ingroup core
+ *
+ * \brief
+ * Locate oshu!'s resources on the filesystem.
+ *
+ * The home directory is the parent directory of all oshu!'s resources. Its
+ * usual path is `~/.oshu`:
+ *
+ * ```
+ * ~/.oshu/
+ *     beatmaps/
+ *     cache/
+ *     web/
+ * ```
+ *
+ * \{
+ */
+
+/**
+ * Read the oshu! home location from the environment.
+ *
+ * By order of priority:
+ *
+ * 1. If OSHU_HOME is set, use it.
+ * 2. If HOME is set, append `/.oshu/` at the end.
+ * 3. Otherwise, throw an exception.
+ *
+ */
+std::string get_oshu_home();
+
+/**
+ * Create a directory unless it already exists.
+ *
+ * Throw a *std::system_error* on failure.
+ */
+void ensure_directory(const std::string &path);
+
+/**
+ * Return the path to a cache directory, like `~/.oshu/cache/beatmaps`,
+ * creating it if needed.
+ *
+ * Everything inside may be deleted at any time without loss of data.
+ *
+ * Throw an exception if the home directory can't be located, or if the
+ * directories can't be created.
+ */
+std::string get_cache_directory(const std::string &name);
+
+/** \} */
+
+}
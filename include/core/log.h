@@ -17,12 +17,8 @@
  *
  * ### Legacy interface
  *
- * This module provides a set of macros to avoid mentionning the verbosely
- * named `SDL_LOG_CATEGORY_APPLICATION` parameter when using SDL's logging
- * facility.
- *
- * It works with C and looks like printf calls, but requires SDL to be linked
- * with the executable.
+ * This module provides a set of macros that look like printf calls, and used
+ * to wrap SDL's logging facility.
  *
  * ### New interface
  *
@@ -31,20 +27,38 @@
  * It is a bit more verbose but it is also easier to extend, and also
  * type-safe.
  *
+ * ### Log queue
+ *
+ * Both interfaces, and SDL's own messages, are written to standard error by a
+ * background thread, so that a burst of debug messages doesn't stall the game
+ * thread on the terminal.
+ *
+ * The messages go through a bounded queue of fixed-size records, which each
+ * producer claims with a compare-and-swap, and which is allocated once. The
+ * macros format the message right into its record, so they never lock nor
+ * allocate, and are safe to call from the audio callback. When the queue is
+ * full, the message is dropped and counted in #oshu::LOG_DROPPED, rather than
+ * making the caller wait. The stream interface allocates, and should be kept
+ * out of the audio callback.
+ *
+ * Every record is stamped with #oshu::trace_clock when it's queued, and the
+ * time is printed in front of the message when debugging messages are
+ * enabled.
+ *
  * \{
  */
 
 /**
  * Unused so far.
  */
-#define oshu_log_verbose(...)  SDL_LogVerbose(SDL_LOG_CATEGORY_APPLICATION, __VA_ARGS__)
+#define oshu_log_verbose(...)  oshu::log_message(oshu::log_level::verbose, __VA_ARGS__)
 
 /**
  * Debugging messages are for developers and advanced users. They shouldn't be
  * shown to everyone, except to inspect the cause of a failure. Use this
  * freely.
  */
-#define oshu_log_debug(...)    SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION, __VA_ARGS__)
+#define oshu_log_debug(...)    oshu::log_message(oshu::log_level::debug, __VA_ARGS__)
 
 /**
  * Informational messages are things that we'd like the techniest users to see,
@@ -54,26 +68,26 @@
  * To show information to the regular user, use a regular printing routing to
  * standard output.
  */
-#define oshu_log_info(...)     SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, __VA_ARGS__)
+#define oshu_log_info(...)     oshu::log_message(oshu::log_level::info, __VA_ARGS__)
 
 /**
  * Warning messages are for non-fatal errors. They'll be the primary indicator
  * of unimplemented non-essential features.
  */
-#define oshu_log_warning(...)     SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION, __VA_ARGS__)
+#define oshu_log_warning(...)  oshu::log_message(oshu::log_level::warning, __VA_ARGS__)
 
 /**
  * Error messages explain errors fatal to the task we were doing. These won't
  * make the game crash, even though in most cases we'll choose to end the game
  * anyway. Failure to read a beatmap, or to open an audio file are errors.
  */
-#define oshu_log_error(...)    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, __VA_ARGS__)
+#define oshu_log_error(...)    oshu::log_message(oshu::log_level::error, __VA_ARGS__)
 
 /**
  * Critical messages are for desperate cases, when the game has no other option
  * but to crash. For example, when SDL fails to initialize.
  */
-#define oshu_log_critical(...) SDL_LogCritical(SDL_LOG_CATEGORY_APPLICATION, __VA_ARGS__)
+#define oshu_log_critical(...) oshu::log_message(oshu::log_level::critical, __VA_ARGS__)
 
 /** \} */
 
@@ -132,6 +146,29 @@ extern log_level log_priority;
  */
 std::ostream& logger(log_level priority);
 
+/**
+ * Format a message with printf's syntax, and queue it if its level is at
+ * least #log_priority.
+ *
+ * Messages longer than #oshu::log_message_size are truncated.
+ *
+ * This is what the `oshu_log_*` macros call.
+ */
+void log_message(log_level priority, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * Size of a log record, including the level prefix and the final null byte.
+ */
+static const int log_message_size = 256;
+
+/**
+ * Write the queued messages now, from the calling thread.
+ *
+ * It's done automatically in the background, but it's worth calling before
+ * the process exits abruptly.
+ */
+void flush_log();
+
 std::ostream& verbose_log();
 std::ostream& debug_log();
 std::ostream& info_log();
@@ -0,0 +1,75 @@
+/**
+ * \file include/core/memory.h
+ * \ingroup core_memory
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+namespace oshu {
+
+/**
+ * \defgroup core_memory Memory
+ * \ingroup core
+ *
+ * \brief
+ * Account for the big allocations, by module.
+ *
+ * The modules holding most of the memory report their allocations here, with
+ * their size: the arenas and slider paths of the beatmaps, the PCM buffers of
+ * the audio, the surfaces and decoded frames of the video, and the string pool
+ * of the library. Small objects aren't tracked.
+ *
+ * Every category has 3 metrics in \ref core_metrics: the bytes currently
+ * allocated, the highest that value ever was, and the total number of
+ * allocations. The last one is the one to watch for allocations on the hot
+ * path, as it shouldn't grow while a song is playing, except for the video
+ * frames.
+ *
+ * The textures are not in the video category, because they live in video
+ * memory, and have their own #oshu::VIDEO_MEMORY metric.
+ *
+ * \{
+ */
+
+enum memory_category {
+	/**
+	 * Zero-initialized #oshu::arena objects are accounted in this
+	 * category.
+	 */
+	BEATMAP_MEMORY_CATEGORY,
+	AUDIO_MEMORY_CATEGORY,
+	VIDEO_MEMORY_CATEGORY,
+	LIBRARY_MEMORY_CATEGORY,
+	MEMORY_CATEGORY_COUNT,
+};
+
+/**
+ * Account for *count* new blocks of *bytes* in total.
+ */
+void track_allocation(enum oshu::memory_category category, size_t bytes, int count = 1);
+
+/**
+ * Account for freed blocks of *bytes* in total, which must match what was
+ * passed to #oshu::track_allocation.
+ */
+void track_release(enum oshu::memory_category category, size_t bytes);
+
+/**
+ * Account for a block that went from *before* to *after* bytes, with
+ * *realloc* or by growing a vector.
+ *
+ * Nothing is counted when the size didn't change.
+ */
+void track_resize(enum oshu::memory_category category, size_t before, size_t after);
+
+/**
+ * Log the live bytes, peak bytes and allocation count of every category, at
+ * the info level, so that `-v` shows them.
+ */
+void log_memory_usage();
+
+/** \} */
+
+}
@@ -0,0 +1,207 @@
+/**
+ * \file include/core/metrics.h
+ * \ingroup core_metrics
+ */
+
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include <stdio.h>
+
+namespace oshu {
+
+/**
+ * \defgroup core_metrics Metrics
+ * \ingroup core
+ *
+ * \brief
+ * Count what goes wrong during long sessions.
+ *
+ * Unlike the spans of \ref core_trace, which only keep the last few seconds,
+ * metrics are totals since the game started, and extremes. Each one is a
+ * single atomic integer, so updating them is cheap enough for the audio
+ * callback.
+ *
+ * They are written in the Prometheus text format by #oshu::dump_metrics, which
+ * the node exporter's textfile collector can scrape.
+ *
+ * \{
+ */
+
+enum metric_id {
+	/**
+	 * Number of audio callbacks.
+	 */
+	AUDIO_CALLBACKS,
+	/**
+	 * Total time spent in the audio callback, in microseconds.
+	 */
+	AUDIO_CALLBACK_TIME,
+	/**
+	 * Duration of the slowest audio callback, in microseconds.
+	 */
+	AUDIO_CALLBACK_MAX_TIME,
+	/**
+	 * Times the callback ran out of music samples before the end of the
+	 * song, filling the rest of the buffer with silence.
+	 */
+	AUDIO_UNDERRUNS,
+	/**
+	 * Times the decoder got fewer samples than it asked for, before the end
+	 * of the song, or failed.
+	 */
+	AUDIO_SHORT_READS,
+	/**
+	 * Music decoded ahead of the playback at the last audio callback, in
+	 * microseconds. When it reaches 0, the decoder is lagging.
+	 */
+	AUDIO_DECODED_AHEAD,
+	/**
+	 * The lowest #AUDIO_DECODED_AHEAD ever seen while the music was
+	 * playing.
+	 */
+	AUDIO_DECODED_AHEAD_MIN,
+	/**
+	 * How far the game clock was from the audio clock at its last
+	 * synchronization, in microseconds, positive when the game was ahead.
+	 */
+	CLOCK_DRIFT,
+	/**
+	 * The largest absolute #CLOCK_DRIFT seen.
+	 */
+	CLOCK_DRIFT_MAX,
+	/**
+	 * Log messages dropped because the log queue was full.
+	 */
+	LOG_DROPPED,
+	/**
+	 * Frames drawn by the game shell.
+	 */
+	FRAMES,
+	/**
+	 * Frames whose deadline passed before the game was ready, as counted
+	 * by #oshu::frame_pacer::missed_frames.
+	 */
+	MISSED_FRAMES,
+	/**
+	 * Estimated video memory used by the textures, in bytes.
+	 *
+	 * \sa oshu::track_texture
+	 */
+	VIDEO_MEMORY,
+	/**
+	 * The highest #VIDEO_MEMORY seen.
+	 */
+	VIDEO_MEMORY_MAX,
+	/**
+	 * Textures freed by a #oshu::texture_cache to stay within its budget.
+	 */
+	TEXTURE_EVICTIONS,
+	/**
+	 * Memory allocated by the beatmaps, in bytes.
+	 *
+	 * \sa oshu::track_allocation
+	 */
+	BEATMAP_HEAP,
+	/**
+	 * The highest #BEATMAP_HEAP seen.
+	 */
+	BEATMAP_HEAP_MAX,
+	/**
+	 * Allocations made by the beatmaps.
+	 */
+	BEATMAP_ALLOCATIONS,
+	/**
+	 * Memory allocated by the audio module, in bytes.
+	 *
+	 * \sa oshu::track_allocation
+	 */
+	AUDIO_HEAP,
+	/**
+	 * The highest #AUDIO_HEAP seen.
+	 */
+	AUDIO_HEAP_MAX,
+	/**
+	 * Allocations made by the audio module.
+	 */
+	AUDIO_ALLOCATIONS,
+	/**
+	 * Memory allocated by the video module, outside of the textures, in bytes.
+	 *
+	 * \sa oshu::track_allocation
+	 */
+	VIDEO_HEAP,
+	/**
+	 * The highest #VIDEO_HEAP seen.
+	 */
+	VIDEO_HEAP_MAX,
+	/**
+	 * Allocations made by the video module.
+	 */
+	VIDEO_ALLOCATIONS,
+	/**
+	 * Memory allocated by the library module, in bytes.
+	 *
+	 * \sa oshu::track_allocation
+	 */
+	LIBRARY_HEAP,
+	/**
+	 * The highest #LIBRARY_HEAP seen.
+	 */
+	LIBRARY_HEAP_MAX,
+	/**
+	 * Allocations made by the library module.
+	 */
+	LIBRARY_ALLOCATIONS,
+	METRIC_COUNT,
+};
+
+extern std::atomic<int64_t> metrics[METRIC_COUNT];
+
+/**
+ * Add *value* to a counter.
+ */
+inline void count(enum oshu::metric_id id, int64_t value = 1)
+{
+	oshu::metrics[id].fetch_add(value, std::memory_order_relaxed);
+}
+
+/**
+ * Set a gauge.
+ */
+inline void set_gauge(enum oshu::metric_id id, int64_t value)
+{
+	oshu::metrics[id].store(value, std::memory_order_relaxed);
+}
+
+/**
+ * Raise a gauge to *value*, if it's lower.
+ */
+void raise_gauge(enum oshu::metric_id id, int64_t value);
+
+/**
+ * Lower a gauge to *value*, if it's higher.
+ *
+ * The minimum gauges start at `INT64_MAX`, which is reported as missing.
+ */
+void lower_gauge(enum oshu::metric_id id, int64_t value);
+
+/**
+ * Write every metric in the Prometheus text format, with an `oshu_` prefix.
+ */
+void dump_metrics(FILE *output);
+
+/**
+ * Replace the file at *path* with the current metrics.
+ *
+ * The file is written next to it first, and renamed, so that a scraper never
+ * reads half a file.
+ *
+ * \return 0 on success, -1 on failure.
+ */
+int save_metrics(const char *path);
+
+/** \} */
+
+}
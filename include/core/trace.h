@@ -0,0 +1,173 @@
+/**
+ * \file include/core/trace.h
+ * \ingroup core_trace
+ */
+
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+namespace oshu {
+
+/**
+ * \defgroup core_trace Trace
+ * \ingroup core
+ *
+ * \brief
+ * Measure how long each part of a frame takes.
+ *
+ * The interesting parts of the game, called zones, are timed with an
+ * #oshu::scoped_timer. The last #trace_capacity spans of every zone are kept
+ * in a ring buffer, which costs two clock reads and a few stores per span, so
+ * that they can be measured all the time.
+ *
+ * ```c
+ * void draw()
+ * {
+ * 	oshu::scoped_timer timer(oshu::DRAW_ZONE);
+ * 	// ...
+ * }
+ * ```
+ *
+ * The spans may be shown on screen, with the \ref ui_trace, or
+ * exported with #oshu::export_trace to a JSON file for Chrome's `about:tracing`
+ * or Perfetto.
+ *
+ * Spans may be recorded from any thread, including the audio callback, as
+ * the rings never lock. A reader racing with a writer may see a span torn
+ * between its old and new values, which is fine for statistics.
+ *
+ * \{
+ */
+
+enum trace_zone {
+	/**
+	 * Everything the main loop does for one frame, for the time it's not
+	 * waiting.
+	 */
+	FRAME_ZONE,
+	/**
+	 * The screen's update, which includes judging the hits.
+	 */
+	UPDATE_ZONE,
+	/**
+	 * The screen's draw, up to the renderer's present.
+	 */
+	DRAW_ZONE,
+	/**
+	 * The rasterization of a slider, on any thread.
+	 */
+	SLIDER_ZONE,
+	/**
+	 * The audio callback, including the mixing.
+	 */
+	AUDIO_ZONE,
+	ZONE_COUNT,
+};
+
+/**
+ * Return a short lower-case name for a zone, like *draw*.
+ */
+const char *zone_name(enum oshu::trace_zone zone);
+
+/**
+ * One timed run of a zone, in nanoseconds since the process started.
+ */
+struct trace_span {
+	std::atomic<int64_t> start;
+	std::atomic<int64_t> duration;
+	/**
+	 * A small number identifying the thread, 0 for the first one.
+	 */
+	std::atomic<int> thread;
+};
+
+/**
+ * How many spans of each zone are kept.
+ *
+ * At 60 FPS, that's 17 seconds of frames, and 12 seconds of audio callbacks
+ * with the default latency.
+ */
+static const int trace_capacity = 1024;
+
+/**
+ * The last spans of a zone.
+ */
+struct trace_ring {
+	oshu::trace_span spans[trace_capacity];
+	/**
+	 * Total number of spans recorded. The last one is at `count - 1`
+	 * modulo #trace_capacity.
+	 */
+	std::atomic<uint64_t> count;
+};
+
+extern oshu::trace_ring trace_rings[ZONE_COUNT];
+
+/**
+ * Return the time since the process started, in nanoseconds, on a monotonic
+ * clock.
+ */
+int64_t trace_clock();
+
+/**
+ * Log at info level, shown with a single `-v`, how long a startup stage took, from *start* to now, and
+ * when it finished, counting from the launch of the process.
+ *
+ * Stages may run on several threads at once, so their durations don't add up
+ * to the time it takes to show the first frame, which is logged as the
+ * *first frame* stage.
+ */
+void log_startup(const char *stage, int64_t start);
+
+/**
+ * Record a span that started at *start* and ended now, as returned by
+ * #oshu::trace_clock.
+ */
+void end_span(enum oshu::trace_zone zone, int64_t start);
+
+/**
+ * Time the scope it lives in.
+ */
+struct scoped_timer {
+	scoped_timer(enum oshu::trace_zone zone) : zone(zone), start(oshu::trace_clock()) {}
+	~scoped_timer() { oshu::end_span(zone, start); }
+	enum oshu::trace_zone zone;
+	int64_t start;
+};
+
+/**
+ * Duration of the *age*-th last span of a zone, in seconds, with 0 for the
+ * last one.
+ *
+ * \return 0 if there's no such span.
+ */
+double span_duration(enum oshu::trace_zone zone, int age);
+
+/**
+ * Summary of the last spans of a zone, in seconds.
+ */
+struct zone_stats {
+	int count;
+	double mean;
+	double p99;
+	double max;
+};
+
+/**
+ * Compute the statistics of the last *count* spans of a zone, or fewer if
+ * there isn't as many.
+ */
+oshu::zone_stats compute_stats(enum oshu::trace_zone zone, int count = trace_capacity);
+
+/**
+ * Write every kept span to *path*, in the Chrome trace event format.
+ *
+ * \return 0 on success, -1 on failure.
+ */
+int export_trace(const char *path);
+
+/** \} */
+
+}
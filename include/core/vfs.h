@@ -0,0 +1,168 @@
+/**
+ * \file include/core/vfs.h
+ * \ingroup core_vfs
+ */
+
+#pragma once
+
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace oshu {
+
+/**
+ * \defgroup core_vfs Virtual filesystem
+ * \ingroup core
+ *
+ * \brief
+ * Read files from the disk, or straight from .osz archives.
+ *
+ * An .osz beatmap set is a zip archive of the set's directory. Rather than
+ * extracting it, a path can go through it as if it were a directory: in
+ * `beatmaps/651934 Zero Tokei.osz/audio.mp3`, `audio.mp3` is looked up inside
+ * the archive.
+ *
+ * Archives are mapped in memory once, and shared by all the files opened from
+ * them. Members that are stored without compression are read in place, without
+ * any copy. Deflated members are inflated into a buffer when opened, which is
+ * unavoidable.
+ *
+ * Relative paths are also looked up in the archive passed to
+ * #oshu::enter_archive, which plays the role of the current directory for an
+ * archived beatmap set. When a file isn't found there, it is looked up on the
+ * disk.
+ *
+ * Member names are matched without regard to case, like osu! does on Windows.
+ * Zip64 and encrypted archives aren't supported.
+ *
+ * ```c
+ * oshu::file_view file;
+ * if (oshu::open_file("set.osz/audio.mp3", &file) < 0)
+ *     return -1;
+ * // read file.data
+ * oshu::close_file(&file);
+ * ```
+ *
+ * \{
+ */
+
+/**
+ * An entry of the central directory of an archive.
+ */
+struct archive_member {
+	/**
+	 * Path of the member in the archive, with slashes as separators.
+	 */
+	std::string name;
+	/**
+	 * 0 for stored members, 8 for deflated ones.
+	 */
+	uint16_t method;
+	uint32_t compressed_size;
+	uint32_t size;
+	/**
+	 * Offset of the member's local header from the start of the archive.
+	 */
+	uint32_t header_offset;
+};
+
+/**
+ * A zip archive mapped in memory.
+ *
+ * Always handled through a shared pointer from #oshu::open_archive, so that
+ * the mapping lives as long as any of its files is open.
+ */
+struct archive {
+	std::string path;
+	const uint8_t *data = nullptr;
+	size_t size = 0;
+	std::vector<oshu::archive_member> members;
+	/**
+	 * Map the lowercased name of every member to its index in #members.
+	 */
+	std::unordered_map<std::string, size_t> index;
+};
+
+/**
+ * The contents of a file, in memory.
+ *
+ * \sa oshu::open_file
+ * \sa oshu::close_file
+ */
+struct file_view {
+	const char *data = nullptr;
+	size_t size = 0;
+	/**
+	 * The archive #data points into, if any.
+	 */
+	std::shared_ptr<oshu::archive> archive;
+	/**
+	 * The map of a regular file, to unmap on close.
+	 */
+	void *map = nullptr;
+	/**
+	 * An inflated member, to free on close.
+	 */
+	void *buffer = nullptr;
+};
+
+/**
+ * Open and index an archive, or share the one already open.
+ *
+ * \return null on failure, and log an error.
+ */
+std::shared_ptr<oshu::archive> open_archive(const std::string &path);
+
+/**
+ * Tell whether a path is an .osz archive, judging by its extension.
+ */
+bool archive_name(const std::string &path);
+
+/**
+ * Split a path going through an archive, like `set.osz/map.osu`, into the
+ * path to the archive and the name of the member.
+ *
+ * \return false for paths that are not inside an archive.
+ */
+bool split_archive_path(const std::string &path, std::string *archive, std::string *member);
+
+/**
+ * Make relative paths look into the archive first.
+ *
+ * Pass an empty path to leave the archive.
+ *
+ * \return 0 on success, -1 if the archive couldn't be opened.
+ */
+int enter_archive(const std::string &path);
+
+/**
+ * Read a whole file, either from the disk or from an archive.
+ *
+ * Regular files are mapped in memory. The data is not null-terminated.
+ *
+ * \return 0 on success, -1 on failure, and log an error in that case.
+ */
+int open_file(const char *path, oshu::file_view *file);
+
+/**
+ * Release what #oshu::open_file acquired, and reset the view.
+ */
+void close_file(oshu::file_view *file);
+
+/**
+ * Tell whether #oshu::open_file would read the path from an archive.
+ */
+bool in_archive(const char *path);
+
+/**
+ * Tell whether #oshu::open_file would find the file.
+ */
+bool file_exists(const char *path);
+
+/** \} */
+
+}
@@ -10,12 +10,22 @@
 #include "audio/audio.h"
 #include "audio/library.h"
 #include "beatmap/beatmap.h"
+#include "beatmap/hit_index.h"
+#include "game/checkpoint.h"
 #include "game/clock.h"
 #include "game/controls.h"
 #include "game/mode.h"
+#include "game/tally.h"
+
+#include <future>
+#include <string>
 
 namespace oshu {
 
+struct publisher;
+struct replay;
+struct spectator;
+
 /**
  * \ingroup game
  *
@@ -30,12 +40,16 @@ public:
 	 * After creating the game, you're free to toy with the options of the game,
 	 * especially autoplay and pause.
 	 *
+	 * A *headless* game doesn't open the audio device nor load the hit
+	 * sounds, so that it can be simulated without a sound card. See
+	 * \ref game_simulation.
+	 *
 	 * \todo
 	 * It should not be the responsibility of this module to load the beatmap. If
 	 * the beatmap is a taiko beatmap, then the taiko game should be instanciated,
 	 * not the base module. Instead, take a beatmap by reference.
 	 */
-	game_base(const char *beatmap_path);
+	game_base(const char *beatmap_path, bool headless = false);
 	~game_base();
 	/**
 	 * Resume the game.
@@ -60,6 +74,33 @@ public:
 	 * See #rewind.
 	 */
 	void forward(double offset);
+	/**
+	 * Resolve the path of a file the beatmap refers to, like its audio
+	 * file, against the beatmap's #directory.
+	 */
+	std::string asset_path(const char *filename) const;
+	/**
+	 * Wait for the assets loaded in the background by the constructor,
+	 * which are the hit sounds.
+	 *
+	 * Call it before the game starts. It does nothing if everything's
+	 * loaded already.
+	 */
+	void finish_loading();
+	/**
+	 * Path of the beatmap file, as passed to the constructor.
+	 */
+	std::string path;
+	/**
+	 * Directory of the beatmap file, or archive, which the beatmap's assets
+	 * are relative to.
+	 *
+	 * It is empty when the beatmap path has no directory part, in which
+	 * case the assets are looked up in the current directory. Resolving
+	 * the paths rather than changing the current directory lets a beatmap
+	 * be loaded while another one plays.
+	 */
+	std::string directory;
 	/**
 	 * \todo
 	 * Take the beatmap by reference when the game state is constructed.
@@ -67,9 +108,42 @@ public:
 	oshu::beatmap beatmap {};
 	oshu::audio audio {};
 	oshu::sound_library library {};
+	/**
+	 * Fill the #library, on a background thread while the display and the
+	 * textures are being prepared.
+	 *
+	 * \sa finish_loading
+	 */
+	std::future<void> library_loader;
 	oshu::clock clock {};
 	int autoplay {};
 	bool paused {};
+	/**
+	 * The game runs without audio, and its clock is driven by the caller
+	 * instead of #oshu::update_clock.
+	 */
+	bool headless {};
+	/**
+	 * When set, the game mode appends the inputs it receives to this
+	 * replay.
+	 *
+	 * \sa game_replay
+	 */
+	oshu::replay *recording {};
+	/**
+	 * When set, the game mode publishes its inputs and judgments to it,
+	 * and the play screen its clock.
+	 *
+	 * \sa game_spectator
+	 */
+	oshu::publisher *publishing {};
+	/**
+	 * When set, the game is driven by the stream of another player's game
+	 * instead of the user's input.
+	 *
+	 * \sa game_spectator
+	 */
+	oshu::spectator *spectating {};
 	/**
 	 * Pointer to the next clickable hit.
 	 *
@@ -90,6 +164,20 @@ public:
 	 * cursor is never null, even after the last hit was played.
 	 */
 	oshu::hit *hit_cursor {};
+	/**
+	 * Index of the beatmap's hits, built right after loading it.
+	 */
+	oshu::hit_index hit_index {};
+	/**
+	 * The running score, which the game modes update through
+	 * #oshu::judge.
+	 */
+	oshu::tally tally {};
+	/**
+	 * The journal of the judgments, to restore the state of the game when
+	 * rewinding.
+	 */
+	oshu::timeline timeline {};
 };
 
 /**
@@ -105,8 +193,7 @@ public:
 /**
  * Find the first hit object after *now - offset*.
  *
- * It bases the search on the #oshu::game_base::hit_cursor for performance, but its
- * position won't affect the results.
+ * It performs a dichotomic search in the #oshu::game_base::hit_index.
  *
  * For long notes like sliders, the end time is used, not the start time.
  *
@@ -0,0 +1,137 @@
+/**
+ * \file game/calibration.h
+ * \ingroup game_calibration
+ */
+
+#pragma once
+
+#include <vector>
+
+namespace oshu {
+
+struct beatmap;
+
+/**
+ * \defgroup game_calibration Calibration
+ * \ingroup game
+ *
+ * \brief
+ * Measure how late the player hears, sees and hits the notes.
+ *
+ * The audio clock accounts for the audio buffer, but not for the sound card,
+ * the display pipeline, nor the input devices, which add a few dozen
+ * milliseconds together on most systems. That latency shows up as hits that
+ * are all early or all late by about the same offset, so the mean offset of
+ * the hits measures it, and their standard deviation, the jitter, measures how
+ * steady the player is.
+ *
+ * The calibration screen plays a metronome on the beats of the beatmap, and
+ * collects the offsets of the player's taps. Once they're steady enough, their
+ * mean is saved as the global offset, in `~/.oshu/offset`, which
+ * #oshu::update_clock adds to the audio latency from then on.
+ *
+ * \{
+ */
+
+/**
+ * The running mean and variance of a series of offsets, in seconds.
+ *
+ * It uses Welford's algorithm, which stays accurate without keeping the
+ * offsets.
+ */
+struct offset_stats {
+	int count;
+	double mean;
+	/**
+	 * The sum of the squared distances to the mean.
+	 */
+	double m2;
+};
+
+/**
+ * Add an offset to the statistics.
+ */
+void add_offset(oshu::offset_stats *stats, double offset);
+
+/**
+ * The standard deviation of the offsets, or 0 with fewer than 2 offsets.
+ */
+double offset_jitter(const oshu::offset_stats *stats);
+
+/**
+ * Collect the offsets of the hits judged good so far.
+ */
+oshu::offset_stats hit_offsets(const oshu::beatmap *beatmap);
+
+/**
+ * Find the beat closest to *t*, from the uninherited timing point in effect
+ * at *t*.
+ *
+ * \return The time of the beat, in seconds, or NaN if the beatmap has no
+ * timing point.
+ */
+double nearest_beat(const oshu::beatmap *beatmap, double t);
+
+/**
+ * Find the first beat strictly after *t*, like #oshu::nearest_beat.
+ *
+ * When a timing point starts before that beat, the beat of the new timing
+ * point is returned instead.
+ */
+double next_beat(const oshu::beatmap *beatmap, double t);
+
+/**
+ * How many taps the calibration takes, at least, before its offset can be
+ * saved.
+ */
+static const int calibration_taps = 16;
+
+/**
+ * The state of the calibration screen.
+ */
+struct calibration {
+	oshu::offset_stats taps;
+	/**
+	 * The offsets of the taps, in order, to show them.
+	 */
+	std::vector<double> offsets;
+	/**
+	 * The last beat given to the metronome, in seconds.
+	 */
+	double scheduled;
+	/**
+	 * When the calibration started, to go back there once it's done.
+	 */
+	double resume;
+};
+
+/**
+ * Reset the calibration, which starts at *now*, in seconds.
+ */
+void start_calibration(oshu::calibration *calibration, double now);
+
+/**
+ * Record a tap at *t*, in seconds, relative to the nearest beat.
+ *
+ * \return The offset of the tap, or NaN if the beatmap has no beats, in
+ * which case the tap is ignored.
+ */
+double record_tap(oshu::calibration *calibration, const oshu::beatmap *beatmap, double t);
+
+/**
+ * Read the global offset from `~/.oshu/offset`.
+ *
+ * \return The offset in seconds, or 0 if it was never calibrated.
+ */
+double load_global_offset();
+
+/**
+ * Write the global offset to `~/.oshu/offset`, in milliseconds.
+ *
+ * \return 0 on success, -1 on failure, after logging why.
+ */
+int save_global_offset(double offset);
+
+/** \} */
+
+}
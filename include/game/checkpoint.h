@@ -0,0 +1,114 @@
+/**
+ * \file game/checkpoint.h
+ * \ingroup game_checkpoint
+ */
+
+#pragma once
+
+#include "beatmap/beatmap.h"
+
+#include <stddef.h>
+#include <vector>
+
+namespace oshu {
+
+class game_base;
+
+/**
+ * \defgroup game_checkpoint Checkpoints
+ * \ingroup game
+ *
+ * \brief
+ * Restore the game state of an earlier time when rewinding.
+ *
+ * Every state change of a hit goes through #oshu::judge, which appends it to
+ * the game's journal with the time it happened. At every
+ * #checkpoint_interval seconds of game time, a checkpoint saves the parts of
+ * the game state that aren't in the journal: the hit cursor, the score
+ * counters, and the position in the journal.
+ *
+ * To go back to time *t*, the checkpoint right before *t* is found by
+ * dividing *t* by the interval, the journal is undone down to it, and the
+ * judgments made between the checkpoint and *t* are replayed. The game is then
+ * exactly as it was at *t*, except that no slider is held.
+ *
+ * Only the past can be restored. Seeking forward past the journal still
+ * skips the hits in between, like before.
+ *
+ * \{
+ */
+
+/**
+ * Seconds of game time between two checkpoints.
+ *
+ * Restoring replays at most that much of the journal.
+ */
+static const double checkpoint_interval = 5.;
+
+/**
+ * A state change of a hit, and when it happened.
+ */
+struct judgment {
+	double time;
+	oshu::hit *hit;
+	enum oshu::hit_state previous_state;
+	double previous_offset;
+	enum oshu::hit_state state;
+	double offset;
+};
+
+/**
+ * The game state at the beginning of a checkpoint interval.
+ */
+struct checkpoint {
+	oshu::hit *hit_cursor;
+	/**
+	 * The tally, without its combo checkpoints.
+	 */
+	int great, early, late, missed, combo, max_combo;
+	/**
+	 * Size of the tally's combo checkpoints.
+	 */
+	size_t combo_checkpoints;
+	/**
+	 * Size of the journal.
+	 */
+	size_t journal;
+};
+
+/**
+ * The history of a game.
+ */
+struct timeline {
+	std::vector<oshu::judgment> journal;
+	/**
+	 * The *i*-th checkpoint is the state at `i * checkpoint_interval`
+	 * seconds.
+	 */
+	std::vector<oshu::checkpoint> checkpoints;
+};
+
+/**
+ * Change the state of a hit, updating the score and the journal.
+ *
+ * The game modes must change the states of the hits only through this
+ * function. For good hits, set #oshu::hit::offset beforehand.
+ *
+ * The final judgments are published when #oshu::game_base::publishing is set.
+ */
+void judge(oshu::game_base *game, oshu::hit *hit, enum oshu::hit_state state);
+
+/**
+ * Put the hits, the hit cursor and the score back to their state at *time*.
+ *
+ * The clock is left untouched, and the held slider, if any, must have been
+ * released beforehand.
+ *
+ * \return 0 on success, -1 if *time* is before the first checkpoint, in which
+ * case nothing changed.
+ */
+int restore_checkpoint(oshu::game_base *game, double time);
+
+/** \} */
+
+}
@@ -18,6 +18,21 @@ class game_base;
  * \brief
  * Compute the game clock from the audio time and process time.
  *
+ * The game clock runs on the process's high-resolution clock, which is smooth
+ * but drifts away from the music, because the sound card's clock doesn't
+ * exactly match the CPU's. To fix that, it is steered toward the audio clock
+ * like a phase-locked loop: at every update, a fraction of the phase error is
+ * corrected, and the error also slowly adjusts the rate of the game clock, so
+ * that a constant drift is eventually compensated without any phase error.
+ *
+ * The audio clock itself comes from #oshu::precise_music_position, which
+ * interpolates the number of samples consumed by the device between two
+ * callbacks.
+ *
+ * The game clock is in music time, so when the music plays at another rate,
+ * the process time is scaled by #oshu::audio::rate, and everything timed by
+ * the beatmap, like the approach time and the hit windows, follows the music.
+ *
  * \{
  */
 
@@ -46,36 +61,67 @@ struct clock {
 	/**
 	 * The audio clock.
 	 *
-	 * It may also be accessed directly using the audio module.
+	 * It is the position of the music sent to SDL, minus the output
+	 * latency and the #offset, so that it matches what the player hears.
 	 *
-	 * When the audio hasn't started, it sticks at 0.
+	 * When the audio hasn't started, it sticks at minus the latency.
 	 */
 	double audio;
 	/**
-	 * The process time, computed from SDL's ticks.
+	 * The process time, from #oshu::system_time.
 	 *
 	 * This is the reference time when the audio hasn't started, or when it
-	 * has stopped.
-	 *
-	 * It may also be used to increase the accuracy of the game clock,
-	 * because sometimes the audio timestamp won't change as no new frame
-	 * was decoded.
+	 * has stopped, and what makes the game clock progress between two
+	 * synchronizations with the audio clock.
 	 */
 	double system;
+	/**
+	 * Rate correction of the game clock relative to #system.
+	 *
+	 * At 0.001, the game clock runs 0.1% faster than the process time to
+	 * catch up with the audio.
+	 */
+	double drift;
+	/**
+	 * The global offset, in seconds, which accounts for the latency SDL
+	 * doesn't know about, like the sound card's, the display's, and the
+	 * input devices'.
+	 *
+	 * It is measured by the calibration screen, and loaded with
+	 * #oshu::load_global_offset. See \ref game_calibration.
+	 */
+	double offset;
 };
 
+/**
+ * Return the process time in seconds, with the precision of
+ * `SDL_GetPerformanceCounter`.
+ *
+ * It has the same origin as `SDL_GetTicks`, so that it can be compared with
+ * the timestamps of the SDL events.
+ */
+double system_time();
+
 void initialize_clock(oshu::game_base *game);
 
+/**
+ * Distance between the game clock and the audio clock, in seconds, past which
+ * the game clock jumps to the audio clock instead of converging smoothly.
+ *
+ * It happens after a seek, or when the audio stalls.
+ */
+static const double clock_snap = .1;
+
 /**
  * Update the game clock.
  *
  * It as roughly 2 modes:
  *
- * 1. When the audio has a lead-in time, rely on SDL's ticks to increase the
- *    clock.
- * 2. When the lead-in phase is over, use the audio clock. However, if we
- *    detect it hasn't change, probably because the codec frame is too big, then
- *    we make it progress with the SDL clock anyway.
+ * 1. When the audio has a lead-in time, rely on the process time to increase
+ *    the clock.
+ * 2. When the lead-in phase is over, follow the audio clock, as described in
+ *    \ref game_clock. When the game clock is more than #oshu::clock_snap
+ *    seconds away from the audio, it jumps to it.
  *
  * In both cases, we wanna ensure the *now* clock is always monotonous. If we
  * detect the new time is before the previous time, then we stop the time until
@@ -85,6 +131,20 @@ void initialize_clock(oshu::game_base *game);
  */
 void update_clock(oshu::game_base *game);
 
+/**
+ * Update the game clock to the time of an input event.
+ *
+ * *ticks* is the time of the event in seconds, on the `SDL_GetTicks` clock,
+ * usually its SDL timestamp. The game clock is moved back by the time elapsed
+ * since then, so that the events are judged at the time the user actually
+ * pressed the key, rather than at the time they were processed.
+ *
+ * The clock stays monotonous, so events are expected to be handled in order.
+ *
+ * \sa update_clock
+ */
+void update_clock(oshu::game_base *game, double ticks);
+
 /** \} */
 
 }
@@ -110,11 +110,36 @@ enum control_key {
 	PAUSE_KEY = SDLK_ESCAPE,
 	REWIND_KEY = SDLK_PAGEUP,
 	FORWARD_KEY = SDLK_PAGEDOWN,
+	/**
+	 * Toggle the \ref ui_trace overlay, on every screen.
+	 */
+	TRACE_KEY = SDLK_F3,
+	/**
+	 * Start the calibration, from the pause screen.
+	 */
+	CALIBRATE_KEY = SDLK_o,
+	/**
+	 * Save the offset measured by the calibration.
+	 */
+	SAVE_KEY = SDLK_RETURN,
 };
 
+/**
+ * Where the mouse is, in game coordinates.
+ */
 struct mouse {
 	virtual ~mouse() = default;
+	/**
+	 * The latest known position of the mouse.
+	 */
 	virtual oshu::point position() = 0;
+	/**
+	 * The position of the mouse at process time *system*, as in
+	 * #oshu::clock::system.
+	 *
+	 * Mice that don't keep a history return their latest position.
+	 */
+	virtual oshu::point position_at(double /* system */) { return position(); }
 };
 
 /** \} */
@@ -0,0 +1,100 @@
+/**
+ * \file include/game/mania.h
+ * \ingroup game_mania
+ */
+
+#pragma once
+
+#include "game/base.h"
+
+#include <vector>
+
+namespace oshu {
+
+/**
+ * \defgroup game_mania Mania
+ * \ingroup game
+ *
+ * \brief
+ * osu!mania game mode.
+ *
+ * The notes fall in columns, one per key, and must be pressed when they reach
+ * the judgement line. Hold notes must be held until their end.
+ *
+ * The column of a hit is given by its x coordinate: the 512 osu! pixels are
+ * split into #oshu::difficulty::key_count equal columns.
+ *
+ * The keys are the middle row of the keyboard, from the index fingers outward,
+ * with the space bar in the middle when the number of keys is odd. See
+ * #oshu::finger. Up to 9 keys are supported.
+ *
+ * Each column keeps its hits in an array, with a cursor on the first one that
+ * isn't judged yet, so that a key press only looks at one hit, however dense
+ * the beatmap is.
+ *
+ * \{
+ */
+
+/**
+ * Largest number of columns, one per finger of #oshu::finger.
+ */
+static const int max_mania_keys = 9;
+
+/**
+ * The hits of a column, and the state of its key.
+ */
+struct mania_column {
+	/**
+	 * The circles and hold notes of the column, in order.
+	 */
+	std::vector<oshu::hit*> hits;
+	/**
+	 * Position in #hits of the first hit that isn't judged yet, or is
+	 * being held.
+	 */
+	size_t cursor {};
+	/**
+	 * The hold note being held, or null.
+	 */
+	oshu::hit *held {};
+};
+
+struct mania_game : public oshu::game_base {
+	/**
+	 * Load a mania beatmap, and split its hits into #columns.
+	 *
+	 * Throw if the beatmap is for another mode, or has too many keys.
+	 */
+	mania_game(const char *beatmap_path, bool headless = false);
+
+	/**
+	 * One column per key, left to right.
+	 */
+	std::vector<oshu::mania_column> columns;
+	/**
+	 * Set by #relinquish, when seeking may have changed the states of the
+	 * hits behind the column cursors, which must then be found again.
+	 */
+	bool realign {};
+
+	int check() override;
+	int check_autoplay() override;
+	int press(enum oshu::finger key) override;
+	int release(enum oshu::finger key) override;
+	int relinquish() override;
+};
+
+/**
+ * Return the column of a hit, from its x coordinate.
+ */
+int mania_column_of(const oshu::mania_game *game, const oshu::hit *hit);
+
+/**
+ * Return the column played by a finger, or -1 if the finger isn't used with
+ * that many keys.
+ */
+int mania_key_column(int key_count, enum oshu::finger key);
+
+/** \} */
+
+}
@@ -7,6 +7,7 @@
 
 #include "game/base.h"
 
+#include <limits>
 #include <memory>
 
 namespace oshu {
@@ -22,7 +23,7 @@ namespace oshu {
  */
 
 struct osu_game : public oshu::game_base {
-	osu_game(const char *beatmap_path);
+	osu_game(const char *beatmap_path, bool headless = false);
 
 	/**
 	 * Slider hit object the user is holding.
@@ -30,6 +31,10 @@ struct osu_game : public oshu::game_base {
 	 * NULL most of the time.
 	 */
 	oshu::hit *current_slider {};
+	/**
+	 * The looping samples of the #current_slider.
+	 */
+	oshu::sound_loops slider_loops {};
 	/**
 	 * Keyboard key or mouse button associated to the #current_slider.
 	 *
@@ -38,6 +43,14 @@ struct osu_game : public oshu::game_base {
 	 */
 	enum oshu::finger held_key = {};
 	std::shared_ptr<oshu::mouse> mouse {};
+	/**
+	 * In autoplay mode, the music timestamp up to which the hit sounds
+	 * were scheduled with #oshu::schedule_sound.
+	 *
+	 * The sounds of autoplay are all known in advance, so they're mixed
+	 * at their exact sample instead of when the game loop notices them.
+	 */
+	double scheduled_until = -std::numeric_limits<double>::infinity();
 
 	int check() override;
 	int check_autoplay() override;
@@ -0,0 +1,90 @@
+/**
+ * \file game/replay.h
+ * \ingroup game_replay
+ */
+
+#pragma once
+
+#include "game/simulation.h"
+
+#include <stdint.h>
+#include <vector>
+
+namespace oshu {
+
+/**
+ * \defgroup game_replay Replay
+ * \ingroup game
+ *
+ * \brief
+ * Record the input of a game, and play it again.
+ *
+ * A replay is the list of inputs the game received: key presses, key releases,
+ * and mouse moves, with their time on the game clock. Playing it back with
+ * #oshu::simulate on a headless game judges it exactly like the original game
+ * did, or like the current game logic would, which makes replays a good
+ * regression test for judgment changes.
+ *
+ * To record a game, point #oshu::game_base::recording to a replay. The game
+ * mode appends the events to it as it receives them.
+ *
+ * The file format is a 32-byte header followed by one 16-byte record per
+ * event, all in little-endian:
+ *
+ * | Offset | Type       | Header field               |
+ * |--------|------------|----------------------------|
+ * | 0      | char[8]    | `oshurpl\0`                |
+ * | 8      | uint32     | version, currently 1       |
+ * | 12     | uint32     | number of events           |
+ * | 16     | uint64     | hash of the beatmap file   |
+ * | 24     | uint64     | reserved                   |
+ *
+ * | Offset | Type       | Event field                  |
+ * |--------|------------|------------------------------|
+ * | 0      | int32      | time, in microseconds        |
+ * | 4      | uint8      | #oshu::input_event::type     |
+ * | 5      | int8       | #oshu::input_event::key      |
+ * | 6      | uint16     | reserved                     |
+ * | 8      | float32[2] | mouse position               |
+ *
+ * \{
+ */
+
+struct replay {
+	/**
+	 * Hash of the beatmap file, from #oshu::hash_file, to detect replays
+	 * played on another beatmap.
+	 */
+	uint64_t beatmap_hash = 0;
+	/**
+	 * The events, sorted by time.
+	 */
+	std::vector<oshu::input_event> events;
+};
+
+/**
+ * Append an event to a replay.
+ *
+ * When the game is rewound, the events recorded after the new time are
+ * dropped, so that the replay follows what the player finally did. Mouse
+ * moves that don't move the mouse are ignored.
+ */
+void record_input(oshu::replay *replay, const oshu::input_event &event);
+
+/**
+ * Write a replay file.
+ *
+ * \return 0 on success, -1 on failure after logging an error.
+ */
+int save_replay(const oshu::replay *replay, const char *path);
+
+/**
+ * Read a replay file.
+ *
+ * \return 0 on success, -1 on failure after logging an error.
+ */
+int load_replay(const char *path, oshu::replay *replay);
+
+/** \} */
+
+}
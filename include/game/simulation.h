@@ -0,0 +1,103 @@
+/**
+ * \file game/simulation.h
+ * \ingroup game_simulation
+ */
+
+#pragma once
+
+#include "core/geometry.h"
+#include "game/controls.h"
+
+#include <vector>
+
+namespace oshu {
+
+struct osu_game;
+
+/**
+ * \defgroup game_simulation Simulation
+ * \ingroup game
+ *
+ * \brief
+ * Play a game without window, audio, or real time.
+ *
+ * The game logic only needs a clock and some input. In a simulation, the
+ * clock is synthetic and advances by fixed steps, and the input is a script of
+ * timed events. Nothing waits, so a whole beatmap is simulated in much less
+ * time than it would take to play it.
+ *
+ * The game must be created headless, so that it doesn't open the audio
+ * device. Its score is then read with #oshu::score, like at the end of a real
+ * game.
+ *
+ * ```c
+ * oshu::osu_game game(path, true);
+ * game.autoplay = true;
+ * oshu::simulate(&game, {});
+ * double score = oshu::score(&game.beatmap);
+ * ```
+ *
+ * \{
+ */
+
+/**
+ * One scripted input.
+ */
+struct input_event {
+	enum input_type {
+		/**
+		 * Move the mouse to #position.
+		 */
+		MOVE,
+		/**
+		 * Press #key, with the mouse at #position.
+		 */
+		PRESS,
+		/**
+		 * Release #key.
+		 */
+		RELEASE,
+	};
+	/**
+	 * Time of the event on the game clock, in seconds.
+	 */
+	double time;
+	enum input_type type;
+	enum oshu::finger key;
+	/**
+	 * Position of the mouse in game coordinates.
+	 */
+	oshu::point position;
+};
+
+/**
+ * A mouse whose position is set by the simulation.
+ */
+struct scripted_mouse : public oshu::mouse {
+	oshu::point at = 0;
+	oshu::point position() override { return at; }
+};
+
+/**
+ * Time between two game checks in a simulation, in seconds.
+ *
+ * It's finer than any frame rate, so that the judgment is at least as precise
+ * as in a real game.
+ */
+static const double simulation_step = .001;
+
+/**
+ * Play the whole beatmap on a headless game.
+ *
+ * The game starts from the beginning, and ends once the last hit can't be
+ * judged anymore. The events must be sorted by time.
+ *
+ * If the game has no mouse, a #oshu::scripted_mouse is attached to it.
+ *
+ * \return 0 on success, -1 if the game isn't headless.
+ */
+int simulate(oshu::osu_game *game, const std::vector<oshu::input_event> &events, double step = simulation_step);
+
+/** \} */
+
+}
@@ -0,0 +1,255 @@
+/**
+ * \file game/spectator.h
+ * \ingroup game_spectator
+ */
+
+#pragma once
+
+#include "beatmap/beatmap.h"
+#include "game/simulation.h"
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+
+namespace oshu {
+
+class game_base;
+
+/**
+ * \defgroup game_spectator Spectator
+ * \ingroup game
+ *
+ * \brief
+ * Stream a game live to another oshu!, and watch it there.
+ *
+ * A game with a #oshu::publisher sends what happens in it as it happens: the
+ * key presses and releases, the mouse position sampled at about 120 Hz, the
+ * final judgment of every hit, and its clock a few times per second. A game
+ * with a #oshu::spectator receives that stream and replays it with a short
+ * delay, driving the game like a player would.
+ *
+ * The stream is made of datagrams, sent over UDP to a `HOST:PORT` address, or
+ * through a Unix datagram socket when the address is a path, which must then
+ * contain a `/`. The spectator listens on that address, and the publisher
+ * sends to it. Lost datagrams are lost: the inputs they held are missed, but
+ * the judgments and the clock of the following datagrams correct the
+ * spectator's game. Records whose key or state is not one the game produces
+ * are dropped on reception.
+ *
+ * The game thread never touches the socket. It pushes the records into a
+ * lock-free queue, which a sender thread empties into a datagram every few
+ * milliseconds. When the queue is full, the records are dropped. On the
+ * spectator's side, a receiver thread fills a queue the game thread empties
+ * between two frames.
+ *
+ * Every datagram is a 16-byte header followed by up to 64 records of 16 bytes,
+ * all in little-endian:
+ *
+ * | Offset | Type       | Header field               |
+ * |--------|------------|----------------------------|
+ * | 0      | char[4]    | `oshs`                     |
+ * | 4      | uint32     | sequence number            |
+ * | 8      | uint64     | hash of the beatmap file   |
+ *
+ * | Offset | Type       | Record field                                          |
+ * |--------|------------|-------------------------------------------------------|
+ * | 0      | int32      | time on the game clock, in milliseconds               |
+ * | 4      | uint8      | #oshu::spectator_record::record_type                  |
+ * | 5      | int8       | key for inputs, state for judgments, paused for clock |
+ * | 6      | uint16     | reserved                                              |
+ * | 8      | float32[2] | mouse position for inputs                             |
+ * | 8      | int32      | position of the hit in the hit index, for judgments   |
+ * | 12     | float32    | offset of the hit, in seconds, for judgments          |
+ *
+ * \{
+ */
+
+struct spectator_record {
+	/**
+	 * The first three are the same as #oshu::input_event::input_type.
+	 */
+	enum record_type {
+		MOVE,
+		PRESS,
+		RELEASE,
+		/**
+		 * A hit was judged #oshu::GOOD_HIT or #oshu::MISSED_HIT.
+		 */
+		JUDGMENT,
+		/**
+		 * The clock of the game, sent periodically and whenever it
+		 * jumps.
+		 */
+		CLOCK,
+	};
+	/**
+	 * Milliseconds are precise enough for the game clock, and last for weeks
+	 * where microseconds would overflow after 35 minutes.
+	 */
+	int32_t time;
+	uint8_t type;
+	int8_t key;
+	uint16_t reserved;
+	union {
+		float x;
+		int32_t hit;
+	};
+	union {
+		float y;
+		float offset;
+	};
+};
+
+/**
+ * Lock-free queue between one producer thread and one consumer thread.
+ *
+ * The producer owns #head and the consumer owns #tail.
+ */
+struct spectator_queue {
+	static const uint64_t capacity = 4096;
+	oshu::spectator_record records[capacity];
+	std::atomic<uint64_t> head {0};
+	std::atomic<uint64_t> tail {0};
+};
+
+/**
+ * The sending end of the stream.
+ */
+struct publisher {
+	int socket = -1;
+	struct sockaddr_storage address;
+	socklen_t address_size;
+	uint64_t beatmap_hash;
+	oshu::spectator_queue queue;
+	std::thread sender;
+	std::atomic<bool> stop {false};
+	/**
+	 * Records that didn't fit in the queue, or whose datagram could not
+	 * be sent.
+	 */
+	std::atomic<uint64_t> dropped {0};
+	/**
+	 * The state of the game thread, to sample the moves and the clock.
+	 */
+	double last_move;
+	oshu::point last_position;
+	double last_clock;
+	double last_clock_system;
+	bool last_paused;
+};
+
+/**
+ * Start publishing a game to *address*.
+ *
+ * \return 0 on success, -1 on failure after logging an error.
+ */
+int open_publisher(const char *address, uint64_t beatmap_hash, oshu::publisher *publisher);
+
+/**
+ * Send the last records, and stop the sender thread.
+ *
+ * It is safe to call this function on a closed publisher.
+ */
+void close_publisher(oshu::publisher *publisher);
+
+/**
+ * Publish a key press or release, or a mouse move.
+ *
+ * The moves are dropped when they don't move the mouse, or when the previous
+ * one was less than about 8 milliseconds ago.
+ */
+void publish_input(oshu::publisher *publisher, const oshu::input_event &event);
+
+/**
+ * Publish the judgment of *hit*.
+ *
+ * Only the final states are sent, since the spectator's game produces the
+ * intermediate ones by itself. The hit is identified by its position in
+ * #oshu::game_base::hit_index, which is the same on both ends for the same
+ * beatmap.
+ */
+void publish_judgment(oshu::publisher *publisher, const oshu::game_base *game, const oshu::hit *hit, enum oshu::hit_state state);
+
+/**
+ * Publish the clock of the game, if it wasn't sent recently, or if it jumped,
+ * or if the game was paused or resumed.
+ *
+ * Call it on every frame.
+ */
+void publish_clock(oshu::publisher *publisher, const oshu::game_base *game);
+
+/**
+ * The receiving end of the stream.
+ */
+struct spectator {
+	int socket = -1;
+	/**
+	 * Path of the Unix socket, removed when the spectator is closed.
+	 */
+	std::string path;
+	uint64_t beatmap_hash;
+	oshu::spectator_queue queue;
+	std::thread receiver;
+	std::atomic<bool> stop {false};
+	/**
+	 * The state of the game thread.
+	 *
+	 * The received records wait in #pending until the game clock reaches
+	 * them.
+	 */
+	std::deque<oshu::spectator_record> pending;
+	/**
+	 * The mouse of the spectated player, to attach to the game.
+	 */
+	std::shared_ptr<oshu::scripted_mouse> mouse;
+	/**
+	 * The last clock received, and the process time it was received at,
+	 * or a negative #received_at before the first one.
+	 */
+	double remote_clock;
+	double received_at;
+	bool remote_paused;
+};
+
+/**
+ * Start listening to a stream on *address*.
+ *
+ * Streams of other beatmaps than the one whose hash is *beatmap_hash* are
+ * ignored.
+ *
+ * \return 0 on success, -1 on failure after logging an error.
+ */
+int open_spectator(const char *address, uint64_t beatmap_hash, oshu::spectator *spectator);
+
+/**
+ * Stop the receiver thread, and close the socket.
+ *
+ * It is safe to call this function on a closed spectator.
+ */
+void close_spectator(oshu::spectator *spectator);
+
+/**
+ * Replay the received events on *game*, up to its clock.
+ *
+ * The game is kept #oshu::spectator_delay behind the player: it is paused
+ * until the stream starts, or while the player is paused or gone, and moved
+ * forward or backward when the clocks grow apart.
+ *
+ * Call it on every frame, before checking the game.
+ */
+void follow(oshu::spectator *spectator, oshu::game_base *game);
+
+/**
+ * How long the spectator's game lags behind the player's, in seconds, for the
+ * records to arrive before the game needs them.
+ */
+static const double spectator_delay = .5;
+
+/** \} */
+
+}
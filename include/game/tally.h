@@ -0,0 +1,81 @@
+/**
+ * \file game/tally.h
+ * \ingroup game_tally
+ */
+
+#pragma once
+
+#include "beatmap/beatmap.h"
+
+#include <vector>
+
+namespace oshu {
+
+/**
+ * \defgroup game_tally Tally
+ * \ingroup game
+ *
+ * \brief
+ * Keep the score up to date as the hits are judged.
+ *
+ * #oshu::score walks the whole beatmap, which is fine once at the end but not
+ * at every frame. Instead, every state change of a hit goes through
+ * #oshu::judge_hit, which updates the running #oshu::tally in constant time.
+ * The game modes call it through #oshu::judge.
+ *
+ * The judgment counts are sums, so undoing a judgment, like when rewinding,
+ * only means subtracting it. The combo can't be undone that way, because it
+ * depends on the order of the judgments, so the tally keeps a checkpoint of
+ * the combo after every judgment. When judgments are undone, the checkpoints
+ * of the hits that are no longer judged are dropped from the end, and the
+ * combo is restored from the last remaining one.
+ *
+ * \{
+ */
+
+/**
+ * The combo after a judgment.
+ */
+struct combo_checkpoint {
+	oshu::hit *hit;
+	int combo;
+	int max_combo;
+};
+
+struct tally {
+	/**
+	 * Hits judged good within half the leniency, worth 1 point.
+	 */
+	int great;
+	/**
+	 * Hits judged good, but more than half the leniency early or late,
+	 * worth ⅓ of a point.
+	 */
+	int early;
+	int late;
+	int missed;
+	/**
+	 * Number of good hits in a row, since the last miss.
+	 */
+	int combo;
+	int max_combo;
+	std::vector<oshu::combo_checkpoint> checkpoints;
+};
+
+/**
+ * Change the state of a hit, and update the tally to match.
+ *
+ * For good hits, #oshu::hit::offset must be set beforehand.
+ */
+void judge_hit(oshu::tally *tally, const oshu::beatmap *beatmap, oshu::hit *hit, enum oshu::hit_state state);
+
+/**
+ * Compute the score like #oshu::score would.
+ *
+ * \return A number between 0 and 1, or NaN if no hit was judged yet.
+ */
+double tally_score(const oshu::tally *tally);
+
+/** \} */
+
+}
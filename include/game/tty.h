@@ -8,6 +8,7 @@
 namespace oshu {
 
 class game_base;
+struct calibration;
 
 /**
  * \defgroup game_tty TTY
@@ -39,22 +40,41 @@ class game_base;
  */
 void welcome(oshu::game_base *game);
 
+/**
+ * How often the status line is refreshed, in seconds.
+ */
+static const double status_interval = .1;
+
 /**
  * Show the state of the game (paused/playing) and the current song position.
  *
  * Only do that for terminal outputs in order not to spam something if the
  * output is redirected.
  *
+ * The line is refreshed at most every #oshu::status_interval, unless *force*
+ * is set, like when the game is paused. It's written in a single `write`,
+ * and only when the terminal is ready to take it, so a slow terminal makes the
+ * line skip updates rather than stall the game.
+ *
+ * With `-v`, the line also shows the frame rate, the missed frames and the
+ * audio underruns.
+ *
  * The state length must not decrease over time, otherwise you end up with
  * glitches. If you write `foo\rx`, you get `xoo`. This is the reason the
  * Paused string literal has an extra space.
  */
-void print_state(oshu::game_base *game);
+void print_state(oshu::game_base *game, bool force = false);
+
+/**
+ * Show the mean and the jitter of the calibration taps on the status line.
+ */
+void print_calibration(const oshu::calibration *calibration);
 
 /**
  * Congratulate the user when the beatmap is over.
  *
- * Show the number of good hits and bad hits.
+ * Show the number of good hits and bad hits, and how early or late they were
+ * on average.
  */
 void congratulate(oshu::game_base *game);
 
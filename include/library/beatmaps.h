@@ -6,7 +6,10 @@
 #pragma once
 
 #include "beatmap/beatmap.h"
+#include "library/strings.h"
 
+#include <functional>
+#include <stdint.h>
 #include <iosfwd>
 #include <string>
 #include <vector>
@@ -38,35 +41,61 @@ namespace oshu {
  * The beatmap set is `651934 Kaori Oda - Zero Tokei (Short ver.)`, and
  * contains 3 beatmaps entry.
  *
+ * A set may also be left packed as `651934 Kaori Oda - Zero Tokei (Short
+ * ver.).osz`, in which case its beatmaps are read from the archive in place.
+ * Their path goes through the archive, as described in \ref core_vfs.
+ *
  * \{
  */
 
 /**
  * Gather the key information of a beatmap.
  *
- * To save resources, it uses #oshu::load_beatmap_headers.
+ * To save resources, the hit objects are counted and rated as they are parsed,
+ * but not stored, and the strings are interned, as described in
+ * \ref library_strings. An entry is therefore a flat, trivially copyable
+ * record, and the difficulties of a set share the same strings.
  *
  * \todo
  * Reuse the beatmap structure?
  */
 struct beatmap_entry {
+	/**
+	 * Create an empty entry, to be filled from the library manifest.
+	 */
+	beatmap_entry() = default;
 	explicit beatmap_entry(const std::string &path);
-	oshu::mode mode;
+	oshu::mode mode {};
 	/**
-	 * Difficulty indicator.
-	 *
-	 * Naively, use the overall difficulty because there's nothing to
-	 * compute. More advanced difficulty calculators exist but this would
-	 * multiply the time required to build an index.
+	 * The overall difficulty declared by the beatmap.
 	 */
-	int difficulty;
-	std::string title;
-	std::string artist;
-	std::string version;
+	int difficulty {};
+	/**
+	 * The star rating computed by \ref beatmap_stars, which is what the sets
+	 * are sorted by.
+	 */
+	double stars {};
+	oshu::interned title;
+	oshu::interned artist;
+	oshu::interned version;
 	/**
 	 * Path to the .osu beatmap the entry was constructed with.
 	 */
-	std::string path;
+	oshu::interned path;
+	/**
+	 * Content hash of the .osu file, from #oshu::hash_file.
+	 *
+	 * It identifies the beatmap wherever it's stored, like in replays.
+	 */
+	uint64_t hash {};
+	/**
+	 * Time at which the last hit object ends, in seconds.
+	 */
+	double duration {};
+	/**
+	 * Number of hit objects.
+	 */
+	int objects {};
 };
 
 /**
@@ -80,14 +109,23 @@ struct beatmap_entry {
  * Print a warning if the BeatmapSetID of beatmaps is inconsistent.
  */
 struct beatmap_set {
+	beatmap_set() = default;
 	explicit beatmap_set(const std::string &path);
 	/**
-	 * List of beatmap entries inside this set, sorted by difficulty.
+	 * List of beatmap entries inside this set, sorted by star rating.
 	 */
 	std::vector<beatmap_entry> entries;
 	bool empty() const;
-	std::string title;
-	std::string artist;
+	/**
+	 * The title and artist of the first entry, which the sets are sorted
+	 * by.
+	 */
+	oshu::interned title;
+	oshu::interned artist;
+	/**
+	 * Path to the set's directory or archive.
+	 */
+	std::string path;
 };
 
 /**
@@ -95,13 +133,39 @@ struct beatmap_set {
  *
  * The entries are sorted alphabetically by artist, then by title.
  *
+ * The sets are independent from each other, so they are built in parallel by
+ * a pool of threads, one per CPU core.
+ *
+ * When *manifest* is not empty, it is the path to a file recording the size,
+ * modification time, headers and content hash of every beatmap scanned by the
+ * previous call. The beatmaps whose size and time haven't changed since are taken
+ * from the manifest instead of being parsed again. The manifest is then
+ * rewritten to reflect the current state of the library. A missing or
+ * invalid manifest is not an error and merely triggers a full scan.
+ *
+ * Identical beatmaps, like a set that is both extracted and archived, are
+ * listed only once, judging by their #oshu::beatmap_entry::hash.
+ *
  * \warning
- * This function is expensive.
+ * This function is expensive, at least the first time.
  *
  * \todo
  * Provide an iterator interface, if needed?
  */
-std::vector<beatmap_set> find_beatmap_sets(const std::string &path);
+std::vector<beatmap_set> find_beatmap_sets(const std::string &path, const std::string &manifest = "");
+
+/**
+ * Scan the beatmap sets like #find_beatmap_sets, but without gathering them.
+ *
+ * Every non-empty set is passed to *sink* as soon as it is built, in no
+ * particular order. The sink is always called from the calling thread, while
+ * the worker threads go on scanning the other sets, so slow processing in the
+ * sink overlaps the parsing.
+ *
+ * If the sink throws, the scan stops and the exception is rethrown once the
+ * workers are done. The manifest is not updated in that case.
+ */
+void scan_beatmap_sets(const std::string &path, const std::string &manifest, const std::function<void(beatmap_set&&)> &sink);
 
 /** } */
 
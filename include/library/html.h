@@ -16,6 +16,8 @@
 #include "library/beatmaps.h"
 
 #include <iosfwd>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace oshu {
@@ -41,16 +43,127 @@ class html_escape {
 public:
 	explicit html_escape(const char*);
 	explicit html_escape(const std::string&);
+	explicit html_escape(oshu::interned);
 	friend std::ostream& operator<<(std::ostream&, const html_escape&);
 private:
 	const char *data;
 };
 
+/**
+ * Write an HTML listing incrementally, one beatmap set at a time.
+ *
+ * The page header is written on construction, and the sets appear in the
+ * order they are added.
+ */
+class html_listing {
+public:
+	explicit html_listing(std::ostream&);
+	void add(const oshu::beatmap_set&);
+private:
+	std::ostream &os;
+};
+
+/**
+ * The HTML fragment of a set, with just enough to sort it.
+ */
+struct html_fragment {
+	oshu::interned artist;
+	oshu::interned title;
+	/**
+	 * The anchor of the set in its page, derived from its path.
+	 */
+	std::string id;
+	std::string html;
+};
+
+/**
+ * An HTML listing kept in memory as one fragment per set, so that a change to
+ * a set only renders that set again.
+ */
+class html_index {
+public:
+	/**
+	 * Render a set, replacing the previous version of the set with the
+	 * same #oshu::beatmap_set::path. Empty sets are removed.
+	 */
+	void update(const oshu::beatmap_set&);
+	/**
+	 * Forget the set at *path*, if it was there.
+	 */
+	void remove(const std::string &path);
+	/**
+	 * Write the whole page, with the sets sorted like
+	 * #oshu::find_beatmap_sets.
+	 */
+	void write(std::ostream&) const;
+	/**
+	 * Write the listing into *directory*, split into shards.
+	 *
+	 * The sets are sorted like #write, and grouped by the initial of their
+	 * artist into `index-a.html` to `index-z.html`, `index-0.html` for the
+	 * digits, and `index-other.html` for the rest. `index.html` is a small
+	 * landing page with links to the shards and a search box, which looks
+	 * the sets up in `index.json`, a manifest of every set with its artist,
+	 * title, shard and anchor.
+	 *
+	 * Every file is written along with its gzipped version, for the web
+	 * servers that serve precompressed files, in parallel. Files whose
+	 * content did not change are left alone, so that a change to a set only
+	 * rewrites its shard and the two index files. Stale shards are removed.
+	 *
+	 * Each file is replaced atomically.
+	 *
+	 * Throw a *std::system_error* on failure.
+	 *
+	 * eturn The number of files rewritten.
+	 */
+	size_t write_shards(const std::string &directory) const;
+	size_t size() const;
+	/**
+	 * The audio preview of every set, by #oshu::beatmap_set::path, as a URL
+	 * relative to the page.
+	 *
+	 * Sets rendered by #update after it's filled get an audio player.
+	 *
+	 * \sa oshu::load_preview_map
+	 */
+	std::unordered_map<std::string, std::string> previews;
+private:
+	std::unordered_map<std::string, oshu::html_fragment> fragments;
+};
+
+/**
+ * Read the list of audio previews written by `oshu-library previews`, made of
+ * lines with the path of a set, a tab, and the URL of its preview.
+ *
+ * A missing list is empty.
+ */
+std::unordered_map<std::string, std::string> load_preview_map(const std::string &path);
+
+/**
+ * Write the list of audio previews read by #oshu::load_preview_map.
+ *
+ * Throw a *std::system_error* on failure.
+ */
+void save_preview_map(const std::string &path, const std::unordered_map<std::string, std::string> &previews);
+
 /**
  * Generate an HTML listing of a list of beatmap sets.
  */
 void generate_html_beatmap_set_listing(const std::vector<oshu::beatmap_set>&, std::ostream&);
 
+/**
+ * Scan a beatmap library and generate its HTML listing, sorted like
+ * #oshu::find_beatmap_sets.
+ *
+ * The sets are rendered into HTML as soon as #oshu::scan_beatmap_sets
+ * delivers them, while the scan goes on. Only the rendered fragments are kept
+ * until the final sort, instead of the whole beatmap sets.
+ *
+ * *manifest* is passed as is to #oshu::scan_beatmap_sets.
+ */
+void generate_html_beatmap_library_listing(const std::string &path, const std::string &manifest, std::ostream&);
+
 /** } */
 
 }
@@ -0,0 +1,119 @@
+/**
+ * \file include/library/index.h
+ * \ingroup library_index
+ */
+
+#pragma once
+
+#include "core/vfs.h"
+#include "library/beatmaps.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace oshu {
+
+/**
+ * \defgroup library_index Index
+ * \ingroup library
+ *
+ * \brief
+ * Search the library without scanning it.
+ *
+ * The index is a binary file listing every #oshu::beatmap_entry of the
+ * library, written by #oshu::save_beatmap_index and mapped in memory by
+ * #oshu::beatmap_index. Its layout is columnar: each field of the entries is
+ * stored in an array of its own, and the strings in a common pool, so that
+ * loading it costs nothing and a search only reads what it needs.
+ *
+ * The search is a case-insensitive substring match on the artist, title and
+ * version of the beatmaps. To avoid comparing every entry, the index lists,
+ * for every trigram (sequence of three bytes), the entries containing it.
+ * Only the entries containing all the trigrams of the query are compared.
+ *
+ * The file is a cache: it is written in the byte order of the machine, and
+ * rebuilt rather than converted when its format changes.
+ *
+ * \{
+ */
+
+/**
+ * Write the index of *entries* to *path*, atomically.
+ *
+ * The entries are sorted by artist, title and star rating. Identical beatmaps,
+ * judging by their #oshu::beatmap_entry::hash, are indexed only once.
+ *
+ * Throw a *std::system_error* on failure.
+ */
+void save_beatmap_index(const std::string &path, std::vector<oshu::beatmap_entry> entries);
+
+/**
+ * An index file mapped in memory.
+ */
+class beatmap_index {
+public:
+	/**
+	 * Map the index at *path*.
+	 *
+	 * Throw a *std::runtime_error* if the file is missing or invalid.
+	 */
+	explicit beatmap_index(const std::string &path);
+	~beatmap_index();
+	beatmap_index(const beatmap_index&) = delete;
+	beatmap_index& operator=(const beatmap_index&) = delete;
+	size_t size() const;
+	/**
+	 * Copy the *i*th entry out of the index.
+	 */
+	oshu::beatmap_entry entry(uint32_t i) const;
+	/**
+	 * Find the entries matching every word of the *query*, in index order.
+	 *
+	 * An empty query matches everything.
+	 */
+	std::vector<uint32_t> search(const std::string &query) const;
+private:
+	oshu::file_view file;
+	uint32_t count;
+	const uint64_t *hashes;
+	const double *durations;
+	const double *stars;
+	const int32_t *difficulties;
+	const int32_t *objects;
+	/**
+	 * Offsets in #pool.
+	 */
+	const uint32_t *titles, *artists, *versions, *paths;
+	/**
+	 * Offsets in #pool of the lowercased artist, title and version,
+	 * separated by newlines, which is what queries are matched against.
+	 */
+	const uint32_t *texts;
+	const uint8_t *modes;
+	struct trigram {
+		uint32_t key;
+		/**
+		 * Index of the first posting, in #postings. The postings of a
+		 * trigram end where the next trigram's begin.
+		 */
+		uint32_t first;
+	};
+	/**
+	 * Sorted by key, and followed by a sentinel.
+	 */
+	const trigram *trigrams;
+	uint32_t trigram_count;
+	/**
+	 * Entry numbers, in increasing order for every trigram.
+	 */
+	const uint32_t *postings;
+	const char *pool;
+	uint32_t pool_size;
+	bool matches(uint32_t i, const std::vector<std::string> &words) const;
+	const uint32_t *find_postings(uint32_t key, size_t *count) const;
+};
+
+/** \} */
+
+}
@@ -0,0 +1,91 @@
+/**
+ * \file include/library/strings.h
+ * \ingroup library_strings
+ */
+
+#pragma once
+
+#include <iosfwd>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+namespace oshu {
+
+/**
+ * \defgroup library_strings Strings
+ * \ingroup library
+ *
+ * \brief
+ * Store the strings of the library once.
+ *
+ * All the difficulties of a set share their artist and title, and a library
+ * may hold a hundred thousand of them. Instead of a heap-allocated
+ * *std::string* per field per entry, the strings are interned: every distinct
+ * string is stored once, in an arena shared by the whole process, and the
+ * entries only hold a pointer to it, an #oshu::interned handle.
+ *
+ * Along with its characters, every pooled string keeps its first bytes packed
+ * into an integer, so that sorting the entries rarely has to look at the
+ * characters, and equal strings are told apart by their address alone.
+ *
+ * The pool is never freed, since the strings of a library live as long as the
+ * process anyway. It may be used from several threads at once.
+ *
+ * \{
+ */
+
+/**
+ * A string in the pool.
+ *
+ * Its characters follow it right away, and are null-terminated.
+ */
+struct pooled_string {
+	/**
+	 * The first 8 bytes of the string, big-endian, padded with zeros, so
+	 * that comparing two prefixes orders the strings like *strcmp*, unless
+	 * they are equal.
+	 */
+	uint64_t prefix;
+	size_t size;
+	const char* data() const { return reinterpret_cast<const char*>(this + 1); }
+};
+
+/**
+ * Find a string in the pool, or add it.
+ */
+const oshu::pooled_string* intern(const char *data, size_t size);
+
+/**
+ * A handle to an interned string, as small as a pointer, and trivially
+ * copyable.
+ *
+ * A default-constructed handle is the empty string.
+ */
+class interned {
+public:
+	interned();
+	interned(const char *str);
+	interned(const std::string &str);
+	const char* c_str() const { return string->data(); }
+	size_t size() const { return string->size; }
+	bool empty() const { return string->size == 0; }
+	std::string str() const { return std::string(string->data(), string->size); }
+	/**
+	 * Interned strings are equal when they are the same string.
+	 */
+	bool operator==(interned other) const { return string == other.string; }
+	bool operator!=(interned other) const { return string != other.string; }
+	/**
+	 * Byte-wise order, like *std::string*'s.
+	 */
+	bool operator<(interned other) const;
+private:
+	const oshu::pooled_string *string;
+};
+
+std::ostream& operator<<(std::ostream &os, interned str);
+
+/** \} */
+
+}
@@ -0,0 +1,82 @@
+/**
+ * \file include/library/watch.h
+ * \ingroup library_watch
+ */
+
+#pragma once
+
+#include <set>
+#include <string>
+#include <unordered_map>
+
+namespace oshu {
+
+/**
+ * \defgroup library_watch Watch
+ * \ingroup library
+ *
+ * \brief
+ * Follow the changes to a beatmaps directory.
+ *
+ * The library is watched with Linux's inotify, both the root directory, for
+ * added and removed sets, and every set directory, for changed .osu files.
+ * The changes are reported by set, so that only the affected sets need
+ * scanning again.
+ *
+ * \{
+ */
+
+/**
+ * What changed in the library since the last call to
+ * #oshu::library_watcher::wait.
+ */
+struct library_changes {
+	/**
+	 * Paths of the changed sets, like #oshu::beatmap_set::path, whether
+	 * they were created, modified or removed.
+	 */
+	std::set<std::string> sets;
+	/**
+	 * The kernel dropped events, so all the sets must be scanned again.
+	 */
+	bool overflow = false;
+};
+
+/**
+ * An inotify instance watching a beatmaps directory.
+ */
+class library_watcher {
+public:
+	/**
+	 * Start watching the directory at *root*, which is the path given to
+	 * #oshu::find_beatmap_sets.
+	 *
+	 * Throw a *std::system_error* if inotify is not available.
+	 */
+	explicit library_watcher(const std::string &root);
+	~library_watcher();
+	library_watcher(const library_watcher&) = delete;
+	library_watcher& operator=(const library_watcher&) = delete;
+	/**
+	 * Wait for changes, and keep gathering them until nothing happens for
+	 * *quiet* seconds, so that a set being extracted is reported once.
+	 *
+	 * \return false if the wait was interrupted by a signal, in which case
+	 * *changes* may be incomplete.
+	 */
+	bool wait(oshu::library_changes *changes, double quiet);
+private:
+	void watch_set(const std::string &path);
+	void read_events(oshu::library_changes *changes);
+	std::string root;
+	int fd;
+	/**
+	 * Map the watch descriptors of the set directories to their path.
+	 */
+	std::unordered_map<int, std::string> sets;
+	int root_watch;
+};
+
+/** \} */
+
+}
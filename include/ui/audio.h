@@ -7,8 +7,8 @@
 
 namespace oshu {
 
+struct audio;
 struct display;
-struct stream;
 
 /**
  * \defgroup ui_audio Audio
@@ -21,7 +21,7 @@ struct stream;
  */
 
 /**
- * The audio progress bar show what part of a stream is currently playing.
+ * The audio progress bar show what part of the music is currently playing.
  *
  * It appears as a full-width transparent bar that fills as the song is played.
  *
@@ -31,17 +31,17 @@ struct stream;
  */
 struct audio_progress_bar {
 	oshu::display *display;
-	oshu::stream *stream;
+	oshu::audio *audio;
 };
 
 /**
- * Create an audio progress bar for an audio stream.
+ * Create an audio progress bar for the music of an audio pipeline.
  *
- * The audio stream must exist at least as long as the widget.
+ * The audio pipeline must exist at least as long as the widget.
  *
- * The stream must have a non-zero duration.
+ * The music must have a non-zero duration.
  */
-int create_audio_progress_bar(oshu::display *display, oshu::stream *stream, oshu::audio_progress_bar *bar);
+int create_audio_progress_bar(oshu::display *display, oshu::audio *audio, oshu::audio_progress_bar *bar);
 
 /**
  * Display the progress bar at the bottom of the screen.
@@ -5,8 +5,15 @@
 
 #pragma once
 
+#include "video/layer.h"
+#include "video/movie.h"
 #include "video/texture.h"
 
+#include <future>
+#include <memory>
+
+struct SDL_Surface;
+
 namespace oshu {
 
 struct display;
@@ -16,20 +23,27 @@ struct display;
  * \ingroup ui
  *
  * \brief
- * Picture background.
+ * Picture and video background.
  *
  * To enable this module, the #oshu::SHOW_BACKGROUND flag must be enabled for
  * the display. Otherwise, this module behaves like a stub and does nothing.
  *
+ * Decoding and scaling a big picture takes a while, so it's done on a
+ * background thread while the game loads, and the window stays black until
+ * the picture is ready. The scaled pictures are cached in
+ * `~/.oshu/cache/backgrounds`, for each window size.
+ *
+ * The beatmaps with a video play it over the picture, with an \ref
+ * video_movie. The video frames are drawn straight from their streaming
+ * texture, without the layer.
+ *
  * \{
  */
 
 /**
  * Define the game background.
  *
- * Today, only a static image is supported.
- *
- * Tomorrow, it could be a video, or a pattern, or something else.
+ * It's a static image, possibly covered by a video.
  *
  * Depending on the game state, the background can be darkened to make the game
  * objects more visible.
@@ -58,16 +72,40 @@ struct background {
 	 * can safely assume the background is a valid object.
 	 */
 	oshu::texture picture;
+	/**
+	 * The scaled picture being loaded, until it's uploaded by
+	 * #oshu::show_background.
+	 */
+	std::future<SDL_Surface*> loader;
+	/**
+	 * The scaled and darkened picture, drawn again only when the
+	 * brightness or the window size changes.
+	 */
+	oshu::layer layer;
+	/**
+	 * The video, or null.
+	 *
+	 * It's behind a pointer because the movie's thread and mutex can't be
+	 * moved.
+	 */
+	std::unique_ptr<oshu::movie> movie;
+	/**
+	 * The clock the video follows, in seconds, and the time on that clock
+	 * at which the video starts.
+	 */
+	const double *clock = nullptr;
+	double video_offset = 0;
 };
 
 /**
- * Load a background picture with SDL2_image.
+ * Start loading a background picture with SDL2_image, on another thread.
  *
  * You must free the background with #oshu::destroy_background.
  *
  * On error, returns -1, but the #oshu::background object remains safe to use
  * with #oshu::show_background and #oshu::destroy_background. It is therefore
- * safe to ignore errors here.
+ * safe to ignore errors here. Errors while decoding the picture are only
+ * logged, and leave the background black.
  *
  * The background is pre-scaled to avoid keeping a huge texture in video
  * memory, and that makes the background rendering much faster as no scaling is
@@ -78,6 +116,28 @@ struct background {
  */
 int load_background(oshu::display *display, const char *filename, oshu::background *background);
 
+/**
+ * Play a video in the background, over the picture.
+ *
+ * Call it after #oshu::load_background, if any. The video starts when *clock*
+ * reaches *offset*, and follows it from there, which means the clock must
+ * outlive the background.
+ *
+ * Until the video starts, and when it can't be played, the picture is shown
+ * instead. Like the picture, the errors are safe to ignore.
+ */
+int load_background_video(oshu::display *display, const char *filename, double offset, const double *clock, oshu::background *background);
+
+/**
+ * Scale a background picture for a view of size *screen*, and store the
+ * result in the cache, so that #oshu::load_background finds it there later.
+ *
+ * It doesn't need a display, and may be called from any thread, like when
+ * loading the next beatmap of a playlist in advance. Pictures too small to be
+ * scaled are not cached, as they are cheap to load anyway.
+ */
+void prefetch_background(const char *filename, oshu::size screen);
+
 /**
  * Display the background such that it fills the whole screen.
  *
@@ -87,7 +147,8 @@ int load_background(oshu::display *display, const char *filename, oshu::backgrou
  *
  * You should also fill the screen with a solid color in case the background
  * couldn't be loaded, because if the background picture is missing, nothing is
- * done.
+ * done. This is also the case until the picture is loaded, after which it is
+ * uploaded on the first call.
  *
  * The brightness is a number in [0, 1] where 0 is the darkest variation of the
  * background, and 1 is the original picture. 0 is not an absolute zero, but a
@@ -96,11 +157,21 @@ int load_background(oshu::display *display, const char *filename, oshu::backgrou
  *
  * You may use #oshu::trapezium for the brightness to implement a fading-in
  * fading-out effect.
+ *
+ * The result is kept in a \ref video_layer, so that drawing the same
+ * background again costs a single copy. While a video plays, its current frame
+ * is drawn instead.
  */
 void show_background(oshu::background *background, double brightness);
 
 /**
- * Free the background picture.
+ * Draw the background again next time, because the renderer lost the cached
+ * layer.
+ */
+void invalidate_background(oshu::background *background);
+
+/**
+ * Free the background picture, and close the video.
  */
 void destroy_background(oshu::background *background);
 
@@ -69,10 +69,17 @@ int create_cursor(oshu::display *display, oshu::cursor_widget *cursor);
  * this function is always called with the same view.
  *
  * Every call to this function update the mouse position history, affecting the
- * cursor trail.
+ * cursor trail. The whole trail is drawn in one batch when the renderer
+ * supports geometry.
  */
 void show_cursor(oshu::cursor_widget *cursor);
 
+/**
+ * Draw the cursor at *position*, in the coordinates of the current view,
+ * rather than where the mouse is.
+ */
+void show_cursor(oshu::cursor_widget *cursor, oshu::point position);
+
 /**
  * Free the cursor's texture.
  *
@@ -0,0 +1,61 @@
+/**
+ * \file include/ui/mania.h
+ * \ingroup ui
+ */
+
+#pragma once
+
+#include "core/geometry.h"
+#include "ui/widget.h"
+
+#include <SDL2/SDL.h>
+
+#include <vector>
+
+namespace oshu {
+
+struct display;
+struct mania_game;
+
+/**
+ * \ingroup ui
+ * \{
+ */
+
+/**
+ * View of the osu!mania mode.
+ *
+ * The notes scroll down the columns toward the judgement line, at the bottom
+ * of the 640×480 viewport.
+ *
+ * Everything is a plain rectangle, so no texture is painted. The rectangles
+ * of a frame are sorted by color while walking the visible hits, and every
+ * color is filled with a single `SDL_RenderFillRects` call, which the
+ * accelerated renderers turn into one batch of geometry. The corners of a
+ * layer are projected together too, with the batched #oshu::project.
+ */
+struct mania_ui : public widget {
+	mania_ui(oshu::display *display, oshu::mania_game &game);
+
+	oshu::display *display;
+	oshu::mania_game &game;
+
+	/**
+	 * The rectangles queued during #draw, one list per color, as pairs of
+	 * top-left and bottom-right corners in viewport coordinates.
+	 *
+	 * They're kept between frames only to reuse their memory.
+	 */
+	std::vector<std::vector<oshu::point>> layers;
+
+	/**
+	 * Scratch buffer for the projected rectangles of a layer.
+	 */
+	std::vector<SDL_Rect> rects;
+
+	void draw() override;
+};
+
+/** \} */
+
+}
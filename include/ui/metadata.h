@@ -67,7 +67,7 @@ struct metadata_frame {
 	 * Show difficulty information.
 	 *
 	 * The first line is the #oshu::metadata::version, and the second the
-	 * difficulty value in stars.
+	 * star rating computed by \ref beatmap_stars.
 	 */
 	oshu::texture stars;
 };
@@ -87,7 +87,7 @@ int create_metadata_frame(oshu::display *display, oshu::beatmap *beatmap, double
  * Display the metadata frame on the configured display with the given opacity.
  *
  * *opacity* is a number between 0 and 1. You may want to use #oshu::fade_out to
- * compute that value.
+ * compute that value. When it's 0, nothing is drawn at all.
  *
  * Metadata are drawn in white text and a translucent black background for
  * readability.
@@ -7,10 +7,15 @@
 
 #include "game/controls.h"
 #include "ui/cursor.h"
+#include "ui/slider_painter.h"
 #include "ui/widget.h"
+#include "video/atlas.h"
 #include "video/texture.h"
+#include "video/texture_cache.h"
 
+#include <future>
 #include <memory>
+#include <vector>
 
 namespace oshu {
 
@@ -18,10 +23,60 @@ struct hit;
 struct osu_ui;
 struct osu_game;
 
+/**
+ * A position of the mouse, as reported by a motion event.
+ */
+struct mouse_sample {
+	/**
+	 * Process time of the event, in seconds, like #oshu::clock::system.
+	 */
+	double time;
+	/**
+	 * Position in window coordinates.
+	 */
+	oshu::point position;
+};
+
+/**
+ * How many motion events #oshu::osu_mouse remembers.
+ *
+ * Gaming mice report up to 1000 positions per second, so that's more than a
+ * frame's worth of motion, even at low frame rates.
+ */
+static const size_t mouse_history_size = 256;
+
+/**
+ * How many resolutions of the approach circle #oshu::osu_ui paints.
+ *
+ * Each level is half the resolution of the previous one. The approach circle
+ * usually shrinks to a quarter of its size, so three levels are enough to
+ * never sample it at less than half its resolution.
+ */
+static const int approach_levels = 3;
+
+/**
+ * The mouse of the osu!standard mode.
+ *
+ * It watches the motion events as soon as SDL receives them, at the rate of
+ * the device rather than at the frame rate, and keeps them in a ring buffer
+ * allocated once. The game can then ask where the mouse was at the exact time
+ * of a judgment, interpolating between two events.
+ *
+ * The event watch runs on the thread pumping the events, which is the main
+ * thread, like the game.
+ */
 struct osu_mouse : public oshu::mouse {
 	osu_mouse(oshu::display *display);
+	~osu_mouse();
 	oshu::display *display;
+	/**
+	 * Ring buffer of the latest motion events, the newest at #head - 1.
+	 */
+	oshu::mouse_sample history[mouse_history_size];
+	size_t head = 0;
+	size_t count = 0;
 	oshu::point position() override;
+	oshu::point position_at(double system) override;
 };
 
 /**
@@ -29,6 +84,25 @@ struct osu_mouse : public oshu::mouse {
  * \{
  */
 
+/**
+ * The dotted line between a hit and the next one of its combo.
+ *
+ * The dots are laid out once when the view is created, because the hits
+ * never move.
+ */
+struct osu_connector {
+	/**
+	 * Position of the next hit in #oshu::hit_index::hits, or -1 when the
+	 * hit isn't followed by a hit of the same combo.
+	 */
+	int next;
+	/**
+	 * The dots, in #oshu::osu_ui::connector_dots.
+	 */
+	int first_dot;
+	int dot_count;
+};
+
 struct osu_ui : public widget {
 	osu_ui(oshu::display *display, oshu::osu_game &game);
 	~osu_ui();
@@ -40,64 +114,108 @@ struct osu_ui : public widget {
 	void draw() override;
 
 	/**
-	 * Dynamic array of circle hit object textures.
+	 * The texture containing all the sprites below.
+	 *
+	 * \sa video_atlas
+	 */
+	oshu::atlas atlas {};
+	/**
+	 * The sprites queued during #draw.
+	 */
+	oshu::sprite_batch batch {};
+	/**
+	 * Dynamic array of circle hit object sprites.
 	 *
 	 * There are as many textures as there are colors in the beatmap.
 	 */
-	oshu::texture *circles {};
+	oshu::sprite *circles {};
 	/**
-	 * Full-size approach circle.
+	 * The background painting of the sprites, started by
+	 * #oshu::osu_paint_resources.
 	 *
-	 * Its size is the `radius + approach_size` from the beatmap.
+	 * Until it's done, the sprites and the atlas belong to the painting
+	 * thread.
 	 */
-	oshu::texture approach_circle {};
+	std::future<void> painting;
+	/**
+	 * Full-size approach circle, at decreasing resolutions.
+	 *
+	 * Its size is the `radius + approach_size` from the beatmap. Every
+	 * level has the same logical size, but level *k* is painted with
+	 * 2^-k^ times the zoom, so that the shrinking circle is drawn from the
+	 * level closest to its size rather than filtered down from the full
+	 * resolution.
+	 */
+	oshu::sprite approach_circle[oshu::approach_levels] {};
 	/**
 	 * The slider ball and its tolerance circle.
 	 */
-	oshu::texture slider_ball {};
+	oshu::sprite slider_ball {};
 	/**
 	 * Symbol to indicate a note was successfully hit.
 	 *
 	 * A green circle.
 	 */
-	oshu::texture good_mark {};
+	oshu::sprite good_mark {};
 	/**
 	 * Symbol for early hits.
 	 *
 	 * A yellow half-circle, on the left.
 	 */
-	oshu::texture early_mark {};
+	oshu::sprite early_mark {};
 	/**
 	 * Symbol for early hits.
 	 *
 	 * A yellow half-circle, on the right.
 	 */
-	oshu::texture late_mark {};
+	oshu::sprite late_mark {};
 	/**
 	 * Symbol to indicate a note was missed.
 	 *
 	 * A red X.
 	 */
-	oshu::texture bad_mark {};
+	oshu::sprite bad_mark {};
 	/**
 	 * Symbol to indicate a note was skipped.
 	 *
 	 * A blue triangle pointing right.
 	 */
-	oshu::texture skip_mark {};
+	oshu::sprite skip_mark {};
 	/**
 	 * Little tick mark for the dotted line between two consecutive hits.
 	 */
-	oshu::texture connector {};
+	oshu::sprite connector {};
+	/**
+	 * The connector leaving every hit, indexed like
+	 * #oshu::hit_index::hits.
+	 */
+	std::vector<oshu::osu_connector> connectors;
+	/**
+	 * The positions of the dots of all the #connectors.
+	 */
+	std::vector<oshu::point> connector_dots;
 	/**
 	 * Use a fancy software cursor for the osu!standard mode, because the
 	 * mouse is a central part of the gameplay.
 	 */
 	oshu::cursor_widget cursor {};
+	/**
+	 * Background threads painting the upcoming sliders.
+	 */
+	oshu::slider_painter painter {};
+	/**
+	 * The painted sliders, kept after they're hit or missed in case the
+	 * user rewinds.
+	 */
+	oshu::texture_cache slider_textures {};
 };
 
 /**
- * Paint all the required textures for the beatmap.
+ * Start painting all the required textures for the beatmap on a background
+ * thread, at the current zoom of the display.
+ *
+ * The sprites can't be drawn until they're packed in #oshu::osu_ui::atlas by
+ * #oshu::osu_upload_resources.
  *
  * Free everything with #oshu::osu_free_resources.
  *
@@ -105,6 +223,14 @@ struct osu_ui : public widget {
  */
 void osu_paint_resources(oshu::osu_ui&);
 
+/**
+ * Wait for the sprites started by #oshu::osu_paint_resources, and upload
+ * them, unless it's already done.
+ *
+ * It must be called from the main thread.
+ */
+void osu_upload_resources(oshu::osu_ui&);
+
 /**
  * Paint a slider.
  *
@@ -114,10 +240,41 @@ void osu_paint_resources(oshu::osu_ui&);
  *
  * The texture is stored in `hit->texture`.
  *
- * Slider textures are freed with #oshu::osu_free_resources.
+ * Slider textures are added to #oshu::osu_ui::slider_textures, which frees
+ * them when it's full, or in #oshu::osu_free_resources.
  */
 int osu_paint_slider(oshu::osu_ui&, oshu::hit *hit);
 
+/**
+ * Draw a slider with the GPU into `hit->texture`, like #oshu::osu_paint_slider
+ * does with Cairo.
+ *
+ * The slider is turned into triangles and rendered into a target texture,
+ * which takes no CPU rasterization and no upload. It requires
+ * #oshu::GPU_SLIDERS.
+ *
+ * \sa video_mesh
+ */
+int osu_render_slider(oshu::osu_ui&, oshu::hit *hit);
+
+/**
+ * Draw a slider into a fresh painter, without uploading it.
+ *
+ * It only reads the geometry and color of the hit, so it may be called from
+ * any thread. The texture's origin is stored in *origin*, for
+ * #oshu::osu_upload_slider. See #oshu::painter::premultiplied.
+ *
+ * \sa oshu::slider_painter
+ */
+int osu_sketch_slider(oshu::hit *hit, double radius, double zoom, bool premultiplied, oshu::painter *painter, oshu::point *origin);
+
+/**
+ * Upload a slider drawn by #oshu::osu_sketch_slider into `hit->texture`.
+ *
+ * It must be called from the main thread.
+ */
+int osu_upload_slider(oshu::osu_ui&, oshu::hit *hit, oshu::painter *painter, oshu::point origin);
+
 /**
  * Free the dynamic resources of the game mode.
  */
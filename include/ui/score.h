@@ -5,6 +5,8 @@
 
 #pragma once
 
+#include "game/calibration.h"
+
 namespace oshu {
 
 struct beatmap;
@@ -18,15 +20,28 @@ struct display;
  * Show the game score and statistics.
  *
  * It's currently extremly simple, showing a bar filled with green for good
- * notes, and red for bad notes.
+ * notes, and red for bad notes, and above it, the histogram of the offsets of
+ * the good notes, to tell whether the player tends to hit early or late.
  *
  * \{
  */
 
+/**
+ * Number of bars in the histogram of the offsets, from minus the leniency to
+ * the leniency.
+ */
+static const int offset_bins = 31;
+
 struct score_frame {
 	oshu::display *display;
 	oshu::beatmap *beatmap;
 	double score;
+	oshu::offset_stats offsets;
+	/**
+	 * How many good hits fall into each bar.
+	 */
+	int histogram[offset_bins];
+	int histogram_max;
 };
 
 /**
@@ -42,7 +57,8 @@ int create_score_frame(oshu::display *display, oshu::beatmap *beatmap, oshu::sco
 /**
  * Show the score frame.
  *
- * It's a simple bar, centered in the bottom of the screen.
+ * It's a simple bar, centered in the bottom of the screen, below the
+ * histogram.
  *
  * The opacity argument lets you fade in the bar with #oshu::fade_in.
  */
@@ -5,10 +5,13 @@
 
 #pragma once
 
+#include "game/calibration.h"
 #include "ui/audio.h"
 #include "ui/background.h"
 #include "ui/metadata.h"
 #include "ui/score.h"
+#include "ui/storyboard.h"
+#include "ui/trace_overlay.h"
 
 #include <memory>
 
@@ -28,6 +31,14 @@ struct widget;
  * \{
  */
 
+/**
+ * How long the score is shown before moving on to the next beatmap, in
+ * seconds.
+ *
+ * \sa oshu::shell::continuous
+ */
+static const double playlist_delay = 5.;
+
 /**
  * The controller of the main game interface.
  *
@@ -45,7 +56,8 @@ struct shell {
 	/**
 	 * The window that the shell managed.
 	 *
-	 * A display should not be associated to more than one shell.
+	 * A display should not be associated to more than one shell at a time,
+	 * but a playlist reuses it for the shells of all its beatmaps.
 	 */
 	oshu::display &display;
 	oshu::game_base &game;
@@ -56,13 +68,35 @@ struct shell {
 	std::unique_ptr<widget> game_view;
 	oshu::game_screen *screen;
 	oshu::background background {};
+	oshu::storyboard_scene storyboard {};
 	oshu::metadata_frame metadata {};
 	oshu::score_frame score {};
 	oshu::audio_progress_bar audio_progress_bar {};
+	oshu::trace_overlay trace_overlay {};
+	oshu::calibration calibration {};
+	/**
+	 * Close the shell by itself #oshu::playlist_delay seconds after the
+	 * score screen shows up, to move on to the next beatmap of a playlist.
+	 */
+	bool continuous = false;
+	/**
+	 * Set when the shell closed itself at the end of the beatmap, rather
+	 * than being closed by the user.
+	 */
+	bool finished = false;
 	/**
 	 * Start the main loop.
 	 */
 	void open();
+	/**
+	 * Update and draw one frame at the current time of the game's clock,
+	 * without waiting nor polling the input.
+	 *
+	 * It lets the caller drive the shell with its own clock, like the
+	 * video renderer does. With #continuous set, the shell closes itself
+	 * after the score screen like it does in #open, and sets #finished.
+	 */
+	void step();
 	/**
 	 * End the game and close the shell.
 	 */
@@ -0,0 +1,137 @@
+/**
+ * \file include/ui/slider_painter.h
+ * \ingroup ui_slider_painter
+ */
+
+#pragma once
+
+#include "video/paint.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+namespace oshu {
+
+struct hit;
+
+/**
+ * \defgroup ui_slider_painter Slider painter
+ * \ingroup ui
+ *
+ * \brief
+ * Paint the sliders on background threads.
+ *
+ * Rasterizing a slider with Cairo takes a few milliseconds, and up to tens of
+ * milliseconds for long sliders, which is more than a frame. Instead of
+ * painting them when they appear, the sliders are painted by a small pool of
+ * threads a few seconds in advance. Only the texture upload, which requires
+ * the renderer, is left to the main thread.
+ *
+ * \{
+ */
+
+/**
+ * A slider painted by a #oshu::slider_painter.
+ */
+struct slider_job {
+	oshu::hit *hit;
+	double zoom;
+	/**
+	 * The painter with the finished surface, ready for
+	 * #oshu::upload_painting.
+	 */
+	oshu::painter painter;
+	/**
+	 * The origin of the texture, from #oshu::osu_sketch_slider.
+	 */
+	oshu::point origin;
+	/**
+	 * 0 if the slider was painted, -1 on failure.
+	 */
+	int rc;
+};
+
+/**
+ * A pool of threads painting sliders.
+ *
+ * \sa oshu::start_slider_painter
+ */
+struct slider_painter {
+	/**
+	 * Radius of the hit circles, for the width of the slider bodies.
+	 */
+	double radius;
+	/**
+	 * Keep the colors premultiplied.
+	 *
+	 * \sa oshu::painter::premultiplied
+	 */
+	bool premultiplied;
+	std::vector<std::thread> workers;
+	/**
+	 * Protects every field below.
+	 */
+	std::mutex mutex;
+	/**
+	 * Wakes the workers up when #queue is filled or when #stopping is set.
+	 */
+	std::condition_variable signal;
+	/**
+	 * Sliders waiting to be painted, the most urgent first.
+	 */
+	std::deque<oshu::slider_job> queue;
+	/**
+	 * Painted sliders, waiting for #oshu::poll_slider.
+	 */
+	std::deque<oshu::slider_job> done;
+	/**
+	 * Every slider that was requested and not polled yet.
+	 */
+	std::unordered_set<oshu::hit*> requested;
+	bool stopping;
+};
+
+/**
+ * Start the painting threads.
+ *
+ * \return 0 on success, -1 if no thread could be started, in which case the
+ * sliders will have to be painted on the main thread.
+ */
+int start_slider_painter(oshu::slider_painter *painter, double radius, bool premultiplied);
+
+/**
+ * Queue a slider for painting at the given zoom, unless it already was.
+ *
+ * The hit must live until it is polled, or until the painter is stopped.
+ */
+void request_slider(oshu::slider_painter *painter, oshu::hit *hit, double zoom);
+
+/**
+ * Remove a slider from the queue, if it's not being painted yet.
+ *
+ * If it is, it'll still be returned by #oshu::poll_slider.
+ */
+void cancel_slider(oshu::slider_painter *painter, oshu::hit *hit);
+
+/**
+ * Pop one painted slider, without waiting.
+ *
+ * The caller takes the ownership of the painter in *job*, and must either
+ * upload or discard it.
+ *
+ * \return true if a job was popped, false if none is ready.
+ */
+bool poll_slider(oshu::slider_painter *painter, oshu::slider_job *job);
+
+/**
+ * Stop and join the threads, and discard all the pending jobs.
+ */
+void stop_slider_painter(oshu::slider_painter *painter);
+
+/** \} */
+
+}
@@ -0,0 +1,109 @@
+/**
+ * \file ui/storyboard.h
+ * \ingroup ui_storyboard
+ */
+
+#pragma once
+
+#include "beatmap/storyboard.h"
+#include "video/atlas.h"
+#include "video/texture.h"
+
+#include <future>
+#include <string>
+#include <vector>
+
+struct SDL_Surface;
+
+namespace oshu {
+
+struct display;
+
+/**
+ * \defgroup ui_storyboard Storyboard
+ * \ingroup ui
+ *
+ * \brief
+ * Play the storyboard of a beatmap behind and above its hit objects.
+ *
+ * Like the background, the storyboard is only shown with the
+ * #oshu::SHOW_BACKGROUND feature.
+ *
+ * The storyboard files are parsed and their pictures decoded on background
+ * threads, while the game starts. Once they're ready, the pictures are packed
+ * into a few atlases, and every frame only evaluates the sprites active at
+ * that time, from the \ref beatmap_storyboard player, before drawing them in
+ * an #oshu::sprite_batch. A storyboard of thousands of sprites therefore costs
+ * a few draw calls, as long as they're drawn from the same atlas.
+ *
+ * The sprites are drawn on the 640×480 storyboard screen, fit in the window.
+ *
+ * \{
+ */
+
+struct storyboard_scene {
+	oshu::display *display = nullptr;
+	/**
+	 * Filled by the #loader, and not to be touched before it's done.
+	 */
+	oshu::storyboard storyboard;
+	/**
+	 * The decoded pictures, one per #oshu::storyboard::images, or null
+	 * for the missing ones, until they're uploaded by
+	 * #oshu::show_storyboard.
+	 */
+	std::future<std::vector<SDL_Surface*>> loader;
+	oshu::storyboard_player player;
+	/**
+	 * One sprite per picture of the storyboard.
+	 */
+	std::vector<oshu::sprite> sprites;
+	std::vector<oshu::atlas> atlases;
+	/**
+	 * The pictures too big for an atlas, each in its own texture.
+	 */
+	std::vector<oshu::texture> textures;
+	oshu::sprite_batch batch;
+	/**
+	 * Whether the storyboard draws the background picture by itself, in
+	 * which case the background must not be drawn.
+	 */
+	bool hides_background = false;
+	/**
+	 * The background picture, to set #hides_background.
+	 */
+	std::string background;
+};
+
+/**
+ * Start loading the storyboard from *files*, in order, on another thread.
+ *
+ * The paths of the pictures are relative to *directory*. Missing files and
+ * pictures are skipped.
+ *
+ * *background* is the background picture of the beatmap, or null.
+ *
+ * \return 0 on success, -1 if the loader couldn't start. In both cases, the
+ * scene is safe to show and destroy.
+ */
+int load_storyboard_scene(oshu::display *display, const std::vector<std::string> &files, const std::string &directory, const char *background, oshu::storyboard_scene *scene);
+
+/**
+ * Draw the layers from *first* to *last* as they are at *now*, in seconds.
+ *
+ * The pictures are uploaded on the first call after they're loaded, and
+ * nothing is drawn until then.
+ *
+ * The *brightness* darkens the storyboard, like it does the background in
+ * #oshu::show_background.
+ */
+void show_storyboard(oshu::storyboard_scene *scene, double now, enum oshu::storyboard_layer first, enum oshu::storyboard_layer last, double brightness);
+
+/**
+ * Free the textures of the storyboard, and wait for the loader.
+ */
+void destroy_storyboard_scene(oshu::storyboard_scene *scene);
+
+/** \} */
+
+}
@@ -0,0 +1,60 @@
+/**
+ * \file ui/trace_overlay.h
+ * \ingroup ui_trace
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+namespace oshu {
+
+struct display;
+
+/**
+ * \defgroup ui_trace Trace overlay
+ * \ingroup ui
+ *
+ * \brief
+ * Graph the frame times on screen.
+ *
+ * The overlay shows one row of bars per \ref core_trace zone, from the
+ * oldest span on the left to the newest on the right. The height of a bar is
+ * its duration relative to the frame budget, which is marked by a red line;
+ * bars reaching that line took a whole frame. The frame row turns red when an
+ * audio underrun occurred since the previous frame.
+ *
+ * It is toggled with #oshu::TRACE_KEY.
+ *
+ * \{
+ */
+
+struct trace_overlay {
+	oshu::display *display;
+	bool visible = false;
+	/**
+	 * The count of #oshu::AUDIO_UNDERRUNS at the previous frame.
+	 */
+	int64_t underruns = 0;
+};
+
+/**
+ * Create a hidden overlay.
+ */
+int create_trace_overlay(oshu::display *display, oshu::trace_overlay *overlay);
+
+/**
+ * Draw the overlay at the bottom left of the window, if it's visible.
+ *
+ * The view must be reset to the window's coordinates beforehand.
+ */
+void show_trace_overlay(oshu::trace_overlay *overlay);
+
+/**
+ * Destroy the overlay, which is a no-op like #oshu::destroy_audio_progress_bar.
+ */
+void destroy_trace_overlay(oshu::trace_overlay *overlay);
+
+/** \} */
+
+}
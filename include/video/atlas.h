@@ -0,0 +1,249 @@
+/**
+ * \file video/atlas.h
+ * \ingroup video_atlas
+ */
+
+#pragma once
+
+#include "core/geometry.h"
+#include "video/paint.h"
+#include "video/texture.h"
+
+#include <stdint.h>
+#include <vector>
+
+namespace oshu {
+
+struct display;
+
+/**
+ * \defgroup video_atlas Atlas
+ * \ingroup video
+ *
+ * \brief
+ * Pack small textures together and draw them in batches.
+ *
+ * Drawing a texture costs a draw call, and a switch of texture on the GPU.
+ * When a dense stream of notes shows hundreds of small textures, these calls
+ * add up.
+ *
+ * Instead, the small textures painted with the \ref video_paint module can be
+ * packed together into a single texture, called an atlas. Each packed texture
+ * becomes an #oshu::sprite, which is a region of the atlas.
+ *
+ * Pictures loaded from files can be packed too, with #oshu::pack_surface.
+ *
+ * Sprites are then queued into an #oshu::sprite_batch, which sends them all to
+ * the GPU in one call to `SDL_RenderGeometry`, as long as they come from the
+ * same atlas. Before SDL 2.0.18, the batch falls back to one `SDL_RenderCopyEx`
+ * per sprite.
+ *
+ * ```c
+ * oshu::atlas atlas;
+ * oshu::sprite circle;
+ * oshu::painter p;
+ * oshu::start_painting(display, size, &p);
+ * // paint with p.cr
+ * oshu::pack_painting(&atlas, &p, &circle);
+ * oshu::build_atlas(&atlas, display);
+ *
+ * oshu::sprite_batch batch;
+ * oshu::draw_sprite(display, &batch, &circle, position);
+ * oshu::flush_batch(display, &batch);
+ * ```
+ *
+ * \{
+ */
+
+/**
+ * A region of an atlas, drawn like an #oshu::texture.
+ */
+struct sprite {
+	/**
+	 * The logical size of the sprite.
+	 *
+	 * \sa oshu::texture::size
+	 */
+	oshu::size size = 0;
+	/**
+	 * The anchor of the sprite.
+	 *
+	 * \sa oshu::texture::origin
+	 */
+	oshu::point origin = 0;
+	/**
+	 * The atlas the sprite belongs to.
+	 */
+	struct SDL_Texture *texture = nullptr;
+	/**
+	 * The physical region of the sprite in the atlas, in pixels.
+	 */
+	int x = 0, y = 0, w = 0, h = 0;
+};
+
+/**
+ * A painted surface waiting to be packed by #oshu::build_atlas.
+ */
+struct atlas_entry {
+	oshu::painter painter;
+	oshu::sprite *sprite;
+};
+
+/**
+ * A texture containing many sprites.
+ *
+ * \sa oshu::pack_painting
+ * \sa oshu::build_atlas
+ * \sa oshu::destroy_atlas
+ */
+struct atlas {
+	oshu::texture texture;
+	/**
+	 * Pack the surfaces with premultiplied colors.
+	 *
+	 * \sa oshu::painter::premultiplied
+	 */
+	bool premultiplied = false;
+	std::vector<oshu::atlas_entry> entries;
+};
+
+/**
+ * Finalize a painter, and keep its surface until #oshu::build_atlas is
+ * called.
+ *
+ * The sprite's size is set immediately, but its region is only set by
+ * #oshu::build_atlas, so it must not move in the meantime. Its origin is left
+ * for the caller to set.
+ */
+void pack_painting(oshu::atlas *atlas, oshu::painter *painter, oshu::sprite *sprite);
+
+/**
+ * Keep a surface until #oshu::build_atlas is called, like
+ * #oshu::pack_painting, and free it afterwards.
+ *
+ * The surface must be in the `SDL_PIXELFORMAT_ARGB8888` format. Its logical
+ * size is its size in pixels.
+ */
+void pack_surface(oshu::atlas *atlas, struct SDL_Surface *surface, oshu::sprite *sprite);
+
+/**
+ * Pack all the painted surfaces into one texture, and fill the sprite
+ * regions.
+ *
+ * Surfaces are packed on shelves, from the tallest to the shortest, which
+ * is close enough to optimal for a set of similar icons.
+ *
+ * \return 0 on success, -1 on failure, in which case the sprites are left
+ * without a texture and won't be drawn.
+ */
+int build_atlas(oshu::atlas *atlas, oshu::display *display);
+
+/**
+ * Destroy the atlas's texture, and any surface that wasn't packed.
+ */
+void destroy_atlas(oshu::atlas *atlas);
+
+/**
+ * A sprite's destination in the window, and its source region in the atlas.
+ */
+struct sprite_quad {
+	/**
+	 * The corners of the sprite in the window, in the order of the
+	 * top-left, top-right, bottom-right and bottom-left corners of the
+	 * source region.
+	 */
+	float x[4], y[4];
+	/**
+	 * The color the sprite is multiplied by, in RGBA.
+	 */
+	uint8_t color[4];
+	const oshu::sprite *sprite;
+};
+
+/**
+ * A list of sprites waiting to be drawn at once.
+ *
+ * Sprites are drawn in the order they were queued. Flush the batch with
+ * #oshu::flush_batch before drawing anything else on top of them, like a
+ * regular texture.
+ */
+struct sprite_batch {
+	/**
+	 * The atlas of the queued sprites.
+	 */
+	struct SDL_Texture *texture = nullptr;
+	/**
+	 * Whether the queued sprites are added to what's below them rather than
+	 * blended over it.
+	 */
+	bool additive = false;
+	std::vector<oshu::sprite_quad> quads;
+};
+
+/**
+ * Queue a sprite.
+ *
+ * Like #oshu::draw_scaled_texture, *p* is where the *origin* of the sprite
+ * goes, and *ratio* scales the sprite around its origin.
+ *
+ * If the sprite comes from a different atlas than the queued ones, the batch
+ * is flushed first.
+ */
+void draw_sprite(oshu::display *display, oshu::sprite_batch *batch, const oshu::sprite *sprite, oshu::point p, double ratio = 1.);
+
+/**
+ * How to place, tint and blend a sprite, for the second variant of
+ * #oshu::draw_sprite.
+ */
+struct sprite_transform {
+	/**
+	 * Where the #origin goes in the view.
+	 */
+	oshu::point position = 0;
+	/**
+	 * The anchor of the sprite, in logical pixels from its top-left
+	 * corner, which replaces #oshu::sprite::origin.
+	 */
+	oshu::point origin = 0;
+	/**
+	 * The horizontal and vertical scale around the origin. A negative
+	 * scale mirrors the sprite.
+	 */
+	oshu::vector scale = 1.;
+	/**
+	 * Clockwise rotation around the origin, in radians.
+	 */
+	double rotation = 0;
+	/**
+	 * The color the sprite is multiplied by, and its opacity, in [0, 1].
+	 *
+	 * Sprites from a premultiplied atlas need their color multiplied by
+	 * their alpha.
+	 */
+	float red = 1, green = 1, blue = 1, alpha = 1;
+	/**
+	 * Mirror the picture in place, without moving the sprite.
+	 */
+	bool flip_h = false, flip_v = false;
+	/**
+	 * Add the sprite to what's below it.
+	 *
+	 * Switching between additive and regular sprites flushes the batch.
+	 * It is only meant for atlases that aren't premultiplied.
+	 */
+	bool additive = false;
+};
+
+/**
+ * Queue a sprite rotated, scaled, tinted or faded.
+ */
+void draw_sprite(oshu::display *display, oshu::sprite_batch *batch, const oshu::sprite *sprite, const oshu::sprite_transform &transform);
+
+/**
+ * Draw all the queued sprites, and empty the batch.
+ */
+void flush_batch(oshu::display *display, oshu::sprite_batch *batch);
+
+/** \} */
+
+}
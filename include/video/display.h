@@ -53,9 +53,11 @@ enum visual_feature {
 	 */
 	LINEAR_SCALING = 0x1,
 	/**
-	 * Display a background picture rather than a pitch black screen.
+	 * Display a background picture rather than a pitch black screen, and
+	 * the storyboard.
 	 *
-	 * Implemented by the \ref ui_background module.
+	 * Implemented by the \ref ui_background and \ref ui_storyboard
+	 * modules.
 	 */
 	SHOW_BACKGROUND = 0x2,
 	/**
@@ -79,12 +81,26 @@ enum visual_feature {
 	 */
 	HARDWARE_ACCELERATION = 0x8,
 	/**
-	 * Increase the frame rate to 60 FPS.
+	 * Run at the refresh rate of the monitor, usually 60 FPS, but up to
+	 * 144 or 240 FPS on high-refresh monitors.
 	 *
 	 * On low-end hardware, 30 FPS is a good compromise, but most of the
 	 * time 60 is much smoother.
+	 *
+	 * The `OSHU_FRAME_RATE` environment variable overrides it.
 	 */
 	SIXTY_FPS = 0x10,
+	/**
+	 * Draw the slider bodies with the GPU, as triangles, instead of
+	 * painting them with Cairo.
+	 *
+	 * It is not part of any quality level, but enabled by setting the
+	 * `OSHU_SLIDERS` environment variable to `gpu`. It is ignored when the
+	 * renderer doesn't support it.
+	 *
+	 * \sa video_mesh
+	 */
+	GPU_SLIDERS = 0x20,
 };
 
 /**
@@ -111,7 +127,7 @@ enum quality_level {
 	 * It should be so pure than virtually anything below that point is
 	 * unplayable.
 	 *
-	 * No background picture.
+	 * No background picture, nor storyboard.
 	 */
 	LOW_QUALITY = 0,
 	/**
@@ -152,6 +168,15 @@ struct display {
 	 * Create a display structure, open the SDL window and create the renderer.
 	 */
 	display();
+	/**
+	 * Create an offscreen display of *size* pixels, whose frames are drawn
+	 * into #target instead of being shown.
+	 *
+	 * Its window is hidden, and only there because SDL needs one to
+	 * create a renderer. On a machine without a screen, SDL's *offscreen*
+	 * or *dummy* video drivers do.
+	 */
+	explicit display(oshu::size size);
 	~display();
 	/**
 	 * The one and only SDL game window.
@@ -163,6 +188,13 @@ struct display {
 	 * It must be freed after the textures, but before the window.
 	 */
 	struct SDL_Renderer *renderer = nullptr;
+	/**
+	 * For an offscreen display, the texture the renderer draws into, from
+	 * which the frames are read back with `SDL_RenderReadPixels`.
+	 *
+	 * It is null for a regular window.
+	 */
+	struct SDL_Texture *target = nullptr;
 	/**
 	 * The current view, used to project coordinates when drawing.
 	 *
@@ -178,14 +210,30 @@ struct display {
 	 */
 	int features = 0;
 	/**
-	 * How long a frame should last in seconds.
+	 * How long a frame should last in seconds, or 0 to render as fast as
+	 * possible.
 	 *
 	 * 0.01666… is 60 FPS.
 	 *
-	 * Its value depends on whether the #SIXTY_FPS is enabled or not. If
-	 * it isn't, then the game runs at 30 FPS.
+	 * It is read from the `OSHU_FRAME_RATE` environment variable. By
+	 * default, it is the monitor's refresh period if #SIXTY_FPS is
+	 * enabled, and 30 FPS otherwise.
+	 *
+	 * \sa video_pacing
 	 */
 	double frame_duration = 0.0333;
+	/**
+	 * Whether presenting a frame waits for the monitor's vertical sync, in
+	 * which case the frames are paced by the renderer.
+	 */
+	bool vsync = false;
+	/**
+	 * Whether the renderer can blend textures with premultiplied colors,
+	 * as detected by #oshu::premultiplied_supported.
+	 *
+	 * \sa oshu::painter::premultiplied
+	 */
+	bool premultiplied = false;
 };
 
 
@@ -0,0 +1,177 @@
+/**
+ * \file video/encoder.h
+ * \ingroup video_encoder
+ */
+
+#pragma once
+
+#include "core/geometry.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+struct AVFormatContext;
+struct AVCodecContext;
+struct AVStream;
+struct AVFrame;
+struct SwsContext;
+struct SwrContext;
+
+namespace oshu {
+
+/**
+ * \defgroup video_encoder Encoder
+ * \ingroup video
+ *
+ * \brief
+ * Write the frames and the audio of a game into a video file.
+ *
+ * The encoder wraps libavformat and libavcodec. The container is guessed from
+ * the file name, like *preview.mp4* or *preview.webm*, and each stream uses the
+ * default codec of the container. The frames are converted from RGBA with
+ * libswscale, and the audio from packed stereo floats with libswresample.
+ *
+ * Encoding runs on a thread of its own, fed by a bounded queue of frames, so
+ * that the next frames are drawn while the previous ones are encoded. The
+ * video codec spreads its own work over all the cores with its frame or slice
+ * threads.
+ *
+ * ```c
+ * oshu::encoder encoder {};
+ * oshu::open_encoder("preview.mp4", size, 60, 44100, &encoder);
+ * for (each frame) {
+ *     std::vector<uint8_t> pixels = oshu::take_frame_buffer(&encoder);
+ *     // draw the frame into the pixels, and mix its audio
+ *     oshu::encode_frame(&encoder, std::move(pixels), std::move(samples));
+ * }
+ * oshu::close_encoder(&encoder);
+ * ```
+ *
+ * With a null size, the file has no video stream, and the frames carry only
+ * audio, like the preview clips of the library. Their pixel buffers are
+ * empty.
+ *
+ * \{
+ */
+
+/**
+ * A frame waiting to be encoded, with the audio samples that play during it.
+ */
+struct encoder_job {
+	std::vector<uint8_t> pixels;
+	std::vector<float> samples;
+};
+
+/**
+ * How many frames may wait in #oshu::encoder::jobs before
+ * #oshu::encode_frame blocks.
+ */
+static const size_t max_queued_frames = 8;
+
+struct encoder {
+	AVFormatContext *muxer;
+	AVCodecContext *video;
+	AVCodecContext *audio;
+	AVStream *video_stream;
+	AVStream *audio_stream;
+	/**
+	 * Converter from RGBA to the pixel format of the video codec.
+	 */
+	struct SwsContext *scaler;
+	/**
+	 * Converter from packed stereo floats to the sample format of the
+	 * audio codec.
+	 *
+	 * It also buffers the samples until there's enough for a full audio
+	 * codec frame.
+	 */
+	struct SwrContext *resampler;
+	AVFrame *picture;
+	AVFrame *sound;
+	/**
+	 * Size of the frames, in pixels.
+	 */
+	int width;
+	int height;
+	/**
+	 * Presentation timestamp of the next picture, in frames.
+	 */
+	int64_t picture_pts;
+	/**
+	 * Presentation timestamp of the next sound frame, in samples.
+	 */
+	int64_t sound_pts;
+	/**
+	 * The thread running the codecs.
+	 */
+	std::thread thread;
+	/**
+	 * Protects #jobs, #spare, #closing and #failed.
+	 */
+	std::mutex mutex;
+	/**
+	 * Wakes the encoder thread when a job arrives, and the producer when a
+	 * job is done.
+	 */
+	std::condition_variable signal;
+	std::deque<oshu::encoder_job> jobs;
+	/**
+	 * Pixel buffers of the encoded frames, to be reused by
+	 * #oshu::take_frame_buffer.
+	 */
+	std::vector<std::vector<uint8_t>> spare;
+	/**
+	 * Set by #oshu::close_encoder, to stop the thread once the queue is
+	 * empty.
+	 */
+	bool closing;
+	/**
+	 * Set when encoding failed, after which the jobs are dropped.
+	 */
+	bool failed;
+};
+
+/**
+ * Create the video file at *path*, and start the encoder thread.
+ *
+ * The frames are *size* pixels, and come at *fps* frames per second. The audio
+ * is stereo, at *sample_rate*. When *size* is 0, only the audio is recorded,
+ * and *fps* is ignored.
+ *
+ * \param encoder Null-initialized encoder.
+ *
+ * \return 0 on success, -1 on error, after which the encoder must still be
+ * closed.
+ */
+int open_encoder(const char *path, oshu::size size, int fps, int sample_rate, oshu::encoder *encoder);
+
+/**
+ * Return a pixel buffer for the next frame, big enough for an RGBA frame,
+ * reusing the buffer of an encoded frame when possible.
+ */
+std::vector<uint8_t> take_frame_buffer(oshu::encoder *encoder);
+
+/**
+ * Queue a frame of packed RGBA pixels, along with the packed stereo samples
+ * that play during it.
+ *
+ * It blocks while #oshu::max_queued_frames frames are waiting.
+ *
+ * \return 0 on success, -1 if the encoder failed earlier.
+ */
+int encode_frame(oshu::encoder *encoder, std::vector<uint8_t> &&pixels, std::vector<float> &&samples);
+
+/**
+ * Encode the remaining frames, finish the file, and free everything.
+ *
+ * \return 0 if the whole video was written, -1 on error.
+ */
+int close_encoder(oshu::encoder *encoder);
+
+/** \} */
+
+}
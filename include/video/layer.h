@@ -0,0 +1,119 @@
+/**
+ * \file video/layer.h
+ * \ingroup video_layer
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+struct SDL_Texture;
+
+namespace oshu {
+
+struct display;
+
+/**
+ * \defgroup video_layer Layer
+ * \ingroup video
+ *
+ * \brief
+ * Keep a rendered part of the screen until it changes.
+ *
+ * Some parts of the screen, like the background, are the same from one frame
+ * to the next most of the time, but still cost a lot to draw: the background
+ * picture is scaled and color-modulated at every frame, which is slow with the
+ * software renderer.
+ *
+ * A layer is a texture the size of the window, used as a render target. Its
+ * content is identified by a key chosen by the caller, and is only drawn again
+ * when the key changes. Otherwise, the layer is pasted as is, with a plain
+ * copy.
+ *
+ * ```c
+ * if (oshu::begin_layer(display, &layer, key)) {
+ *     // draw the content
+ *     oshu::end_layer(display, &layer);
+ * }
+ * oshu::show_layer(display, &layer);
+ * ```
+ *
+ * When the renderer doesn't support render targets, #oshu::begin_layer always
+ * returns true and the content is drawn directly on the screen, so the code
+ * above works the same.
+ *
+ * \{
+ */
+
+/**
+ * A cached render target.
+ *
+ * Initialize it with `{}`, and destroy it with #oshu::destroy_layer.
+ */
+struct layer {
+	struct SDL_Texture *target = nullptr;
+	/**
+	 * Size of #target, in pixels.
+	 */
+	int width = 0, height = 0;
+	/**
+	 * Identify the content of the layer.
+	 */
+	uint64_t key = 0;
+	/**
+	 * Whether #target holds the content for #key.
+	 */
+	bool valid = false;
+	/**
+	 * The content covers the whole layer without transparency.
+	 *
+	 * The layer is then pasted without blending, which is faster.
+	 */
+	bool opaque = false;
+	/**
+	 * Draw the content straight on the screen, because render targets
+	 * don't work.
+	 */
+	bool direct = false;
+	/**
+	 * The render target to restore in #oshu::end_layer.
+	 */
+	struct SDL_Texture *previous = nullptr;
+};
+
+/**
+ * Prepare the layer for content identified by *key*.
+ *
+ * If the layer already holds that content, and the window wasn't resized,
+ * return false. Otherwise, make the layer the render target, clear it, and
+ * return true, in which case the caller must draw the content and call
+ * #oshu::end_layer.
+ */
+bool begin_layer(oshu::display *display, oshu::layer *layer, uint64_t key);
+
+/**
+ * Restore the render target after drawing the layer's content.
+ */
+void end_layer(oshu::display *display, oshu::layer *layer);
+
+/**
+ * Paste the layer on the whole window.
+ */
+void show_layer(oshu::display *display, oshu::layer *layer);
+
+/**
+ * Forget the content of the layer, so that it is drawn again next time.
+ *
+ * The content of render targets may be lost when the renderer is reset, as
+ * notified by the `SDL_RENDER_TARGETS_RESET` event.
+ */
+void invalidate_layer(oshu::layer *layer);
+
+/**
+ * Free the layer's texture.
+ */
+void destroy_layer(oshu::layer *layer);
+
+/** \} */
+
+}
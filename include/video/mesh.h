@@ -0,0 +1,111 @@
+/**
+ * \file video/mesh.h
+ * \ingroup video_mesh
+ */
+
+#pragma once
+
+#include "core/geometry.h"
+
+#include <vector>
+
+namespace oshu {
+
+struct display;
+
+/**
+ * \defgroup video_mesh Mesh
+ * \ingroup video
+ *
+ * \brief
+ * Draw shapes as triangles rasterized by the GPU.
+ *
+ * Painting with Cairo happens on the CPU, and the result must then be
+ * un-premultiplied and uploaded to the GPU. For shapes made of thick lines and
+ * discs, like the slider bodies, it is much cheaper to turn them into
+ * triangles and let the GPU fill them, through `SDL_RenderGeometry`.
+ *
+ * A mesh is built once in logical coordinates, then drawn at any zoom.
+ * Shapes are opaque, and drawn in the order they were added, so that a shape
+ * covers what was drawn before it. This mimics Cairo's *source* operator:
+ * apply the transparency to the whole result, for example by drawing the mesh
+ * into a texture and setting its alpha modulation.
+ *
+ * The GPU path requires SDL 2.0.18. Check #oshu::mesh_supported.
+ *
+ * \{
+ */
+
+/**
+ * An RGB color, with components from 0 to 1.
+ */
+struct mesh_color {
+	float red, green, blue;
+};
+
+/**
+ * A radial gradient, like `cairo_pattern_create_radial` with a single center.
+ *
+ * Colors are interpolated per vertex, from *inner* at *center*, to *outer* at
+ * *radius* and beyond. A solid color is a gradient whose two colors are the
+ * same.
+ */
+struct mesh_paint {
+	oshu::mesh_color inner;
+	oshu::mesh_color outer;
+	oshu::point center;
+	double radius;
+};
+
+struct mesh_vertex {
+	float x, y;
+	oshu::mesh_color color;
+};
+
+/**
+ * A list of triangles.
+ */
+struct mesh {
+	std::vector<oshu::mesh_vertex> vertices;
+	std::vector<int> indices;
+	/**
+	 * The zoom the mesh is built for, which decides how many segments the
+	 * circles use.
+	 */
+	double zoom = 1.;
+};
+
+/**
+ * Paint a disc.
+ */
+void fill_circle(oshu::mesh *mesh, oshu::point center, double radius, const oshu::mesh_paint &paint);
+
+/**
+ * Paint a circle outline of the given line width.
+ */
+void stroke_circle(oshu::mesh *mesh, oshu::point center, double radius, double width, const oshu::mesh_paint &paint);
+
+/**
+ * Paint a polyline of the given width, with round joins and caps, like
+ * `cairo_stroke` does with `CAIRO_LINE_CAP_ROUND` and
+ * `CAIRO_LINE_JOIN_ROUND`.
+ */
+void stroke_polyline(oshu::mesh *mesh, const std::vector<oshu::point> &points, double width, const oshu::mesh_paint &paint);
+
+/**
+ * Whether meshes can be drawn by the renderer, which requires SDL 2.0.18 and
+ * render target support.
+ */
+bool mesh_supported(oshu::display *display);
+
+/**
+ * Draw the mesh on the current render target, with the logical point *origin*
+ * at the top-left corner of the target and a zoom of #oshu::mesh::zoom.
+ *
+ * The mesh is drawn without blending, so the target's pixels are replaced.
+ */
+int draw_mesh(oshu::display *display, oshu::mesh *mesh, oshu::point origin);
+
+/** \} */
+
+}
@@ -0,0 +1,191 @@
+/**
+ * \file video/movie.h
+ * \ingroup video_movie
+ */
+
+#pragma once
+
+#include "core/geometry.h"
+#include "video/texture.h"
+
+#include <condition_variable>
+#include <deque>
+#include <math.h>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+
+struct AVBufferRef;
+struct AVCodecContext;
+struct AVFormatContext;
+struct AVFrame;
+struct AVIOContext;
+struct SwsContext;
+
+namespace oshu {
+
+struct display;
+struct movie_source;
+
+/**
+ * \defgroup video_movie Movie
+ * \ingroup video
+ *
+ * \brief
+ * Play a video file into a texture, in sync with a clock.
+ *
+ * The video is demuxed and decoded with libavformat and libavcodec on a
+ * worker thread, which keeps a few frames ahead in a queue. When the system
+ * supports it, like with VA-API on Linux or VideoToolbox on macOS, the frames
+ * are decoded by the GPU, and only copied back to memory.
+ *
+ * The frames stay in YUV: they are uploaded as they are to an NV12 or IYUV
+ * streaming texture, and the GPU converts them to RGB when drawing the
+ * texture. Only the frames in another format, like 4:4:4 or 10-bit ones, are
+ * converted to 4:2:0 with libswscale, on the worker thread.
+ *
+ * The main thread calls #oshu::update_movie on every frame with the time of
+ * its clock, which shows the last frame due at that time. The frames that are
+ * already late when decoded are dropped on the worker thread, and the ones
+ * that were due between two updates on the main thread, so that a slow
+ * decoder falls behind without slowing the game down. When the clock jumps,
+ * the worker seeks to the new time.
+ *
+ * ```c
+ * oshu::movie movie;
+ * oshu::open_movie(display, "video.mp4", &movie);
+ * for (each frame) {
+ *     if (oshu::update_movie(&movie, t))
+ *         SDL_RenderCopy(display->renderer, movie.picture.texture, NULL, &dest);
+ * }
+ * oshu::close_movie(&movie);
+ * ```
+ *
+ * \{
+ */
+
+/**
+ * How many decoded frames the worker keeps ahead.
+ */
+static const size_t movie_queue_size = 4;
+
+/**
+ * A decoded frame, and the time it's due, in seconds.
+ */
+struct movie_frame {
+	AVFrame *frame;
+	double time;
+	/**
+	 * The size of the frame's buffers, accounted in the video category of
+	 * \ref core_memory while the frame is queued.
+	 */
+	size_t bytes;
+};
+
+struct movie {
+	oshu::display *display = nullptr;
+	AVFormatContext *demuxer = nullptr;
+	/**
+	 * For files read from an archive, the I/O context reading the
+	 * #source.
+	 */
+	AVIOContext *io = nullptr;
+	oshu::movie_source *source = nullptr;
+	AVCodecContext *decoder = nullptr;
+	int stream_index;
+	/**
+	 * Duration of a timestamp unit, in seconds.
+	 */
+	double time_base;
+	/**
+	 * The timestamp of the first frame, in #time_base units.
+	 */
+	int64_t start_time;
+	/**
+	 * Duration of a frame, in seconds, estimated from the frame rate.
+	 */
+	double frame_duration;
+	/**
+	 * The device decoding the video, or null for software decoding.
+	 */
+	AVBufferRef *hw_device = nullptr;
+	/**
+	 * The pixel format of the hardware frames, as an *AVPixelFormat*.
+	 */
+	int hw_format;
+	/**
+	 * Converts the frames the texture can't take.
+	 */
+	SwsContext *converter = nullptr;
+	/**
+	 * The last frame shown, in a streaming texture created on the first
+	 * update, since its format depends on the decoded frames.
+	 */
+	oshu::texture picture;
+	/**
+	 * The pixel format of #picture, as an *AVPixelFormat*.
+	 */
+	int picture_format;
+	/**
+	 * The time of the frame in #picture, or minus infinity.
+	 */
+	double shown = -INFINITY;
+	/**
+	 * The time of the last update, to detect the jumps of the clock.
+	 */
+	double last_update = 0;
+	std::thread worker;
+	/**
+	 * Protects the fields below, shared with the worker.
+	 */
+	std::mutex mutex;
+	std::condition_variable wake;
+	/**
+	 * The decoded frames, in presentation order.
+	 */
+	std::deque<oshu::movie_frame> frames;
+	/**
+	 * The time the worker should seek to, or NaN.
+	 */
+	double seek_target = NAN;
+	/**
+	 * The time of the last update. Older frames are dropped.
+	 */
+	double now = -INFINITY;
+	bool finished = false;
+	bool stop = false;
+	/**
+	 * How many frames were decoded but never shown.
+	 */
+	uint64_t dropped = 0;
+};
+
+/**
+ * Open a video file, and start decoding it.
+ *
+ * The file is read with #oshu::open_file, so it may be in an archive.
+ *
+ * \return 0 on success, -1 on failure, after logging an error. In both cases,
+ * the movie must be closed with #oshu::close_movie.
+ */
+int open_movie(oshu::display *display, const char *path, oshu::movie *movie);
+
+/**
+ * Show the frame due at *t*, in seconds from the start of the video.
+ *
+ * Call it on every frame, before drawing #oshu::movie::picture.
+ *
+ * \return false when there's no frame to show yet.
+ */
+bool update_movie(oshu::movie *movie, double t);
+
+/**
+ * Stop the worker, and free everything.
+ *
+ * It is safe to call this function on a closed movie.
+ */
+void close_movie(oshu::movie *movie);
+
+/** \} */
+
+}
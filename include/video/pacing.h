@@ -0,0 +1,106 @@
+/**
+ * \file video/pacing.h
+ * \ingroup video_pacing
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+union SDL_Event;
+
+namespace oshu {
+
+struct display;
+
+/**
+ * \defgroup video_pacing Frame pacing
+ * \ingroup video
+ *
+ * \brief
+ * Start the frames at a regular rate.
+ *
+ * The frame rate is set by #oshu::display::frame_duration. Frames are
+ * scheduled on a fixed grid, rather than a fixed delay after the previous
+ * one, so that the time spent drawing doesn't slow the game down.
+ *
+ * `SDL_Delay` is only precise to a millisecond or so, and often a bit more,
+ * which is a large part of a frame at 144 FPS. The pacer sleeps until shortly
+ * before the deadline, and spins on the performance counter for the rest.
+ *
+ * Between two frames, the input events are handled as soon as they arrive with
+ * #oshu::wait_event, rather than once per frame, so that a slow frame doesn't
+ * delay them. The game is updated after each event.
+ *
+ * When #oshu::display::vsync is set, presenting the frame already blocks until
+ * the next refresh, so the pacer doesn't wait. It doesn't either when the frame
+ * rate is uncapped.
+ *
+ * ```c
+ * oshu::frame_pacer pacer;
+ * oshu::start_pacing(&pacer, &display);
+ * for (;;) {
+ *     while (oshu::wait_event(&pacer, &event))
+ *         // handle the event
+ *     oshu::wait_frame(&pacer);
+ *     // poll the remaining events, then draw
+ * }
+ * ```
+ *
+ * \{
+ */
+
+/**
+ * The schedule of the frames.
+ *
+ * All the times are in ticks of `SDL_GetPerformanceCounter`.
+ */
+struct frame_pacer {
+	/**
+	 * Ticks per second.
+	 */
+	uint64_t frequency;
+	/**
+	 * Ticks per frame, or 0 when the pacer doesn't wait.
+	 */
+	uint64_t period;
+	/**
+	 * When the next frame should start, or 0 before the first frame.
+	 */
+	uint64_t deadline;
+	/**
+	 * Frames that started after their deadline.
+	 */
+	int missed_frames;
+};
+
+/**
+ * Schedule the first frame for now, at the display's frame rate.
+ */
+void start_pacing(oshu::frame_pacer *pacer, oshu::display *display);
+
+/**
+ * Wait for an input event until the next frame is almost due.
+ *
+ * The last moments before the deadline are left to #oshu::wait_frame, which
+ * waits more precisely. Events arriving then are polled with the frame.
+ *
+ * When the pacer doesn't wait, it returns immediately.
+ *
+ * \return 1 if an event was received, 0 when it's time to start the frame.
+ */
+int wait_event(oshu::frame_pacer *pacer, union SDL_Event *event);
+
+/**
+ * Wait until the next frame should start.
+ *
+ * If the deadline is already passed, the frame is counted as missed and the
+ * schedule restarts from now, rather than rushing the next frames to catch up.
+ *
+ * \return 0 if the frame is on time, -1 if it was missed.
+ */
+int wait_frame(oshu::frame_pacer *pacer);
+
+/** \} */
+
+}
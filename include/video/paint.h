@@ -10,6 +10,7 @@
 #include <cairo/cairo.h>
 
 struct SDL_Surface;
+struct SDL_Texture;
 
 namespace oshu {
 
@@ -40,6 +41,11 @@ struct texture;
  * oshu::finish_painting(&p, display, &t);
  * ```
  *
+ * Painting may also be split in two, to draw on a background thread and only
+ * upload the texture on the main thread. Start with the zoom-based
+ * #oshu::start_painting, draw, call #oshu::finish_surface from the painting
+ * thread, and finally #oshu::upload_painting from the main thread.
+ *
  * The \ref video/paint.h header imports cairo.h for convenience.
  *
  * \{
@@ -51,6 +57,16 @@ struct painter {
 	struct SDL_Surface *destination = nullptr;
 	cairo_surface_t *surface = nullptr;
 	cairo_t *cr = nullptr;
+	/**
+	 * Keep Cairo's premultiplied colors, and draw the texture with a
+	 * matching blend mode, which saves the un-premultiplying pass.
+	 *
+	 * Only set it when #oshu::display::premultiplied is true, and for
+	 * textures that are never drawn with an alpha modulation, because SDL
+	 * would only apply it to the alpha channel. Set it after
+	 * #oshu::start_painting, which resets the painter.
+	 */
+	bool premultiplied = false;
 };
 
 /**
@@ -75,6 +91,50 @@ struct painter {
  */
 int start_painting(oshu::display *display, oshu::size size, oshu::painter *painter);
 
+/**
+ * Like the display version #oshu::start_painting, but with an explicit zoom,
+ * so that it can be called from any thread.
+ *
+ * The painter has no display, so it must be finalized with
+ * #oshu::finish_surface and #oshu::upload_painting.
+ */
+int start_painting(double zoom, oshu::size size, oshu::painter *painter);
+
+/**
+ * Finalize the drawing into the SDL surface, and free the Cairo context.
+ *
+ * Unlike #oshu::finish_painting, this doesn't touch the renderer, so it may be
+ * called from any thread.
+ */
+void finish_surface(oshu::painter *painter);
+
+/**
+ * Upload a surface finalized with #oshu::finish_surface as a texture, and free
+ * the painter.
+ *
+ * It must be called from the thread owning the display's renderer.
+ */
+int upload_painting(oshu::painter *painter, oshu::display *display, oshu::texture *texture);
+
+/**
+ * Check whether the renderer can blend premultiplied textures.
+ *
+ * \sa oshu::painter::premultiplied
+ */
+bool premultiplied_supported(oshu::display *display);
+
+/**
+ * Make a texture use the premultiplied blend mode.
+ */
+void set_premultiplied_blend(struct SDL_Texture *texture);
+
+/**
+ * Free a painter without uploading anything.
+ *
+ * It is safe to call at any stage of the painting, or on an empty painter.
+ */
+void discard_painting(oshu::painter *painter);
+
 /**
  * Load the drawn texture onto the GPU as a texture, and free everything else.
  *
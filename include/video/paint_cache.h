@@ -0,0 +1,71 @@
+/**
+ * \file video/paint_cache.h
+ * \ingroup video_paint_cache
+ */
+
+#pragma once
+
+#include "core/geometry.h"
+
+#include <stdint.h>
+#include <string>
+
+namespace oshu {
+
+struct display;
+struct painter;
+struct texture;
+
+/**
+ * \defgroup video_paint_cache Paint cache
+ * \ingroup video
+ *
+ * \brief
+ * Keep painted surfaces on disk across runs.
+ *
+ * Laying out text with Pango takes a noticeable time at startup, while the
+ * result rarely changes from one run to the next. The finished surfaces of a
+ * #oshu::painter may be saved in `~/.oshu/cache/paintings`, and loaded back
+ * instead of painting them again.
+ *
+ * A painting is identified by a key, which must cover everything that affects
+ * the result: the content, the size, the zoom, the fonts, …
+ *
+ * ```c
+ * std::string path = oshu::paint_cache_path(key);
+ * if (oshu::load_painting(path, display, size, &texture) < 0) {
+ *     oshu::start_painting(display, size, &p);
+ *     // paint with p.cr
+ *     oshu::finish_surface(&p);
+ *     oshu::save_painting(path, &p);
+ *     oshu::upload_painting(&p, display, &texture);
+ * }
+ * ```
+ *
+ * \{
+ */
+
+/**
+ * Return the path of a painting in the cache, or an empty string when the
+ * cache is unavailable.
+ */
+std::string paint_cache_path(uint64_t key);
+
+/**
+ * Load a cached painting into a texture, with the given logical size.
+ *
+ * \return 0 on success, -1 if the painting isn't cached, or is invalid.
+ */
+int load_painting(const std::string &path, oshu::display *display, oshu::size size, oshu::texture *texture);
+
+/**
+ * Save a finished painter's surface in the cache.
+ *
+ * Call it after #oshu::finish_surface, and before uploading the painting.
+ * Failures are ignored, as the painting can always be painted again.
+ */
+void save_painting(const std::string &path, oshu::painter *painter);
+
+/** \} */
+
+}
@@ -7,6 +7,9 @@
 
 #include "core/geometry.h"
 
+#include <stddef.h>
+
+struct SDL_Surface;
 struct SDL_Texture;
 
 namespace oshu {
@@ -95,7 +98,7 @@ struct texture {
 int load_texture(oshu::display *display, const char *filename, oshu::texture *texture);
 
 /**
- * Destroy an SDL texture with `SDL_DestroyTexture`.
+ * Destroy an SDL texture with #oshu::release_texture.
  *
  * Note that textures are linked to the renderer they were created for, so make
  * sure you delete the textures before the renderer.
@@ -105,6 +108,76 @@ int load_texture(oshu::display *display, const char *filename, oshu::texture *te
  */
 void destroy_texture(oshu::texture *texture);
 
+/**
+ * \name Video memory accounting
+ *
+ * Every texture oshu! creates is counted in the #oshu::VIDEO_MEMORY metric,
+ * with an estimate of 4 bytes per pixel. Create the SDL textures as usual,
+ * pass them to #oshu::track_texture, and destroy them with
+ * #oshu::release_texture, or #oshu::destroy_texture for the #oshu::texture
+ * objects.
+ *
+ * The *OSHU_VIDEO_MEMORY* environment variable sets a budget in MiB. When the
+ * textures exceed it, the #oshu::texture_cache objects evict their least
+ * recently drawn textures, which can be painted again, even when their own
+ * budget isn't reached yet. The other textures are never evicted, so the
+ * budget is a target rather than a hard limit.
+ *
+ * The surfaces the textures are painted on live in system memory, and are
+ * counted in the video category of \ref core_memory instead. Create them with
+ * #oshu::create_surface, and free them with #oshu::free_surface.
+ *
+ * \{
+ */
+
+/**
+ * Estimate the video memory used by a texture, assuming 32-bit pixels.
+ */
+size_t texture_bytes(struct SDL_Texture *texture);
+
+/**
+ * Add a new texture to the video memory usage.
+ *
+ * Null textures are ignored, so that it can be called right after creating
+ * the texture, before checking it.
+ */
+void track_texture(struct SDL_Texture *texture);
+
+/**
+ * Remove a texture from the video memory usage, and destroy it.
+ *
+ * Null textures are ignored.
+ */
+void release_texture(struct SDL_Texture *texture);
+
+/**
+ * Create a 32-bit ARGB surface, the format of the paintings, and add it to the
+ * memory usage.
+ *
+ * \return The surface, or null on failure.
+ */
+struct SDL_Surface* create_surface(int width, int height);
+
+/**
+ * Remove a surface from the memory usage, and free it.
+ *
+ * Null surfaces are ignored.
+ */
+void free_surface(struct SDL_Surface *surface);
+
+/**
+ * The video memory budget set by *OSHU_VIDEO_MEMORY*, in bytes, or 0 when
+ * there's none.
+ */
+size_t video_memory_budget();
+
+/**
+ * Tell whether the textures use more video memory than the budget allows.
+ */
+bool over_video_memory_budget();
+
+/** \} */
+
 /**
  * Draw a texture at the specified position.
  *
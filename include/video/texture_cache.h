@@ -0,0 +1,106 @@
+/**
+ * \file video/texture_cache.h
+ * \ingroup video_texture_cache
+ */
+
+#pragma once
+
+#include <list>
+#include <stddef.h>
+#include <unordered_map>
+
+namespace oshu {
+
+struct texture;
+
+/**
+ * \defgroup video_texture_cache Texture cache
+ * \ingroup video
+ *
+ * \brief
+ * Keep generated textures in video memory within a budget.
+ *
+ * Some textures, like the slider bodies, are expensive to paint but only
+ * needed for a short time. Freeing them as soon as they're not needed means
+ * painting them again whenever the user rewinds, while keeping them all would
+ * fill the video memory on long beatmaps.
+ *
+ * This cache keeps track of the textures' sizes in video memory, and frees the
+ * least recently drawn ones when the total exceeds a budget, or when all the
+ * textures together exceed the video memory budget of
+ * #oshu::video_memory_budget. Textures drawn during the current frame are
+ * never evicted.
+ *
+ * A texture is identified by the pointer that owns it, like
+ * `&hit->texture`. When it is evicted, the texture is destroyed, freed, and
+ * the owning pointer is reset to null.
+ *
+ * \{
+ */
+
+/**
+ * One texture in a #oshu::texture_cache.
+ */
+struct cached_texture {
+	/**
+	 * The pointer owning the texture, which was allocated with `malloc`.
+	 */
+	oshu::texture **owner;
+	/**
+	 * The estimated size of the texture in video memory, in bytes.
+	 */
+	size_t bytes;
+	/**
+	 * The last frame the texture was drawn in.
+	 */
+	unsigned int frame;
+};
+
+struct texture_cache {
+	/**
+	 * The maximum size of the cached textures, in bytes.
+	 */
+	size_t budget;
+	/**
+	 * The current size of the cached textures, in bytes.
+	 */
+	size_t usage;
+	/**
+	 * The current frame number, incremented by #oshu::trim_textures.
+	 */
+	unsigned int frame;
+	/**
+	 * The textures, from the most recently drawn to the least recently drawn.
+	 */
+	std::list<oshu::cached_texture> entries;
+	std::unordered_map<oshu::texture**, std::list<oshu::cached_texture>::iterator> index;
+};
+
+/**
+ * Add a freshly created texture to the cache, as if it was just drawn.
+ */
+void insert_texture(oshu::texture_cache *cache, oshu::texture **owner);
+
+/**
+ * Mark a cached texture as drawn in the current frame.
+ *
+ * Textures that aren't in the cache are ignored.
+ */
+void touch_texture(oshu::texture_cache *cache, oshu::texture **owner);
+
+/**
+ * Evict the least recently drawn textures until the cache fits its budget,
+ * and start a new frame.
+ *
+ * Call it once per frame, after drawing.
+ */
+void trim_textures(oshu::texture_cache *cache);
+
+/**
+ * Destroy every cached texture.
+ */
+void clear_texture_cache(oshu::texture_cache *cache);
+
+/** \} */
+
+}
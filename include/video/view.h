@@ -7,6 +7,8 @@
 
 #include "core/geometry.h"
 
+#include <stddef.h>
+
 namespace oshu {
 
 struct display;
@@ -118,6 +120,14 @@ struct display;
  * logical coordinates and physical coordinates. Views convert logical
  * coordinates into physical coordinates, so the logical one is the input, and
  * physical one the output.
+ *
+ * In matrix terms, a view is the similarity `[[z, 0, x], [0, z, y]]`. Rotations
+ * and shearing are never needed, so the three numbers are kept as they are
+ * rather than as a general matrix. The view is not handed to SDL as a render
+ * scale either: the textures are painted at the view's zoom, pixel for pixel,
+ * and scaling them again in the renderer would blur them. To transform many
+ * points at once, like a polyline or a cursor trail, use the batched
+ * #oshu::project.
  */
 struct view {
 	double zoom;
@@ -208,6 +218,21 @@ oshu::point project(oshu::view *view, oshu::point p);
  */
 oshu::point unproject(oshu::view *view, oshu::point p);
 
+/**
+ * Project *count* points in place.
+ *
+ * The points are handled as a flat array of coordinates, which the compiler
+ * vectorizes, unlike the complex products of the single-point version.
+ */
+void project(oshu::view *view, oshu::point *points, size_t count);
+
+/**
+ * Unproject *count* points in place.
+ *
+ * \sa oshu::project
+ */
+void unproject(oshu::view *view, oshu::point *points, size_t count);
+
 /** \} */
 
 }
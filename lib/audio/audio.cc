@@ -7,73 +7,597 @@
  */
 
 #include "audio/audio.h"
+#include "audio/mix.h"
+#include "audio/pcm.h"
 #include "core/log.h"
+#include "core/metrics.h"
+#include "core/trace.h"
 
+#include <algorithm>
 #include <assert.h>
+#include <chrono>
+#include <stdlib.h>
+#include <string.h>
+#include <system_error>
 
 /**
- * Size of the SDL audio buffer, in samples.
+ * Size of the SDL audio buffer, in samples, for each latency level.
  *
- * The smaller it is, the less lag.
+ * The smaller it is, the less lag, but the more often the audio callback runs,
+ * and the more likely an overloaded system is to produce audible underruns.
  *
  * It should be a power of 2 according to SDL's doc.
+ *
+ * \sa get_buffer_size
+ */
+static const int low_latency_buffer_size = 256;
+static const int medium_latency_buffer_size = 1024;
+static const int high_latency_buffer_size = 2048;
+
+/**
+ * Size of the ring buffer between the decoder thread and the audio callback,
+ * in samples.
+ *
+ * This is how far ahead of the playback the decoder may go, about 0.7 second
+ * at 44.1 kHz. A slow decode is only heard when it stalls for that long.
+ */
+static const size_t ring_size = 32768;
+
+/**
+ * Number of samples the decoder thread reads from the stream at once.
+ */
+static const int decode_chunk_size = 1024;
+
+/**
+ * Number of voices for the sound effects.
+ *
+ * Marathon streams may layer a normal sound, a whistle, a clap and a finish on
+ * every note, with each sample lasting for several notes.
+ */
+static const int voice_count = 64;
+
+/**
+ * How long looping samples take to fade in and out, in seconds.
+ */
+static const double loop_fade = .005;
+
+/**
+ * Number of samples per channel the audio callback processes at once.
+ *
+ * 256 stereo samples take 2 KiB, which stays in the L1 cache while all the
+ * tracks are mixed into it.
+ */
+static const int mix_block_size = 256;
+
+/**
+ * How long the decoder thread sleeps when the ring is full.
+ *
+ * It must be well below the duration of #ring_size, so that the decoder refills
+ * the ring before the audio callback drains it.
+ */
+static const std::chrono::milliseconds decode_interval(10);
+
+/**
+ * How long #oshu::render_audio sleeps while waiting for the decoder thread.
+ */
+static const std::chrono::microseconds offline_poll_interval(200);
+
+/**
+ * Apply the last seek of the decoder thread, if the audio callback hasn't yet.
+ *
+ * Skip the samples decoded before the seek, and stop the sound effects,
+ * including the scheduled ones.
+ *
+ * If the decoder is in the middle of publishing a seek, leave it for the next
+ * callback rather than waiting.
+ */
+static void handle_seek(oshu::audio *audio)
+{
+	unsigned sequence = audio->seek_sequence.load();
+	if (sequence == audio->seek_handled || sequence % 2)
+		return;
+	size_t position = audio->seek_position.load();
+	double timestamp = audio->seek_timestamp.load();
+	double rate = audio->seek_rate.load();
+	if (audio->seek_sequence.load() != sequence)
+		return;
+	oshu::skip_ring(&audio->ring, position);
+	audio->handled_position = position;
+	audio->handled_timestamp = timestamp;
+	audio->handled_rate = rate;
+	audio->scheduled_count = 0;
+	oshu::stop_voices(&audio->voices);
+	for (int i = 0; i < oshu::max_loops; ++i)
+		audio->loop_voices[i] = -1;
+	audio->seek_handled = sequence;
+}
+
+/**
+ * Start a sample on a new voice, *delay* samples into the current buffer.
+ *
+ * Only the audio callback may call it.
+ */
+static int start_voice(oshu::audio *audio, oshu::sound_command *command, int delay)
+{
+	int index = oshu::acquire_voice(&audio->voices, command->priority);
+	if (index < 0) {
+		oshu_log_debug("every voice is more important, dropping a sample");
+		return -1;
+	}
+	oshu::track *track = &audio->voices.voices[index].track;
+	oshu::start_track(track, command->sample, command->volume, 0);
+	if (!track->sample) {
+		/* null or empty sample, nothing to play */
+		oshu::release_voice(&audio->voices, index);
+		return -1;
+	}
+	track->delay = delay;
+	return index;
+}
+
+/**
+ * Start a looping sample on a new voice, fading it in.
+ *
+ * The loop's handle is only recorded if the voice really started.
+ */
+static void start_loop(oshu::audio *audio, oshu::sound_command *command, int delay)
+{
+	int fade = loop_fade * audio->device_spec.freq;
+	int index = start_voice(audio, command, delay);
+	if (index < 0)
+		return;
+	audio->loop_voices[command->loop] = index;
+	oshu::track *track = &audio->voices.voices[index].track;
+	track->loop = 1;
+	track->volume = 0;
+	oshu::ramp_track(track, command->volume, fade);
+}
+
+/**
+ * Fade out a looping sample. Its voice is released once the fade is over.
+ */
+static void stop_loop(oshu::audio *audio, oshu::sound_command *command)
+{
+	int fade = loop_fade * audio->device_spec.freq;
+	int index = audio->loop_voices[command->loop];
+	audio->loop_voices[command->loop] = -1;
+	if (index >= 0)
+		oshu::ramp_track(&audio->voices.voices[index].track, 0, fade);
+}
+
+/**
+ * Clear the handles of the loops whose voice was released while mixing, so
+ * that they never point at a voice reused by another sample.
  */
-static const int sample_buffer_size = 2048;
+static void forget_released_loops(oshu::audio *audio)
+{
+	for (int i = 0; i < oshu::max_loops; ++i) {
+		int index = audio->loop_voices[i];
+		if (index >= 0 && !audio->voices.voices[index].active)
+			audio->loop_voices[i] = -1;
+	}
+}
 
 /**
- * Clip a buffer of float audio samples to ensure every sample's value is
- * normalized between -1 and 1.
+ * Compute where a command should take effect in the current audio buffer, in
+ * samples per channel.
  *
- * Without this, some audio cards emit an awful noise.
+ * The command is delayed by the time elapsed between the previous callback
+ * and the command, so that it is heard with a constant latency. Commands that
+ * would fall outside the buffer, like the ones issued while the audio was
+ * paused, take effect immediately.
  */
-static void clip(float *samples, int nb_samples, int channels)
+static int command_offset(oshu::audio *audio, oshu::sound_command *command, int nb_samples)
 {
-	for (int i = 0; i < nb_samples * channels; ++i) {
-		if (samples[i] > 1.)
-			samples[i] = 1.;
-		else if (samples[i] < -1.)
-			samples[i] = -1.;
+	if (!audio->previous_callback || command->time <= audio->previous_callback)
+		return 0;
+	double elapsed = (double) (command->time - audio->previous_callback) / SDL_GetPerformanceFrequency();
+	int offset = elapsed * audio->device_spec.freq;
+	return offset < nb_samples ? offset : 0;
+}
+
+/**
+ * Apply the sound commands sent by #oshu::play_sample and friends.
+ */
+static void drain_commands(oshu::audio *audio, int nb_samples)
+{
+	size_t tail = audio->sound_tail.load(std::memory_order_relaxed);
+	size_t head = audio->sound_head.load(std::memory_order_acquire);
+	for (; tail != head; ++tail) {
+		oshu::sound_command *command = &audio->sound_commands[tail % oshu::sound_queue_size];
+		switch (command->type) {
+		case oshu::sound_command::PLAY_SAMPLE:
+			start_voice(audio, command, command_offset(audio, command, nb_samples));
+			break;
+		case oshu::sound_command::PLAY_LOOP:
+			start_loop(audio, command, command_offset(audio, command, nb_samples));
+			break;
+		case oshu::sound_command::STOP_LOOP:
+			stop_loop(audio, command);
+			break;
+		case oshu::sound_command::SCHEDULE_SAMPLE:
+			if (audio->scheduled_count < oshu::max_scheduled_samples)
+				audio->scheduled[audio->scheduled_count++] = *command;
+			else
+				oshu_log_debug("too many scheduled samples, dropping one");
+			break;
+		}
 	}
+	audio->sound_tail.store(tail, std::memory_order_release);
 }
 
 /**
- * Fill SDL's audio buffer, while requesting more frames as needed.
+ * Start the scheduled samples that are due in the current audio buffer, at
+ * their exact position in it.
  *
- * libavcodec organize frames by channel in planar mode (LLLLRRRR), while we'd
- * like them to be interleaved as SDL requires (LRLRLRLR). This makes a
- * intricate nesting of loops. In that order: frame loop, sample loop, channel
- * loop. Makes sense.
+ * The buffer starts at position *start* in the ring, and is *nb_samples*
+ * long.
+ */
+static void start_scheduled(oshu::audio *audio, size_t start, int nb_samples)
+{
+	int rate = audio->device_spec.freq;
+	for (int i = 0; i < audio->scheduled_count;) {
+		oshu::sound_command *command = &audio->scheduled[i];
+		double position = audio->handled_position + (command->timestamp - audio->handled_timestamp) / audio->handled_rate * rate;
+		double offset = position - start;
+		if (offset >= nb_samples) {
+			++i;
+			continue;
+		}
+		start_voice(audio, command, offset > 0 ? (int) offset : 0);
+		*command = audio->scheduled[--audio->scheduled_count];
+	}
+}
+
+/**
+ * Fill SDL's audio buffer from the ring, and mix the sound effects.
  *
- * When frames are interleaved, a coarser memcpy does the trick.
+ * This function never calls ffmpeg, nor waits for the decoder thread. If the
+ * ring doesn't have enough samples, because the stream is finished or the
+ * decoder is late, fill what remains of the buffer with silence, because you
+ * never know what SDL might do with a left-over buffer. Most likely, it would
+ * play the previous buffer over, and over again.
  *
- * When the stream is finished, fill what remains of the buffer with silence,
- * because you never know what SDL might do with a left-over buffer. Most
- * likely, it would play the previous buffer over, and over again.
+ * The buffer is processed by blocks of #mix_block_size samples, each of which
+ * is filled, mixed with every track and clipped while it's still in the CPU
+ * cache, rather than walking the whole buffer once per track.
  */
 static void audio_callback(void *userdata, Uint8 *buffer, int len)
 {
 	oshu::audio *audio;
 	audio = (oshu::audio*) userdata;
-	int unit = audio->device_spec.channels * sizeof(float);
+	int channels = audio->device_spec.channels;
+	int unit = channels * sizeof(float);
 	assert (len % unit == 0);
 	int nb_samples = len / unit;
-	float *samples = (float*) buffer;
+	oshu::scoped_timer timer(oshu::AUDIO_ZONE);
 
-	int rc = oshu::read_stream(&audio->music, samples, nb_samples);
-	if (rc < 0) {
-		oshu_log_debug("failed reading samples from the audio stream");
-		return;
-	} else if (rc < nb_samples) {
-		/* fill what remains with silence */
-		memset(buffer + rc * unit, 0, len - rc * unit);
+	Uint64 now = SDL_GetPerformanceCounter();
+	handle_seek(audio);
+	drain_commands(audio, nb_samples);
+	start_scheduled(audio, audio->ring.tail.load(), nb_samples);
+	audio->previous_callback = now;
+
+	bool drained = audio->music_drained.load(std::memory_order_relaxed);
+	size_t ahead = audio->ring.head.load() - audio->ring.tail.load();
+	int64_t ahead_us = ahead * 1000000 / audio->device_spec.freq;
+	oshu::set_gauge(oshu::AUDIO_DECODED_AHEAD, ahead_us);
+	if (!drained)
+		oshu::lower_gauge(oshu::AUDIO_DECODED_AHEAD_MIN, ahead_us);
+
+	bool starved = false;
+	for (int offset = 0; offset < nb_samples; offset += mix_block_size) {
+		int count = std::min(mix_block_size, nb_samples - offset);
+		float *samples = (float*) buffer + offset * channels;
+		int rc = oshu::read_ring(&audio->ring, samples, count);
+		if (rc < count) {
+			starved = true;
+			/* fill what remains with silence */
+			memset(samples + rc * channels, 0, (count - rc) * unit);
+		}
+		oshu::mix_voices(&audio->voices, samples, count);
+		oshu::clip_samples(samples, count * channels);
+	}
+	forget_released_loops(audio);
+
+	unsigned sequence = audio->timing_sequence.load();
+	audio->timing_sequence = sequence + 1;
+	audio->timing_tail = audio->ring.tail.load();
+	audio->timing_counter = now;
+	audio->timing_samples = nb_samples;
+	audio->timing_sequence = sequence + 2;
+
+	if (starved && !drained)
+		oshu::count(oshu::AUDIO_UNDERRUNS);
+	int64_t elapsed = (SDL_GetPerformanceCounter() - now) * 1000000 / SDL_GetPerformanceFrequency();
+	oshu::count(oshu::AUDIO_CALLBACKS);
+	oshu::count(oshu::AUDIO_CALLBACK_TIME, elapsed);
+	oshu::raise_gauge(oshu::AUDIO_CALLBACK_MAX_TIME, elapsed);
+}
+
+/**
+ * Seek the music, and tell the audio callback about it.
+ *
+ * The stretcher is reset, or replaced when the command changes the rate.
+ *
+ * Must be called from the decoder thread.
+ */
+static int seek_decoder(oshu::audio *audio, oshu::audio_command *command)
+{
+	double target = command->seek_target;
+	oshu::stretcher *stretcher = &audio->stretcher;
+	if (command->rate != stretcher->rate || command->keep_pitch != stretcher->keep_pitch) {
+		oshu::close_stretcher(stretcher);
+		if (oshu::open_stretcher(stretcher, audio->music.sample_rate, command->rate, command->keep_pitch) < 0)
+			return -1;
+	} else if (oshu::reset_stretcher(stretcher) < 0) {
+		return -1;
+	}
+	double timestamp;
+	if (audio->pcm_ready.load()) {
+		/* Switch to the PCM cache as soon as it's ready. */
+		double rate = audio->pcm.sample_rate;
+		double cursor = std::max(0., (target - audio->pcm_origin) * rate);
+		if (cursor >= audio->pcm.nb_samples) {
+			oshu_log_warning("cannot seek past the end of the stream");
+			return -1;
+		}
+		audio->pcm_active = true;
+		audio->pcm_cursor = cursor;
+		timestamp = audio->pcm_origin + audio->pcm_cursor / rate;
+	} else {
+		int rc = oshu::seek_stream(&audio->music, target);
+		if (rc < 0)
+			return rc;
+		timestamp = audio->music.current_timestamp;
+	}
+	audio->seek_sequence.fetch_add(1);
+	audio->seek_position = audio->ring.head.load();
+	audio->seek_timestamp = timestamp;
+	audio->seek_rate = stretcher->rate;
+	audio->seek_sequence.fetch_add(1);
+	return 0;
+}
+
+/**
+ * Read the next samples of the music, either from the stream or from the PCM
+ * cache.
+ *
+ * Must be called from the decoder thread.
+ */
+static int read_music(oshu::audio *audio, float *samples, int nb_samples)
+{
+	if (!audio->pcm_active)
+		return oshu::read_stream(&audio->music, samples, nb_samples);
+	size_t rc = oshu::read_pcm_cache(&audio->pcm, audio->pcm_cursor, samples, nb_samples);
+	audio->pcm_cursor += rc;
+	return rc;
+}
+
+/**
+ * Check whether the decoder thread has read the whole music, not counting
+ * what's left in the stretcher.
+ */
+static bool source_finished(oshu::audio *audio)
+{
+	if (audio->pcm_active)
+		return audio->pcm_cursor >= audio->pcm.nb_samples;
+	return audio->music.finished;
+}
+
+/**
+ * Check whether the decoder thread has read the whole music, and stretched
+ * it.
+ */
+static bool music_finished(oshu::audio *audio)
+{
+	if (!source_finished(audio))
+		return false;
+	return !oshu::stretching(&audio->stretcher) || oshu::stretcher_drained(&audio->stretcher);
+}
+
+/**
+ * Read the next samples of the music like #read_music, stretched to the
+ * #oshu::audio::rate.
+ *
+ * The stretcher is fed by chunks of #decode_chunk_size input samples until it
+ * has *nb_samples* samples ready, or until the end of the music.
+ */
+static int read_stretched(oshu::audio *audio, float *samples, int nb_samples)
+{
+	oshu::stretcher *stretcher = &audio->stretcher;
+	if (!oshu::stretching(stretcher))
+		return read_music(audio, samples, nb_samples);
+	float chunk[decode_chunk_size * 2];
+	int count = 0;
+	for (;;) {
+		count += oshu::read_stretcher(stretcher, samples + count * 2, nb_samples - count);
+		if (count == nb_samples || stretcher->flushed)
+			return count;
+		if (source_finished(audio)) {
+			if (oshu::flush_stretcher(stretcher) < 0)
+				return -1;
+			continue;
+		}
+		int rc = read_music(audio, chunk, decode_chunk_size);
+		if (rc < 0)
+			return -1;
+		if (oshu::feed_stretcher(stretcher, chunk, rc) < 0)
+			return -1;
+	}
+}
+
+/**
+ * Body of the decoder thread.
+ *
+ * Decode the music into the ring as long as there's room for a full chunk,
+ * then sleep until a command arrives or the audio callback might have
+ * consumed a chunk.
+ *
+ * The command mutex is released while decoding, so that the requesters are
+ * never locked out by ffmpeg.
+ */
+static void decode(oshu::audio *audio)
+{
+	float chunk[decode_chunk_size * 2];
+	std::unique_lock<std::mutex> lock(audio->command_mutex);
+	while (!audio->stopping) {
+		if (!audio->commands.empty()) {
+			oshu::audio_command *command = audio->commands.front();
+			audio->commands.pop_front();
+			command->result = seek_decoder(audio, command);
+			command->done = true;
+			audio->command_signal.notify_all();
+			continue;
+		}
+		oshu::sample_ring *ring = &audio->ring;
+		size_t room = ring->capacity - (ring->head.load() - ring->tail.load());
+		bool finished = music_finished(audio);
+		audio->music_drained.store(finished, std::memory_order_relaxed);
+		if (finished || room < decode_chunk_size) {
+			audio->command_signal.wait_for(lock, decode_interval);
+			continue;
+		}
+		lock.unlock();
+		int rc = read_stretched(audio, chunk, decode_chunk_size);
+		if (rc > 0)
+			oshu::write_ring(ring, chunk, rc);
+		if (rc < 0 || (rc < decode_chunk_size && !music_finished(audio)))
+			oshu::count(oshu::AUDIO_SHORT_READS);
+		lock.lock();
+		if (rc < 0) {
+			oshu_log_debug("failed reading samples from the audio stream");
+			audio->command_signal.wait_for(lock, decode_interval);
+		}
+	}
+}
+
+/**
+ * Allocate the ring buffer, and start the decoder thread.
+ * \return 0 on success, -1 on error.
+ */
+static int start_decoder(oshu::audio *audio)
+{
+	if (oshu::open_ring(&audio->ring, ring_size) < 0)
+		return -1;
+	audio->rate = 1.;
+	audio->keep_pitch = false;
+	if (oshu::open_stretcher(&audio->stretcher, audio->music.sample_rate, 1., false) < 0)
+		return -1;
+	audio->stopping = false;
+	audio->music_drained = false;
+	audio->seek_sequence = 0;
+	audio->seek_handled = 0;
+	audio->seek_position = 0;
+	audio->seek_timestamp = audio->music.current_timestamp;
+	audio->seek_rate = 1.;
+	audio->handled_position = 0;
+	audio->handled_timestamp = audio->music.current_timestamp;
+	audio->handled_rate = 1.;
+	audio->scheduled_count = 0;
+	audio->timing_sequence = 0;
+	audio->timing_tail = 0;
+	audio->timing_counter = 0;
+	audio->timing_samples = 0;
+	audio->pcm_active = audio->pcm_ready.load();
+	audio->pcm_cursor = 0;
+	try {
+		audio->decoder = std::thread(decode, audio);
+	} catch (std::system_error &e) {
+		oshu_log_error("could not start the audio decoder thread: %s", e.what());
+		return -1;
 	}
+	return 0;
+}
+
+/**
+ * Stop the decoder thread if it's running, and free the ring buffer.
+ */
+static void stop_decoder(oshu::audio *audio)
+{
+	if (audio->decoder.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(audio->command_mutex);
+			audio->stopping = true;
+		}
+		audio->command_signal.notify_all();
+		audio->decoder.join();
+	}
+	oshu::close_ring(&audio->ring);
+	oshu::close_stretcher(&audio->stretcher);
+}
+
+/**
+ * Return the size of the SDL audio buffer reading the OSHU_AUDIO_LATENCY
+ * environment variable.
+ */
+static int get_buffer_size()
+{
+	char *value = getenv("OSHU_AUDIO_LATENCY");
+	if (!value || !*value) { /* null or empty */
+		return high_latency_buffer_size;
+	} else if (!strcmp(value, "high")) {
+		return high_latency_buffer_size;
+	} else if (!strcmp(value, "medium")) {
+		return medium_latency_buffer_size;
+	} else if (!strcmp(value, "low")) {
+		return low_latency_buffer_size;
+	} else {
+		oshu_log_warning("invalid OSHU_AUDIO_LATENCY value: %s", value);
+		oshu_log_warning("supported latency levels are: low, medium, high");
+		return high_latency_buffer_size;
+	}
+}
 
-	int tracks = sizeof(audio->effects) / sizeof(*audio->effects);
-	for (int i = 0; i < tracks; i++)
-		oshu::mix_track(&audio->effects[i], samples, nb_samples);
-	oshu::mix_track(&audio->looping, samples, nb_samples);
+/**
+ * Map the PCM cache of the music if it exists, or start building it in the
+ * background when it's enabled.
+ *
+ * Failing to use the cache is never an error, since the music can always be
+ * streamed.
+ */
+static void start_pcm_cache(const char *url, oshu::audio *audio)
+{
+	audio->pcm_origin = audio->music.current_timestamp;
+	size_t limit = oshu::pcm_cache_limit();
+	if (!limit)
+		return;
+	std::string path = oshu::pcm_cache_path(url, audio->music.sample_rate);
+	if (path.empty())
+		return;
+	if (oshu::open_pcm_cache(path.c_str(), audio->music.sample_rate, &audio->pcm) == 0) {
+		audio->pcm_ready = true;
+		return;
+	}
+	if (audio->music.duration * audio->music.sample_rate * 2 * sizeof(float) > limit) {
+		oshu_log_debug("the music is too long for the PCM cache, streaming it");
+		return;
+	}
+	std::string source = url;
+	int rate = audio->music.sample_rate;
+	auto build = [audio, source, path, rate, limit] {
+		if (oshu::build_pcm_cache(source.c_str(), path.c_str(), rate, limit, &audio->pcm_cancel) < 0)
+			return;
+		if (oshu::open_pcm_cache(path.c_str(), audio->music.sample_rate, &audio->pcm) == 0)
+			audio->pcm_ready = true;
+	};
+	try {
+		audio->pcm_builder = std::thread(build);
+	} catch (std::system_error &e) {
+		oshu_log_debug("could not start the PCM cache thread: %s", e.what());
+	}
+}
 
-	clip(samples, nb_samples, audio->device_spec.channels);
+/**
+ * Stop building the PCM cache, and unmap it.
+ */
+static void stop_pcm_cache(oshu::audio *audio)
+{
+	if (audio->pcm_builder.joinable()) {
+		audio->pcm_cancel = true;
+		audio->pcm_builder.join();
+	}
+	oshu::close_pcm_cache(&audio->pcm);
 }
 
 /**
@@ -87,7 +611,7 @@ static int open_device(oshu::audio *audio)
 	want.freq = audio->music.sample_rate;
 	want.format = AUDIO_F32;
 	want.channels = 2;
-	want.samples = sample_buffer_size;
+	want.samples = get_buffer_size();
 	want.callback = audio_callback;
 	want.userdata = (void*) audio;
 	audio->device_id = SDL_OpenAudioDevice(NULL, 0, &want, &audio->device_spec, 0);
@@ -98,13 +622,43 @@ static int open_device(oshu::audio *audio)
 	assert (audio->device_spec.freq == audio->music.sample_rate);
 	assert (audio->device_spec.format == AUDIO_F32);
 	assert (audio->device_spec.channels == 2);
+	audio->latency = (double) audio->device_spec.samples / audio->device_spec.freq;
+	oshu_log_debug("audio buffer of %d samples, %.1f ms of latency", audio->device_spec.samples, audio->latency * 1000);
+	oshu_log_debug("using the %s mixing kernels", oshu::mix_kernels());
+	return 0;
+}
+
+/**
+ * Return the sample rate the default audio device works at, or 0 if SDL can't
+ * tell.
+ *
+ * Opening the device at that rate spares SDL from resampling everything we
+ * mix, in real time, with its own cheap filter. The music is resampled once by
+ * the decoder instead, and the samples when they are loaded.
+ */
+static int native_sample_rate()
+{
+#if SDL_VERSION_ATLEAST(2, 24, 0)
+	SDL_AudioSpec spec;
+	if (SDL_GetDefaultAudioInfo(NULL, &spec, 0) == 0) {
+		oshu_log_debug("the audio device works at %d Hz", spec.freq);
+		return spec.freq;
+	}
+	oshu_log_debug("could not query the audio device: %s", SDL_GetError());
+#endif
 	return 0;
 }
 
 int oshu::open_audio(const char *url, oshu::audio *audio)
 {
 	assert (sizeof(float) == 4);
-	if (oshu::open_stream(url, &audio->music) < 0)
+	if (oshu::open_stream(url, &audio->music, native_sample_rate()) < 0)
+		goto fail;
+	start_pcm_cache(url, audio);
+	oshu::open_voice_pool(&audio->voices, voice_count);
+	for (int i = 0; i < oshu::max_loops; ++i)
+		audio->loop_voices[i] = -1;
+	if (start_decoder(audio) < 0)
 		goto fail;
 	if (open_device(audio) < 0)
 		goto fail;
@@ -114,82 +668,185 @@ fail:
 	return -1;
 }
 
+int oshu::open_offline_audio(const char *url, oshu::audio *audio)
+{
+	if (oshu::open_stream(url, &audio->music) < 0)
+		goto fail;
+	oshu::open_voice_pool(&audio->voices, voice_count);
+	for (int i = 0; i < oshu::max_loops; ++i)
+		audio->loop_voices[i] = -1;
+	if (start_decoder(audio) < 0)
+		goto fail;
+	SDL_zero(audio->device_spec);
+	audio->device_spec.freq = audio->music.sample_rate;
+	audio->device_spec.format = AUDIO_F32;
+	audio->device_spec.channels = 2;
+	audio->latency = 0;
+	return 0;
+fail:
+	oshu::close_audio(audio);
+	return -1;
+}
+
+void oshu::render_audio(oshu::audio *audio, float *samples, int nb_samples)
+{
+	assert (!audio->device_id);
+	oshu::sample_ring *ring = &audio->ring;
+	assert ((size_t) nb_samples <= ring->capacity);
+	while (ring->head.load() - ring->tail.load() < (size_t) nb_samples && !audio->music_drained.load()) {
+		audio->command_signal.notify_all();
+		std::this_thread::sleep_for(offline_poll_interval);
+	}
+	/* Start the commands at the beginning of the buffer, since the time
+	 * they were sent has nothing to do with the music. */
+	audio->previous_callback = 0;
+	audio_callback(audio, (Uint8*) samples, nb_samples * 2 * sizeof(float));
+	audio->command_signal.notify_all();
+}
+
 void oshu::play_audio(oshu::audio *audio)
 {
-	SDL_PauseAudioDevice(audio->device_id, 0);
+	if (audio->device_id)
+		SDL_PauseAudioDevice(audio->device_id, 0);
 }
 
 void oshu::pause_audio(oshu::audio *audio)
 {
-	SDL_PauseAudioDevice(audio->device_id, 1);
+	if (audio->device_id)
+		SDL_PauseAudioDevice(audio->device_id, 1);
 }
 
 void oshu::close_audio(oshu::audio *audio)
 {
 	if (audio->device_id)
 		SDL_CloseAudioDevice(audio->device_id);
+	stop_decoder(audio);
+	stop_pcm_cache(audio);
 	oshu::close_stream(&audio->music);
 }
 
 /**
- * Pick a track for playing sound effects.
- *
- * If one track is inactive, pick it without hesitation. If all the tracks
- * are active, pick the one with the biggest cursor, because there's a good
- * chance it's about to end.
+ * Send a command to the audio callback.
  *
- * Make sure you lock the audio device when calling this function, in order to
- * ensure predictable results.
+ * Only one thread may call this function.
  */
-static oshu::track *select_track(oshu::audio *audio)
+static void push_command(oshu::audio *audio, oshu::sound_command::kind type, oshu::sample *sample, float volume, oshu::voice_priority priority = oshu::NORMAL_VOICE, double timestamp = 0, int loop = -1)
 {
-	int max_cursor = 0;
-	oshu::track *best_track = &audio->effects[0];
-	int tracks = sizeof(audio->effects) / sizeof(*audio->effects);
-	for (int i = 0; i < tracks; ++i) {
-		oshu::track *c = &audio->effects[i];
-		if (c->sample == NULL) {
-			return c;
-		} else if (c->cursor > max_cursor) {
-			max_cursor = c->cursor;
-			best_track = c;
-		}
+	size_t head = audio->sound_head.load(std::memory_order_relaxed);
+	size_t tail = audio->sound_tail.load(std::memory_order_acquire);
+	if (head - tail >= oshu::sound_queue_size) {
+		oshu_log_debug("the sound command queue is full, dropping a command");
+		return;
 	}
-	return best_track;
+	oshu::sound_command *command = &audio->sound_commands[head % oshu::sound_queue_size];
+	command->type = type;
+	command->sample = sample;
+	command->volume = volume;
+	command->priority = priority;
+	command->time = SDL_GetPerformanceCounter();
+	command->timestamp = timestamp;
+	command->loop = loop;
+	audio->sound_head.store(head + 1, std::memory_order_release);
+}
+
+void oshu::play_sample(oshu::audio *audio, oshu::sample *sample, float volume, oshu::voice_priority priority)
+{
+	push_command(audio, oshu::sound_command::PLAY_SAMPLE, sample, volume, priority);
 }
 
-void oshu::play_sample(oshu::audio *audio, oshu::sample *sample, float volume)
+void oshu::schedule_sample(oshu::audio *audio, oshu::sample *sample, float volume, double timestamp, oshu::voice_priority priority)
 {
-	SDL_LockAudioDevice(audio->device_id);
-	oshu::track *track = select_track(audio);
-	if (track->sample != NULL)
-		oshu_log_debug("all the effect tracks are taken, stealing one");
-	oshu::start_track(track, sample, volume, 0);
-	SDL_UnlockAudioDevice(audio->device_id);
+	push_command(audio, oshu::sound_command::SCHEDULE_SAMPLE, sample, volume, priority, timestamp);
 }
 
-void oshu::play_loop(oshu::audio *audio, oshu::sample *sample, float volume)
+int oshu::play_loop(oshu::audio *audio, oshu::sample *sample, float volume)
 {
-	SDL_LockAudioDevice(audio->device_id);
-	oshu::start_track(&audio->looping, sample, volume, 1);
-	SDL_UnlockAudioDevice(audio->device_id);
+	for (int i = 0; i < oshu::max_loops; ++i) {
+		if (!audio->loop_taken[i]) {
+			audio->loop_taken[i] = true;
+			push_command(audio, oshu::sound_command::PLAY_LOOP, sample, volume, oshu::LOOPING_VOICE, 0, i);
+			return i;
+		}
+	}
+	oshu_log_debug("too many looping samples, dropping one");
+	return -1;
+}
+
+void oshu::stop_loop(oshu::audio *audio, int loop)
+{
+	if (loop < 0 || loop >= oshu::max_loops || !audio->loop_taken[loop])
+		return;
+	audio->loop_taken[loop] = false;
+	push_command(audio, oshu::sound_command::STOP_LOOP, NULL, 0, oshu::LOOPING_VOICE, 0, loop);
 }
 
-void oshu::stop_loop(oshu::audio *audio)
+/**
+ * Send a command to the decoder thread, and wait until it's done.
+ */
+static int send_command(oshu::audio *audio, oshu::audio_command *command)
 {
-	SDL_LockAudioDevice(audio->device_id);
-	oshu::stop_track(&audio->looping);
-	SDL_UnlockAudioDevice(audio->device_id);
+	std::unique_lock<std::mutex> lock(audio->command_mutex);
+	audio->commands.push_back(command);
+	audio->command_signal.notify_all();
+	audio->command_signal.wait(lock, [&] { return command->done; });
+	return command->result;
 }
 
 int oshu::seek_music(oshu::audio *audio, double target)
 {
-	SDL_LockAudioDevice(audio->device_id);
-	int rc = oshu::seek_stream(&audio->music, target);
-	oshu::stop_track(&audio->looping);
-	int tracks = sizeof(audio->effects) / sizeof(*audio->effects);
-	for (int i = 0; i < tracks; ++i)
-		oshu::stop_track(&audio->effects[i]);
-	SDL_UnlockAudioDevice(audio->device_id);
-	return rc;
+	oshu::audio_command command {target, audio->rate, audio->keep_pitch, 0, false};
+	return send_command(audio, &command);
+}
+
+int oshu::set_music_rate(oshu::audio *audio, double rate, bool keep_pitch)
+{
+	oshu::audio_command command {oshu::music_position(audio), rate, keep_pitch, 0, false};
+	if (send_command(audio, &command) < 0)
+		return -1;
+	audio->rate = rate;
+	audio->keep_pitch = keep_pitch;
+	return 0;
+}
+
+double oshu::music_position(oshu::audio *audio)
+{
+	unsigned sequence;
+	size_t position;
+	double timestamp, rate;
+	do {
+		sequence = audio->seek_sequence.load();
+		position = audio->seek_position.load();
+		timestamp = audio->seek_timestamp.load();
+		rate = audio->seek_rate.load();
+	} while (sequence % 2 || audio->seek_sequence.load() != sequence);
+	size_t tail = audio->ring.tail.load();
+	if (tail <= position)
+		return timestamp;
+	return timestamp + (double) (tail - position) / audio->music.sample_rate * rate;
+}
+
+double oshu::precise_music_position(oshu::audio *audio, Uint64 counter)
+{
+	unsigned sequence;
+	size_t position, tail;
+	double timestamp, speed;
+	Uint64 callback;
+	int samples;
+	do {
+		sequence = audio->seek_sequence.load();
+		position = audio->seek_position.load();
+		timestamp = audio->seek_timestamp.load();
+		speed = audio->seek_rate.load();
+	} while (sequence % 2 || audio->seek_sequence.load() != sequence);
+	do {
+		sequence = audio->timing_sequence.load();
+		tail = audio->timing_tail.load();
+		callback = audio->timing_counter.load();
+		samples = audio->timing_samples.load();
+	} while (sequence % 2 || audio->timing_sequence.load() != sequence);
+	if (!callback || tail <= position)
+		return oshu::music_position(audio);
+	double rate = audio->music.sample_rate;
+	double elapsed = counter > callback ? (double) (counter - callback) / SDL_GetPerformanceFrequency() : 0;
+	return timestamp + ((tail - position) / rate + std::min(elapsed, samples / rate)) * speed;
 }
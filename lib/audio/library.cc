@@ -8,15 +8,25 @@
 #include "audio/library.h"
 #include "audio/audio.h"
 #include "audio/sample.h"
+#include "core/hash.h"
+#include "core/home.h"
 #include "core/log.h"
+#include "core/memory.h"
+#include "core/vfs.h"
 
+#include <algorithm>
 #include <assert.h>
+#include <atomic>
+#include <mutex>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <SDL2/SDL_timer.h>
 #include <sstream>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
 
 /**
  * Determine the directory of the skin to use.
@@ -53,128 +63,104 @@ void oshu::open_sound_library(oshu::sound_library *library, struct SDL_AudioSpec
 	library->format = format;
 }
 
-static void free_sample(oshu::sample **sample)
-{
-	if (*sample) {
-		oshu::destroy_sample(*sample);
-		free(*sample);
-		*sample = NULL;
-	}
-}
-
-static void free_shelf(oshu::sound_shelf *shelf)
-{
-	free_sample(&shelf->hit_normal);
-	free_sample(&shelf->hit_whistle);
-	free_sample(&shelf->hit_finish);
-	free_sample(&shelf->hit_clap);
-	free_sample(&shelf->slider_slide);
-	free_sample(&shelf->slider_whistle);
-}
-
-static void free_room(oshu::sound_room *room)
-{
-	if (room->shelves) {
-		for (int i = 0; i < room->size; ++i)
-			free_shelf(&room->shelves[i]);
-		free(room->shelves);
-		room->shelves = NULL;
-	}
-	free(room->indices);
-	room->indices = NULL;
-}
-
 void oshu::close_sound_library(oshu::sound_library *library)
 {
-	free_room(&library->normal);
-	free_room(&library->soft);
-	free_room(&library->drum);
+	library->table.clear();
+	library->count = 0;
+	library->samples.clear();
+	library->contents.clear();
+	library->offsets.clear();
+	oshu::track_release(oshu::AUDIO_MEMORY_CATEGORY, library->pcm.capacity() * sizeof(float));
+	library->pcm.clear();
+	library->pcm.shrink_to_fit();
 }
 
 /**
- * Find a shelf in a room, looking for its index.
+ * Pack the attributes of a sample into a hash table key.
  *
- * Return NULL if the shelf wasn't found.
+ * If the set or type is invalid, return 0.
  */
-static oshu::sound_shelf* find_shelf(oshu::sound_room *room, int index)
+static uint64_t make_key(enum oshu::sample_set_family set, int index, int type)
 {
-	for (int i = 0; i < room->size; ++i) {
-		if (room->indices[i] == index)
-			return &room->shelves[i];
+	switch (set) {
+	case oshu::NORMAL_SAMPLE_SET:
+	case oshu::SOFT_SAMPLE_SET:
+	case oshu::DRUM_SAMPLE_SET:
+		break;
+	default:
+		oshu_log_debug("unknown sample set %d", (int) set);
+		return 0;
 	}
-	return NULL;
+	switch (type) {
+	case oshu::HIT_SOUND|oshu::NORMAL_SOUND:
+	case oshu::HIT_SOUND|oshu::WHISTLE_SOUND:
+	case oshu::HIT_SOUND|oshu::FINISH_SOUND:
+	case oshu::HIT_SOUND|oshu::CLAP_SOUND:
+	case oshu::SLIDER_SOUND|oshu::NORMAL_SOUND:
+	case oshu::SLIDER_SOUND|oshu::WHISTLE_SOUND:
+		break;
+	default:
+		oshu_log_debug("unknown sample type %d", (int) type);
+		return 0;
+	}
+	return (uint64_t) set << 40 | (uint64_t) type << 32 | (uint32_t) index;
 }
 
 /**
- * Allocate the space for a new shelf.
- *
- * If the capacity of the room is already big enough, there's nothing much to
- * do. However, if it's too small, the room is expanded by steps of 8 shelves.
+ * Find the slot of a key in the hash table, which is either the slot holding
+ * that key, or the empty slot where it would be inserted.
  *
- * After calling this function, you are guaranteed that there is the capacity
- * for at least one new shelf (i.e. `room->size < room->capacity`).
+ * The table must not be empty.
  */
-static void grow_room(oshu::sound_room *room)
+static oshu::sound_slot *find_slot(oshu::sound_library *library, uint64_t key)
 {
-	assert (room->size <= room->capacity);
-	if (room->size < room->capacity)
-		return;
-	room->capacity += 8;
-	room->shelves = (oshu::sound_shelf*) realloc(room->shelves, room->capacity * sizeof(*room->shelves));
-	assert (room->shelves != NULL);
-	room->indices = (int*) realloc(room->indices, room->capacity * sizeof(*room->indices));
-	assert (room->indices != NULL);
+	size_t mask = library->table.size() - 1;
+	size_t i = (key * 0x9E3779B97F4A7C15ULL) >> 32 & mask;
+	while (library->table[i].key && library->table[i].key != key)
+		i = (i + 1) & mask;
+	return &library->table[i];
 }
 
 /**
- * Add a shelf in a room with a specific index.
- *
- * Return the pointer to the new shelf.
+ * Make sure the hash table has room for one more key, doubling its size when
+ * it would become more than half full.
  */
-static oshu::sound_shelf* new_shelf(oshu::sound_room *room, int index)
+static void grow_table(oshu::sound_library *library)
 {
-	grow_room(room);
-	int position = room->size++;
-	room->indices[position] = index;
-	memset(&room->shelves[position], 0, sizeof(*room->shelves));
-	return &room->shelves[position];
+	if ((library->count + 1) * 2 <= library->table.size())
+		return;
+	std::vector<oshu::sound_slot> old = std::move(library->table);
+	library->table.assign(old.empty() ? 64 : old.size() * 2, oshu::sound_slot {});
+	for (oshu::sound_slot &slot : old) {
+		if (slot.key)
+			*find_slot(library, slot.key) = slot;
+	}
 }
 
 /**
- * Get the room for a specified sample set.
+ * Append PCM data to the library's buffer, and return the new sample object.
  *
- * If the room wasnn't found, return NULL.
+ * The sample doesn't point to the buffer until #rebase_samples is called,
+ * because the buffer may move when it grows.
  */
-static oshu::sound_room* get_room(oshu::sound_library *library, enum oshu::sample_set_family set)
+static oshu::sample *store_sample(oshu::sound_library *library, const std::vector<float> &pcm)
 {
-	switch (set) {
-	case oshu::NORMAL_SAMPLE_SET: return &library->normal;
-	case oshu::SOFT_SAMPLE_SET:   return &library->soft;
-	case oshu::DRUM_SAMPLE_SET:   return &library->drum;
-	default:
-		oshu_log_debug("unknown sample set %d", (int) set);
-		return NULL;
-	}
+	library->offsets.push_back(library->pcm.size());
+	library->pcm.insert(library->pcm.end(), pcm.begin(), pcm.end());
+	library->samples.push_back(oshu::sample {});
+	oshu::sample *sample = &library->samples.back();
+	sample->size = pcm.size() * sizeof(float);
+	sample->nb_samples = pcm.size() / 2;
+	return sample;
 }
 
 /**
- * Locate the sample on a shelf given its type.
- *
- * If the sample wasnn't found because its type doesn't exist, return NULL.
+ * Point every sample to its data, after the PCM buffer has grown.
  */
-static oshu::sample** get_sample(oshu::sound_shelf *shelf, int type)
+static void rebase_samples(oshu::sound_library *library)
 {
-	switch (type) {
-	case oshu::HIT_SOUND|oshu::NORMAL_SOUND:  return &shelf->hit_normal;
-	case oshu::HIT_SOUND|oshu::WHISTLE_SOUND: return &shelf->hit_whistle;
-	case oshu::HIT_SOUND|oshu::FINISH_SOUND:  return &shelf->hit_finish;
-	case oshu::HIT_SOUND|oshu::CLAP_SOUND:    return &shelf->hit_clap;
-	case oshu::SLIDER_SOUND|oshu::NORMAL_SOUND:  return &shelf->slider_slide;
-	case oshu::SLIDER_SOUND|oshu::WHISTLE_SOUND: return &shelf->slider_whistle;
-	default:
-		oshu_log_debug("unknown sample type %d", (int) type);
-		return NULL;
-	}
+	for (size_t i = 0; i < library->samples.size(); ++i)
+		library->samples[i].samples = library->pcm.data() + library->offsets[i];
 }
 
 /**
@@ -235,8 +221,10 @@ static std::string locate_sample(oshu::sound_library *library, enum oshu::sample
 	if (filename.empty())
 		return {};
 	if (index > 0) {
-		/* Check the current directory. */
-		if (access(filename.c_str(), R_OK) == 0)
+		/* Check the beatmap's directory, or the entered archive. */
+		if (!library->beatmap_directory.empty())
+			filename = library->beatmap_directory + "/" + filename;
+		if (oshu::file_exists(filename.c_str()))
 			return filename;
 	} else {
 		/* Check the installation's data directory. */
@@ -247,71 +235,283 @@ static std::string locate_sample(oshu::sound_library *library, enum oshu::sample
 	return {};
 }
 
-int oshu::register_sample(oshu::sound_library *library, enum oshu::sample_set_family set, int index, int type)
+/**
+ * The converted samples, shared by all the libraries of the process, so that
+ * identical files are decoded only once, whether they come from the skin or
+ * from the beatmaps, and under whatever name.
+ *
+ * The keys are the content hash of the sample file, followed by the sample
+ * rate it was converted to.
+ */
+static std::unordered_map<std::string, std::vector<float>> converted;
+static std::mutex converted_mutex;
+
+/**
+ * Add a sample to #converted, with #converted_mutex held.
+ *
+ * The cache is never emptied, so its samples are accounted in the audio memory
+ * until the process exits.
+ */
+static void remember_converted(const std::string &key, const std::vector<float> &pcm)
 {
-	oshu::sound_room *room = get_room(library, set);
-	if (!room)
-		return -1;
-	oshu::sound_shelf *shelf = find_shelf(room, index);
-	if (!shelf)
-		shelf = new_shelf(room, index);
-	if (!shelf)
+	if (converted.emplace(key, pcm).second)
+		oshu::track_allocation(oshu::AUDIO_MEMORY_CATEGORY, pcm.size() * sizeof(float));
+}
+
+/**
+ * Return the path of the converted sample in the disk cache, or an empty
+ * string when the cache is unavailable.
+ *
+ * Like the in-memory cache, it is keyed by the content hash and the sample
+ * rate, since the same skin is converted again for every device rate.
+ */
+static std::string converted_path(uint64_t hash, int sample_rate)
+{
+	std::string directory;
+	try {
+		directory = oshu::get_cache_directory("samples");
+	} catch (std::exception &e) {
+		oshu_log_debug("sample cache unavailable: %s", e.what());
+		return "";
+	}
+	char name[48];
+	snprintf(name, sizeof(name), "/%016llx@%d.pcm", (unsigned long long) hash, sample_rate);
+	return directory + name;
+}
+
+/**
+ * Read a converted sample from the disk cache, as raw packed floats.
+ */
+static int read_converted(const std::string &path, std::vector<float> *pcm)
+{
+	FILE *file = fopen(path.c_str(), "rb");
+	if (!file)
 		return -1;
-	oshu::sample **sample = get_sample(shelf, type);
-	if (!sample)
+	int rc = -1;
+	if (fseek(file, 0, SEEK_END) == 0) {
+		long size = ftell(file);
+		if (size >= 0 && size % (2 * sizeof(float)) == 0 && fseek(file, 0, SEEK_SET) == 0) {
+			pcm->resize(size / sizeof(float));
+			if (fread(pcm->data(), sizeof(float), pcm->size(), file) == pcm->size())
+				rc = 0;
+		}
+	}
+	fclose(file);
+	if (rc < 0)
+		oshu_log_debug("ignoring the invalid cached sample %s", path.c_str());
+	return rc;
+}
+
+/**
+ * Save a converted sample in the disk cache, through a temporary file so that
+ * nobody reads a partial sample.
+ */
+static void write_converted(const std::string &path, const std::vector<float> &pcm)
+{
+	std::ostringstream tmp;
+	tmp << path << ".tmp" << getpid() << '-' << std::this_thread::get_id();
+	FILE *file = fopen(tmp.str().c_str(), "wb");
+	if (!file)
+		return;
+	bool written = fwrite(pcm.data(), sizeof(float), pcm.size(), file) == pcm.size();
+	if (fclose(file) != 0 || !written || rename(tmp.str().c_str(), path.c_str()) < 0)
+		unlink(tmp.str().c_str());
+}
+
+/**
+ * Load a sample file, converted for the library's format, as packed stereo
+ * floats, through the #converted cache, and then through the disk cache.
+ *
+ * The content hash of the file is written to *hash*, or 0 if the file
+ * couldn't be read.
+ *
+ * A sample that fails to load is left empty. This function may be called
+ * from several threads at once.
+ */
+static void load_pcm(oshu::sound_library *library, const std::string &path, uint64_t *hash, std::vector<float> *pcm)
+{
+	assert (library->format != NULL);
+	std::string key;
+	if (oshu::hash_file(path.c_str(), hash) == 0) {
+		key = std::to_string(*hash) + '@' + std::to_string(library->format->freq);
+		std::lock_guard<std::mutex> lock(converted_mutex);
+		auto cached = converted.find(key);
+		if (cached != converted.end()) {
+			*pcm = cached->second;
+			return;
+		}
+	} else {
+		*hash = 0;
+	}
+	std::string disk_path = key.empty() ? "" : converted_path(*hash, library->format->freq);
+	if (!disk_path.empty() && read_converted(disk_path, pcm) == 0) {
+		std::lock_guard<std::mutex> lock(converted_mutex);
+		remember_converted(key, *pcm);
+		return;
+	}
+	oshu_log_debug("loading %s", path.c_str());
+	oshu::sample loaded {};
+	if (oshu::load_sample(path.c_str(), library->format, &loaded) < 0) {
+		oshu_log_debug("continuing the process with an empty sample");
+		pcm->clear();
+	} else {
+		pcm->assign(loaded.samples, loaded.samples + loaded.nb_samples * 2);
+		oshu::destroy_sample(&loaded);
+		if (!disk_path.empty())
+			write_converted(disk_path, *pcm);
+	}
+	if (!key.empty()) {
+		std::lock_guard<std::mutex> lock(converted_mutex);
+		remember_converted(key, *pcm);
+	}
+}
+
+/**
+ * A sample file to load into the library.
+ */
+struct pending_sample {
+	uint64_t key;
+	std::string path;
+	/**
+	 * Content hash of the file, set by #load_pcm.
+	 */
+	uint64_t hash;
+	std::vector<float> pcm;
+};
+
+/**
+ * Reserve a slot for a sample in the library, and locate its file.
+ *
+ * If the sample wasn't registered yet and its file was found, push it to
+ * *pending* for loading.
+ *
+ * Return 0 if the sample is, or will be, available, -1 otherwise.
+ */
+static int request_sample(oshu::sound_library *library, enum oshu::sample_set_family set, int index, int type, std::vector<pending_sample> *pending)
+{
+	uint64_t key = make_key(set, index, type);
+	if (!key)
 		return -1;
-	if (*sample) /* already loaded */
-		return 0;
+	grow_table(library);
+	oshu::sound_slot *slot = find_slot(library, key);
+	if (slot->key) /* already registered */
+		return slot->sample ? 0 : -1;
+	slot->key = key;
+	slot->sample = NULL;
+	++library->count;
 	std::string path = locate_sample(library, set, index, type);
 	if (path.empty())
 		return -1;
 	oshu_log_debug("registering %s", path.c_str());
-	*sample = (oshu::sample*) calloc(1, sizeof(**sample));
-	assert (*sample != NULL);
-	assert (library->format != NULL);
-	int rc = oshu::load_sample(path.c_str(), library->format, *sample);
-	if (rc < 0)
-		oshu_log_debug("continuing the process with an empty sample");
+	pending->push_back({key, path, 0, {}});
 	return 0;
 }
 
-void oshu::register_sound(oshu::sound_library *library, oshu::hit_sound *sound)
+/**
+ * Load the pending samples in parallel, and store them in the library.
+ *
+ * Loading a sample means decoding a WAV file and resampling it, which is
+ * independent for every sample. Files with the same content are stored once.
+ */
+static void load_pending(oshu::sound_library *library, std::vector<pending_sample> &pending)
+{
+	if (pending.empty())
+		return;
+	std::atomic<size_t> next {0};
+	auto work = [&] {
+		for (size_t i; (i = next++) < pending.size();)
+			load_pcm(library, pending[i].path, &pending[i].hash, &pending[i].pcm);
+	};
+	size_t workers = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), pending.size());
+	std::vector<std::thread> threads;
+	for (size_t i = 1; i < workers; ++i) {
+		try {
+			threads.emplace_back(work);
+		} catch (std::system_error &e) {
+			oshu_log_debug("could not start a sample loading thread: %s", e.what());
+			break;
+		}
+	}
+	work();
+	for (std::thread &t : threads)
+		t.join();
+
+	size_t total = library->pcm.size();
+	for (pending_sample &p : pending)
+		total += p.pcm.size();
+	size_t capacity = library->pcm.capacity();
+	library->pcm.reserve(total);
+	oshu::track_resize(oshu::AUDIO_MEMORY_CATEGORY, capacity * sizeof(float), library->pcm.capacity() * sizeof(float));
+	for (pending_sample &p : pending) {
+		auto known = p.hash ? library->contents.find(p.hash) : library->contents.end();
+		oshu::sample *sample;
+		if (known != library->contents.end()) {
+			sample = known->second;
+		} else {
+			sample = store_sample(library, p.pcm);
+			if (p.hash)
+				library->contents.emplace(p.hash, sample);
+		}
+		find_slot(library, p.key)->sample = sample;
+	}
+	rebase_samples(library);
+	pending.clear();
+}
+
+int oshu::register_sample(oshu::sound_library *library, enum oshu::sample_set_family set, int index, int type)
+{
+	std::vector<pending_sample> pending;
+	int rc = request_sample(library, set, index, type, &pending);
+	load_pending(library, pending);
+	return rc;
+}
+
+static void request_sound(oshu::sound_library *library, oshu::hit_sound *sound, std::vector<pending_sample> *pending)
 {
 	int target = sound->additions & oshu::SOUND_TARGET;
 	if (sound->additions & oshu::NORMAL_SOUND)
-		oshu::register_sample(library, sound->sample_set, sound->index, target | oshu::NORMAL_SOUND);
+		request_sample(library, sound->sample_set, sound->index, target | oshu::NORMAL_SOUND, pending);
 	if (sound->additions & oshu::WHISTLE_SOUND)
-		oshu::register_sample(library, sound->additions_set, sound->index, target | oshu::WHISTLE_SOUND);
+		request_sample(library, sound->additions_set, sound->index, target | oshu::WHISTLE_SOUND, pending);
 	if (sound->additions & oshu::FINISH_SOUND)
-		oshu::register_sample(library, sound->additions_set, sound->index, target | oshu::FINISH_SOUND);
+		request_sample(library, sound->additions_set, sound->index, target | oshu::FINISH_SOUND, pending);
 	if (sound->additions & oshu::CLAP_SOUND)
-		oshu::register_sample(library, sound->additions_set, sound->index, target | oshu::CLAP_SOUND);
+		request_sample(library, sound->additions_set, sound->index, target | oshu::CLAP_SOUND, pending);
+}
+
+void oshu::register_sound(oshu::sound_library *library, oshu::hit_sound *sound)
+{
+	std::vector<pending_sample> pending;
+	request_sound(library, sound, &pending);
+	load_pending(library, pending);
 }
 
-static void populate_default(oshu::sound_library *library, enum oshu::sample_set_family set)
+static void populate_default(oshu::sound_library *library, enum oshu::sample_set_family set, std::vector<pending_sample> *pending)
 {
-	oshu::register_sample(library, set, oshu::DEFAULT_SHELF, oshu::HIT_SOUND|oshu::NORMAL_SOUND);
-	oshu::register_sample(library, set, oshu::DEFAULT_SHELF, oshu::HIT_SOUND|oshu::WHISTLE_SOUND);
-	oshu::register_sample(library, set, oshu::DEFAULT_SHELF, oshu::HIT_SOUND|oshu::FINISH_SOUND);
-	oshu::register_sample(library, set, oshu::DEFAULT_SHELF, oshu::HIT_SOUND|oshu::CLAP_SOUND);
-	oshu::register_sample(library, set, oshu::DEFAULT_SHELF, oshu::SLIDER_SOUND|oshu::NORMAL_SOUND);
-	oshu::register_sample(library, set, oshu::DEFAULT_SHELF, oshu::SLIDER_SOUND|oshu::WHISTLE_SOUND);
+	request_sample(library, set, oshu::DEFAULT_SHELF, oshu::HIT_SOUND|oshu::NORMAL_SOUND, pending);
+	request_sample(library, set, oshu::DEFAULT_SHELF, oshu::HIT_SOUND|oshu::WHISTLE_SOUND, pending);
+	request_sample(library, set, oshu::DEFAULT_SHELF, oshu::HIT_SOUND|oshu::FINISH_SOUND, pending);
+	request_sample(library, set, oshu::DEFAULT_SHELF, oshu::HIT_SOUND|oshu::CLAP_SOUND, pending);
+	request_sample(library, set, oshu::DEFAULT_SHELF, oshu::SLIDER_SOUND|oshu::NORMAL_SOUND, pending);
+	request_sample(library, set, oshu::DEFAULT_SHELF, oshu::SLIDER_SOUND|oshu::WHISTLE_SOUND, pending);
 }
 
 void oshu::populate_library(oshu::sound_library *library, oshu::beatmap *beatmap)
 {
 	int start = SDL_GetTicks();
 	oshu_log_debug("loading the sample library");
-	populate_default(library, oshu::NORMAL_SAMPLE_SET);
-	populate_default(library, oshu::SOFT_SAMPLE_SET);
-	populate_default(library, oshu::DRUM_SAMPLE_SET);
+	std::vector<pending_sample> pending;
+	populate_default(library, oshu::NORMAL_SAMPLE_SET, &pending);
+	populate_default(library, oshu::SOFT_SAMPLE_SET, &pending);
+	populate_default(library, oshu::DRUM_SAMPLE_SET, &pending);
 	for (oshu::hit *hit = beatmap->hits; hit; hit = hit->next) {
 		if (hit->type & oshu::SLIDER_HIT) {
 			for (int i = 0; i <= hit->slider.repeat; ++i)
-				oshu::register_sound(library, &hit->slider.sounds[i]);
+				request_sound(library, &hit->slider.sounds[i], &pending);
 		}
-		oshu::register_sound(library, &hit->sound);
+		request_sound(library, &hit->sound, &pending);
 	}
+	load_pending(library, pending);
 	int end = SDL_GetTicks();
 	oshu_log_debug("done loading the library in %.3f seconds", (end - start) / 1000.);
 }
@@ -324,47 +524,88 @@ void oshu::populate_library(oshu::sound_library *library, oshu::beatmap *beatmap
  *
  * \sa oshu::play_sound
  */
-oshu::sample* find_sample(oshu::sound_library *library, enum oshu::sample_set_family set, int index, int type)
+static oshu::sample* find_sample(oshu::sound_library *library, enum oshu::sample_set_family set, int index, int type)
 {
-	oshu::sample **sample {nullptr};
-	oshu::sound_room *room = get_room(library, set);
-	if (!room)
+	if (library->table.empty())
 		return NULL;
-	oshu::sound_shelf *shelf = find_shelf(room, index);
-	if (!shelf)
-		goto round2;
-	sample = get_sample(shelf, type);
-	if (sample && *sample)
-		return *sample;
-round2:
-	shelf = find_shelf(room, oshu::DEFAULT_SHELF);
-	if (!shelf)
+	uint64_t key = make_key(set, index, type);
+	if (!key)
 		return NULL;
-	sample = get_sample(shelf, type);
-	if (!sample)
+	oshu::sound_slot *slot = find_slot(library, key);
+	if (slot->sample)
+		return slot->sample;
+	slot = find_slot(library, make_key(set, oshu::DEFAULT_SHELF, type));
+	return slot->sample;
+}
+
+/**
+ * Find the sample for one of the additions of a hit sound.
+ *
+ * Return null if the sound doesn't have that addition, or if the sample is
+ * missing.
+ */
+static oshu::sample *find_addition(oshu::sound_library *library, oshu::hit_sound *sound, enum oshu::sound_type flag)
+{
+	if (!(sound->additions & flag))
 		return NULL;
-	return *sample;
+	int target = sound->additions & oshu::SOUND_TARGET;
+	oshu::sample_set_family set = (flag == oshu::NORMAL_SOUND) ? sound->sample_set : sound->additions_set;
+	return find_sample(library, set, sound->index, target | flag);
+}
+
+/**
+ * Finishes are rare and long, and cutting them is very noticeable, so they're
+ * protected from the other hit sounds.
+ */
+static oshu::voice_priority voice_priority(enum oshu::sound_type flag)
+{
+	return flag == oshu::FINISH_SOUND ? oshu::PROTECTED_VOICE : oshu::NORMAL_VOICE;
 }
 
-static void try_sound(oshu::sound_library *library, oshu::hit_sound *sound, oshu::audio *audio, enum oshu::sound_type flag)
+static void try_sound(oshu::sound_library *library, oshu::hit_sound *sound, oshu::audio *audio, enum oshu::sound_type flag, oshu::sound_loops *loops)
 {
-	if (sound->additions & flag) {
-		int target = sound->additions & oshu::SOUND_TARGET;
-		oshu::sample_set_family set = (flag == oshu::NORMAL_SOUND) ? sound->sample_set : sound->additions_set;
-		oshu::sample *sample = find_sample(library, set, sound->index, target | flag);
-		if (!sample)
-			return;
-		else if (sound->additions & oshu::SLIDER_SOUND)
-			oshu::play_loop(audio, sample, sound->volume);
-		else
-			oshu::play_sample(audio, sample, sound->volume);
+	oshu::sample *sample = find_addition(library, sound, flag);
+	if (!sample)
+		return;
+	if (!(sound->additions & oshu::SLIDER_SOUND)) {
+		oshu::play_sample(audio, sample, sound->volume, voice_priority(flag));
+	} else if (loops) {
+		int handle = oshu::play_loop(audio, sample, sound->volume);
+		if (handle >= 0)
+			loops->handles[loops->count++] = handle;
 	}
 }
 
-void oshu::play_sound(oshu::sound_library *library, oshu::hit_sound *sound, oshu::audio *audio)
+void oshu::play_sound(oshu::sound_library *library, oshu::hit_sound *sound, oshu::audio *audio, oshu::sound_loops *loops)
+{
+	if (loops)
+		oshu::stop_sound(audio, loops);
+	try_sound(library, sound, audio, oshu::NORMAL_SOUND, loops);
+	try_sound(library, sound, audio, oshu::WHISTLE_SOUND, loops);
+	try_sound(library, sound, audio, oshu::FINISH_SOUND, loops);
+	try_sound(library, sound, audio, oshu::CLAP_SOUND, loops);
+}
+
+void oshu::stop_sound(oshu::audio *audio, oshu::sound_loops *loops)
+{
+	for (int i = 0; i < loops->count; ++i)
+		oshu::stop_loop(audio, loops->handles[i]);
+	loops->count = 0;
+}
+
+static void try_schedule(oshu::sound_library *library, oshu::hit_sound *sound, oshu::audio *audio, enum oshu::sound_type flag, double timestamp)
 {
-	try_sound(library, sound, audio, oshu::NORMAL_SOUND);
-	try_sound(library, sound, audio, oshu::WHISTLE_SOUND);
-	try_sound(library, sound, audio, oshu::FINISH_SOUND);
-	try_sound(library, sound, audio, oshu::CLAP_SOUND);
+	oshu::sample *sample = find_addition(library, sound, flag);
+	if (sample)
+		oshu::schedule_sample(audio, sample, sound->volume, timestamp, voice_priority(flag));
+}
+
+void oshu::schedule_sound(oshu::sound_library *library, oshu::hit_sound *sound, oshu::audio *audio, double timestamp)
+{
+	if (sound->additions & oshu::SLIDER_SOUND)
+		return;
+	try_schedule(library, sound, audio, oshu::NORMAL_SOUND, timestamp);
+	try_schedule(library, sound, audio, oshu::WHISTLE_SOUND, timestamp);
+	try_schedule(library, sound, audio, oshu::FINISH_SOUND, timestamp);
+	try_schedule(library, sound, audio, oshu::CLAP_SOUND, timestamp);
 }
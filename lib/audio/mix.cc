@@ -0,0 +1,162 @@
+/**
+ * \file audio/mix.cc
+ * \ingroup audio_mix
+ */
+
+#include "audio/mix.h"
+
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define OSHU_MIX_X86
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define OSHU_MIX_NEON
+#endif
+
+static void mix_scalar(float *output, const float *input, float volume, int count)
+{
+	for (int i = 0; i < count; ++i)
+		output[i] = fmaf(input[i], volume, output[i]);
+}
+
+static void clip_scalar(float *samples, int count)
+{
+	for (int i = 0; i < count; ++i) {
+		if (samples[i] > 1.)
+			samples[i] = 1.;
+		else if (samples[i] < -1.)
+			samples[i] = -1.;
+	}
+}
+
+#ifdef OSHU_MIX_X86
+
+__attribute__((target("sse2")))
+static void mix_sse2(float *output, const float *input, float volume, int count)
+{
+	__m128 v = _mm_set1_ps(volume);
+	int i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 x = _mm_loadu_ps(input + i);
+		__m128 y = _mm_loadu_ps(output + i);
+		_mm_storeu_ps(output + i, _mm_add_ps(y, _mm_mul_ps(x, v)));
+	}
+	mix_scalar(output + i, input + i, volume, count - i);
+}
+
+__attribute__((target("sse2")))
+static void clip_sse2(float *samples, int count)
+{
+	__m128 low = _mm_set1_ps(-1.f);
+	__m128 high = _mm_set1_ps(1.f);
+	int i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 x = _mm_loadu_ps(samples + i);
+		_mm_storeu_ps(samples + i, _mm_min_ps(_mm_max_ps(x, low), high));
+	}
+	clip_scalar(samples + i, count - i);
+}
+
+__attribute__((target("avx2,fma")))
+static void mix_avx2(float *output, const float *input, float volume, int count)
+{
+	__m256 v = _mm256_set1_ps(volume);
+	int i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256 x = _mm256_loadu_ps(input + i);
+		__m256 y = _mm256_loadu_ps(output + i);
+		_mm256_storeu_ps(output + i, _mm256_fmadd_ps(x, v, y));
+	}
+	mix_scalar(output + i, input + i, volume, count - i);
+}
+
+__attribute__((target("avx2")))
+static void clip_avx2(float *samples, int count)
+{
+	__m256 low = _mm256_set1_ps(-1.f);
+	__m256 high = _mm256_set1_ps(1.f);
+	int i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256 x = _mm256_loadu_ps(samples + i);
+		_mm256_storeu_ps(samples + i, _mm256_min_ps(_mm256_max_ps(x, low), high));
+	}
+	clip_scalar(samples + i, count - i);
+}
+
+#endif
+
+#ifdef OSHU_MIX_NEON
+
+static void mix_neon(float *output, const float *input, float volume, int count)
+{
+	int i = 0;
+	for (; i + 4 <= count; i += 4) {
+		float32x4_t x = vld1q_f32(input + i);
+		float32x4_t y = vld1q_f32(output + i);
+		vst1q_f32(output + i, vmlaq_n_f32(y, x, volume));
+	}
+	mix_scalar(output + i, input + i, volume, count - i);
+}
+
+static void clip_neon(float *samples, int count)
+{
+	float32x4_t low = vdupq_n_f32(-1.f);
+	float32x4_t high = vdupq_n_f32(1.f);
+	int i = 0;
+	for (; i + 4 <= count; i += 4) {
+		float32x4_t x = vld1q_f32(samples + i);
+		vst1q_f32(samples + i, vminq_f32(vmaxq_f32(x, low), high));
+	}
+	clip_scalar(samples + i, count - i);
+}
+
+#endif
+
+/**
+ * A set of kernels for one instruction set.
+ */
+struct kernels {
+	const char *name;
+	void (*mix)(float *output, const float *input, float volume, int count);
+	void (*clip)(float *samples, int count);
+};
+
+/**
+ * Pick the best kernels for the running CPU.
+ */
+static kernels select_kernels()
+{
+#if defined(OSHU_MIX_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return {"avx2", mix_avx2, clip_avx2};
+	if (__builtin_cpu_supports("sse2"))
+		return {"sse2", mix_sse2, clip_sse2};
+#elif defined(OSHU_MIX_NEON)
+	return {"neon", mix_neon, clip_neon};
+#endif
+	return {"scalar", mix_scalar, clip_scalar};
+}
+
+/**
+ * The kernels in use, selected before main so that the audio callback never
+ * pays for the selection.
+ */
+static const kernels active = select_kernels();
+
+void oshu::mix_samples(float *output, const float *input, float volume, int count)
+{
+	active.mix(output, input, volume, count);
+}
+
+void oshu::clip_samples(float *samples, int count)
+{
+	active.clip(samples, count);
+}
+
+const char *oshu::mix_kernels()
+{
+	return active.name;
+}
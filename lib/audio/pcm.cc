@@ -0,0 +1,208 @@
+/**
+ * \file audio/pcm.cc
+ * \ingroup audio_pcm
+ */
+
+#include "audio/pcm.h"
+
+#include "audio/stream.h"
+#include "core/hash.h"
+#include "core/home.h"
+#include "core/log.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/** Work in stereo. */
+static const int channels = 2;
+
+/**
+ * Number of samples per channel decoded at once when building the cache.
+ */
+static const int build_chunk_size = 4096;
+
+/**
+ * Header of the PCM cache files, followed by the samples.
+ *
+ * Its size is a multiple of the sample size, so that the samples are aligned
+ * in the mapping.
+ */
+struct pcm_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t sample_rate;
+	uint32_t channels;
+	uint32_t reserved;
+	uint64_t nb_samples;
+};
+
+static const char pcm_magic[8] = {'o', 's', 'h', 'u', 'p', 'c', 'm', '\0'};
+static const uint32_t pcm_version = 1;
+
+size_t oshu::pcm_cache_limit()
+{
+	const char *value = getenv("OSHU_PCM_CACHE");
+	if (!value || !*value)
+		return 0;
+	char *end;
+	long mebibytes = strtol(value, &end, 10);
+	if (*end || mebibytes < 0) {
+		oshu_log_warning("invalid OSHU_PCM_CACHE value: %s", value);
+		oshu_log_warning("it must be the maximum size of the decoded audio in MiB");
+		return 0;
+	}
+	return (size_t) mebibytes << 20;
+}
+
+std::string oshu::pcm_cache_path(const char *url, int sample_rate)
+{
+	uint64_t key;
+	struct stat s;
+	if (stat(url, &s) < 0 || !S_ISREG(s.st_mode))
+		return "";
+	if (oshu::hash_file(url, &key) < 0)
+		return "";
+	std::string directory;
+	try {
+		directory = oshu::get_cache_directory("pcm");
+	} catch (std::exception &e) {
+		oshu_log_debug("PCM cache unavailable: %s", e.what());
+		return "";
+	}
+	char name[48];
+	snprintf(name, sizeof(name), "/%016llx-%d.pcm", (unsigned long long) key, sample_rate);
+	return directory + name;
+}
+
+int oshu::open_pcm_cache(const char *path, int sample_rate, oshu::pcm_cache *pcm)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	struct stat s;
+	if (fstat(fd, &s) < 0 || (size_t) s.st_size < sizeof(pcm_header)) {
+		close(fd);
+		return -1;
+	}
+	void *mapping = mmap(nullptr, s.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED) {
+		oshu_log_debug("could not map %s: %s", path, strerror(errno));
+		return -1;
+	}
+	pcm_header header;
+	memcpy(&header, mapping, sizeof(header));
+	size_t body = s.st_size - sizeof(header);
+	if (memcmp(header.magic, pcm_magic, sizeof(pcm_magic)) || header.version != pcm_version
+	    || header.channels != channels || header.sample_rate != (uint32_t) sample_rate
+	    || header.nb_samples != body / (channels * sizeof(float))
+	    || body % (channels * sizeof(float))) {
+		oshu_log_debug("ignoring the invalid PCM cache %s", path);
+		munmap(mapping, s.st_size);
+		return -1;
+	}
+	pcm->mapping = mapping;
+	pcm->mapping_size = s.st_size;
+	pcm->samples = (const float*) ((char*) mapping + sizeof(header));
+	pcm->nb_samples = header.nb_samples;
+	pcm->sample_rate = sample_rate;
+	madvise(mapping, s.st_size, MADV_WILLNEED);
+	oshu_log_debug("mapped the PCM cache %s (%zu samples)", path, pcm->nb_samples);
+	return 0;
+}
+
+/**
+ * Write a whole buffer to a file descriptor.
+ */
+static int write_all(int fd, const void *data, size_t size)
+{
+	const char *p = (const char*) data;
+	while (size > 0) {
+		ssize_t rc = write(fd, p, size);
+		if (rc < 0 && errno == EINTR)
+			continue;
+		if (rc < 0)
+			return -1;
+		p += rc;
+		size -= rc;
+	}
+	return 0;
+}
+
+int oshu::build_pcm_cache(const char *url, const char *path, int sample_rate, size_t max_size, const std::atomic<bool> *cancel)
+{
+	oshu::stream stream {};
+	if (oshu::open_stream(url, &stream, sample_rate) < 0)
+		return -1;
+	size_t max_samples = max_size / (channels * sizeof(float));
+	if (stream.duration * stream.sample_rate > max_samples) {
+		oshu_log_debug("the decoded audio would be too big for the PCM cache");
+		oshu::close_stream(&stream);
+		return -1;
+	}
+
+	std::string tmp = std::string(path) + ".tmp" + std::to_string(getpid());
+	int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		oshu_log_debug("could not create %s: %s", tmp.c_str(), strerror(errno));
+		oshu::close_stream(&stream);
+		return -1;
+	}
+
+	pcm_header header {};
+	memcpy(header.magic, pcm_magic, sizeof(pcm_magic));
+	header.version = pcm_version;
+	header.sample_rate = stream.sample_rate;
+	header.channels = channels;
+	float chunk[build_chunk_size * channels];
+	int rc = write_all(fd, &header, sizeof(header));
+	while (rc == 0 && !stream.finished) {
+		if (cancel->load() || header.nb_samples > max_samples) {
+			rc = -1;
+			break;
+		}
+		int count = oshu::read_stream(&stream, chunk, build_chunk_size);
+		if (count < 0) {
+			rc = -1;
+			break;
+		}
+		rc = write_all(fd, chunk, count * channels * sizeof(float));
+		header.nb_samples += count;
+	}
+	oshu::close_stream(&stream);
+	if (rc == 0 && pwrite(fd, &header, sizeof(header), 0) != sizeof(header))
+		rc = -1;
+	close(fd);
+	if (rc == 0 && rename(tmp.c_str(), path) < 0)
+		rc = -1;
+	if (rc < 0) {
+		unlink(tmp.c_str());
+		return -1;
+	}
+	oshu_log_debug("saved the PCM cache %s (%llu samples)", path, (unsigned long long) header.nb_samples);
+	return 0;
+}
+
+size_t oshu::read_pcm_cache(oshu::pcm_cache *pcm, size_t position, float *samples, size_t nb_samples)
+{
+	if (position >= pcm->nb_samples)
+		return 0;
+	size_t count = std::min(nb_samples, pcm->nb_samples - position);
+	memcpy(samples, pcm->samples + position * channels, count * channels * sizeof(float));
+	return count;
+}
+
+void oshu::close_pcm_cache(oshu::pcm_cache *pcm)
+{
+	if (pcm->mapping)
+		munmap(pcm->mapping, pcm->mapping_size);
+	*pcm = {};
+}
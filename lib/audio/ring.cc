@@ -0,0 +1,95 @@
+/**
+ * \file audio/ring.cc
+ * \ingroup audio_ring
+ */
+
+#include "audio/ring.h"
+
+#include "core/log.h"
+#include "core/memory.h"
+
+#include <algorithm>
+#include <new>
+#include <string.h>
+
+/** Work in stereo. */
+static const int channels = 2;
+
+int oshu::open_ring(oshu::sample_ring *ring, size_t capacity)
+{
+	size_t size = 1;
+	while (size < capacity)
+		size <<= 1;
+	ring->buffer = new (std::nothrow) float[size * channels]();
+	if (!ring->buffer) {
+		oshu_log_error("could not allocate the audio ring buffer");
+		return -1;
+	}
+	oshu::track_allocation(oshu::AUDIO_MEMORY_CATEGORY, size * channels * sizeof(float));
+	ring->capacity = size;
+	ring->head = 0;
+	ring->tail = 0;
+	return 0;
+}
+
+/**
+ * Copy *nb_samples* between a linear buffer and the ring, starting at
+ * *position*, splitting the copy in two when it wraps around the end of the
+ * ring.
+ */
+static void copy_in(oshu::sample_ring *ring, size_t position, const float *samples, size_t nb_samples)
+{
+	size_t index = position & (ring->capacity - 1);
+	size_t first = std::min(nb_samples, ring->capacity - index);
+	memcpy(ring->buffer + index * channels, samples, first * channels * sizeof(float));
+	memcpy(ring->buffer, samples + first * channels, (nb_samples - first) * channels * sizeof(float));
+}
+
+static void copy_out(oshu::sample_ring *ring, size_t position, float *samples, size_t nb_samples)
+{
+	size_t index = position & (ring->capacity - 1);
+	size_t first = std::min(nb_samples, ring->capacity - index);
+	memcpy(samples, ring->buffer + index * channels, first * channels * sizeof(float));
+	memcpy(samples + first * channels, ring->buffer, (nb_samples - first) * channels * sizeof(float));
+}
+
+size_t oshu::write_ring(oshu::sample_ring *ring, const float *samples, size_t nb_samples)
+{
+	size_t head = ring->head.load(std::memory_order_relaxed);
+	size_t tail = ring->tail.load(std::memory_order_acquire);
+	size_t count = std::min(nb_samples, ring->capacity - (head - tail));
+	if (count > 0) {
+		copy_in(ring, head, samples, count);
+		ring->head.store(head + count, std::memory_order_release);
+	}
+	return count;
+}
+
+size_t oshu::read_ring(oshu::sample_ring *ring, float *samples, size_t nb_samples)
+{
+	size_t tail = ring->tail.load(std::memory_order_relaxed);
+	size_t head = ring->head.load(std::memory_order_acquire);
+	size_t count = std::min(nb_samples, head - tail);
+	if (count > 0) {
+		copy_out(ring, tail, samples, count);
+		ring->tail.store(tail + count, std::memory_order_release);
+	}
+	return count;
+}
+
+void oshu::skip_ring(oshu::sample_ring *ring, size_t position)
+{
+	size_t tail = ring->tail.load(std::memory_order_relaxed);
+	size_t head = ring->head.load(std::memory_order_acquire);
+	position = std::min(position, head);
+	if (position > tail)
+		ring->tail.store(position, std::memory_order_release);
+}
+
+void oshu::close_ring(oshu::sample_ring *ring)
+{
+	if (ring->buffer)
+		oshu::track_release(oshu::AUDIO_MEMORY_CATEGORY, ring->capacity * channels * sizeof(float));
+	delete[] ring->buffer;
+	ring->buffer = nullptr;
+}
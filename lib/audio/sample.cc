@@ -5,6 +5,8 @@
 
 #include "audio/sample.h"
 #include "core/log.h"
+#include "core/memory.h"
+#include "core/vfs.h"
 
 #include <SDL2/SDL.h>
 
@@ -44,6 +46,7 @@ static int convert_audio(SDL_AudioSpec *device_spec, SDL_AudioSpec *wav_spec, os
 		oshu_log_error("SDL audio conversion error while converting: %s", SDL_GetError());
 		return -1;
 	}
+	oshu::track_resize(oshu::AUDIO_MEMORY_CATEGORY, sample->size, converter.len_cvt);
 	sample->size = converter.len_cvt;
 	/* reclaim the unrequired memory */
 	sample->samples = (float*) realloc(sample->samples, sample->size);
@@ -55,12 +58,17 @@ int oshu::load_sample(const char *path, SDL_AudioSpec *spec, oshu::sample *sampl
 {
 	assert (spec->format == AUDIO_F32);
 	assert (spec->channels == channels);
+	oshu::file_view file;
+	if (oshu::open_file(path, &file) < 0)
+		return -1;
 	SDL_AudioSpec wav_spec;
-	SDL_AudioSpec *wav = SDL_LoadWAV(path, &wav_spec, (Uint8**) &sample->samples, &sample->size);
+	SDL_AudioSpec *wav = SDL_LoadWAV_RW(SDL_RWFromConstMem(file.data, file.size), 1, &wav_spec, (Uint8**) &sample->samples, &sample->size);
+	oshu::close_file(&file);
 	if (wav == NULL) {
 		oshu_log_debug("SDL error when loading the sample: %s", SDL_GetError());
 		goto fail;
 	}
+	oshu::track_allocation(oshu::AUDIO_MEMORY_CATEGORY, sample->size);
 	if (convert_audio(spec, wav, sample) < 0)
 		goto fail;
 	sample->nb_samples = sample->size / (channels * sizeof(*sample->samples));
@@ -73,6 +81,7 @@ fail:
 void oshu::destroy_sample(oshu::sample *sample)
 {
 	if (sample->samples) {
+		oshu::track_release(oshu::AUDIO_MEMORY_CATEGORY, sample->size);
 		SDL_FreeWAV((Uint8*) sample->samples);
 		sample->samples = NULL;
 	}
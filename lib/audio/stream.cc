@@ -4,7 +4,11 @@
  */
 
 #include "audio/stream.h"
+#include "core/hash.h"
+#include "core/home.h"
 #include "core/log.h"
+#include "core/trace.h"
+#include "core/vfs.h"
 
 extern "C" {
 #include <libavformat/avformat.h>
@@ -13,7 +17,13 @@ extern "C" {
 #include <libswresample/swresample.h>
 }
 
+#include <algorithm>
 #include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
 
 /** Work in stereo. */
 static const int channels = 2;
@@ -69,6 +79,46 @@ static int next_page(oshu::stream *stream)
 	return 0;
 }
 
+static bool resampling(oshu::stream *stream)
+{
+	return stream->sample_rate != stream->decoder->sample_rate;
+}
+
+/**
+ * Number of samples per channel #oshu::read_stream can take from the current
+ * frame, once converted.
+ */
+static int frame_length(oshu::stream *stream)
+{
+	return resampling(stream) ? stream->resampled.size() / channels : stream->frame->nb_samples;
+}
+
+/**
+ * Convert the whole #oshu::stream::frame into #oshu::stream::resampled.
+ *
+ * The output is sized for every sample the resampler may have, so that it
+ * never keeps input for later.
+ */
+static int resample_frame(oshu::stream *stream)
+{
+	AVFrame *frame = stream->frame;
+	int size = swr_get_out_samples(stream->converter, frame->nb_samples);
+	if (size < 0) {
+		log_av_error(size);
+		return -1;
+	}
+	stream->resampled.resize(size * channels);
+	uint8_t *output = (uint8_t*) stream->resampled.data();
+	int rc = swr_convert(stream->converter, &output, size, (const uint8_t**) frame->extended_data, frame->nb_samples);
+	if (rc < 0) {
+		oshu_log_error("audio resampling error");
+		log_av_error(rc);
+		return -1;
+	}
+	stream->resampled.resize(rc * channels);
+	return 0;
+}
+
 /**
  * Read the next frame from the stream into #oshu::stream::frame.
  *
@@ -84,6 +134,10 @@ static int next_frame(oshu::stream *stream)
 			if (ts > 0)
 				stream->current_timestamp = stream->time_base * ts;
 			stream->sample_index = 0;
+			if (resampling(stream) && resample_frame(stream) < 0) {
+				stream->finished = 1;
+				return -1;
+			}
 			return 0;
 		} else if (rc == AVERROR(EAGAIN)) {
 			if (next_page(stream) < 0) {
@@ -135,21 +189,36 @@ static int convert_frame(struct SwrContext *converter, AVFrame *frame, int index
 	return rc;
 }
 
+/**
+ * Copy at most *wanted* samples per channel of the resampled frame, starting
+ * from the sample at position *index*.
+ */
+static int copy_resampled(oshu::stream *stream, int index, float *samples, int wanted)
+{
+	int count = std::min(wanted, frame_length(stream) - index);
+	memcpy(samples, stream->resampled.data() + index * channels, count * channels * sizeof(float));
+	return count;
+}
+
 int oshu::read_stream(oshu::stream *stream, float *samples, int nb_samples)
 {
 	int left = nb_samples;
 	while (left > 0 && !stream->finished) {
-		if (stream->sample_index >= stream->frame->nb_samples) {
+		if (stream->sample_index >= frame_length(stream)) {
 			if (next_frame(stream) < 0)
 				return -1;
 			continue;
 		}
-		int rc = convert_frame(stream->converter, stream->frame, stream->sample_index, samples, left);
+		int rc;
+		if (resampling(stream))
+			rc = copy_resampled(stream, stream->sample_index, samples, left);
+		else
+			rc = convert_frame(stream->converter, stream->frame, stream->sample_index, samples, left);
 		if (rc < 0)
 			return -1;
 		left -= rc;
 		stream->sample_index += rc;
-		stream->current_timestamp += (double) rc / stream->decoder->sample_rate;
+		stream->current_timestamp += (double) rc / stream->sample_rate;
 		samples += rc * channels;
 	}
 	return nb_samples - left;
@@ -164,31 +233,254 @@ static void dump_stream_info(oshu::stream *stream)
 	oshu_log_info("============ Audio information ============");
 	oshu_log_info("            Codec: %s.", stream->codec->long_name);
 	oshu_log_info("      Sample rate: %d Hz.", stream->decoder->sample_rate);
+	if (resampling(stream))
+		oshu_log_info("    Resampling to: %d Hz.", stream->sample_rate);
 	oshu_log_info(" Average bit rate: %ld kbps.", stream->decoder->bit_rate / 1000);
 	oshu_log_info("    Sample format: %s.", av_get_sample_fmt_name(stream->decoder->sample_fmt));
 	oshu_log_info("         Duration: %0.3f", stream->duration);
 }
 
+/**
+ * Size of the buffer of the custom I/O context.
+ */
+static const int io_buffer_size = 32768;
+
+/**
+ * A file from an archive, with the reading position of the demuxer.
+ */
+struct oshu::stream_source {
+	oshu::file_view file;
+	size_t position;
+};
+
+static int read_source(void *opaque, uint8_t *buf, int size)
+{
+	oshu::stream_source *source = (oshu::stream_source*) opaque;
+	size_t left = source->file.size - source->position;
+	if (left == 0)
+		return AVERROR_EOF;
+	size_t count = std::min<size_t>(size, left);
+	memcpy(buf, source->file.data + source->position, count);
+	source->position += count;
+	return count;
+}
+
+static int64_t seek_source(void *opaque, int64_t offset, int whence)
+{
+	oshu::stream_source *source = (oshu::stream_source*) opaque;
+	int64_t base;
+	switch (whence & ~AVSEEK_FORCE) {
+	case AVSEEK_SIZE: return source->file.size;
+	case SEEK_SET:    base = 0; break;
+	case SEEK_CUR:    base = source->position; break;
+	case SEEK_END:    base = source->file.size; break;
+	default:          return -1;
+	}
+	if (base + offset < 0 || base + offset > (int64_t) source->file.size)
+		return -1;
+	source->position = base + offset;
+	return source->position;
+}
+
+/**
+ * Prepare a demuxer reading from an archived file, with #oshu::stream::io.
+ *
+ * The file is read in place from the archive's memory map.
+ */
+static int open_source(const char *path, oshu::stream *stream)
+{
+	stream->source = new oshu::stream_source {};
+	if (oshu::open_file(path, &stream->source->file) < 0)
+		return -1;
+	unsigned char *buffer = (unsigned char*) av_malloc(io_buffer_size);
+	if (!buffer)
+		return -1;
+	stream->io = avio_alloc_context(buffer, io_buffer_size, 0, stream->source, read_source, NULL, seek_source);
+	if (!stream->io) {
+		av_free(buffer);
+		oshu_log_error("could not allocate the I/O context");
+		return -1;
+	}
+	stream->demuxer = avformat_alloc_context();
+	if (!stream->demuxer)
+		return -1;
+	stream->demuxer->pb = stream->io;
+	return 0;
+}
+
+/**
+ * The stream parameters that `avformat_find_stream_info` finds by reading and
+ * decoding the beginning of the file, saved in the probe cache.
+ *
+ * Probing a big FLAC or Vorbis file takes a noticeable time, and gives the
+ * same result every time, so the cache lets #open_demuxer skip it when the
+ * file was opened before.
+ */
+struct stream_probe {
+	char magic[8];
+	uint32_t version;
+	/**
+	 * Index of the best audio stream in the file.
+	 */
+	int32_t index;
+	int32_t codec_id;
+	int32_t sample_rate;
+	int32_t channels;
+	int32_t frame_size;
+	uint64_t channel_layout;
+	int32_t time_base_num;
+	int32_t time_base_den;
+	/**
+	 * Duration of the stream, in #time_base_num / #time_base_den units.
+	 */
+	int64_t duration;
+};
+
+static const char probe_magic[8] = {'o', 's', 'h', 'u', 'p', 'r', 'b', '\0'};
+static const uint32_t probe_version = 1;
+
+/**
+ * Return the path of the file's probe in the cache, or an empty string if the
+ * cache is unavailable.
+ *
+ * The key is a hash of the file's content, like the other caches.
+ */
+static std::string probe_cache_path(const char *url)
+{
+	uint64_t key;
+	if (oshu::hash_file(url, &key) < 0)
+		return "";
+	std::string directory;
+	try {
+		directory = oshu::get_cache_directory("streams");
+	} catch (std::exception &e) {
+		oshu_log_debug("stream probe cache unavailable: %s", e.what());
+		return "";
+	}
+	char name[32];
+	snprintf(name, sizeof(name), "/%016llx.probe", (unsigned long long) key);
+	return directory + name;
+}
+
+static int load_probe(const std::string &path, stream_probe *probe)
+{
+	FILE *file = fopen(path.c_str(), "rb");
+	if (!file)
+		return -1;
+	size_t rc = fread(probe, sizeof(*probe), 1, file);
+	fclose(file);
+	if (rc != 1 || memcmp(probe->magic, probe_magic, sizeof(probe_magic)) || probe->version != probe_version) {
+		oshu_log_debug("ignoring the invalid stream probe %s", path.c_str());
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Save the probe in the cache, through a temporary file so that another
+ * instance of oshu! never reads a partial probe.
+ */
+static void save_probe(const std::string &path, oshu::stream *stream)
+{
+	AVCodecParameters *codecpar = stream->stream->codecpar;
+	stream_probe probe {};
+	memcpy(probe.magic, probe_magic, sizeof(probe_magic));
+	probe.version = probe_version;
+	probe.index = stream->stream->index;
+	probe.codec_id = codecpar->codec_id;
+	probe.sample_rate = codecpar->sample_rate;
+	probe.channels = codecpar->channels;
+	probe.frame_size = codecpar->frame_size;
+	probe.channel_layout = codecpar->channel_layout;
+	probe.time_base_num = stream->stream->time_base.num;
+	probe.time_base_den = stream->stream->time_base.den;
+	probe.duration = stream->stream->duration;
+
+	std::string tmp = path + ".tmp" + std::to_string(getpid());
+	FILE *file = fopen(tmp.c_str(), "wb");
+	if (!file)
+		return;
+	bool written = fwrite(&probe, sizeof(probe), 1, file) == 1;
+	if (fclose(file) != 0 || !written || rename(tmp.c_str(), path.c_str()) < 0)
+		unlink(tmp.c_str());
+}
+
+/**
+ * Fill the stream parameters from the cached probe, instead of probing the
+ * file.
+ *
+ * The demuxer has only read the file's header, so the probe must agree with
+ * what it found there: the same stream with the same codec and time base.
+ * Otherwise the probe is stale, and the file is probed again.
+ *
+ * \return 0 on success, -1 if the probe doesn't fit the file.
+ */
+static int apply_probe(const stream_probe &probe, oshu::stream *stream)
+{
+	if (probe.index < 0 || (unsigned) probe.index >= stream->demuxer->nb_streams)
+		return -1;
+	AVStream *s = stream->demuxer->streams[probe.index];
+	AVCodecParameters *codecpar = s->codecpar;
+	if (codecpar->codec_type != AVMEDIA_TYPE_AUDIO || codecpar->codec_id != probe.codec_id
+	    || s->time_base.num != probe.time_base_num || s->time_base.den != probe.time_base_den)
+		return -1;
+	const AVCodec *codec = avcodec_find_decoder(codecpar->codec_id);
+	if (!codec)
+		return -1;
+	if (!codecpar->sample_rate)
+		codecpar->sample_rate = probe.sample_rate;
+	if (!codecpar->channels)
+		codecpar->channels = probe.channels;
+	if (!codecpar->channel_layout)
+		codecpar->channel_layout = probe.channel_layout;
+	if (!codecpar->frame_size)
+		codecpar->frame_size = probe.frame_size;
+	if (s->duration == AV_NOPTS_VALUE)
+		s->duration = probe.duration;
+	stream->codec = (AVCodec*) codec;
+	stream->stream = s;
+	return 0;
+}
+
 /**
  * Open the libavformat demuxer, and find the best stream stream.
  *
  * Fill #oshu::stream::demuxer, #oshu::stream::codec, #oshu::stream::stream and
  * #oshu::stream::time_base.
  *
+ * The stream parameters come from the probe cache when the file was probed
+ * before.
+ *
  * \return 0 on success, -1 on error.
  */
 static int open_demuxer(const char *url, oshu::stream *stream)
 {
+	int64_t start = oshu::trace_clock();
+	std::string probe_path = probe_cache_path(url);
+	stream_probe probe;
+	bool probed = false;
+	if (oshu::in_archive(url) && open_source(url, stream) < 0)
+		return -1;
 	int rc = avformat_open_input(&stream->demuxer, url, NULL, NULL);
 	if (rc < 0) {
 		oshu_log_error("failed opening the stream file");
 		goto fail;
 	}
+	oshu::log_startup("opening the audio file", start);
+	start = oshu::trace_clock();
+	if (!probe_path.empty() && load_probe(probe_path, &probe) == 0) {
+		if (apply_probe(probe, stream) == 0) {
+			oshu_log_debug("using the cached stream probe %s", probe_path.c_str());
+			goto done;
+		}
+		oshu_log_debug("the cached stream probe %s is stale", probe_path.c_str());
+	}
 	rc = avformat_find_stream_info(stream->demuxer, NULL);
 	if (rc < 0) {
 		oshu_log_error("error reading the stream headers");
 		goto fail;
 	}
+	probed = true;
 	rc = av_find_best_stream(
 		stream->demuxer,
 		AVMEDIA_TYPE_AUDIO,
@@ -205,6 +497,10 @@ static int open_demuxer(const char *url, oshu::stream *stream)
 		goto fail;
 	}
 	stream->stream = stream->demuxer->streams[rc];
+	if (probed && !probe_path.empty())
+		save_probe(probe_path, stream);
+done:
+	oshu::log_startup(probed ? "probing the audio stream" : "reading the cached audio probe", start);
 	stream->time_base = av_q2d(stream->stream->time_base);
 	stream->duration = stream->time_base * stream->stream->duration;
 	return 0;
@@ -222,6 +518,7 @@ fail:
  */
 static int open_decoder(oshu::stream *stream)
 {
+	int64_t start = oshu::trace_clock();
 	stream->decoder = avcodec_alloc_context3(stream->codec);
 	int rc = avcodec_parameters_to_context(
 		stream->decoder,
@@ -231,6 +528,12 @@ static int open_decoder(oshu::stream *stream)
 		oshu_log_error("error copying the codec context");
 		goto fail;
 	}
+	/* Let the codecs that can decode on several threads, like FLAC, pick
+	 * their number of threads. */
+	if (stream->codec->capabilities & (AV_CODEC_CAP_FRAME_THREADS | AV_CODEC_CAP_SLICE_THREADS)) {
+		stream->decoder->thread_count = 0;
+		stream->decoder->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+	}
 	rc = avcodec_open2(stream->decoder, stream->codec, NULL);
 	if (rc < 0) {
 		oshu_log_error("error opening the codec");
@@ -243,12 +546,39 @@ static int open_decoder(oshu::stream *stream)
 		oshu_log_error("could not allocate the codec frame");
 		goto fail;
 	}
+	oshu::log_startup("opening the audio decoder", start);
 	return 0;
 fail:
 	log_av_error(rc);
 	return -1;
 }
 
+/**
+ * Set the quality of the resampler from the *OSHU_RESAMPLING* environment
+ * variable.
+ *
+ * The *medium* quality keeps the defaults of libswresample. The *fast* one
+ * uses a shorter filter, and the *best* one a longer filter with more phases,
+ * interpolated.
+ */
+static void set_resampling_quality(struct SwrContext *converter)
+{
+	const char *quality = getenv("OSHU_RESAMPLING");
+	if (!quality || !*quality || !strcmp(quality, "medium"))
+		return;
+	if (!strcmp(quality, "fast")) {
+		av_opt_set_int(converter, "filter_size", 8, 0);
+		av_opt_set_int(converter, "phase_shift", 6, 0);
+	} else if (!strcmp(quality, "best")) {
+		av_opt_set_int(converter, "filter_size", 64, 0);
+		av_opt_set_int(converter, "phase_shift", 12, 0);
+		av_opt_set_int(converter, "linear_interp", 1, 0);
+	} else {
+		oshu_log_warning("invalid OSHU_RESAMPLING value: %s", quality);
+		oshu_log_warning("it must be one of fast, medium or best");
+	}
+}
+
 /**
  * Initialize the libswresample converter to resample data from
  * #oshu::stream::decoder into a definied output format.
@@ -274,6 +604,8 @@ static int open_converter(oshu::stream *stream)
 		oshu_log_error("error allocating the audio resampler");
 		return -1;
 	}
+	if (resampling(stream))
+		set_resampling_quality(stream->converter);
 	int rc = swr_init(stream->converter);
 	if (rc < 0) {
 		oshu_log_error("error initializing the audio resampler");
@@ -283,7 +615,7 @@ static int open_converter(oshu::stream *stream)
 	return 0;
 }
 
-int oshu::open_stream(const char *url, oshu::stream *stream)
+int oshu::open_stream(const char *url, oshu::stream *stream, int sample_rate)
 {
 	/*
 	 * av_register_all() got deprecated in lavf 58.9.100
@@ -298,12 +630,16 @@ int oshu::open_stream(const char *url, oshu::stream *stream)
 		goto fail;
 	if (open_decoder(stream) < 0)
 		goto fail;
+	stream->sample_rate = sample_rate > 0 ? sample_rate : stream->decoder->sample_rate;
 	dump_stream_info(stream);
-	stream->sample_rate = stream->decoder->sample_rate;
 	if (open_converter(stream) < 0)
 		goto fail;
-	if (next_frame(stream) < 0)
-		goto fail;
+	{
+		int64_t start = oshu::trace_clock();
+		if (next_frame(stream) < 0)
+			goto fail;
+		oshu::log_startup("decoding the first audio frame", start);
+	}
 	return 0;
 fail:
 	oshu::close_stream(stream);
@@ -319,8 +655,18 @@ void oshu::close_stream(oshu::stream *stream)
 		avcodec_free_context(&stream->decoder);
 	if (stream->demuxer)
 		avformat_close_input(&stream->demuxer);
+	if (stream->io) {
+		av_freep(&stream->io->buffer);
+		avio_context_free(&stream->io);
+	}
+	if (stream->source) {
+		oshu::close_file(&stream->source->file);
+		delete stream->source;
+		stream->source = nullptr;
+	}
 	if (stream->converter)
 		swr_free(&stream->converter);
+	stream->resampled = {};
 }
 
 int oshu::seek_stream(oshu::stream *stream, double target)
@@ -342,7 +688,10 @@ int oshu::seek_stream(oshu::stream *stream, double target)
 		return -1;
 	}
 	stream->current_timestamp = target;
-	/* Flush the buffers. */
+	/* Flush the buffers, including the resampler's, since the samples it
+	 * keeps are from before the seek. */
+	if (resampling(stream))
+		swr_init(stream->converter);
 	next_page(stream);
 	next_frame(stream);
 	return 0;
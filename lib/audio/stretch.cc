@@ -0,0 +1,261 @@
+/**
+ * \file audio/stretch.cc
+ * \ingroup audio_stretch
+ */
+
+#include "audio/stretch.h"
+
+#include "core/log.h"
+
+extern "C" {
+#include <libavutil/channel_layout.h>
+#include <libswresample/swresample.h>
+}
+
+#include <algorithm>
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+/** Work in stereo. */
+static const int channels = 2;
+
+/**
+ * Duration of a WSOLA frame, in seconds.
+ *
+ * Longer frames blur the transients, while shorter ones make the low
+ * frequencies warble.
+ */
+static const double frame_duration = .025;
+
+/**
+ * How far a WSOLA frame may be shifted, in seconds.
+ *
+ * It must cover the period of the lowest frequency we care to align.
+ */
+static const double frame_tolerance = .006;
+
+/**
+ * Step between the samples compared when aligning two frames.
+ *
+ * Comparing every other sample is enough to find the best alignment, and
+ * halves the work of the decoder thread.
+ */
+static const int correlation_stride = 2;
+
+bool oshu::stretching(oshu::stretcher *stretcher)
+{
+	return stretcher->rate != 1.;
+}
+
+static int open_resampler(oshu::stretcher *stretcher, int sample_rate)
+{
+	stretcher->resampler = swr_alloc_set_opts(
+		stretcher->resampler,
+		/* output */
+		AV_CH_LAYOUT_STEREO,
+		AV_SAMPLE_FMT_FLT,
+		sample_rate,
+		/* input, declared faster to be played faster */
+		AV_CH_LAYOUT_STEREO,
+		AV_SAMPLE_FMT_FLT,
+		lrint(sample_rate * stretcher->rate),
+		0, NULL
+	);
+	if (!stretcher->resampler) {
+		oshu_log_error("error allocating the audio stretcher");
+		return -1;
+	}
+	if (swr_init(stretcher->resampler) < 0) {
+		oshu_log_error("error initializing the audio stretcher");
+		return -1;
+	}
+	return 0;
+}
+
+int oshu::open_stretcher(oshu::stretcher *stretcher, int sample_rate, double rate, bool keep_pitch)
+{
+	assert (rate > 0);
+	stretcher->rate = rate;
+	stretcher->keep_pitch = keep_pitch;
+	stretcher->hop = sample_rate * frame_duration / 2;
+	stretcher->tolerance = sample_rate * frame_tolerance;
+	stretcher->window.resize(stretcher->hop);
+	for (int i = 0; i < stretcher->hop; ++i)
+		stretcher->window[i] = .5 - .5 * cos(M_PI * i / stretcher->hop);
+	if (oshu::stretching(stretcher) && !keep_pitch && open_resampler(stretcher, sample_rate) < 0)
+		return -1;
+	return oshu::reset_stretcher(stretcher);
+}
+
+int oshu::reset_stretcher(oshu::stretcher *stretcher)
+{
+	stretcher->input.clear();
+	stretcher->nominal = 0;
+	stretcher->natural = -1;
+	stretcher->overlap.assign(stretcher->hop * channels, 0);
+	stretcher->output.clear();
+	stretcher->output_read = 0;
+	stretcher->flushed = false;
+	if (stretcher->resampler && swr_init(stretcher->resampler) < 0) {
+		oshu_log_error("error resetting the audio stretcher");
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Find the position of the frame around *nominal* whose beginning looks the
+ * most like the continuation of the previous frame, at *natural*.
+ *
+ * The similarity is the cross-correlation of the mono downmix, normalized by
+ * the energy of the candidate so that loud passages don't always win.
+ */
+static long align_frame(oshu::stretcher *stretcher, long nominal)
+{
+	const float *input = stretcher->input.data();
+	const float *target = input + stretcher->natural * channels;
+	long first = std::max(0L, nominal - stretcher->tolerance);
+	long last = nominal + stretcher->tolerance;
+	long best = nominal;
+	double best_score = -INFINITY;
+	for (long p = first; p <= last; ++p) {
+		const float *candidate = input + p * channels;
+		double correlation = 0, energy = 1e-9;
+		for (int i = 0; i < stretcher->hop * channels; i += correlation_stride * channels) {
+			double c = candidate[i] + candidate[i + 1];
+			correlation += c * (target[i] + target[i + 1]);
+			energy += c * c;
+		}
+		double score = correlation / sqrt(energy);
+		if (score > best_score) {
+			best_score = score;
+			best = p;
+		}
+	}
+	return best;
+}
+
+/**
+ * Overlap the next WSOLA frame with the previous one, and output a hop.
+ *
+ * \return false when there isn't enough input for the frame.
+ */
+static bool overlap_frame(oshu::stretcher *stretcher)
+{
+	int hop = stretcher->hop;
+	long available = stretcher->input.size() / channels;
+	long nominal = lrint(stretcher->nominal);
+	if (nominal + stretcher->tolerance + 2 * hop > available)
+		return false;
+	long p = stretcher->natural < 0 ? nominal : align_frame(stretcher, nominal);
+
+	const float *frame = stretcher->input.data() + p * channels;
+	float *overlap = stretcher->overlap.data();
+	size_t start = stretcher->output.size();
+	stretcher->output.resize(start + hop * channels);
+	float *output = stretcher->output.data() + start;
+	for (int i = 0; i < hop; ++i) {
+		float w = stretcher->window[i];
+		for (int c = 0; c < channels; ++c) {
+			output[i * channels + c] = overlap[i * channels + c] + w * frame[i * channels + c];
+			overlap[i * channels + c] = (1.f - w) * frame[(hop + i) * channels + c];
+		}
+	}
+	stretcher->natural = p + hop;
+	stretcher->nominal += hop * stretcher->rate;
+
+	/* Drop the input no frame will ever look at again. */
+	long keep = std::min(stretcher->natural, lrint(stretcher->nominal) - stretcher->tolerance);
+	if (keep > 4 * hop) {
+		stretcher->input.erase(stretcher->input.begin(), stretcher->input.begin() + keep * channels);
+		stretcher->natural -= keep;
+		stretcher->nominal -= keep;
+	}
+	return true;
+}
+
+/**
+ * Drop the output that was read, before appending more.
+ */
+static void compact_output(oshu::stretcher *stretcher)
+{
+	if (!stretcher->output_read)
+		return;
+	stretcher->output.erase(stretcher->output.begin(), stretcher->output.begin() + stretcher->output_read * channels);
+	stretcher->output_read = 0;
+}
+
+/**
+ * Run the resampler on *nb_samples*, or flush it when *samples* is null.
+ */
+static int resample(oshu::stretcher *stretcher, const float *samples, int nb_samples)
+{
+	int room = swr_get_out_samples(stretcher->resampler, nb_samples);
+	if (room < 0)
+		return -1;
+	size_t start = stretcher->output.size();
+	stretcher->output.resize(start + room * channels);
+	uint8_t *output = (uint8_t*) (stretcher->output.data() + start);
+	const uint8_t *input = (const uint8_t*) samples;
+	int rc = swr_convert(stretcher->resampler, &output, room, samples ? &input : NULL, nb_samples);
+	if (rc < 0) {
+		oshu_log_error("audio stretching error");
+		stretcher->output.resize(start);
+		return -1;
+	}
+	stretcher->output.resize(start + rc * channels);
+	return 0;
+}
+
+int oshu::feed_stretcher(oshu::stretcher *stretcher, const float *samples, int nb_samples)
+{
+	compact_output(stretcher);
+	if (!stretcher->keep_pitch)
+		return resample(stretcher, samples, nb_samples);
+	stretcher->input.insert(stretcher->input.end(), samples, samples + nb_samples * channels);
+	while (overlap_frame(stretcher));
+	return 0;
+}
+
+int oshu::flush_stretcher(oshu::stretcher *stretcher)
+{
+	if (stretcher->flushed)
+		return 0;
+	stretcher->flushed = true;
+	compact_output(stretcher);
+	if (!stretcher->keep_pitch)
+		return resample(stretcher, NULL, 0);
+	/* Pad with silence so that the frames reach the last input sample,
+	 * then fade out the last frame. */
+	int hop = stretcher->hop;
+	double step = hop * stretcher->rate;
+	long end = stretcher->input.size() / channels;
+	int frames = std::max(0., ceil((end - stretcher->nominal) / step));
+	stretcher->input.resize((end + stretcher->tolerance + 2 * hop + lrint(step) + 1) * channels);
+	for (int i = 0; i < frames && overlap_frame(stretcher); ++i);
+	stretcher->output.insert(stretcher->output.end(), stretcher->overlap.begin(), stretcher->overlap.end());
+	return 0;
+}
+
+int oshu::read_stretcher(oshu::stretcher *stretcher, float *samples, int nb_samples)
+{
+	size_t available = stretcher->output.size() / channels - stretcher->output_read;
+	int count = std::min<size_t>(nb_samples, available);
+	memcpy(samples, stretcher->output.data() + stretcher->output_read * channels, count * channels * sizeof(float));
+	stretcher->output_read += count;
+	return count;
+}
+
+bool oshu::stretcher_drained(oshu::stretcher *stretcher)
+{
+	return stretcher->flushed && stretcher->output_read * channels >= stretcher->output.size();
+}
+
+void oshu::close_stretcher(oshu::stretcher *stretcher)
+{
+	if (stretcher->resampler)
+		swr_free(&stretcher->resampler);
+	stretcher->input.clear();
+	stretcher->output.clear();
+}
@@ -3,11 +3,11 @@
  * \ingroup audio_track
  */
 
+#include "audio/mix.h"
 #include "audio/sample.h"
 #include "audio/track.h"
 
 #include <assert.h>
-#include <math.h>
 #include <stdlib.h>
 
 /** Work in stereo. */
@@ -21,6 +21,8 @@ void oshu::start_track(oshu::track *track, oshu::sample *sample, float volume, i
 	track->cursor = 0;
 	track->volume = volume;
 	track->loop = loop;
+	track->delay = 0;
+	track->ramp_left = 0;
 }
 
 void oshu::stop_track(oshu::track *track)
@@ -28,9 +30,49 @@ void oshu::stop_track(oshu::track *track)
 	track->sample = NULL;
 }
 
+void oshu::ramp_track(oshu::track *track, float volume, int nb_samples)
+{
+	if (nb_samples <= 0) {
+		track->volume = volume;
+		track->ramp_left = 0;
+		if (volume <= 0)
+			track->sample = NULL;
+		return;
+	}
+	track->ramp_left = nb_samples;
+	track->ramp_step = (volume - track->volume) / nb_samples;
+	track->ramp_target = volume;
+}
+
+/**
+ * Mix the beginning of a track's volume ramp, and return the number of
+ * samples per channel it mixed.
+ */
+static int mix_ramp(oshu::track *track, float *output, const float *input, int nb_samples)
+{
+	int count = track->ramp_left < nb_samples ? track->ramp_left : nb_samples;
+	float volume = track->volume;
+	for (int i = 0; i < count; ++i) {
+		volume += track->ramp_step;
+		output[i * channels] += input[i * channels] * volume;
+		output[i * channels + 1] += input[i * channels + 1] * volume;
+	}
+	track->volume = volume;
+	track->ramp_left -= count;
+	if (track->ramp_left == 0)
+		track->volume = track->ramp_target;
+	return count;
+}
+
 int oshu::mix_track(oshu::track *track, float *samples, int nb_samples)
 {
 	int wanted = nb_samples;
+	if (track->sample && track->delay > 0) {
+		int skip = track->delay < wanted ? track->delay : wanted;
+		track->delay -= skip;
+		samples += skip * channels;
+		wanted -= skip;
+	}
 	while (wanted > 0 && track->sample) {
 		int left = track->sample->nb_samples - track->cursor;
 		if (left == 0) {
@@ -44,8 +86,13 @@ int oshu::mix_track(oshu::track *track, float *samples, int nb_samples)
 		}
 		int consume = left < wanted ? left : wanted;
 		float *input = track->sample->samples + track->cursor * channels;
-		for (int i = 0; i < consume * channels; i++)
-			samples[i] = fmaf(input[i], track->volume, samples[i]);
+		if (track->ramp_left > 0) {
+			consume = mix_ramp(track, samples, input, consume);
+			if (track->ramp_left == 0 && track->volume <= 0)
+				track->sample = NULL;
+		} else {
+			oshu::mix_samples(samples, input, track->volume, consume * channels);
+		}
 		track->cursor += consume;
 		samples += consume * channels;
 		wanted -= consume;
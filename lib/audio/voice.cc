@@ -0,0 +1,116 @@
+/**
+ * \file audio/voice.cc
+ * \ingroup audio_voice
+ */
+
+#include "audio/voice.h"
+
+#include "core/log.h"
+
+#include <assert.h>
+
+void oshu::open_voice_pool(oshu::voice_pool *pool, int size)
+{
+	assert (size > 0);
+	pool->voices.assign(size, oshu::voice {});
+	for (int i = 0; i < size; ++i) {
+		pool->voices[i].previous = -1;
+		pool->voices[i].next = i + 1 < size ? i + 1 : -1;
+	}
+	pool->free = 0;
+	for (int p = 0; p < oshu::voice_priorities; ++p) {
+		pool->oldest[p] = -1;
+		pool->newest[p] = -1;
+	}
+}
+
+/**
+ * Append a voice to the active list of its priority.
+ */
+static void link_voice(oshu::voice_pool *pool, int index)
+{
+	oshu::voice *v = &pool->voices[index];
+	int p = v->priority;
+	v->previous = pool->newest[p];
+	v->next = -1;
+	if (pool->newest[p] >= 0)
+		pool->voices[pool->newest[p]].next = index;
+	else
+		pool->oldest[p] = index;
+	pool->newest[p] = index;
+}
+
+/**
+ * Remove a voice from the active list of its priority.
+ */
+static void unlink_voice(oshu::voice_pool *pool, int index)
+{
+	oshu::voice *v = &pool->voices[index];
+	int p = v->priority;
+	if (v->previous >= 0)
+		pool->voices[v->previous].next = v->next;
+	else
+		pool->oldest[p] = v->next;
+	if (v->next >= 0)
+		pool->voices[v->next].previous = v->previous;
+	else
+		pool->newest[p] = v->previous;
+}
+
+int oshu::acquire_voice(oshu::voice_pool *pool, oshu::voice_priority priority)
+{
+	int index = pool->free;
+	if (index >= 0) {
+		pool->free = pool->voices[index].next;
+	} else {
+		int p = 0;
+		while (p <= priority && p < oshu::LOOPING_VOICE && pool->oldest[p] < 0)
+			++p;
+		if (p > priority || p >= oshu::LOOPING_VOICE)
+			return -1;
+		index = pool->oldest[p];
+		oshu_log_debug("all the voices are taken, stealing one");
+		unlink_voice(pool, index);
+	}
+	oshu::voice *v = &pool->voices[index];
+	oshu::stop_track(&v->track);
+	v->priority = priority;
+	v->active = true;
+	link_voice(pool, index);
+	return index;
+}
+
+void oshu::release_voice(oshu::voice_pool *pool, int index)
+{
+	oshu::voice *v = &pool->voices[index];
+	if (!v->active)
+		return;
+	unlink_voice(pool, index);
+	oshu::stop_track(&v->track);
+	v->active = false;
+	v->previous = -1;
+	v->next = pool->free;
+	pool->free = index;
+}
+
+void oshu::mix_voices(oshu::voice_pool *pool, float *samples, int nb_samples)
+{
+	for (int p = 0; p < oshu::voice_priorities; ++p) {
+		for (int i = pool->oldest[p]; i >= 0;) {
+			oshu::voice *v = &pool->voices[i];
+			int next = v->next;
+			oshu::mix_track(&v->track, samples, nb_samples);
+			if (!v->track.sample)
+				oshu::release_voice(pool, i);
+			i = next;
+		}
+	}
+}
+
+void oshu::stop_voices(oshu::voice_pool *pool)
+{
+	for (int p = 0; p < oshu::voice_priorities; ++p) {
+		while (pool->oldest[p] >= 0)
+			oshu::release_voice(pool, pool->oldest[p]);
+	}
+}
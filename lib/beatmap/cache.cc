@@ -0,0 +1,630 @@
+/**
+ * \file beatmap/cache.cc
+ * \ingroup beatmap_cache
+ *
+ * The cache file is a header, followed by the serialized beatmap.
+ *
+ * The beatmap properties are written field by field, in the order of
+ * #oshu::beatmap, with strings written as a 32-bit length followed by their
+ * null-terminated bytes. Then come the arrays of timing points, colors, and
+ * hits, each prefixed by their 32-bit count.
+ *
+ * Timing points and colors are plain structures which are stored as is. Hits
+ * refer to their timing point and color by index, and their slider paths are
+ * stored in their normalized form.
+ *
+ * On load, the whole file is read into one buffer, which becomes
+ * #oshu::beatmap::contents, and the strings point right inside it. The body is
+ * checksummed, so that a damaged file is discarded rather than trusted.
+ */
+
+#include "beatmap/cache.h"
+
+#include "core/arena.h"
+#include "core/hash.h"
+#include "core/home.h"
+#include "core/log.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Bump this whenever the serialized structures change.
+ */
+static const uint32_t cache_version = 6;
+
+static const char cache_magic[8] = {'O', 'S', 'H', 'U', 'B', '\0', '\r', '\n'};
+
+/**
+ * Layout signature of the structures we dump as is, to detect incompatible
+ * builds.
+ */
+static const uint32_t cache_layout =
+	sizeof(oshu::timing_point) << 24 |
+	sizeof(oshu::color) << 16 |
+	sizeof(oshu::hit_sound) << 8 |
+	sizeof(oshu::arc);
+
+struct cache_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t layout;
+	/**
+	 * Informative only: the freshness is judged by #source_hash.
+	 */
+	uint64_t source_size;
+	int64_t source_mtime_sec;
+	int64_t source_mtime_nsec;
+	uint64_t source_hash;
+	uint64_t body_hash;
+};
+
+static const uint32_t null_string = UINT32_MAX;
+
+/* Writer ********************************************************************/
+
+template <typename T>
+static void put(std::string &out, const T &value)
+{
+	out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static void put_array(std::string &out, const void *data, size_t size)
+{
+	out.append(reinterpret_cast<const char*>(data), size);
+}
+
+static void put_string(std::string &out, const char *str)
+{
+	if (!str) {
+		put(out, null_string);
+		return;
+	}
+	uint32_t len = strlen(str);
+	put(out, len);
+	out.append(str, len + 1);
+}
+
+static void put_path(std::string &out, oshu::path *path)
+{
+	put(out, (char) path->type);
+	put(out, (uint32_t) path->polyline.points.size());
+	put_array(out, path->polyline.points.data(), path->polyline.points.size() * sizeof(oshu::point));
+	put_array(out, path->polyline.distance.data(), path->polyline.distance.size() * sizeof(double));
+	switch (path->type) {
+	case oshu::LINEAR_PATH:
+		put(out, (uint32_t) path->line.points.size());
+		put_array(out, path->line.points.data(), path->line.points.size() * sizeof(oshu::point));
+		put_array(out, path->line.distance.data(), path->line.distance.size() * sizeof(double));
+		break;
+	case oshu::PERFECT_PATH:
+		put(out, path->arc);
+		break;
+	case oshu::BEZIER_PATH:
+	case oshu::CATMULL_PATH:
+		put(out, (uint32_t) path->bezier.indices.size());
+		put_array(out, path->bezier.indices.data(), path->bezier.indices.size() * sizeof(int));
+		put(out, (uint32_t) path->bezier.control_points.size());
+		put_array(out, path->bezier.control_points.data(), path->bezier.control_points.size() * sizeof(oshu::point));
+		put(out, (uint32_t) path->bezier.lengths.size());
+		put_array(out, path->bezier.lengths.data(), path->bezier.lengths.size() * sizeof(double));
+		put(out, path->bezier.length);
+		put(out, (uint32_t) path->bezier.lut.size());
+		put_array(out, path->bezier.lut.data(), path->bezier.lut.size() * sizeof(oshu::point));
+		break;
+	}
+}
+
+template <typename T>
+static uint32_t index_of(T **array, int count, T *item, int *cursor)
+{
+	/* Items are usually referred to in increasing order. */
+	for (int i = *cursor; i < count; ++i) {
+		if (array[i] == item)
+			return *cursor = i;
+	}
+	for (int i = 0; i < *cursor; ++i) {
+		if (array[i] == item)
+			return *cursor = i;
+	}
+	return UINT32_MAX;
+}
+
+static void put_hit(std::string &out, oshu::hit *hit, uint32_t timing, uint32_t color)
+{
+	put(out, hit->p);
+	put(out, hit->time);
+	put(out, hit->type);
+	put(out, hit->sound);
+	put(out, timing);
+	put(out, color);
+	put(out, hit->combo);
+	put(out, hit->combo_seq);
+	if (hit->type & oshu::SLIDER_HIT) {
+		put_path(out, &hit->slider.path);
+		put(out, hit->slider.repeat);
+		put(out, hit->slider.length);
+		put(out, hit->slider.duration);
+		put_array(out, hit->slider.sounds, (hit->slider.repeat + 1) * sizeof(oshu::hit_sound));
+	} else if (hit->type & oshu::SPINNER_HIT) {
+		put(out, hit->spinner.end_time);
+	} else if (hit->type & oshu::HOLD_HIT) {
+		put(out, hit->hold_note.end_time);
+	}
+}
+
+static void serialize(std::string &out, oshu::beatmap *beatmap)
+{
+	put(out, beatmap->version);
+	put_string(out, beatmap->audio_filename);
+	put(out, beatmap->audio_lead_in);
+	put(out, beatmap->preview_time);
+	put(out, beatmap->countdown);
+	put(out, beatmap->sample_set);
+	put(out, beatmap->mode);
+	oshu::metadata *meta = &beatmap->metadata;
+	put_string(out, meta->title);
+	put_string(out, meta->title_unicode);
+	put_string(out, meta->artist);
+	put_string(out, meta->artist_unicode);
+	put_string(out, meta->creator);
+	put_string(out, meta->version);
+	put_string(out, meta->source);
+	put(out, meta->beatmap_id);
+	put(out, meta->beatmap_set_id);
+	put(out, beatmap->difficulty);
+	put_string(out, beatmap->background_filename);
+	put_string(out, beatmap->video_filename);
+	put(out, beatmap->video_offset);
+
+	put(out, (uint32_t) beatmap->timing_point_count);
+	for (int i = 0; i < beatmap->timing_point_count; ++i)
+		put(out, *beatmap->timing_index[i]);
+
+	std::vector<oshu::color*> colors;
+	for (int i = 0; i < beatmap->color_count; ++i)
+		colors.push_back(i ? colors.back()->next : beatmap->colors);
+	put(out, (uint32_t) colors.size());
+	for (oshu::color *c : colors)
+		put(out, *c);
+
+	uint32_t hit_count = 0;
+	for (oshu::hit *hit = beatmap->hits->next; hit->next; hit = hit->next)
+		++hit_count;
+	put(out, hit_count);
+	int timing_cursor = 0, color_cursor = 0;
+	for (oshu::hit *hit = beatmap->hits->next; hit->next; hit = hit->next) {
+		uint32_t timing = index_of(beatmap->timing_index, beatmap->timing_point_count, hit->timing_point, &timing_cursor);
+		uint32_t color = index_of(colors.data(), colors.size(), hit->color, &color_cursor);
+		put_hit(out, hit, timing, color);
+	}
+}
+
+/* Reader ********************************************************************/
+
+struct reader {
+	char *cursor;
+	char *end;
+	bool failed;
+};
+
+static bool get_array(reader *in, void *data, size_t size)
+{
+	if (in->failed || (size_t) (in->end - in->cursor) < size) {
+		in->failed = true;
+		return false;
+	}
+	if (size > 0)
+		memcpy(data, in->cursor, size);
+	in->cursor += size;
+	return true;
+}
+
+template <typename T>
+static bool get(reader *in, T *value)
+{
+	return get_array(in, value, sizeof(*value));
+}
+
+static bool get_string(reader *in, char **str)
+{
+	uint32_t len;
+	if (!get(in, &len))
+		return false;
+	if (len == null_string) {
+		*str = nullptr;
+		return true;
+	}
+	if ((size_t) (in->end - in->cursor) < (size_t) len + 1 || in->cursor[len] != '\0') {
+		in->failed = true;
+		return false;
+	}
+	*str = in->cursor;
+	in->cursor += len + 1;
+	return true;
+}
+
+/**
+ * Read a count, and check the remaining input can hold that many items of
+ * *size* bytes, so that a corrupt count can't make us allocate gigabytes.
+ */
+static bool get_count(reader *in, uint32_t *count, size_t size)
+{
+	if (!get(in, count))
+		return false;
+	if ((size_t) (in->end - in->cursor) / size < *count) {
+		in->failed = true;
+		return false;
+	}
+	return true;
+}
+
+template <typename T>
+static bool get_vector(reader *in, std::vector<T> *v)
+{
+	uint32_t count;
+	if (!get_count(in, &count, sizeof(T)))
+		return false;
+	v->resize(count);
+	return get_array(in, v->data(), count * sizeof(T));
+}
+
+static bool get_path(reader *in, oshu::path *path)
+{
+	/* Construct everything before setting the type, so that free_path only
+	 * ever destroys initialized objects. */
+	new (&path->polyline) oshu::line();
+	char type;
+	if (!get(in, &type))
+		return false;
+	switch (type) {
+	case oshu::LINEAR_PATH:
+		new (&path->line) oshu::line();
+		break;
+	case oshu::PERFECT_PATH:
+		break;
+	case oshu::BEZIER_PATH:
+	case oshu::CATMULL_PATH:
+		new (&path->bezier) oshu::bezier();
+		break;
+	default:
+		in->failed = true;
+		return false;
+	}
+	path->type = (oshu::path_type) type;
+	if (!get_vector(in, &path->polyline.points))
+		return false;
+	path->polyline.distance.resize(path->polyline.points.size());
+	if (!get_array(in, path->polyline.distance.data(), path->polyline.distance.size() * sizeof(double)))
+		return false;
+	switch (path->type) {
+	case oshu::LINEAR_PATH:
+		if (!get_vector(in, &path->line.points))
+			return false;
+		path->line.distance.resize(path->line.points.size());
+		return get_array(in, path->line.distance.data(), path->line.distance.size() * sizeof(double));
+	case oshu::PERFECT_PATH:
+		return get(in, &path->arc);
+	default:
+		return get_vector(in, &path->bezier.indices)
+			&& get_vector(in, &path->bezier.control_points)
+			&& get_vector(in, &path->bezier.lengths)
+			&& get(in, &path->bezier.length)
+			&& get_vector(in, &path->bezier.lut);
+	}
+}
+
+static bool get_hit(reader *in, oshu::beatmap *beatmap, oshu::color **colors, oshu::hit *hit)
+{
+	uint32_t timing, color;
+	get(in, &hit->p);
+	get(in, &hit->time);
+	get(in, &hit->type);
+	get(in, &hit->sound);
+	get(in, &timing);
+	get(in, &color);
+	get(in, &hit->combo);
+	if (!get(in, &hit->combo_seq))
+		return false;
+	if (timing >= (uint32_t) beatmap->timing_point_count || color >= (uint32_t) beatmap->color_count) {
+		in->failed = true;
+		return false;
+	}
+	hit->timing_point = beatmap->timing_index[timing];
+	hit->color = colors[color];
+	if (hit->type & oshu::SLIDER_HIT) {
+		if (!get_path(in, &hit->slider.path))
+			return false;
+		get(in, &hit->slider.repeat);
+		get(in, &hit->slider.length);
+		if (!get(in, &hit->slider.duration))
+			return false;
+		if (hit->slider.repeat < 0 || hit->slider.repeat > (in->end - in->cursor)) {
+			in->failed = true;
+			return false;
+		}
+		size_t size = (hit->slider.repeat + 1) * sizeof(oshu::hit_sound);
+		hit->slider.sounds = (oshu::hit_sound*) malloc(size);
+		assert (hit->slider.sounds != NULL);
+		return get_array(in, hit->slider.sounds, size);
+	} else if (hit->type & oshu::SPINNER_HIT) {
+		return get(in, &hit->spinner.end_time);
+	} else if (hit->type & oshu::HOLD_HIT) {
+		return get(in, &hit->hold_note.end_time);
+	}
+	return true;
+}
+
+static int deserialize(reader *in, oshu::beatmap *beatmap)
+{
+	oshu::arena *arena = &beatmap->arena;
+	get(in, &beatmap->version);
+	get_string(in, &beatmap->audio_filename);
+	get(in, &beatmap->audio_lead_in);
+	get(in, &beatmap->preview_time);
+	get(in, &beatmap->countdown);
+	get(in, &beatmap->sample_set);
+	get(in, &beatmap->mode);
+	oshu::metadata *meta = &beatmap->metadata;
+	get_string(in, &meta->title);
+	get_string(in, &meta->title_unicode);
+	get_string(in, &meta->artist);
+	get_string(in, &meta->artist_unicode);
+	get_string(in, &meta->creator);
+	get_string(in, &meta->version);
+	get_string(in, &meta->source);
+	get(in, &meta->beatmap_id);
+	get(in, &meta->beatmap_set_id);
+	get(in, &beatmap->difficulty);
+	get_string(in, &beatmap->background_filename);
+	get_string(in, &beatmap->video_filename);
+	get(in, &beatmap->video_offset);
+
+	uint32_t count;
+	if (!get_count(in, &count, sizeof(oshu::timing_point)))
+		return -1;
+	size_t timing_size = count * (sizeof(oshu::timing_point*) + sizeof(oshu::timing_point));
+	oshu::arena_reserve(arena, timing_size);
+	beatmap->timing_index = (oshu::timing_point**) oshu::arena_alloc(arena, count * sizeof(oshu::timing_point*));
+	beatmap->timing_point_count = count;
+	for (uint32_t i = 0; i < count; ++i) {
+		oshu::timing_point *t = oshu::arena_new<oshu::timing_point>(arena);
+		get(in, t);
+		t->next = nullptr;
+		beatmap->timing_index[i] = t;
+		if (i > 0)
+			beatmap->timing_index[i - 1]->next = t;
+	}
+	beatmap->timing_points = count ? beatmap->timing_index[0] : nullptr;
+
+	if (!get_count(in, &count, sizeof(oshu::color)))
+		return -1;
+	std::vector<oshu::color*> colors(count);
+	for (uint32_t i = 0; i < count; ++i) {
+		colors[i] = oshu::arena_new<oshu::color>(arena);
+		get(in, colors[i]);
+		colors[i]->next = nullptr;
+		if (i > 0)
+			colors[i - 1]->next = colors[i];
+	}
+	if (count) {
+		colors.back()->next = colors.front();
+		beatmap->colors = colors.front();
+	}
+	beatmap->color_count = count;
+
+	/* A hit takes at least a few dozen bytes, so get_count can use that. */
+	if (!get_count(in, &count, 32))
+		return -1;
+	oshu::arena_reserve(arena, (count + 2) * sizeof(oshu::hit));
+	oshu::hit *last = beatmap->hits = oshu::arena_new<oshu::hit>(arena);
+	last->time = -INFINITY;
+	bool ok = true;
+	for (uint32_t i = 0; ok && i < count; ++i) {
+		oshu::hit *hit = oshu::arena_new<oshu::hit>(arena);
+		/* Link it first, so that destroy_beatmap frees it on failure. */
+		last->next = hit;
+		hit->previous = last;
+		last = hit;
+		ok = get_hit(in, beatmap, colors.data(), hit);
+	}
+	oshu::hit *end = oshu::arena_new<oshu::hit>(arena);
+	end->time = INFINITY;
+	last->next = end;
+	end->previous = last;
+
+	if (!ok || in->failed || in->cursor != in->end)
+		return -1;
+	return 0;
+}
+
+/* Files *********************************************************************/
+
+static void fill_source_info(struct stat *s, cache_header *header)
+{
+	header->source_size = s->st_size;
+	header->source_mtime_sec = s->st_mtim.tv_sec;
+	header->source_mtime_nsec = s->st_mtim.tv_nsec;
+}
+
+int oshu::save_beatmap_cache(const char *cache_path, const char *source_path, oshu::beatmap *beatmap)
+{
+	cache_header header {};
+	memcpy(header.magic, cache_magic, sizeof(cache_magic));
+	header.version = cache_version;
+	header.layout = cache_layout;
+	/* Archived beatmaps have no stat, but they have a hash. */
+	struct stat s;
+	if (stat(source_path, &s) == 0)
+		fill_source_info(&s, &header);
+	if (oshu::hash_file(source_path, &header.source_hash) < 0)
+		return -1;
+
+	std::string out;
+	put(out, header);
+	serialize(out, beatmap);
+	header.body_hash = oshu::hash_bytes(out.data() + sizeof(header), out.size() - sizeof(header));
+	out.replace(0, sizeof(header), reinterpret_cast<const char*>(&header), sizeof(header));
+
+	std::string tmp = std::string(cache_path) + ".tmp" + std::to_string(getpid());
+	int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		oshu_log_debug("could not create %s: %s", tmp.c_str(), strerror(errno));
+		return -1;
+	}
+	const char *data = out.data();
+	size_t left = out.size();
+	while (left > 0) {
+		ssize_t rc = write(fd, data, left);
+		if (rc < 0 && errno == EINTR)
+			continue;
+		if (rc < 0) {
+			oshu_log_debug("could not write %s: %s", tmp.c_str(), strerror(errno));
+			close(fd);
+			unlink(tmp.c_str());
+			return -1;
+		}
+		data += rc;
+		left -= rc;
+	}
+	close(fd);
+	if (rename(tmp.c_str(), cache_path) < 0) {
+		oshu_log_debug("could not rename %s: %s", tmp.c_str(), strerror(errno));
+		unlink(tmp.c_str());
+		return -1;
+	}
+	oshu_log_debug("saved the beatmap cache %s (%zu bytes)", cache_path, out.size());
+	return 0;
+}
+
+/**
+ * Read a whole file into a buffer allocated with *malloc*.
+ */
+static int read_cache_file(const char *path, char **buffer, size_t *size)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	struct stat s;
+	if (fstat(fd, &s) < 0 || !S_ISREG(s.st_mode)) {
+		close(fd);
+		return -1;
+	}
+	*size = s.st_size;
+	*buffer = (char*) malloc(*size ? *size : 1);
+	assert (*buffer != NULL);
+	size_t total = 0;
+	while (total < *size) {
+		ssize_t rc = read(fd, *buffer + total, *size - total);
+		if (rc < 0 && errno == EINTR)
+			continue;
+		if (rc <= 0)
+			break;
+		total += rc;
+	}
+	close(fd);
+	if (total != *size) {
+		free(*buffer);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Check the header of the cache matches this build and the source file.
+ */
+static bool fresh(const cache_header *header, const char *source_path)
+{
+	if (memcmp(header->magic, cache_magic, sizeof(cache_magic)))
+		return false;
+	if (header->version != cache_version || header->layout != cache_layout)
+		return false;
+	/* Cheap, since the hash was computed to find the cache file. */
+	uint64_t hash;
+	if (oshu::hash_file(source_path, &hash) < 0)
+		return false;
+	return hash == header->source_hash;
+}
+
+int oshu::load_beatmap_cache(const char *cache_path, const char *source_path, oshu::beatmap *beatmap)
+{
+	memset((void*) beatmap, 0, sizeof(*beatmap));
+	char *buffer;
+	size_t size;
+	if (read_cache_file(cache_path, &buffer, &size) < 0)
+		return -1;
+	cache_header header;
+	if (size < sizeof(header)) {
+		free(buffer);
+		return -1;
+	}
+	memcpy(&header, buffer, sizeof(header));
+	if (!fresh(&header, source_path)) {
+		oshu_log_debug("stale beatmap cache %s", cache_path);
+		free(buffer);
+		return -1;
+	}
+	if (oshu::hash_bytes(buffer + sizeof(header), size - sizeof(header)) != header.body_hash) {
+		oshu_log_warning("corrupt beatmap cache %s", cache_path);
+		free(buffer);
+		return -1;
+	}
+	beatmap->contents = buffer;
+	reader in {buffer + sizeof(header), buffer + size, false};
+	if (deserialize(&in, beatmap) < 0) {
+		oshu_log_warning("corrupt beatmap cache %s", cache_path);
+		oshu::destroy_beatmap(beatmap);
+		return -1;
+	}
+	oshu::track_beatmap_memory(beatmap, size ? size : 1);
+	oshu_log_debug("loaded the beatmap from the cache %s", cache_path);
+	return 0;
+}
+
+/**
+ * Compute the path to the cache file of a beatmap, named after the hash of its
+ * content.
+ *
+ * Identical beatmaps share the same cache file, wherever they are, and so do
+ * beatmaps from archives.
+ *
+ * Return an empty string if the cache is unavailable.
+ */
+static std::string cache_path_for(const char *path)
+{
+	const char *enabled = getenv("OSHU_BEATMAP_CACHE");
+	if (enabled && !strcmp(enabled, "0"))
+		return "";
+	uint64_t key;
+	if (oshu::hash_file(path, &key) < 0)
+		return "";
+	std::string directory;
+	try {
+		directory = oshu::get_cache_directory("beatmaps");
+	} catch (std::exception &e) {
+		oshu_log_debug("beatmap cache unavailable: %s", e.what());
+		return "";
+	}
+	char name[32];
+	snprintf(name, sizeof(name), "/%016llx.oshub", (unsigned long long) key);
+	return directory + name;
+}
+
+int oshu::load_cached_beatmap(const char *path, oshu::beatmap *beatmap)
+{
+	std::string cache = cache_path_for(path);
+	if (!cache.empty() && oshu::load_beatmap_cache(cache.c_str(), path, beatmap) == 0)
+		return 0;
+	if (oshu::load_beatmap(path, beatmap) < 0)
+		return -1;
+	if (!cache.empty())
+		oshu::save_beatmap_cache(cache.c_str(), path, beatmap);
+	return 0;
+}
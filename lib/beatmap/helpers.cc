@@ -7,6 +7,7 @@
  */
 
 #include "beatmap/beatmap.h"
+#include <algorithm>
 #include <assert.h>
 #include <limits>
 
@@ -14,6 +15,8 @@ double oshu::hit_end_time(oshu::hit *hit)
 {
 	if (hit->type & oshu::SLIDER_HIT)
 		return hit->time + hit->slider.duration * hit->slider.repeat;
+	else if (hit->type & oshu::HOLD_HIT)
+		return hit->hold_note.end_time;
 	else
 		return hit->time;
 }
@@ -26,6 +29,27 @@ oshu::point oshu::end_point(oshu::hit *hit)
 		return hit->p;
 }
 
+oshu::timing_point* oshu::timing_at(oshu::beatmap *beatmap, double t, oshu::timing_point *hint)
+{
+	if (beatmap->timing_point_count == 0)
+		return nullptr;
+	/* Fast path: we're still in the hinted timing point, or in the next one. */
+	if (hint && hint->offset <= t) {
+		if (!hint->next || hint->next->offset > t)
+			return hint;
+		oshu::timing_point *next = hint->next;
+		if (!next->next || next->next->offset > t)
+			return next;
+	}
+	oshu::timing_point **begin = beatmap->timing_index;
+	oshu::timing_point **end = begin + beatmap->timing_point_count;
+	oshu::timing_point **it = std::upper_bound(
+		begin, end, t,
+		[](double t, const oshu::timing_point *p) { return t < p->offset; }
+	);
+	return it == begin ? *begin : *(it - 1);
+}
+
 double oshu::score(oshu::beatmap *beatmap)
 {
 	double score = 0, total = 0;
@@ -0,0 +1,152 @@
+/**
+ * \file beatmap/hit_index.cc
+ * \ingroup beatmap_hit_index
+ */
+
+#include "beatmap/hit_index.h"
+
+#include <algorithm>
+#include <assert.h>
+
+/**
+ * Keep the grid small, because a very large one would mostly be empty cells.
+ */
+static const int max_grid_side = 64;
+
+static int clamp(int x, int min, int max)
+{
+	return x < min ? min : (x > max ? max : x);
+}
+
+static int column_of(const oshu::hit_index *index, double x)
+{
+	return clamp((int) floor((x - std::real(index->origin)) / index->cell_size), 0, index->columns - 1);
+}
+
+static int row_of(const oshu::hit_index *index, double y)
+{
+	return clamp((int) floor((y - std::imag(index->origin)) / index->cell_size), 0, index->rows - 1);
+}
+
+static bool clickable(oshu::hit *hit)
+{
+	return hit->type & (oshu::CIRCLE_HIT | oshu::SLIDER_HIT);
+}
+
+void oshu::build_hit_index(oshu::beatmap *beatmap, oshu::hit_index *index)
+{
+	*index = {};
+	double radius = beatmap->difficulty.circle_radius;
+	double end_max = -INFINITY;
+	oshu::point top_left, bottom_right;
+	bool empty = true;
+	for (oshu::hit *hit = beatmap->hits; hit; hit = hit->next) {
+		index->hits.push_back(hit);
+		index->times.push_back(hit->time);
+		end_max = std::max(end_max, oshu::hit_end_time(hit));
+		index->end_times.push_back(end_max);
+		index->ends.push_back(oshu::hit_end_time(hit));
+		index->xs.push_back(std::real(hit->p));
+		index->ys.push_back(std::imag(hit->p));
+		index->types.push_back(hit->type);
+		index->states.push_back(hit->state);
+		if (!clickable(hit))
+			continue;
+		if (empty) {
+			top_left = bottom_right = hit->p;
+			empty = false;
+		}
+		top_left = {std::min(std::real(top_left), std::real(hit->p)), std::min(std::imag(top_left), std::imag(hit->p))};
+		bottom_right = {std::max(std::real(bottom_right), std::real(hit->p)), std::max(std::imag(bottom_right), std::imag(hit->p))};
+	}
+
+	/* A circle spans at most 2 cells on each axis. */
+	index->origin = top_left - oshu::vector{1, 1} * radius;
+	oshu::vector extent = bottom_right - top_left + oshu::vector{2, 2} * radius;
+	double side = std::max(std::real(extent), std::imag(extent));
+	index->cell_size = std::max(2. * radius, side / max_grid_side);
+	if (!(index->cell_size > 0))
+		index->cell_size = 1.;
+	index->columns = clamp((int) ceil(std::real(extent) / index->cell_size), 1, max_grid_side);
+	index->rows = clamp((int) ceil(std::imag(extent) / index->cell_size), 1, max_grid_side);
+	index->cells.resize(index->columns * index->rows);
+
+	for (size_t i = 0; i < index->hits.size(); ++i) {
+		oshu::hit *hit = index->hits[i];
+		if (!clickable(hit))
+			continue;
+		int left = column_of(index, std::real(hit->p) - radius);
+		int right = column_of(index, std::real(hit->p) + radius);
+		int top = row_of(index, std::imag(hit->p) - radius);
+		int bottom = row_of(index, std::imag(hit->p) + radius);
+		for (int y = top; y <= bottom; ++y) {
+			for (int x = left; x <= right; ++x)
+				index->cells[y * index->columns + x].push_back(i);
+		}
+	}
+}
+
+int oshu::hit_position(const oshu::hit_index *index, const oshu::hit *hit)
+{
+	size_t i = std::lower_bound(index->times.begin(), index->times.end(), hit->time) - index->times.begin();
+	for (; i < index->hits.size() && index->times[i] == hit->time; ++i) {
+		if (index->hits[i] == hit)
+			return i;
+	}
+	return -1;
+}
+
+void oshu::sync_hit_state(oshu::hit_index *index, const oshu::hit *hit)
+{
+	int i = oshu::hit_position(index, hit);
+	if (i >= 0)
+		index->states[i] = hit->state;
+}
+
+void oshu::hit_range(const oshu::hit_index *index, double start, double end, int *first, int *last)
+{
+	*first = std::lower_bound(index->end_times.begin(), index->end_times.end(), start) - index->end_times.begin();
+	*last = std::upper_bound(index->times.begin(), index->times.end(), end) - index->times.begin();
+	if (*last < *first)
+		*last = *first;
+}
+
+oshu::hit* oshu::first_hit_ending_after(const oshu::hit_index *index, double t)
+{
+	assert (!index->hits.empty());
+	auto it = std::lower_bound(index->end_times.begin(), index->end_times.end(), t);
+	if (it == index->end_times.end())
+		return index->hits.back();
+	return index->hits[it - index->end_times.begin()];
+}
+
+oshu::hit* oshu::last_hit_starting_before(const oshu::hit_index *index, double t)
+{
+	assert (!index->hits.empty());
+	auto it = std::lower_bound(index->times.begin(), index->times.end(), t);
+	if (it == index->times.end() || *it != t) {
+		if (it == index->times.begin())
+			return index->hits.front();
+		--it;
+	}
+	return index->hits[it - index->times.begin()];
+}
+
+oshu::hit* oshu::find_hit_at(const oshu::hit_index *index, oshu::point p, double radius, double start, double end)
+{
+	if (index->cells.empty())
+		return NULL;
+	size_t first = std::lower_bound(index->end_times.begin(), index->end_times.end(), start) - index->end_times.begin();
+	const std::vector<int> &cell = index->cells[row_of(index, std::imag(p)) * index->columns + column_of(index, std::real(p))];
+	float x = std::real(p), y = std::imag(p), r2 = radius * radius;
+	for (auto i = std::lower_bound(cell.begin(), cell.end(), (int) first); i != cell.end(); ++i) {
+		if (index->times[*i] > end)
+			break;
+		if (index->states[*i] != oshu::INITIAL_HIT)
+			continue;
+		float dx = index->xs[*i] - x, dy = index->ys[*i] - y;
+		if (dx * dx + dy * dy <= r2)
+			return index->hits[*i];
+	}
+	return NULL;
+}
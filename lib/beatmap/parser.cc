@@ -9,12 +9,18 @@
 #include "./parser.h"
 #include "beatmap/beatmap.h"
 #include "core/log.h"
+#include "core/memory.h"
+#include "core/vfs.h"
 
+#include <algorithm>
 #include <assert.h>
-#include <errno.h>
+#include <atomic>
+#include <math.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
-#include <sys/stat.h>
+#include <system_error>
+#include <thread>
 
 /**
  * Every osu beatmap file must begin with this.
@@ -45,12 +51,20 @@ static const oshu::beatmap default_beatmap = {
 		.slider_multiplier = 1.4,
 		.slider_tick_rate = 1.,
 		.slider_tolerance = 64.,
+		.key_count = 4,
 	},
 	.background_filename = nullptr,
+	.video_filename = nullptr,
+	.video_offset = 0,
 	.timing_points = nullptr,
+	.timing_index = nullptr,
+	.timing_point_count = 0,
 	.colors = nullptr,
 	.color_count = 0,
 	.hits = nullptr,
+	.contents = nullptr,
+	.arena = {},
+	.memory = 0,
 };
 
 /**
@@ -135,8 +149,33 @@ static int parse_char(struct parser_state *parser, char *c)
 	return 0;
 }
 
+static bool is_digit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+/**
+ * Parse a decimal integer.
+ *
+ * The common case of a short plain number is parsed by hand, which is much
+ * faster than *strtol*. Anything else, like leading spaces or numbers too big
+ * for 9 digits, is left to *strtol* so that the result is the same.
+ */
 static int parse_int(struct parser_state *parser, int *value)
 {
+	const char *c = parser->input;
+	bool negative = (*c == '-');
+	if (*c == '-' || *c == '+')
+		++c;
+	const char *digits = c;
+	int n = 0;
+	while (is_digit(*c) && c - digits < 9)
+		n = n * 10 + (*c++ - '0');
+	if (c != digits && !is_digit(*c)) {
+		*value = negative ? -n : n;
+		parser->input = (char*) c;
+		return 0;
+	}
 	char *end;
 	*value = strtol(parser->input, &end, 10);
 	if (end == parser->input) {
@@ -162,8 +201,60 @@ static int parse_int_sep(struct parser_state *parser, int *value, char sep)
 	return 0;
 }
 
+/**
+ * The powers of ten that are exactly representable as doubles.
+ */
+static const double powers_of_ten[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+/**
+ * Parse a decimal number like `-12.5` or `1e-3`.
+ *
+ * When the number has at most 15 significant digits and a small exponent,
+ * both the digits and the power of ten are exact doubles, so a single
+ * multiplication or division yields the correctly rounded value, exactly like
+ * *strtod* would. This covers every number in practice.
+ *
+ * Everything else, including hexadecimal numbers, falls back to *strtod*. Note
+ * that the fast path always expects a dot, whatever the locale.
+ */
 static int parse_double(struct parser_state *parser, double *value)
 {
+	const char *c = parser->input;
+	bool negative = (*c == '-');
+	if (*c == '-' || *c == '+')
+		++c;
+	uint64_t mantissa = 0;
+	int digits = 0;
+	int exponent = 0;
+	for (; is_digit(*c); ++c, ++digits)
+		mantissa = mantissa * 10 + (*c - '0');
+	if (*c == '.') {
+		for (++c; is_digit(*c); ++c, ++digits, --exponent)
+			mantissa = mantissa * 10 + (*c - '0');
+	}
+	if ((*c == 'e' || *c == 'E') && digits > 0) {
+		const char *e = c + 1;
+		bool negative_exponent = (*e == '-');
+		if (*e == '-' || *e == '+')
+			++e;
+		if (is_digit(*e)) {
+			int n = 0;
+			for (; is_digit(*e) && n < 1000; ++e)
+				n = n * 10 + (*e - '0');
+			exponent += negative_exponent ? -n : n;
+			c = e;
+		}
+	}
+	if (digits > 0 && digits <= 15 && exponent >= -22 && exponent <= 22 && !is_digit(*c) && *c != 'x' && *c != 'X') {
+		double v = mantissa;
+		v = exponent < 0 ? v / powers_of_ten[-exponent] : v * powers_of_ten[exponent];
+		*value = negative ? -v : v;
+		parser->input = (char*) c;
+		return 0;
+	}
 	char *end;
 	*value = strtod(parser->input, &end);
 	if (end == parser->input) {
@@ -196,8 +287,8 @@ static int parse_double_sep(struct parser_state *parser, double *value, char sep
  *
  * If the string is empty, `*str` is set to NULL.
  *
- * Otherwise, return a dynamically allocated string using *strdup*, which you
- * must not forget to free!
+ * Otherwise, `*str` points inside the input buffer, which is owned by the
+ * beatmap as #oshu::beatmap::contents. Don't free it.
  */
 static int parse_string(struct parser_state *parser, char **str)
 {
@@ -206,7 +297,7 @@ static int parse_string(struct parser_state *parser, char **str)
 		return 0;
 	} else {
 		int len = strlen(parser->input);
-		*str = strdup(parser->input);
+		*str = parser->input;
 		parser->input += len;
 		return 0;
 	}
@@ -218,7 +309,8 @@ static int parse_string(struct parser_state *parser, char **str)
  * Mainly useful for parsing the file name of the background picture in the
  * events section.
  *
- * Behaves like #parse_string.
+ * Behaves like #parse_string. The closing quote is replaced by a null
+ * terminator in the input buffer.
  */
 static int parse_quoted_string(struct parser_state *parser, char **str)
 {
@@ -236,7 +328,7 @@ static int parse_quoted_string(struct parser_state *parser, char **str)
 		*str = NULL;
 		return 0;
 	} else {
-		*str = strdup(parser->input);
+		*str = parser->input;
 		parser->input = end + 1;
 	}
 	return 0;
@@ -246,14 +338,76 @@ static int parse_quoted_string(struct parser_state *parser, char **str)
  * Map each token to its string representation using CPP's magic
  * stringification operator.
  */
-static const char* token_strings[NUM_TOKENS] = {
+static constexpr const char* token_strings[NUM_TOKENS] = {
 #define TOKEN(t) #t,
 #include "./tokens.h"
 #undef TOKEN
 };
 
 /**
- * Perform a dichotomic search using #token_strings.
+ * Hash the first *len* characters of *str* into a slot of #token_table,
+ * using FNV-1a.
+ */
+static constexpr int hash_token(const char *str, int len, uint32_t seed)
+{
+	uint32_t h = seed;
+	for (int i = 0; i < len; ++i)
+		h = (h ^ (unsigned char) str[i]) * 16777619u;
+	return h >> 24;
+}
+
+static constexpr int token_length(const char *str)
+{
+	int len = 0;
+	while (str[len])
+		++len;
+	return len;
+}
+
+/**
+ * A perfect hash table of the tokens: every token has its own slot.
+ *
+ * \sa build_token_table
+ */
+struct token_table {
+	uint32_t seed;
+	/**
+	 * Token stored in each slot, or #NUM_TOKENS for empty slots.
+	 */
+	uint8_t slots[256];
+};
+
+static_assert(NUM_TOKENS < 256, "too many tokens for the token table");
+
+/**
+ * Find the first hash seed for which no two tokens collide, and fill the
+ * table with it.
+ *
+ * This is all done by the compiler, so adding a token is only a matter of
+ * editing *tokens.h*.
+ */
+static constexpr token_table build_token_table()
+{
+	for (uint32_t seed = 2166136261u;; ++seed) {
+		token_table table {seed, {}};
+		for (int i = 0; i < 256; ++i)
+			table.slots[i] = NUM_TOKENS;
+		bool collision = false;
+		for (int t = 0; t < NUM_TOKENS && !collision; ++t) {
+			int slot = hash_token(token_strings[t], token_length(token_strings[t]), seed);
+			if (table.slots[slot] != NUM_TOKENS)
+				collision = true;
+			table.slots[slot] = t;
+		}
+		if (!collision)
+			return table;
+	}
+}
+
+static constexpr token_table tokens = build_token_table();
+
+/**
+ * Look a token up in #tokens.
  *
  * The *str* argument isn't expected to be null-terminated at *len*, so we must
  * make sure we take the length into account when comparing tokens, and not
@@ -262,25 +416,14 @@ static const char* token_strings[NUM_TOKENS] = {
  */
 static int search_token(const char *str, int len, enum token *token)
 {
-	int start = 0;
-	int end = NUM_TOKENS - 1; /* inclusive */
-	while (start <= end) {
-		int middle = start + (end - start) / 2;
-		const char *repr = token_strings[middle];
-		int cmp = strncmp(str, repr, len);
-		if (cmp == 0)
-			cmp = len - strlen(repr);
-		if (cmp == 0) {
-			/* Found! */
-			*token = (enum token) middle;
-			return 0;
-		} else if (cmp < 0) {
-			end = middle - 1;
-		} else {
-			start = middle + 1;
-		}
-	}
-	return -1;
+	int t = tokens.slots[hash_token(str, len, tokens.seed)];
+	if (t == NUM_TOKENS)
+		return -1;
+	const char *repr = token_strings[t];
+	if (strncmp(str, repr, len) != 0 || repr[len] != '\0')
+		return -1;
+	*token = (enum token) t;
+	return 0;
 }
 
 static int parse_token(struct parser_state *parser, enum token *token)
@@ -397,11 +540,61 @@ static int process_section(struct parser_state *parser)
 		parser->section = BEATMAP_UNKNOWN;
 		return -1;
 	}
-	if (parser->section == BEATMAP_HIT_OBJECTS)
+	/* The section values follow the alphabetical order of the tokens, not
+	 * the order of the file, so the data sections are listed one by one. */
+	if (parser->section == BEATMAP_TIMING_POINTS || parser->section == BEATMAP_COLOURS
+	    || parser->section == BEATMAP_HIT_OBJECTS)
+		emit_headers(parser);
+	if (parser->stop)
+		return 0;
+	if (parser->section == BEATMAP_TIMING_POINTS)
+		parser->builder->expect_timing_points(count_section_lines(parser));
+	if (parser->section == BEATMAP_HIT_OBJECTS) {
 		validate_colors(parser);
+		parser->builder->expect_hit_objects(count_section_lines(parser));
+	}
 	return 0;
 }
 
+/**
+ * Look ahead and count the non-empty lines until the next section or the end
+ * of the file.
+ *
+ * It relies on the fact that the lines following the current one are still
+ * intact in the buffer. Comments are counted too, which is fine for a hint.
+ */
+static size_t count_section_lines(struct parser_state *parser)
+{
+	/* Skip the current line, and the null bytes that terminate it. */
+	char *c = parser->input + strlen(parser->input);
+	while (c < parser->end && *c == '\0')
+		++c;
+	size_t count = 0;
+	while (c < parser->end) {
+		if (*c == '[')
+			break;
+		char *eol = (char*) memchr(c, '\n', parser->end - c);
+		if (!eol)
+			eol = parser->end;
+		if (eol > c && !isspace(*c))
+			++count;
+		c = eol + 1;
+	}
+	return count;
+}
+
+/**
+ * Call #oshu::builder::headers the first time we leave the header sections.
+ */
+static void emit_headers(struct parser_state *parser)
+{
+	if (parser->headers_done)
+		return;
+	parser->headers_done = true;
+	if (!parser->builder->headers(*parser->beatmap))
+		parser->stop = true;
+}
+
 static int process_general(struct parser_state *parser)
 {
 	oshu::beatmap *beatmap = parser->beatmap;
@@ -537,6 +730,10 @@ static int process_difficulty(struct parser_state *parser)
 		return -1;
 	switch (key) {
 	case CircleSize:
+		if (parser->beatmap->mode == oshu::MANIA_MODE) {
+			difficulty->key_count = lrint(value);
+			break;
+		}
 		difficulty->circle_radius = 54.4 - 4.48 * value;
 		assert (difficulty->circle_radius > 0.);
 		difficulty->approach_size = 3. * difficulty->circle_radius;
@@ -570,8 +767,15 @@ static int process_difficulty(struct parser_state *parser)
 }
 
 /**
- * The Events section contains most notably the background image, but also
- * break points.
+ * The Events section contains most notably the background image and video,
+ * but also break points.
+ *
+ * The video line looks like `Video,-200,"video.avi"`, where the number is the
+ * time at which the video starts, in milliseconds. Older beatmaps write `1`
+ * instead of `Video`.
+ *
+ * The storyboard lives there too, but it's only parsed when it's played, by
+ * the \ref beatmap_storyboard module, which reads the file again.
  *
  * \todo
  * Parse break points. The structure is `2,start,end` where start and end are
@@ -582,118 +786,112 @@ static int process_difficulty(struct parser_state *parser)
  */
 static int process_event(struct parser_state *parser)
 {
-	if (parser->beatmap->background_filename) {
-		/* skip events after we got the background */
-		goto skip;
-	}
-	if (!strncmp(parser->input, "0,0,", 4)) {
+	oshu::beatmap *beatmap = parser->beatmap;
+	if (!beatmap->background_filename && !strncmp(parser->input, "0,0,", 4)) {
 		parser->input += 4;
-		if (parse_quoted_string(parser, &parser->beatmap->background_filename) < 0)
+		if (parse_quoted_string(parser, &beatmap->background_filename) < 0)
+			return -1;
+	} else if (!beatmap->video_filename && (!strncmp(parser->input, "Video,", 6) || !strncmp(parser->input, "1,", 2))) {
+		parser->input = strchr(parser->input, ',') + 1;
+		int offset;
+		if (parse_int_sep(parser, &offset, ',') < 0)
 			return -1;
+		if (parse_quoted_string(parser, &beatmap->video_filename) < 0)
+			return -1;
+		beatmap->video_offset = offset / 1000.;
 	}
-skip:
 	consume_all(parser);
 	return 0;
 }
 
 /**
- * Parse one timing point and link it.
+ * Parse one timing point and emit it.
  *
  * Sample input:
  * `129703,731.707317073171,4,2,1,50,1,0`
  */
 static int process_timing_point(struct parser_state *parser)
 {
-	oshu::timing_point *timing;
+	oshu::timing_point timing {};
 	if (parse_timing_point(parser, &timing) < 0)
 		return -1;
-	if (parser->last_timing_point && timing->offset < parser->last_timing_point->offset) {
+	if (timing.offset < parser->last_offset) {
 		parser_error(parser, "misordered timing point");
-		free(timing);
 		return -1;
 	}
-	/* link it to the timing points list */
-	if (parser->last_timing_point)
-		parser->last_timing_point->next = timing;
-	else
-		parser->beatmap->timing_points = timing;
-	parser->last_timing_point = timing;
+	parser->last_offset = timing.offset;
+	oshu::timing_point *stored = parser->builder->timing_point(timing);
+	if (stored)
+		parser->timing_points.push_back(stored);
 	return 0;
 }
 
-static int parse_timing_point(struct parser_state *parser, oshu::timing_point **timing)
+static int parse_timing_point(struct parser_state *parser, oshu::timing_point *timing)
 {
 	int value;
-	*timing = (oshu::timing_point*) calloc(1, sizeof(**timing));
-	assert (timing != NULL);
 	/* 0. Defaults. */
-	(*timing)->meter = 4;
-	(*timing)->sample_set = parser->beatmap->sample_set;
-	(*timing)->volume = 1.0;
+	timing->meter = 4;
+	timing->sample_set = parser->beatmap->sample_set;
+	timing->volume = 1.0;
 	/* 1. Timing offset. */
-	if (parse_double_sep(parser, &(*timing)->offset, ',') < 0)
-		goto fail;
-	(*timing)->offset /= 1000.;
+	if (parse_double_sep(parser, &timing->offset, ',') < 0)
+		return -1;
+	timing->offset /= 1000.;
 	/* 2. Beat duration, in milliseconds. */
-	if (parse_double(parser, &(*timing)->beat_duration) < 0)
-		goto fail;
-	if ((*timing)->beat_duration > 0.) {
-		(*timing)->beat_duration /= 1000.;
-		parser->timing_base = (*timing)->beat_duration;
-	} else if ((*timing)->beat_duration < 0.) {
+	if (parse_double(parser, &timing->beat_duration) < 0)
+		return -1;
+	if (timing->beat_duration > 0.) {
+		timing->beat_duration /= 1000.;
+		parser->timing_base = timing->beat_duration;
+	} else if (timing->beat_duration < 0.) {
 		if (!parser->timing_base) {
 			parser_error(parser, "inherited timing point has no parent");
-			goto fail;
+			return -1;
 		}
-		(*timing)->beat_duration = - (*timing)->beat_duration / 100. * parser->timing_base;
+		timing->beat_duration = - timing->beat_duration / 100. * parser->timing_base;
 	} else {
-		parser_error(parser, "invalid beat duration %f", (*timing)->beat_duration);
-		goto fail;
+		parser_error(parser, "invalid beat duration %f", timing->beat_duration);
+		return -1;
 	}
 	if (*parser->input == '\0')
-		goto end;
+		return 0;
 	else if (consume_char(parser, ',') < 0)
-		goto fail;
+		return -1;
 
 	/* 3. Number of beats per measure. */
-	if (parse_int_sep(parser, &(*timing)->meter, ',') < 0)
-		goto fail;
-	if ((*timing)->meter <= 0) {
-		parser_error(parser, "invalid meter value %d", (*timing)->meter);
-		goto fail;
+	if (parse_int_sep(parser, &timing->meter, ',') < 0)
+		return -1;
+	if (timing->meter <= 0) {
+		parser_error(parser, "invalid meter value %d", timing->meter);
+		return -1;
 	}
 	/* 4. Sample set. */
 	if (parse_int_sep(parser, &value, ',') < 0)
-		goto fail;
-	(*timing)->sample_set = value ? (oshu::sample_set_family) value : parser->beatmap->sample_set;
+		return -1;
+	timing->sample_set = value ? (oshu::sample_set_family) value : parser->beatmap->sample_set;
 	/* 5. Looks like this is the sample set index. */
 	if (parse_int(parser, &value) < 0)
-		goto fail;
-	(*timing)->sample_index = value;
+		return -1;
+	timing->sample_index = value;
 	if (*parser->input == '\0')
-		goto end;
+		return 0;
 	else if (consume_char(parser, ',') < 0)
-		goto fail;
+		return -1;
 	/* 6. Volume, from 0 to 100%. */
 	if (parse_int_sep(parser, &value, ',') < 0)
-		goto fail;
+		return -1;
 	if (value < 0 || value > 100) {
 		parser_error(parser, "invalid volume %d", value);
-		goto fail;
+		return -1;
 	}
-	(*timing)->volume = (float) value / 100.;
+	timing->volume = (float) value / 100.;
 	/* 7. Inherited flag. Useless? */
 	if (parse_int_sep(parser, &value, ',') < 0)
-		goto fail;
+		return -1;
 	/* 8. Kiai mode. */
-	if (parse_int(parser, &(*timing)->kiai) < 0)
-		goto fail;
-end:
+	if (parse_int(parser, &timing->kiai) < 0)
+		return -1;
 	return 0;
-fail:
-	free(*timing);
-	*timing = NULL;
-	return -1;
 }
 
 static int process_color(struct parser_state *parser)
@@ -725,11 +923,11 @@ static int process_color_combo(struct parser_state *parser)
 	if (parse_int(parser, &index) < 0)
 		return -1;
 	index--;
-	if (parser->last_color) {
-		if (index != parser->last_color->index + 1)
+	if (parser->last_color >= 0) {
+		if (index != parser->last_color + 1)
 			parser_error(parser, "suspicious color index");
 		else
-			index = parser->last_color->index + 1;
+			index = parser->last_color + 1;
 	} else if (index != 0) {
 		parser_error(parser, "suspicious first color index");
 	} else {
@@ -737,45 +935,35 @@ static int process_color_combo(struct parser_state *parser)
 	}
 
 	/* Parse everything else. */
-	oshu::color *color;
+	oshu::color color {};
 	consume_spaces(parser);
 	if (consume_char(parser, ':') < 0)
 		return -1;
 	if (parse_color(parser, &color) < 0)
 		return -1;
-	color->index = index;
-
-	/* Link it. */
-	if (parser->last_color)
-		parser->last_color->next = color;
-	parser->last_color = color;
-	if (!parser->beatmap->colors)
-		parser->beatmap->colors = color;
-	color->next = parser->beatmap->colors;
-	assert (parser->beatmap->color_count == index);
-	parser->beatmap->color_count = index + 1;
+	color.index = index;
+	parser->last_color = index;
+
+	/* Emit it. */
+	oshu::color *stored = parser->builder->color(color);
+	if (stored)
+		parser->colors.push_back(stored);
 	return 0;
 }
 
-static int parse_color(struct parser_state *parser, oshu::color **color)
+static int parse_color(struct parser_state *parser, oshu::color *color)
 {
-	*color = (oshu::color*) calloc(1, sizeof(**color));
-	assert (color != NULL);
-	if (parse_color_channel(parser, &(*color)->red) < 0)
-		goto fail;
+	if (parse_color_channel(parser, &color->red) < 0)
+		return -1;
 	if (consume_char(parser, ',') < 0)
-		goto fail;
-	if (parse_color_channel(parser, &(*color)->green) < 0)
-		goto fail;
+		return -1;
+	if (parse_color_channel(parser, &color->green) < 0)
+		return -1;
 	if (consume_char(parser, ',') < 0)
-		goto fail;
-	if (parse_color_channel(parser, &(*color)->blue) < 0)
-		goto fail;
+		return -1;
+	if (parse_color_channel(parser, &color->blue) < 0)
+		return -1;
 	return 0;
-fail:
-	free(*color);
-	*color = NULL;
-	return -1;
 }
 
 static int parse_color_channel(struct parser_state *parser, double *ch)
@@ -793,14 +981,14 @@ static int parse_color_channel(struct parser_state *parser, double *ch)
 
 static void validate_colors(struct parser_state *parser)
 {
-	if (parser->beatmap->colors)
+	if (!parser->colors.empty())
 		return;
 	oshu_log_debug("no colors; generating a default color scheme");
-	oshu::color *color = (oshu::color*) calloc(1, sizeof(*color));
-	color->red = color->green = color->blue = 128;
-	color->next = color;
-	parser->beatmap->colors = color;
-	parser->beatmap->color_count = 1;
+	oshu::color color {};
+	color.red = color.green = color.blue = 128;
+	oshu::color *stored = parser->builder->color(color);
+	if (stored)
+		parser->colors.push_back(stored);
 }
 
 /*****************************************************************************/
@@ -818,21 +1006,31 @@ static void validate_colors(struct parser_state *parser)
  */
 static oshu::timing_point* seek_timing_point(double offset, struct parser_state *parser)
 {
-	if (parser->current_timing_point == NULL)
-		parser->current_timing_point = parser->beatmap->timing_points;
-	/* update the parser state as we loop */
-	oshu::timing_point **tp = &parser->current_timing_point;
-	for (; *tp && (*tp)->next; *tp = (*tp)->next) {
-		if ((*tp)->next->offset > offset)
-			break;
+	std::vector<oshu::timing_point*> &points = parser->timing_points;
+	if (points.empty())
+		return NULL;
+	size_t &i = parser->current_timing_point;
+	/* Fast path: the hits are sorted, so we usually move by 0 or 1 point. */
+	for (int step = 0; step < 2 && i + 1 < points.size(); ++step, ++i) {
+		if (points[i + 1]->offset > offset)
+			return points[i];
 	}
-	return *tp;
+	if (i + 1 == points.size())
+		return points[i];
+	/* Big jump: perform a dichotomic search. */
+	auto it = std::upper_bound(
+		points.begin() + i, points.end(), offset,
+		[](double t, const oshu::timing_point *p) { return t < p->offset; }
+	);
+	i = it - points.begin() - 1;
+	return points[i];
 }
 
 /**
  * Compute #oshu::hit::combo and #oshu::hit::combo_seq of a single #oshu::hit.
  *
- * Also the update the #oshu::hit::color.
+ * Also the update the #oshu::hit::color, and return its position in
+ * #parser_state::colors.
  *
  * The common case for a new combo is to have the #oshu::NEW_HIT_COMBO flag set
  * and the combo skip at 0.
@@ -843,26 +1041,27 @@ static oshu::timing_point* seek_timing_point(double offset, struct parser_state
  * - What if the initial hit has a combo skip?
  * - What if the combo skip is non-zero but the new combo flag is unset?
  */
-static void compute_hit_combo(struct parser_state *parser, oshu::hit *hit)
+static size_t compute_hit_combo(struct parser_state *parser, oshu::hit *hit)
 {
 	assert (parser->last_hit != NULL);
+	size_t color_count = parser->colors.size();
+	size_t color = parser->last_hit_color;
 	if (parser->last_hit->time < 0.) {
 		hit->combo = 0;
 		hit->combo_seq = 1;
-		hit->color = parser->beatmap->colors;
+		color = 0;
 	} else if (hit->type & oshu::NEW_HIT_COMBO) {
 		int skip_combo = (hit->type & oshu::COMBO_HIT_MASK) >> oshu::COMBO_HIT_OFFSET;
 		hit->combo = parser->last_hit->combo + 1 + skip_combo;
 		hit->combo_seq = 1;
-		hit->color = parser->last_hit->color;
-		for (int i = 0; hit->color && i < 1 + skip_combo; ++i)
-			hit->color = hit->color->next;
+		if (color_count)
+			color = (color + 1 + skip_combo) % color_count;
 	} else {
 		hit->combo = parser->last_hit->combo;
 		hit->combo_seq = parser->last_hit->combo_seq + 1;
-		hit->color = parser->last_hit->color;
 	}
-	assert (hit->color != NULL);
+	hit->color = color_count ? parser->colors[color] : NULL;
+	return color;
 }
 
 /**
@@ -887,70 +1086,206 @@ static void fill_slider_additions(oshu::hit *hit)
 	}
 }
 
+/**
+ * Free the dynamic parts of the scratch hit, unless the builder took them, and
+ * clear it for the next hit object.
+ */
+static void reset_hit(oshu::hit *hit, bool stolen)
+{
+	if (!stolen && (hit->type & oshu::SLIDER_HIT))
+		free_slider(&hit->slider);
+	memset((void*) hit, 0, sizeof(*hit));
+}
+
 static int process_hit_object(struct parser_state *parser)
 {
-	oshu::hit *hit;
-	if (parse_hit_object(parser, &hit) < 0)
+	oshu::hit *hit = parser->hit;
+	if (parse_hit_object(parser, hit) < 0) {
+		reset_hit(hit, false);
 		return -1;
-	compute_hit_combo(parser, hit);
+	}
+	size_t color = compute_hit_combo(parser, hit);
 	assert (parser->last_hit != NULL);
 	if (hit->time < parser->last_hit->time) {
 		parser_error(parser, "missorted hit object");
-		free(hit);
+		reset_hit(hit, false);
 		return -1;
 	}
-	parser->last_hit->next = hit;
-	hit->previous = parser->last_hit;
-	parser->last_hit = hit;
+	memcpy((void*) parser->last_hit, hit, sizeof(*hit));
+	parser->last_hit_color = color;
+	bool stolen = parser->builder->hit_object(*hit);
+	reset_hit(hit, stolen);
 	return 0;
 }
 
 /**
- * Allocate and parse one hit object.
+ * Sections with fewer lines than that are parsed line by line, like the other
+ * sections, since starting the threads would cost more than it saves.
+ */
+static const size_t parallel_section_lines = 4096;
+
+/**
+ * Number of lines parsed by a thread at once, taken in turn by the threads.
+ */
+static const size_t hit_object_chunk = 512;
+
+/**
+ * Parse the [HitObjects] section starting at *start* in parallel, when it's
+ * long enough, and return where the line-by-line parsing must resume: the
+ * next section, or the end of the buffer.
+ *
+ * For shorter sections, *start* is returned untouched.
+ *
+ * The lines are split first, and null-terminated like #parse_buffer does.
+ * Then the threads parse them into an array with one hit per line, seeking
+ * their timing points and normalizing the slider paths. Finally, the hits are
+ * walked in order to compute the combos, check the order, and hand them to
+ * the builder, exactly like #process_hit_object does.
+ */
+static char* process_hit_object_section(struct parser_state *parser, char *start)
+{
+	std::vector<section_line> lines;
+	int line_number = parser->line_number;
+	char *line = start;
+	for (; line < parser->end; ++line_number) {
+		char *c = line;
+		while (c < parser->end && isspace(*c) && *c != '\n')
+			++c;
+		if (c < parser->end && *c == '[')
+			break;
+		char *eol = (char*) memchr(line, '\n', parser->end - line);
+		if (eol == NULL)
+			eol = parser->end;
+		lines.push_back(section_line {line, line_number + 1, false});
+		line = eol + 1;
+	}
+	if (lines.size() < parallel_section_lines)
+		return start;
+
+	for (section_line &l : lines) {
+		char *eol = l.text + strcspn(l.text, "\n");
+		*eol = '\0';
+		for (char *c = eol - 1; c >= l.text && isspace(*c); --c)
+			*c = '\0';
+	}
+	oshu::hit *hits = (oshu::hit*) calloc(lines.size(), sizeof(*hits));
+	assert (hits != NULL);
+
+	size_t chunk_count = (lines.size() + hit_object_chunk - 1) / hit_object_chunk;
+	std::atomic<size_t> next_chunk {0};
+	auto work = [&]() {
+		/* The beatmap and the timing points are only read. */
+		struct parser_state local;
+		local.source = parser->source;
+		local.beatmap = parser->beatmap;
+		local.end = parser->end;
+		local.section = BEATMAP_HIT_OBJECTS;
+		local.timing_points = parser->timing_points;
+		for (size_t i; (i = next_chunk++) < chunk_count;) {
+			size_t first = i * hit_object_chunk;
+			size_t count = std::min(hit_object_chunk, lines.size() - first);
+			parse_hit_object_chunk(&local, &lines[first], &hits[first], count);
+		}
+	};
+	size_t thread_count = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), chunk_count);
+	std::vector<std::thread> threads;
+	try {
+		for (size_t i = 1; i < thread_count; ++i)
+			threads.emplace_back(work);
+	} catch (std::system_error &e) {
+		oshu_log_debug("could not start the parser threads: %s", e.what());
+	}
+	work();
+	for (std::thread &t : threads)
+		t.join();
+
+	for (size_t i = 0; i < lines.size(); ++i) {
+		if (!lines[i].parsed)
+			continue;
+		oshu::hit *hit = &hits[i];
+		size_t color = compute_hit_combo(parser, hit);
+		if (hit->time < parser->last_hit->time) {
+			parser->buffer = parser->input = lines[i].text;
+			parser->line_number = lines[i].line_number;
+			parser_error(parser, "missorted hit object");
+			reset_hit(hit, false);
+			continue;
+		}
+		memcpy((void*) parser->last_hit, hit, sizeof(*hit));
+		parser->last_hit_color = color;
+		bool stolen = parser->builder->hit_object(*hit);
+		reset_hit(hit, stolen);
+	}
+	free(hits);
+	parser->line_number = lines.back().line_number;
+	return line;
+}
+
+/**
+ * Parse *count* lines of hit objects into *hits*, using *parser* for the
+ * state of that thread only, and mark the lines that yielded a hit.
  *
- * On failure, return -1, free any allocated memory, and leave `*hit`
- * unspecified.
+ * The empty lines and the comments are skipped like #process_input does.
+ */
+static void parse_hit_object_chunk(struct parser_state *parser, struct section_line *lines, oshu::hit *hits, size_t count)
+{
+	for (size_t i = 0; i < count; ++i) {
+		parser->buffer = parser->input = lines[i].text;
+		parser->line_number = lines[i].line_number;
+		consume_spaces(parser);
+		if (*parser->input == '\0' || (parser->input[0] == '/' && parser->input[1] == '/'))
+			continue;
+		if (parse_hit_object(parser, &hits[i]) < 0) {
+			reset_hit(&hits[i], false);
+			continue;
+		}
+		lines[i].parsed = true;
+		/* Trailing garbage is reported, but the hit is kept. */
+		consume_end(parser);
+	}
+}
+
+/**
+ * Parse one hit object into the scratch *hit*.
+ *
+ * On failure, return -1, and leave `*hit` unspecified. The caller must then
+ * free its slider, if any.
  *
  * Consumes:
  * `288,256,8538,2,0,P|254:261|219:255,1,70,8|0,0:0|0:0,0:0:0:0:`
  */
-static int parse_hit_object(struct parser_state *parser, oshu::hit **hit)
+static int parse_hit_object(struct parser_state *parser, oshu::hit *hit)
 {
-	*hit = (oshu::hit*) calloc(1, sizeof(**hit));
-	assert (*hit != NULL);
-	if (parse_common_hit(parser, *hit) < 0)
-		goto fail;
-	(*hit)->timing_point = seek_timing_point((*hit)->time, parser);
-	if ((*hit)->timing_point == NULL) {
+	if (parse_common_hit(parser, hit) < 0)
+		return -1;
+	hit->timing_point = seek_timing_point(hit->time, parser);
+	if (hit->timing_point == NULL) {
 		parser_error(parser, "could not find the timing point for this hit");
-		goto fail;
+		return -1;
 	}
-	if (!((*hit)->type & oshu::CIRCLE_HIT) && consume_char(parser, ',') < 0)
-			goto fail;
+	if (!(hit->type & oshu::CIRCLE_HIT) && consume_char(parser, ',') < 0)
+			return -1;
 	int rc;
-	if ((*hit)->type & oshu::CIRCLE_HIT) {
+	if (hit->type & oshu::CIRCLE_HIT) {
 		rc = 0;
-	} else if ((*hit)->type & oshu::SLIDER_HIT) {
-		rc = parse_slider(parser, *hit);
-	} else if ((*hit)->type & oshu::SPINNER_HIT) {
-		rc = parse_spinner(parser, *hit);
-	} else if ((*hit)->type & oshu::HOLD_HIT) {
-		rc = parse_hold_note(parser, *hit);
+	} else if (hit->type & oshu::SLIDER_HIT) {
+		rc = parse_slider(parser, hit);
+	} else if (hit->type & oshu::SPINNER_HIT) {
+		rc = parse_spinner(parser, hit);
+	} else if (hit->type & oshu::HOLD_HIT) {
+		rc = parse_hold_note(parser, hit);
 	} else {
 		parser_error(parser, "unknown type");
-		goto fail;
+		return -1;
 	}
 	if (rc < 0)
-		goto fail;
-	if (parse_additions(parser, *hit) < 0)
-		goto fail;
-	if ((*hit)->type & oshu::SLIDER_HIT)
-		fill_slider_additions(*hit);
+		return -1;
+	/* Hold notes separate their end time from the additions with a colon. */
+	if (parse_additions(parser, hit, hit->type & oshu::HOLD_HIT ? ':' : ',') < 0)
+		return -1;
+	if (hit->type & oshu::SLIDER_HIT)
+		fill_slider_additions(hit);
 	return 0;
-fail:
-	free(*hit);
-	*hit = NULL;
-	return -1;
 }
 
 /**
@@ -980,6 +1315,14 @@ static int parse_common_hit(struct parser_state *parser, oshu::hit *hit)
 	return 0;
 }
 
+/**
+ * The most times a slider may be run through.
+ *
+ * Real beatmaps stay well below, but every run gets its own hit sound, so an
+ * absurd count would allocate as much.
+ */
+static const int max_slider_repeat = 10000;
+
 /**
  * Parse the specific parts of a slider hit object.
  *
@@ -993,6 +1336,7 @@ static int parse_common_hit(struct parser_state *parser, oshu::hit *hit)
  */
 static int parse_slider(struct parser_state *parser, oshu::hit *hit)
 {
+	new (&hit->slider.path.polyline) oshu::line();
 	char type;
 	if (parse_char(parser, &type) < 0)
 		return -1;
@@ -1014,6 +1358,10 @@ static int parse_slider(struct parser_state *parser, oshu::hit *hit)
 		return -1;
 	if (parse_int_sep(parser, &hit->slider.repeat, ',') < 0)
 		return -1;
+	if (hit->slider.repeat < 0 || hit->slider.repeat > max_slider_repeat) {
+		parser_error(parser, "invalid slider repeat count");
+		return -1;
+	}
 	if (parse_double(parser, &hit->slider.length) < 0)
 		return -1;
 	hit->slider.duration = hit->slider.length / (100. * parser->beatmap->difficulty.slider_multiplier) * hit->timing_point->beat_duration;
@@ -1262,7 +1610,7 @@ static int parse_hold_note(struct parser_state *parser, oshu::hit *hit)
  * \todo
  * Store the optional filename at the end when present.
  */
-static int parse_additions(struct parser_state *parser, oshu::hit *hit)
+static int parse_additions(struct parser_state *parser, oshu::hit *hit, char separator)
 {
 	/* 0. Fill defaults. */
 	hit->sound.sample_set = hit->timing_point->sample_set;
@@ -1271,7 +1619,7 @@ static int parse_additions(struct parser_state *parser, oshu::hit *hit)
 	hit->sound.volume = hit->timing_point->volume;
 	if (*parser->input == '\0')
 		return 0;
-	if (consume_char(parser, ',') < 0)
+	if (consume_char(parser, separator) < 0)
 		return - 1;
 	/* Legacy formats */
 	if (*parser->input == '\0')
@@ -1320,31 +1668,44 @@ static int parse_additions(struct parser_state *parser, oshu::hit *hit)
 /* Global interface **********************************************************/
 
 /**
- * Create the parser state, then read the input file line-by-line, feeding it
- * to the parser automaton with #process_input.
+ * Create the parser state, then split the input buffer into lines, feeding
+ * them to the parser automaton with #process_input.
+ *
+ * The buffer is modified in place: every end of line, along with the trailing
+ * spaces, is overwritten with null terminators, so that each line looks like
+ * a C string to the parser. The strings of the beatmap end up pointing inside
+ * that buffer, so it must live as long as the beatmap.
+ *
+ * *buffer* must contain *size* bytes, followed by a null terminator.
  *
  * \todo
  * Stop reading the file if the header is incorrect. It's no use printing a
  * mega list of warnings if the file clearly looks nothing like text.
  */
-static int parse_file(FILE *input, const char *name, oshu::beatmap *beatmap, bool headers_only)
+static int parse_buffer(char *buffer, size_t size, const char *name, oshu::beatmap *beatmap, oshu::builder *builder)
 {
 	struct parser_state parser;
-	memset(&parser, 0, sizeof(parser));
-	parser.section = BEATMAP_HEADER;
 	parser.source = name;
 	parser.beatmap = beatmap;
-	parser.last_hit = beatmap->hits;
+	parser.builder = builder;
+	parser.end = buffer + size;
+	parser.hit = (oshu::hit*) calloc(2, sizeof(*parser.hit));
+	assert (parser.hit != NULL);
+	parser.last_hit = parser.hit + 1;
+	parser.last_hit->time = -INFINITY;
 	int rc = 0;
-	char *line = NULL;
-	size_t len = 0;
-	ssize_t nread;
-	while ((nread = getline(&line, &len, input)) != -1) {
-		for (int i = nread - 1; i >= 0 && isspace(line[i]); --i)
-			line[i] = '\0';
+	char *line = buffer;
+	while (line < parser.end) {
+		char *eol = (char*) memchr(line, '\n', parser.end - line);
+		if (eol == NULL)
+			eol = parser.end;
+		*eol = '\0';
+		for (char *c = eol - 1; c >= line && isspace(*c); --c)
+			*c = '\0';
 		parser.buffer = line;
 		parser.input = line;
 		parser.line_number++;
+		enum beatmap_section section = parser.section;
 		try {
 			process_input(&parser);
 		} catch (invalid_header& e) {
@@ -1353,30 +1714,49 @@ static int parse_file(FILE *input, const char *name, oshu::beatmap *beatmap, boo
 			break;
 		}
 		/* ^ note: ignore parsing errors */
-		if (headers_only && parser.section == BEATMAP_TIMING_POINTS)
+		if (parser.stop)
 			break;
+		line = eol + 1;
+		if (parser.section == BEATMAP_HIT_OBJECTS && section != BEATMAP_HIT_OBJECTS)
+			line = process_hit_object_section(&parser, line);
 	}
-	free(line);
-	/* Finalize the hits sequence. */
-	oshu::hit *end;
-	end = (oshu::hit*) calloc(1, sizeof(*end));
-	assert (end != NULL);
-	end->time = INFINITY;
-	parser.last_hit->next = end;
-	end->previous = parser.last_hit;
+	free(parser.hit);
+	if (rc == 0)
+		emit_headers(&parser);
+	if (!parser.stop)
+		builder->end();
 	return rc;
 }
 
 /**
- * Initialize the beatmap to its defaults, and add the first unreachable hit
- * object.
+ * Read the whole file into a single null-terminated buffer.
+ *
+ * The file may come from an archive, as described in \ref core_vfs. The
+ * parser writes into its buffer, so the contents are copied once, whatever
+ * the number of lines. On success, the buffer must be freed with *free*.
+ */
+static int read_file(const char *path, char **buffer, size_t *size)
+{
+	oshu::file_view file;
+	if (oshu::open_file(path, &file) < 0) {
+		oshu_log_error("could not read the beatmap");
+		return -1;
+	}
+	*size = file.size;
+	*buffer = (char*) malloc(*size + 1);
+	assert (*buffer != NULL);
+	memcpy(*buffer, file.data, *size);
+	(*buffer)[*size] = '\0';
+	oshu::close_file(&file);
+	return 0;
+}
+
+/**
+ * Initialize the beatmap to its defaults.
  */
-void initialize(oshu::beatmap *beatmap)
+static void initialize(oshu::beatmap *beatmap)
 {
 	memcpy(beatmap, &default_beatmap, sizeof(*beatmap));
-	beatmap->hits = (oshu::hit*) calloc(1, sizeof(*beatmap->hits));
-	assert (beatmap->hits != NULL);
-	beatmap->hits->time = -INFINITY;
 }
 
 static int validate_metadata(oshu::metadata *meta)
@@ -1407,27 +1787,15 @@ static int validate(oshu::beatmap *beatmap)
 	return 0;
 }
 
-static int load_beatmap(const char *path, oshu::beatmap *beatmap, bool headers_only)
-
+/**
+ * Parse a null-terminated buffer allocated with *malloc*, and take ownership
+ * of it.
+ */
+static int load_buffer(char *buffer, size_t size, const char *name, oshu::beatmap *beatmap, oshu::builder *builder)
 {
-	oshu_log_debug("loading beatmap %s", path);
-	struct stat s;
-	if (stat(path, &s) < 0) {
-		oshu_log_error("could not find the beatmap: %s", strerror(errno));
-		return -1;
-	}
-	if (!(S_ISREG(s.st_mode) || S_ISLNK(s.st_mode))) {
-		oshu_log_error("not a file: %s", path);
-		return -1;
-	}
-	FILE *input = fopen(path, "r");
-	if (input == NULL) {
-		oshu_log_error("could not open the beatmap: %s", strerror(errno));
-		return -1;
-	}
-	initialize(beatmap);
-	int rc = parse_file(input, path, beatmap, headers_only);
-	fclose(input);
+	beatmap->contents = buffer;
+	int rc = parse_buffer(buffer, size, name, beatmap, builder);
+	oshu::track_beatmap_memory(beatmap, size + 1);
 	if (rc < 0)
 		goto fail;
 	if (validate(beatmap) < 0)
@@ -1435,85 +1803,234 @@ static int load_beatmap(const char *path, oshu::beatmap *beatmap, bool headers_o
 	return 0;
 fail:
 	oshu_log_error("error loading the beatmap file");
-	oshu::destroy_beatmap(beatmap);
 	return -1;
 }
 
+int oshu::load_beatmap(const char *path, oshu::beatmap *beatmap, oshu::builder *builder)
+{
+	oshu_log_debug("loading beatmap %s", path);
+	initialize(beatmap);
+	char *buffer;
+	size_t size;
+	if (read_file(path, &buffer, &size) < 0)
+		return -1;
+	return load_buffer(buffer, size, path, beatmap, builder);
+}
+
+/**
+ * The default builder, storing everything into the #oshu::beatmap's linked
+ * lists.
+ *
+ * The objects are allocated from the beatmap's arena. Thanks to the section
+ * size hints, all the timing points end up in one block, and all the hits in
+ * another, in chronological order.
+ *
+ * The hits list is enclosed by two sentinels, as described in
+ * #oshu::beatmap::hits.
+ */
+struct beatmap_builder : public oshu::builder {
+	bool headers(oshu::beatmap&) override;
+	void expect_timing_points(size_t) override;
+	void expect_hit_objects(size_t) override;
+	oshu::timing_point* timing_point(const oshu::timing_point&) override;
+	oshu::color* color(const oshu::color&) override;
+	bool hit_object(oshu::hit&) override;
+	void end() override;
+	oshu::beatmap *beatmap = nullptr;
+	oshu::timing_point *last_timing_point = nullptr;
+	/**
+	 * Allocated size of #oshu::beatmap::timing_index.
+	 */
+	size_t timing_capacity = 0;
+	oshu::color *last_color = nullptr;
+	oshu::hit *last_hit = nullptr;
+};
+
+/**
+ * Add the first unreachable hit object.
+ */
+bool beatmap_builder::headers(oshu::beatmap &b)
+{
+	beatmap = &b;
+	beatmap->hits = oshu::arena_new<oshu::hit>(&beatmap->arena);
+	beatmap->hits->time = -INFINITY;
+	last_hit = beatmap->hits;
+	return true;
+}
+
+/**
+ * Allocate the timing point index, along with the timing points themselves.
+ *
+ * In the unlikely case where a beatmap has many [TimingPoints] sections, the
+ * index is reallocated to make room for the new ones.
+ */
+void beatmap_builder::expect_timing_points(size_t count)
+{
+	size_t capacity = beatmap->timing_point_count + count;
+	oshu::arena_reserve(&beatmap->arena, capacity * sizeof(oshu::timing_point*) + count * sizeof(oshu::timing_point));
+	oshu::timing_point **index = (oshu::timing_point**) oshu::arena_alloc(&beatmap->arena, capacity * sizeof(*index));
+	if (beatmap->timing_index)
+		memcpy(index, beatmap->timing_index, beatmap->timing_point_count * sizeof(*index));
+	beatmap->timing_index = index;
+	timing_capacity = capacity;
+}
+
+/**
+ * Reserve room for the final sentinel too.
+ */
+void beatmap_builder::expect_hit_objects(size_t count)
+{
+	oshu::arena_reserve(&beatmap->arena, (count + 1) * sizeof(oshu::hit));
+}
+
+oshu::timing_point* beatmap_builder::timing_point(const oshu::timing_point &t)
+{
+	oshu::timing_point *timing = oshu::arena_new<oshu::timing_point>(&beatmap->arena);
+	memcpy(timing, &t, sizeof(*timing));
+	if (last_timing_point)
+		last_timing_point->next = timing;
+	else
+		beatmap->timing_points = timing;
+	last_timing_point = timing;
+	assert ((size_t) beatmap->timing_point_count < timing_capacity);
+	beatmap->timing_index[beatmap->timing_point_count++] = timing;
+	return timing;
+}
+
+oshu::color* beatmap_builder::color(const oshu::color &c)
+{
+	oshu::color *color = oshu::arena_new<oshu::color>(&beatmap->arena);
+	memcpy(color, &c, sizeof(*color));
+	if (last_color)
+		last_color->next = color;
+	last_color = color;
+	if (!beatmap->colors)
+		beatmap->colors = color;
+	color->next = beatmap->colors;
+	beatmap->color_count++;
+	return color;
+}
+
+bool beatmap_builder::hit_object(oshu::hit &h)
+{
+	oshu::hit *hit = oshu::arena_new<oshu::hit>(&beatmap->arena);
+	memcpy((void*) hit, &h, sizeof(*hit));
+	last_hit->next = hit;
+	hit->previous = last_hit;
+	last_hit = hit;
+	return true;
+}
+
+/**
+ * Finalize the hits sequence.
+ */
+void beatmap_builder::end()
+{
+	if (!last_hit)
+		return;
+	oshu::hit *end = oshu::arena_new<oshu::hit>(&beatmap->arena);
+	end->time = INFINITY;
+	last_hit->next = end;
+	end->previous = last_hit;
+}
+
+/**
+ * Builder for #oshu::load_beatmap_headers, stopping as soon as the headers are
+ * parsed and storing nothing.
+ */
+struct headers_builder : public oshu::builder {
+	bool headers(oshu::beatmap&) override { return false; }
+};
+
 int oshu::load_beatmap(const char *path, oshu::beatmap *beatmap)
 {
-	return ::load_beatmap(path, beatmap, false);
+	beatmap_builder builder;
+	if (oshu::load_beatmap(path, beatmap, &builder) < 0) {
+		oshu::destroy_beatmap(beatmap);
+		return -1;
+	}
+	return 0;
 }
 
-int oshu::load_beatmap_headers(const char *path, oshu::beatmap *beatmap)
+int oshu::parse_beatmap(const char *data, size_t size, const char *name, oshu::beatmap *beatmap)
 {
-	return ::load_beatmap(path, beatmap, true);
+	initialize(beatmap);
+	char *buffer = (char*) malloc(size + 1);
+	assert (buffer != NULL);
+	memcpy(buffer, data, size);
+	buffer[size] = '\0';
+	beatmap_builder builder;
+	if (load_buffer(buffer, size, name, beatmap, &builder) < 0) {
+		oshu::destroy_beatmap(beatmap);
+		return -1;
+	}
+	return 0;
 }
 
-static void free_metadata(oshu::metadata *meta)
+int oshu::load_beatmap_headers(const char *path, oshu::beatmap *beatmap)
 {
-	free(meta->title);
-	free(meta->title_unicode);
-	free(meta->artist);
-	free(meta->artist_unicode);
-	free(meta->creator);
-	free(meta->version);
-	free(meta->source);
+	headers_builder builder;
+	if (oshu::load_beatmap(path, beatmap, &builder) < 0) {
+		oshu::destroy_beatmap(beatmap);
+		return -1;
+	}
+	return 0;
 }
 
 static void free_path(oshu::path *path)
 {
 	/* Explicitly invoke the destructor. */
-	if (path->type == oshu::BEZIER_PATH)
+	if (path->type == oshu::BEZIER_PATH || path->type == oshu::CATMULL_PATH)
 		path->bezier.~bezier();
 	else if (path->type == oshu::LINEAR_PATH)
 		path->line.~line();
 	else if (path->type == oshu::PERFECT_PATH)
 		path->arc.~arc();
+	else
+		return;
+	path->polyline.~line();
 }
 
-static void free_hits(oshu::hit *hits)
+static void free_slider(oshu::slider *slider)
 {
-	oshu::hit *current = hits;
-	while (current != NULL) {
-		oshu::hit *next = current->next;
-		if (current->type & oshu::SLIDER_HIT) {
-			free_path(&current->slider.path);
-			free(current->slider.sounds);
-		}
-		free(current);
-		current = next;
-	}
+	free_path(&slider->path);
+	free(slider->sounds);
 }
 
-static void free_timing_points(oshu::timing_point *t)
+/**
+ * The hits are in the beatmap's arena, but their slider paths have
+ * destructors to call.
+ */
+static void free_hits(oshu::hit *hits)
 {
-	oshu::timing_point *current = t;
-	while (current != NULL) {
-		oshu::timing_point *next = current->next;
-		free(current);
-		current = next;
+	for (oshu::hit *current = hits; current != NULL; current = current->next) {
+		if (current->type & oshu::SLIDER_HIT)
+			free_slider(&current->slider);
 	}
 }
 
-static void free_colors(oshu::color *colors)
+void oshu::track_beatmap_memory(oshu::beatmap *beatmap, size_t contents_size)
 {
-	if (!colors)
-		return;
-	oshu::color *current = colors;
-	do {
-		oshu::color *next = current->next;
-		free(current);
-		current = next;
-	} while (current != colors);
+	size_t bytes = contents_size;
+	int allocations = 1;
+	for (oshu::hit *hit = beatmap->hits; hit; hit = hit->next) {
+		if (!(hit->type & oshu::SLIDER_HIT))
+			continue;
+		bytes += oshu::path_memory(&hit->slider.path, &allocations);
+		if (hit->slider.sounds) {
+			bytes += (hit->slider.repeat + 1) * sizeof(*hit->slider.sounds);
+			++allocations;
+		}
+	}
+	beatmap->memory = bytes;
+	oshu::track_allocation(oshu::BEATMAP_MEMORY_CATEGORY, bytes, allocations);
 }
 
 void oshu::destroy_beatmap(oshu::beatmap *beatmap)
 {
-	free(beatmap->audio_filename);
-	free(beatmap->background_filename);
-	free_metadata(&beatmap->metadata);
-	free_timing_points(beatmap->timing_points);
-	free_colors(beatmap->colors);
+	oshu::track_release(oshu::BEATMAP_MEMORY_CATEGORY, beatmap->memory);
+	free(beatmap->contents);
 	free_hits(beatmap->hits);
+	oshu::destroy_arena(&beatmap->arena);
 	memset(beatmap, 0, sizeof(*beatmap));
 }
@@ -42,43 +42,41 @@
  *
  * ### SAX-like parser
  *
- * Rather than hiding the parser, it could be exposed and configurable through
- * a callback interface with virtual methods.
+ * The parser doesn't build the beatmap's lists by itself. Instead, it emits
+ * the timing points, colors and hit objects to an #oshu::builder, which
+ * decides what to keep. The main advantage is that the parsing and
+ * interpretation are separated, isolating these two complex logics, and that
+ * the library indexer can skip everything but the headers.
  *
- * ```c
- * struct builder {
- * 	virtual void title(const std::string&) {}
- * 	virtual void timing_point(const timing_point_record&) {}
- * 	virtual void color(struct color&) {}
- * 	virtual void hit_object(const hit_object_record&) {}
- * };
- * ```
+ * The default builder, which builds the full #oshu::beatmap with its linked
+ * lists, lives at the end of parser.cc along with #oshu::load_beatmap.
  *
- * With that kind of parser, it's easy to build a fast parser that, say, only
- * stores the metadata. No need to store the whole beatmap in the memory
- * everytime or make special cases in the parser.
+ * ### Parallel hit objects
  *
- * The main advantage is that the parsing and interpretation are separated,
- * isolating these two complex logics. The performance cost doesn't sound too
- * heavy.
- *
- * \todo
- * Build the SAX-like parser.
+ * Long [HitObjects] sections are parsed in two phases by
+ * #process_hit_object_section. The section is first split into lines, which
+ * are then parsed in chunks on several threads, each with its own copy of the
+ * parser state, into an array of hits. The combos depend on the previous hit,
+ * so they are computed by a final sequential pass, which also checks the order
+ * of the hits and emits them to the builder.
  *
  */
 
 #pragma once
 
 #include "beatmap/beatmap.h"
+#include "beatmap/builder.h"
 
+#include <cmath>
 #include <exception>
+#include <vector>
 
 /**
  * Enumerate all the special strings that may be found in a header file.
  *
  * Using such a structure makes it easier, and also faster, to branch on
  * sections or keys. The #parse_token function also optimizes the performance
- * by performing a dichotomic search.
+ * by looking tokens up in a perfect hash table.
  *
  * Since we're in an internal header, let's break the naming a bit and use the
  * same strings as the ones in the beatmap, with the same case.
@@ -125,9 +123,6 @@ enum beatmap_section {
  *
  * You'll note the parsing is based on an automaton model, with a transition
  * function receiving one line at a time, and updating the parser state.
- *
- * \todo
- * Consider using std::istream instead of reinventing the wheel.
  */
 struct parser_state {
 	/**
@@ -137,31 +132,42 @@ struct parser_state {
 	 * a full line. As the parsing process advances, the cursor is
 	 * incremented, until it reaches the end terminator. It is never NULL.
 	 */
-	char *input;
+	char *input = nullptr;
 	/**
 	 * The initial input state when reading a line.
 	 *
 	 * Useful to determine the column number, using the difference between
 	 * #input and #buffer.
 	 */
-	char *buffer;
+	char *buffer = nullptr;
+	/**
+	 * The end of the whole file buffer, which is null-terminated.
+	 *
+	 * Lines past the current one are still intact, with their newline
+	 * characters, which allows looking ahead.
+	 */
+	char *end = nullptr;
 	/**
 	 * The line number corresponding to the current #input, starting at 1.
 	 *
 	 * If 0, it means the parsing process hasn't begun.
 	 */
-	int line_number;
+	int line_number = 0;
 	/**
 	 * The name of the file being read, or something similar, like
 	 * `<stdin>` or some URL, who knows.
 	 */
-	const char *source;
+	const char *source = nullptr;
 	/**
-	 * The beatmap object we're filling.
+	 * The beatmap object whose headers we're filling.
 	 *
 	 * Its memory isn't handled by us.
 	 */
-	oshu::beatmap *beatmap;
+	oshu::beatmap *beatmap = nullptr;
+	/**
+	 * The receiver of the timing points, colors and hit objects.
+	 */
+	oshu::builder *builder = nullptr;
 	/**
 	 * The current section.
 	 *
@@ -173,33 +179,78 @@ struct parser_state {
 	 * matching token, as mentionned in #beatmap_section. If the section is
 	 * unknown, #section becomes #BEATMAP_UNKNOWN.
 	 */
-	enum beatmap_section section;
+	enum beatmap_section section = BEATMAP_HEADER;
+	/**
+	 * True once #oshu::builder::headers was called.
+	 */
+	bool headers_done = false;
 	/**
-	 * Keep track of the last timing point to build the linked list.
+	 * Set when the builder asked to stop the parsing.
 	 */
-	oshu::timing_point *last_timing_point;
+	bool stop = false;
 	/**
-	 * Keep track of the last color to build the circular linked list.
+	 * The timing points stored by the builder, in chronological order.
 	 */
-	oshu::color *last_color;
+	std::vector<oshu::timing_point*> timing_points;
 	/**
 	 * When parsing hit objects, we need to figure out what its timing
 	 * point is, notably to compute slider durations.
 	 *
-	 * It is NULL until the first hit object is parsed, and keeps increasing.
-	 * It must not become NULL at the end of the chain, because otherwise
-	 * we're back to the first case and will trigger an infinite loop.
+	 * This is an index in #timing_points, which keeps increasing as hit
+	 * objects appear.
+	 */
+	size_t current_timing_point = 0;
+	/**
+	 * Offset of the last parsed timing point, to detect misordered ones.
 	 */
-	oshu::timing_point *current_timing_point;
+	double last_offset = -INFINITY;
 	/**
 	 * This is the #oshu::timing_point::beat_duration of the last
 	 * non-inherited timing point.
 	 */
-	double timing_base;
+	double timing_base = 0;
+	/**
+	 * The colors stored by the builder, sorted by index.
+	 */
+	std::vector<oshu::color*> colors;
 	/**
-	 * Keep track of the last hit object to build the linked list.
+	 * Index of the last parsed color, or -1 if none was seen yet.
 	 */
-	oshu::hit *last_hit;
+	int last_color = -1;
+	/**
+	 * The hit object being parsed, which is handed to the builder.
+	 *
+	 * It is allocated once and reused for every hit object.
+	 */
+	oshu::hit *hit = nullptr;
+	/**
+	 * The previous hit object, copied from #hit before it is reset.
+	 *
+	 * It is used to check the chronological order of the hits, and to
+	 * compute combos. Only the scalar fields are meaningful. Its time is
+	 * -INFINITY until the first hit object is parsed.
+	 */
+	oshu::hit *last_hit = nullptr;
+	/**
+	 * Position of #last_hit's color in #colors.
+	 */
+	size_t last_hit_color = 0;
+};
+
+/**
+ * A line of a section split ahead of parsing, for
+ * #process_hit_object_section.
+ */
+struct section_line {
+	/**
+	 * The null-terminated line.
+	 */
+	char *text;
+	int line_number;
+	/**
+	 * Whether the line yielded a hit object.
+	 */
+	bool parsed;
 };
 
 /**
@@ -235,22 +286,26 @@ static int parse_key(P*, enum token*);
  */
 
 static int process_input(P*);
+static char* process_hit_object_section(P*, char*);
+	static void parse_hit_object_chunk(P*, struct section_line*, oshu::hit*, size_t);
 	static int process_header(P*);
 	static int process_section(P*);
+		static void emit_headers(P*);
+		static size_t count_section_lines(P*);
 	static int process_general(P*);
 		static int parse_sample_set(P*, enum oshu::sample_set_family*);
 	static int process_metadata(P*);
 	static int process_difficulty(P*);
 	static int process_event(P*);
 	static int process_timing_point(P*);
-		static int parse_timing_point(P*, oshu::timing_point**);
+		static int parse_timing_point(P*, oshu::timing_point*);
 	static int process_color(P*);
 		static int process_color_combo(P*);
-		static int parse_color(P*, oshu::color**);
+		static int parse_color(P*, oshu::color*);
 		static int parse_color_channel(P*, double*);
 		static void validate_colors(P*);
 	static int process_hit_object(P*);
-		static int parse_hit_object(P*, oshu::hit**);
+		static int parse_hit_object(P*, oshu::hit*);
 			static int parse_common_hit(P*, oshu::hit*);
 			static int parse_slider(P*, oshu::hit*);
 				static int parse_point(P*, oshu::point*);
@@ -261,7 +316,14 @@ static int process_input(P*);
 				static int parse_slider_additions(P*, oshu::hit*);
 			static int parse_spinner(P*, oshu::hit*);
 			static int parse_hold_note(P*, oshu::hit*);
-			static int parse_additions(P*, oshu::hit*);
+			static int parse_additions(P*, oshu::hit*, char);
+
+/*
+ * Memory management of the objects that the parser may allocate.
+ */
+
+static void free_path(oshu::path*);
+static void free_slider(oshu::slider*);
 
 namespace oshu {
 
@@ -51,8 +51,6 @@ static void extend_box(oshu::point p, oshu::point *top_left, oshu::point *bottom
  * Guarantees:
  * - 0 ≤ t ≤ 1
  * - 0 ≤ return value < n
- *
- * \sa bezier_map
  */
 static int focus(double *t, int n)
 {
@@ -67,78 +65,128 @@ static int focus(double *t, int n)
 }
 
 /**
- * \brief Map global *t*-coordinates to segment-wise *t*-coordinates.
- *
- * \param path Read the Bézier path object.
- * \param t Read the path's *t*-coordinates and write the segment's.
- * \param degree Write the selected segment's degree.
- * \param control_points Write the address of the first point of the segment.
- *
- * Let's explain a bit how *t* is mapped. First of all, we assume each segment
- * has the same length, and have the same portion of the [0, 1] range for *t*.
- *
- * Let's illustrate with 4 segments, using the *t*-coordinates for the path:
- *
- * ```
- *                        t=0.625
- *                           ↓
- *  ├─────────┼─────────┼─────────┼─────────┤
- * t=0      t=1/4     t=1/2     t=3/4      t=1
- * ```
- *
- * When we multiply it by 4, we get the followed scaled *t*-coordinates:
- *
- * ```
- *                         t=2.5
- *                           ↓
- *  ├─────────┼─────────┼─────────┼─────────┤
- * t=0       t=1       t=2       t=3       t=4
- * ```
+ * Scratch buffer for de Casteljau's algorithm.
  *
- * With these scaled coordinates, we just take the integral part (or floor) to
- * get the segment's index. The floating part will range from 0 to 1 which is
- * just what we need.
- *
- * From the illustration, we see that 0.625 maps to the middle of the third
- * segment, which is what we expect.
- *
- * \sa focus
+ * Beatmaps are parsed on several threads, hence the thread_local.
  */
-static void bezier_map(oshu::bezier *path, double *t, std::vector<oshu::point>& control_points)
-{
-	int segment = focus(t, path->indices.size() - 1);
-	auto start = path->control_points.begin() + path->indices[segment];
-	auto end = path->control_points.begin() + path->indices[segment+1];
-	control_points.reserve(path->indices[segment+1] - path->indices[segment]);
-	std::copy(start, end, std::back_inserter(control_points));
-}
+static thread_local std::vector<oshu::point> casteljau;
 
 /**
- * Compute the position of a point expressed in *t*-coordinates.
- *
- * The coordinates are mapped with #bezier_map, and then we just apply the
- * standard explicit definition of Bézier curves.
+ * Compute the position of a point of a segment, at *t* in the segment's own
+ * t-coordinates.
  *
  * Use de Casteljau's algorithm for numerical stability. I did come across
  * super high-degree Bézier curves on some beatmaps, and the factorial was at
  * its limits.
  */
-static oshu::point bezier_at(oshu::bezier *path, double t)
+static oshu::point segment_at(oshu::bezier *path, int segment, double t)
 {
-	std::vector<oshu::point> points;
-	bezier_map(path, &t, points);
-	oshu::point *pp = points.data();
+	auto start = path->control_points.begin() + path->indices[segment];
+	auto end = path->control_points.begin() + path->indices[segment + 1];
+	casteljau.assign(start, end);
+	oshu::point *pp = casteljau.data();
 
 	/* l is the logical length of pp.
 	 * It begins with all the points, and drops one point at every
 	 * iteration. We stop when only 1 point is left */
-	for (int l = points.size(); l > 1; --l) {
+	for (int l = casteljau.size(); l > 1; --l) {
 		for (int j = 0; j < (l - 1); ++j)
 			pp[j] = (1. - t) * pp[j] + t * pp[j+1];
 	}
 	return pp[0];
 }
 
+/**
+ * Compute the speed of a segment at *t*, in pixels per unit of t.
+ *
+ * The derivative of a Bézier curve of degree d is the Bézier curve of degree
+ * d - 1 whose control points are the differences of the consecutive control
+ * points, multiplied by d.
+ */
+static double segment_speed(oshu::bezier *path, int segment, double t)
+{
+	int first = path->indices[segment];
+	int degree = path->indices[segment + 1] - first - 1;
+	if (degree < 1)
+		return 0;
+	casteljau.resize(degree);
+	oshu::point *pp = casteljau.data();
+	for (int i = 0; i < degree; ++i)
+		pp[i] = path->control_points[first + i + 1] - path->control_points[first + i];
+	for (int l = degree; l > 1; --l) {
+		for (int j = 0; j < (l - 1); ++j)
+			pp[j] = (1. - t) * pp[j] + t * pp[j+1];
+	}
+	return degree * std::abs(pp[0]);
+}
+
+/**
+ * Nodes and weights of the 8-point Gauss–Legendre quadrature on [-1, 1],
+ * for the positive nodes. The negative ones are symmetric.
+ */
+static const double gauss_nodes[4] = {
+	0.1834346424956498, 0.5255324099163290, 0.7966664774136267, 0.9602898564975363,
+};
+static const double gauss_weights[4] = {
+	0.3626837833783620, 0.3137066458778873, 0.2223810344533745, 0.1012285362903763,
+};
+
+/**
+ * Compute the length of a segment between *a* and *b*, in the segment's
+ * t-coordinates, by integrating its speed.
+ *
+ * The speed is the square root of a polynomial, smooth except at cusps, so an
+ * 8-point Gauss–Legendre quadrature is exact to a small fraction of a pixel.
+ * The interval is split into more pieces for higher degrees, whose speed
+ * wiggles more.
+ */
+static double segment_length(oshu::bezier *path, int segment, double a, double b)
+{
+	int degree = path->indices[segment + 1] - path->indices[segment] - 1;
+	int pieces = 1 + degree / 3;
+	double step = (b - a) / pieces;
+	double length = 0;
+	for (int p = 0; p < pieces; ++p) {
+		double middle = a + (p + .5) * step;
+		double half = step / 2.;
+		for (int i = 0; i < 4; ++i) {
+			length += gauss_weights[i] * half * (
+				segment_speed(path, segment, middle - half * gauss_nodes[i]) +
+				segment_speed(path, segment, middle + half * gauss_nodes[i])
+			);
+		}
+	}
+	return length;
+}
+
+/**
+ * Find the t-coordinate of the point *length* pixels after *from* on a
+ * segment, with Newton's method on #segment_length.
+ *
+ * The first guess assumes a constant speed, which is usually close enough for
+ * 2 or 3 iterations to reach a hundredth of a pixel.
+ */
+static double segment_walk(oshu::bezier *path, int segment, double from, double length)
+{
+	static const double tolerance = .01;
+	double t = from;
+	double speed = segment_speed(path, segment, t);
+	for (int i = 0; i < 8; ++i) {
+		if (speed < epsilon) {
+			/* Stationary point, nudge forward. */
+			t = std::min(1., t + epsilon);
+			speed = segment_speed(path, segment, t);
+			continue;
+		}
+		double error = length - segment_length(path, segment, from, t);
+		if (fabs(error) < tolerance)
+			break;
+		t = std::max(from, std::min(1., t + error / speed));
+		speed = segment_speed(path, segment, t);
+	}
+	return t;
+}
+
 /**
  * Grow a Bézier path.
  *
@@ -152,8 +200,8 @@ static oshu::point bezier_at(oshu::bezier *path, double t)
  * equal to the *extension* argument, and finally adding that vector to the
  * previous point.
  *
- * The memory reallocation implies the memory must have been dynamically
- * allocated. You won't be able to grow a static path.
+ * Since the new segment is straight, its length is exactly *extension*, and
+ * is appended to #oshu::bezier::lengths without measuring it.
  */
 static int grow_bezier(oshu::bezier *bezier, double extension)
 {
@@ -173,113 +221,215 @@ static int grow_bezier(oshu::bezier *bezier, double extension)
 	bezier->control_points.reserve(n + 2);
 	bezier->control_points.push_back(end);
 	bezier->control_points.emplace_back(end + direction / std::abs(direction) * extension);
+	bezier->lengths.push_back(bezier->lengths.back() + extension);
 	return 0;
 }
 
 /**
- * Approximate the length of the segment and set-up the l-coordinate system.
- *
- * Receives a Bézier path whose #oshu::bezier::segment_count,
- * #oshu::bezier::indices and #oshu::bezier::control_points are filled, and use
- * these data to compute the #oshu::bezier::anchors field.
- *
- * Here are the steps of the normalization process:
+ * Measure the segments and set up the l-coordinate system.
  *
- * 1. Pick `n + 1` points `p_0, …, p_n` on the curve, with their t-coordinates
- *    `t_0, … t_n` such that `t_0 = 0`, `t_n = 1`, and for every i ≤ j,
- *    `t_i ≤ t_j`. The sanest choice is to take `t_i = i / n`.
- *
- * 2. For each point, compute its distance from the beginning, following the
- *    curve. `L_0 = 0` and `L_(i+1) = L_i + || p_(i+1) - p_i ||`.
- *    With this, `L_n` is the actual length of the path.
- *
- * 3. Deduce the l-coordinates of the points by normalizing the L-coordinates
- *    above such that `l_0 = 0` and `l_n = 1`: let `l_i = L_i / L`. Note that
- *    here, `L` is the *wanted* length, assuming `L ≤ L_n`. This implies
- *    `l_n ≥ 1`, which in turns implies that the final curve is cut, the
- *    desired effect.
- *
- * 4. Now, let's compute #oshu::bezier::anchors.
- *    For every anchor index `j`, let `l = j / (# of anchors - 1)`, and find
- *    `i` such that `l_i ≤ l ≤ l_(i+1)`.
- *    Compute `k` such that `l = (1-k) * l_i + k * l_(i+1)`.
- *    Hint: `k = (l - l_i) / (l_(i+1) - l_i)`.
- *    Finally, let `anchors[j] = (1-k) * t_i + k * t_(i+1)`.
+ * Receives a Bézier path whose #oshu::bezier::indices and
+ * #oshu::bezier::control_points are filled, and computes
+ * #oshu::bezier::lengths and #oshu::bezier::length.
  *
+ * Each segment is measured once, with #segment_length. When the path is too
+ * short, it's extended by a straight segment of the missing length. When it's
+ * too long, #oshu::bezier::length is what cuts it.
  */
 void normalize_bezier(oshu::bezier *bezier, double target_length)
 {
-	/* 1. Prepare the field. */
-	int n = 64;  /* arbitrary */
-	double l[n + 1];
-	double length;
-
-begin:
-	/* 2. Compute the length of the path. */
-	length = 0;
-	oshu::point prev = bezier->control_points[0];
-	for (int i = 0; i <= n; i++) {
-		double t = (double) i / n;
-		oshu::point current = bezier_at(bezier, t);
-		length += std::abs(prev - current);
-		l[i] = length;
-		prev = current;
-	}
+	int segments = bezier->indices.size() - 1;
+	bezier->lengths.resize(1);
+	bezier->lengths[0] = 0;
+	for (int i = 0; i < segments; ++i)
+		bezier->lengths.push_back(bezier->lengths.back() + segment_length(bezier, i, 0., 1.));
+	double length = bezier->lengths.back();
 	if (length + 5. < target_length) {
 		if (grow_bezier(bezier, target_length - length) >= 0)
-			goto begin;
+			length = target_length;
 	}
 	if (length < target_length)
 		/* ignore the rounding errors */
 		target_length = length;
-
-	/* 3. Deduce the l-coordinates. */
 	assert (length > 0);
-	for (int i = 0; i <= n; i++)
-		l[i] /= target_length;
-
-	/* 4. Set up the anchors. */
-	int i = 0;
-	size_t num_anchors = bezier->anchors.size();
-	for (int j = 0; j < num_anchors; j++) {
-		double my_l = (double) j / (num_anchors - 1);
-		while (!(my_l <= l[i + 1]) && i < n - 1)
-			i++;
-		assert (l[i] <= my_l);
-		double k = (l[i+1] != l[i]) ? (my_l - l[i]) / (l[i+1] - l[i]) : 0;
-		bezier->anchors[j] = (1. - k) * i / n + k * (i + 1.) / n;
-	}
+	bezier->length = target_length;
 }
 
 /**
- * Translate l-coordinates to t-coordinates.
+ * Find the segment and its t-coordinate at *distance* pixels from the start
+ * of the path.
  *
- * First, the #focus converts our l such that we have
- * `l = (1 - k) * i / n + k * (i + 1) / n`.
- *
- * Then, we get the approximate t by applying a similar relation:
- * `t = (1 - k) * anchors[i] + k * anchors[i + 1]`.
+ * The segment is found with a binary search in #oshu::bezier::lengths, and the
+ * t-coordinate by walking from the start of the segment.
+ */
+static oshu::point bezier_at_distance(oshu::bezier *bezier, double distance)
+{
+	auto &lengths = bezier->lengths;
+	int segments = lengths.size() - 1;
+	int segment = std::upper_bound(lengths.begin() + 1, lengths.end() - 1, distance) - lengths.begin() - 1;
+	assert (segment >= 0 && segment < segments);
+	double t = segment_walk(bezier, segment, 0., distance - lengths[segment]);
+	return segment_at(bezier, segment, t);
+}
+
+/**
+ * Sample the path at regular l-coordinates into #oshu::bezier::lut.
  *
- * \sa normalize_bezier
+ * The samples are taken in order, so each one is found by walking from the
+ * previous one with #segment_walk, over a few pixels, rather than from the
+ * start of its segment.
+ */
+static void build_bezier_lut(oshu::bezier *bezier)
+{
+	double length = bezier->length;
+	int n = std::max(16, std::min(4096, (int) ceil(length / oshu::lut_spacing)));
+	int segments = bezier->lengths.size() - 1;
+	bezier->lut.resize(n + 1);
+	int segment = 0;
+	double t = 0;
+	double walked = 0;
+	for (int i = 0; i <= n; ++i) {
+		double distance = length * i / n;
+		while (segment < segments - 1 && distance > bezier->lengths[segment + 1]) {
+			++segment;
+			t = 0;
+			walked = bezier->lengths[segment];
+		}
+		t = segment_walk(bezier, segment, t, distance - walked);
+		walked = distance;
+		bezier->lut[i] = segment_at(bezier, segment, t);
+	}
+}
+
+/**
+ * Interpolate linearly between the two closest points of the LUT.
  */
-static double l_to_t(oshu::bezier *bezier, double l)
+static oshu::point bezier_lut_at(oshu::bezier *bezier, double l)
 {
-	int n = bezier->anchors.size() - 1;
+	int n = bezier->lut.size() - 1;
 	int i = focus(&l, n);
-	return (1. - l) * bezier->anchors[i] + l * bezier->anchors[i + 1];
+	return (1. - l) * bezier->lut[i] + l * bezier->lut[i + 1];
 }
 
 /**
- * Every point on a Bézier line is an average of all the control points, so
- * it's safe to compute the bounding box of the polyline defined by them.
+ * Evaluate a polynomial of degree n - 1 given by its n Bernstein
+ * coefficients, with de Casteljau's algorithm.
+ */
+static double bernstein_at(const double *coefficients, int n, double t)
+{
+	static thread_local std::vector<double> scratch;
+	scratch.assign(coefficients, coefficients + n);
+	double *b = scratch.data();
+	for (int l = n; l > 1; --l) {
+		for (int j = 0; j < (l - 1); ++j)
+			b[j] = (1. - t) * b[j] + t * b[j+1];
+	}
+	return b[0];
+}
+
+/**
+ * Find the roots in ]0, *end*[ of a polynomial given by its n Bernstein
+ * coefficients, and call *found* for each.
+ *
+ * Up to degree 2, which covers the derivatives of the cubic curves, the roots
+ * are solved in closed form. Above, the sign changes are isolated on a grid
+ * fine enough for the degree, and refined by bisection.
+ */
+template <typename F>
+static void bernstein_roots(const double *c, int n, double end, F found)
+{
+	auto accept = [&](double t) { if (t > 0 && t < end) found(t); };
+	if (n == 2) {
+		if (c[0] != c[1])
+			accept(c[0] / (c[0] - c[1]));
+	} else if (n == 3) {
+		/* a(1-t)² + 2bt(1-t) + ct² = (a - 2b + c)t² + 2(b - a)t + a */
+		double qa = c[0] - 2. * c[1] + c[2], qb = 2. * (c[1] - c[0]), qc = c[0];
+		if (fabs(qa) < 1e-12) {
+			if (qb != 0)
+				accept(-qc / qb);
+			return;
+		}
+		double delta = qb * qb - 4. * qa * qc;
+		if (delta < 0)
+			return;
+		double root = sqrt(delta);
+		accept((-qb - root) / (2. * qa));
+		accept((-qb + root) / (2. * qa));
+	} else if (n > 3) {
+		int steps = 8 * n;
+		double a = 0, fa = bernstein_at(c, n, 0);
+		for (int i = 1; i <= steps; ++i) {
+			double b = end * i / steps, fb = bernstein_at(c, n, b);
+			if ((fa < 0) != (fb < 0)) {
+				double lo = a, hi = b, flo = fa;
+				for (int k = 0; k < 40; ++k) {
+					double mid = (lo + hi) / 2., fmid = bernstein_at(c, n, mid);
+					if ((fmid < 0) == (flo < 0)) {
+						lo = mid;
+						flo = fmid;
+					} else {
+						hi = mid;
+					}
+				}
+				accept((lo + hi) / 2.);
+			}
+			a = b;
+			fa = fb;
+		}
+	}
+}
+
+/**
+ * Extend the box with the extrema of a segment between t = 0 and *end*.
+ *
+ * Along each axis, the extrema are either at the ends, or where the derivative
+ * is zero. The derivative of a Bézier curve is the Bézier curve of the
+ * differences of its control points, so its Bernstein coefficients are at
+ * hand.
+ */
+static void segment_bounding_box(oshu::bezier *bezier, int segment, double end, oshu::point *top_left, oshu::point *bottom_right)
+{
+	int first = bezier->indices[segment];
+	int degree = bezier->indices[segment + 1] - first - 1;
+	extend_box(segment_at(bezier, segment, 0.), top_left, bottom_right);
+	extend_box(segment_at(bezier, segment, end), top_left, bottom_right);
+	if (degree < 2)
+		return;
+	std::vector<double> dx (degree), dy (degree);
+	for (int i = 0; i < degree; ++i) {
+		oshu::vector d = bezier->control_points[first + i + 1] - bezier->control_points[first + i];
+		dx[i] = std::real(d);
+		dy[i] = std::imag(d);
+	}
+	auto extend = [&](double t) { extend_box(segment_at(bezier, segment, t), top_left, bottom_right); };
+	bernstein_roots(dx.data(), degree, end, extend);
+	bernstein_roots(dy.data(), degree, end, extend);
+}
+
+/**
+ * Compute the exact box of the curve, from the extrema of its segments.
+ *
+ * When the path was measured, the segments past #oshu::bezier::length are
+ * left out, and the last one is cut where the slider ends. Otherwise, the
+ * whole curve is taken.
  */
 void bezier_bounding_box(oshu::bezier *bezier, oshu::point *top_left, oshu::point *bottom_right)
 {
 	assert (bezier->indices.size() > 0);
 	*top_left = *bottom_right = bezier->control_points[0];
-	int count = bezier->indices.back();
-	for (int i = 0; i < count; ++i)
-		extend_box(bezier->control_points[i], top_left, bottom_right);
+	int segments = bezier->indices.size() - 1;
+	bool measured = bezier->lengths.size() == bezier->indices.size();
+	for (int i = 0; i < segments; ++i) {
+		double end = 1.;
+		if (measured) {
+			if (bezier->lengths[i] >= bezier->length && i > 0)
+				break;
+			if (bezier->lengths[i + 1] > bezier->length)
+				end = segment_walk(bezier, i, 0., bezier->length - bezier->lengths[i]);
+		}
+		segment_bounding_box(bezier, i, end, top_left, bottom_right);
+	}
 }
 
 /* Catmull ********************************************************************/
@@ -322,16 +472,33 @@ static void expand_catmull(oshu::path *path)
 /* Lines **********************************************************************/
 
 /**
- * Simple weighted average of the starting point and end point.
+ * How many segments #line_curve walks forward before it gives up and searches.
+ */
+static const size_t line_walk_limit = 4;
+
+/**
+ * Find the segment of the polyline *t* falls in, as the index of its first
+ * point.
+ *
+ * Flattened paths may have hundreds of points, so use a binary search to find
+ * the first point past t.
+ */
+static size_t line_segment(const oshu::line *line, double t)
+{
+	auto& ts = line->distance;
+	size_t n = line->points.size();
+	return std::upper_bound(ts.begin() + 1, ts.begin() + (n - 1), t) - ts.begin() - 1;
+}
+
+/**
+ * Simple weighted average of the starting point and end point of the *i*th
+ * segment.
  */
-static oshu::point line_at(oshu::line *line, double t)
+static oshu::point line_segment_at(const oshu::line *line, size_t i, double t)
 {
-	size_t i = 0, n = line->points.size();
 	auto& ts = line->distance;
-	while (t > ts[i+1] && i < n - 1)
-		i++;
-	oshu::point& start = line->points[i];
-	oshu::point& end = line->points[i+1];
+	const oshu::point& start = line->points[i];
+	const oshu::point& end = line->points[i+1];
 	double u = (ts[i] != ts[i+1]) ? (t - ts[i]) / (ts[i+1] - ts[i]) : 0;
 	return (1 - u) * start + u * end;
 }
@@ -371,7 +538,7 @@ static void normalize_line(oshu::line *line, double target_length)
 	               [actual_length](double x){ return x / actual_length; });
 }
 
-void line_bounding_box(oshu::line *line, oshu::point *top_left, oshu::point *bottom_right)
+void line_bounding_box(const oshu::line *line, oshu::point *top_left, oshu::point *bottom_right)
 {
 	*top_left = *bottom_right = line->points.at(0);
 	std::for_each(line->points.begin() + 1, line->points.end(),
@@ -472,61 +639,269 @@ void arc_bounding_box(oshu::arc *arc, oshu::point *top_left, oshu::point *bottom
 	}
 }
 
+/* Specialized curves *********************************************************/
+
+/**
+ * \brief A polyline, evaluated in its l-coordinates.
+ *
+ * The curves below share the same interface: *at* evaluates the curve at *t*
+ * in [0, 1], and *bounding_box* computes its box. The generic functions switch
+ * on the path type once with #visit_curve, and then call the curve of that
+ * type directly, which the compiler can inline into their loops.
+ *
+ * Catmull paths have no curve of their own, since #oshu::normalize_path turns
+ * them into Bézier paths.
+ *
+ * The polyline remembers the last segment it evaluated, and walks from there
+ * when *t* grows by a few segments, which is how the batches are usually
+ * sorted. The first point, and the ones before the last or too far after it,
+ * are found with a binary search, so that a single #oshu::path_at stays
+ * logarithmic.
+ */
+struct line_curve {
+	const oshu::line *line;
+	size_t segment = 0;
+	bool seeded = false;
+	explicit line_curve(const oshu::line *line) : line(line) {}
+	oshu::point at(double t)
+	{
+		auto& ts = line->distance;
+		size_t last = line->points.size() - 2;
+		size_t steps = 0;
+		if (seeded && t >= ts[segment]) {
+			while (segment < last && ts[segment + 1] <= t && steps <= line_walk_limit) {
+				++segment;
+				++steps;
+			}
+		}
+		if (!seeded || t < ts[segment] || steps > line_walk_limit) {
+			segment = line_segment(line, t);
+			seeded = true;
+		}
+		return line_segment_at(line, segment, t);
+	}
+	void bounding_box(oshu::point *top_left, oshu::point *bottom_right)
+	{
+		line_bounding_box(line, top_left, bottom_right);
+	}
+};
+
+struct arc_curve {
+	oshu::arc *arc;
+	oshu::point at(double t) { return arc_at(arc, t); }
+	void bounding_box(oshu::point *top_left, oshu::point *bottom_right)
+	{
+		arc_bounding_box(arc, top_left, bottom_right);
+	}
+};
+
+/**
+ * A Bézier path that has no LUT, walked from its start for every point.
+ */
+struct bezier_curve {
+	oshu::bezier *bezier;
+	oshu::point at(double t) { return bezier_at_distance(bezier, t * bezier->length); }
+	void bounding_box(oshu::point *top_left, oshu::point *bottom_right)
+	{
+		bezier_bounding_box(bezier, top_left, bottom_right);
+	}
+};
+
+/**
+ * A Bézier path interpolated from its #oshu::bezier::lut.
+ */
+struct bezier_lut_curve {
+	oshu::bezier *bezier;
+	oshu::point at(double t) { return bezier_lut_at(bezier, t); }
+	void bounding_box(oshu::point *top_left, oshu::point *bottom_right)
+	{
+		bezier_bounding_box(bezier, top_left, bottom_right);
+	}
+};
+
+/**
+ * Call *f* with the curve of the path, ignoring the polyline.
+ */
+template <typename F>
+static void visit_curve(oshu::path *path, F f)
+{
+	switch (path->type) {
+	case oshu::LINEAR_PATH:
+		f(line_curve {&path->line});
+		break;
+	case oshu::BEZIER_PATH:
+		if (!path->bezier.lut.empty())
+			f(bezier_lut_curve {&path->bezier});
+		else
+			f(bezier_curve {&path->bezier});
+		break;
+	case oshu::PERFECT_PATH:
+		f(arc_curve {&path->arc});
+		break;
+	case oshu::CATMULL_PATH:
+		assert (path->type != oshu::CATMULL_PATH);
+	default:
+		assert (path->type != path->type);
+	}
+}
+
+/**
+ * Call *f* with the polyline of the path if it was flattened, or else with its
+ * curve.
+ */
+template <typename F>
+static void visit_path(oshu::path *path, F f)
+{
+	if (path->polyline.points.size() >= 2)
+		f(line_curve {&path->polyline});
+	else
+		visit_curve(path, f);
+}
+
 /* Generic interface **********************************************************/
 
 void oshu::normalize_path(oshu::path *path, double length)
 {
 	switch (path->type) {
 	case oshu::LINEAR_PATH:
-		return normalize_line(&path->line, length);
+		normalize_line(&path->line, length);
+		break;
 	case oshu::PERFECT_PATH:
-		return normalize_arc(&path->arc, length);
+		normalize_arc(&path->arc, length);
+		break;
 	case oshu::CATMULL_PATH:
 		expand_catmull(path);
 		[[fallthrough]];
 	case oshu::BEZIER_PATH:
-		return normalize_bezier(&path->bezier, length);
+		normalize_bezier(&path->bezier, length);
+		build_bezier_lut(&path->bezier);
+		break;
 	default:
 		return;
 	}
+	oshu::flatten_path(path, oshu::flatten_tolerance);
 }
 
-oshu::point oshu::path_at(oshu::path *path, double t)
+/**
+ * Map t from ℝ to [0, 1].
+ */
+static double fold(double t)
 {
-	/* map t from ℝ to [0,1] */
+	/* Most of the time, t is already there, and remainder is slow. */
+	if (t >= 0 && t <= 1)
+		return t;
 	t = fabs(remainder(t, 2.));
 	assert (-epsilon <= t && t <= 1 + epsilon);
-	switch (path->type) {
-	case oshu::LINEAR_PATH:
-		return line_at(&path->line, t);
-	case oshu::BEZIER_PATH:
-		t = l_to_t(&path->bezier, t);
-		return bezier_at(&path->bezier, t);
-	case oshu::PERFECT_PATH:
-		return arc_at(&path->arc, t);
-	case oshu::CATMULL_PATH:
-		assert (path->type != oshu::CATMULL_PATH);
-	default:
-		assert (path->type != path->type);
+	return t;
+}
+
+oshu::point oshu::path_at(oshu::path *path, double t)
+{
+	t = fold(t);
+	oshu::point p = 0;
+	visit_path(path, [&](auto curve) { p = curve.at(t); });
+	return p;
+}
+
+void oshu::path_at_many(oshu::path *path, const double *t, oshu::point *out, size_t n)
+{
+	visit_path(path, [&](auto curve) {
+		for (size_t i = 0; i < n; ++i)
+			out[i] = curve.at(fold(t[i]));
+	});
+}
+
+/**
+ * Distance from *p* to the segment [a, b].
+ */
+static double segment_distance(oshu::point p, oshu::point a, oshu::point b)
+{
+	oshu::vector ab = b - a;
+	double length2 = std::norm(ab);
+	if (length2 < epsilon)
+		return std::abs(p - a);
+	double k = std::real(std::conj(ab) * (p - a)) / length2;
+	k = std::max(0., std::min(1., k));
+	return std::abs(p - (a + k * ab));
+}
+
+/**
+ * Split the [a, b] piece of *curve* until it's flat enough, and append its
+ * points after *a* to the polyline.
+ *
+ * A few splits are forced, because an S-shaped piece might have its middle
+ * right on the chord.
+ */
+template <typename Curve>
+static void subdivide(Curve &curve, double a, oshu::point pa, double b, oshu::point pb, double tolerance, int depth, oshu::line *flat)
+{
+	static const int min_depth = 3;
+	static const int max_depth = 16;
+	double m = (a + b) / 2.;
+	oshu::point pm = curve.at(m);
+	if (depth >= max_depth || (depth >= min_depth && segment_distance(pm, pa, pb) <= tolerance)) {
+		flat->points.push_back(pb);
+		flat->distance.push_back(b);
+		return;
 	}
-	return 0;
+	subdivide(curve, a, pa, m, pm, tolerance, depth + 1, flat);
+	subdivide(curve, m, pm, b, pb, tolerance, depth + 1, flat);
+}
+
+void oshu::flatten_path(oshu::path *path, double tolerance)
+{
+	oshu::line *flat = &path->polyline;
+	flat->points.clear();
+	flat->distance.clear();
+	if (path->type == oshu::LINEAR_PATH) {
+		/* Lines are already polylines. */
+		*flat = path->line;
+		return;
+	}
+	visit_curve(path, [&](auto curve) {
+		oshu::point start = curve.at(0.);
+		flat->points.push_back(start);
+		flat->distance.push_back(0.);
+		subdivide(curve, 0., start, 1., curve.at(1.), tolerance, 0, flat);
+	});
+	flat->points.shrink_to_fit();
+	flat->distance.shrink_to_fit();
 }
 
 void oshu::path_bounding_box(oshu::path *path, oshu::point *top_left, oshu::point *bottom_right)
 {
+	visit_curve(path, [&](auto curve) { curve.bounding_box(top_left, bottom_right); });
+}
+
+template <typename T>
+static size_t vector_memory(const std::vector<T> &v, int *allocations)
+{
+	if (v.capacity() > 0)
+		++*allocations;
+	return v.capacity() * sizeof(T);
+}
+
+static size_t line_memory(const oshu::line *line, int *allocations)
+{
+	return vector_memory(line->points, allocations) + vector_memory(line->distance, allocations);
+}
+
+size_t oshu::path_memory(const oshu::path *path, int *allocations)
+{
+	size_t bytes = line_memory(&path->polyline, allocations);
 	switch (path->type) {
 	case oshu::LINEAR_PATH:
-		line_bounding_box(&path->line, top_left, bottom_right);
+		bytes += line_memory(&path->line, allocations);
 		break;
+	case oshu::CATMULL_PATH:
 	case oshu::BEZIER_PATH:
-		bezier_bounding_box(&path->bezier, top_left, bottom_right);
+		bytes += vector_memory(path->bezier.indices, allocations);
+		bytes += vector_memory(path->bezier.control_points, allocations);
+		bytes += vector_memory(path->bezier.lengths, allocations);
+		bytes += vector_memory(path->bezier.lut, allocations);
 		break;
-	case oshu::PERFECT_PATH:
-		arc_bounding_box(&path->arc, top_left, bottom_right);
-		break;
-	case oshu::CATMULL_PATH:
-		assert (path->type != oshu::CATMULL_PATH);
 	default:
-		assert (path->type != path->type);
+		break;
 	}
+	return bytes;
 }
@@ -0,0 +1,154 @@
+/**
+ * \file beatmap/stars.cc
+ * \ingroup beatmap_stars
+ *
+ * The constants come from osu!'s difficulty calculator for the standard mode,
+ * as found in `osu.Game.Rulesets.Osu/Difficulty` in 2019.
+ */
+
+#include "beatmap/stars.h"
+
+#include <algorithm>
+#include <functional>
+#include <math.h>
+
+static const double normalized_radius = 52;
+
+/**
+ * Length of the strain sections, in milliseconds.
+ */
+static const double section_length = 400;
+
+/**
+ * Weight of every peak relative to the previous, higher one.
+ */
+static const double peak_weight = .9;
+
+/**
+ * Objects closer than this in time are rated as if they were this far apart,
+ * in milliseconds.
+ */
+static const double min_delta = 50;
+
+/**
+ * Distance beyond which spacing stops making the speed strain grow, in
+ * normalized units.
+ */
+static const double single_spacing = 125;
+
+static const double rating_factor = .0675;
+
+static void start_strain(oshu::strain *strain, double multiplier, double decay)
+{
+	*strain = {};
+	strain->multiplier = multiplier;
+	strain->decay = decay;
+}
+
+/**
+ * Close the sections before *time*, and then add an object of *difficulty*
+ * to the strain.
+ */
+static void add_strain(oshu::strain *strain, double time, double delta, double difficulty)
+{
+	if (strain->section_end == 0)
+		strain->section_end = (floor(time / section_length) + 1) * section_length;
+	while (time > strain->section_end) {
+		strain->peaks.push_back(strain->peak);
+		/* The strain at the start of the next section. */
+		strain->peak = strain->value * pow(strain->decay, (strain->section_end - strain->last_time) / 1000);
+		strain->section_end += section_length;
+	}
+	strain->value = strain->value * pow(strain->decay, delta / 1000) + difficulty * strain->multiplier;
+	strain->last_time = time;
+	strain->peak = std::max(strain->peak, strain->value);
+}
+
+static double strain_difficulty(oshu::strain *strain)
+{
+	std::vector<double> &peaks = strain->peaks;
+	peaks.push_back(strain->peak);
+	std::sort(peaks.begin(), peaks.end(), std::greater<double>());
+	double difficulty = 0;
+	double weight = 1;
+	for (double peak : peaks) {
+		difficulty += peak * weight;
+		weight *= peak_weight;
+	}
+	return difficulty;
+}
+
+void oshu::start_star_rating(oshu::star_rating *rating, double circle_radius)
+{
+	*rating = {};
+	rating->scale = normalized_radius / (circle_radius > 0 ? circle_radius : 32);
+	rating->follow_radius = normalized_radius * 3;
+	start_strain(&rating->aim, 26.25, .15);
+	start_strain(&rating->speed, 1400, .3);
+}
+
+/**
+ * Walk the flattened path of a slider, with all its repeats, with a lazy
+ * cursor, and return the distance the cursor travelled.
+ */
+static double follow_slider(oshu::star_rating *rating, oshu::hit *hit)
+{
+	const std::vector<oshu::point> &points = hit->slider.path.polyline.points;
+	double travel = 0;
+	for (int r = 0; r < hit->slider.repeat; ++r) {
+		for (size_t i = 0; i < points.size(); ++i) {
+			oshu::point p = points[r % 2 ? points.size() - 1 - i : i] * rating->scale;
+			double distance = std::abs(p - rating->cursor);
+			if (distance > rating->follow_radius) {
+				double step = distance - rating->follow_radius;
+				rating->cursor += (p - rating->cursor) * (step / distance);
+				travel += step;
+			}
+		}
+	}
+	return travel;
+}
+
+void oshu::rate_hit(oshu::star_rating *rating, oshu::hit *hit)
+{
+	if (!(hit->type & (oshu::CIRCLE_HIT | oshu::SLIDER_HIT)))
+		return;
+	double time = hit->time * 1000;
+	oshu::point p = hit->p * rating->scale;
+	if (rating->started) {
+		double delta = std::max(time - rating->last_time, min_delta);
+		double jump = std::abs(p - rating->cursor);
+		double aim = (pow(rating->travel, .99) + pow(jump, .99)) / delta;
+		double distance = std::min(single_spacing, rating->travel + jump);
+		double speed = (.95 + pow(distance / single_spacing, 3.5)) / delta;
+		add_strain(&rating->aim, time, time - rating->last_time, aim);
+		add_strain(&rating->speed, time, time - rating->last_time, speed);
+	}
+	rating->started = true;
+	rating->last_time = time;
+	rating->cursor = p;
+	if ((hit->type & oshu::SLIDER_HIT) && !hit->slider.path.polyline.points.empty())
+		rating->travel = follow_slider(rating, hit);
+	else
+		rating->travel = 0;
+}
+
+double oshu::finish_star_rating(oshu::star_rating *rating)
+{
+	if (!rating->started)
+		return 0;
+	double aim = sqrt(strain_difficulty(&rating->aim)) * rating_factor;
+	double speed = sqrt(strain_difficulty(&rating->speed)) * rating_factor;
+	return aim + speed + fabs(aim - speed) / 2;
+}
+
+double oshu::compute_star_rating(oshu::beatmap *beatmap)
+{
+	oshu::star_rating rating;
+	oshu::start_star_rating(&rating, beatmap->difficulty.circle_radius);
+	if (beatmap->hits) {
+		for (oshu::hit *hit = beatmap->hits->next; hit && hit->time != INFINITY; hit = hit->next)
+			oshu::rate_hit(&rating, hit);
+	}
+	return oshu::finish_star_rating(&rating);
+}
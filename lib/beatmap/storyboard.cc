@@ -0,0 +1,738 @@
+/**
+ * \file lib/beatmap/storyboard.cc
+ * \ingroup beatmap_storyboard
+ */
+
+#include "beatmap/storyboard.h"
+
+#include "core/log.h"
+#include "core/vfs.h"
+
+#include <algorithm>
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unordered_map>
+
+/**
+ * Loops are unrolled into at most that many commands, so that a loop repeated
+ * a million times doesn't eat all the memory.
+ */
+static const size_t max_loop_commands = 100000;
+
+/**
+ * Animations with more frames than that are cut.
+ */
+static const int max_frame_count = 1000;
+
+/* Parser ********************************************************************/
+
+/**
+ * A command of the sprite being parsed, and the track it animates.
+ */
+struct raw_command {
+	enum oshu::storyboard_track track;
+	oshu::storyboard_command command;
+};
+
+struct storyboard_parser {
+	oshu::storyboard *storyboard;
+	/**
+	 * Index of every picture or animation in the storyboard's images, to
+	 * share them between the sprites.
+	 */
+	std::unordered_map<std::string, int> images;
+	/**
+	 * The `$name=value` pairs of the [Variables] section, longest names
+	 * first.
+	 */
+	std::vector<std::pair<std::string, std::string>> variables;
+	enum { OTHER_SECTION, EVENTS_SECTION, VARIABLES_SECTION } section = OTHER_SECTION;
+	int line_number = 0;
+	int invalid_lines = 0;
+	/**
+	 * The sprite being parsed, and its commands.
+	 */
+	bool in_sprite = false;
+	oshu::storyboard_sprite sprite;
+	std::vector<raw_command> commands;
+	/**
+	 * The loop or trigger the indented commands belong to.
+	 */
+	enum { NO_GROUP, LOOP_GROUP, TRIGGER_GROUP } group = NO_GROUP;
+	double loop_start;
+	int loop_count;
+	std::vector<raw_command> loop;
+	/**
+	 * The fields of the current line, kept to avoid allocating them for
+	 * every line.
+	 */
+	std::vector<char*> fields;
+};
+
+static void invalid_line(storyboard_parser *parser, const char *reason)
+{
+	oshu_log_debug("storyboard line %d: %s", parser->line_number, reason);
+	++parser->invalid_lines;
+}
+
+/**
+ * Parse a number, which must take the whole field.
+ */
+static int parse_number(const char *field, double *value)
+{
+	char *end;
+	*value = strtod(field, &end);
+	if (end == field || *end)
+		return -1;
+	return 0;
+}
+
+/**
+ * Parse a non-negative number that must fit in an int, like a frame or loop
+ * count. Fractional counts are truncated.
+ */
+static int parse_count(const char *field, int *count)
+{
+	double value;
+	if (parse_number(field, &value) < 0 || !isfinite(value) || value < 0 || value > INT_MAX)
+		return -1;
+	*count = value;
+	return 0;
+}
+
+/**
+ * Find a keyword, or its index since older storyboards use numbers.
+ *
+ * \return The index of the keyword in *names*, or -1.
+ */
+static int parse_keyword(const char *field, const char *const *names, int count)
+{
+	for (int i = 0; i < count; ++i) {
+		if (names[i] && !strcmp(field, names[i]))
+			return i;
+	}
+	char *end;
+	long index = strtol(field, &end, 10);
+	if (end == field || *end || index < 0 || index >= count)
+		return -1;
+	return index;
+}
+
+static const char *const layer_names[] = {"Background", "Fail", "Pass", "Foreground", "Overlay"};
+
+static const char *const origin_names[] = {
+	"TopLeft", "Centre", "CentreLeft", "TopRight", "BottomCentre",
+	"TopCentre", "Custom", "CentreRight", "BottomLeft", "BottomRight",
+};
+
+/**
+ * The origins of #origin_names, relative to the size of the picture.
+ *
+ * Custom origins have no coordinates in the file, and are the top-left corner.
+ */
+static const oshu::point origins[] = {
+	{0, 0}, {.5, .5}, {0, .5}, {1, 0}, {.5, 1},
+	{.5, 0}, {0, 0}, {1, .5}, {0, 1}, {1, 1},
+};
+
+/**
+ * Strip the quotes around a file name, and turn its backslashes into slashes.
+ */
+static std::string parse_filename(const char *field)
+{
+	std::string name = field;
+	if (name.size() >= 2 && name.front() == '"' && name.back() == '"')
+		name = name.substr(1, name.size() - 2);
+	std::replace(name.begin(), name.end(), '\\', '/');
+	return name;
+}
+
+/**
+ * Find a picture in the storyboard's images, or add it.
+ *
+ * The frames of an animation are named after the picture, with the frame
+ * number before the extension: `sb/star.png` becomes `sb/star0.png`,
+ * `sb/star1.png`, and so on. They are added next to each other.
+ */
+static int add_image(storyboard_parser *parser, const std::string &name, int frame_count)
+{
+	std::string key = frame_count > 1 ? name + "*" + std::to_string(frame_count) : name;
+	auto it = parser->images.find(key);
+	if (it != parser->images.end())
+		return it->second;
+	std::vector<std::string> &images = parser->storyboard->images;
+	int index = images.size();
+	if (frame_count > 1) {
+		size_t dot = name.rfind('.');
+		if (dot == std::string::npos || name.find('/', dot) != std::string::npos)
+			dot = name.size();
+		for (int i = 0; i < frame_count; ++i)
+			images.push_back(name.substr(0, dot) + std::to_string(i) + name.substr(dot));
+	} else {
+		images.push_back(name);
+	}
+	parser->images[key] = index;
+	return index;
+}
+
+/**
+ * Unroll the current loop into the sprite's commands.
+ *
+ * The times of the commands in a loop are relative to the start of the loop,
+ * and every iteration lasts from the first command to the end of the last
+ * one.
+ */
+static void close_group(storyboard_parser *parser)
+{
+	if (parser->group == storyboard_parser::LOOP_GROUP && !parser->loop.empty()) {
+		double first = INFINITY, last = -INFINITY;
+		for (const raw_command &c : parser->loop) {
+			first = std::min(first, c.command.start);
+			last = std::max(last, c.command.end);
+		}
+		double duration = last - first;
+		size_t iterations = std::max(1, parser->loop_count);
+		iterations = std::min(iterations, std::max<size_t>(1, max_loop_commands / parser->loop.size()));
+		for (size_t i = 0; i < iterations; ++i) {
+			double offset = parser->loop_start + i * duration;
+			for (raw_command c : parser->loop) {
+				c.command.start += offset;
+				c.command.end += offset;
+				parser->commands.push_back(c);
+			}
+		}
+	}
+	parser->group = storyboard_parser::NO_GROUP;
+	parser->loop.clear();
+}
+
+static bool is_flag(enum oshu::storyboard_track track)
+{
+	return track >= oshu::FLIP_H_TRACK;
+}
+
+/**
+ * Store the sprite being parsed and its commands in the storyboard.
+ *
+ * Sprites without any command are never shown, and dropped.
+ */
+static void close_sprite(storyboard_parser *parser)
+{
+	if (!parser->in_sprite)
+		return;
+	close_group(parser);
+	parser->in_sprite = false;
+	std::vector<raw_command> &commands = parser->commands;
+	std::stable_sort(commands.begin(), commands.end(), [](const raw_command &a, const raw_command &b) {
+		return a.track < b.track || (a.track == b.track && a.command.start < b.command.start);
+	});
+	oshu::storyboard_sprite &sprite = parser->sprite;
+	sprite.start = INFINITY;
+	sprite.end = -INFINITY;
+	for (const raw_command &c : commands) {
+		if (is_flag(c.track))
+			continue;
+		sprite.start = std::min(sprite.start, c.command.start);
+		sprite.end = std::max(sprite.end, c.command.end);
+	}
+	if (sprite.start > sprite.end) {
+		commands.clear();
+		return;
+	}
+	oshu::storyboard *storyboard = parser->storyboard;
+	size_t c = 0;
+	for (int t = 0; t <= oshu::TRACK_COUNT; ++t) {
+		sprite.tracks[t] = storyboard->commands.size();
+		for (; c < commands.size() && commands[c].track == t; ++c)
+			storyboard->commands.push_back(commands[c].command);
+	}
+	sprite.depth = storyboard->sprites.size();
+	storyboard->sprites.push_back(sprite);
+	commands.clear();
+}
+
+/**
+ * Parse a `Sprite` or `Animation` line, whose first field was checked by the
+ * caller.
+ */
+static int parse_sprite(storyboard_parser *parser, std::vector<char*> &fields, bool animation)
+{
+	size_t expected = animation ? 9 : 6;
+	if (fields.size() < expected)
+		return -1;
+	oshu::storyboard_sprite sprite {};
+	int layer = parse_keyword(fields[1], layer_names, 5);
+	int origin = parse_keyword(fields[2], origin_names, 10);
+	if (layer < 0 || origin < 0)
+		return -1;
+	sprite.layer = (enum oshu::storyboard_layer) layer;
+	sprite.origin = origins[origin];
+	double x, y;
+	if (parse_number(fields[4], &x) < 0 || parse_number(fields[5], &y) < 0)
+		return -1;
+	sprite.position = oshu::point(x, y);
+	sprite.frame_count = 1;
+	if (animation) {
+		int count;
+		double delay;
+		if (parse_count(fields[6], &count) < 0 || parse_number(fields[7], &delay) < 0)
+			return -1;
+		sprite.frame_count = std::max(1, std::min(count, max_frame_count));
+		sprite.frame_delay = delay / 1000.;
+		sprite.loop_once = !strcmp(fields[8], "LoopOnce") || !strcmp(fields[8], "1");
+	}
+	std::string filename = parse_filename(fields[3]);
+	if (filename.empty())
+		return -1;
+	sprite.image = add_image(parser, filename, sprite.frame_count);
+	parser->sprite = sprite;
+	parser->in_sprite = true;
+	return 0;
+}
+
+/**
+ * The tracks of every command, and how many values each takes.
+ */
+struct command_type {
+	const char *name;
+	int count;
+	enum oshu::storyboard_track tracks[3];
+	/**
+	 * What the values are multiplied by to store them.
+	 */
+	double factor;
+};
+
+static const command_type command_types[] = {
+	{"F", 1, {oshu::FADE_TRACK}, 1},
+	{"M", 2, {oshu::X_TRACK, oshu::Y_TRACK}, 1},
+	{"MX", 1, {oshu::X_TRACK}, 1},
+	{"MY", 1, {oshu::Y_TRACK}, 1},
+	{"S", 1, {oshu::SCALE_TRACK}, 1},
+	{"V", 2, {oshu::SCALE_X_TRACK, oshu::SCALE_Y_TRACK}, 1},
+	{"R", 1, {oshu::ROTATION_TRACK}, 1},
+	{"C", 3, {oshu::RED_TRACK, oshu::GREEN_TRACK, oshu::BLUE_TRACK}, 1 / 255.},
+};
+
+/**
+ * Parse a command, and append it to *commands*.
+ *
+ * A command may chain several values, in which case it's repeated with the
+ * same duration, from one value to the next: `F,0,0,100,0,1,0` fades in from
+ * 0 to 100 ms, and out from 100 to 200 ms.
+ */
+static int parse_command(std::vector<char*> &fields, std::vector<raw_command> *commands)
+{
+	if (fields.size() < 5)
+		return -1;
+	double easing, start, end;
+	if (parse_number(fields[1], &easing) < 0)
+		return -1;
+	if (easing < 0 || easing > 34)
+		easing = 0;
+	if (parse_number(fields[2], &start) < 0)
+		return -1;
+	if (!*fields[3])
+		end = start;
+	else if (parse_number(fields[3], &end) < 0)
+		return -1;
+	start /= 1000.;
+	end = std::max(start, end / 1000.);
+
+	if (!strcmp(fields[0], "P")) {
+		enum oshu::storyboard_track track;
+		if (!strcmp(fields[4], "H"))
+			track = oshu::FLIP_H_TRACK;
+		else if (!strcmp(fields[4], "V"))
+			track = oshu::FLIP_V_TRACK;
+		else if (!strcmp(fields[4], "A"))
+			track = oshu::ADDITIVE_TRACK;
+		else
+			return -1;
+		commands->push_back(raw_command {track, {start, end, 1, 1, 0}});
+		return 0;
+	}
+
+	const command_type *type = nullptr;
+	for (const command_type &t : command_types) {
+		if (!strcmp(fields[0], t.name))
+			type = &t;
+	}
+	if (!type)
+		return -1;
+	size_t value_count = fields.size() - 4;
+	if (value_count % type->count)
+		return -1;
+	std::vector<double> values(value_count);
+	for (size_t i = 0; i < value_count; ++i) {
+		if (parse_number(fields[4 + i], &values[i]) < 0)
+			return -1;
+		values[i] *= type->factor;
+	}
+	size_t segments = std::max<size_t>(1, value_count / type->count - 1);
+	double duration = end - start;
+	for (size_t s = 0; s < segments; ++s) {
+		size_t from = s * type->count;
+		size_t to = value_count > (size_t) type->count ? from + type->count : from;
+		for (int i = 0; i < type->count; ++i) {
+			commands->push_back(raw_command {type->tracks[i], {
+				start + s * duration, end + s * duration,
+				(float) values[from + i], (float) values[to + i],
+				(uint8_t) easing,
+			}});
+		}
+	}
+	return 0;
+}
+
+/**
+ * Replace the variables of the [Variables] section in an event line.
+ */
+static void substitute(storyboard_parser *parser, std::string *line)
+{
+	if (parser->variables.empty() || line->find('$') == std::string::npos)
+		return;
+	for (auto &variable : parser->variables) {
+		for (size_t i = 0; (i = line->find(variable.first, i)) != std::string::npos; i += variable.second.size())
+			line->replace(i, variable.first.size(), variable.second);
+	}
+}
+
+/**
+ * Split a line on its commas, in place.
+ */
+static void split(std::string *line, std::vector<char*> *fields)
+{
+	fields->clear();
+	char *field = &(*line)[0];
+	fields->push_back(field);
+	for (char *c = field; *c; ++c) {
+		if (*c == ',') {
+			*c = '\0';
+			fields->push_back(c + 1);
+		}
+	}
+}
+
+static void parse_event(storyboard_parser *parser, std::string &line)
+{
+	substitute(parser, &line);
+	size_t depth = line.find_first_not_of(" _");
+	if (depth == std::string::npos)
+		return;
+	std::vector<char*> &fields = parser->fields;
+	split(&line, &fields);
+	fields[0] += depth;
+
+	if (depth == 0) {
+		close_sprite(parser);
+		bool animation = !strcmp(fields[0], "Animation") || !strcmp(fields[0], "6");
+		if (animation || !strcmp(fields[0], "Sprite") || !strcmp(fields[0], "4")) {
+			if (parse_sprite(parser, fields, animation) < 0)
+				invalid_line(parser, "invalid sprite");
+		}
+		/* Backgrounds, videos, breaks and samples are not part of the storyboard. */
+		return;
+	}
+	if (!parser->in_sprite)
+		return;
+	if (depth > 1) {
+		if (parser->group == storyboard_parser::LOOP_GROUP && parse_command(fields, &parser->loop) < 0)
+			invalid_line(parser, "invalid command in a loop");
+		return;
+	}
+
+	close_group(parser);
+	if (!strcmp(fields[0], "L")) {
+		double start;
+		int count;
+		if (fields.size() < 3 || parse_number(fields[1], &start) < 0 || parse_count(fields[2], &count) < 0) {
+			invalid_line(parser, "invalid loop");
+			return;
+		}
+		parser->group = storyboard_parser::LOOP_GROUP;
+		parser->loop_start = start / 1000.;
+		parser->loop_count = count;
+	} else if (!strcmp(fields[0], "T")) {
+		parser->group = storyboard_parser::TRIGGER_GROUP;
+	} else if (parse_command(fields, &parser->commands) < 0) {
+		invalid_line(parser, "invalid command");
+	}
+}
+
+static void parse_variable(storyboard_parser *parser, const std::string &line)
+{
+	size_t equal = line.find('=');
+	if (line[0] != '$' || equal == std::string::npos) {
+		invalid_line(parser, "invalid variable");
+		return;
+	}
+	parser->variables.emplace_back(line.substr(0, equal), line.substr(equal + 1));
+	std::stable_sort(parser->variables.begin(), parser->variables.end(), [](const auto &a, const auto &b) {
+		return a.first.size() > b.first.size();
+	});
+}
+
+static void parse_line(storyboard_parser *parser, std::string &line)
+{
+	if (line.empty() || !line.compare(0, 2, "//"))
+		return;
+	if (line[0] == '[') {
+		close_sprite(parser);
+		if (line == "[Events]")
+			parser->section = storyboard_parser::EVENTS_SECTION;
+		else if (line == "[Variables]")
+			parser->section = storyboard_parser::VARIABLES_SECTION;
+		else
+			parser->section = storyboard_parser::OTHER_SECTION;
+		return;
+	}
+	if (parser->section == storyboard_parser::EVENTS_SECTION)
+		parse_event(parser, line);
+	else if (parser->section == storyboard_parser::VARIABLES_SECTION)
+		parse_variable(parser, line);
+}
+
+void oshu::parse_storyboard(const char *text, size_t size, oshu::storyboard *storyboard)
+{
+	storyboard_parser parser;
+	parser.storyboard = storyboard;
+	for (size_t i = 0; i < storyboard->images.size(); ++i)
+		parser.images.emplace(storyboard->images[i], i);
+	size_t first_sprite = storyboard->sprites.size();
+
+	const char *end = text + size;
+	std::string line;
+	while (text < end) {
+		const char *eol = (const char*) memchr(text, '\n', end - text);
+		if (!eol)
+			eol = end;
+		line.assign(text, eol);
+		text = eol + 1;
+		++parser.line_number;
+		while (!line.empty() && (line.back() == '\r' || line.back() == ' '))
+			line.pop_back();
+		parse_line(&parser, line);
+	}
+	close_sprite(&parser);
+
+	/* The previous sprites keep a lower depth, and stay below. */
+	std::stable_sort(storyboard->sprites.begin(), storyboard->sprites.end(), [](const oshu::storyboard_sprite &a, const oshu::storyboard_sprite &b) {
+		return a.start < b.start;
+	});
+	if (parser.invalid_lines)
+		oshu_log_warning("skipped %d invalid storyboard lines", parser.invalid_lines);
+	oshu_log_debug("storyboard: %zu sprites, %zu commands, %zu pictures",
+	               storyboard->sprites.size() - first_sprite, storyboard->commands.size(), storyboard->images.size());
+}
+
+int oshu::read_storyboard(const char *path, oshu::storyboard *storyboard)
+{
+	oshu::file_view file;
+	if (oshu::open_file(path, &file) < 0)
+		return -1;
+	oshu::parse_storyboard((const char*) file.data, file.size, storyboard);
+	oshu::close_file(&file);
+	return 0;
+}
+
+/* Easing ********************************************************************/
+
+/**
+ * The *in* variant of every family of curves, which starts slowly.
+ */
+enum easing_family {
+	QUAD, CUBIC, QUART, QUINT, SINE, EXPO, CIRC, BACK, BOUNCE,
+};
+
+static double bounce_out(double t)
+{
+	if (t < 1 / 2.75)
+		return 7.5625 * t * t;
+	if (t < 2 / 2.75) {
+		t -= 1.5 / 2.75;
+		return 7.5625 * t * t + .75;
+	}
+	if (t < 2.5 / 2.75) {
+		t -= 2.25 / 2.75;
+		return 7.5625 * t * t + .9375;
+	}
+	t -= 2.625 / 2.75;
+	return 7.5625 * t * t + .984375;
+}
+
+static double ease_in(enum easing_family family, double t)
+{
+	switch (family) {
+	case QUAD:   return t * t;
+	case CUBIC:  return t * t * t;
+	case QUART:  return t * t * t * t;
+	case QUINT:  return t * t * t * t * t;
+	case SINE:   return 1 - cos(t * M_PI / 2);
+	case EXPO:   return t == 0 ? 0 : pow(2, 10 * (t - 1));
+	case CIRC:   return 1 - sqrt(1 - t * t);
+	case BACK:   return t * t * (2.70158 * t - 1.70158);
+	case BOUNCE: return 1 - bounce_out(1 - t);
+	}
+	return t;
+}
+
+/**
+ * The elastic curves of osu!, which overshoot and oscillate before settling.
+ * The half and quarter variants oscillate less.
+ */
+static double elastic_out(double t, double period)
+{
+	return pow(2, -10 * t) * sin((t * period - .075) * (2 * M_PI) / .3) + 1;
+}
+
+/**
+ * Map the progress *t* of a transition, in [0, 1], through its easing curve.
+ */
+static double ease(int easing, double t)
+{
+	switch (easing) {
+	case 0:  return t;
+	case 1:  return 1 - ease_in(QUAD, 1 - t);
+	case 2:  return ease_in(QUAD, t);
+	case 24: return 1 - elastic_out(1 - t, 1);
+	case 25: return elastic_out(t, 1);
+	case 26: return elastic_out(t, .5);
+	case 27: return elastic_out(t, .25);
+	case 28: return t < .5 ? (1 - elastic_out(1 - 2 * t, 1)) / 2 : elastic_out(2 * t - 1, 1) / 2 + .5;
+	}
+	/* 3 to 23 are the in, out and in-out variants of the first families,
+	 * and 29 to 34 those of the back and bounce. */
+	int index = easing < 24 ? easing - 3 : easing - 29 + 3 * BACK;
+	enum easing_family family = (enum easing_family) (index / 3);
+	switch (index % 3) {
+	case 0:  return ease_in(family, t);
+	case 1:  return 1 - ease_in(family, 1 - t);
+	default: return t < .5 ? ease_in(family, 2 * t) / 2 : 1 - ease_in(family, 2 - 2 * t) / 2;
+	}
+}
+
+/* Player ********************************************************************/
+
+void oshu::start_storyboard(const oshu::storyboard *storyboard, oshu::storyboard_player *player)
+{
+	player->storyboard = storyboard;
+	player->now = -INFINITY;
+	player->next = 0;
+	player->active.clear();
+	player->cursors.assign(storyboard->sprites.size() * oshu::TRACK_COUNT, 0);
+}
+
+void oshu::update_storyboard(oshu::storyboard_player *player, double now)
+{
+	if (now == player->now)
+		return;
+	const std::vector<oshu::storyboard_sprite> &sprites = player->storyboard->sprites;
+	if (now < player->now) {
+		/* The cursors only move forward. */
+		std::fill(player->cursors.begin(), player->cursors.begin() + player->next * oshu::TRACK_COUNT, 0);
+		player->next = 0;
+		player->active.clear();
+	}
+	player->now = now;
+
+	std::vector<uint32_t> &active = player->active;
+	active.erase(std::remove_if(active.begin(), active.end(), [&](uint32_t i) {
+		return sprites[i].end < now;
+	}), active.end());
+
+	size_t old_count = active.size();
+	for (; player->next < sprites.size() && sprites[player->next].start <= now; ++player->next) {
+		if (sprites[player->next].end >= now)
+			active.push_back(player->next);
+	}
+	if (active.size() == old_count)
+		return;
+	auto order = [&](uint32_t a, uint32_t b) {
+		if (sprites[a].layer != sprites[b].layer)
+			return sprites[a].layer < sprites[b].layer;
+		return sprites[a].depth < sprites[b].depth;
+	};
+	std::sort(active.begin() + old_count, active.end(), order);
+	std::inplace_merge(active.begin(), active.begin() + old_count, active.end(), order);
+}
+
+/**
+ * Find the command of a track that applies at *now*, moving its cursor
+ * forward.
+ *
+ * \return null when the track has no command.
+ */
+static const oshu::storyboard_command *seek_track(const oshu::storyboard *storyboard, const oshu::storyboard_sprite &sprite, uint32_t *cursors, int track, double now)
+{
+	uint32_t begin = sprite.tracks[track];
+	uint32_t end = sprite.tracks[track + 1];
+	if (begin == end)
+		return nullptr;
+	uint32_t i = begin + cursors[track];
+	while (i + 1 < end && storyboard->commands[i + 1].start <= now)
+		++i;
+	cursors[track] = i - begin;
+	return &storyboard->commands[i];
+}
+
+static double track_value(const oshu::storyboard *storyboard, const oshu::storyboard_sprite &sprite, uint32_t *cursors, int track, double now, double value)
+{
+	const oshu::storyboard_command *c = seek_track(storyboard, sprite, cursors, track, now);
+	if (!c)
+		return value;
+	if (now <= c->start)
+		return c->from;
+	if (now >= c->end)
+		return c->to;
+	double t = ease(c->easing, (now - c->start) / (c->end - c->start));
+	return c->from + (c->to - c->from) * t;
+}
+
+static bool track_flag(const oshu::storyboard *storyboard, const oshu::storyboard_sprite &sprite, uint32_t *cursors, int track, double now)
+{
+	const oshu::storyboard_command *c = seek_track(storyboard, sprite, cursors, track, now);
+	if (!c || now < c->start)
+		return false;
+	return c->start == c->end || now <= c->end;
+}
+
+bool oshu::evaluate_sprite(oshu::storyboard_player *player, uint32_t index, oshu::sprite_state *state)
+{
+	const oshu::storyboard *storyboard = player->storyboard;
+	const oshu::storyboard_sprite &sprite = storyboard->sprites[index];
+	uint32_t *cursors = &player->cursors[index * oshu::TRACK_COUNT];
+	double now = player->now;
+	auto value = [&](int track, double fallback) {
+		return track_value(storyboard, sprite, cursors, track, now, fallback);
+	};
+
+	state->alpha = std::min(1., value(FADE_TRACK, 1));
+	if (state->alpha <= 0)
+		return false;
+	double scale = value(SCALE_TRACK, 1);
+	state->scale = oshu::vector(value(SCALE_X_TRACK, 1), value(SCALE_Y_TRACK, 1)) * scale;
+	if (std::real(state->scale) == 0 || std::imag(state->scale) == 0)
+		return false;
+	state->position = oshu::point(value(X_TRACK, std::real(sprite.position)), value(Y_TRACK, std::imag(sprite.position)));
+	state->rotation = value(ROTATION_TRACK, 0);
+	state->red = value(RED_TRACK, 1);
+	state->green = value(GREEN_TRACK, 1);
+	state->blue = value(BLUE_TRACK, 1);
+	state->flip_h = track_flag(storyboard, sprite, cursors, FLIP_H_TRACK, now);
+	state->flip_v = track_flag(storyboard, sprite, cursors, FLIP_V_TRACK, now);
+	state->additive = track_flag(storyboard, sprite, cursors, ADDITIVE_TRACK, now);
+
+	int frame = 0;
+	if (sprite.frame_count > 1 && sprite.frame_delay > 0) {
+		/* Clamp before the conversion, which would overflow for far away
+		 * times or tiny delays. */
+		double elapsed = std::max(0., (now - sprite.start) / sprite.frame_delay);
+		frame = std::min(elapsed, (double) INT_MAX);
+		frame = sprite.loop_once ? std::min(frame, sprite.frame_count - 1) : frame % sprite.frame_count;
+	}
+	state->image = sprite.image + frame;
+	return true;
+}
@@ -8,9 +8,9 @@
  * This file is a bit magical as it uses a special `TOKEN` macro defined by the
  * file that includes *tokens.h*.
  *
- * It is an absolute requirement that the tokens are sorted in alphabetical order!
- * This lets us perform a dichotomic search when parsing, which makes lexing
- * orders of magnitude faster.
+ * The tokens are looked up through a perfect hash table built by the compiler,
+ * so their order doesn't matter to the parser. Keep them sorted anyway, it
+ * makes the list easier to read.
  */
 
 TOKEN(ApproachRate)
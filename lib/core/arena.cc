@@ -0,0 +1,79 @@
+/**
+ * \file lib/core/arena.cc
+ * \ingroup core_arena
+ */
+
+#include "core/arena.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace oshu {
+
+/**
+ * Alignment of every allocation, and of the data following a block header.
+ */
+static const size_t arena_alignment = alignof(max_align_t);
+
+/**
+ * Default size of a block, when nothing was reserved.
+ */
+static const size_t default_block_size = 16 * 1024;
+
+static size_t align(size_t size)
+{
+	return (size + arena_alignment - 1) & ~(arena_alignment - 1);
+}
+
+static const size_t header_size = align(sizeof(oshu::arena_block));
+
+static char* block_data(oshu::arena_block *block)
+{
+	return reinterpret_cast<char*>(block) + header_size;
+}
+
+static void new_block(oshu::arena *arena, size_t size)
+{
+	oshu::arena_block *block = (oshu::arena_block*) malloc(header_size + size);
+	assert (block != NULL);
+	block->size = size;
+	block->used = 0;
+	block->next = arena->blocks;
+	arena->blocks = block;
+	oshu::track_allocation(arena->category, header_size + size);
+}
+
+void arena_reserve(oshu::arena *arena, size_t size)
+{
+	size = align(size);
+	oshu::arena_block *block = arena->blocks;
+	if (block && block->size - block->used >= size)
+		return;
+	new_block(arena, size > default_block_size ? size : default_block_size);
+}
+
+void* arena_alloc(oshu::arena *arena, size_t size)
+{
+	size = align(size);
+	arena_reserve(arena, size);
+	oshu::arena_block *block = arena->blocks;
+	char *data = block_data(block) + block->used;
+	block->used += size;
+	memset(data, 0, size);
+	return data;
+}
+
+void destroy_arena(oshu::arena *arena)
+{
+	oshu::arena_block *block = arena->blocks;
+	while (block) {
+		oshu::arena_block *next = block->next;
+		oshu::track_release(arena->category, header_size + block->size);
+		free(block);
+		block = next;
+	}
+	arena->blocks = nullptr;
+}
+
+}
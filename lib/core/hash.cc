@@ -0,0 +1,177 @@
+/**
+ * \file lib/core/hash.cc
+ * \ingroup core_hash
+ *
+ * Implementation of XXH64, following the reference specification at
+ * https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md
+ */
+
+#include "core/hash.h"
+
+#include "core/vfs.h"
+
+#include <mutex>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <unordered_map>
+
+namespace oshu {
+
+static const uint64_t prime1 = 11400714785074694791ULL;
+static const uint64_t prime2 = 14029467366897019727ULL;
+static const uint64_t prime3 = 1609587929392839161ULL;
+static const uint64_t prime4 = 9650029242287828579ULL;
+static const uint64_t prime5 = 2870177450012600261ULL;
+
+static inline uint64_t rotl(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const unsigned char *p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint32_t read32(const unsigned char *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t input)
+{
+	acc += input * prime2;
+	acc = rotl(acc, 31);
+	return acc * prime1;
+}
+
+static inline uint64_t merge_round(uint64_t acc, uint64_t val)
+{
+	acc ^= xxh_round(0, val);
+	return acc * prime1 + prime4;
+}
+
+uint64_t hash_bytes(const void *data, size_t size, uint64_t seed)
+{
+	const unsigned char *p = (const unsigned char*) data;
+	const unsigned char *end = p + size;
+	uint64_t h;
+
+	if (size >= 32) {
+		uint64_t v1 = seed + prime1 + prime2;
+		uint64_t v2 = seed + prime2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - prime1;
+		do {
+			v1 = xxh_round(v1, read64(p));
+			v2 = xxh_round(v2, read64(p + 8));
+			v3 = xxh_round(v3, read64(p + 16));
+			v4 = xxh_round(v4, read64(p + 24));
+			p += 32;
+		} while (p + 32 <= end);
+		h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+		h = merge_round(h, v1);
+		h = merge_round(h, v2);
+		h = merge_round(h, v3);
+		h = merge_round(h, v4);
+	} else {
+		h = seed + prime5;
+	}
+
+	h += size;
+
+	for (; p + 8 <= end; p += 8) {
+		h ^= xxh_round(0, read64(p));
+		h = rotl(h, 27) * prime1 + prime4;
+	}
+	if (p + 4 <= end) {
+		h ^= (uint64_t) read32(p) * prime1;
+		h = rotl(h, 23) * prime2 + prime3;
+		p += 4;
+	}
+	for (; p < end; ++p) {
+		h ^= (*p) * prime5;
+		h = rotl(h, 11) * prime1;
+	}
+
+	h ^= h >> 33;
+	h *= prime2;
+	h ^= h >> 29;
+	h *= prime3;
+	h ^= h >> 32;
+	return h;
+}
+
+/**
+ * What identifies the version of a file on the disk, with its hash.
+ *
+ * For files inside an archive, it's the archive's.
+ */
+struct file_version {
+	dev_t device;
+	ino_t inode;
+	off_t size;
+	struct timespec mtime;
+	uint64_t hash;
+};
+
+/**
+ * Protects #known_hashes.
+ */
+static std::mutex known_hashes_mutex;
+
+/**
+ * The hashes computed by #hash_file, by path.
+ */
+static std::unordered_map<std::string, file_version> known_hashes;
+
+static bool identify(const char *path, file_version *version)
+{
+	struct stat s;
+	std::string archive, member;
+	if (stat(path, &s) < 0 && !(split_archive_path(path, &archive, &member) && stat(archive.c_str(), &s) == 0))
+		return false;
+	version->device = s.st_dev;
+	version->inode = s.st_ino;
+	version->size = s.st_size;
+	version->mtime = s.st_mtim;
+	return true;
+}
+
+static bool same_version(const file_version &a, const file_version &b)
+{
+	return a.device == b.device && a.inode == b.inode && a.size == b.size
+	       && a.mtime.tv_sec == b.mtime.tv_sec && a.mtime.tv_nsec == b.mtime.tv_nsec;
+}
+
+int hash_file(const char *path, uint64_t *hash)
+{
+	file_version version;
+	bool identified = identify(path, &version);
+	if (identified) {
+		std::lock_guard<std::mutex> lock(known_hashes_mutex);
+		auto known = known_hashes.find(path);
+		if (known != known_hashes.end() && same_version(known->second, version)) {
+			*hash = known->second.hash;
+			return 0;
+		}
+	}
+	oshu::file_view file;
+	if (oshu::open_file(path, &file) < 0)
+		return -1;
+	*hash = hash_bytes(file.data, file.size);
+	oshu::close_file(&file);
+	if (identified) {
+		version.hash = *hash;
+		std::lock_guard<std::mutex> lock(known_hashes_mutex);
+		known_hashes[path] = version;
+	}
+	return 0;
+}
+
+}
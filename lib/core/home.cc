@@ -0,0 +1,51 @@
+/**
+ * \file lib/core/home.cc
+ * \ingroup core_home
+ */
+
+#include "core/home.h"
+
+#include "core/log.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <system_error>
+
+namespace oshu {
+
+std::string get_oshu_home()
+{
+	const char *home = std::getenv("OSHU_HOME");
+	if (home && *home)
+		return home;
+	home = std::getenv("HOME");
+	if (home && *home)
+		return std::string(home) + "/.oshu";
+	throw std::runtime_error("could not locate the oshu! home");
+}
+
+void ensure_directory(const std::string &path)
+{
+	if (mkdir(path.c_str(), S_IRWXU | S_IRWXG | S_IRWXO) < 0) {
+		if (errno == EEXIST)
+			return;
+		throw std::system_error(errno, std::system_category(), "could not create directory " + path);
+	} else {
+		oshu::debug_log() << "created directory " << path << std::endl;
+	}
+}
+
+std::string get_cache_directory(const std::string &name)
+{
+	std::string path = get_oshu_home();
+	ensure_directory(path);
+	path += "/cache";
+	ensure_directory(path);
+	path += "/" + name;
+	ensure_directory(path);
+	return path;
+}
+
+}
@@ -5,7 +5,17 @@
 
 #include "core/log.h"
 
+#include "core/metrics.h"
+#include "core/trace.h"
+
+#include <atomic>
+#include <chrono>
 #include <iostream>
+#include <mutex>
+#include <sstream>
+#include <stdarg.h>
+#include <stdio.h>
+#include <thread>
 
 namespace oshu {
 
@@ -29,6 +39,236 @@ log_level& operator--(log_level &l)
 	return l;
 }
 
+}
+
+/**
+ * A message in the log queue.
+ */
+struct log_record {
+	/**
+	 * Twice the lap of the queue the record was last written in, plus one
+	 * while it holds a message that wasn't written yet.
+	 *
+	 * Zero-initialized records are free for the first lap, so the queue
+	 * works before any constructor runs.
+	 */
+	std::atomic<uint64_t> turn;
+	/**
+	 * When the message was queued, from #oshu::trace_clock.
+	 */
+	int64_t time;
+	char text[oshu::log_message_size];
+};
+
+/**
+ * Number of records in the queue. The messages past that are dropped until
+ * the writer catches up.
+ */
+static const uint64_t log_capacity = 1024;
+
+static log_record records[log_capacity];
+
+/**
+ * Position of the next record to claim, incremented by the producers.
+ */
+static std::atomic<uint64_t> write_position;
+
+/**
+ * Position of the next record to write, owned by whoever holds #reader.
+ */
+static uint64_t read_position;
+
+/**
+ * Serialize the writer thread and #oshu::flush_log. The producers never take
+ * it.
+ */
+static std::mutex reader;
+
+/**
+ * Set once the writer thread is gone, after which the messages are written
+ * right away.
+ */
+static std::atomic<bool> writer_stopped;
+
+/**
+ * How long the writer sleeps when the queue is empty.
+ */
+static const auto writer_period = std::chrono::milliseconds(10);
+
+/**
+ * Claim a record, or return null if the queue is full.
+ *
+ * The caller fills the record, and publishes it with #publish.
+ */
+static log_record* claim(uint64_t *lap)
+{
+	uint64_t position = write_position.load(std::memory_order_relaxed);
+	for (;;) {
+		log_record *record = &records[position % log_capacity];
+		uint64_t turn = record->turn.load(std::memory_order_acquire);
+		*lap = position / log_capacity * 2;
+		if (turn == *lap) {
+			if (write_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+				return record;
+		} else if (turn < *lap) {
+			/* The record of the previous lap wasn't written yet. */
+			return nullptr;
+		} else {
+			position = write_position.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+static void publish(log_record *record, uint64_t lap)
+{
+	record->turn.store(lap + 1, std::memory_order_release);
+}
+
+/**
+ * Write every published record to standard error. The caller must hold
+ * #reader.
+ */
+static void drain()
+{
+	bool timestamps = oshu::log_priority <= oshu::log_level::debug;
+	bool wrote = false;
+	for (;;) {
+		log_record *record = &records[read_position % log_capacity];
+		uint64_t lap = read_position / log_capacity * 2;
+		if (record->turn.load(std::memory_order_acquire) != lap + 1)
+			break;
+		if (timestamps)
+			fprintf(stderr, "[%12.6f] ", record->time / 1e9);
+		fputs(record->text, stderr);
+		fputc('\n', stderr);
+		record->turn.store(lap + 2, std::memory_order_release);
+		++read_position;
+		wrote = true;
+	}
+	if (wrote)
+		fflush(stderr);
+}
+
+static const char *level_name(oshu::log_level priority)
+{
+	switch (priority) {
+	case oshu::log_level::verbose: return "VERBOSE";
+	case oshu::log_level::debug: return "DEBUG";
+	case oshu::log_level::info: return "INFO";
+	case oshu::log_level::warning: return "WARNING";
+	case oshu::log_level::error: return "ERROR";
+	case oshu::log_level::critical: return "CRITICAL";
+	default: return "LOG";
+	}
+}
+
+/**
+ * Queue a message made of *prefix*, and *format* expanded with *args*.
+ */
+static void queue_message(const char *prefix, const char *format, va_list args)
+{
+	uint64_t lap;
+	log_record *record = claim(&lap);
+	if (!record) {
+		oshu::count(oshu::LOG_DROPPED);
+		return;
+	}
+	record->time = oshu::trace_clock();
+	int length = snprintf(record->text, sizeof(record->text), "%s", prefix);
+	if (length >= 0 && length < (int) sizeof(record->text))
+		vsnprintf(record->text + length, sizeof(record->text) - length, format, args);
+	publish(record, lap);
+	if (writer_stopped.load(std::memory_order_relaxed))
+		oshu::flush_log();
+}
+
+static void queue_text(const char *prefix, const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	queue_message(prefix, format, args);
+	va_end(args);
+}
+
+/**
+ * Route SDL's own messages to the queue, with the same prefixes as ours.
+ */
+static void sdl_output(void*, int, SDL_LogPriority priority, const char *message)
+{
+	char prefix[16];
+	snprintf(prefix, sizeof(prefix), "%s: ", level_name(static_cast<oshu::log_level>(priority)));
+	queue_text(prefix, "%s", message);
+}
+
+/**
+ * The background thread writing the queue, started when the library is
+ * loaded, and stopped when the process exits, after writing the last
+ * messages.
+ */
+static struct log_writer {
+	std::thread thread;
+	std::atomic<bool> stop {false};
+
+	log_writer()
+	{
+		SDL_LogSetOutputFunction(sdl_output, nullptr);
+		thread = std::thread([this] {
+			while (!stop.load()) {
+				{
+					std::lock_guard<std::mutex> lock(reader);
+					drain();
+				}
+				std::this_thread::sleep_for(writer_period);
+			}
+		});
+	}
+
+	~log_writer()
+	{
+		stop = true;
+		thread.join();
+		writer_stopped = true;
+		oshu::flush_log();
+	}
+} writer;
+
+void oshu::log_message(oshu::log_level priority, const char *format, ...)
+{
+	if (priority < oshu::log_priority)
+		return;
+	char prefix[16];
+	snprintf(prefix, sizeof(prefix), "%s: ", level_name(priority));
+	va_list args;
+	va_start(args, format);
+	queue_message(prefix, format, args);
+	va_end(args);
+}
+
+void oshu::flush_log()
+{
+	std::lock_guard<std::mutex> lock(reader);
+	drain();
+}
+
+/**
+ * Stream buffer queueing its content as one message whenever the stream is
+ * flushed, which `std::endl` does.
+ */
+struct queue_buffer : public std::stringbuf {
+	int sync() override
+	{
+		std::string text = str();
+		if (!text.empty() && text.back() == '\n')
+			text.pop_back();
+		if (!text.empty())
+			queue_text("", "%s", text.c_str());
+		str("");
+		return 0;
+	}
+};
+
+namespace oshu {
+
 /**
  * Dummy output stream.
  */
@@ -36,8 +276,10 @@ static std::ostream devnull {nullptr};
 
 std::ostream& logger(log_level priority)
 {
+	static thread_local queue_buffer buffer;
+	static thread_local std::ostream stream {&buffer};
 	if (priority >= oshu::log_priority)
-		return std::clog;
+		return stream;
 	else
 		return devnull;
 }
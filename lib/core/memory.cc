@@ -0,0 +1,60 @@
+/**
+ * \file lib/core/memory.cc
+ * \ingroup core_memory
+ */
+
+#include "core/memory.h"
+
+#include "core/log.h"
+#include "core/metrics.h"
+
+struct category_metrics {
+	const char *name;
+	enum oshu::metric_id bytes;
+	enum oshu::metric_id max_bytes;
+	enum oshu::metric_id allocations;
+};
+
+static const category_metrics categories[oshu::MEMORY_CATEGORY_COUNT] = {
+	{"beatmap", oshu::BEATMAP_HEAP, oshu::BEATMAP_HEAP_MAX, oshu::BEATMAP_ALLOCATIONS},
+	{"audio", oshu::AUDIO_HEAP, oshu::AUDIO_HEAP_MAX, oshu::AUDIO_ALLOCATIONS},
+	{"video", oshu::VIDEO_HEAP, oshu::VIDEO_HEAP_MAX, oshu::VIDEO_ALLOCATIONS},
+	{"library", oshu::LIBRARY_HEAP, oshu::LIBRARY_HEAP_MAX, oshu::LIBRARY_ALLOCATIONS},
+};
+
+void oshu::track_allocation(enum oshu::memory_category category, size_t bytes, int count)
+{
+	const category_metrics &c = categories[category];
+	int64_t usage = oshu::metrics[c.bytes].fetch_add(bytes, std::memory_order_relaxed) + bytes;
+	oshu::raise_gauge(c.max_bytes, usage);
+	oshu::count(c.allocations, count);
+}
+
+void oshu::track_release(enum oshu::memory_category category, size_t bytes)
+{
+	oshu::count(categories[category].bytes, - (int64_t) bytes);
+}
+
+void oshu::track_resize(enum oshu::memory_category category, size_t before, size_t after)
+{
+	if (before == after)
+		return;
+	const category_metrics &c = categories[category];
+	int64_t delta = (int64_t) after - (int64_t) before;
+	int64_t usage = oshu::metrics[c.bytes].fetch_add(delta, std::memory_order_relaxed) + delta;
+	oshu::raise_gauge(c.max_bytes, usage);
+	oshu::count(c.allocations);
+}
+
+void oshu::log_memory_usage()
+{
+	for (const category_metrics &c : categories) {
+		oshu_log_info("%s memory: %.1f KiB, peak %.1f KiB, %lld allocations", c.name,
+		              oshu::metrics[c.bytes].load() / 1024.,
+		              oshu::metrics[c.max_bytes].load() / 1024.,
+		              (long long) oshu::metrics[c.allocations].load());
+	}
+	oshu_log_info("texture memory: %.1f KiB, peak %.1f KiB",
+	              oshu::metrics[oshu::VIDEO_MEMORY].load() / 1024.,
+	              oshu::metrics[oshu::VIDEO_MEMORY_MAX].load() / 1024.);
+}
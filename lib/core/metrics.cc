@@ -0,0 +1,96 @@
+/**
+ * \file lib/core/metrics.cc
+ * \ingroup core_metrics
+ */
+
+#include "core/metrics.h"
+
+#include "core/log.h"
+
+#include <string>
+
+namespace oshu {
+
+std::atomic<int64_t> metrics[METRIC_COUNT] = {
+	{0}, {0}, {0}, {0}, {0}, {0}, {INT64_MAX}, {0}, {0}, {0}, {0}, {0}, {0}, {0}, {0},
+	{0}, {0}, {0}, {0}, {0}, {0}, {0}, {0}, {0}, {0}, {0}, {0},
+};
+
+}
+
+struct metric_info {
+	const char *name;
+	const char *type;
+	const char *help;
+};
+
+static const metric_info infos[oshu::METRIC_COUNT] = {
+	{"audio_callbacks_total", "counter", "Number of audio callbacks."},
+	{"audio_callback_microseconds_total", "counter", "Time spent in the audio callback."},
+	{"audio_callback_max_microseconds", "gauge", "Duration of the slowest audio callback."},
+	{"audio_underruns_total", "counter", "Audio buffers padded with silence before the end of the song."},
+	{"audio_short_reads_total", "counter", "Failed or short reads of the music decoder."},
+	{"audio_decoded_ahead_microseconds", "gauge", "Music decoded ahead of the playback."},
+	{"audio_decoded_ahead_min_microseconds", "gauge", "Lowest amount of music decoded ahead of the playback."},
+	{"clock_drift_microseconds", "gauge", "Game clock minus audio clock at the last synchronization."},
+	{"clock_drift_max_microseconds", "gauge", "Largest absolute drift between the game and audio clocks."},
+	{"log_dropped_total", "counter", "Log messages dropped because the log queue was full."},
+	{"frames_total", "counter", "Frames drawn by the game."},
+	{"missed_frames_total", "counter", "Frames drawn after their deadline."},
+	{"video_memory_bytes", "gauge", "Estimated video memory used by the textures."},
+	{"video_memory_max_bytes", "gauge", "Highest estimated video memory used by the textures."},
+	{"texture_evictions_total", "counter", "Cached textures freed to stay within the video memory budget."},
+	{"beatmap_heap_bytes", "gauge", "Memory allocated by the beatmaps."},
+	{"beatmap_heap_max_bytes", "gauge", "Highest memory allocated by the beatmaps."},
+	{"beatmap_allocations_total", "counter", "Allocations made by the beatmaps."},
+	{"audio_heap_bytes", "gauge", "Memory allocated by the audio module."},
+	{"audio_heap_max_bytes", "gauge", "Highest memory allocated by the audio module."},
+	{"audio_allocations_total", "counter", "Allocations made by the audio module."},
+	{"video_heap_bytes", "gauge", "System memory allocated by the video module."},
+	{"video_heap_max_bytes", "gauge", "Highest system memory allocated by the video module."},
+	{"video_allocations_total", "counter", "Allocations made by the video module."},
+	{"library_heap_bytes", "gauge", "Memory allocated by the library module."},
+	{"library_heap_max_bytes", "gauge", "Highest memory allocated by the library module."},
+	{"library_allocations_total", "counter", "Allocations made by the library module."},
+};
+
+void oshu::raise_gauge(enum oshu::metric_id id, int64_t value)
+{
+	int64_t current = oshu::metrics[id].load(std::memory_order_relaxed);
+	while (current < value && !oshu::metrics[id].compare_exchange_weak(current, value, std::memory_order_relaxed));
+}
+
+void oshu::lower_gauge(enum oshu::metric_id id, int64_t value)
+{
+	int64_t current = oshu::metrics[id].load(std::memory_order_relaxed);
+	while (current > value && !oshu::metrics[id].compare_exchange_weak(current, value, std::memory_order_relaxed));
+}
+
+void oshu::dump_metrics(FILE *output)
+{
+	for (int i = 0; i < oshu::METRIC_COUNT; ++i) {
+		int64_t value = oshu::metrics[i].load(std::memory_order_relaxed);
+		if (value == INT64_MAX)
+			continue;
+		fprintf(output, "# HELP oshu_%s %s\n", infos[i].name, infos[i].help);
+		fprintf(output, "# TYPE oshu_%s %s\n", infos[i].name, infos[i].type);
+		fprintf(output, "oshu_%s %lld\n", infos[i].name, (long long) value);
+	}
+}
+
+int oshu::save_metrics(const char *path)
+{
+	std::string tmp = std::string(path) + ".tmp";
+	FILE *output = fopen(tmp.c_str(), "w");
+	if (!output) {
+		oshu_log_debug("could not open %s for writing the metrics", tmp.c_str());
+		return -1;
+	}
+	oshu::dump_metrics(output);
+	if (fclose(output) != 0 || rename(tmp.c_str(), path) != 0) {
+		oshu_log_debug("could not write the metrics to %s", path);
+		remove(tmp.c_str());
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,133 @@
+/**
+ * \file lib/core/trace.cc
+ * \ingroup core_trace
+ */
+
+#include "core/trace.h"
+
+#include "core/log.h"
+#include "core/metrics.h"
+
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+#include <vector>
+
+namespace oshu {
+
+trace_ring trace_rings[ZONE_COUNT];
+
+}
+
+static const auto epoch = std::chrono::steady_clock::now();
+
+static std::atomic<int> thread_count;
+
+static int thread_number()
+{
+	static thread_local int number = thread_count++;
+	return number;
+}
+
+const char *oshu::zone_name(enum oshu::trace_zone zone)
+{
+	switch (zone) {
+	case oshu::FRAME_ZONE: return "frame";
+	case oshu::UPDATE_ZONE: return "update";
+	case oshu::DRAW_ZONE: return "draw";
+	case oshu::SLIDER_ZONE: return "slider";
+	case oshu::AUDIO_ZONE: return "audio";
+	default: return "unknown";
+	}
+}
+
+int64_t oshu::trace_clock()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+void oshu::log_startup(const char *stage, int64_t start)
+{
+	int64_t end = oshu::trace_clock();
+	oshu_log_info("startup: %s in %.1f ms, done at %.1f ms", stage, (end - start) / 1e6, end / 1e6);
+}
+
+void oshu::end_span(enum oshu::trace_zone zone, int64_t start)
+{
+	int64_t end = oshu::trace_clock();
+	oshu::trace_ring *ring = &oshu::trace_rings[zone];
+	uint64_t index = ring->count.load(std::memory_order_relaxed);
+	oshu::trace_span *span = &ring->spans[index % oshu::trace_capacity];
+	span->start.store(start, std::memory_order_relaxed);
+	span->duration.store(end - start, std::memory_order_relaxed);
+	span->thread.store(thread_number(), std::memory_order_relaxed);
+	/* Slider spans come from several threads, so the increment must be
+	 * atomic, even though two writers may get the same slot in the rare
+	 * case they end at the same time. */
+	ring->count.fetch_add(1, std::memory_order_release);
+}
+
+double oshu::span_duration(enum oshu::trace_zone zone, int age)
+{
+	oshu::trace_ring *ring = &oshu::trace_rings[zone];
+	uint64_t count = ring->count.load(std::memory_order_acquire);
+	if (age < 0 || (uint64_t) age >= count || age >= oshu::trace_capacity)
+		return 0;
+	oshu::trace_span *span = &ring->spans[(count - 1 - age) % oshu::trace_capacity];
+	return span->duration.load(std::memory_order_relaxed) / 1e9;
+}
+
+oshu::zone_stats oshu::compute_stats(enum oshu::trace_zone zone, int count)
+{
+	std::vector<double> durations;
+	for (int age = 0; age < count && age < oshu::trace_capacity; ++age) {
+		double d = oshu::span_duration(zone, age);
+		if (d <= 0)
+			break;
+		durations.push_back(d);
+	}
+	oshu::zone_stats stats {(int) durations.size(), 0, 0, 0};
+	if (durations.empty())
+		return stats;
+	for (double d : durations)
+		stats.mean += d;
+	stats.mean /= durations.size();
+	std::sort(durations.begin(), durations.end());
+	stats.p99 = durations[(durations.size() - 1) * 99 / 100];
+	stats.max = durations.back();
+	return stats;
+}
+
+int oshu::export_trace(const char *path)
+{
+	FILE *output = fopen(path, "w");
+	if (!output) {
+		oshu_log_error("could not open %s for writing the trace", path);
+		return -1;
+	}
+	fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", output);
+	const char *separator = "";
+	for (int zone = 0; zone < oshu::ZONE_COUNT; ++zone) {
+		oshu::trace_ring *ring = &oshu::trace_rings[zone];
+		uint64_t count = ring->count.load(std::memory_order_acquire);
+		uint64_t first = count > (uint64_t) oshu::trace_capacity ? count - oshu::trace_capacity : 0;
+		for (uint64_t i = first; i < count; ++i) {
+			oshu::trace_span *span = &ring->spans[i % oshu::trace_capacity];
+			fprintf(output, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+			        separator, oshu::zone_name((enum oshu::trace_zone) zone),
+			        span->thread.load(std::memory_order_relaxed),
+			        span->start.load(std::memory_order_relaxed) / 1e3,
+			        span->duration.load(std::memory_order_relaxed) / 1e3);
+			separator = ",\n";
+		}
+	}
+	fprintf(output, "%s{\"name\":\"audio_underruns\",\"ph\":\"C\",\"pid\":1,\"tid\":0,\"ts\":%.3f,\"args\":{\"count\":%lld}}",
+	        separator, oshu::trace_clock() / 1e3, (long long) oshu::metrics[oshu::AUDIO_UNDERRUNS].load());
+	fputs("\n]}\n", output);
+	if (fclose(output) != 0) {
+		oshu_log_error("error writing the trace to %s", path);
+		return -1;
+	}
+	oshu_log_info("trace written to %s", path);
+	return 0;
+}
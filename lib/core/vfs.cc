@@ -0,0 +1,381 @@
+/**
+ * \file lib/core/vfs.cc
+ * \ingroup core_vfs
+ *
+ * The zip format is described in PKWARE's APPNOTE.TXT. Only the central
+ * directory at the end of the archive is trusted for the sizes, as the local
+ * headers may defer them to a data descriptor.
+ */
+
+#include "core/vfs.h"
+
+#include "core/log.h"
+
+#include <algorithm>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <mutex>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+namespace oshu {
+
+static const uint32_t end_signature = 0x06054b50;
+static const uint32_t central_signature = 0x02014b50;
+static const uint32_t local_signature = 0x04034b50;
+
+static const size_t end_size = 22;
+static const size_t central_size = 46;
+static const size_t local_size = 30;
+
+/**
+ * Protects #archives and #entered.
+ */
+static std::mutex archives_mutex;
+
+/**
+ * The open archives, by path, so that opening many files from the same
+ * archive maps it only once.
+ */
+static std::unordered_map<std::string, std::weak_ptr<oshu::archive>> archives;
+
+/**
+ * The archive set by #oshu::enter_archive.
+ */
+static std::shared_ptr<oshu::archive> entered;
+
+static uint16_t read16(const uint8_t *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static uint32_t read32(const uint8_t *p)
+{
+	return (uint32_t) read16(p) | (uint32_t) read16(p + 2) << 16;
+}
+
+static std::string lowercase(std::string str)
+{
+	for (char &c : str)
+		c = tolower((unsigned char) c);
+	return str;
+}
+
+static void destroy_archive(oshu::archive *archive)
+{
+	if (archive->data)
+		munmap((void*) archive->data, archive->size);
+	delete archive;
+}
+
+/**
+ * Locate the end of central directory record, which is followed by a comment
+ * of at most 64 KiB.
+ */
+static const uint8_t *find_end(const oshu::archive *archive)
+{
+	if (archive->size < end_size)
+		return nullptr;
+	size_t last = archive->size - end_size;
+	size_t first = last > 0xFFFF ? last - 0xFFFF : 0;
+	for (size_t i = last + 1; i-- > first;) {
+		if (read32(archive->data + i) == end_signature)
+			return archive->data + i;
+	}
+	return nullptr;
+}
+
+static int read_central_directory(oshu::archive *archive)
+{
+	const uint8_t *end = find_end(archive);
+	if (!end) {
+		oshu_log_error("%s is not a zip archive", archive->path.c_str());
+		return -1;
+	}
+	uint16_t count = read16(end + 10);
+	uint32_t offset = read32(end + 16);
+	if (count == 0xFFFF || offset == 0xFFFFFFFF) {
+		oshu_log_error("zip64 archives are not supported: %s", archive->path.c_str());
+		return -1;
+	}
+	const uint8_t *p = archive->data + offset;
+	const uint8_t *limit = end;
+	if (offset > (size_t) (end - archive->data))
+		goto invalid;
+	archive->members.reserve(count);
+	for (uint16_t i = 0; i < count; ++i) {
+		if (p + central_size > limit || read32(p) != central_signature)
+			goto invalid;
+		uint16_t flags = read16(p + 8);
+		uint16_t name_length = read16(p + 28);
+		size_t entry_size = central_size + name_length + read16(p + 30) + read16(p + 32);
+		if (p + entry_size > limit)
+			goto invalid;
+		oshu::archive_member member;
+		member.name.assign((const char*) p + central_size, name_length);
+		member.method = read16(p + 10);
+		member.compressed_size = read32(p + 20);
+		member.size = read32(p + 24);
+		member.header_offset = read32(p + 42);
+		p += entry_size;
+		if (flags & 1) {
+			oshu_log_debug("skipping the encrypted member %s", member.name.c_str());
+			continue;
+		}
+		/* Some Windows tools write backslashes. */
+		std::replace(member.name.begin(), member.name.end(), '\\', '/');
+		if (member.name.empty() || member.name.back() == '/')
+			continue;
+		archive->index.emplace(lowercase(member.name), archive->members.size());
+		archive->members.push_back(std::move(member));
+	}
+	return 0;
+invalid:
+	oshu_log_error("invalid central directory in %s", archive->path.c_str());
+	return -1;
+}
+
+/**
+ * Map a whole file in memory, read-only.
+ *
+ * Empty files get a null map.
+ */
+static int map_file(const char *path, void **map, size_t *size)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		oshu_log_error("could not open %s: %s", path, strerror(errno));
+		return -1;
+	}
+	struct stat s;
+	if (fstat(fd, &s) < 0) {
+		oshu_log_error("could not stat %s: %s", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	if (!S_ISREG(s.st_mode)) {
+		oshu_log_error("not a file: %s", path);
+		close(fd);
+		return -1;
+	}
+	*size = s.st_size;
+	*map = nullptr;
+	if (*size > 0) {
+		*map = mmap(nullptr, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (*map == MAP_FAILED) {
+			oshu_log_error("could not map %s: %s", path, strerror(errno));
+			close(fd);
+			return -1;
+		}
+	}
+	close(fd);
+	return 0;
+}
+
+std::shared_ptr<oshu::archive> open_archive(const std::string &path)
+{
+	std::lock_guard<std::mutex> lock(archives_mutex);
+	std::shared_ptr<oshu::archive> archive = archives[path].lock();
+	if (archive)
+		return archive;
+	archive.reset(new oshu::archive, destroy_archive);
+	archive->path = path;
+	void *map;
+	if (map_file(path.c_str(), &map, &archive->size) < 0)
+		return nullptr;
+	archive->data = (const uint8_t*) map;
+	if (read_central_directory(archive.get()) < 0)
+		return nullptr;
+	oshu_log_debug("opened %s, with %zu members", path.c_str(), archive->members.size());
+	archives[path] = archive;
+	return archive;
+}
+
+bool archive_name(const std::string &path)
+{
+	return path.size() > 4 && !strcasecmp(path.c_str() + path.size() - 4, ".osz");
+}
+
+/**
+ * Tell if the path is an archive, on the disk.
+ */
+static bool archive_file(const std::string &path)
+{
+	struct stat s;
+	return archive_name(path) && stat(path.c_str(), &s) == 0 && S_ISREG(s.st_mode);
+}
+
+bool split_archive_path(const std::string &path, std::string *archive, std::string *member)
+{
+	for (size_t slash = path.find('/'); slash != std::string::npos; slash = path.find('/', slash + 1)) {
+		std::string prefix = path.substr(0, slash);
+		if (archive_file(prefix)) {
+			*archive = prefix;
+			*member = path.substr(slash + 1);
+			return true;
+		}
+	}
+	return false;
+}
+
+int enter_archive(const std::string &path)
+{
+	std::shared_ptr<oshu::archive> archive;
+	if (!path.empty() && !(archive = open_archive(path)))
+		return -1;
+	std::lock_guard<std::mutex> lock(archives_mutex);
+	entered = archive;
+	return 0;
+}
+
+/**
+ * Find a member, ignoring the case and any leading `./`.
+ */
+static const oshu::archive_member *find_member(const oshu::archive &archive, std::string name)
+{
+	while (name.compare(0, 2, "./") == 0)
+		name.erase(0, 2);
+	auto it = archive.index.find(lowercase(name));
+	return it == archive.index.end() ? nullptr : &archive.members[it->second];
+}
+
+static int inflate_member(const uint8_t *source, const oshu::archive_member &member, oshu::file_view *file)
+{
+	/* One more byte, so that malloc(0) never returns null. */
+	file->buffer = malloc(member.size + 1);
+	if (!file->buffer) {
+		oshu_log_error("could not allocate %u bytes for %s", member.size, member.name.c_str());
+		return -1;
+	}
+	z_stream z {};
+	z.next_in = (Bytef*) source;
+	z.avail_in = member.compressed_size;
+	z.next_out = (Bytef*) file->buffer;
+	z.avail_out = member.size;
+	/* Negative window bits for a raw deflate stream, without zlib header. */
+	if (inflateInit2(&z, -MAX_WBITS) != Z_OK) {
+		oshu_log_error("could not initialize zlib");
+		return -1;
+	}
+	int rc = inflate(&z, Z_FINISH);
+	inflateEnd(&z);
+	if (rc != Z_STREAM_END || z.total_out != member.size) {
+		oshu_log_error("corrupted member %s", member.name.c_str());
+		return -1;
+	}
+	file->data = (const char*) file->buffer;
+	file->size = member.size;
+	return 0;
+}
+
+/**
+ * Point the view to a member's data, or inflate it.
+ */
+static int open_member(const std::shared_ptr<oshu::archive> &archive, const oshu::archive_member &member, oshu::file_view *file)
+{
+	const uint8_t *header = archive->data + member.header_offset;
+	if (archive->size < local_size || member.header_offset > archive->size - local_size || read32(header) != local_signature)
+		goto invalid;
+	{
+		size_t offset = member.header_offset + local_size + read16(header + 26) + read16(header + 28);
+		if (offset > archive->size || member.compressed_size > archive->size - offset)
+			goto invalid;
+		file->archive = archive;
+		if (member.method == 0) {
+			if (member.compressed_size != member.size)
+				goto invalid;
+			file->data = (const char*) archive->data + offset;
+			file->size = member.size;
+			return 0;
+		} else if (member.method == Z_DEFLATED) {
+			return inflate_member(archive->data + offset, member, file);
+		} else {
+			oshu_log_error("unsupported compression method %d for %s", member.method, member.name.c_str());
+			return -1;
+		}
+	}
+invalid:
+	oshu_log_error("invalid member %s in %s", member.name.c_str(), archive->path.c_str());
+	return -1;
+}
+
+/**
+ * Find the archive and the member a path designates, either through an
+ * explicit archive in the path or through the entered archive.
+ *
+ * \return false if the path is outside any archive.
+ */
+static bool locate(const char *path, std::shared_ptr<oshu::archive> *archive, std::string *member)
+{
+	std::string archive_path;
+	if (split_archive_path(path, &archive_path, member)) {
+		*archive = open_archive(archive_path);
+		return true;
+	}
+	if (path[0] != '/') {
+		std::lock_guard<std::mutex> lock(archives_mutex);
+		if (entered && find_member(*entered, path)) {
+			*archive = entered;
+			*member = path;
+			return true;
+		}
+	}
+	return false;
+}
+
+int open_file(const char *path, oshu::file_view *file)
+{
+	*file = {};
+	std::shared_ptr<oshu::archive> archive;
+	std::string name;
+	if (locate(path, &archive, &name)) {
+		if (!archive)
+			return -1;
+		const oshu::archive_member *member = find_member(*archive, name);
+		if (!member) {
+			oshu_log_error("could not find %s in %s", name.c_str(), archive->path.c_str());
+			return -1;
+		}
+		if (open_member(archive, *member, file) < 0) {
+			oshu::close_file(file);
+			return -1;
+		}
+		return 0;
+	}
+	if (map_file(path, &file->map, &file->size) < 0)
+		return -1;
+	file->data = file->map ? (const char*) file->map : "";
+	return 0;
+}
+
+void close_file(oshu::file_view *file)
+{
+	if (file->map)
+		munmap(file->map, file->size);
+	free(file->buffer);
+	*file = {};
+}
+
+bool in_archive(const char *path)
+{
+	std::shared_ptr<oshu::archive> archive;
+	std::string name;
+	return locate(path, &archive, &name);
+}
+
+bool file_exists(const char *path)
+{
+	std::shared_ptr<oshu::archive> archive;
+	std::string name;
+	if (locate(path, &archive, &name))
+		return archive && find_member(*archive, name);
+	return access(path, R_OK) == 0;
+}
+
+}
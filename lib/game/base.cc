@@ -7,101 +7,163 @@
 
 #include "config.h"
 
+#include "beatmap/cache.h"
 #include "core/log.h"
+#include "core/trace.h"
 #include "game/base.h"
 #include "game/tty.h"
 
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
 
 #include <SDL2/SDL_image.h>
 
 static int open_beatmap(const char *beatmap_path, oshu::game_base *game)
 {
-	if (oshu::load_beatmap(beatmap_path, &game->beatmap) < 0) {
+	int64_t start = oshu::trace_clock();
+	if (oshu::load_cached_beatmap(beatmap_path, &game->beatmap) < 0) {
 		oshu_log_error("no beatmap, aborting");
 		return -1;
 	}
-	if (game->beatmap.mode != oshu::OSU_MODE) {
+	if (game->beatmap.mode != oshu::OSU_MODE && game->beatmap.mode != oshu::MANIA_MODE) {
 		oshu_log_error("unsupported game mode");
 		return -1;
 	}
 	assert (game->beatmap.hits != NULL);
 	game->hit_cursor = game->beatmap.hits;
+	oshu::build_hit_index(&game->beatmap, &game->hit_index);
+	oshu::log_startup("opening the beatmap", start);
 	return 0;
 }
 
+static void populate_library(oshu::game_base *game)
+{
+	int64_t start = oshu::trace_clock();
+	oshu::populate_library(&game->library, &game->beatmap);
+	oshu::log_startup("loading the hit sounds", start);
+}
+
+/**
+ * Open the audio, and start loading the hit sounds in the background.
+ *
+ * The samples are only needed once the game starts, and decoding them takes
+ * about as long as everything else together.
+ */
 static int open_audio(oshu::game_base *game)
 {
 	assert (game->beatmap.audio_filename != NULL);
-	if (oshu::open_audio(game->beatmap.audio_filename, &game->audio) < 0) {
+	int64_t start = oshu::trace_clock();
+	if (oshu::open_audio(game->asset_path(game->beatmap.audio_filename).c_str(), &game->audio) < 0) {
 		oshu_log_error("no audio, aborting");
 		return -1;
 	}
+	oshu::log_startup("opening the audio", start);
 	oshu::open_sound_library(&game->library, &game->audio.device_spec);
-	oshu::populate_library(&game->library, &game->beatmap);
+	game->library.beatmap_directory = game->directory;
+	try {
+		game->library_loader = std::async(std::launch::async, populate_library, game);
+	} catch (std::system_error &e) {
+		oshu_log_debug("could not start loading the hit sounds in the background: %s", e.what());
+		populate_library(game);
+	}
 	return 0;
 }
 
 namespace oshu {
 
-game_base::game_base(const char *beatmap_path)
+game_base::game_base(const char *beatmap_path, bool headless)
+: path(beatmap_path), headless(headless)
 {
+	const char *slash = strrchr(beatmap_path, '/');
+	if (slash)
+		directory.assign(beatmap_path, slash - beatmap_path);
 	if (open_beatmap(beatmap_path, this) < 0)
 		throw std::runtime_error("could not load the beatmap");
-	if (::open_audio(this) < 0)
+	if (!headless && ::open_audio(this) < 0)
 		throw std::runtime_error("could not open the audio device");
 }
 
 game_base::~game_base()
 {
+	if (library_loader.valid())
+		library_loader.wait();
 	oshu::destroy_beatmap(&beatmap);
 	oshu::close_audio(&audio);
 	oshu::close_sound_library(&library);
 }
 
+void game_base::finish_loading()
+{
+	if (library_loader.valid())
+		library_loader.get();
+}
+
+std::string game_base::asset_path(const char *filename) const
+{
+	if (directory.empty() || filename[0] == '/')
+		return filename;
+	return directory + "/" + filename;
+}
+
+/**
+ * Move the music and the clock to *target*, or just the clock when the game is
+ * headless.
+ */
+static void seek(oshu::game_base *game, double target)
+{
+	if (game->headless) {
+		game->clock.now = target;
+		return;
+	}
+	oshu::seek_music(&game->audio, target);
+	game->clock.now = oshu::music_position(&game->audio);
+}
+
 void game_base::rewind(double offset)
 {
-	oshu::seek_music(&this->audio, this->audio.music.current_timestamp - offset);
-	this->clock.now = this->audio.music.current_timestamp;
+	seek(this, this->headless ? this->clock.now - offset : oshu::music_position(&this->audio) - offset);
 	this->relinquish();
-	oshu::print_state(this);
+	oshu::print_state(this, true);
 
+	/* Keep the hits of the next second as they were, to leave a break. */
+	if (oshu::restore_checkpoint(this, this->clock.now + 1.) == 0)
+		return;
 	assert (this->hit_cursor != NULL);
 	while (this->hit_cursor->time > this->clock.now + 1.) {
-		this->hit_cursor->state = oshu::INITIAL_HIT;
+		oshu::judge(this, this->hit_cursor, oshu::INITIAL_HIT);
 		this->hit_cursor = this->hit_cursor->previous;
 	}
 }
 
 void game_base::forward(double offset)
 {
-	oshu::seek_music(&this->audio, this->audio.music.current_timestamp + offset);
-	this->clock.now = this->audio.music.current_timestamp;
+	seek(this, this->headless ? this->clock.now + offset : oshu::music_position(&this->audio) + offset);
 	this->relinquish();
 
-	oshu::print_state(this);
+	oshu::print_state(this, true);
 
 	assert (this->hit_cursor != NULL);
 	while (this->hit_cursor->time < this->clock.now + 1.) {
-		this->hit_cursor->state = oshu::SKIPPED_HIT;
+		oshu::judge(this, this->hit_cursor, oshu::SKIPPED_HIT);
 		this->hit_cursor = this->hit_cursor->next;
 	}
 }
 
 void game_base::pause()
 {
-	oshu::pause_audio(&this->audio);
+	if (!this->headless)
+		oshu::pause_audio(&this->audio);
 	this->paused = true;
-	oshu::print_state(this);
+	oshu::print_state(this, true);
 }
 
 void game_base::unpause()
 {
-	if (this->clock.now >= 0)
+	if (this->clock.now >= 0 && !this->headless)
 		oshu::play_audio(&this->audio);
 	this->paused = false;
-	oshu::print_state(this);
+	oshu::print_state(this, true);
 }
 
 }
@@ -0,0 +1,172 @@
+/**
+ * \file game/calibration.cc
+ * \ingroup game_calibration
+ */
+
+#include "game/calibration.h"
+
+#include "beatmap/beatmap.h"
+#include "core/home.h"
+#include "core/log.h"
+
+#include <cmath>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+
+void oshu::add_offset(oshu::offset_stats *stats, double offset)
+{
+	++stats->count;
+	double delta = offset - stats->mean;
+	stats->mean += delta / stats->count;
+	stats->m2 += delta * (offset - stats->mean);
+}
+
+double oshu::offset_jitter(const oshu::offset_stats *stats)
+{
+	if (stats->count < 2)
+		return 0;
+	return std::sqrt(stats->m2 / (stats->count - 1));
+}
+
+oshu::offset_stats oshu::hit_offsets(const oshu::beatmap *beatmap)
+{
+	oshu::offset_stats stats {};
+	for (oshu::hit *hit = beatmap->hits; hit; hit = hit->next) {
+		if (hit->state == oshu::GOOD_HIT)
+			oshu::add_offset(&stats, hit->offset);
+	}
+	return stats;
+}
+
+/**
+ * Find the uninherited timing point in effect at *t*, or the first one before
+ * the first timing point.
+ *
+ * The inherited timing points only change the speed of the sliders, not the
+ * beats.
+ */
+static const oshu::timing_point *beat_timing(const oshu::beatmap *beatmap, double t)
+{
+	const oshu::timing_point *base = nullptr;
+	for (const oshu::timing_point *p = beatmap->timing_points; p; p = p->next) {
+		if (base && p->offset > t)
+			break;
+		if (p->beat_duration > 0)
+			base = p;
+	}
+	return base;
+}
+
+double oshu::nearest_beat(const oshu::beatmap *beatmap, double t)
+{
+	const oshu::timing_point *base = beat_timing(beatmap, t);
+	if (!base)
+		return NAN;
+	double k = std::round((t - base->offset) / base->beat_duration);
+	return base->offset + k * base->beat_duration;
+}
+
+double oshu::next_beat(const oshu::beatmap *beatmap, double t)
+{
+	const oshu::timing_point *base = beat_timing(beatmap, t);
+	if (!base)
+		return NAN;
+	double k = std::floor((t - base->offset) / base->beat_duration) + 1;
+	double beat = base->offset + k * base->beat_duration;
+	/* t is often the previous beat, give or take a rounding error */
+	if (beat - t < 1e-4)
+		beat += base->beat_duration;
+	for (const oshu::timing_point *p = base->next; p && p->offset < beat; p = p->next) {
+		if (p->beat_duration > 0 && p->offset > t)
+			return p->offset;
+	}
+	return beat;
+}
+
+void oshu::start_calibration(oshu::calibration *calibration, double now)
+{
+	calibration->taps = {};
+	calibration->offsets.clear();
+	calibration->scheduled = now;
+	calibration->resume = now;
+}
+
+double oshu::record_tap(oshu::calibration *calibration, const oshu::beatmap *beatmap, double t)
+{
+	double beat = oshu::nearest_beat(beatmap, t);
+	if (std::isnan(beat))
+		return NAN;
+	double offset = t - beat;
+	oshu::add_offset(&calibration->taps, offset);
+	calibration->offsets.push_back(offset);
+	return offset;
+}
+
+/**
+ * Return the path of the global offset file, or an empty string when the home
+ * directory can't be located.
+ */
+static std::string offset_path()
+{
+	try {
+		return oshu::get_oshu_home() + "/offset";
+	} catch (std::exception &e) {
+		oshu_log_debug("no global offset: %s", e.what());
+		return "";
+	}
+}
+
+double oshu::load_global_offset()
+{
+	std::string path = offset_path();
+	if (path.empty())
+		return 0;
+	FILE *file = fopen(path.c_str(), "r");
+	if (!file)
+		return 0;
+	double offset;
+	int rc = fscanf(file, "%lf", &offset);
+	fclose(file);
+	if (rc != 1 || !std::isfinite(offset)) {
+		oshu_log_warning("ignoring the invalid global offset in %s", path.c_str());
+		return 0;
+	}
+	oshu_log_debug("global offset: %.1f ms", offset);
+	return offset / 1000.;
+}
+
+/**
+ * The file is written to a temporary file first, so that another instance of
+ * oshu! never reads a partial file.
+ */
+int oshu::save_global_offset(double offset)
+{
+	std::string path = offset_path();
+	if (path.empty()) {
+		oshu_log_error("could not locate the oshu! home to save the offset");
+		return -1;
+	}
+	try {
+		oshu::ensure_directory(oshu::get_oshu_home());
+	} catch (std::exception &e) {
+		oshu_log_error("%s", e.what());
+		return -1;
+	}
+	std::string tmp = path + ".tmp" + std::to_string(getpid());
+	FILE *file = fopen(tmp.c_str(), "w");
+	if (!file) {
+		oshu_log_error("could not write %s: %s", tmp.c_str(), strerror(errno));
+		return -1;
+	}
+	bool written = fprintf(file, "%.1f\n", offset * 1000.) > 0;
+	if (fclose(file) != 0 || !written || rename(tmp.c_str(), path.c_str()) < 0) {
+		oshu_log_error("could not save the global offset to %s", path.c_str());
+		unlink(tmp.c_str());
+		return -1;
+	}
+	oshu_log_info("saved the global offset of %.1f ms to %s", offset * 1000., path.c_str());
+	return 0;
+}
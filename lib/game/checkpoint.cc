@@ -0,0 +1,93 @@
+/**
+ * \file game/checkpoint.cc
+ * \ingroup game_checkpoint
+ */
+
+#include "game/checkpoint.h"
+
+#include "game/base.h"
+#include "game/spectator.h"
+
+#include <math.h>
+
+/**
+ * Save a checkpoint for every interval that started since the last one.
+ */
+static void take_checkpoints(oshu::game_base *game)
+{
+	oshu::timeline *timeline = &game->timeline;
+	oshu::tally *tally = &game->tally;
+	if (game->clock.now < 0)
+		return;
+	size_t due = floor(game->clock.now / oshu::checkpoint_interval) + 1;
+	while (timeline->checkpoints.size() < due) {
+		timeline->checkpoints.push_back(oshu::checkpoint {
+			game->hit_cursor,
+			tally->great, tally->early, tally->late, tally->missed, tally->combo, tally->max_combo,
+			tally->checkpoints.size(),
+			timeline->journal.size(),
+		});
+	}
+}
+
+void oshu::judge(oshu::game_base *game, oshu::hit *hit, enum oshu::hit_state state)
+{
+	if (hit->state == state)
+		return;
+	take_checkpoints(game);
+	oshu::judgment entry {game->clock.now, hit, hit->state, hit->offset, state, hit->offset};
+	oshu::judge_hit(&game->tally, &game->beatmap, hit, state);
+	oshu::sync_hit_state(&game->hit_index, hit);
+	game->timeline.journal.push_back(entry);
+	if (game->publishing)
+		oshu::publish_judgment(game->publishing, game, hit, state);
+}
+
+int oshu::restore_checkpoint(oshu::game_base *game, double time)
+{
+	oshu::timeline *timeline = &game->timeline;
+	if (time < 0 || timeline->checkpoints.empty())
+		return -1;
+	size_t index = floor(time / oshu::checkpoint_interval);
+	if (index >= timeline->checkpoints.size())
+		index = timeline->checkpoints.size() - 1;
+	oshu::checkpoint *checkpoint = &timeline->checkpoints[index];
+
+	std::vector<oshu::judgment> &journal = timeline->journal;
+	for (size_t i = journal.size(); i > checkpoint->journal; --i) {
+		oshu::judgment &entry = journal[i - 1];
+		entry.hit->state = entry.previous_state;
+		entry.hit->offset = entry.previous_offset;
+		oshu::sync_hit_state(&game->hit_index, entry.hit);
+	}
+
+	oshu::tally *tally = &game->tally;
+	tally->great = checkpoint->great;
+	tally->early = checkpoint->early;
+	tally->late = checkpoint->late;
+	tally->missed = checkpoint->missed;
+	tally->combo = checkpoint->combo;
+	tally->max_combo = checkpoint->max_combo;
+	tally->checkpoints.resize(checkpoint->combo_checkpoints);
+	game->hit_cursor = checkpoint->hit_cursor;
+
+	size_t end = checkpoint->journal;
+	oshu::hit *sliding = nullptr;
+	for (; end < journal.size() && journal[end].time <= time; ++end) {
+		oshu::judgment &entry = journal[end];
+		entry.hit->offset = entry.offset;
+		oshu::judge_hit(tally, &game->beatmap, entry.hit, entry.state);
+		oshu::sync_hit_state(&game->hit_index, entry.hit);
+		if (entry.state == oshu::SLIDING_HIT)
+			sliding = entry.hit;
+	}
+	/* The slider that was held at that time isn't anymore. */
+	if (sliding && sliding->state == oshu::SLIDING_HIT) {
+		sliding->state = oshu::INITIAL_HIT;
+		oshu::sync_hit_state(&game->hit_index, sliding);
+	}
+
+	journal.resize(end);
+	timeline->checkpoints.resize(index + 1);
+	return 0;
+}
@@ -6,8 +6,39 @@
 #include "game/clock.h"
 
 #include "core/log.h"
+#include "core/metrics.h"
 #include "game/base.h"
 
+#include <algorithm>
+
+/**
+ * Time it takes to correct most of a phase error between the game clock
+ * and the audio clock, in seconds.
+ *
+ * Shorter makes the game follow the audio more tightly, but lets the jitter of
+ * the audio clock through.
+ */
+static const double phase_time = .2;
+
+/**
+ * Weight of the accumulated phase error in the rate correction, per second
+ * squared.
+ */
+static const double rate_gain = .5;
+
+/**
+ * Largest rate correction. Sound cards are usually a few hundred parts per
+ * million away from the CPU clock.
+ */
+static const double max_drift = .005;
+
+double oshu::system_time()
+{
+	static const double frequency = SDL_GetPerformanceFrequency();
+	static const double origin = SDL_GetPerformanceCounter() / frequency - SDL_GetTicks() / 1000.;
+	return SDL_GetPerformanceCounter() / frequency - origin;
+}
+
 void oshu::initialize_clock(oshu::game_base *game)
 {
 	if (game->beatmap.audio_lead_in > 0.) {
@@ -17,21 +48,24 @@ void oshu::initialize_clock(oshu::game_base *game)
 		if (first_hit < 1.)
 			game->clock.now = first_hit - 1.;
 	}
-	game->clock.system = SDL_GetTicks() / 1000.;
+	game->clock.system = oshu::system_time();
+	game->clock.drift = 0;
 }
 
 /**
- * \todo
- * Find a better way to determine if the music is playing. The clock shouldn't
- * take the game screen into consideration.
+ * Move the clock to the process time *system*, which is *lag* seconds ago.
+ *
+ * The durations in process time are converted to music time with the rate of
+ * the music, including the audio latency.
  */
-void oshu::update_clock(oshu::game_base *game)
+static void advance(oshu::game_base *game, double system, double lag)
 {
 	oshu::clock *clock = &game->clock;
-	double system = SDL_GetTicks() / 1000.;
-	double diff = system - clock->system;
-	double prev_audio = clock->audio;
-	clock->audio = game->audio.music.current_timestamp;
+	if (system < clock->system)
+		system = clock->system;
+	double rate = game->audio.rate;
+	double diff = (system - clock->system) * rate;
+	clock->audio = oshu::precise_music_position(&game->audio, SDL_GetPerformanceCounter()) - (game->audio.latency + clock->offset + lag) * rate;
 	clock->before = clock->now;
 	clock->system = system;
 
@@ -40,16 +74,37 @@ void oshu::update_clock(oshu::game_base *game)
 	} else if (clock->before < 0) {
 		/* Leading in. */
 		clock->now = clock->before + diff;
-	} else if (clock->audio == prev_audio) {
-		/* The audio clock is stuck. */
-		/* It happens as the audio buffer is worth several frames. */
-		clock->now = clock->before + diff;
 	} else {
-		/* If the audio clock changed, synchronize the game clock. */
-		clock->now = clock->audio;
+		double predicted = clock->before + diff * (1. + clock->drift);
+		double error = clock->audio - predicted;
+		if (std::abs(error) > oshu::clock_snap) {
+			clock->now = clock->audio;
+			clock->drift = 0;
+		} else {
+			clock->now = predicted + error * std::min(1., diff / phase_time);
+			clock->drift += error * diff * rate_gain;
+			clock->drift = std::max(-max_drift, std::min(max_drift, clock->drift));
+		}
+		int64_t drift = -error * 1e6;
+		oshu::set_gauge(oshu::CLOCK_DRIFT, drift);
+		oshu::raise_gauge(oshu::CLOCK_DRIFT_MAX, drift < 0 ? -drift : drift);
 	}
 
 	/* Force monotonicity. */
 	if (clock->now < clock->before)
 		clock->now = clock->before;
 }
+
+void oshu::update_clock(oshu::game_base *game)
+{
+	advance(game, oshu::system_time(), 0);
+}
+
+void oshu::update_clock(oshu::game_base *game, double ticks)
+{
+	/* How long ago the event happened. */
+	double lag = SDL_GetTicks() / 1000. - ticks;
+	if (lag < 0)
+		lag = 0;
+	advance(game, oshu::system_time() - lag, lag);
+}
@@ -7,37 +7,19 @@
 
 oshu::hit* oshu::look_hit_back(oshu::game_base *game, double offset)
 {
-	oshu::hit *hit = game->hit_cursor;
-	double target = game->clock.now - offset;
-	/* seek backward */
-	while (oshu::hit_end_time(hit) > target)
-		hit = hit->previous;
-	/* seek forward */
-	while (oshu::hit_end_time(hit) < target)
-		hit = hit->next;
-	/* here we have the guarantee that hit->time >= target */
-	return hit;
+	return oshu::first_hit_ending_after(&game->hit_index, game->clock.now - offset);
 }
 
 oshu::hit* oshu::look_hit_up(oshu::game_base *game, double offset)
 {
-	oshu::hit *hit = game->hit_cursor;
-	double target = game->clock.now + offset;
-	/* seek forward */
-	while (hit->time < target)
-		hit = hit->next;
-	/* seek backward */
-	while (hit->time > target)
-		hit = hit->previous;
-	/* here we have the guarantee that hit->time <= target */
-	return hit;
+	return oshu::last_hit_starting_before(&game->hit_index, game->clock.now + offset);
 }
 
 oshu::hit* oshu::next_hit(oshu::game_base *game)
 {
 	oshu::hit *hit = game->hit_cursor;
 	for (; hit->next; hit = hit->next) {
-		if (hit->type & (oshu::CIRCLE_HIT | oshu::SLIDER_HIT))
+		if (hit->type & (oshu::CIRCLE_HIT | oshu::SLIDER_HIT | oshu::HOLD_HIT))
 			break;
 	}
 	return hit;
@@ -49,7 +31,7 @@ oshu::hit* oshu::previous_hit(oshu::game_base *game)
 	if (!hit->previous)
 		return hit;
 	for (hit = hit->previous; hit->previous; hit = hit->previous) {
-		if (hit->type & (oshu::CIRCLE_HIT | oshu::SLIDER_HIT))
+		if (hit->type & (oshu::CIRCLE_HIT | oshu::SLIDER_HIT | oshu::HOLD_HIT))
 			break;
 	}
 	return hit;
@@ -0,0 +1,240 @@
+/**
+ * \file lib/game/mania.cc
+ * \ingroup game_mania
+ *
+ * Implement the osu!mania mode.
+ */
+
+#include "game/mania.h"
+
+#include "game/checkpoint.h"
+#include "game/replay.h"
+#include "game/spectator.h"
+
+#include <math.h>
+#include <stdexcept>
+
+int oshu::mania_column_of(const oshu::mania_game *game, const oshu::hit *hit)
+{
+	int keys = game->beatmap.difficulty.key_count;
+	int column = std::real(hit->p) * keys / 512;
+	return column < 0 ? 0 : column >= keys ? keys - 1 : column;
+}
+
+int oshu::mania_key_column(int key_count, enum oshu::finger key)
+{
+	if (key < oshu::LEFT_PINKY || key > oshu::RIGHT_PINKY)
+		return -1;
+	int half = key_count / 2;
+	int column;
+	if (key < 0)
+		column = key + half;
+	else if (key_count % 2)
+		column = key + half;
+	else if (key > 0)
+		column = key + half - 1;
+	else
+		return -1;
+	return column >= 0 && column < key_count ? column : -1;
+}
+
+oshu::mania_game::mania_game(const char *beatmap_path, bool headless)
+: oshu::game_base(beatmap_path, headless)
+{
+	if (beatmap.mode != oshu::MANIA_MODE)
+		throw std::runtime_error("not an osu!mania beatmap");
+	int keys = beatmap.difficulty.key_count;
+	if (keys < 1 || keys > oshu::max_mania_keys)
+		throw std::runtime_error("unsupported number of keys");
+	columns.resize(keys);
+	for (oshu::hit *hit = beatmap.hits; hit; hit = hit->next) {
+		if (hit->type & (oshu::CIRCLE_HIT | oshu::HOLD_HIT))
+			columns[oshu::mania_column_of(this, hit)].hits.push_back(hit);
+	}
+}
+
+/**
+ * Record an input in the game's replay, if any, and publish it.
+ */
+static void record(oshu::mania_game *game, enum oshu::input_event::input_type type, enum oshu::finger key)
+{
+	oshu::input_event event {game->clock.now, type, key, 0};
+	if (game->recording)
+		oshu::record_input(game->recording, event);
+	if (game->publishing)
+		oshu::publish_input(game->publishing, event);
+}
+
+/**
+ * Find the hits behind the column cursors again after a seek.
+ *
+ * It goes through all the hits, but only once per seek.
+ */
+static void align_columns(oshu::mania_game *game)
+{
+	if (!game->realign)
+		return;
+	for (oshu::mania_column &column : game->columns) {
+		column.cursor = 0;
+		while (column.cursor < column.hits.size() && column.hits[column.cursor]->state != oshu::INITIAL_HIT)
+			++column.cursor;
+	}
+	game->realign = false;
+}
+
+/**
+ * The hit waiting at the judgement line of a column, or null when the column
+ * is done.
+ */
+static oshu::hit* column_hit(oshu::mania_column *column)
+{
+	return column->cursor < column->hits.size() ? column->hits[column->cursor] : nullptr;
+}
+
+/**
+ * Judge the hit under the cursor of a column, and move the cursor past it.
+ *
+ * Hold notes are marked as sliding, and stay under the cursor until they're
+ * released.
+ */
+static void activate_hit(oshu::mania_game *game, oshu::mania_column *column)
+{
+	oshu::hit *hit = column_hit(column);
+	if (hit->type & oshu::HOLD_HIT) {
+		oshu::judge(game, hit, oshu::SLIDING_HIT);
+		column->held = hit;
+	} else {
+		oshu::judge(game, hit, oshu::GOOD_HIT);
+		++column->cursor;
+	}
+	oshu::play_sound(&game->library, &hit->sound, &game->audio);
+}
+
+/**
+ * Judge the held hold note of a column, depending on whether it was held
+ * until its end.
+ */
+static void release_hold(oshu::mania_game *game, oshu::mania_column *column)
+{
+	oshu::hit *hit = column->held;
+	if (!hit)
+		return;
+	if (game->clock.now < hit->hold_note.end_time - game->beatmap.difficulty.leniency)
+		oshu::judge(game, hit, oshu::MISSED_HIT);
+	else
+		oshu::judge(game, hit, oshu::GOOD_HIT);
+	column->held = nullptr;
+	++column->cursor;
+}
+
+/**
+ * Skip the hits that are neither notes nor hold notes, and keep the global
+ * cursor in sync with the columns for the checkpoints.
+ */
+static void advance_cursor(oshu::mania_game *game, double t)
+{
+	while (game->hit_cursor->time < t) {
+		oshu::hit *hit = game->hit_cursor;
+		if (!(hit->type & (oshu::CIRCLE_HIT | oshu::HOLD_HIT)))
+			oshu::judge(game, hit, oshu::UNKNOWN_HIT);
+		game->hit_cursor = hit->next;
+	}
+}
+
+/**
+ * Mark the notes past the leniency as missed, and complete the hold notes
+ * that reached their end.
+ */
+int oshu::mania_game::check()
+{
+	align_columns(this);
+	double left_wall = this->clock.now - this->beatmap.difficulty.leniency;
+	for (oshu::mania_column &column : this->columns) {
+		if (column.held && this->clock.now >= column.held->hold_note.end_time)
+			release_hold(this, &column);
+		if (column.held)
+			continue;
+		while (oshu::hit *hit = column_hit(&column)) {
+			if (hit->time >= left_wall)
+				break;
+			if (hit->state == oshu::INITIAL_HIT)
+				oshu::judge(this, hit, oshu::MISSED_HIT);
+			++column.cursor;
+		}
+	}
+	advance_cursor(this, left_wall);
+	return 0;
+}
+
+/**
+ * Press every note on time, and hold the hold notes until their end.
+ */
+int oshu::mania_game::check_autoplay()
+{
+	align_columns(this);
+	for (oshu::mania_column &column : this->columns) {
+		if (column.held && this->clock.now >= column.held->hold_note.end_time)
+			release_hold(this, &column);
+		while (!column.held) {
+			oshu::hit *hit = column_hit(&column);
+			if (!hit || hit->time > this->clock.now)
+				break;
+			activate_hit(this, &column);
+		}
+	}
+	advance_cursor(this, this->clock.now);
+	return 0;
+}
+
+/**
+ * Judge the next note of the key's column.
+ *
+ * Pressing too early, but not that early, counts as a miss so that mashing
+ * the keys doesn't pay off.
+ */
+int oshu::mania_game::press(enum oshu::finger key)
+{
+	record(this, oshu::input_event::PRESS, key);
+	int c = oshu::mania_key_column(this->beatmap.difficulty.key_count, key);
+	if (c < 0)
+		return 0;
+	align_columns(this);
+	oshu::mania_column *column = &this->columns[c];
+	oshu::hit *hit = column_hit(column);
+	if (!hit || column->held)
+		return 0;
+	double leniency = this->beatmap.difficulty.leniency;
+	double offset = this->clock.now - hit->time;
+	if (fabs(offset) < leniency) {
+		hit->offset = offset;
+		activate_hit(this, column);
+	} else if (offset < 0 && offset > -2 * leniency) {
+		oshu::judge(this, hit, oshu::MISSED_HIT);
+		++column->cursor;
+	}
+	return 0;
+}
+
+/**
+ * Release the hold note of the key's column, if any.
+ */
+int oshu::mania_game::release(enum oshu::finger key)
+{
+	record(this, oshu::input_event::RELEASE, key);
+	int c = oshu::mania_key_column(this->beatmap.difficulty.key_count, key);
+	if (c >= 0)
+		release_hold(this, &this->columns[c]);
+	return 0;
+}
+
+int oshu::mania_game::relinquish()
+{
+	for (oshu::mania_column &column : this->columns) {
+		if (column.held) {
+			oshu::judge(this, column.held, oshu::INITIAL_HIT);
+			column.held = nullptr;
+		}
+	}
+	this->realign = true;
+	return 0;
+}
@@ -8,13 +8,33 @@
 #include "game/osu.h"
 
 #include "game/base.h"
-#include "video/texture.h"
+#include "game/checkpoint.h"
+#include "game/replay.h"
+#include "game/spectator.h"
 
 #include <assert.h>
+#include <stdexcept>
 
-oshu::osu_game::osu_game(const char *beatmap_path)
-: oshu::game_base(beatmap_path)
+oshu::osu_game::osu_game(const char *beatmap_path, bool headless)
+: oshu::game_base(beatmap_path, headless)
 {
+	if (beatmap.mode != oshu::OSU_MODE)
+		throw std::runtime_error("not an osu!standard beatmap");
+}
+
+/**
+ * Record an input in the game's replay, if any, and publish it.
+ */
+static void record(oshu::osu_game *game, enum oshu::input_event::input_type type, enum oshu::finger key)
+{
+	if (!game->recording && !game->publishing)
+		return;
+	oshu::point m = game->mouse ? game->mouse->position_at(game->clock.system) : 0;
+	oshu::input_event event {game->clock.now, type, key, m};
+	if (game->recording)
+		oshu::record_input(game->recording, event);
+	if (game->publishing)
+		oshu::publish_input(game->publishing, event);
 }
 
 /**
@@ -27,32 +47,55 @@ oshu::osu_game::osu_game(const char *beatmap_path)
  */
 static oshu::hit* find_hit(oshu::osu_game *game, oshu::point p)
 {
-	oshu::hit *start = oshu::look_hit_back(game, game->beatmap.difficulty.approach_time);
-	double max_time = game->clock.now + game->beatmap.difficulty.approach_time;
-	for (oshu::hit *hit = start; hit->time <= max_time; hit = hit->next) {
-		if (!(hit->type & (oshu::CIRCLE_HIT | oshu::SLIDER_HIT)))
-			continue;
-		if (hit->state != oshu::INITIAL_HIT)
-			continue;
-		if (std::abs(p - hit->p) <= game->beatmap.difficulty.circle_radius)
-			return hit;
-	}
-	return NULL;
+	double approach = game->beatmap.difficulty.approach_time;
+	return oshu::find_hit_at(&game->hit_index, p, game->beatmap.difficulty.circle_radius,
+	                         game->clock.now - approach, game->clock.now + approach);
+}
+
+/**
+ * How far beyond the audio already sent to SDL the autoplay hit sounds are
+ * scheduled, in seconds of real time.
+ *
+ * It must be longer than a game frame, so that no sound is scheduled late.
+ */
+static const double schedule_ahead = .1;
+
+/**
+ * Play a hit sound, unless it was scheduled by #schedule_autoplay.
+ */
+static void sonorize(oshu::osu_game *game, oshu::hit_sound *sound)
+{
+	if (!game->autoplay)
+		oshu::play_sound(&game->library, sound, &game->audio);
 }
 
 /**
- * Free the texture associated to a slider, when the slider gets old.
+ * Schedule the hit sounds of the hits that will soon be sent to the audio
+ * device, assuming they'll all be hit on time, like autoplay does.
  *
- * It is unlikely that once a slider is marked as good or missed, it will ever
- * be shown once again. The main exception is when the user seeks.
+ * Looping slider sounds are still played by #activate_hit, since the slider
+ * ball controls them.
  */
-static void jettison_hit(oshu::hit *hit)
+static void schedule_autoplay(oshu::osu_game *game)
 {
-	if (hit->texture) {
-		oshu::destroy_texture(hit->texture);
-		free(hit->texture);
-		hit->texture = NULL;
+	double from = game->scheduled_until;
+	double horizon = oshu::music_position(&game->audio) + schedule_ahead * game->audio.rate;
+	if (horizon <= from)
+		return;
+	oshu::hit *hit = oshu::first_hit_ending_after(&game->hit_index, from);
+	for (; hit->time <= horizon; hit = hit->next) {
+		if (hit->type & oshu::SLIDER_HIT) {
+			for (int t = 0; t <= hit->slider.repeat; ++t) {
+				double time = hit->time + t * hit->slider.duration;
+				if (time > from && time <= horizon)
+					oshu::schedule_sound(&game->library, &hit->slider.sounds[t], &game->audio, time);
+			}
+		} else if (hit->type & oshu::CIRCLE_HIT) {
+			if (hit->time > from)
+				oshu::schedule_sound(&game->library, &hit->sound, &game->audio, hit->time);
+		}
 	}
+	game->scheduled_until = horizon;
 }
 
 /**
@@ -66,13 +109,12 @@ static void release_slider(oshu::osu_game *game)
 		return;
 	assert (hit->type & oshu::SLIDER_HIT);
 	if (game->clock.now < oshu::hit_end_time(hit) - game->beatmap.difficulty.leniency) {
-		hit->state = oshu::MISSED_HIT;
+		oshu::judge(game, hit, oshu::MISSED_HIT);
 	} else {
-		hit->state = oshu::GOOD_HIT;
-		oshu::play_sound(&game->library, &hit->slider.sounds[hit->slider.repeat], &game->audio);
+		oshu::judge(game, hit, oshu::GOOD_HIT);
+		sonorize(game, &hit->slider.sounds[hit->slider.repeat]);
 	}
-	jettison_hit(hit);
-	oshu::stop_loop(&game->audio);
+	oshu::stop_sound(&game->audio, &game->slider_loops);
 	game->current_slider = NULL;
 }
 
@@ -93,7 +135,7 @@ static void sonorize_slider(oshu::osu_game *game)
 		release_slider(game);
 	} else if (t > prev_t && prev_t >= 0) {
 		assert (t <= hit->slider.repeat);
-		oshu::play_sound(&game->library, &hit->slider.sounds[t], &game->audio);
+		sonorize(game, &hit->slider.sounds[t]);
 	}
 }
 
@@ -108,18 +150,19 @@ static void sonorize_slider(oshu::osu_game *game)
  */
 int oshu::osu_game::check()
 {
+	if (!this->autoplay)
+		record(this, oshu::input_event::MOVE, oshu::UNKNOWN_KEY);
 	/* Ensure the mouse follows the slider. */
 	sonorize_slider(this); /* < may release the slider! */
 	if (this->current_slider && mouse) {
 		oshu::hit *hit = this->current_slider;
 		double t = (this->clock.now - hit->time) / hit->slider.duration;
 		oshu::point ball = oshu::path_at(&hit->slider.path, t);
-		oshu::point m = mouse->position();
+		oshu::point m = mouse->position_at(this->clock.system);
 		if (std::abs(ball - m) > this->beatmap.difficulty.slider_tolerance) {
-			oshu::stop_loop(&this->audio);
+			oshu::stop_sound(&this->audio, &this->slider_loops);
 			this->current_slider = NULL;
-			hit->state = oshu::MISSED_HIT;
-			jettison_hit(hit);
+			oshu::judge(this, hit, oshu::MISSED_HIT);
 		}
 	}
 	/* Mark dead notes as missed. */
@@ -127,10 +170,9 @@ int oshu::osu_game::check()
 	while (this->hit_cursor->time < left_wall) {
 		oshu::hit *hit = this->hit_cursor;
 		if (!(hit->type & (oshu::CIRCLE_HIT | oshu::SLIDER_HIT))) {
-			hit->state = oshu::UNKNOWN_HIT;
+			oshu::judge(this, hit, oshu::UNKNOWN_HIT);
 		} else if (hit->state == oshu::INITIAL_HIT) {
-			hit->state = oshu::MISSED_HIT;
-			jettison_hit(hit);
+			oshu::judge(this, hit, oshu::MISSED_HIT);
 		}
 		this->hit_cursor = hit->next;
 	}
@@ -150,16 +192,16 @@ static void activate_hit(oshu::osu_game *game, oshu::hit *hit, enum oshu::finger
 {
 	if (hit->type & oshu::SLIDER_HIT) {
 		release_slider(game);
-		hit->state = oshu::SLIDING_HIT;
+		oshu::judge(game, hit, oshu::SLIDING_HIT);
 		game->current_slider = hit;
 		game->held_key = key;
-		oshu::play_sound(&game->library, &hit->sound, &game->audio);
-		oshu::play_sound(&game->library, &hit->slider.sounds[0], &game->audio);
+		oshu::play_sound(&game->library, &hit->sound, &game->audio, &game->slider_loops);
+		sonorize(game, &hit->slider.sounds[0]);
 	} else if (hit->type & oshu::CIRCLE_HIT) {
-		hit->state = oshu::GOOD_HIT;
-		oshu::play_sound(&game->library, &hit->sound, &game->audio);
+		oshu::judge(game, hit, oshu::GOOD_HIT);
+		sonorize(game, &hit->sound);
 	} else {
-		hit->state = oshu::UNKNOWN_HIT;
+		oshu::judge(game, hit, oshu::UNKNOWN_HIT);
 	}
 }
 
@@ -168,6 +210,7 @@ static void activate_hit(oshu::osu_game *game, oshu::hit *hit, enum oshu::finger
  */
 int oshu::osu_game::check_autoplay()
 {
+	schedule_autoplay(this);
 	sonorize_slider(this);
 	while (this->hit_cursor->time < this->clock.now) {
 		activate_hit(this, this->hit_cursor, oshu::UNKNOWN_KEY);
@@ -177,24 +220,25 @@ int oshu::osu_game::check_autoplay()
 }
 
 /**
- * Get the current mouse position, get the hit object, and change its state.
+ * Get the mouse position at the time of the press, get the hit object, and
+ * change its state.
  *
  * Play a sample depending on what was clicked, and when.
  */
 int oshu::osu_game::press(enum oshu::finger key)
 {
+	record(this, oshu::input_event::PRESS, key);
 	if (!mouse)
 		return 0;
-	oshu::point m = mouse->position();
+	oshu::point m = mouse->position_at(this->clock.system);
 	oshu::hit *hit = find_hit(this, m);
 	if (!hit)
 		return 0;
 	if (fabs(hit->time - this->clock.now) < this->beatmap.difficulty.leniency) {
-		activate_hit(this, hit, key);
 		hit->offset = this->clock.now - hit->time;
+		activate_hit(this, hit, key);
 	} else {
-		hit->state = oshu::MISSED_HIT;
-		jettison_hit(hit);
+		oshu::judge(this, hit, oshu::MISSED_HIT);
 	}
 	return 0;
 }
@@ -205,6 +249,7 @@ int oshu::osu_game::press(enum oshu::finger key)
  */
 int oshu::osu_game::release(enum oshu::finger key)
 {
+	record(this, oshu::input_event::RELEASE, key);
 	if (this->held_key == key)
 		release_slider(this);
 	return 0;
@@ -212,9 +257,10 @@ int oshu::osu_game::release(enum oshu::finger key)
 
 int oshu::osu_game::relinquish()
 {
+	this->scheduled_until = oshu::music_position(&this->audio);
 	if (this->current_slider) {
-		this->current_slider->state = oshu::INITIAL_HIT;
-		oshu::stop_loop(&this->audio);
+		oshu::judge(this, this->current_slider, oshu::INITIAL_HIT);
+		oshu::stop_sound(&this->audio, &this->slider_loops);
 		this->current_slider = NULL;
 	}
 	return 0;
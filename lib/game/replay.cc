@@ -0,0 +1,131 @@
+/**
+ * \file game/replay.cc
+ * \ingroup game_replay
+ */
+
+#include "game/replay.h"
+
+#include "core/log.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+struct replay_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t count;
+	uint64_t beatmap_hash;
+	uint64_t reserved;
+};
+
+struct replay_record {
+	int32_t time;
+	uint8_t type;
+	int8_t key;
+	uint16_t reserved;
+	float x;
+	float y;
+};
+
+static_assert(sizeof(replay_header) == 32, "unexpected replay header padding");
+static_assert(sizeof(replay_record) == 16, "unexpected replay record padding");
+
+static const char replay_magic[8] = {'o', 's', 'h', 'u', 'r', 'p', 'l', '\0'};
+static const uint32_t replay_version = 1;
+
+void oshu::record_input(oshu::replay *replay, const oshu::input_event &event)
+{
+	std::vector<oshu::input_event> &events = replay->events;
+	while (!events.empty() && events.back().time > event.time)
+		events.pop_back();
+	if (event.type == oshu::input_event::MOVE) {
+		for (auto it = events.rbegin(); it != events.rend(); ++it) {
+			if (it->type == oshu::input_event::MOVE) {
+				if (it->position == event.position)
+					return;
+				break;
+			}
+		}
+	}
+	events.push_back(event);
+}
+
+int oshu::save_replay(const oshu::replay *replay, const char *path)
+{
+	FILE *file = fopen(path, "wb");
+	if (!file) {
+		oshu_log_error("could not create %s: %s", path, strerror(errno));
+		return -1;
+	}
+	replay_header header {};
+	memcpy(header.magic, replay_magic, sizeof(replay_magic));
+	header.version = replay_version;
+	header.count = replay->events.size();
+	header.beatmap_hash = replay->beatmap_hash;
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	for (const oshu::input_event &event : replay->events) {
+		if (!ok)
+			break;
+		replay_record record {};
+		record.time = lround(event.time * 1e6);
+		record.type = event.type;
+		record.key = event.key;
+		record.x = std::real(event.position);
+		record.y = std::imag(event.position);
+		ok = fwrite(&record, sizeof(record), 1, file) == 1;
+	}
+	if (fclose(file) != 0)
+		ok = false;
+	if (!ok) {
+		oshu_log_error("could not write the replay %s", path);
+		return -1;
+	}
+	oshu_log_debug("saved %zu events in %s", replay->events.size(), path);
+	return 0;
+}
+
+int oshu::load_replay(const char *path, oshu::replay *replay)
+{
+	FILE *file = fopen(path, "rb");
+	if (!file) {
+		oshu_log_error("could not open %s: %s", path, strerror(errno));
+		return -1;
+	}
+	int rc = -1;
+	replay_header header;
+	replay->events.clear();
+	if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, replay_magic, sizeof(replay_magic))) {
+		oshu_log_error("%s is not a replay", path);
+		goto done;
+	}
+	if (header.version != replay_version) {
+		oshu_log_error("unsupported replay version %u in %s", header.version, path);
+		goto done;
+	}
+	replay->beatmap_hash = header.beatmap_hash;
+	replay->events.reserve(header.count);
+	for (uint32_t i = 0; i < header.count; ++i) {
+		replay_record record;
+		if (fread(&record, sizeof(record), 1, file) != 1) {
+			oshu_log_error("truncated replay %s", path);
+			goto done;
+		}
+		if (record.type > oshu::input_event::RELEASE) {
+			oshu_log_error("invalid event in the replay %s", path);
+			goto done;
+		}
+		replay->events.push_back(oshu::input_event {
+			record.time / 1e6,
+			(enum oshu::input_event::input_type) record.type,
+			(enum oshu::finger) record.key,
+			oshu::point(record.x, record.y),
+		});
+	}
+	rc = 0;
+
+done:
+	fclose(file);
+	return rc;
+}
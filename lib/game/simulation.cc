@@ -0,0 +1,102 @@
+/**
+ * \file game/simulation.cc
+ * \ingroup game_simulation
+ */
+
+#include "game/simulation.h"
+
+#include "core/log.h"
+#include "game/osu.h"
+
+#include <algorithm>
+
+/**
+ * Move the synthetic clock forward to *t*, like #oshu::update_clock would.
+ */
+static void advance(oshu::osu_game *game, double t)
+{
+	oshu::clock *clock = &game->clock;
+	clock->before = clock->now;
+	clock->now = std::max(t, clock->now);
+	clock->audio = clock->now;
+	clock->system = clock->now;
+}
+
+static void check(oshu::osu_game *game)
+{
+	if (game->autoplay)
+		game->check_autoplay();
+	else
+		game->check();
+}
+
+static void apply(oshu::osu_game *game, oshu::scripted_mouse *mouse, const oshu::input_event &event)
+{
+	if (mouse)
+		mouse->at = event.position;
+	if (game->autoplay)
+		return;
+	switch (event.type) {
+	case oshu::input_event::MOVE:
+		break;
+	case oshu::input_event::PRESS:
+		game->press(event.key);
+		break;
+	case oshu::input_event::RELEASE:
+		game->release(event.key);
+		break;
+	}
+}
+
+/**
+ * When the game starts, like #oshu::initialize_clock.
+ */
+static double start_time(oshu::osu_game *game)
+{
+	if (game->beatmap.audio_lead_in > 0.)
+		return - game->beatmap.audio_lead_in;
+	double first_hit = game->beatmap.hits->next->time;
+	return first_hit < 1. ? first_hit - 1. : 0.;
+}
+
+/**
+ * When the last hit can't change anymore, like the play screen's end check.
+ */
+static double end_time(oshu::osu_game *game)
+{
+	oshu::hit *last = game->beatmap.hits;
+	while (last->next && last->next->next)
+		last = last->next;
+	return oshu::hit_end_time(last) + game->beatmap.difficulty.leniency + game->beatmap.difficulty.approach_time;
+}
+
+int oshu::simulate(oshu::osu_game *game, const std::vector<oshu::input_event> &events, double step)
+{
+	if (!game->headless) {
+		oshu_log_error("only headless games can be simulated");
+		return -1;
+	}
+	std::shared_ptr<oshu::scripted_mouse> mouse;
+	if (!game->mouse) {
+		mouse = std::make_shared<oshu::scripted_mouse>();
+		game->mouse = mouse;
+	} else {
+		mouse = std::dynamic_pointer_cast<oshu::scripted_mouse>(game->mouse);
+	}
+	game->hit_cursor = game->beatmap.hits;
+	game->clock = {};
+	game->clock.now = start_time(game);
+	double end = end_time(game);
+	auto event = events.begin();
+	for (double t = game->clock.now; t <= end; t += step) {
+		double next = t + step;
+		for (; event != events.end() && event->time <= next; ++event) {
+			advance(game, event->time);
+			apply(game, mouse.get(), *event);
+			check(game);
+		}
+		advance(game, next);
+		check(game);
+	}
+	return 0;
+}
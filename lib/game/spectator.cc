@@ -0,0 +1,491 @@
+/**
+ * \file game/spectator.cc
+ * \ingroup game_spectator
+ */
+
+#include "game/spectator.h"
+
+#include "core/log.h"
+#include "game/base.h"
+
+#include <algorithm>
+#include <chrono>
+#include <errno.h>
+#include <math.h>
+#include <netdb.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+struct datagram_header {
+	char magic[4];
+	uint32_t sequence;
+	uint64_t beatmap_hash;
+};
+
+static_assert(sizeof(datagram_header) == 16, "unexpected datagram header padding");
+static_assert(sizeof(oshu::spectator_record) == 16, "unexpected spectator record padding");
+
+static const char datagram_magic[4] = {'o', 's', 'h', 's'};
+
+/**
+ * Convert a time on the game clock to the milliseconds of
+ * #oshu::spectator_record::time.
+ */
+static int32_t to_record_time(double seconds)
+{
+	return lround(seconds * 1e3);
+}
+
+static double record_seconds(const oshu::spectator_record &record)
+{
+	return record.time / 1e3;
+}
+
+/**
+ * Most records in a datagram, to keep it below the usual 1500-byte MTU.
+ */
+static const size_t datagram_records = 64;
+
+/**
+ * How long the sender thread sleeps between two datagrams.
+ */
+static const auto send_period = std::chrono::milliseconds(5);
+
+/**
+ * Shortest time between two published moves, in seconds.
+ */
+static const double move_period = 1. / 120;
+
+/**
+ * Longest time between two published clocks, in seconds.
+ */
+static const double clock_period = .25;
+
+/**
+ * How far the published clock may move away from the previous clock plus the
+ * time elapsed before it counts as a jump, in seconds.
+ */
+static const double clock_jump = .1;
+
+/**
+ * How long the spectator waits for the next clock before considering the
+ * player gone, in seconds.
+ */
+static const double spectator_timeout = 2.;
+
+/**
+ * How far behind the player the spectator's game may fall before it is moved
+ * forward, in seconds. It is waited for when it gets ahead, up to
+ * #spectator_patience.
+ */
+static const double spectator_tolerance = .25;
+
+/**
+ * How far ahead of the player the spectator's game may get before it is
+ * rewound instead of paused, in seconds.
+ */
+static const double spectator_patience = 2.;
+
+/**
+ * How long the receiver blocks on its socket before checking if it must stop,
+ * in milliseconds.
+ */
+static const int receive_timeout = 100;
+
+static bool push(oshu::spectator_queue *queue, const oshu::spectator_record &record)
+{
+	uint64_t head = queue->head.load(std::memory_order_relaxed);
+	if (head - queue->tail.load(std::memory_order_acquire) >= oshu::spectator_queue::capacity)
+		return false;
+	queue->records[head % oshu::spectator_queue::capacity] = record;
+	queue->head.store(head + 1, std::memory_order_release);
+	return true;
+}
+
+static bool pop(oshu::spectator_queue *queue, oshu::spectator_record *record)
+{
+	uint64_t tail = queue->tail.load(std::memory_order_relaxed);
+	if (tail == queue->head.load(std::memory_order_acquire))
+		return false;
+	*record = queue->records[tail % oshu::spectator_queue::capacity];
+	queue->tail.store(tail + 1, std::memory_order_release);
+	return true;
+}
+
+/**
+ * Resolve *address*, either a path to a Unix socket, or a `HOST:PORT` pair,
+ * and open a datagram socket for it.
+ *
+ * When *passive* is set, an empty host means any address, to listen on.
+ *
+ * \return the socket, or -1 on failure after logging an error.
+ */
+static int open_socket(const char *address, bool passive, struct sockaddr_storage *addr, socklen_t *size)
+{
+	memset(addr, 0, sizeof(*addr));
+	if (strchr(address, '/')) {
+		struct sockaddr_un *un = (struct sockaddr_un*) addr;
+		if (strlen(address) >= sizeof(un->sun_path)) {
+			oshu_log_error("socket path too long: %s", address);
+			return -1;
+		}
+		un->sun_family = AF_UNIX;
+		strcpy(un->sun_path, address);
+		*size = sizeof(*un);
+	} else {
+		const char *colon = strrchr(address, ':');
+		if (!colon) {
+			oshu_log_error("expected HOST:PORT or a socket path, not %s", address);
+			return -1;
+		}
+		std::string host(address, colon - address);
+		if (host.size() >= 2 && host.front() == '[' && host.back() == ']')
+			host = host.substr(1, host.size() - 2);
+		struct addrinfo hints {};
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_DGRAM;
+		hints.ai_flags = passive ? AI_PASSIVE : 0;
+		struct addrinfo *info;
+		int rc = getaddrinfo(host.empty() ? NULL : host.c_str(), colon + 1, &hints, &info);
+		if (rc != 0) {
+			oshu_log_error("could not resolve %s: %s", address, gai_strerror(rc));
+			return -1;
+		}
+		memcpy(addr, info->ai_addr, info->ai_addrlen);
+		*size = info->ai_addrlen;
+		freeaddrinfo(info);
+	}
+	int fd = socket(addr->ss_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		oshu_log_error("could not open a socket for %s: %s", address, strerror(errno));
+	return fd;
+}
+
+/**
+ * Send the queued records, in as many datagrams as needed.
+ */
+static void send_records(oshu::publisher *publisher, uint32_t *sequence)
+{
+	struct {
+		datagram_header header;
+		oshu::spectator_record records[datagram_records];
+	} datagram;
+	memcpy(datagram.header.magic, datagram_magic, sizeof(datagram_magic));
+	datagram.header.beatmap_hash = publisher->beatmap_hash;
+	for (;;) {
+		size_t count = 0;
+		while (count < datagram_records && pop(&publisher->queue, &datagram.records[count]))
+			++count;
+		if (count == 0)
+			break;
+		datagram.header.sequence = (*sequence)++;
+		size_t size = sizeof(datagram.header) + count * sizeof(oshu::spectator_record);
+		ssize_t rc = sendto(publisher->socket, &datagram, size, MSG_DONTWAIT,
+		                    (struct sockaddr*) &publisher->address, publisher->address_size);
+		if (rc < 0)
+			publisher->dropped += count;
+	}
+}
+
+int oshu::open_publisher(const char *address, uint64_t beatmap_hash, oshu::publisher *publisher)
+{
+	publisher->socket = open_socket(address, false, &publisher->address, &publisher->address_size);
+	if (publisher->socket < 0)
+		return -1;
+	publisher->beatmap_hash = beatmap_hash;
+	publisher->stop = false;
+	publisher->dropped = 0;
+	publisher->last_move = -INFINITY;
+	publisher->last_position = NAN;
+	publisher->last_clock = NAN;
+	publisher->last_clock_system = -INFINITY;
+	publisher->last_paused = false;
+	publisher->sender = std::thread([publisher] {
+		uint32_t sequence = 0;
+		while (!publisher->stop.load()) {
+			send_records(publisher, &sequence);
+			std::this_thread::sleep_for(send_period);
+		}
+		send_records(publisher, &sequence);
+	});
+	oshu_log_info("publishing the game to %s", address);
+	return 0;
+}
+
+void oshu::close_publisher(oshu::publisher *publisher)
+{
+	if (publisher->socket < 0)
+		return;
+	publisher->stop = true;
+	publisher->sender.join();
+	close(publisher->socket);
+	publisher->socket = -1;
+	if (publisher->dropped > 0)
+		oshu_log_debug("%llu spectator records were dropped", (unsigned long long) publisher->dropped.load());
+}
+
+static void publish(oshu::publisher *publisher, const oshu::spectator_record &record)
+{
+	if (!push(&publisher->queue, record))
+		++publisher->dropped;
+}
+
+void oshu::publish_input(oshu::publisher *publisher, const oshu::input_event &event)
+{
+	if (event.type == oshu::input_event::MOVE) {
+		if (event.position == publisher->last_position)
+			return;
+		if (event.time >= publisher->last_move && event.time < publisher->last_move + move_period)
+			return;
+		publisher->last_move = event.time;
+	}
+	publisher->last_position = event.position;
+	oshu::spectator_record record {};
+	record.time = to_record_time(event.time);
+	record.type = event.type;
+	record.key = event.key;
+	record.x = std::real(event.position);
+	record.y = std::imag(event.position);
+	publish(publisher, record);
+}
+
+void oshu::publish_judgment(oshu::publisher *publisher, const oshu::game_base *game, const oshu::hit *hit, enum oshu::hit_state state)
+{
+	if (state != oshu::GOOD_HIT && state != oshu::MISSED_HIT)
+		return;
+	oshu::spectator_record record {};
+	record.time = to_record_time(game->clock.now);
+	record.type = oshu::spectator_record::JUDGMENT;
+	record.key = state;
+	record.hit = oshu::hit_position(&game->hit_index, hit);
+	record.offset = hit->offset;
+	if (record.hit >= 0)
+		publish(publisher, record);
+}
+
+void oshu::publish_clock(oshu::publisher *publisher, const oshu::game_base *game)
+{
+	double now = game->clock.now;
+	double system = game->clock.system;
+	double elapsed = system - publisher->last_clock_system;
+	bool changed = game->paused != publisher->last_paused;
+	if (!changed && elapsed < clock_period) {
+		double expected = publisher->last_clock + (game->paused ? 0 : elapsed * game->audio.rate);
+		if (std::abs(now - expected) < clock_jump)
+			return;
+	}
+	publisher->last_clock = now;
+	publisher->last_clock_system = system;
+	publisher->last_paused = game->paused;
+	oshu::spectator_record record {};
+	record.time = to_record_time(now);
+	record.type = oshu::spectator_record::CLOCK;
+	record.key = game->paused;
+	publish(publisher, record);
+}
+
+/**
+ * Check that the fields of a received record make sense for its type, so
+ * that a corrupted or forged datagram can't feed the game with keys or hit
+ * states it never produces.
+ */
+static bool valid_record(const oshu::spectator_record &record)
+{
+	bool finger = record.key >= oshu::LEFT_BUTTON && record.key <= oshu::RIGHT_BUTTON;
+	bool position = std::isfinite(record.x) && std::isfinite(record.y);
+	switch (record.type) {
+	case oshu::spectator_record::MOVE:
+		return position;
+	case oshu::spectator_record::PRESS:
+		return finger && position;
+	case oshu::spectator_record::RELEASE:
+		return finger;
+	case oshu::spectator_record::JUDGMENT:
+		return (record.key == oshu::GOOD_HIT || record.key == oshu::MISSED_HIT) && std::isfinite(record.offset);
+	case oshu::spectator_record::CLOCK:
+		return record.key == 0 || record.key == 1;
+	default:
+		return false;
+	}
+}
+
+/**
+ * Check a received datagram, and queue its valid records.
+ */
+static void receive_datagram(oshu::spectator *spectator, const char *data, size_t size, bool *warned)
+{
+	datagram_header header;
+	if (size < sizeof(header))
+		return;
+	memcpy(&header, data, sizeof(header));
+	if (memcmp(header.magic, datagram_magic, sizeof(datagram_magic)))
+		return;
+	if (header.beatmap_hash != spectator->beatmap_hash) {
+		if (!*warned)
+			oshu_log_warning("ignoring the stream of another beatmap");
+		*warned = true;
+		return;
+	}
+	size_t count = (size - sizeof(header)) / sizeof(oshu::spectator_record);
+	for (size_t i = 0; i < count; ++i) {
+		oshu::spectator_record record;
+		memcpy(&record, data + sizeof(header) + i * sizeof(record), sizeof(record));
+		if (!valid_record(record))
+			continue;
+		if (!push(&spectator->queue, record))
+			break;
+	}
+}
+
+int oshu::open_spectator(const char *address, uint64_t beatmap_hash, oshu::spectator *spectator)
+{
+	struct sockaddr_storage addr;
+	socklen_t size;
+	spectator->socket = open_socket(address, true, &addr, &size);
+	if (spectator->socket < 0)
+		return -1;
+	if (addr.ss_family == AF_UNIX) {
+		/* Remove the socket a previous spectator left behind. */
+		unlink(address);
+		spectator->path = address;
+	}
+	if (bind(spectator->socket, (struct sockaddr*) &addr, size) < 0) {
+		oshu_log_error("could not listen on %s: %s", address, strerror(errno));
+		close(spectator->socket);
+		spectator->socket = -1;
+		spectator->path.clear();
+		return -1;
+	}
+	spectator->beatmap_hash = beatmap_hash;
+	spectator->stop = false;
+	spectator->pending.clear();
+	spectator->mouse = std::make_shared<oshu::scripted_mouse>();
+	spectator->remote_clock = 0;
+	spectator->received_at = -1;
+	spectator->remote_paused = false;
+	spectator->receiver = std::thread([spectator] {
+		bool warned = false;
+		struct pollfd fd {spectator->socket, POLLIN, 0};
+		char data[sizeof(datagram_header) + datagram_records * sizeof(oshu::spectator_record)];
+		while (!spectator->stop.load()) {
+			if (poll(&fd, 1, receive_timeout) <= 0)
+				continue;
+			ssize_t size = recv(spectator->socket, data, sizeof(data), MSG_DONTWAIT);
+			if (size > 0)
+				receive_datagram(spectator, data, size, &warned);
+		}
+	});
+	oshu_log_info("waiting for a game on %s", address);
+	return 0;
+}
+
+void oshu::close_spectator(oshu::spectator *spectator)
+{
+	if (spectator->socket < 0)
+		return;
+	spectator->stop = true;
+	spectator->receiver.join();
+	close(spectator->socket);
+	spectator->socket = -1;
+	if (!spectator->path.empty()) {
+		unlink(spectator->path.c_str());
+		spectator->path.clear();
+	}
+}
+
+/**
+ * Move the game to *target*, like the rewind and forward keys.
+ */
+static void seek_game(oshu::spectator *spectator, oshu::game_base *game, double target)
+{
+	double position = oshu::music_position(&game->audio);
+	if (target > position)
+		game->forward(target - position);
+	else
+		game->rewind(position - target);
+	/* The inputs the game skipped over would only mislead it now. */
+	auto &pending = spectator->pending;
+	auto stale = [game](const oshu::spectator_record &record) {
+		return record.type != oshu::spectator_record::JUDGMENT && record_seconds(record) < game->clock.now;
+	};
+	pending.erase(std::remove_if(pending.begin(), pending.end(), stale), pending.end());
+}
+
+/**
+ * Set a hit to the state the player's game judged it, if the spectator's game
+ * judged it otherwise.
+ */
+static void correct(oshu::game_base *game, const oshu::spectator_record &record)
+{
+	const oshu::hit_index *index = &game->hit_index;
+	if (record.hit <= 0 || (size_t) record.hit >= index->hits.size() - 1)
+		return;
+	oshu::hit *hit = index->hits[record.hit];
+	if (hit->state == record.key)
+		return;
+	hit->offset = record.offset;
+	oshu::judge(game, hit, (enum oshu::hit_state) record.key);
+}
+
+static void apply(oshu::spectator *spectator, oshu::game_base *game, const oshu::spectator_record &record)
+{
+	switch (record.type) {
+	case oshu::spectator_record::MOVE:
+		spectator->mouse->at = oshu::point(record.x, record.y);
+		break;
+	case oshu::spectator_record::PRESS:
+		spectator->mouse->at = oshu::point(record.x, record.y);
+		game->press((enum oshu::finger) record.key);
+		break;
+	case oshu::spectator_record::RELEASE:
+		game->release((enum oshu::finger) record.key);
+		break;
+	case oshu::spectator_record::JUDGMENT:
+		correct(game, record);
+		break;
+	}
+}
+
+void oshu::follow(oshu::spectator *spectator, oshu::game_base *game)
+{
+	double system = oshu::system_time();
+	oshu::spectator_record record;
+	while (pop(&spectator->queue, &record)) {
+		if (record.type != oshu::spectator_record::CLOCK) {
+			spectator->pending.push_back(record);
+			continue;
+		}
+		double clock = record_seconds(record);
+		if (spectator->received_at >= 0 && clock < spectator->remote_clock - clock_jump) {
+			/* The player rewound, and will play these again. */
+			spectator->pending.clear();
+		}
+		spectator->remote_clock = clock;
+		spectator->received_at = system;
+		spectator->remote_paused = record.key;
+	}
+
+	bool live = spectator->received_at >= 0 && system - spectator->received_at < spectator_timeout;
+	if (!live || spectator->remote_paused) {
+		if (!game->paused)
+			game->pause();
+	} else {
+		double target = spectator->remote_clock + (system - spectator->received_at) * game->audio.rate - spectator_delay;
+		double gap = target - game->clock.now;
+		if (target > 0 && (gap > spectator_tolerance || gap < -spectator_patience)) {
+			seek_game(spectator, game, target);
+			gap = target - game->clock.now;
+		}
+		if (game->paused && gap >= 0)
+			game->unpause();
+		else if (!game->paused && gap < -spectator_tolerance)
+			game->pause();
+	}
+
+	while (!spectator->pending.empty() && record_seconds(spectator->pending.front()) <= game->clock.now) {
+		apply(spectator, game, spectator->pending.front());
+		spectator->pending.pop_front();
+	}
+}
@@ -0,0 +1,60 @@
+/**
+ * \file game/tally.cc
+ * \ingroup game_tally
+ */
+
+#include "game/tally.h"
+
+#include <algorithm>
+#include <limits>
+
+static bool judged(enum oshu::hit_state state)
+{
+	return state == oshu::GOOD_HIT || state == oshu::MISSED_HIT;
+}
+
+/**
+ * Return the counter of a judged hit.
+ */
+static int *counter(oshu::tally *tally, const oshu::beatmap *beatmap, oshu::hit *hit)
+{
+	if (hit->state == oshu::MISSED_HIT)
+		return &tally->missed;
+	double leniency = beatmap->difficulty.leniency;
+	if (hit->offset < - leniency / 2)
+		return &tally->early;
+	else if (hit->offset > leniency / 2)
+		return &tally->late;
+	else
+		return &tally->great;
+}
+
+void oshu::judge_hit(oshu::tally *tally, const oshu::beatmap *beatmap, oshu::hit *hit, enum oshu::hit_state state)
+{
+	if (hit->state == state)
+		return;
+	if (judged(hit->state))
+		--*counter(tally, beatmap, hit);
+	bool undone = judged(hit->state);
+	hit->state = state;
+	if (judged(state)) {
+		++*counter(tally, beatmap, hit);
+		tally->combo = state == oshu::GOOD_HIT ? tally->combo + 1 : 0;
+		tally->max_combo = std::max(tally->max_combo, tally->combo);
+		tally->checkpoints.push_back(oshu::combo_checkpoint {hit, tally->combo, tally->max_combo});
+	} else if (undone) {
+		std::vector<oshu::combo_checkpoint> &checkpoints = tally->checkpoints;
+		while (!checkpoints.empty() && !judged(checkpoints.back().hit->state))
+			checkpoints.pop_back();
+		tally->combo = checkpoints.empty() ? 0 : checkpoints.back().combo;
+		tally->max_combo = checkpoints.empty() ? 0 : checkpoints.back().max_combo;
+	}
+}
+
+double oshu::tally_score(const oshu::tally *tally)
+{
+	int total = tally->great + tally->early + tally->late + tally->missed;
+	if (total == 0)
+		return std::numeric_limits<double>::quiet_NaN();
+	return (tally->great + (tally->early + tally->late) / 3.) / total;
+}
@@ -5,8 +5,15 @@
 
 #include "game/tty.h"
 
+#include "core/log.h"
+#include "core/metrics.h"
 #include "game/base.h"
+#include "game/calibration.h"
+#include "game/clock.h"
 
+#include <algorithm>
+#include <poll.h>
+#include <stdarg.h>
 #include <unistd.h>
 
 void print_dual(const char *ascii, const char *unicode)
@@ -46,6 +53,22 @@ void oshu::welcome(oshu::game_base *game)
 	printf("\n\n");
 }
 
+/**
+ * Format at the end of *line*, which is *size* bytes and already holds
+ * *length* bytes, and update *length*.
+ */
+static void append(char *line, int size, int *length, const char *format, ...)
+{
+	if (*length >= size - 1)
+		return;
+	va_list args;
+	va_start(args, format);
+	int rc = vsnprintf(line + *length, size - *length, format, args);
+	va_end(args);
+	if (rc > 0)
+		*length = std::min(*length + rc, size - 1);
+}
+
 /**
  * \todo
  * This function is called in too many locations.
@@ -53,34 +76,86 @@ void oshu::welcome(oshu::game_base *game)
  * \todo
  * This function should be deleted once the window can display the time.
  */
-void oshu::print_state(oshu::game_base *game)
+void oshu::print_state(oshu::game_base *game, bool force)
 {
-	if (!isatty(fileno(stdout)))
+	static bool tty = isatty(fileno(stdout));
+	static double last_print = 0;
+	static int64_t last_frames = 0;
+	if (!tty)
+		return;
+	double now = oshu::system_time();
+	if (!force && now - last_print < oshu::status_interval)
 		return;
+	struct pollfd ready = {fileno(stdout), POLLOUT, 0};
+	if (poll(&ready, 1, 0) <= 0)
+		return;
+
+	char line[256];
+	int length = 0;
 	int minutes = game->clock.now / 60.;
 	double seconds = game->clock.now - minutes * 60.;
 	double duration = game->audio.music.duration;
 	int duration_minutes = duration / 60.;
 	double duration_seconds = duration - duration_minutes * 60;
-	printf(
-		"%s %d:%06.3f / %d:%06.3f\r",
+	append(line, sizeof(line), &length,
+		"%s %d:%06.3f / %d:%06.3f",
 		game->paused ? "Paused: " : "Playing:", minutes, seconds,
 		duration_minutes, duration_seconds
 	);
+	double score = oshu::tally_score(&game->tally);
+	if (!std::isnan(score))
+		append(line, sizeof(line), &length, "  %6.2f%%  %dx", score * 100, game->tally.combo);
+	int64_t frames = oshu::metrics[oshu::FRAMES].load();
+	if (oshu::log_priority <= oshu::log_level::info && last_print > 0 && now - last_print >= oshu::status_interval) {
+		append(line, sizeof(line), &length, "  %3.0f fps  %lld missed  %lld underruns",
+		       (frames - last_frames) / (now - last_print),
+		       (long long) oshu::metrics[oshu::MISSED_FRAMES].load(),
+		       (long long) oshu::metrics[oshu::AUDIO_UNDERRUNS].load());
+	}
+	append(line, sizeof(line), &length, "\033[K\r");
+	last_print = now;
+	last_frames = frames;
+
+	/* Keep the order with what was printed through stdio. */
+	fflush(stdout);
+	if (write(fileno(stdout), line, length) < 0)
+		tty = false;
+}
+
+void oshu::print_calibration(const oshu::calibration *calibration)
+{
+	static bool tty = isatty(fileno(stdout));
+	if (!tty)
+		return;
+	const oshu::offset_stats *taps = &calibration->taps;
+	if (taps->count == 0) {
+		printf("Calibrating: tap to the beat\033[K\r");
+	} else {
+		printf("Calibrating: %+6.1f ms, jitter %5.1f ms over %d taps",
+		       taps->mean * 1e3, oshu::offset_jitter(taps) * 1e3, taps->count);
+		if (taps->count >= oshu::calibration_taps)
+			printf("  (Enter to save)");
+		printf("\033[K\r");
+	}
 	fflush(stdout);
 }
 
 void oshu::congratulate(oshu::game_base *game)
 {
 	/* Clear the status line. */
-	printf("\r                                        \r");
-	double score = oshu::score(&game->beatmap);
+	printf("\r\033[K");
+	double score = oshu::tally_score(&game->tally);
         if (std::isnan(score)) return;
 
         int score_color = 0;
         if (score >= 0.9) score_color = 32;
         else if (score < 0.5) score_color = 31;
 	printf(
-		"  \033[1mScore: \033[%dm%3.2f\033[0m%%\n\n",
+		"  \033[1mScore: \033[%dm%3.2f\033[0m%%\n",
 		score_color, score * 100);
+	oshu::offset_stats offsets = oshu::hit_offsets(&game->beatmap);
+	if (offsets.count > 0)
+		printf("  Offset: %+.1f ms, jitter %.1f ms\n",
+		       offsets.mean * 1e3, oshu::offset_jitter(&offsets) * 1e3);
+	printf("\n");
 }
@@ -6,29 +6,123 @@
 #include "library/beatmaps.h"
 
 #include "beatmap/beatmap.h"
+#include "beatmap/builder.h"
+#include "beatmap/stars.h"
+#include "core/hash.h"
 #include "core/log.h"
+#include "core/vfs.h"
 
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
 #include <dirent.h>
+#include <exception>
+#include <fstream>
 #include <iostream>
+#include <mutex>
 #include <sstream>
+#include <sys/stat.h>
 #include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <unistd.h>
 
 namespace oshu {
 
+/**
+ * The sets are scanned by concurrent threads, which must not write to the
+ * log streams at the same time.
+ */
+static std::mutex log_mutex;
+
+/**
+ * What the manifest knows about a beatmap file.
+ *
+ * The file is considered unchanged when its size and modification time are
+ * the same as recorded.
+ */
+struct manifest_record {
+	off_t size;
+	struct timespec mtime;
+	beatmap_entry entry;
+};
+
+/**
+ * Map the path of every .osu file to its record.
+ */
+using manifest = std::unordered_map<std::string, manifest_record>;
+
+/**
+ * The version of the star rating is part of the signature, so that changing
+ * the algorithm rates the whole library again.
+ */
+static const std::string manifest_signature = "oshu-library-manifest 4 stars " + std::to_string(oshu::star_rating_version);
+
+/**
+ * Builder counting and rating the hit objects, and finding when the last one
+ * ends, without storing them.
+ *
+ * The timing points are kept because the sliders' duration depends on them.
+ */
+struct entry_builder : public oshu::builder {
+	bool headers(oshu::beatmap &beatmap) override
+	{
+		oshu::start_star_rating(&rating, beatmap.difficulty.circle_radius);
+		return true;
+	}
+	oshu::timing_point* timing_point(const oshu::timing_point &t) override
+	{
+		timing_points.push_back(t);
+		return &timing_points.back();
+	}
+	bool hit_object(oshu::hit &hit) override
+	{
+		++objects;
+		oshu::rate_hit(&rating, &hit);
+		double end;
+		if (hit.type & oshu::SPINNER_HIT)
+			end = hit.spinner.end_time;
+		else if (hit.type & oshu::HOLD_HIT)
+			end = hit.hold_note.end_time;
+		else
+			end = oshu::hit_end_time(&hit);
+		duration = std::max(duration, end);
+		return false;
+	}
+	/**
+	 * A deque, whose elements never move.
+	 */
+	std::deque<oshu::timing_point> timing_points;
+	int objects = 0;
+	double duration = 0;
+	oshu::star_rating rating;
+};
+
 beatmap_entry::beatmap_entry(const std::string &path)
 : path(path)
 {
 	oshu::beatmap beatmap;
-	int rc = oshu::load_beatmap_headers(path.c_str(), &beatmap);
-	if (rc < 0)
+	entry_builder builder;
+	int rc = oshu::load_beatmap(path.c_str(), &beatmap, &builder);
+	if (rc < 0) {
+		oshu::destroy_beatmap(&beatmap);
 		throw std::runtime_error("could not load beatmap " + path);
+	}
 	mode = beatmap.mode;
 	difficulty = beatmap.difficulty.overall_difficulty;
 	title = beatmap.metadata.title;
 	artist = beatmap.metadata.artist;
 	version = beatmap.metadata.version;
 	oshu::destroy_beatmap(&beatmap);
+	duration = builder.duration;
+	objects = builder.objects;
+	stars = oshu::finish_star_rating(&builder.rating);
+	if (oshu::hash_file(path.c_str(), &hash) < 0)
+		throw std::runtime_error("could not hash beatmap " + path);
 }
 
 static bool osu_file(const char *filename)
@@ -39,8 +133,83 @@ static bool osu_file(const char *filename)
 	return !strcmp(filename + l - 4, ".osu");
 }
 
-static void find_entries(const std::string &path, beatmap_set &set)
+/**
+ * Build the entry for the .osu file at *path*, from the old manifest if the
+ * file is unchanged, or by parsing it otherwise.
+ *
+ * The up-to-date record is appended to *fresh*, when not null.
+ *
+ * Throw a *std::runtime_error* if the beatmap is invalid.
+ */
+static beatmap_entry scan_entry(const std::string &path, const manifest *old, std::vector<manifest_record> *fresh)
 {
+	/* Archived beatmaps change along with their archive. */
+	std::string archive, member;
+	const std::string &file = oshu::split_archive_path(path, &archive, &member) ? archive : path;
+	struct stat s;
+	if (stat(file.c_str(), &s) < 0)
+		throw std::system_error(errno, std::system_category(), "could not stat " + file);
+	if (old) {
+		auto it = old->find(path);
+		if (it != old->end()) {
+			const manifest_record &r = it->second;
+			if (r.size == s.st_size && r.mtime.tv_sec == s.st_mtim.tv_sec && r.mtime.tv_nsec == s.st_mtim.tv_nsec) {
+				if (fresh)
+					fresh->push_back(r);
+				return r.entry;
+			}
+		}
+	}
+	beatmap_entry entry (path);
+	if (fresh)
+		fresh->push_back({s.st_size, s.st_mtim, entry});
+	return entry;
+}
+
+/**
+ * Scan a .osu file and add it to the set, unless it's invalid or for another
+ * mode.
+ */
+static void add_entry(const std::string &path, beatmap_set &set, const manifest *old, std::vector<manifest_record> *fresh)
+{
+	try {
+		beatmap_entry entry = scan_entry(path, old, fresh);
+		if (entry.mode != oshu::OSU_MODE && entry.mode != oshu::MANIA_MODE) {
+			std::lock_guard<std::mutex> lock (log_mutex);
+			oshu::debug_log() << "skipping " << path << ": unsupported mode" << std::endl;
+		} else {
+			set.entries.push_back(std::move(entry));
+		}
+	} catch(std::runtime_error &e) {
+		std::lock_guard<std::mutex> lock (log_mutex);
+		oshu::warning_log() << e.what() << std::endl;
+		oshu::warning_log() << "ignoring invalid beatmap " << path << std::endl;
+	}
+}
+
+/**
+ * Find the .osu files of an .osz archive, without extracting it.
+ *
+ * The entries' paths go through the archive, as described in \ref core_vfs.
+ */
+static void find_archived_entries(const std::string &path, beatmap_set &set, const manifest *old, std::vector<manifest_record> *fresh)
+{
+	std::shared_ptr<oshu::archive> archive = oshu::open_archive(path);
+	if (!archive)
+		throw std::system_error(EINVAL, std::system_category(), "could not open the beatmap archive " + path);
+	for (const oshu::archive_member &member : archive->members) {
+		if (osu_file(member.name.c_str()))
+			add_entry(path + "/" + member.name, set, old, fresh);
+	}
+}
+
+static void find_entries(const std::string &path, beatmap_set &set, const manifest *old, std::vector<manifest_record> *fresh)
+{
+	set.path = path;
+	if (oshu::archive_name(path)) {
+		find_archived_entries(path, set, old, fresh);
+		return;
+	}
 	DIR *dir = opendir(path.c_str());
 	if (!dir)
 		throw std::system_error(errno, std::system_category(), "could not open the beatmap set directory " + path);
@@ -48,7 +217,9 @@ static void find_entries(const std::string &path, beatmap_set &set)
 		errno = 0;
 		struct dirent* entry = readdir(dir);
 		if (errno) {
-			throw std::system_error(errno, std::system_category(), "could not read the beatmap set directory " + path);
+			int error = errno;
+			closedir(dir);
+			throw std::system_error(error, std::system_category(), "could not read the beatmap set directory " + path);
 		} else if (!entry) {
 			// end of directory
 			break;
@@ -58,18 +229,9 @@ static void find_entries(const std::string &path, beatmap_set &set)
 		} else if (!osu_file(entry->d_name)) {
 			continue;
 		} else {
-			try {
-				std::ostringstream os;
-				os << path << "/" << entry->d_name;
-				beatmap_entry entry (os.str());
-				if (entry.mode != oshu::OSU_MODE)
-					oshu::debug_log() << "skipping " << path << ": unsupported mode" << std::endl;
-				else
-					set.entries.push_back(std::move(entry));
-			} catch(std::runtime_error &e) {
-				oshu::warning_log() << e.what() << std::endl;
-				oshu::warning_log() << "ignoring invalid beatmap " << path << std::endl;
-			}
+			std::ostringstream os;
+			os << path << "/" << entry->d_name;
+			add_entry(os.str(), set, old, fresh);
 		}
 	}
 	closedir(dir);
@@ -77,28 +239,39 @@ static void find_entries(const std::string &path, beatmap_set &set)
 
 static bool compare_entries(const beatmap_entry &a, const beatmap_entry &b)
 {
-	return a.difficulty < b.difficulty;
+	return a.stars < b.stars;
 }
 
+/**
+ * Sort by artist, then by title.
+ *
+ * The strings are interned, so the common case of sets by the same artist is
+ * told by comparing their addresses, and most of the others by their
+ * prefixes, without reading the characters.
+ */
 static bool compare_sets(const beatmap_set &a, const beatmap_set &b)
 {
-	int cmp = a.artist.compare(b.artist);
-	if (cmp == 0) {
-		// artist is the same, compare titles
-		return a.title.compare(b.title) < 0;
-	} else {
-		return cmp < 0;
+	if (a.artist != b.artist)
+		return a.artist < b.artist;
+	return a.title < b.title;
+}
+
+/**
+ * Finish building a set after its entries were found.
+ */
+static void sort_set(beatmap_set &set)
+{
+	if (!set.empty()) {
+		set.title = set.entries[0].title;
+		set.artist = set.entries[0].artist;
+		std::sort(set.entries.begin(), set.entries.end(), compare_entries);
 	}
 }
 
 beatmap_set::beatmap_set(const std::string &path)
 {
-	find_entries(path, *this);
-	if (!empty()) {
-		title = entries[0].title;
-		artist = entries[0].artist;
-		std::sort(entries.begin(), entries.end(), compare_entries);
-	}
+	find_entries(path, *this, nullptr, nullptr);
+	sort_set(*this);
 }
 
 bool beatmap_set::empty() const
@@ -106,10 +279,96 @@ bool beatmap_set::empty() const
 	return entries.empty();
 };
 
-std::vector<beatmap_set> find_beatmap_sets(const std::string &path)
+/**
+ * Tell if a string can be stored in the tab-separated manifest.
+ */
+static bool storable(oshu::interned str)
 {
-	std::vector<beatmap_set> sets;
+	return strcspn(str.c_str(), "\t\n") == str.size();
+}
+
+/**
+ * Load a manifest written by #save_manifest.
+ *
+ * On error, the manifest is left empty or incomplete, which is harmless.
+ */
+static void load_manifest(const std::string &path, manifest &m)
+{
+	std::ifstream file (path);
+	if (!file)
+		return;
+	std::string line;
+	if (!std::getline(file, line) || line != manifest_signature) {
+		oshu::warning_log() << "ignoring the outdated or invalid library manifest " << path << std::endl;
+		return;
+	}
+	while (std::getline(file, line)) {
+		std::istringstream fields (line);
+		manifest_record r;
+		long long size, sec, nsec;
+		int mode;
+		std::string file_path, title, artist, version;
+		fields >> size >> sec >> nsec >> mode >> r.entry.difficulty >> std::hex >> r.entry.hash >> std::dec >> r.entry.objects >> r.entry.duration >> r.entry.stars;
+		fields.ignore(1);
+		std::getline(fields, file_path, '\t');
+		std::getline(fields, title, '\t');
+		std::getline(fields, artist, '\t');
+		std::getline(fields, version, '\t');
+		if (!fields) {
+			oshu::warning_log() << "invalid record in the library manifest " << path << std::endl;
+			m.clear();
+			return;
+		}
+		r.size = size;
+		r.mtime.tv_sec = sec;
+		r.mtime.tv_nsec = nsec;
+		r.entry.mode = static_cast<oshu::mode>(mode);
+		r.entry.title = title;
+		r.entry.artist = artist;
+		r.entry.version = version;
+		r.entry.path = file_path;
+		m.emplace(std::move(file_path), std::move(r));
+	}
+}
+
+/**
+ * Write the manifest atomically, so that a concurrent or interrupted scan
+ * doesn't leave a truncated file behind.
+ */
+static void save_manifest(const std::string &path, const std::vector<std::vector<manifest_record>> &records)
+{
+	std::string tmp = path + ".tmp" + std::to_string(getpid());
+	{
+		std::ofstream file (tmp);
+		file << manifest_signature << "\n";
+		for (auto &set : records) {
+			for (auto &r : set) {
+				const beatmap_entry &e = r.entry;
+				if (!storable(e.path) || !storable(e.title) || !storable(e.artist) || !storable(e.version))
+					continue;
+				file << (long long) r.size << " " << (long long) r.mtime.tv_sec << " " << (long long) r.mtime.tv_nsec
+				     << " " << (int) e.mode << " " << e.difficulty << " " << std::hex << e.hash << std::dec
+				     << " " << e.objects << " " << e.duration << " " << e.stars << "\t" << e.path << "\t" << e.title << "\t" << e.artist << "\t" << e.version << "\n";
+			}
+		}
+		if (!file) {
+			oshu::warning_log() << "could not write the library manifest " << tmp << std::endl;
+			unlink(tmp.c_str());
+			return;
+		}
+	}
+	if (std::rename(tmp.c_str(), path.c_str()) < 0) {
+		oshu::warning_log() << "could not rename " << tmp << std::endl;
+		unlink(tmp.c_str());
+	}
+}
 
+/**
+ * List the candidate beatmap set directories, in directory order.
+ */
+static std::vector<std::string> list_sets(const std::string &path)
+{
+	std::vector<std::string> paths;
 	DIR *dir = opendir(path.c_str());
 	if (!dir)
 		throw std::system_error(errno, std::system_category(), "could not open the beatmaps directory " + path);
@@ -117,7 +376,9 @@ std::vector<beatmap_set> find_beatmap_sets(const std::string &path)
 		errno = 0;
 		struct dirent* entry = readdir(dir);
 		if (errno) {
-			throw std::system_error(errno, std::system_category(), "could not read the beatmaps directory");
+			int error = errno;
+			closedir(dir);
+			throw std::system_error(error, std::system_category(), "could not read the beatmaps directory");
 		} else if (!entry) {
 			// end of directory
 			break;
@@ -125,19 +386,100 @@ std::vector<beatmap_set> find_beatmap_sets(const std::string &path)
 			// hidden directory, ignore
 			continue;
 		} else {
+			std::ostringstream os;
+			os << path << "/" << entry->d_name;
+			paths.push_back(os.str());
+		}
+	}
+	closedir(dir);
+	return paths;
+}
+
+void scan_beatmap_sets(const std::string &path, const std::string &manifest_path, const std::function<void(beatmap_set&&)> &sink)
+{
+	std::vector<std::string> paths = list_sets(path);
+
+	manifest old;
+	if (!manifest_path.empty())
+		load_manifest(manifest_path, old);
+	const manifest *previous = manifest_path.empty() ? nullptr : &old;
+
+	/* The workers take the directories in turn, and hand the sets over to
+	 * the calling thread through the queue. */
+	std::vector<std::vector<manifest_record>> records (paths.size());
+	std::atomic<size_t> next {0};
+	std::mutex queue_mutex;
+	std::condition_variable queue_ready;
+	std::deque<beatmap_set> queue;
+	size_t running = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), paths.size());
+
+	auto work = [&]() {
+		for (size_t i; (i = next++) < paths.size();) {
+			beatmap_set set;
 			try {
-				std::ostringstream os;
-				os << path << "/" << entry->d_name;
-				beatmap_set set (os.str());
-				if (!set.empty())
-					sets.push_back(std::move(set));
+				find_entries(paths[i], set, previous, &records[i]);
+				sort_set(set);
 			} catch (std::system_error& e) {
+				std::lock_guard<std::mutex> lock (log_mutex);
 				oshu::debug_log() << e.what() << std::endl;
+				continue;
 			}
+			if (set.empty())
+				continue;
+			std::lock_guard<std::mutex> lock (queue_mutex);
+			queue.push_back(std::move(set));
+			queue_ready.notify_one();
 		}
+		std::lock_guard<std::mutex> lock (queue_mutex);
+		--running;
+		queue_ready.notify_one();
+	};
+	std::vector<std::thread> workers;
+	for (size_t i = 0; i < running; ++i)
+		workers.emplace_back(work);
+
+	std::exception_ptr error;
+	std::unique_lock<std::mutex> lock (queue_mutex);
+	for (;;) {
+		queue_ready.wait(lock, [&]() { return !queue.empty() || running == 0; });
+		if (queue.empty())
+			break;
+		beatmap_set set = std::move(queue.front());
+		queue.pop_front();
+		if (error)
+			continue;
+		/* Let the workers go on while the sink processes the set. */
+		lock.unlock();
+		try {
+			sink(std::move(set));
+		} catch (...) {
+			error = std::current_exception();
+			next = paths.size();
+		}
+		lock.lock();
 	}
-	closedir(dir);
+	lock.unlock();
+	for (std::thread &t : workers)
+		t.join();
+	if (error)
+		std::rethrow_exception(error);
+
+	if (!manifest_path.empty())
+		save_manifest(manifest_path, records);
+}
+
+std::vector<beatmap_set> find_beatmap_sets(const std::string &path, const std::string &manifest)
+{
+	std::vector<beatmap_set> sets;
+	scan_beatmap_sets(path, manifest, [&](beatmap_set &&set) { sets.push_back(std::move(set)); });
 	std::sort(sets.begin(), sets.end(), compare_sets);
+	std::unordered_set<uint64_t> seen;
+	for (beatmap_set &set : sets) {
+		set.entries.erase(std::remove_if(set.entries.begin(), set.entries.end(), [&](const beatmap_entry &e) {
+			return !seen.insert(e.hash).second;
+		}), set.entries.end());
+	}
+	sets.erase(std::remove_if(sets.begin(), sets.end(), [](const beatmap_set &set) { return set.empty(); }), sets.end());
 	return sets;
 }
 
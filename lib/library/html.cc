@@ -7,8 +7,23 @@
 
 #include "library/html.h"
 
+#include "core/hash.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <fstream>
 #include <iostream>
-#include <unordered_map>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+#include <zlib.h>
 
 namespace oshu {
 
@@ -22,22 +37,40 @@ html_escape::html_escape(const std::string &str)
 {
 }
 
-static std::unordered_map<char, std::string> escape_sequences = {
-	{'<', "&lt;"},
-	{'>', "&gt;"},
-	{'&', "&amp;"},
-	{'"', "&quot;"}, // for attributes
-};
+html_escape::html_escape(oshu::interned str)
+: data(str.c_str())
+{
+}
+
+/**
+ * Escape sequence of every byte, or null for bytes that are output as is.
+ *
+ * UTF-8 sequences only contain bytes above 0x7F, which are never escaped.
+ */
+static const struct escape_table {
+	const char *sequences[256] {};
+	escape_table()
+	{
+		sequences['<'] = "&lt;";
+		sequences['>'] = "&gt;";
+		sequences['&'] = "&amp;";
+		sequences['"'] = "&quot;"; // for attributes
+	}
+} escape_sequences;
 
 std::ostream& operator<<(std::ostream &os, const html_escape &e)
 {
+	const char *run = e.data;
 	for (const char *c = e.data; *c; ++c) {
-		auto i = escape_sequences.find(*c);
-		if (i != escape_sequences.end())
-			os << i->second;
-		else
-			os << *c;
+		const char *seq = escape_sequences.sequences[(unsigned char) *c];
+		if (seq) {
+			os.write(run, c - run);
+			os << seq;
+			run = c + 1;
+		}
 	}
+	/* Output the final run of plain characters in bulk. */
+	os.write(run, strlen(run));
 	return os;
 }
 
@@ -50,7 +83,20 @@ static const char *head = R"html(
 
 static void generate_entry(const beatmap_entry &entry, std::ostream &os)
 {
-	os << "<li><a href=\"" << html_escape{entry.path} << "\">" << html_escape{entry.version} << "</a></li>";
+	char stars[16];
+	snprintf(stars, sizeof(stars), "%.2f", entry.stars);
+	os << "<li><a href=\"" << html_escape{entry.path} << "\">" << html_escape{entry.version} << "</a> "
+	   << stars << "★</li>";
+}
+
+/**
+ * The anchor of a set, stable as long as the set stays in the same directory.
+ */
+static std::string set_id(const std::string &path)
+{
+	char id[24];
+	snprintf(id, sizeof(id), "s%016llx", (unsigned long long) oshu::hash_bytes(path.data(), path.size()));
+	return id;
 }
 
 /**
@@ -61,21 +107,319 @@ static void generate_entry(const beatmap_entry &entry, std::ostream &os)
  * Add a picture. If the background images are too heavy, maybe we'll need to
  * resize them, and possibly also crop them for uniformity.
  */
-static void generate_set(const beatmap_set &set, std::ostream &os)
+static void generate_set(const beatmap_set &set, const std::string &preview, std::ostream &os)
 {
-	os << "<article>";
-	os << "<h4>" << html_escape{set.artist} << " - " << html_escape{set.title} << "</h4><ul>";
+	os << "<article id=\"" << set_id(set.path) << "\">";
+	os << "<h4>" << html_escape{set.artist} << " - " << html_escape{set.title} << "</h4>";
+	if (!preview.empty())
+		os << "<audio controls preload=\"none\" src=\"" << html_escape{preview} << "\"></audio>";
+	os << "<ul>";
 	for (const beatmap_entry &entry : set.entries)
 		generate_entry(entry, os);
 	os << "</ul></article>";
 }
 
-void generate_html_beatmap_set_listing(const std::vector<beatmap_set> &sets, std::ostream &os)
+html_listing::html_listing(std::ostream &os)
+: os(os)
 {
 	os << head;
 	os << "<link rel=\"stylesheet\" href=\"" << html_escape{OSHU_WEB_DIRECTORY} << "/style.css\" />";
+}
+
+void html_listing::add(const beatmap_set &set)
+{
+	generate_set(set, "", os);
+}
+
+void generate_html_beatmap_set_listing(const std::vector<beatmap_set> &sets, std::ostream &os)
+{
+	html_listing listing (os);
 	for (const beatmap_set &set : sets)
-		generate_set(set, os);
+		listing.add(set);
+}
+
+void html_index::update(const beatmap_set &set)
+{
+	if (set.empty()) {
+		remove(set.path);
+		return;
+	}
+	std::ostringstream html;
+	auto preview = previews.find(set.path);
+	generate_set(set, preview == previews.end() ? "" : preview->second, html);
+	fragments[set.path] = html_fragment {set.artist, set.title, set_id(set.path), html.str()};
+}
+
+void html_index::remove(const std::string &path)
+{
+	fragments.erase(path);
+}
+
+static std::vector<const html_fragment*> sort_fragments(const std::unordered_map<std::string, html_fragment> &fragments)
+{
+	std::vector<const html_fragment*> sorted;
+	sorted.reserve(fragments.size());
+	for (auto &it : fragments)
+		sorted.push_back(&it.second);
+	std::sort(sorted.begin(), sorted.end(), [](const html_fragment *a, const html_fragment *b) {
+		return a->artist != b->artist ? a->artist < b->artist : a->title < b->title;
+	});
+	return sorted;
+}
+
+void html_index::write(std::ostream &os) const
+{
+	html_listing listing (os);
+	for (const html_fragment *fragment : sort_fragments(fragments))
+		os << fragment->html;
+}
+
+/**
+ * The shards, in order. Their file is `index-<key>.html`.
+ */
+static const std::vector<std::string> shard_keys = {
+	"0", "a", "b", "c", "d", "e", "f", "g", "h", "i", "j", "k", "l", "m",
+	"n", "o", "p", "q", "r", "s", "t", "u", "v", "w", "x", "y", "z", "other",
+};
+
+/**
+ * Find the index of a set's shard in #shard_keys from its artist.
+ *
+ * Non-ASCII initials all go to the last shard, because there's no telling how
+ * they sort relative to each other without a locale.
+ */
+static size_t shard_of(oshu::interned artist)
+{
+	unsigned char c = artist.c_str()[0];
+	if (c >= 'A' && c <= 'Z')
+		c += 'a' - 'A';
+	if (c >= 'a' && c <= 'z')
+		return 1 + c - 'a';
+	else if (c >= '0' && c <= '9')
+		return 0;
+	else
+		return shard_keys.size() - 1;
+}
+
+static std::string shard_label(const std::string &key)
+{
+	if (key == "0")
+		return "0-9";
+	else if (key == "other")
+		return "…";
+	std::string label = key;
+	label[0] += 'A' - 'a';
+	return label;
+}
+
+/**
+ * Escape a string for a JSON string literal, quotes excluded.
+ */
+static void write_json_string(std::ostream &os, const char *str)
+{
+	for (const char *c = str; *c; ++c) {
+		unsigned char byte = *c;
+		if (byte == '"' || byte == '\\') {
+			os << '\\' << *c;
+		} else if (byte < 0x20) {
+			char escape[8];
+			snprintf(escape, sizeof(escape), "\\u%04x", byte);
+			os << escape;
+		} else {
+			os << *c;
+		}
+	}
+}
+
+/**
+ * Compress a whole file in the gzip format, as expected by the web servers'
+ * static gzip modules.
+ */
+static std::string gzip(const std::string &data)
+{
+	z_stream stream {};
+	/* 16 more bits of window selects the gzip header rather than zlib's. */
+	if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+		throw std::runtime_error("could not initialize the gzip compressor");
+	std::string out(deflateBound(&stream, data.size()), '\0');
+	stream.next_in = (Bytef*) data.data();
+	stream.avail_in = data.size();
+	stream.next_out = (Bytef*) &out[0];
+	stream.avail_out = out.size();
+	int rc = deflate(&stream, Z_FINISH);
+	out.resize(stream.total_out);
+	deflateEnd(&stream);
+	if (rc != Z_STREAM_END)
+		throw std::runtime_error("could not gzip a file");
+	return out;
+}
+
+static bool same_content(const std::string &path, const std::string &data)
+{
+	std::ifstream in(path, std::ios::binary);
+	if (!in)
+		return false;
+	std::ostringstream current;
+	current << in.rdbuf();
+	return current.str() == data;
+}
+
+static void write_file(const std::string &path, const std::string &data)
+{
+	std::string tmp = path + ".tmp";
+	{
+		std::ofstream out(tmp, std::ios::binary);
+		out.write(data.data(), data.size());
+		if (!out)
+			throw std::system_error(errno, std::system_category(), "could not write " + tmp);
+	}
+	if (rename(tmp.c_str(), path.c_str()) < 0)
+		throw std::system_error(errno, std::system_category(), "could not write " + path);
+}
+
+/**
+ * A file of the sharded index, with its content.
+ */
+struct shard_file {
+	std::string path;
+	std::string data;
+};
+
+/**
+ * Write the files that changed along with their gzipped version, in parallel,
+ * since compressing is the slow part.
+ *
+ * The compressed version is written first, so that an interrupted write is
+ * caught by the next one.
+ *
+ * \return The number of files written.
+ */
+static size_t write_shard_files(const std::vector<shard_file> &files)
+{
+	std::vector<const shard_file*> changed;
+	for (const shard_file &file : files) {
+		if (!same_content(file.path, file.data) || access((file.path + ".gz").c_str(), F_OK) < 0)
+			changed.push_back(&file);
+	}
+	std::atomic<size_t> next {0};
+	std::mutex mutex;
+	std::exception_ptr error;
+	auto work = [&]() {
+		for (size_t i; (i = next++) < changed.size();) {
+			try {
+				write_file(changed[i]->path + ".gz", gzip(changed[i]->data));
+				write_file(changed[i]->path, changed[i]->data);
+			} catch (...) {
+				std::lock_guard<std::mutex> lock(mutex);
+				if (!error)
+					error = std::current_exception();
+			}
+		}
+	};
+	size_t count = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), changed.size());
+	std::vector<std::thread> workers;
+	for (size_t i = 0; i < count; ++i)
+		workers.emplace_back(work);
+	for (std::thread &t : workers)
+		t.join();
+	if (error)
+		std::rethrow_exception(error);
+	return changed.size();
+}
+
+size_t html_index::write_shards(const std::string &directory) const
+{
+	std::vector<const html_fragment*> sorted = sort_fragments(fragments);
+	std::vector<std::vector<const html_fragment*>> shards(shard_keys.size());
+	for (const html_fragment *fragment : sorted)
+		shards[shard_of(fragment->artist)].push_back(fragment);
+
+	std::ostringstream nav;
+	nav << "<nav><a href=\"index.html\">Search</a>";
+	for (size_t i = 0; i < shards.size(); ++i) {
+		if (!shards[i].empty())
+			nav << " <a href=\"index-" << shard_keys[i] << ".html\">" << shard_label(shard_keys[i]) << "</a>";
+	}
+	nav << "</nav>";
+
+	std::vector<shard_file> files;
+	for (size_t i = 0; i < shards.size(); ++i) {
+		std::string path = directory + "/index-" + shard_keys[i] + ".html";
+		if (shards[i].empty()) {
+			unlink(path.c_str());
+			unlink((path + ".gz").c_str());
+			continue;
+		}
+		std::ostringstream page;
+		html_listing listing (page);
+		page << nav.str();
+		for (const html_fragment *fragment : shards[i])
+			page << fragment->html;
+		files.push_back(shard_file {path, page.str()});
+	}
+
+	std::ostringstream manifest;
+	manifest << "{\"sets\":[";
+	for (size_t i = 0; i < sorted.size(); ++i) {
+		const html_fragment *fragment = sorted[i];
+		manifest << (i ? ",\n" : "\n") << "[\"";
+		write_json_string(manifest, fragment->artist.c_str());
+		manifest << "\",\"";
+		write_json_string(manifest, fragment->title.c_str());
+		manifest << "\",\"" << shard_keys[shard_of(fragment->artist)] << "\",\"" << fragment->id << "\"]";
+	}
+	manifest << "\n]}\n";
+	files.push_back(shard_file {directory + "/index.json", manifest.str()});
+
+	std::ostringstream landing;
+	html_listing listing (landing);
+	landing << nav.str();
+	landing << "<p>" << sorted.size() << " beatmap sets</p>";
+	landing << "<input type=\"search\" id=\"search\" placeholder=\"Search\" autofocus />";
+	landing << "<ul id=\"results\"></ul>";
+	landing << "<script src=\"" << html_escape{OSHU_WEB_DIRECTORY} << "/search.js\"></script>";
+	files.push_back(shard_file {directory + "/index.html", landing.str()});
+
+	return write_shard_files(files);
+}
+
+size_t html_index::size() const
+{
+	return fragments.size();
+}
+
+std::unordered_map<std::string, std::string> load_preview_map(const std::string &path)
+{
+	std::unordered_map<std::string, std::string> previews;
+	std::ifstream in(path);
+	std::string line;
+	while (std::getline(in, line)) {
+		size_t tab = line.rfind('\t');
+		if (tab != std::string::npos)
+			previews[line.substr(0, tab)] = line.substr(tab + 1);
+	}
+	return previews;
+}
+
+void save_preview_map(const std::string &path, const std::unordered_map<std::string, std::string> &previews)
+{
+	std::string tmp = path + ".tmp";
+	{
+		std::ofstream out(tmp);
+		for (auto &it : previews)
+			out << it.first << '\t' << it.second << '\n';
+		if (!out)
+			throw std::system_error(errno, std::system_category(), "could not write " + tmp);
+	}
+	if (rename(tmp.c_str(), path.c_str()) < 0)
+		throw std::system_error(errno, std::system_category(), "could not write " + path);
+}
+
+void generate_html_beatmap_library_listing(const std::string &path, const std::string &manifest, std::ostream &os)
+{
+	html_index index;
+	oshu::scan_beatmap_sets(path, manifest, [&](beatmap_set &&set) { index.update(set); });
+	index.write(os);
 }
 
 }
@@ -0,0 +1,389 @@
+/**
+ * \file lib/library/index.cc
+ * \ingroup library_index
+ *
+ * The index file starts with an #index_header, followed by the columns in the
+ * order of #index_layout, each aligned on 8 bytes.
+ */
+
+#include "library/index.h"
+
+#include "core/log.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <system_error>
+#include <tuple>
+#include <unistd.h>
+#include <unordered_set>
+
+namespace oshu {
+
+static const char index_signature[8] = {'o', 's', 'h', 'u', 'i', 'd', 'x', '2'};
+
+struct index_header {
+	char signature[8];
+	uint32_t count;
+	uint32_t trigram_count;
+	uint32_t posting_count;
+	uint32_t pool_size;
+};
+
+/**
+ * Offsets of every column from the beginning of the file.
+ */
+struct index_layout {
+	size_t hashes, durations, stars, difficulties, objects;
+	size_t titles, artists, versions, paths, texts;
+	size_t modes, trigrams, postings, pool;
+	size_t size;
+};
+
+static size_t align(size_t offset)
+{
+	return (offset + 7) & ~(size_t) 7;
+}
+
+static index_layout compute_layout(const index_header &h)
+{
+	index_layout l;
+	size_t n = h.count;
+	size_t offset = align(sizeof(h));
+	auto column = [&](size_t *field, size_t size) {
+		*field = offset;
+		offset = align(offset + size);
+	};
+	column(&l.hashes, n * sizeof(uint64_t));
+	column(&l.durations, n * sizeof(double));
+	column(&l.stars, n * sizeof(double));
+	column(&l.difficulties, n * sizeof(int32_t));
+	column(&l.objects, n * sizeof(int32_t));
+	column(&l.titles, n * sizeof(uint32_t));
+	column(&l.artists, n * sizeof(uint32_t));
+	column(&l.versions, n * sizeof(uint32_t));
+	column(&l.paths, n * sizeof(uint32_t));
+	column(&l.texts, n * sizeof(uint32_t));
+	column(&l.modes, n);
+	column(&l.trigrams, ((size_t) h.trigram_count + 1) * 2 * sizeof(uint32_t));
+	column(&l.postings, (size_t) h.posting_count * sizeof(uint32_t));
+	column(&l.pool, h.pool_size);
+	l.size = offset;
+	return l;
+}
+
+/**
+ * Check that every column of the header, taken alone, fits in a file of
+ * *size* bytes, so that #compute_layout can't overflow on absurd counts.
+ */
+static bool header_fits(const index_header &h, size_t size)
+{
+	return h.count <= size / sizeof(uint64_t)
+	       && h.trigram_count < size / (2 * sizeof(uint32_t))
+	       && h.posting_count <= size / sizeof(uint32_t)
+	       && h.pool_size <= size;
+}
+
+/**
+ * Lowercase the ASCII letters, leaving the UTF-8 sequences alone.
+ */
+static std::string lowercase(const std::string &str)
+{
+	std::string result = str;
+	for (char &c : result) {
+		if (c >= 'A' && c <= 'Z')
+			c = c - 'A' + 'a';
+	}
+	return result;
+}
+
+static uint32_t trigram_key(const char *p)
+{
+	return (uint32_t) (unsigned char) p[0] << 16 | (uint32_t) (unsigned char) p[1] << 8 | (unsigned char) p[2];
+}
+
+/**
+ * List the trigrams of a string, skipping the ones that span a newline.
+ */
+static void list_trigrams(const std::string &text, std::vector<uint32_t> *keys)
+{
+	for (size_t i = 0; i + 3 <= text.size(); ++i) {
+		if (text[i] == '\n' || text[i + 1] == '\n' || text[i + 2] == '\n')
+			continue;
+		keys->push_back(trigram_key(&text[i]));
+	}
+}
+
+/**
+ * Accumulate strings in the pool, null-terminated.
+ */
+static uint32_t add_string(std::string *pool, const char *str, size_t size)
+{
+	uint32_t offset = pool->size();
+	pool->append(str, size + 1);
+	return offset;
+}
+
+static uint32_t add_string(std::string *pool, const std::string &str)
+{
+	return add_string(pool, str.c_str(), str.size());
+}
+
+static uint32_t add_string(std::string *pool, oshu::interned str)
+{
+	return add_string(pool, str.c_str(), str.size());
+}
+
+template<typename T>
+static void write_column(std::ostream &os, const std::vector<T> &column)
+{
+	os.write(reinterpret_cast<const char*>(column.data()), column.size() * sizeof(T));
+	static const char zeros[8] {};
+	size_t position = os.tellp();
+	os.write(zeros, align(position) - position);
+}
+
+void save_beatmap_index(const std::string &path, std::vector<beatmap_entry> entries)
+{
+	std::sort(entries.begin(), entries.end(), [](const beatmap_entry &a, const beatmap_entry &b) {
+		return std::tie(a.artist, a.title, a.stars, a.version) < std::tie(b.artist, b.title, b.stars, b.version);
+	});
+	std::unordered_set<uint64_t> seen;
+	entries.erase(std::remove_if(entries.begin(), entries.end(), [&](const beatmap_entry &e) {
+		return !seen.insert(e.hash).second;
+	}), entries.end());
+	size_t n = entries.size();
+	std::vector<uint64_t> hashes (n);
+	std::vector<double> durations (n), stars (n);
+	std::vector<int32_t> difficulties (n), objects (n);
+	std::vector<uint32_t> titles (n), artists (n), versions (n), paths (n), texts (n);
+	std::vector<uint8_t> modes (n);
+	std::string pool;
+	/* Pairs of trigram and entry, packed for sorting. */
+	std::vector<uint64_t> pairs;
+	std::vector<uint32_t> keys;
+	for (size_t i = 0; i < n; ++i) {
+		const beatmap_entry &e = entries[i];
+		hashes[i] = e.hash;
+		durations[i] = e.duration;
+		stars[i] = e.stars;
+		difficulties[i] = e.difficulty;
+		objects[i] = e.objects;
+		modes[i] = e.mode;
+		titles[i] = add_string(&pool, e.title);
+		artists[i] = add_string(&pool, e.artist);
+		versions[i] = add_string(&pool, e.version);
+		paths[i] = add_string(&pool, e.path);
+		std::string text = lowercase(e.artist.str() + "\n" + e.title.str() + "\n" + e.version.str());
+		texts[i] = add_string(&pool, text);
+		keys.clear();
+		list_trigrams(text, &keys);
+		for (uint32_t key : keys)
+			pairs.push_back((uint64_t) key << 32 | i);
+	}
+	std::sort(pairs.begin(), pairs.end());
+	pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+	std::vector<uint32_t> trigrams, postings;
+	for (size_t i = 0; i < pairs.size(); ++i) {
+		uint32_t key = pairs[i] >> 32;
+		if (i == 0 || key != pairs[i - 1] >> 32) {
+			trigrams.push_back(key);
+			trigrams.push_back(postings.size());
+		}
+		postings.push_back(pairs[i] & 0xFFFFFFFF);
+	}
+	/* The sentinel. */
+	trigrams.push_back(0);
+	trigrams.push_back(postings.size());
+
+	index_header header;
+	memcpy(header.signature, index_signature, sizeof(header.signature));
+	header.count = n;
+	header.trigram_count = trigrams.size() / 2 - 1;
+	header.posting_count = postings.size();
+	header.pool_size = pool.size();
+
+	std::string tmp = path + ".tmp" + std::to_string(getpid());
+	{
+		std::ofstream os (tmp, std::ios::binary);
+		os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		write_column(os, hashes);
+		write_column(os, durations);
+		write_column(os, stars);
+		write_column(os, difficulties);
+		write_column(os, objects);
+		write_column(os, titles);
+		write_column(os, artists);
+		write_column(os, versions);
+		write_column(os, paths);
+		write_column(os, texts);
+		write_column(os, modes);
+		write_column(os, trigrams);
+		write_column(os, postings);
+		write_column(os, std::vector<char>(pool.begin(), pool.end()));
+		if (!os) {
+			unlink(tmp.c_str());
+			throw std::system_error(errno, std::system_category(), "could not write the beatmap index " + tmp);
+		}
+	}
+	if (std::rename(tmp.c_str(), path.c_str()) < 0) {
+		int error = errno;
+		unlink(tmp.c_str());
+		throw std::system_error(error, std::system_category(), "could not rename " + tmp);
+	}
+	oshu::debug_log() << "indexed " << n << " beatmaps with " << header.trigram_count << " trigrams" << std::endl;
+}
+
+beatmap_index::beatmap_index(const std::string &path)
+{
+	if (oshu::open_file(path.c_str(), &file) < 0)
+		throw std::runtime_error("could not open the beatmap index " + path);
+	index_header header;
+	if (file.size < sizeof(header)) {
+		oshu::close_file(&file);
+		throw std::runtime_error("truncated beatmap index " + path);
+	}
+	memcpy(&header, file.data, sizeof(header));
+	if (memcmp(header.signature, index_signature, sizeof(index_signature))
+	    || !header_fits(header, file.size)
+	    || compute_layout(header).size != file.size) {
+		oshu::close_file(&file);
+		throw std::runtime_error("invalid beatmap index " + path);
+	}
+	index_layout l = compute_layout(header);
+	const char *base = file.data;
+	count = header.count;
+	hashes = reinterpret_cast<const uint64_t*>(base + l.hashes);
+	durations = reinterpret_cast<const double*>(base + l.durations);
+	stars = reinterpret_cast<const double*>(base + l.stars);
+	difficulties = reinterpret_cast<const int32_t*>(base + l.difficulties);
+	objects = reinterpret_cast<const int32_t*>(base + l.objects);
+	titles = reinterpret_cast<const uint32_t*>(base + l.titles);
+	artists = reinterpret_cast<const uint32_t*>(base + l.artists);
+	versions = reinterpret_cast<const uint32_t*>(base + l.versions);
+	paths = reinterpret_cast<const uint32_t*>(base + l.paths);
+	texts = reinterpret_cast<const uint32_t*>(base + l.texts);
+	modes = reinterpret_cast<const uint8_t*>(base + l.modes);
+	trigrams = reinterpret_cast<const trigram*>(base + l.trigrams);
+	trigram_count = header.trigram_count;
+	postings = reinterpret_cast<const uint32_t*>(base + l.postings);
+	pool = base + l.pool;
+	pool_size = header.pool_size;
+	/* Check the offsets once here, not on every access. The postings are
+	 * too many to check up front, and are checked by #search instead. */
+	bool valid = pool_size > 0 ? pool[pool_size - 1] == '\0' : count == 0;
+	for (uint32_t i = 0; valid && i < count; ++i) {
+		valid = titles[i] < pool_size && artists[i] < pool_size && versions[i] < pool_size
+		        && paths[i] < pool_size && texts[i] < pool_size;
+	}
+	/* The trigram column ends with a sentinel whose first posting is the
+	 * posting count, hence its trigram_count + 1 entries. */
+	for (uint32_t i = 1; valid && i <= trigram_count; ++i)
+		valid = trigrams[i - 1].first <= trigrams[i].first;
+	valid = valid && trigrams[trigram_count].first == header.posting_count;
+	if (!valid) {
+		oshu::close_file(&file);
+		throw std::runtime_error("corrupted beatmap index " + path);
+	}
+}
+
+beatmap_index::~beatmap_index()
+{
+	oshu::close_file(&file);
+}
+
+size_t beatmap_index::size() const
+{
+	return count;
+}
+
+beatmap_entry beatmap_index::entry(uint32_t i) const
+{
+	beatmap_entry e;
+	e.mode = static_cast<oshu::mode>(modes[i]);
+	e.difficulty = difficulties[i];
+	e.title = pool + titles[i];
+	e.artist = pool + artists[i];
+	e.version = pool + versions[i];
+	e.path = pool + paths[i];
+	e.hash = hashes[i];
+	e.duration = durations[i];
+	e.stars = stars[i];
+	e.objects = objects[i];
+	return e;
+}
+
+/**
+ * Find the postings of a trigram by binary search.
+ *
+ * \return null if no entry contains the trigram.
+ */
+const uint32_t *beatmap_index::find_postings(uint32_t key, size_t *size) const
+{
+	const trigram *end = trigrams + trigram_count;
+	const trigram *t = std::lower_bound(trigrams, end, key, [](const trigram &t, uint32_t key) { return t.key < key; });
+	if (t == end || t->key != key)
+		return nullptr;
+	*size = t[1].first - t->first;
+	return postings + t->first;
+}
+
+bool beatmap_index::matches(uint32_t i, const std::vector<std::string> &words) const
+{
+	const char *text = pool + texts[i];
+	for (const std::string &word : words) {
+		if (!strstr(text, word.c_str()))
+			return false;
+	}
+	return true;
+}
+
+std::vector<uint32_t> beatmap_index::search(const std::string &query) const
+{
+	std::vector<std::string> words;
+	std::istringstream is (lowercase(query));
+	for (std::string word; is >> word;)
+		words.push_back(word);
+
+	/* Gather the postings of every trigram, shortest first. */
+	std::vector<std::pair<const uint32_t*, size_t>> lists;
+	std::vector<uint32_t> keys;
+	for (const std::string &word : words)
+		list_trigrams(word, &keys);
+	for (uint32_t key : keys) {
+		size_t size;
+		const uint32_t *list = find_postings(key, &size);
+		if (!list)
+			return {};
+		lists.emplace_back(list, size);
+	}
+	std::sort(lists.begin(), lists.end(), [](const std::pair<const uint32_t*, size_t> &a, const std::pair<const uint32_t*, size_t> &b) {
+		return a.second < b.second;
+	});
+
+	std::vector<uint32_t> results;
+	auto consider = [&](uint32_t i) {
+		if (i >= count)
+			return;
+		for (size_t l = 1; l < lists.size(); ++l) {
+			if (!std::binary_search(lists[l].first, lists[l].first + lists[l].second, i))
+				return;
+		}
+		/* The trigrams of a word may appear apart from each other. */
+		if (matches(i, words))
+			results.push_back(i);
+	};
+	if (lists.empty()) {
+		for (uint32_t i = 0; i < count; ++i)
+			consider(i);
+	} else {
+		for (size_t p = 0; p < lists[0].second; ++p)
+			consider(lists[0].first[p]);
+	}
+	return results;
+}
+
+}
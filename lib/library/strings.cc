@@ -0,0 +1,111 @@
+/**
+ * \file lib/library/strings.cc
+ * \ingroup library_strings
+ */
+
+#include "library/strings.h"
+
+#include "core/arena.h"
+#include "core/hash.h"
+
+#include <algorithm>
+#include <mutex>
+#include <ostream>
+#include <string.h>
+#include <unordered_map>
+
+namespace oshu {
+
+/**
+ * The characters of a string being looked up, or of a pooled string.
+ */
+struct string_key {
+	const char *data;
+	size_t size;
+	bool operator==(const string_key &other) const
+	{
+		return size == other.size && memcmp(data, other.data, size) == 0;
+	}
+};
+
+struct string_key_hash {
+	size_t operator()(const string_key &key) const
+	{
+		return oshu::hash_bytes(key.data, key.size);
+	}
+};
+
+/**
+ * The pooled strings, and the arena holding them.
+ *
+ * The keys of the table point into the arena, so they stay valid as long as
+ * the pool.
+ */
+static struct string_pool {
+	std::mutex mutex;
+	oshu::arena arena {nullptr, oshu::LIBRARY_MEMORY_CATEGORY};
+	std::unordered_map<string_key, const pooled_string*, string_key_hash> table;
+} pool;
+
+static uint64_t make_prefix(const char *data, size_t size)
+{
+	uint64_t prefix = 0;
+	for (size_t i = 0; i < 8; ++i)
+		prefix = prefix << 8 | (i < size ? (unsigned char) data[i] : 0);
+	return prefix;
+}
+
+const pooled_string* intern(const char *data, size_t size)
+{
+	std::lock_guard<std::mutex> lock(pool.mutex);
+	auto it = pool.table.find(string_key {data, size});
+	if (it != pool.table.end())
+		return it->second;
+	pooled_string *str = (pooled_string*) oshu::arena_alloc(&pool.arena, sizeof(pooled_string) + size + 1);
+	str->prefix = make_prefix(data, size);
+	str->size = size;
+	char *chars = reinterpret_cast<char*>(str + 1);
+	memcpy(chars, data, size);
+	chars[size] = '\0';
+	pool.table.emplace(string_key {chars, size}, str);
+	return str;
+}
+
+/**
+ * Interned once, so that default handles don't lock the pool.
+ */
+static const pooled_string *empty_string = intern("", 0);
+
+interned::interned()
+: string(empty_string)
+{
+}
+
+interned::interned(const char *str)
+: string(str ? oshu::intern(str, strlen(str)) : empty_string)
+{
+}
+
+interned::interned(const std::string &str)
+: string(oshu::intern(str.data(), str.size()))
+{
+}
+
+bool interned::operator<(interned other) const
+{
+	if (string == other.string)
+		return false;
+	if (string->prefix != other.string->prefix)
+		return string->prefix < other.string->prefix;
+	/* The first 8 bytes are the same. */
+	size_t n = std::min(string->size, other.string->size);
+	int cmp = memcmp(string->data(), other.string->data(), n);
+	return cmp < 0 || (cmp == 0 && string->size < other.string->size);
+}
+
+std::ostream& operator<<(std::ostream &os, interned str)
+{
+	return os.write(str.c_str(), str.size());
+}
+
+}
@@ -0,0 +1,140 @@
+/**
+ * \file lib/library/watch.cc
+ * \ingroup library_watch
+ */
+
+#include "library/watch.h"
+
+#include "core/log.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <iostream>
+#include <poll.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace oshu {
+
+/**
+ * Sets appearing, disappearing, or being renamed.
+ */
+static const uint32_t root_events = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE;
+
+/**
+ * Beatmaps being written, removed or renamed, and the set itself going away.
+ */
+static const uint32_t set_events = IN_CLOSE_WRITE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF;
+
+static bool osu_file(const char *filename)
+{
+	size_t l = strlen(filename);
+	return l >= 4 && !strcmp(filename + l - 4, ".osu");
+}
+
+library_watcher::library_watcher(const std::string &root)
+: root(root)
+{
+	fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0)
+		throw std::system_error(errno, std::system_category(), "could not initialize inotify");
+	root_watch = inotify_add_watch(fd, root.c_str(), root_events | IN_ONLYDIR);
+	if (root_watch < 0) {
+		int error = errno;
+		close(fd);
+		throw std::system_error(error, std::system_category(), "could not watch " + root);
+	}
+	DIR *dir = opendir(root.c_str());
+	if (!dir) {
+		int error = errno;
+		close(fd);
+		throw std::system_error(error, std::system_category(), "could not open the beatmaps directory " + root);
+	}
+	while (struct dirent *entry = readdir(dir)) {
+		if (entry->d_name[0] != '.')
+			watch_set(root + "/" + entry->d_name);
+	}
+	closedir(dir);
+	oshu::debug_log() << "watching " << sets.size() << " beatmap sets in " << root << std::endl;
+}
+
+library_watcher::~library_watcher()
+{
+	close(fd);
+}
+
+/**
+ * Watch a set directory.
+ *
+ * Archives are regular files, which are watched through the root directory:
+ * their modification, or their replacement, triggers an event there.
+ */
+void library_watcher::watch_set(const std::string &path)
+{
+	int wd = inotify_add_watch(fd, path.c_str(), set_events | IN_ONLYDIR);
+	if (wd >= 0)
+		sets[wd] = path;
+	else if (errno != ENOTDIR && errno != ENOENT)
+		oshu::warning_log() << "could not watch " << path << ": " << strerror(errno) << std::endl;
+}
+
+void library_watcher::read_events(library_changes *changes)
+{
+	alignas(struct inotify_event) char buffer[4096];
+	for (;;) {
+		ssize_t size = read(fd, buffer, sizeof(buffer));
+		if (size < 0 && errno == EINTR)
+			continue;
+		if (size < 0 && errno == EAGAIN)
+			return;
+		if (size < 0)
+			throw std::system_error(errno, std::system_category(), "could not read the inotify events");
+		for (char *p = buffer; p < buffer + size;) {
+			struct inotify_event *event = (struct inotify_event*) p;
+			p += sizeof(*event) + event->len;
+			const char *name = event->len ? event->name : "";
+			if (event->mask & IN_Q_OVERFLOW) {
+				changes->overflow = true;
+			} else if (event->wd == root_watch) {
+				if (!*name || *name == '.')
+					continue;
+				std::string path = root + "/" + name;
+				changes->sets.insert(path);
+				/* A directory renamed keeps its watch, which is given
+				 * back by inotify_add_watch for the new path. */
+				if ((event->mask & (IN_CREATE | IN_MOVED_TO)) && (event->mask & IN_ISDIR))
+					watch_set(path);
+			} else {
+				auto set = sets.find(event->wd);
+				if (set == sets.end())
+					continue;
+				if (event->mask & IN_IGNORED)
+					sets.erase(set);
+				else if ((event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) || osu_file(name))
+					changes->sets.insert(set->second);
+			}
+		}
+	}
+}
+
+bool library_watcher::wait(library_changes *changes, double quiet)
+{
+	int timeout = -1;
+	for (;;) {
+		struct pollfd p = {fd, POLLIN, 0};
+		int rc = poll(&p, 1, timeout);
+		if (rc < 0 && errno == EINTR)
+			return false;
+		else if (rc < 0)
+			throw std::system_error(errno, std::system_category(), "could not wait for inotify events");
+		else if (rc == 0)
+			return true;
+		read_events(changes);
+		if (changes->overflow || !changes->sets.empty())
+			timeout = quiet * 1000;
+	}
+}
+
+}
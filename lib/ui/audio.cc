@@ -5,23 +5,23 @@
 
 #include "ui/audio.h"
 
-#include "audio/stream.h"
+#include "audio/audio.h"
 #include "video/display.h"
 
 #include <assert.h>
 #include <SDL2/SDL.h>
 
-int oshu::create_audio_progress_bar(oshu::display *display, oshu::stream *stream, oshu::audio_progress_bar *bar)
+int oshu::create_audio_progress_bar(oshu::display *display, oshu::audio *audio, oshu::audio_progress_bar *bar)
 {
 	bar->display = display;
-	bar->stream = stream;
+	bar->audio = audio;
 	return 0;
 }
 
 void oshu::show_audio_progress_bar(oshu::audio_progress_bar *bar)
 {
-	assert (bar->stream->duration != 0);
-	double progression = bar->stream->current_timestamp / bar->stream->duration;
+	assert (bar->audio->music.duration != 0);
+	double progression = oshu::music_position(bar->audio) / bar->audio->music.duration;
 	if (progression < 0)
 		progression = 0;
 	else if (progression > 1)
@@ -12,12 +12,20 @@
 #include "ui/background.h"
 
 #include "video/display.h"
+#include "video/texture.h"
+#include "core/hash.h"
+#include "core/home.h"
 #include "core/log.h"
+#include "core/trace.h"
+#include "core/vfs.h"
 
 #include <assert.h>
 #include <cairo/cairo.h>
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
+#include <stdio.h>
+#include <system_error>
+#include <unistd.h>
 
 /**
  * Adjust the background size such that it fits the display.
@@ -25,9 +33,8 @@
  * The result is written in *dest*, such that the rectangle covers the whole
  * window while possibly being cropped.
  */
-static void fit(oshu::display *display, oshu::size size, SDL_Rect *dest)
+static void fit(oshu::size vsize, oshu::size size, SDL_Rect *dest)
 {
-	oshu::size vsize = display->view.size;
 	double window_ratio = oshu::ratio(vsize);;
 	double pic_ratio = oshu::ratio(size);
 
@@ -76,10 +83,10 @@ static void fit(oshu::display *display, oshu::size size, SDL_Rect *dest)
  * \todo
  * Handle cairo errors.
  */
-static int scale_background(oshu::display *display, SDL_Surface **pic)
+static int scale_background(oshu::size screen, SDL_Surface **pic)
 {
 	SDL_Rect target_rect;
-	fit(display, oshu::size((*pic)->w, (*pic)->h), &target_rect);
+	fit(screen, oshu::size((*pic)->w, (*pic)->h), &target_rect);
 	if (target_rect.w >= (*pic)->w)
 		return 0; /* don't upscale */
 	double zoom = (double) target_rect.w / (*pic)->w;
@@ -120,32 +127,145 @@ static int scale_background(oshu::display *display, SDL_Surface **pic)
 	return 0;
 }
 
+/**
+ * Return the path of the scaled picture in the cache, or an empty string if
+ * the cache is unavailable.
+ *
+ * The key is a hash of the picture's content, so that an edited picture isn't
+ * confused with the old one, and the size of the screen.
+ */
+static std::string cache_path(const std::string &filename, oshu::size screen)
+{
+	uint64_t key;
+	if (oshu::hash_file(filename.c_str(), &key) < 0)
+		return "";
+	std::string directory;
+	try {
+		directory = oshu::get_cache_directory("backgrounds");
+	} catch (std::exception &e) {
+		oshu_log_debug("background cache unavailable: %s", e.what());
+		return "";
+	}
+	char name[64];
+	snprintf(name, sizeof(name), "/%016llx-%dx%d.bmp", (unsigned long long) key,
+	         (int) std::real(screen), (int) std::imag(screen));
+	return directory + name;
+}
+
+/**
+ * Save the scaled picture in the cache.
+ *
+ * It is written to a temporary file first, so that another instance of oshu!
+ * never reads a partial file.
+ */
+static void save_cache(SDL_Surface *pic, const std::string &path)
+{
+	std::string tmp = path + ".tmp" + std::to_string(getpid());
+	if (SDL_SaveBMP(pic, tmp.c_str()) < 0) {
+		oshu_log_debug("could not cache the background: %s", SDL_GetError());
+		unlink(tmp.c_str());
+	} else if (rename(tmp.c_str(), path.c_str()) < 0) {
+		unlink(tmp.c_str());
+	} else {
+		oshu_log_debug("cached the background in %s", path.c_str());
+	}
+}
+
+/**
+ * Decode and scale the picture, or read it from the cache.
+ *
+ * This runs on the loader thread, so it must not touch the renderer.
+ *
+ * \return The scaled picture, or null on failure.
+ */
+static SDL_Surface *load_picture(std::string filename, oshu::size screen)
+{
+	int64_t start = oshu::trace_clock();
+	std::string cache = cache_path(filename, screen);
+	if (!cache.empty()) {
+		SDL_Surface *pic = SDL_LoadBMP(cache.c_str());
+		if (pic) {
+			oshu::log_startup("loading the cached background", start);
+			return pic;
+		}
+	}
+
+	oshu::file_view file;
+	if (oshu::open_file(filename.c_str(), &file) < 0)
+		return nullptr;
+	SDL_Surface *pic = IMG_Load_RW(SDL_RWFromConstMem(file.data, file.size), 1);
+	oshu::close_file(&file);
+	if (!pic) {
+		oshu_log_error("error loading background: %s", IMG_GetError());
+		return nullptr;
+	}
+	int width = pic->w;
+	if (scale_background(screen, &pic) < 0) {
+		SDL_FreeSurface(pic);
+		return nullptr;
+	}
+	/* Small pictures are cheap to load again. */
+	if (!cache.empty() && pic->w < width)
+		save_cache(pic, cache);
+	oshu::log_startup("loading the background", start);
+	return pic;
+}
+
+void oshu::prefetch_background(const char *filename, oshu::size screen)
+{
+	SDL_Surface *pic = load_picture(filename, screen);
+	if (pic)
+		SDL_FreeSurface(pic);
+}
+
 int oshu::load_background(oshu::display *display, const char *filename, oshu::background *background)
 {
 	*background = {};
 	background->display = display;
+	background->layer.opaque = true;
 	if (!(display->features & oshu::SHOW_BACKGROUND))
 		return 0;
 
-	SDL_Surface *pic = IMG_Load(filename);
-	if (!pic) {
-		oshu_log_error("error loading background: %s", IMG_GetError());
+	try {
+		background->loader = std::async(std::launch::async, load_picture, std::string(filename), display->view.size);
+	} catch (std::system_error &e) {
+		oshu_log_error("could not start loading the background: %s", e.what());
 		return -1;
 	}
-	if (scale_background(display, &pic) < 0)
+	return 0;
+}
+
+int oshu::load_background_video(oshu::display *display, const char *filename, double offset, const double *clock, oshu::background *background)
+{
+	background->display = display;
+	if (!(display->features & oshu::SHOW_BACKGROUND))
+		return 0;
+	background->movie.reset(new oshu::movie);
+	background->clock = clock;
+	background->video_offset = offset;
+	if (oshu::open_movie(display, filename, background->movie.get()) < 0) {
+		oshu::close_movie(background->movie.get());
+		background->movie.reset();
 		return -1;
+	}
+	return 0;
+}
 
+/**
+ * Upload the picture once the loader is done.
+ */
+static void upload(oshu::background *background)
+{
+	SDL_Surface *pic = background->loader.get();
+	if (!pic)
+		return;
 	background->picture.size = oshu::size(pic->w, pic->h);
 	background->picture.origin = 0;
-	background->picture.texture = SDL_CreateTextureFromSurface(display->renderer, pic);
+	background->picture.texture = SDL_CreateTextureFromSurface(background->display->renderer, pic);
+	oshu::track_texture(background->picture.texture);
 	SDL_FreeSurface(pic);
-
-	if (!background->picture.texture) {
+	if (!background->picture.texture)
 		oshu_log_error("error uploading background: %s", SDL_GetError());
-		return -1;
-	} else {
-		return 0;
-	}
 }
 
 /**
@@ -158,21 +278,46 @@ int oshu::load_background(oshu::display *display, const char *filename, oshu::ba
 static void fill_screen(oshu::display *display, oshu::texture *pic)
 {
 	SDL_Rect dest;
-	fit(display, pic->size, &dest);
+	fit(display->view.size, pic->size, &dest);
 	SDL_RenderCopy(display->renderer, pic->texture, NULL, &dest);
 }
 
+/**
+ * Draw the current frame of the video, if it has one at this time.
+ */
+static bool show_video(oshu::background *background, int mod)
+{
+	oshu::movie *movie = background->movie.get();
+	if (!movie || !oshu::update_movie(movie, *background->clock - background->video_offset))
+		return false;
+	SDL_SetTextureColorMod(movie->picture.texture, mod, mod, mod);
+	fill_screen(background->display, &movie->picture);
+	return true;
+}
+
 void oshu::show_background(oshu::background *background, double brightness)
 {
-	if (!background->picture.texture)
-		return;
+	if (background->loader.valid() && background->loader.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+		upload(background);
 	assert (brightness >= 0);
 	assert (brightness <= 1);
 	int mod = 64 + brightness * 191;
 	assert (mod >= 0);
 	assert (mod <= 255);
-	SDL_SetTextureColorMod(background->picture.texture, mod, mod, mod);
-	fill_screen(background->display, &background->picture);
+	if (show_video(background, mod) || !background->picture.texture)
+		return;
+	oshu::display *display = background->display;
+	if (oshu::begin_layer(display, &background->layer, mod)) {
+		SDL_SetTextureColorMod(background->picture.texture, mod, mod, mod);
+		fill_screen(display, &background->picture);
+		oshu::end_layer(display, &background->layer);
+	}
+	oshu::show_layer(display, &background->layer);
+}
+
+void oshu::invalidate_background(oshu::background *background)
+{
+	oshu::invalidate_layer(&background->layer);
 }
 
 void oshu::destroy_background(oshu::background *background)
@@ -181,5 +326,15 @@ void oshu::destroy_background(oshu::background *background)
 		return;
 	if (!(background->display->features & oshu::SHOW_BACKGROUND))
 		return;
+	if (background->loader.valid()) {
+		SDL_Surface *pic = background->loader.get();
+		if (pic)
+			SDL_FreeSurface(pic);
+	}
 	oshu::destroy_texture(&background->picture);
+	oshu::destroy_layer(&background->layer);
+	if (background->movie) {
+		oshu::close_movie(background->movie.get());
+		background->movie.reset();
+	}
 }
@@ -7,9 +7,11 @@
 
 #include "video/display.h"
 #include "video/paint.h"
+#include "video/view.h"
 
 #include <math.h>
 #include <SDL2/SDL.h>
+#include <vector>
 
 static int paint_cursor(oshu::cursor_widget *cursor)
 {
@@ -38,6 +40,64 @@ static int paint_cursor(oshu::cursor_widget *cursor)
 	return rc;
 }
 
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+
+/**
+ * Scratch buffers for #draw_trail, kept to avoid allocating at every frame.
+ */
+static std::vector<SDL_Vertex> vertices;
+static std::vector<int> indices;
+
+/**
+ * Draw a firefly on every point of the trail, given in physical coordinates,
+ * in one call to `SDL_RenderGeometry`. The older the firefly, the smaller and
+ * more transparent.
+ */
+static void draw_trail(oshu::cursor_widget *cursor, oshu::point *trail, int fireflies)
+{
+	oshu::texture *mouse = &cursor->mouse;
+	double zoom = cursor->display->view.zoom;
+	vertices.clear();
+	indices.clear();
+	for (int i = 1; i <= fireflies; ++i) {
+		double ratio = (double) (i + 1) / (fireflies + 1);
+		oshu::point top_left = trail[i - 1] - mouse->origin * ratio * zoom;
+		oshu::size size = mouse->size * ratio * zoom;
+		float x = std::real(top_left), y = std::imag(top_left);
+		float w = std::real(size), h = std::imag(size);
+		SDL_Color color = {255, 255, 255, (Uint8) (ratio * 255)};
+		int base = vertices.size();
+		vertices.push_back({{x, y}, color, {0, 0}});
+		vertices.push_back({{x + w, y}, color, {1, 0}});
+		vertices.push_back({{x + w, y + h}, color, {1, 1}});
+		vertices.push_back({{x, y + h}, color, {0, 1}});
+		for (int v : {0, 1, 2, 0, 2, 3})
+			indices.push_back(base + v);
+	}
+	SDL_RenderGeometry(cursor->display->renderer, mouse->texture, vertices.data(), vertices.size(), indices.data(), indices.size());
+}
+
+#else
+
+static void draw_trail(oshu::cursor_widget *cursor, oshu::point *trail, int fireflies)
+{
+	oshu::texture *mouse = &cursor->mouse;
+	double zoom = cursor->display->view.zoom;
+	for (int i = 1; i <= fireflies; ++i) {
+		double ratio = (double) (i + 1) / (fireflies + 1);
+		oshu::point top_left = trail[i - 1] - mouse->origin * ratio * zoom;
+		oshu::size size = mouse->size * ratio * zoom;
+		SDL_Rect dest = {
+			.x = (int) std::real(top_left), .y = (int) std::imag(top_left),
+			.w = (int) std::real(size), .h = (int) std::imag(size),
+		};
+		SDL_SetTextureAlphaMod(mouse->texture, ratio * 255);
+		SDL_RenderCopy(cursor->display->renderer, mouse->texture, NULL, &dest);
+	}
+}
+
+#endif
+
 int oshu::create_cursor(oshu::display *display, oshu::cursor_widget *cursor)
 {
 	*cursor = {};
@@ -58,21 +118,25 @@ void oshu::show_cursor(oshu::cursor_widget *cursor)
 {
 	if (!(cursor->display->features & oshu::FANCY_CURSOR))
 		return;
+	oshu::show_cursor(cursor, oshu::get_mouse(cursor->display));
+}
 
-	int fireflies = sizeof(cursor->history) / sizeof(*cursor->history);
+void oshu::show_cursor(oshu::cursor_widget *cursor, oshu::point position)
+{
+	if (!(cursor->display->features & oshu::FANCY_CURSOR))
+		return;
+
+	const int fireflies = sizeof(cursor->history) / sizeof(*cursor->history);
 	cursor->offset = (cursor->offset + 1) % fireflies;
-	cursor->history[cursor->offset] = oshu::get_mouse(cursor->display);
+	cursor->history[cursor->offset] = position;
 
-	for (int i = 1; i <= fireflies; ++i) {
-		int offset = (cursor->offset + i) % fireflies;
-		double ratio = (double) (i + 1) / (fireflies + 1);
-		SDL_SetTextureAlphaMod(cursor->mouse.texture, ratio * 255);
-		oshu::draw_scaled_texture(
-			cursor->display, &cursor->mouse,
-			cursor->history[offset],
-			ratio
-		);
-	}
+	/* Project the whole trail at once, oldest first. */
+	oshu::point trail[fireflies];
+	for (int i = 1; i <= fireflies; ++i)
+		trail[i - 1] = cursor->history[(cursor->offset + i) % fireflies];
+	oshu::project(&cursor->display->view, trail, fireflies);
+
+	draw_trail(cursor, trail, fireflies);
 }
 
 void oshu::destroy_cursor(oshu::cursor_widget *cursor)
@@ -0,0 +1,156 @@
+/**
+ * \file lib/ui/mania.cc
+ * \ingroup ui
+ *
+ * \brief
+ * Drawing routines specific to the osu!mania game mode.
+ */
+
+#include "ui/mania.h"
+
+#include "game/mania.h"
+#include "video/display.h"
+#include "video/view.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <math.h>
+
+/**
+ * How long a note takes to scroll from the top of the screen down to the
+ * judgement line, in seconds.
+ */
+static const double scroll_time = .8;
+
+/**
+ * Dimensions of the playfield, in the 640×480 viewport.
+ */
+static const double column_width = 40;
+static const double note_height = 12;
+static const double judgement_line = 440;
+static const double line_height = 4;
+
+/**
+ * The colors the rectangles are sorted by, from the bottom to the top.
+ */
+enum mania_layer {
+	COLUMN_LAYER,
+	LINE_LAYER,
+	HOLD_LAYER,
+	NOTE_LAYER,
+	/** Notes of every other column, for readability. */
+	ALTERNATE_NOTE_LAYER,
+	MISSED_LAYER,
+	LAYER_COUNT,
+};
+
+static const SDL_Color layer_colors[LAYER_COUNT] = {
+	{0, 0, 0, 192},
+	{255, 255, 255, 255},
+	{160, 160, 220, 192},
+	{240, 240, 240, 255},
+	{96, 176, 255, 255},
+	{224, 64, 64, 128},
+};
+
+/**
+ * Queue a rectangle given in viewport coordinates.
+ *
+ * Only its corners are stored, to be projected along with the rest of the
+ * layer by #flush_layer.
+ */
+static void queue(oshu::mania_ui &view, enum mania_layer layer, double x, double y, double w, double h)
+{
+	std::vector<oshu::point> &corners = view.layers[layer];
+	corners.push_back(oshu::point(x, y));
+	corners.push_back(oshu::point(x + w, y + h));
+}
+
+/**
+ * Project the corners of a layer in one batch, and fill its rectangles.
+ */
+static void flush_layer(oshu::mania_ui &view, enum mania_layer layer)
+{
+	std::vector<oshu::point> &corners = view.layers[layer];
+	if (corners.empty())
+		return;
+	oshu::project(&view.display->view, corners.data(), corners.size());
+	view.rects.clear();
+	for (size_t i = 0; i < corners.size(); i += 2) {
+		int left = lrint(std::real(corners[i]));
+		int top = lrint(std::imag(corners[i]));
+		int right = lrint(std::real(corners[i + 1]));
+		int bottom = lrint(std::imag(corners[i + 1]));
+		view.rects.push_back(SDL_Rect {left, top, right - left, bottom - top});
+	}
+	SDL_Color color = layer_colors[layer];
+	SDL_SetRenderDrawColor(view.display->renderer, color.r, color.g, color.b, color.a);
+	SDL_RenderFillRects(view.display->renderer, view.rects.data(), view.rects.size());
+	corners.clear();
+}
+
+/**
+ * Vertical position of a time on the screen.
+ */
+static double scroll(oshu::mania_ui &view, double t)
+{
+	return judgement_line - (t - view.game.clock.now) / scroll_time * judgement_line;
+}
+
+static void queue_hit(oshu::mania_ui &view, oshu::hit *hit, double left)
+{
+	int column = oshu::mania_column_of(&view.game, hit);
+	double x = left + column * column_width + 1;
+	double w = column_width - 2;
+	bool missed = hit->state == oshu::MISSED_HIT;
+	enum mania_layer note = missed ? MISSED_LAYER : column % 2 ? ALTERNATE_NOTE_LAYER : NOTE_LAYER;
+	if (hit->type & oshu::HOLD_HIT) {
+		if (hit->state != oshu::INITIAL_HIT && hit->state != oshu::SLIDING_HIT && !missed)
+			return;
+		double head = scroll(view, hit->time);
+		if (hit->state == oshu::SLIDING_HIT)
+			head = std::min(head, judgement_line);
+		double tail = scroll(view, hit->hold_note.end_time);
+		queue(view, missed ? MISSED_LAYER : HOLD_LAYER, x + w / 4, tail, w / 2, head - tail);
+		queue(view, note, x, head - note_height, w, note_height);
+	} else if (hit->state == oshu::INITIAL_HIT || missed) {
+		queue(view, note, x, scroll(view, hit->time) - note_height, w, note_height);
+	}
+}
+
+oshu::mania_ui::mania_ui(oshu::display *display, oshu::mania_game &game)
+: display(display), game(game), layers(LAYER_COUNT)
+{
+	assert (display != nullptr);
+}
+
+/**
+ * Draw the columns, and the notes between the top of the screen and a bit
+ * below the judgement line.
+ *
+ * The hits are found with the #oshu::hit_index, so the cost of a frame only
+ * depends on how many notes are visible.
+ */
+void oshu::mania_ui::draw()
+{
+	oshu::fit_view(&display->view, oshu::size{640, 480});
+	int keys = game.columns.size();
+	double left = 320 - keys * column_width / 2;
+	queue(*this, COLUMN_LAYER, left, 0, keys * column_width, 480);
+	queue(*this, LINE_LAYER, left, judgement_line, keys * column_width, line_height);
+
+	double now = game.clock.now;
+	double past = now - (480 - judgement_line) / judgement_line * scroll_time;
+	const oshu::hit_index *index = &game.hit_index;
+	int first, last;
+	oshu::hit_range(index, past, now + scroll_time, &first, &last);
+	for (int i = first; i < last; ++i) {
+		if (index->types[i] & (oshu::CIRCLE_HIT | oshu::HOLD_HIT) && index->ends[i] >= past)
+			queue_hit(*this, index->hits[i], left);
+	}
+
+	SDL_SetRenderDrawBlendMode(display->renderer, SDL_BLENDMODE_BLEND);
+	for (int layer = 0; layer < LAYER_COUNT; ++layer)
+		flush_layer(*this, (enum mania_layer) layer);
+	oshu::reset_view(display);
+}
@@ -8,18 +8,26 @@
 #include "ui/metadata.h"
 
 #include "beatmap/beatmap.h"
+#include "beatmap/stars.h"
+#include "core/hash.h"
 #include "video/display.h"
 #include "video/paint.h"
+#include "video/paint_cache.h"
 #include "video/texture.h"
 
+#include <algorithm>
 #include <assert.h>
+#include <math.h>
 #include <pango/pangocairo.h>
 #include <SDL2/SDL.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 
 static const double padding = 10;
 
+static const char *font = "Sans Bold 12";
+
 static PangoLayout* setup_layout(oshu::painter *p)
 {
 	cairo_set_operator(p->cr, CAIRO_OPERATOR_SOURCE);
@@ -29,13 +37,38 @@ static PangoLayout* setup_layout(oshu::painter *p)
 	pango_layout_set_ellipsize(layout, PANGO_ELLIPSIZE_END);
 	pango_layout_set_spacing(layout, 5 * PANGO_SCALE);
 
-	PangoFontDescription *desc = pango_font_description_from_string("Sans Bold 12");
+	PangoFontDescription *desc = pango_font_description_from_string(font);
 	pango_layout_set_font_description(layout, desc);
 	pango_font_description_free(desc);
 
 	return layout;
 }
 
+/**
+ * Find where a text would be cached.
+ *
+ * Besides the text, the key covers the font, the size of the frame, the zoom,
+ * and the version of Pango. Changes to the font configuration aren't
+ * detected, but clearing the cache fixes that.
+ */
+static std::string cache_path(oshu::display *display, oshu::size size, const char *kind, const std::string &text)
+{
+	std::ostringstream os;
+	os << kind << '\n' << text << '\n' << font << '\n' << size << '\n' << display->view.zoom << '\n' << pango_version();
+	std::string key = os.str();
+	return oshu::paint_cache_path(oshu::hash_bytes(key.data(), key.size()));
+}
+
+/**
+ * Finish a painting, save it in the cache, and upload it.
+ */
+static int finish(oshu::painter *p, const std::string &cache, oshu::texture *texture)
+{
+	oshu::finish_surface(p);
+	oshu::save_painting(cache, p);
+	return oshu::upload_painting(p, p->display, texture);
+}
+
 
 /**
  * \todo
@@ -44,22 +77,30 @@ static PangoLayout* setup_layout(oshu::painter *p)
 static int paint_stars(oshu::metadata_frame *frame)
 {
 	oshu::size size {360, 60};
-	oshu::painter p;
-	oshu::start_painting(frame->display, size, &p);
 
 	const char *sky = " ★ ★ ★ ★ ★ ★ ★ ★ ★ ★";
-	int stars = frame->beatmap->difficulty.overall_difficulty;
-	assert (stars >= 0);
-	assert (stars <= 10);
+	double rating = oshu::compute_star_rating(frame->beatmap);
+	int stars = std::min(10, std::max(0, (int) round(rating)));
 	int star_length = strlen(sky) / 10;
 	std::string difficulty (sky, star_length * stars);
+	char value[16];
+	snprintf(value, sizeof(value), " %.2f", rating);
 
 	oshu::metadata *meta = &frame->beatmap->metadata;
 	const char *version = meta->version;
 	assert (version != NULL);
 	std::ostringstream os;
-	os << version << "\n" << difficulty;
+	os << version << "\n" << difficulty << value;
+
+	oshu::texture *texture = &frame->stars;
+	std::string cache = cache_path(frame->display, size, "stars", os.str());
+	if (oshu::load_painting(cache, frame->display, size, texture) == 0) {
+		texture->origin = std::real(size);
+		return 0;
+	}
 
+	oshu::painter p;
+	oshu::start_painting(frame->display, size, &p);
 	PangoLayout *layout = setup_layout(&p);
 	pango_layout_set_text(layout, os.str().c_str(), -1);
 	pango_layout_set_alignment(layout, PANGO_ALIGN_RIGHT);
@@ -70,8 +111,7 @@ static int paint_stars(oshu::metadata_frame *frame)
 	pango_cairo_show_layout(p.cr, layout);
 	g_object_unref(layout);
 
-	oshu::texture *texture = &frame->stars;
-	int rc = oshu::finish_painting(&p, texture);
+	int rc = finish(&p, cache, texture);
 	texture->origin = std::real(size);
 	return rc;
 }
@@ -83,8 +123,6 @@ static int paint_stars(oshu::metadata_frame *frame)
 static int paint_metadata(oshu::metadata_frame *frame, int unicode)
 {
 	oshu::size size {640, 60};
-	oshu::painter p;
-	oshu::start_painting(frame->display, size, &p);
 
 	oshu::metadata *meta = &frame->beatmap->metadata;
 	const char *title = unicode ? meta->title_unicode : meta->title;
@@ -92,6 +130,13 @@ static int paint_metadata(oshu::metadata_frame *frame, int unicode)
 	std::ostringstream os;
 	os << title << "\n" << artist;
 
+	oshu::texture *texture = unicode ? &frame->unicode : &frame->ascii;
+	std::string cache = cache_path(frame->display, size, "metadata", os.str());
+	if (oshu::load_painting(cache, frame->display, size, texture) == 0)
+		return 0;
+
+	oshu::painter p;
+	oshu::start_painting(frame->display, size, &p);
 	PangoLayout *layout = setup_layout(&p);
 	pango_layout_set_text(layout, os.str().c_str(), -1);
 	int width, height;
@@ -101,8 +146,7 @@ static int paint_metadata(oshu::metadata_frame *frame, int unicode)
 	pango_cairo_show_layout(p.cr, layout);
 	g_object_unref(layout);
 
-	oshu::texture *texture = unicode ? &frame->unicode : &frame->ascii;
-	int rc = oshu::finish_painting(&p, texture);
+	int rc = finish(&p, cache, texture);
 	texture->origin = 0;
 	return rc;
 }
@@ -136,6 +180,8 @@ int oshu::create_metadata_frame(oshu::display *display, oshu::beatmap *beatmap,
 
 void oshu::show_metadata_frame(oshu::metadata_frame *frame, double opacity)
 {
+	if (opacity <= 0)
+		return;
 	SDL_Rect back = {
 		.x = 0,
 		.y = 0,
@@ -8,11 +8,28 @@
 
 #include "ui/osu.h"
 
+#include "core/log.h"
 #include "game/osu.h"
 #include "video/display.h"
 #include "video/texture.h"
 
+#include <algorithm>
 #include <assert.h>
+#include <math.h>
+
+/**
+ * How long before their approach the sliders are queued for painting, in
+ * seconds.
+ */
+static const double prerender_ahead = 3.;
+
+/**
+ * Video memory budget for the slider textures, in bytes.
+ *
+ * A slider covering the whole screen at 1080p takes about 8 MiB, but most are
+ * much smaller.
+ */
+static const size_t slider_cache_budget = 256 << 20;
 
 static void draw_hint(oshu::osu_ui &view, oshu::hit *hit)
 {
@@ -23,10 +40,11 @@ static void draw_hint(oshu::osu_ui &view, oshu::hit *hit)
 		double ratio = (double) (hit->time - now) / game->beatmap.difficulty.approach_time;
 		double base_radius = game->beatmap.difficulty.circle_radius;
 		double radius = base_radius + ratio * game->beatmap.difficulty.approach_size;
-		oshu::draw_scaled_texture(
-			view.display, &view.approach_circle, hit->p,
-			2. * radius / std::real(view.approach_circle.size)
-		);
+		double scale = 2. * radius / std::real(view.approach_circle[0].size);
+		/* Pick the smallest level that doesn't need to be scaled up. */
+		int level = scale > 0 ? (int) floor(-log2(scale)) : oshu::approach_levels - 1;
+		level = std::max(0, std::min(level, oshu::approach_levels - 1));
+		oshu::draw_sprite(view.display, &view.batch, &view.approach_circle[level], hit->p, scale);
 	}
 }
 
@@ -35,16 +53,16 @@ static void draw_hit_mark(oshu::osu_ui &view, oshu::hit *hit)
 	oshu::game_base *game = &view.game;
 	if (hit->state == oshu::GOOD_HIT) {
 		double leniency = game->beatmap.difficulty.leniency;
-		oshu::texture *mark = &view.good_mark;
+		oshu::sprite *mark = &view.good_mark;
 		if (hit->offset < - leniency / 2)
 			mark = &view.early_mark;
 		else if (hit->offset > leniency / 2)
 			mark = &view.late_mark;
-		oshu::draw_texture(view.display, mark, oshu::end_point(hit));
+		oshu::draw_sprite(view.display, &view.batch, mark, oshu::end_point(hit));
 	} else if (hit->state == oshu::MISSED_HIT) {
-		oshu::draw_texture(view.display, &view.bad_mark, oshu::end_point(hit));
+		oshu::draw_sprite(view.display, &view.batch, &view.bad_mark, oshu::end_point(hit));
 	} else if (hit->state == oshu::SKIPPED_HIT) {
-		oshu::draw_texture(view.display, &view.skip_mark, oshu::end_point(hit));
+		oshu::draw_sprite(view.display, &view.batch, &view.skip_mark, oshu::end_point(hit));
 	}
 }
 
@@ -53,7 +71,7 @@ static void draw_hit_circle(oshu::osu_ui &view, oshu::hit *hit)
 	oshu::display *display = view.display;
 	if (hit->state == oshu::INITIAL_HIT) {
 		assert (hit->color != NULL);
-		oshu::draw_texture(display, &view.circles[hit->color->index], hit->p);
+		oshu::draw_sprite(display, &view.batch, &view.circles[hit->color->index], hit->p);
 		draw_hint(view, hit);
 	} else {
 		draw_hit_mark(view, hit);
@@ -66,23 +84,60 @@ static void draw_slider(oshu::osu_ui &view, oshu::hit *hit)
 	oshu::display *display = view.display;
 	double now = game->clock.now;
 	if (hit->state == oshu::INITIAL_HIT || hit->state == oshu::SLIDING_HIT) {
-		if (!hit->texture) {
+		if (!hit->texture && (display->features & oshu::GPU_SLIDERS)) {
+			oshu::osu_render_slider(view, hit);
+		} else if (!hit->texture) {
+			oshu_log_debug("slider not painted in time, painting it now");
+			oshu::cancel_slider(&view.painter, hit);
 			oshu::osu_paint_slider(view, hit);
-			assert (hit->texture != NULL);
 		}
+		if (!hit->texture)
+			return;
+		oshu::touch_texture(&view.slider_textures, &hit->texture);
+		oshu::flush_batch(display, &view.batch);
 		oshu::draw_texture(view.display, hit->texture, hit->p);
 		draw_hint(view, hit);
 		/* ball */
 		double t = (now - hit->time) / hit->slider.duration;
 		if (hit->state == oshu::SLIDING_HIT) {
 			oshu::point ball = oshu::path_at(&hit->slider.path, t < 0 ? 0 : t);
-			oshu::draw_texture(display, &view.slider_ball, ball);
+			oshu::draw_sprite(display, &view.batch, &view.slider_ball, ball);
 		}
 	} else {
 		draw_hit_mark(view, hit);
 	}
 }
 
+/**
+ * Upload the sliders painted in the background, and queue the sliders that
+ * will appear soon.
+ *
+ * A slider may have been painted on the main thread in the meantime, or the
+ * view may have been zoomed, in which case the job is dropped.
+ */
+static void prerender_sliders(oshu::osu_ui &view)
+{
+	oshu::game_base *game = &view.game;
+	double zoom = view.display->view.zoom;
+	oshu::slider_job job;
+	while (oshu::poll_slider(&view.painter, &job)) {
+		if (job.rc < 0)
+			continue;
+		bool visible = job.hit->state == oshu::INITIAL_HIT || job.hit->state == oshu::SLIDING_HIT;
+		if (job.hit->texture || job.zoom != zoom || !visible)
+			oshu::discard_painting(&job.painter);
+		else
+			oshu::osu_upload_slider(view, job.hit, &job.painter, job.origin);
+	}
+	if (view.display->features & oshu::GPU_SLIDERS)
+		return;
+	double horizon = game->clock.now + game->beatmap.difficulty.approach_time + prerender_ahead;
+	for (oshu::hit *hit = game->hit_cursor; hit && hit->time < horizon; hit = hit->next) {
+		if ((hit->type & oshu::SLIDER_HIT) && !hit->texture && hit->state == oshu::INITIAL_HIT)
+			oshu::request_slider(&view.painter, hit, zoom);
+	}
+}
+
 static void draw_hit(oshu::osu_ui &view, oshu::hit *hit)
 {
 	if (hit->type & oshu::SLIDER_HIT)
@@ -92,7 +147,7 @@ static void draw_hit(oshu::osu_ui &view, oshu::hit *hit)
 }
 
 /**
- * Connect two hits with a dotted line.
+ * Lay out the dotted line connecting two hits.
  *
  * ( ) · · · · ( )
  *
@@ -116,11 +171,11 @@ static void draw_hit(oshu::osu_ui &view, oshu::hit *hit)
  * Voilà!
  *
  */
-static void connect_hits(oshu::osu_ui &view, oshu::hit *a, oshu::hit *b)
+static void lay_out_connector(oshu::osu_ui &view, oshu::hit *a, oshu::hit *b, oshu::osu_connector *connector)
 {
 	oshu::game_base *game = &view.game;
-	if (a->state != oshu::INITIAL_HIT && a->state != oshu::SLIDING_HIT)
-		return;
+	connector->first_dot = view.connector_dots.size();
+	connector->dot_count = 0;
 	oshu::point a_end = oshu::end_point(a);
 	double radius = game->beatmap.difficulty.circle_radius;
 	double interval = 15;
@@ -135,7 +190,40 @@ static void connect_hits(oshu::osu_ui &view, oshu::hit *a, oshu::hit *b)
 	oshu::point start = a_end + direction * radius;
 	oshu::vector step = direction * interval;
 	for (int i = 0; i < steps; ++i)
-		oshu::draw_texture(view.display, &view.connector, start + (i + .5) * step);
+		view.connector_dots.push_back(start + (i + .5) * step);
+	connector->dot_count = steps;
+}
+
+/**
+ * Fill #oshu::osu_ui::connectors.
+ */
+static void lay_out_connectors(oshu::osu_ui &view)
+{
+	const oshu::hit_index *index = &view.game.hit_index;
+	view.connectors.assign(index->hits.size(), oshu::osu_connector {-1, 0, 0});
+	int previous = -1;
+	for (size_t i = 0; i < index->hits.size(); ++i) {
+		if (!(index->types[i] & (oshu::CIRCLE_HIT | oshu::SLIDER_HIT)))
+			continue;
+		if (previous >= 0 && index->hits[previous]->combo == index->hits[i]->combo) {
+			view.connectors[previous].next = i;
+			lay_out_connector(view, index->hits[previous], index->hits[i], &view.connectors[previous]);
+		}
+		previous = i;
+	}
+}
+
+/**
+ * Draw the dotted line from the hit at position *i* in the hit index to the
+ * next hit of its combo, as long as the hit is still waiting to be played.
+ */
+static void draw_connector(oshu::osu_ui &view, int i)
+{
+	if (view.game.hit_index.states[i] != oshu::INITIAL_HIT && view.game.hit_index.states[i] != oshu::SLIDING_HIT)
+		return;
+	const oshu::osu_connector &connector = view.connectors[i];
+	for (int d = 0; d < connector.dot_count; ++d)
+		oshu::draw_sprite(view.display, &view.batch, &view.connector, view.connector_dots[connector.first_dot + d]);
 }
 
 namespace oshu {
@@ -145,9 +233,12 @@ osu_ui::osu_ui(oshu::display *display, oshu::osu_game &game)
 {
 	assert (display != nullptr);
 	oshu::osu_view(display);
+	slider_textures.budget = slider_cache_budget;
 	oshu::osu_paint_resources(*this);
 	if (oshu::create_cursor(display, &cursor) < 0)
 		throw std::runtime_error("could not create cursor");
+	if (oshu::start_slider_painter(&painter, game.beatmap.difficulty.circle_radius, display->premultiplied) < 0)
+		oshu_log_warning("could not start painting the sliders in the background");
 	oshu::reset_view(display);
 	mouse = std::make_shared<osu_mouse>(display);
 	game.mouse = mouse;
@@ -156,6 +247,7 @@ osu_ui::osu_ui(oshu::display *display, oshu::osu_game &game)
 osu_ui::~osu_ui()
 {
 	SDL_ShowCursor(SDL_ENABLE);
+	oshu::stop_slider_painter(&painter);
 	oshu::osu_free_resources(*this);
 	oshu::destroy_cursor(&cursor);
 }
@@ -166,27 +258,61 @@ osu_ui::~osu_ui()
  */
 void osu_ui::draw()
 {
+	oshu::osu_upload_resources(*this);
 	oshu::osu_view(display);
-	oshu::hit *cursor = oshu::look_hit_up(&game, game.beatmap.difficulty.approach_time);
-	oshu::hit *next = NULL;
+	prerender_sliders(*this);
 	double now = game.clock.now;
-	for (oshu::hit *hit = cursor; hit; hit = hit->previous) {
-		if (!(hit->type & (oshu::CIRCLE_HIT | oshu::SLIDER_HIT)))
+	double approach = game.beatmap.difficulty.approach_time;
+	const oshu::hit_index *index = &game.hit_index;
+	int first, last;
+	double gone = now - approach;
+	oshu::hit_range(index, gone, now + approach, &first, &last);
+	for (int i = last - 1; i >= first; --i) {
+		if (!(index->types[i] & (oshu::CIRCLE_HIT | oshu::SLIDER_HIT)) || index->ends[i] < gone)
 			continue;
-		if (oshu::hit_end_time(hit) < now - game.beatmap.difficulty.approach_time)
-			break;
-		if (next && next->combo == hit->combo)
-			connect_hits(*this, hit, next);
-		draw_hit(*this, hit);
-		next = hit;
+		int next = connectors[i].next;
+		if (next >= 0 && next < last && index->ends[next] >= gone)
+			draw_connector(*this, i);
+		draw_hit(*this, index->hits[i]);
 	}
-	oshu::show_cursor(&this->cursor);
+	oshu::flush_batch(display, &batch);
+	/* A spectator's game has the mouse of the player it follows. */
+	if (game.mouse && game.mouse != mouse)
+		oshu::show_cursor(&this->cursor, game.mouse->position());
+	else
+		oshu::show_cursor(&this->cursor);
 	oshu::reset_view(display);
+	oshu::trim_textures(&slider_textures);
+}
+
+/**
+ * Record the motion events in the history of the #oshu::osu_mouse given as
+ * *data*.
+ */
+static int watch_motion(void *data, SDL_Event *event)
+{
+	if (event->type != SDL_MOUSEMOTION)
+		return 0;
+	osu_mouse *mouse = static_cast<osu_mouse*>(data);
+	mouse->history[mouse->head] = mouse_sample {
+		event->motion.timestamp / 1000.,
+		oshu::point(event->motion.x, event->motion.y),
+	};
+	mouse->head = (mouse->head + 1) % mouse_history_size;
+	if (mouse->count < mouse_history_size)
+		++mouse->count;
+	return 0;
 }
 
 osu_mouse::osu_mouse(oshu::display *display)
 : display(display)
 {
+	SDL_AddEventWatch(watch_motion, this);
+}
+
+osu_mouse::~osu_mouse()
+{
+	SDL_DelEventWatch(watch_motion, this);
 }
 
 oshu::point osu_mouse::position()
@@ -197,6 +323,36 @@ oshu::point osu_mouse::position()
 	return mouse;
 }
 
+/**
+ * Walk the history from the newest event, and interpolate between the two
+ * events around *system*.
+ *
+ * Past the newest event, the mouse hasn't moved since. Before the oldest one,
+ * the oldest position is the best guess.
+ */
+oshu::point osu_mouse::position_at(double system)
+{
+	if (count == 0)
+		return position();
+	const mouse_sample *later = nullptr;
+	const mouse_sample *sample = nullptr;
+	for (size_t i = 1; i <= count; ++i) {
+		sample = &history[(head + mouse_history_size - i) % mouse_history_size];
+		if (sample->time <= system)
+			break;
+		later = sample;
+	}
+	oshu::point p = sample->position;
+	if (later && sample->time <= system && later->time > sample->time) {
+		double ratio = (system - sample->time) / (later->time - sample->time);
+		p += (later->position - sample->position) * ratio;
+	}
+	oshu::osu_view(display);
+	p = oshu::unproject(&display->view, p);
+	oshu::reset_view(display);
+	return p;
+}
+
 }
 
 void oshu::osu_view(oshu::display *display)
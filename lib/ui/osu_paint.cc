@@ -6,11 +6,18 @@
 #include "ui/osu.h"
 
 #include "core/log.h"
+#include "core/trace.h"
 #include "game/osu.h"
+#include "video/display.h"
+#include "video/mesh.h"
 #include "video/paint.h"
+#include "video/texture.h"
 
 #include <assert.h>
-#include <SDL2/SDL_timer.h>
+#include <math.h>
+#include <SDL2/SDL.h>
+
+#include <functional>
 
 static double brighter(double v)
 {
@@ -18,14 +25,20 @@ static double brighter(double v)
 	return v < 1. ? v : 1.;
 }
 
-static int paint_approach_circle(oshu::osu_ui &view)
+/**
+ * Paint one level of #oshu::osu_ui::approach_circle.
+ *
+ * The levels are painted by cairo rather than scaled down from the first one,
+ * so that the thin ring stays antialiased.
+ */
+static void paint_approach_circle(oshu::osu_ui &view, double zoom, int level)
 {
 	oshu::game_base *game = &view.game;
 	double radius = game->beatmap.difficulty.circle_radius + game->beatmap.difficulty.approach_size;
 	oshu::size size = oshu::size(radius * 2., radius * 2.);
 
 	oshu::painter p;
-	oshu::start_painting(view.display, size, &p);
+	oshu::start_painting(ldexp(zoom, -level), size, &p);
 	cairo_translate(p.cr, radius, radius);
 
 	cairo_arc(p.cr, 0, 0, radius - 3, 0, 2. * M_PI);
@@ -33,20 +46,19 @@ static int paint_approach_circle(oshu::osu_ui &view)
 	cairo_set_line_width(p.cr, 4);
 	cairo_stroke(p.cr);
 
-	oshu::texture *texture = &view.approach_circle;
-	int rc = oshu::finish_painting(&p, texture);
-	texture->origin = size / 2.;
-	return rc;
+	oshu::sprite *sprite = &view.approach_circle[level];
+	oshu::pack_painting(&view.atlas, &p, sprite);
+	sprite->origin = size / 2.;
 }
 
-static int paint_circle(oshu::osu_ui &view, oshu::color *color, oshu::texture *texture)
+static void paint_circle(oshu::osu_ui &view, double zoom, oshu::color *color, oshu::sprite *sprite)
 {
 	oshu::game_base *game = &view.game;
 	double radius = game->beatmap.difficulty.circle_radius;
 	oshu::size size = oshu::size(radius * 2., radius * 2.);
 
 	oshu::painter p;
-	oshu::start_painting(view.display, size, &p);
+	oshu::start_painting(zoom, size, &p);
 	cairo_translate(p.cr, radius, radius);
 	cairo_set_operator(p.cr, CAIRO_OPERATOR_SOURCE);
 	double opacity = 0.7;
@@ -71,33 +83,20 @@ static int paint_circle(oshu::osu_ui &view, oshu::color *color, oshu::texture *t
 	cairo_set_line_width(p.cr, 3);
 	cairo_stroke(p.cr);
 
-	int rc = oshu::finish_painting(&p, texture);
-	texture->origin = size / 2.;
-	return rc;
+	oshu::pack_painting(&view.atlas, &p, sprite);
+	sprite->origin = size / 2.;
 }
 
+/**
+ * Trace the flattened path, which is also what the slider ball follows.
+ */
 static void build_path(cairo_t *cr, oshu::slider *slider)
 {
-	if (slider->path.type == oshu::LINEAR_PATH) {
-		auto& points = slider->path.line.points;
-		cairo_move_to(cr, std::real(points.at(0)), std::imag(points.at(0)));
-		for (size_t i = 1; i < points.size(); i++)
-			cairo_line_to(cr, std::real(points[i]), std::imag(points[i]));
-	} else if (slider->path.type == oshu::PERFECT_PATH) {
-		oshu::arc *arc = &slider->path.arc;
-		if (arc->start_angle < arc->end_angle)
-			cairo_arc(cr, std::real(arc->center), std::imag(arc->center), arc->radius, arc->start_angle, arc->end_angle);
-		else
-			cairo_arc_negative(cr, std::real(arc->center), std::imag(arc->center), arc->radius, arc->start_angle, arc->end_angle);
-	} else {
-		oshu::point start = oshu::path_at(&slider->path, 0);
-		cairo_move_to(cr, std::real(start), std::imag(start));
-		int resolution = slider->length / 5. + 5;
-		for (int i = 1; i <= resolution; ++i) {
-			oshu::point pt = oshu::path_at(&slider->path, (double) i / resolution);
-			cairo_line_to(cr, std::real(pt), std::imag(pt));
-		}
-	}
+	auto& points = slider->path.polyline.points;
+	assert (points.size() >= 2);
+	cairo_move_to(cr, std::real(points[0]), std::imag(points[0]));
+	for (size_t i = 1; i < points.size(); i++)
+		cairo_line_to(cr, std::real(points[i]), std::imag(points[i]));
 }
 
 /**
@@ -110,18 +109,18 @@ static void build_path(cairo_t *cr, oshu::slider *slider)
  * Paint the slider ticks. Preferably updating the ticks every time the slider
  * repeats. Also, clear the ticks as the slider rolls over them.
  */
-int oshu::osu_paint_slider(oshu::osu_ui &view, oshu::hit *hit)
+int oshu::osu_sketch_slider(oshu::hit *hit, double radius, double zoom, bool premultiplied, oshu::painter *painter, oshu::point *origin)
 {
-	oshu::game_base *game = &view.game;
-	int start = SDL_GetTicks();
 	assert (hit->type & oshu::SLIDER_HIT);
-	double radius = game->beatmap.difficulty.circle_radius;
+	oshu::scoped_timer timer(oshu::SLIDER_ZONE);
 	oshu::point top_left, bottom_right;
 	oshu::path_bounding_box(&hit->slider.path, &top_left, &bottom_right);
 	oshu::size size = bottom_right - top_left + oshu::vector{2, 2} * radius;
 
-	oshu::painter p;
-	oshu::start_painting(view.display, size, &p);
+	oshu::painter &p = *painter;
+	if (oshu::start_painting(zoom, size, &p) < 0)
+		return -1;
+	p.premultiplied = premultiplied;
 
 	cairo_translate(p.cr, - std::real(top_left) + radius, - std::imag(top_left) + radius);
 	cairo_set_operator(p.cr, CAIRO_OPERATOR_SOURCE);
@@ -173,31 +172,128 @@ int oshu::osu_paint_slider(oshu::osu_ui &view, oshu::hit *hit)
 
 	cairo_pattern_destroy(pattern);
 
+	oshu::finish_surface(&p);
+	*origin = hit->p - top_left + oshu::vector{1, 1} * radius;
+	return 0;
+}
+
+int oshu::osu_upload_slider(oshu::osu_ui &view, oshu::hit *hit, oshu::painter *painter, oshu::point origin)
+{
 	hit->texture = (oshu::texture*) calloc(1, sizeof(*hit->texture));
 	assert (hit->texture != NULL);
-	if (oshu::finish_painting(&p, hit->texture) < 0) {
+	if (oshu::upload_painting(painter, view.display, hit->texture) < 0) {
 		free(hit->texture);
 		hit->texture = NULL;
 		return -1;
 	}
+	hit->texture->origin = origin;
+	oshu::insert_texture(&view.slider_textures, &hit->texture);
+	return 0;
+}
 
-	hit->texture->origin = hit->p - top_left + oshu::vector{1, 1} * radius;
+int oshu::osu_paint_slider(oshu::osu_ui &view, oshu::hit *hit)
+{
+	int start = SDL_GetTicks();
+	oshu::painter p;
+	oshu::point origin;
+	double radius = view.game.beatmap.difficulty.circle_radius;
+	if (oshu::osu_sketch_slider(hit, radius, view.display->view.zoom, view.display->premultiplied, &p, &origin) < 0)
+		return -1;
+	if (osu_upload_slider(view, hit, &p, origin) < 0)
+		return -1;
 	oshu_log_verbose("slider drawn in %.3f seconds", (SDL_GetTicks() - start) / 1000.);
 	return 0;
 }
 
+/**
+ * Build the same slider as #oshu::osu_sketch_slider, but as a mesh.
+ */
+static void mesh_slider(oshu::hit *hit, double radius, oshu::point top_left, oshu::size size, oshu::mesh *mesh)
+{
+	oshu::color *c = hit->color;
+	oshu::mesh_color white = {1, 1, 1}, black = {0, 0, 0};
+	oshu::mesh_paint border = {white, white, 0, 0};
+	oshu::mesh_paint dark = {black, black, 0, 0};
+	oshu::mesh_paint body = {
+		{(float) brighter(c->red), (float) brighter(c->green), (float) brighter(c->blue)},
+		{(float) c->red, (float) c->green, (float) c->blue},
+		top_left, std::abs(size / 1.5),
+	};
+	auto &points = hit->slider.path.polyline.points;
+
+	oshu::stroke_polyline(mesh, points, 2. * radius - 2, border);
+	oshu::stroke_polyline(mesh, points, 2. * radius - 4, dark);
+	oshu::stroke_polyline(mesh, points, 2. * radius - 8, body);
+
+	oshu::point end = oshu::path_at(&hit->slider.path, 1.);
+	for (int i = 1; i <= hit->slider.repeat; ++i) {
+		double ratio = (double) i / hit->slider.repeat;
+		oshu::stroke_circle(mesh, end, (radius - 4.) * ratio, 1, dark);
+	}
+
+	oshu::fill_circle(mesh, hit->p, radius - 4, body);
+	oshu::stroke_circle(mesh, hit->p, radius - 4, 2.5, dark);
+}
+
+int oshu::osu_render_slider(oshu::osu_ui &view, oshu::hit *hit)
+{
+	assert (hit->type & oshu::SLIDER_HIT);
+	SDL_Renderer *renderer = view.display->renderer;
+	double radius = view.game.beatmap.difficulty.circle_radius;
+	oshu::point top_left, bottom_right;
+	oshu::path_bounding_box(&hit->slider.path, &top_left, &bottom_right);
+	oshu::size size = bottom_right - top_left + oshu::vector{2, 2} * radius;
+
+	oshu::mesh mesh;
+	mesh.zoom = view.display->view.zoom;
+	mesh_slider(hit, radius, top_left, size, &mesh);
+
+	oshu::size physical = size * mesh.zoom;
+	SDL_Texture *target = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET,
+	                                        std::ceil(std::real(physical)), std::ceil(std::imag(physical)));
+	if (!target) {
+		oshu_log_error("could not create a slider texture: %s", SDL_GetError());
+		return -1;
+	}
+	oshu::track_texture(target);
+	SDL_SetTextureBlendMode(target, SDL_BLENDMODE_BLEND);
+	SDL_SetTextureAlphaMod(target, 255 * .7);
+
+	SDL_Texture *previous = SDL_GetRenderTarget(renderer);
+	Uint8 r, g, b, a;
+	SDL_GetRenderDrawColor(renderer, &r, &g, &b, &a);
+	SDL_SetRenderTarget(renderer, target);
+	SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+	SDL_RenderClear(renderer);
+	int rc = oshu::draw_mesh(view.display, &mesh, top_left - oshu::vector{1, 1} * radius);
+	SDL_SetRenderTarget(renderer, previous);
+	SDL_SetRenderDrawColor(renderer, r, g, b, a);
+	if (rc < 0) {
+		oshu::release_texture(target);
+		return -1;
+	}
+
+	hit->texture = (oshu::texture*) calloc(1, sizeof(*hit->texture));
+	assert (hit->texture != NULL);
+	hit->texture->texture = target;
+	hit->texture->size = size;
+	hit->texture->origin = hit->p - top_left + oshu::vector{1, 1} * radius;
+	oshu::insert_texture(&view.slider_textures, &hit->texture);
+	return 0;
+}
+
 /**
  * \todo
  * It looks like cairo_fill with a pattern triggers jumps depending on
  * uninitialised values, which propagates.
  */
-static int paint_slider_ball(oshu::osu_ui &view) {
+static void paint_slider_ball(oshu::osu_ui &view, double zoom) {
 	oshu::game_base *game = &view.game;
 	double radius = game->beatmap.difficulty.slider_tolerance;
 	oshu::size size = oshu::size{1, 1} * radius * 2.;
 
 	oshu::painter p;
-	oshu::start_painting(view.display, size, &p);
+	oshu::start_painting(zoom, size, &p);
 	cairo_translate(p.cr, radius, radius);
 
 	/* tolerance */
@@ -221,20 +317,19 @@ static int paint_slider_ball(oshu::osu_ui &view) {
 	cairo_fill(p.cr);
 	cairo_pattern_destroy(pattern);
 
-	oshu::texture *texture = &view.slider_ball;
-	int rc = oshu::finish_painting(&p, texture);
-	texture->origin = size / 2.;
-	return rc;
+	oshu::sprite *sprite = &view.slider_ball;
+	oshu::pack_painting(&view.atlas, &p, sprite);
+	sprite->origin = size / 2.;
 }
 
-static int paint_good_mark(oshu::osu_ui &view, int offset, oshu::texture *texture)
+static void paint_good_mark(oshu::osu_ui &view, double zoom, int offset, oshu::sprite *sprite)
 {
 	oshu::game_base *game = &view.game;
 	double radius = game->beatmap.difficulty.circle_radius / 3.5;
 	oshu::size size = oshu::size{1, 1} * radius * 2.;
 
 	oshu::painter p;
-	oshu::start_painting(view.display, size, &p);
+	oshu::start_painting(zoom, size, &p);
 	cairo_translate(p.cr, radius, radius);
 
 	if (offset == 0) {
@@ -253,19 +348,18 @@ static int paint_good_mark(oshu::osu_ui &view, int offset, oshu::texture *textur
 	cairo_set_line_width(p.cr, 2);
 	cairo_stroke(p.cr);
 
-	int rc = oshu::finish_painting(&p, texture);
-	texture->origin = size / 2.;
-	return rc;
+	oshu::pack_painting(&view.atlas, &p, sprite);
+	sprite->origin = size / 2.;
 }
 
-static int paint_bad_mark(oshu::osu_ui &view)
+static void paint_bad_mark(oshu::osu_ui &view, double zoom)
 {
 	oshu::game_base *game = &view.game;
 	double half = game->beatmap.difficulty.circle_radius / 4.7;
 	oshu::size size = oshu::size{1, 1} * (half + 2) * 2.;
 
 	oshu::painter p;
-	oshu::start_painting(view.display, size, &p);
+	oshu::start_painting(zoom, size, &p);
 	cairo_translate(p.cr, half + 2, half + 2);
 
 	cairo_set_source_rgba(p.cr, .9, 0, 0, .4);
@@ -279,20 +373,19 @@ static int paint_bad_mark(oshu::osu_ui &view)
 
 	cairo_stroke(p.cr);
 
-	oshu::texture *texture = &view.bad_mark;
-	int rc = oshu::finish_painting(&p, texture);
-	texture->origin = size / 2.;
-	return rc;
+	oshu::sprite *sprite = &view.bad_mark;
+	oshu::pack_painting(&view.atlas, &p, sprite);
+	sprite->origin = size / 2.;
 }
 
-static int paint_skip_mark(oshu::osu_ui &view)
+static void paint_skip_mark(oshu::osu_ui &view, double zoom)
 {
 	oshu::game_base *game = &view.game;
 	double radius = game->beatmap.difficulty.circle_radius / 4.7;
 	oshu::size size = oshu::size{1, 1} * (radius + 2) * 2.;
 
 	oshu::painter p;
-	oshu::start_painting(view.display, size, &p);
+	oshu::start_painting(zoom, size, &p);
 	cairo_translate(p.cr, radius + 2, radius + 2);
 
 	cairo_set_source_rgba(p.cr, .3, .3, 1, .6);
@@ -308,88 +401,97 @@ static int paint_skip_mark(oshu::osu_ui &view)
 
 	cairo_stroke(p.cr);
 
-	oshu::texture *texture = &view.skip_mark;
-	int rc = oshu::finish_painting(&p, texture);
-	texture->origin = size / 2.;
-	return rc;
+	oshu::sprite *sprite = &view.skip_mark;
+	oshu::pack_painting(&view.atlas, &p, sprite);
+	sprite->origin = size / 2.;
 }
 
-static int paint_connector(oshu::osu_ui &view)
+static void paint_connector(oshu::osu_ui &view, double zoom)
 {
 	double radius = 3;
 	oshu::size size = oshu::size{1, 1} * radius * 2.;
 
 	oshu::painter p;
-	oshu::start_painting(view.display, size, &p);
+	oshu::start_painting(zoom, size, &p);
 	cairo_translate(p.cr, radius, radius);
 
 	cairo_set_source_rgba(p.cr, 1, 1, 1, .5);
 	cairo_arc(p.cr, 0, 0, radius - 1, 0, 2. * M_PI);
 	cairo_fill(p.cr);
 
-	oshu::texture *texture = &view.connector;
-	int rc = oshu::finish_painting(&p, texture);
-	texture->origin = size / 2.;
-	return rc;
+	oshu::sprite *sprite = &view.connector;
+	oshu::pack_painting(&view.atlas, &p, sprite);
+	sprite->origin = size / 2.;
 }
 
 /**
+ * Paint every sprite into the atlas, without touching the display, so that it
+ * can run on a background thread.
+ *
  * \todo
  * Handle errors.
  */
-void oshu::osu_paint_resources(oshu::osu_ui &view)
+static void paint_sprites(oshu::osu_ui &view, double zoom)
 {
 	oshu::game_base *game = &view.game;
-	int start = SDL_GetTicks();
-	oshu_log_debug("painting the textures");
+	int64_t start = oshu::trace_clock();
 
 	/* Circle hits. */
-	assert (game->beatmap.color_count > 0);
-	assert (game->beatmap.colors != NULL);
-	view.circles = (oshu::texture*) calloc(game->beatmap.color_count, sizeof(*view.circles));
-	assert (view.circles != NULL);
 	oshu::color *color = game->beatmap.colors;
 	for (int i = 0; i < game->beatmap.color_count; ++i) {
 		oshu_log_verbose("painting circle for combo color #%d", i);
 		assert (color->index == i);
-		paint_circle(view, color, &view.circles[i]);
+		paint_circle(view, zoom, color, &view.circles[i]);
 		color = color->next;
 	}
 
-	paint_approach_circle(view);
-	paint_slider_ball(view);
-	paint_good_mark(view, -1, &view.early_mark);
-	paint_good_mark(view, 0, &view.good_mark);
-	paint_good_mark(view, 1, &view.late_mark);
-	paint_bad_mark(view);
-	paint_skip_mark(view);
-	paint_connector(view);
-
-	int end = SDL_GetTicks();
-	oshu_log_debug("done generating the common textures in %.3f seconds", (end - start) / 1000.);
+	for (int level = 0; level < oshu::approach_levels; ++level)
+		paint_approach_circle(view, zoom, level);
+	paint_slider_ball(view, zoom);
+	paint_good_mark(view, zoom, -1, &view.early_mark);
+	paint_good_mark(view, zoom, 0, &view.good_mark);
+	paint_good_mark(view, zoom, 1, &view.late_mark);
+	paint_bad_mark(view, zoom);
+	paint_skip_mark(view, zoom);
+	paint_connector(view, zoom);
+	oshu::log_startup("painting the sprites", start);
 }
 
-void oshu::osu_free_resources(oshu::osu_ui &view)
+void oshu::osu_paint_resources(oshu::osu_ui &view)
 {
 	oshu::game_base *game = &view.game;
-	if (view.circles) {
-		for (int i = 0; i < game->beatmap.color_count; ++i)
-			oshu::destroy_texture(&view.circles[i]);
-		free(view.circles);
-	}
-	for (oshu::hit *hit = game->beatmap.hits; hit; hit = hit->next) {
-		if (hit->texture) {
-			oshu::destroy_texture(hit->texture);
-			free(hit->texture);
-			hit->texture = NULL;
-		}
+	oshu_log_debug("painting the textures");
+	view.atlas.premultiplied = view.display->premultiplied;
+	assert (game->beatmap.color_count > 0);
+	assert (game->beatmap.colors != NULL);
+	view.circles = new oshu::sprite[game->beatmap.color_count];
+	double zoom = view.display->view.zoom;
+	try {
+		view.painting = std::async(std::launch::async, paint_sprites, std::ref(view), zoom);
+	} catch (std::system_error &e) {
+		oshu_log_debug("could not start the painting thread: %s", e.what());
+		paint_sprites(view, zoom);
 	}
-	oshu::destroy_texture(&view.approach_circle);
-	oshu::destroy_texture(&view.slider_ball);
-	oshu::destroy_texture(&view.good_mark);
-	oshu::destroy_texture(&view.early_mark);
-	oshu::destroy_texture(&view.late_mark);
-	oshu::destroy_texture(&view.bad_mark);
-	oshu::destroy_texture(&view.skip_mark);
-	oshu::destroy_texture(&view.connector);
+}
+
+void oshu::osu_upload_resources(oshu::osu_ui &view)
+{
+	if (view.painting.valid())
+		view.painting.get();
+	if (view.atlas.entries.empty())
+		return;
+	int64_t start = oshu::trace_clock();
+	oshu::build_atlas(&view.atlas, view.display);
+	oshu::log_startup("uploading the sprites", start);
+}
+
+void oshu::osu_free_resources(oshu::osu_ui &view)
+{
+	if (view.painting.valid())
+		view.painting.wait();
+	oshu::game_base *game = &view.game;
+	delete[] view.circles;
+	view.circles = nullptr;
+	oshu::clear_texture_cache(&view.slider_textures);
+	oshu::destroy_atlas(&view.atlas);
 }
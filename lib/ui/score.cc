@@ -12,15 +12,65 @@
 
 #include <SDL2/SDL.h>
 
+#include <algorithm>
+
 int oshu::create_score_frame(oshu::display *display, oshu::beatmap *beatmap, oshu::score_frame *frame)
 {
 	memset(frame, 0, sizeof(*frame));
 	frame->display = display;
 	frame->beatmap = beatmap;
 	frame->score = oshu::score(beatmap);
+	frame->offsets = oshu::hit_offsets(beatmap);
+	double leniency = beatmap->difficulty.leniency;
+	for (oshu::hit *hit = beatmap->hits; hit; hit = hit->next) {
+		if (hit->state != oshu::GOOD_HIT)
+			continue;
+		int bin = (hit->offset / leniency + 1.) / 2. * offset_bins;
+		bin = std::max(0, std::min(offset_bins - 1, bin));
+		frame->histogram_max = std::max(frame->histogram_max, ++frame->histogram[bin]);
+	}
 	return 0;
 }
 
+/**
+ * Draw the histogram of the offsets, with the bars of the great hits in green,
+ * and the early and late ones in yellow, like the tally counts them.
+ *
+ * The mean offset is marked by a white line.
+ */
+static void show_histogram(oshu::score_frame *frame, SDL_Rect *area, double opacity)
+{
+	if (frame->histogram_max == 0)
+		return;
+	SDL_Renderer *renderer = frame->display->renderer;
+	double width = (double) area->w / oshu::offset_bins;
+	for (int i = 0; i < oshu::offset_bins; ++i) {
+		int height = (double) frame->histogram[i] / frame->histogram_max * area->h;
+		SDL_Rect bar = {
+			.x = (int) (area->x + i * width),
+			.y = area->y + area->h - height,
+			.w = std::max(1, (int) width - 1),
+			.h = height,
+		};
+		double center = ((i + .5) / oshu::offset_bins) * 2. - 1.;
+		if (std::abs(center) <= .5)
+			SDL_SetRenderDrawColor(renderer, 0, 255, 0, 196 * opacity);
+		else
+			SDL_SetRenderDrawColor(renderer, 255, 196, 0, 196 * opacity);
+		SDL_RenderFillRect(renderer, &bar);
+	}
+	double leniency = frame->beatmap->difficulty.leniency;
+	double mean = std::max(-1., std::min(1., frame->offsets.mean / leniency));
+	SDL_Rect marker = {
+		.x = (int) (area->x + (mean + 1.) / 2. * area->w),
+		.y = area->y - 5,
+		.w = 2,
+		.h = area->h + 5,
+	};
+	SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255 * opacity);
+	SDL_RenderFillRect(renderer, &marker);
+}
+
 void oshu::show_score_frame(oshu::score_frame *frame, double opacity)
 {
 	if (std::isnan(frame->score)) return;
@@ -50,6 +100,14 @@ void oshu::show_score_frame(oshu::score_frame *frame, double opacity)
 	};
 	SDL_SetRenderDrawColor(frame->display->renderer, 255, 0, 0, 196 * opacity);
 	SDL_RenderFillRect(frame->display->renderer, &bad);
+
+	SDL_Rect histogram = {
+		.x = (int) (std::real(frame->display->view.size) * 0.35),
+		.y = bar.y - 75,
+		.w = (int) (std::real(frame->display->view.size) * 0.30),
+		.h = 60,
+	};
+	show_histogram(frame, &histogram, opacity);
 }
 
 void oshu::destroy_score_frame(oshu::score_frame *frame)
@@ -0,0 +1,242 @@
+/**
+ * \file lib/ui/screens/calibration.cc
+ * \ingroup ui_screens
+ *
+ * \brief
+ * Implement the calibration screen, reached from the pause screen.
+ */
+
+#include "./screens.h"
+
+#include "game/base.h"
+#include "game/calibration.h"
+#include "game/tty.h"
+#include "ui/shell.h"
+#include "video/display.h"
+
+#include <SDL2/SDL.h>
+
+#include <algorithm>
+#include <cmath>
+
+/**
+ * How long before the music reaches a beat its tick is scheduled, on top of
+ * the audio latency, in seconds.
+ */
+static const double metronome_lookahead = .1;
+
+/**
+ * The taps shown on the screen, from the last one.
+ */
+static const size_t shown_taps = 32;
+
+/**
+ * The offset at the edges of the tap graph, in seconds.
+ */
+static const double graph_range = .1;
+
+static void finish(oshu::shell &w, bool save)
+{
+	oshu::game_base *game = &w.game;
+	oshu::calibration *calibration = &w.calibration;
+	if (save) {
+		if (calibration->taps.count < oshu::calibration_taps)
+			return;
+		double offset = game->clock.offset + calibration->taps.mean;
+		if (oshu::save_global_offset(offset) == 0)
+			game->clock.offset = offset;
+	}
+	game->rewind(game->clock.now - calibration->resume);
+	game->pause();
+	w.screen = &oshu::pause_screen;
+}
+
+static void tap(oshu::shell &w)
+{
+	if (!std::isnan(oshu::record_tap(&w.calibration, &w.game.beatmap, w.game.clock.now)))
+		oshu::print_calibration(&w.calibration);
+}
+
+static int on_event(oshu::shell &w, union SDL_Event *event)
+{
+	switch (event->type) {
+	case SDL_KEYDOWN:
+		if (event->key.repeat)
+			break;
+		switch (event->key.keysym.sym) {
+		case oshu::QUIT_KEY:
+			w.close();
+			break;
+		case oshu::PAUSE_KEY:
+			finish(w, false);
+			break;
+		case oshu::SAVE_KEY:
+			finish(w, true);
+			break;
+		default:
+			if (oshu::translate_key(&event->key.keysym) != oshu::UNKNOWN_KEY)
+				tap(w);
+		}
+		break;
+	case SDL_MOUSEBUTTONDOWN:
+		tap(w);
+		break;
+	case SDL_WINDOWEVENT:
+		switch (event->window.event) {
+		case SDL_WINDOWEVENT_MINIMIZED:
+		case SDL_WINDOWEVENT_FOCUS_LOST:
+			finish(w, false);
+			break;
+		case SDL_WINDOWEVENT_CLOSE:
+			w.close();
+			break;
+		}
+		break;
+	}
+	return 0;
+}
+
+/**
+ * Schedule the ticks of the metronome, just before the music they're mixed
+ * into is sent to SDL.
+ *
+ * The ticks are the default normal hit sound.
+ */
+static int update(oshu::shell &w)
+{
+	oshu::game_base *game = &w.game;
+	if (game->clock.now >= 0)
+		oshu::play_audio(&game->audio);
+	if (game->clock.now > game->audio.music.duration) {
+		finish(w, false);
+		return 0;
+	}
+	oshu::hit_sound tick = {
+		.sample_set = oshu::NORMAL_SAMPLE_SET,
+		.additions = oshu::HIT_SOUND | oshu::NORMAL_SOUND,
+		.additions_set = oshu::NORMAL_SAMPLE_SET,
+		.index = oshu::DEFAULT_SHELF,
+		.volume = 1.,
+	};
+	double horizon = game->clock.now + (game->audio.latency + game->clock.offset + metronome_lookahead) * game->audio.rate;
+	for (;;) {
+		double beat = oshu::next_beat(&game->beatmap, w.calibration.scheduled);
+		if (std::isnan(beat) || beat > horizon)
+			break;
+		oshu::schedule_sound(&game->library, &tick, &game->audio, beat);
+		w.calibration.scheduled = beat;
+	}
+	return 0;
+}
+
+/**
+ * Flash a square on every beat, for the players who follow the picture rather
+ * than the sound.
+ */
+static void draw_flash(oshu::shell &w)
+{
+	double now = w.game.clock.now;
+	double beat = oshu::nearest_beat(&w.game.beatmap, now);
+	if (std::isnan(beat) || now < beat)
+		return;
+	double light = 1. - (now - beat) / .15;
+	if (light <= 0)
+		return;
+	const double size = 100;
+	oshu::size screen = w.display.view.size;
+	SDL_Rect square = {
+		.x = (int) (std::real(screen) / 2. - size / 2.),
+		.y = (int) (std::imag(screen) / 2. - size / 2.),
+		.w = (int) size,
+		.h = (int) size,
+	};
+	SDL_SetRenderDrawColor(w.display.renderer, 255, 255, 255, 255 * light);
+	SDL_RenderFillRect(w.display.renderer, &square);
+}
+
+/**
+ * Show the last taps on a horizontal axis, early on the left and late on the
+ * right, with the band of the mean plus or minus the jitter behind them.
+ */
+static void draw_taps(oshu::shell &w)
+{
+	const oshu::calibration *calibration = &w.calibration;
+	SDL_Renderer *renderer = w.display.renderer;
+	oshu::size screen = w.display.view.size;
+	double width = std::real(screen) * .6;
+	double left = (std::real(screen) - width) / 2.;
+	int top = std::imag(screen) * .75;
+	const int height = 40;
+	auto x = [&](double offset) {
+		offset = std::max(-graph_range, std::min(graph_range, offset));
+		return (int) (left + (offset / graph_range + 1.) / 2. * width);
+	};
+
+	SDL_Rect axis = {(int) left, top + height / 2, (int) width, 1};
+	SDL_SetRenderDrawColor(renderer, 255, 255, 255, 64);
+	SDL_RenderFillRect(renderer, &axis);
+	SDL_Rect zero = {x(0), top, 1, height};
+	SDL_RenderFillRect(renderer, &zero);
+
+	const oshu::offset_stats *taps = &calibration->taps;
+	if (taps->count == 0)
+		return;
+	double jitter = oshu::offset_jitter(taps);
+	int from = x(taps->mean - jitter), to = x(taps->mean + jitter);
+	SDL_Rect band = {from, top, std::max(1, to - from), height};
+	SDL_SetRenderDrawColor(renderer, 64, 128, 255, 64);
+	SDL_RenderFillRect(renderer, &band);
+
+	const std::vector<double> &offsets = calibration->offsets;
+	size_t first = offsets.size() > shown_taps ? offsets.size() - shown_taps : 0;
+	for (size_t i = first; i < offsets.size(); ++i) {
+		double age = (double) (offsets.size() - 1 - i) / shown_taps;
+		SDL_Rect mark = {x(offsets[i]) - 1, top + height / 4, 2, height / 2};
+		SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255 * (1. - age));
+		SDL_RenderFillRect(renderer, &mark);
+	}
+
+	SDL_Rect mean = {x(taps->mean) - 2, top - 5, 4, height + 10};
+	SDL_SetRenderDrawColor(renderer, taps->count >= oshu::calibration_taps ? 0 : 255, 255, 0, 255);
+	SDL_RenderFillRect(renderer, &mean);
+}
+
+static int draw(oshu::shell &w)
+{
+	SDL_ShowCursor(SDL_ENABLE);
+	oshu::show_background(&w.background, 0);
+	oshu::show_audio_progress_bar(&w.audio_progress_bar);
+	SDL_SetRenderDrawBlendMode(w.display.renderer, SDL_BLENDMODE_BLEND);
+	draw_flash(w);
+	draw_taps(w);
+	return 0;
+}
+
+void oshu::calibrate(oshu::shell &w)
+{
+	oshu::game_base *game = &w.game;
+	oshu::start_calibration(&w.calibration, game->clock.now);
+	/* The music starts at 0, and so does the metronome. */
+	w.calibration.scheduled = std::max(0., game->clock.now);
+	game->unpause();
+	oshu::print_calibration(&w.calibration);
+	w.screen = &oshu::calibration_screen;
+}
+
+/**
+ * Calibration screen: the music plays on from where the game was paused,
+ * along with a metronome on its beats, and every key or click is a tap.
+ *
+ * The taps are not judged. Instead, their offset to the nearest beat is
+ * shown, and once there are enough of them, saving adds their mean to the
+ * global offset, which fixes the clock right away.
+ *
+ * Leaving the screen goes back to the pause screen, at the time the
+ * calibration started.
+ */
+oshu::game_screen oshu::calibration_screen = {
+	.name = "Calibrating",
+	.on_event = on_event,
+	.update = update,
+	.draw = draw,
+};
@@ -9,6 +9,7 @@
 #include "./screens.h"
 
 #include "game/base.h"
+#include "game/spectator.h"
 #include "ui/shell.h"
 #include "video/display.h"
 
@@ -37,6 +38,10 @@ static int on_event(oshu::shell &w, union SDL_Event *event)
 		case oshu::FORWARD_KEY:
 			game->forward(20.);
 			break;
+		case oshu::CALIBRATE_KEY:
+			if (!game->autoplay && !game->spectating)
+				oshu::calibrate(w);
+			break;
 		}
 		break;
 	case SDL_WINDOWEVENT:
@@ -53,6 +58,9 @@ static int on_event(oshu::shell &w, union SDL_Event *event)
 static int update(oshu::shell &w)
 {
 	oshu::game_base *game = &w.game;
+	/* Keep the spectators waiting rather than gone. */
+	if (game->publishing)
+		oshu::publish_clock(game->publishing, game);
 	if (!game->paused)
 		w.screen = &oshu::play_screen;
 	return 0;
@@ -98,6 +106,8 @@ static int draw(oshu::shell &w)
  * When resuming, the audio is rewinded by 1 second to leave the user some time
  * to re-focus.
  *
+ * From there, the calibration screen measures the global offset.
+ *
  */
 oshu::game_screen oshu::pause_screen = {
 	.name = "Paused",
@@ -9,6 +9,7 @@
 #include "./screens.h"
 
 #include "game/base.h"
+#include "game/spectator.h"
 #include "game/tty.h"
 #include "ui/widget.h"
 #include "ui/shell.h"
@@ -17,6 +18,15 @@
 
 #include <SDL2/SDL.h>
 
+/**
+ * Whether the user's input plays the game, which it doesn't when the game
+ * plays itself or follows another player.
+ */
+static bool playing(oshu::game_base *game)
+{
+	return !game->autoplay && !game->spectating;
+}
+
 static int on_event(oshu::shell &w, union SDL_Event *event)
 {
 	oshu::game_base *game = &w.game;
@@ -36,7 +46,7 @@ static int on_event(oshu::shell &w, union SDL_Event *event)
 			game->forward(20.);
 			break;
 		default:
-			if (!game->autoplay) {
+			if (playing(game)) {
 				enum oshu::finger key = oshu::translate_key(&event->key.keysym);
 				if (key != oshu::UNKNOWN_KEY)
 					game->press(key);
@@ -44,25 +54,25 @@ static int on_event(oshu::shell &w, union SDL_Event *event)
 		}
 		break;
 	case SDL_KEYUP:
-		if (!game->autoplay) {
+		if (playing(game)) {
 			enum oshu::finger key = oshu::translate_key(&event->key.keysym);
 			if (key != oshu::UNKNOWN_KEY)
 				game->release(key);
 		}
 		break;
 	case SDL_MOUSEBUTTONDOWN:
-		if (!game->autoplay)
+		if (playing(game))
 			game->press(oshu::LEFT_BUTTON);
 		break;
 	case SDL_MOUSEBUTTONUP:
-		if (!game->autoplay)
+		if (playing(game))
 			game->release(oshu::LEFT_BUTTON);
 		break;
 	case SDL_WINDOWEVENT:
 		switch (event->window.event) {
 		case SDL_WINDOWEVENT_MINIMIZED:
 		case SDL_WINDOWEVENT_FOCUS_LOST:
-			if (!game->autoplay && game->hit_cursor->next) {
+			if (playing(game) && game->hit_cursor->next) {
 				game->pause();
 				w.screen = &oshu::pause_screen;
 			}
@@ -100,8 +110,14 @@ static void check_end(oshu::shell &w)
 static int update(oshu::shell &w)
 {
 	oshu::game_base *game = &w.game;
+	if (game->publishing)
+		oshu::publish_clock(game->publishing, game);
+	if (game->spectating)
+		oshu::follow(game->spectating, game);
 	if (game->paused) {
-		w.screen = &oshu::pause_screen;
+		/* The spectator's game resumes by itself with the player's. */
+		if (!game->spectating)
+			w.screen = &oshu::pause_screen;
 		return 0;
 	}
 	if (game->clock.now >= 0)
@@ -115,7 +131,7 @@ static int update(oshu::shell &w)
 }
 
 /**
- * Draw the background, adjusting the brightness.
+ * Compute the brightness of the background.
  *
  * Most of the time, the background will be displayed at 25% of its luminosity,
  * so that hit objects are clear.
@@ -140,7 +156,7 @@ static int update(oshu::shell &w)
  * seconds.
  *
  */
-static void draw_background(oshu::shell &w)
+static double background_brightness(oshu::shell &w)
 {
 	oshu::game_base *game = &w.game;
 	double break_start = oshu::hit_end_time(oshu::previous_hit(game));
@@ -149,7 +165,20 @@ static void draw_background(oshu::shell &w)
 	double ratio = 0.;
 	if (break_end - break_start > 6.)
 		ratio = oshu::trapezium(break_start + 1, break_end - 1, 1, now);
-	oshu::show_background(&w.background, ratio);
+	return ratio;
+}
+
+/**
+ * Draw the background, then the storyboard, dimmed alike.
+ *
+ * The background is skipped when the storyboard draws it by itself, possibly
+ * moving or fading it, unless there's a video to play behind the storyboard.
+ */
+static void draw_background(oshu::shell &w, double brightness)
+{
+	if (!w.storyboard.hides_background || w.background.movie)
+		oshu::show_background(&w.background, brightness);
+	oshu::show_storyboard(&w.storyboard, w.game.clock.now, oshu::STORYBOARD_BACKGROUND, oshu::STORYBOARD_FOREGROUND, brightness);
 }
 
 static int draw(oshu::shell &w)
@@ -157,11 +186,13 @@ static int draw(oshu::shell &w)
 	oshu::game_base *game = &w.game;
 	if (w.display.features & oshu::FANCY_CURSOR)
 		SDL_ShowCursor(SDL_DISABLE);
-	draw_background(w);
+	double brightness = background_brightness(w);
+	draw_background(w, brightness);
 	oshu::show_metadata_frame(&w.metadata, oshu::fade_out(5, 6, game->clock.system));
 	oshu::show_audio_progress_bar(&w.audio_progress_bar);
 	if (w.game_view)
 		w.game_view->draw();
+	oshu::show_storyboard(&w.storyboard, game->clock.now, oshu::STORYBOARD_OVERLAY, oshu::STORYBOARD_OVERLAY, brightness);
 	return 0;
 }
 
@@ -37,8 +37,18 @@ static int on_event(oshu::shell &w, union SDL_Event *event)
 	return 0;
 }
 
+/**
+ * In a playlist, leave the score screen after a while.
+ */
 static int update(oshu::shell &w)
 {
+	if (!w.continuous)
+		return 0;
+	double end = oshu::hit_end_time(oshu::previous_hit(&w.game));
+	if (w.game.clock.now > end + oshu::playlist_delay) {
+		w.finished = true;
+		w.close();
+	}
 	return 0;
 }
 
@@ -58,7 +68,8 @@ static int draw(oshu::shell &w)
 /**
  * Game complete screen.
  *
- * Once this screen is reached, the only command left is *exit*.
+ * Once this screen is reached, the only command left is *exit*, unless the
+ * beatmap is part of a playlist, in which case the next one follows.
  *
  */
 oshu::game_screen oshu::score_screen = {
@@ -40,6 +40,8 @@ struct shell;
  * 		rank=same;
  * 		Pause -> Play;
  * 		Play -> Pause;
+ * 		Pause -> Calibration;
+ * 		Calibration -> Pause;
  * 	}
  * 	Start -> Play;
  * 	Play -> Finish;
@@ -93,6 +95,15 @@ extern oshu::game_screen pause_screen;
 /* Defined in score.c */
 extern oshu::game_screen score_screen;
 
+/* Defined in calibration.cc */
+extern oshu::game_screen calibration_screen;
+
+/**
+ * Switch to the calibration screen, and start the music from the current
+ * time.
+ */
+void calibrate(oshu::shell &w);
+
 /** \} */
 
 }
@@ -7,9 +7,14 @@
 
 #include "game/base.h"
 #include "core/log.h"
+#include "core/memory.h"
+#include "core/metrics.h"
+#include "core/trace.h"
+#include "game/controls.h"
 #include "game/tty.h"
 #include "ui/widget.h"
 #include "video/display.h"
+#include "video/pacing.h"
 
 #include "./screens/screens.h"
 
@@ -22,6 +27,24 @@ static void set_title(oshu::shell &w)
 	oshu::reset_view(&w.display);
 }
 
+/**
+ * Load the storyboard of the set, named `Artist - Title (Creator).osb`, and
+ * then the one of the beatmap, so that the latter is drawn above.
+ */
+static void load_storyboard(oshu::shell &w)
+{
+	oshu::game_base &game = w.game;
+	oshu::metadata *meta = &game.beatmap.metadata;
+	std::vector<std::string> files;
+	if (meta->artist && meta->title && meta->creator) {
+		std::ostringstream osb;
+		osb << meta->artist << " - " << meta->title << " (" << meta->creator << ").osb";
+		files.push_back(game.asset_path(osb.str().c_str()));
+	}
+	files.push_back(game.path);
+	oshu::load_storyboard_scene(&w.display, files, game.directory, game.beatmap.background_filename, &w.storyboard);
+}
+
 namespace oshu {
 
 shell::shell(oshu::display &display, oshu::game_base &game)
@@ -29,67 +52,174 @@ shell::shell(oshu::display &display, oshu::game_base &game)
 {
 	set_title(*this);
 	if (game.beatmap.background_filename)
-		oshu::load_background(&display, game.beatmap.background_filename, &background);
+		oshu::load_background(&display, game.asset_path(game.beatmap.background_filename).c_str(), &background);
+	if (game.beatmap.video_filename)
+		oshu::load_background_video(&display, game.asset_path(game.beatmap.video_filename).c_str(), game.beatmap.video_offset, &game.clock.now, &background);
+	load_storyboard(*this);
+	int64_t start = oshu::trace_clock();
 	oshu::create_metadata_frame(&display, &game.beatmap, &game.clock.system, &metadata);
-	oshu::create_audio_progress_bar(&display, &game.audio.music, &audio_progress_bar);
+	oshu::log_startup("painting the metadata", start);
+	oshu::create_audio_progress_bar(&display, &game.audio, &audio_progress_bar);
+	oshu::create_trace_overlay(&display, &trace_overlay);
 }
 
 shell::~shell()
 {
-	game_view.release();
+	game_view.reset();
 	oshu::destroy_background(&background);
+	oshu::destroy_storyboard_scene(&storyboard);
 	oshu::destroy_metadata_frame(&metadata);
 	oshu::destroy_score_frame(&score);
 	oshu::destroy_audio_progress_bar(&audio_progress_bar);
+	oshu::destroy_trace_overlay(&trace_overlay);
 }
 
 static void draw(shell &w)
 {
+	oshu::scoped_timer timer(oshu::DRAW_ZONE);
 	SDL_SetRenderDrawColor(w.display.renderer, 0, 0, 0, 255);
 	SDL_RenderClear(w.display.renderer);
 	w.screen->draw(w);
+	oshu::reset_view(&w.display);
+	oshu::show_trace_overlay(&w.trace_overlay);
 	SDL_RenderPresent(w.display.renderer);
 }
 
+static void update(shell &w)
+{
+	oshu::scoped_timer timer(oshu::UPDATE_ZONE);
+	w.screen->update(w);
+}
+
+/**
+ * Handle an input event at the time it happened, and update the game right
+ * away, so that the hits are judged without waiting for the next frame.
+ */
+static void handle_event(shell &w, union SDL_Event *event)
+{
+	if (event->type == SDL_RENDER_TARGETS_RESET || event->type == SDL_RENDER_DEVICE_RESET)
+		oshu::invalidate_background(&w.background);
+	if (event->type == SDL_KEYDOWN && !event->key.repeat && event->key.keysym.sym == oshu::TRACE_KEY) {
+		w.trace_overlay.visible = !w.trace_overlay.visible;
+		return;
+	}
+	oshu::update_clock(&w.game, event->common.timestamp / 1000.);
+	oshu::reset_view(&w.display);
+	w.screen->on_event(w, event);
+	update(w);
+}
+
+/**
+ * Log a summary of the spans, and export them if *OSHU_TRACE* is set.
+ */
+static void report_trace()
+{
+	for (int zone = 0; zone < oshu::ZONE_COUNT; ++zone) {
+		oshu::zone_stats stats = oshu::compute_stats((enum oshu::trace_zone) zone);
+		if (stats.count > 0)
+			oshu_log_debug("%s: mean %.2f ms, p99 %.2f ms, max %.2f ms over the last %d spans",
+			               oshu::zone_name((enum oshu::trace_zone) zone),
+			               stats.mean * 1e3, stats.p99 * 1e3, stats.max * 1e3, stats.count);
+	}
+	const char *path = getenv("OSHU_TRACE");
+	if (path && *path)
+		oshu::export_trace(path);
+}
+
+/**
+ * How often the metrics are saved to *OSHU_METRICS*, in seconds.
+ */
+static const double metrics_interval = 10.;
+
+/**
+ * Save the metrics if *OSHU_METRICS* is set, and at most every
+ * #metrics_interval seconds unless *force* is set.
+ */
+static void save_metrics(double now, bool force)
+{
+	static double last_save = 0;
+	static const char *path = getenv("OSHU_METRICS");
+	if (!path || !*path)
+		return;
+	if (!force && now - last_save < metrics_interval)
+		return;
+	last_save = now;
+	oshu::save_metrics(path);
+}
+
+/**
+ * Log when the first frame of the process was shown, which is when the startup
+ * is over.
+ */
+static void report_first_frame()
+{
+	static bool reported = false;
+	if (reported)
+		return;
+	reported = true;
+	oshu::log_startup("first frame", 0);
+}
+
 void shell::open()
 {
+	int64_t start = oshu::trace_clock();
+	game.finish_loading();
+	oshu::log_startup("waiting for the hit sounds", start);
 	oshu::welcome(&game);
 	oshu::initialize_clock(&game);
+	game.clock.offset = oshu::load_global_offset();
 
 	SDL_Event event;
-	int missed_frames = 0;
+	oshu::frame_pacer pacer;
+	oshu::start_pacing(&pacer, &display);
 
 	while (!stop) {
+		while (!stop && oshu::wait_event(&pacer, &event))
+			handle_event(*this, &event);
+		if (oshu::wait_frame(&pacer) < 0 && pacer.missed_frames == 1000) {
+			oshu_log_warning("your computer is having a hard time keeping up");
+			if (display.features)
+				oshu_log_warning("try running oshu! with OSHU_QUALITY=low (see the man page)");
+		}
+		/* Poll the input right after waiting, so that it's as fresh as
+		 * possible when the frame is drawn. */
+		int64_t start = oshu::trace_clock();
+		while (SDL_PollEvent(&event))
+			handle_event(*this, &event);
 		oshu::update_clock(&game);
 		oshu::reset_view(&display);
-		while (SDL_PollEvent(&event))
-			screen->on_event(*this, &event);
-		screen->update(*this);
+		update(*this);
 		draw(*this);
+		oshu::count(oshu::FRAMES);
+		oshu::end_span(oshu::FRAME_ZONE, start);
+		report_first_frame();
+		save_metrics(game.clock.system, false);
 
-		/* Calling oshu::print_state before draw causes some flickering
-		 * on the tty, for some reason. */
+		/* The status line is throttled, and skipped when the terminal
+		 * is busy, so that it never holds the frame. */
 		if (screen == &oshu::play_screen)
 			oshu::print_state(&game);
-
-		double advance = display.frame_duration - (SDL_GetTicks() / 1000. - game.clock.system);
-		if (advance > 0) {
-			SDL_Delay(advance * 1000);
-		} else {
-			missed_frames++;
-			if (missed_frames == 1000) {
-				oshu_log_warning("your computer is having a hard time keeping up");
-				if (display.features)
-					oshu_log_warning("try running oshu! with OSHU_QUALITY=low (see the man page)");
-			}
-		}
 	}
 
 	if (screen != &oshu::score_screen)
 		puts("");
 		/* write a new line to avoid conflict between the status line
 		 * and the shell prompt */
-	oshu_log_debug("%d missed frames", missed_frames);
+	oshu_log_debug("%d missed frames", pacer.missed_frames);
+	report_trace();
+	save_metrics(game.clock.system, true);
+	oshu_log_debug("audio: %lld underruns, %lld short reads, slowest callback %.3f ms",
+	               (long long) oshu::metrics[oshu::AUDIO_UNDERRUNS].load(),
+	               (long long) oshu::metrics[oshu::AUDIO_SHORT_READS].load(),
+	               oshu::metrics[oshu::AUDIO_CALLBACK_MAX_TIME].load() / 1e3);
+	oshu::log_memory_usage();
+}
+
+void shell::step()
+{
+	oshu::reset_view(&display);
+	update(*this);
+	draw(*this);
 }
 
 void shell::close()
@@ -0,0 +1,104 @@
+/**
+ * \file lib/ui/slider_painter.cc
+ * \ingroup ui_slider_painter
+ */
+
+#include "ui/slider_painter.h"
+
+#include "core/log.h"
+#include "ui/osu.h"
+
+#include <algorithm>
+#include <system_error>
+
+/**
+ * Maximum number of painting threads.
+ *
+ * The main thread needs a core for itself, and sliders are requested a
+ * few seconds before they are needed, so a couple of threads are enough.
+ */
+static const unsigned int max_workers = 2;
+
+static void work(oshu::slider_painter *painter)
+{
+	std::unique_lock<std::mutex> lock(painter->mutex);
+	for (;;) {
+		painter->signal.wait(lock, [&] { return painter->stopping || !painter->queue.empty(); });
+		if (painter->stopping)
+			return;
+		oshu::slider_job job = painter->queue.front();
+		painter->queue.pop_front();
+		lock.unlock();
+		job.rc = oshu::osu_sketch_slider(job.hit, painter->radius, job.zoom, painter->premultiplied, &job.painter, &job.origin);
+		lock.lock();
+		painter->done.push_back(job);
+	}
+}
+
+int oshu::start_slider_painter(oshu::slider_painter *painter, double radius, bool premultiplied)
+{
+	painter->radius = radius;
+	painter->premultiplied = premultiplied;
+	painter->stopping = false;
+	unsigned int count = std::thread::hardware_concurrency();
+	count = std::min(max_workers, count > 1 ? count - 1 : 1);
+	for (unsigned int i = 0; i < count; ++i) {
+		try {
+			painter->workers.emplace_back(work, painter);
+		} catch (std::system_error &e) {
+			oshu_log_debug("could not start a slider painting thread: %s", e.what());
+			break;
+		}
+	}
+	return painter->workers.empty() ? -1 : 0;
+}
+
+void oshu::request_slider(oshu::slider_painter *painter, oshu::hit *hit, double zoom)
+{
+	if (painter->workers.empty())
+		return;
+	std::lock_guard<std::mutex> lock(painter->mutex);
+	if (!painter->requested.insert(hit).second)
+		return;
+	painter->queue.push_back(oshu::slider_job {hit, zoom, {}, {}, 0});
+	painter->signal.notify_one();
+}
+
+void oshu::cancel_slider(oshu::slider_painter *painter, oshu::hit *hit)
+{
+	std::lock_guard<std::mutex> lock(painter->mutex);
+	auto it = std::find_if(painter->queue.begin(), painter->queue.end(),
+	                       [&](const oshu::slider_job &job) { return job.hit == hit; });
+	if (it != painter->queue.end()) {
+		painter->queue.erase(it);
+		painter->requested.erase(hit);
+	}
+}
+
+bool oshu::poll_slider(oshu::slider_painter *painter, oshu::slider_job *job)
+{
+	std::lock_guard<std::mutex> lock(painter->mutex);
+	if (painter->done.empty())
+		return false;
+	*job = painter->done.front();
+	painter->done.pop_front();
+	painter->requested.erase(job->hit);
+	return true;
+}
+
+void oshu::stop_slider_painter(oshu::slider_painter *painter)
+{
+	{
+		std::lock_guard<std::mutex> lock(painter->mutex);
+		painter->stopping = true;
+		painter->signal.notify_all();
+	}
+	for (std::thread &t : painter->workers)
+		t.join();
+	painter->workers.clear();
+	for (oshu::slider_job &job : painter->done)
+		oshu::discard_painting(&job.painter);
+	painter->done.clear();
+	painter->queue.clear();
+	painter->requested.clear();
+}
@@ -0,0 +1,236 @@
+/**
+ * \file ui/storyboard.cc
+ * \ingroup ui_storyboard
+ */
+
+#include "ui/storyboard.h"
+
+#include "core/log.h"
+#include "core/trace.h"
+#include "core/vfs.h"
+#include "video/display.h"
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_image.h>
+
+#include <algorithm>
+#include <atomic>
+#include <strings.h>
+#include <system_error>
+#include <thread>
+
+/**
+ * Pictures wider or taller than that get their own texture, like the
+ * full-screen backgrounds some storyboards are made of.
+ */
+static const int max_packed_size = 512;
+
+/**
+ * The area of the pictures packed in one atlas, in pixels, so that the 2048
+ * pixels wide atlases stay about as tall, which every GPU supports.
+ */
+static const size_t atlas_area = 2048 * 1536;
+
+/**
+ * Decode a picture into the pixel format the atlases expect.
+ *
+ * \return null on failure, after logging why.
+ */
+static SDL_Surface *load_picture(const std::string &path)
+{
+	if (!oshu::file_exists(path.c_str())) {
+		oshu_log_debug("missing storyboard picture %s", path.c_str());
+		return nullptr;
+	}
+	oshu::file_view file;
+	if (oshu::open_file(path.c_str(), &file) < 0)
+		return nullptr;
+	SDL_Surface *pic = IMG_Load_RW(SDL_RWFromConstMem(file.data, file.size), 1);
+	oshu::close_file(&file);
+	if (!pic) {
+		oshu_log_debug("could not load %s: %s", path.c_str(), IMG_GetError());
+		return nullptr;
+	}
+	SDL_Surface *converted = SDL_ConvertSurfaceFormat(pic, SDL_PIXELFORMAT_ARGB8888, 0);
+	SDL_FreeSurface(pic);
+	return converted;
+}
+
+/**
+ * Parse the storyboard files, and decode the pictures on as many threads as
+ * there are cores.
+ *
+ * This runs on the loader thread, so it must not touch the renderer.
+ */
+static std::vector<SDL_Surface*> load_scene(std::vector<std::string> files, std::string directory, oshu::storyboard *storyboard)
+{
+	int64_t start = oshu::trace_clock();
+	for (const std::string &file : files) {
+		if (oshu::file_exists(file.c_str()))
+			oshu::read_storyboard(file.c_str(), storyboard);
+	}
+	std::vector<SDL_Surface*> pictures(storyboard->images.size());
+	if (pictures.empty())
+		return pictures;
+	std::atomic<size_t> next {0};
+	auto work = [&]() {
+		for (size_t i; (i = next++) < pictures.size();) {
+			const std::string &image = storyboard->images[i];
+			pictures[i] = load_picture(directory.empty() ? image : directory + "/" + image);
+		}
+	};
+	size_t count = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), pictures.size());
+	std::vector<std::thread> workers;
+	for (size_t i = 1; i < count; ++i)
+		workers.emplace_back(work);
+	work();
+	for (std::thread &t : workers)
+		t.join();
+	oshu::log_startup("loading the storyboard", start);
+	return pictures;
+}
+
+int oshu::load_storyboard_scene(oshu::display *display, const std::vector<std::string> &files, const std::string &directory, const char *background, oshu::storyboard_scene *scene)
+{
+	*scene = {};
+	scene->display = display;
+	if (!(display->features & oshu::SHOW_BACKGROUND))
+		return 0;
+	if (background) {
+		scene->background = background;
+		std::replace(scene->background.begin(), scene->background.end(), '\\', '/');
+	}
+	try {
+		scene->loader = std::async(std::launch::async, load_scene, files, directory, &scene->storyboard);
+	} catch (std::system_error &e) {
+		oshu_log_error("could not start loading the storyboard: %s", e.what());
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Give a picture its own texture.
+ */
+static void upload_alone(oshu::storyboard_scene *scene, SDL_Surface *pic, oshu::sprite *sprite)
+{
+	oshu::texture texture;
+	texture.size = oshu::size(pic->w, pic->h);
+	texture.texture = SDL_CreateTextureFromSurface(scene->display->renderer, pic);
+	oshu::track_texture(texture.texture);
+	SDL_FreeSurface(pic);
+	if (!texture.texture) {
+		oshu_log_error("error uploading a storyboard picture: %s", SDL_GetError());
+		return;
+	}
+	sprite->size = texture.size;
+	sprite->texture = texture.texture;
+	sprite->x = sprite->y = 0;
+	sprite->w = std::real(texture.size);
+	sprite->h = std::imag(texture.size);
+	scene->textures.push_back(texture);
+}
+
+/**
+ * Pack the pictures into atlases once the loader is done, and start the
+ * player.
+ *
+ * The pictures are packed in the order they appear in the storyboard, so
+ * that the sprites shown together tend to share an atlas.
+ */
+static void upload(oshu::storyboard_scene *scene)
+{
+	std::vector<SDL_Surface*> pictures = scene->loader.get();
+	if (scene->storyboard.sprites.empty()) {
+		for (SDL_Surface *pic : pictures)
+			SDL_FreeSurface(pic);
+		return;
+	}
+	int64_t start = oshu::trace_clock();
+	scene->sprites.resize(pictures.size());
+	oshu::atlas *atlas = nullptr;
+	size_t area = 0;
+	for (size_t i = 0; i < pictures.size(); ++i) {
+		SDL_Surface *pic = pictures[i];
+		if (!pic)
+			continue;
+		if (pic->w > max_packed_size || pic->h > max_packed_size) {
+			upload_alone(scene, pic, &scene->sprites[i]);
+			continue;
+		}
+		size_t pic_area = (pic->w + 1) * (pic->h + 1);
+		if (!atlas || area + pic_area > atlas_area) {
+			if (atlas)
+				oshu::build_atlas(atlas, scene->display);
+			scene->atlases.emplace_back();
+			atlas = &scene->atlases.back();
+			area = 0;
+		}
+		oshu::pack_surface(atlas, pic, &scene->sprites[i]);
+		area += pic_area;
+	}
+	if (atlas)
+		oshu::build_atlas(atlas, scene->display);
+	for (const std::string &image : scene->storyboard.images) {
+		if (!strcasecmp(image.c_str(), scene->background.c_str()))
+			scene->hides_background = true;
+	}
+	oshu::start_storyboard(&scene->storyboard, &scene->player);
+	oshu::log_startup("uploading the storyboard", start);
+}
+
+void oshu::show_storyboard(oshu::storyboard_scene *scene, double now, enum oshu::storyboard_layer first, enum oshu::storyboard_layer last, double brightness)
+{
+	if (scene->loader.valid() && scene->loader.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+		upload(scene);
+	if (!scene->player.storyboard)
+		return;
+	oshu::update_storyboard(&scene->player, now);
+	oshu::display *display = scene->display;
+	oshu::fit_view(&display->view, oshu::size{640, 480});
+	float dim = (64 + brightness * 191) / 255.;
+	const std::vector<oshu::storyboard_sprite> &sprites = scene->storyboard.sprites;
+	for (uint32_t i : scene->player.active) {
+		const oshu::storyboard_sprite &s = sprites[i];
+		if (s.layer < first || s.layer == oshu::STORYBOARD_FAIL)
+			continue;
+		if (s.layer > last)
+			break;
+		oshu::sprite_state state;
+		if (!oshu::evaluate_sprite(&scene->player, i, &state))
+			continue;
+		const oshu::sprite *sprite = &scene->sprites[state.image];
+		if (!sprite->texture)
+			continue;
+		oshu::sprite_transform transform;
+		transform.position = state.position;
+		transform.origin = oshu::point(std::real(s.origin) * std::real(sprite->size), std::imag(s.origin) * std::imag(sprite->size));
+		transform.scale = state.scale;
+		transform.rotation = state.rotation;
+		transform.red = state.red * dim;
+		transform.green = state.green * dim;
+		transform.blue = state.blue * dim;
+		transform.alpha = state.alpha;
+		transform.flip_h = state.flip_h;
+		transform.flip_v = state.flip_v;
+		transform.additive = state.additive;
+		oshu::draw_sprite(display, &scene->batch, sprite, transform);
+	}
+	oshu::flush_batch(display, &scene->batch);
+	oshu::reset_view(display);
+}
+
+void oshu::destroy_storyboard_scene(oshu::storyboard_scene *scene)
+{
+	if (scene->loader.valid()) {
+		for (SDL_Surface *pic : scene->loader.get())
+			SDL_FreeSurface(pic);
+	}
+	for (oshu::atlas &atlas : scene->atlases)
+		oshu::destroy_atlas(&atlas);
+	scene->atlases.clear();
+	for (oshu::texture &texture : scene->textures)
+		oshu::destroy_texture(&texture);
+	scene->textures.clear();
+	scene->sprites.clear();
+}
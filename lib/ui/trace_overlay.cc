@@ -0,0 +1,78 @@
+/**
+ * \file ui/trace_overlay.cc
+ * \ingroup ui_trace
+ */
+
+#include "ui/trace_overlay.h"
+
+#include "core/metrics.h"
+#include "core/trace.h"
+#include "video/display.h"
+
+#include <SDL2/SDL.h>
+
+#include <algorithm>
+
+/**
+ * Number of spans shown per row, each one pixel wide.
+ */
+static const int graph_width = 240;
+
+/**
+ * Height of a row, in pixels, for a span as long as the frame budget.
+ */
+static const int row_height = 40;
+
+static void draw_row(oshu::display *display, enum oshu::trace_zone zone, int x, int bottom, double budget, SDL_Color color)
+{
+	SDL_Renderer *renderer = display->renderer;
+	SDL_SetRenderDrawColor(renderer, 0, 0, 0, 160);
+	SDL_Rect box = {x, bottom - row_height, graph_width, row_height};
+	SDL_RenderFillRect(renderer, &box);
+	SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, color.a);
+	for (int i = 0; i < graph_width; ++i) {
+		double d = oshu::span_duration(zone, graph_width - 1 - i);
+		int h = std::min(row_height, (int) (d / budget * row_height + .5));
+		if (h > 0)
+			SDL_RenderDrawLine(renderer, x + i, bottom - 1, x + i, bottom - h);
+	}
+	SDL_SetRenderDrawColor(renderer, 255, 64, 64, 255);
+	SDL_RenderDrawLine(renderer, x, bottom - row_height, x + graph_width - 1, bottom - row_height);
+}
+
+int oshu::create_trace_overlay(oshu::display *display, oshu::trace_overlay *overlay)
+{
+	overlay->display = display;
+	overlay->visible = false;
+	overlay->underruns = oshu::metrics[oshu::AUDIO_UNDERRUNS].load();
+	return 0;
+}
+
+void oshu::show_trace_overlay(oshu::trace_overlay *overlay)
+{
+	oshu::display *display = overlay->display;
+	int64_t underruns = oshu::metrics[oshu::AUDIO_UNDERRUNS].load();
+	bool crackled = underruns != overlay->underruns;
+	overlay->underruns = underruns;
+	if (!overlay->visible)
+		return;
+	double budget = display->frame_duration > 0 ? display->frame_duration : 1. / 60.;
+	SDL_SetRenderDrawBlendMode(display->renderer, SDL_BLENDMODE_BLEND);
+	SDL_Color colors[oshu::ZONE_COUNT] = {
+		crackled ? SDL_Color {255, 64, 64, 255} : SDL_Color {220, 220, 220, 255},
+		{96, 160, 255, 255},
+		{96, 255, 128, 255},
+		{255, 192, 64, 255},
+		{224, 128, 255, 255},
+	};
+	int x = 8;
+	int bottom = std::imag(display->view.size) - 16;
+	for (int zone = oshu::ZONE_COUNT - 1; zone >= 0; --zone) {
+		draw_row(display, (enum oshu::trace_zone) zone, x, bottom, budget, colors[zone]);
+		bottom -= row_height + 4;
+	}
+}
+
+void oshu::destroy_trace_overlay(oshu::trace_overlay *overlay)
+{
+}
@@ -0,0 +1,283 @@
+/**
+ * \file video/atlas.cc
+ * \ingroup video_atlas
+ */
+
+#include "video/atlas.h"
+
+#include "core/log.h"
+#include "core/memory.h"
+#include "video/display.h"
+
+#include <SDL2/SDL.h>
+
+#include <algorithm>
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+/**
+ * Width of the atlas, unless the renderer doesn't support it.
+ */
+static const int atlas_width = 2048;
+
+/**
+ * Transparent pixels between the sprites, so that linear filtering doesn't
+ * bleed a sprite into its neighbour.
+ */
+static const int padding = 1;
+
+void oshu::pack_painting(oshu::atlas *atlas, oshu::painter *painter, oshu::sprite *sprite)
+{
+	painter->premultiplied = atlas->premultiplied;
+	oshu::finish_surface(painter);
+	sprite->size = painter->size;
+	atlas->entries.push_back(oshu::atlas_entry {*painter, sprite});
+	*painter = {};
+}
+
+void oshu::pack_surface(oshu::atlas *atlas, SDL_Surface *surface, oshu::sprite *sprite)
+{
+	assert (surface->format->format == SDL_PIXELFORMAT_ARGB8888);
+	oshu::painter painter;
+	painter.size = oshu::size(surface->w, surface->h);
+	painter.destination = surface;
+	/* It is freed like the paintings', so account for it the same way. */
+	oshu::track_allocation(oshu::VIDEO_MEMORY_CATEGORY, (size_t) surface->pitch * surface->h);
+	sprite->size = painter.size;
+	atlas->entries.push_back(oshu::atlas_entry {painter, sprite});
+}
+
+/**
+ * Assign a position to every sprite, and return the total height.
+ */
+static int arrange(std::vector<oshu::atlas_entry> &entries, int width)
+{
+	std::sort(entries.begin(), entries.end(), [](const oshu::atlas_entry &a, const oshu::atlas_entry &b) {
+		return a.painter.destination->h > b.painter.destination->h;
+	});
+	int x = 0, y = 0, shelf = 0;
+	for (oshu::atlas_entry &entry : entries) {
+		SDL_Surface *surface = entry.painter.destination;
+		if (x + surface->w > width) {
+			x = 0;
+			y += shelf + padding;
+			shelf = 0;
+		}
+		entry.sprite->x = x;
+		entry.sprite->y = y;
+		entry.sprite->w = surface->w;
+		entry.sprite->h = surface->h;
+		x += surface->w + padding;
+		shelf = std::max(shelf, surface->h);
+	}
+	return y + shelf;
+}
+
+int oshu::build_atlas(oshu::atlas *atlas, oshu::display *display)
+{
+	int start = SDL_GetTicks();
+	SDL_RendererInfo info;
+	int width = atlas_width;
+	if (SDL_GetRendererInfo(display->renderer, &info) == 0 && info.max_texture_width > 0)
+		width = std::min(width, info.max_texture_width);
+	for (oshu::atlas_entry &entry : atlas->entries)
+		width = std::max(width, entry.painter.destination->w);
+	int height = arrange(atlas->entries, width);
+
+	int rc = -1;
+	SDL_Surface *surface = oshu::create_surface(width, height);
+	if (!surface) {
+		oshu_log_error("could not create the atlas surface: %s", SDL_GetError());
+		goto done;
+	}
+	for (oshu::atlas_entry &entry : atlas->entries) {
+		SDL_Surface *source = entry.painter.destination;
+		uint8_t *pixels = (uint8_t*) surface->pixels;
+		for (int row = 0; row < source->h; ++row)
+			memcpy(pixels + (entry.sprite->y + row) * surface->pitch + entry.sprite->x * 4,
+			       (uint8_t*) source->pixels + row * source->pitch, source->w * 4);
+	}
+	atlas->texture.size = oshu::size(width, height);
+	atlas->texture.texture = SDL_CreateTextureFromSurface(display->renderer, surface);
+	oshu::track_texture(atlas->texture.texture);
+	oshu::free_surface(surface);
+	if (!atlas->texture.texture) {
+		oshu_log_error("error uploading the atlas: %s", SDL_GetError());
+		goto done;
+	}
+	if (atlas->premultiplied)
+		oshu::set_premultiplied_blend(atlas->texture.texture);
+	for (oshu::atlas_entry &entry : atlas->entries)
+		entry.sprite->texture = atlas->texture.texture;
+	oshu_log_debug("packed %zu sprites in a %dx%d atlas in %.3f seconds",
+	               atlas->entries.size(), width, height, (SDL_GetTicks() - start) / 1000.);
+	rc = 0;
+
+done:
+	for (oshu::atlas_entry &entry : atlas->entries)
+		oshu::discard_painting(&entry.painter);
+	atlas->entries.clear();
+	return rc;
+}
+
+void oshu::destroy_atlas(oshu::atlas *atlas)
+{
+	for (oshu::atlas_entry &entry : atlas->entries)
+		oshu::discard_painting(&entry.painter);
+	atlas->entries.clear();
+	oshu::destroy_texture(&atlas->texture);
+}
+
+/**
+ * Queue a quad, after flushing the batch if the quad can't be drawn with the
+ * queued ones.
+ */
+static void queue(oshu::display *display, oshu::sprite_batch *batch, const oshu::sprite_quad &quad, bool additive)
+{
+	if (quad.sprite->texture != batch->texture || additive != batch->additive)
+		oshu::flush_batch(display, batch);
+	batch->texture = quad.sprite->texture;
+	batch->additive = additive;
+	batch->quads.push_back(quad);
+}
+
+void oshu::draw_sprite(oshu::display *display, oshu::sprite_batch *batch, const oshu::sprite *sprite, oshu::point p, double ratio)
+{
+	if (!sprite->texture)
+		return;
+	oshu::point top_left = oshu::project(&display->view, p - sprite->origin * ratio);
+	oshu::size size = sprite->size * ratio * display->view.zoom;
+	float x0 = std::real(top_left), y0 = std::imag(top_left);
+	float x1 = x0 + std::real(size), y1 = y0 + std::imag(size);
+	queue(display, batch, oshu::sprite_quad {
+		{x0, x1, x1, x0}, {y0, y0, y1, y1},
+		{255, 255, 255, 255},
+		sprite,
+	}, false);
+}
+
+static uint8_t color_byte(float value)
+{
+	return std::max(0.f, std::min(value, 1.f)) * 255 + .5f;
+}
+
+void oshu::draw_sprite(oshu::display *display, oshu::sprite_batch *batch, const oshu::sprite *sprite, const oshu::sprite_transform &transform)
+{
+	if (!sprite->texture)
+		return;
+	oshu::sprite_quad quad;
+	quad.sprite = sprite;
+	quad.color[0] = color_byte(transform.red);
+	quad.color[1] = color_byte(transform.green);
+	quad.color[2] = color_byte(transform.blue);
+	quad.color[3] = color_byte(transform.alpha);
+	double w = std::real(sprite->size), h = std::imag(sprite->size);
+	oshu::point corners[4] = {{0, 0}, {w, 0}, {w, h}, {0, h}};
+	if (transform.flip_h) {
+		std::swap(corners[0], corners[1]);
+		std::swap(corners[2], corners[3]);
+	}
+	if (transform.flip_v) {
+		std::swap(corners[0], corners[3]);
+		std::swap(corners[1], corners[2]);
+	}
+	oshu::vector rotation = std::polar(1., transform.rotation);
+	double sx = std::real(transform.scale), sy = std::imag(transform.scale);
+	for (int i = 0; i < 4; ++i) {
+		oshu::vector d = corners[i] - transform.origin;
+		d = oshu::vector(std::real(d) * sx, std::imag(d) * sy) * rotation;
+		oshu::point p = oshu::project(&display->view, transform.position + d);
+		quad.x[i] = std::real(p);
+		quad.y[i] = std::imag(p);
+	}
+	queue(display, batch, quad, transform.additive);
+}
+
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+
+/**
+ * Scratch buffers for #oshu::flush_batch, kept to avoid allocating at every
+ * frame.
+ */
+static std::vector<SDL_Vertex> vertices;
+static std::vector<int> indices;
+
+void oshu::flush_batch(oshu::display *display, oshu::sprite_batch *batch)
+{
+	if (batch->quads.empty())
+		return;
+	int tw, th;
+	SDL_QueryTexture(batch->texture, NULL, NULL, &tw, &th);
+	vertices.clear();
+	indices.clear();
+	for (oshu::sprite_quad &q : batch->quads) {
+		float u0 = (float) q.sprite->x / tw, v0 = (float) q.sprite->y / th;
+		float u1 = (float) (q.sprite->x + q.sprite->w) / tw, v1 = (float) (q.sprite->y + q.sprite->h) / th;
+		SDL_Color color = {q.color[0], q.color[1], q.color[2], q.color[3]};
+		int base = vertices.size();
+		vertices.push_back({{q.x[0], q.y[0]}, color, {u0, v0}});
+		vertices.push_back({{q.x[1], q.y[1]}, color, {u1, v0}});
+		vertices.push_back({{q.x[2], q.y[2]}, color, {u1, v1}});
+		vertices.push_back({{q.x[3], q.y[3]}, color, {u0, v1}});
+		for (int i : {0, 1, 2, 0, 2, 3})
+			indices.push_back(base + i);
+	}
+	if (batch->additive)
+		SDL_SetTextureBlendMode(batch->texture, SDL_BLENDMODE_ADD);
+	if (SDL_RenderGeometry(display->renderer, batch->texture, vertices.data(), vertices.size(), indices.data(), indices.size()) < 0)
+		oshu_log_debug("could not draw a sprite batch: %s", SDL_GetError());
+	if (batch->additive)
+		SDL_SetTextureBlendMode(batch->texture, SDL_BLENDMODE_BLEND);
+	batch->quads.clear();
+}
+
+#else
+
+/**
+ * Find back the rectangle, the rotation and the mirroring of a quad, for
+ * `SDL_RenderCopyEx`.
+ */
+static void unpack_quad(const oshu::sprite_quad &q, SDL_Rect *dest, double *angle, SDL_RendererFlip *flip)
+{
+	oshu::point c[4];
+	for (int i = 0; i < 4; ++i)
+		c[i] = oshu::point(q.x[i], q.y[i]);
+	oshu::vector u = c[1] - c[0], v = c[3] - c[0];
+	*flip = SDL_FLIP_NONE;
+	if (std::real(u) * std::imag(v) - std::imag(u) * std::real(v) < 0) {
+		/* Mirrored: the unmirrored rectangle starts at the second corner. */
+		u = c[0] - c[1];
+		v = c[2] - c[1];
+		*flip = SDL_FLIP_HORIZONTAL;
+	}
+	double w = std::abs(u), h = std::abs(v);
+	oshu::point center = (c[0] + c[2]) / 2.;
+	*dest = {(int) (std::real(center) - w / 2), (int) (std::imag(center) - h / 2), (int) w, (int) h};
+	*angle = std::arg(u) * 180 / M_PI;
+}
+
+void oshu::flush_batch(oshu::display *display, oshu::sprite_batch *batch)
+{
+	if (batch->quads.empty())
+		return;
+	if (batch->additive)
+		SDL_SetTextureBlendMode(batch->texture, SDL_BLENDMODE_ADD);
+	for (oshu::sprite_quad &q : batch->quads) {
+		SDL_Rect source = {q.sprite->x, q.sprite->y, q.sprite->w, q.sprite->h};
+		SDL_Rect dest;
+		double angle;
+		SDL_RendererFlip flip;
+		unpack_quad(q, &dest, &angle, &flip);
+		SDL_SetTextureColorMod(batch->texture, q.color[0], q.color[1], q.color[2]);
+		SDL_SetTextureAlphaMod(batch->texture, q.color[3]);
+		SDL_RenderCopyEx(display->renderer, batch->texture, &source, &dest, angle, NULL, flip);
+	}
+	SDL_SetTextureColorMod(batch->texture, 255, 255, 255);
+	SDL_SetTextureAlphaMod(batch->texture, 255);
+	if (batch->additive)
+		SDL_SetTextureBlendMode(batch->texture, SDL_BLENDMODE_BLEND);
+	batch->quads.clear();
+}
+
+#endif
@@ -6,6 +6,9 @@
 #include "video/display.h"
 
 #include "core/log.h"
+#include "video/mesh.h"
+#include "video/paint.h"
+#include "video/texture.h"
 
 #include <SDL2/SDL.h>
 
@@ -74,6 +77,86 @@ static int get_features()
 	}
 }
 
+/**
+ * Return #oshu::GPU_SLIDERS if the OSHU_SLIDERS environment variable asks for
+ * it.
+ */
+static int get_slider_features()
+{
+	char *value = getenv("OSHU_SLIDERS");
+	if (!value || !*value || !strcmp(value, "cairo")) {
+		return 0;
+	} else if (!strcmp(value, "gpu")) {
+		return oshu::GPU_SLIDERS;
+	} else {
+		oshu_log_warning("invalid OSHU_SLIDERS value: %s", value);
+		oshu_log_warning("supported slider renderers are: cairo, gpu");
+		return 0;
+	}
+}
+
+/**
+ * Return the refresh rate of the monitor showing the window, or 60 Hz when it
+ * is unknown.
+ */
+static int get_refresh_rate(oshu::display *display)
+{
+	SDL_DisplayMode mode;
+	int index = SDL_GetWindowDisplayIndex(display->window);
+	if (index < 0 || SDL_GetCurrentDisplayMode(index, &mode) < 0 || mode.refresh_rate <= 0)
+		return 60;
+	return mode.refresh_rate;
+}
+
+/**
+ * Set the frame pacing from the OSHU_FRAME_RATE environment variable.
+ *
+ * It may be `vsync`, `uncapped`, or a number of frames per second. By
+ * default, the game runs at the monitor's refresh rate with
+ * #oshu::SIXTY_FPS, or at 30 FPS without.
+ */
+static void set_frame_rate(oshu::display *display)
+{
+	int refresh_rate = get_refresh_rate(display);
+	char *value = getenv("OSHU_FRAME_RATE");
+	char *end;
+	long fps;
+	if (!value || !*value) {
+		fps = (display->features & oshu::SIXTY_FPS) ? refresh_rate : 30;
+	} else if (!strcmp(value, "vsync")) {
+		display->vsync = true;
+		fps = refresh_rate;
+	} else if (!strcmp(value, "uncapped")) {
+		fps = 0;
+	} else if ((fps = strtol(value, &end, 10)) <= 0 || *end) {
+		oshu_log_warning("invalid OSHU_FRAME_RATE value: %s", value);
+		oshu_log_warning("it must be vsync, uncapped, or a number of frames per second");
+		fps = (display->features & oshu::SIXTY_FPS) ? refresh_rate : 30;
+	}
+	display->frame_duration = fps ? 1. / fps : 0;
+	oshu_log_debug("monitor at %d Hz, rendering at %ld FPS%s", refresh_rate, fps, display->vsync ? " with vsync" : "");
+}
+
+/**
+ * Create the renderer of the display's window, with extra SDL renderer
+ * *flags*, and check what it supports.
+ */
+static int create_renderer(oshu::display *display, Uint32 flags)
+{
+	display->renderer = SDL_CreateRenderer(
+		display->window, -1,
+		((display->features & oshu::HARDWARE_ACCELERATION) ? 0 : SDL_RENDERER_SOFTWARE) | flags
+	);
+	if (display->renderer == NULL)
+		return -1;
+	if ((display->features & oshu::GPU_SLIDERS) && !oshu::mesh_supported(display)) {
+		oshu_log_warning("the renderer can't draw sliders on the GPU, painting them with cairo");
+		display->features &= ~oshu::GPU_SLIDERS;
+	}
+	display->premultiplied = oshu::premultiplied_supported(display);
+	return 0;
+}
+
 /**
  * Open the window and create the rendered.
  *
@@ -82,11 +165,10 @@ static int get_features()
  */
 static int create_window(oshu::display *display)
 {
-	display->features = get_features();
+	display->features = get_features() | get_slider_features();
 	oshu::size window_size = get_default_window_size();
 	if (display->features & oshu::LINEAR_SCALING)
 		SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "linear");
-	display->frame_duration = 1. / ((display->features|oshu::SIXTY_FPS) ? 60. : 30.);
 	display->window = SDL_CreateWindow(
 		"oshu!",
 		SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
@@ -95,11 +177,8 @@ static int create_window(oshu::display *display)
 	);
 	if (display->window == NULL)
 		goto fail;
-	display->renderer = SDL_CreateRenderer(
-		display->window, -1,
-		(display->features & oshu::HARDWARE_ACCELERATION) ? 0 : SDL_RENDERER_SOFTWARE
-	);
-	if (display->renderer == NULL)
+	set_frame_rate(display);
+	if (create_renderer(display, display->vsync ? SDL_RENDERER_PRESENTVSYNC : 0) < 0)
 		goto fail;
 	return 0;
 fail:
@@ -107,8 +186,47 @@ fail:
 	return -1;
 }
 
+/**
+ * Open a hidden window of *size*, and make the renderer draw into a texture of
+ * the same size rather than on the screen.
+ *
+ * There's no mouse to follow, so the fancy cursor is disabled.
+ */
+static int create_offscreen(oshu::display *display, oshu::size size)
+{
+	display->features = (get_features() | get_slider_features()) & ~oshu::FANCY_CURSOR;
+	if (display->features & oshu::LINEAR_SCALING)
+		SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "linear");
+	display->window = SDL_CreateWindow(
+		"oshu!",
+		SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+		std::real(size), std::imag(size),
+		SDL_WINDOW_HIDDEN
+	);
+	if (display->window == NULL)
+		goto fail;
+	display->frame_duration = 0;
+	if (create_renderer(display, SDL_RENDERER_TARGETTEXTURE) < 0)
+		goto fail;
+	display->target = SDL_CreateTexture(
+		display->renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_TARGET,
+		std::real(size), std::imag(size)
+	);
+	oshu::track_texture(display->target);
+	if (display->target == NULL || SDL_SetRenderTarget(display->renderer, display->target) < 0)
+		goto fail;
+	return 0;
+fail:
+	oshu_log_error("error creating the offscreen display: %s", SDL_GetError());
+	return -1;
+}
+
 static void close_display(oshu::display *display)
 {
+	if (display->target) {
+		oshu::release_texture(display->target);
+		display->target = NULL;
+	}
 	if (display->renderer) {
 		SDL_DestroyRenderer(display->renderer);
 		display->renderer = NULL;
@@ -132,6 +250,15 @@ oshu::display::display()
 	oshu::reset_view(this);
 }
 
+oshu::display::display(oshu::size size)
+{
+	if (create_offscreen(this, size) < 0) {
+		close_display(this);
+		throw std::runtime_error("could not open the offscreen display");
+	}
+	oshu::reset_view(this);
+}
+
 oshu::display::~display()
 {
 	close_display(this);
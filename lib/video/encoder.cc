@@ -0,0 +1,371 @@
+/**
+ * \file video/encoder.cc
+ * \ingroup video_encoder
+ */
+
+#include "video/encoder.h"
+
+#include "core/log.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/channel_layout.h>
+#include <libswresample/swresample.h>
+#include <libswscale/swscale.h>
+}
+
+#include <assert.h>
+#include <system_error>
+
+/** Work in stereo. */
+static const int channels = 2;
+
+/**
+ * Spew an error message according to the return value of a call to one of
+ * ffmpeg's functions.
+ */
+static void log_av_error(int rc)
+{
+	char errbuf[256];
+	av_strerror(rc, errbuf, sizeof(errbuf));
+	oshu_log_error("ffmpeg error: %s", errbuf);
+}
+
+/**
+ * Move the packets the codec has ready into the file.
+ */
+static int write_packets(oshu::encoder *encoder, AVCodecContext *codec, AVStream *stream)
+{
+	AVPacket packet;
+	av_init_packet(&packet);
+	packet.data = NULL;
+	packet.size = 0;
+	for (;;) {
+		int rc = avcodec_receive_packet(codec, &packet);
+		if (rc == AVERROR(EAGAIN) || rc == AVERROR_EOF)
+			return 0;
+		if (rc < 0) {
+			oshu_log_error("encoding error");
+			log_av_error(rc);
+			return -1;
+		}
+		av_packet_rescale_ts(&packet, codec->time_base, stream->time_base);
+		packet.stream_index = stream->index;
+		rc = av_interleaved_write_frame(encoder->muxer, &packet);
+		if (rc < 0) {
+			oshu_log_error("error writing the video file");
+			log_av_error(rc);
+			return -1;
+		}
+	}
+}
+
+/**
+ * Send a frame to a codec, or flush it when *frame* is null, and write what
+ * comes out.
+ */
+static int send_frame(oshu::encoder *encoder, AVCodecContext *codec, AVStream *stream, AVFrame *frame)
+{
+	int rc = avcodec_send_frame(codec, frame);
+	if (rc < 0) {
+		oshu_log_error("encoding error");
+		log_av_error(rc);
+		return -1;
+	}
+	return write_packets(encoder, codec, stream);
+}
+
+/**
+ * Encode the sound frames the resampler has enough samples for, or all of
+ * them when *flush* is set.
+ */
+static int encode_sound(oshu::encoder *encoder, bool flush)
+{
+	AVFrame *sound = encoder->sound;
+	int frame_size = encoder->audio->frame_size;
+	for (;;) {
+		int available = swr_get_out_samples(encoder->resampler, 0);
+		if (available <= 0 || (available < frame_size && !flush))
+			return 0;
+		int rc = av_frame_make_writable(sound);
+		if (rc < 0) {
+			log_av_error(rc);
+			return -1;
+		}
+		rc = swr_convert(encoder->resampler, sound->data, frame_size, NULL, 0);
+		if (rc <= 0)
+			return rc;
+		sound->nb_samples = rc;
+		sound->pts = encoder->sound_pts;
+		encoder->sound_pts += rc;
+		if (send_frame(encoder, encoder->audio, encoder->audio_stream, sound) < 0)
+			return -1;
+	}
+}
+
+static int encode_picture(oshu::encoder *encoder, oshu::encoder_job *job)
+{
+	AVFrame *picture = encoder->picture;
+	int rc = av_frame_make_writable(picture);
+	if (rc < 0) {
+		log_av_error(rc);
+		return -1;
+	}
+	const uint8_t *pixels = job->pixels.data();
+	int pitch = encoder->width * 4;
+	sws_scale(encoder->scaler, &pixels, &pitch, 0, encoder->height, picture->data, picture->linesize);
+	picture->pts = encoder->picture_pts++;
+	return send_frame(encoder, encoder->video, encoder->video_stream, picture);
+}
+
+static int encode_job(oshu::encoder *encoder, oshu::encoder_job *job)
+{
+	if (encoder->video && encode_picture(encoder, job) < 0)
+		return -1;
+
+	const uint8_t *samples = (const uint8_t*) job->samples.data();
+	int nb_samples = job->samples.size() / channels;
+	if (swr_convert(encoder->resampler, NULL, 0, &samples, nb_samples) < 0) {
+		oshu_log_error("audio sample conversion error");
+		return -1;
+	}
+	return encode_sound(encoder, false);
+}
+
+/**
+ * Body of the encoder thread.
+ *
+ * Encode the queued jobs in order until the encoder is closed. After an
+ * error, keep emptying the queue so that the producer never waits forever.
+ */
+static void run_encoder(oshu::encoder *encoder)
+{
+	std::unique_lock<std::mutex> lock(encoder->mutex);
+	for (;;) {
+		encoder->signal.wait(lock, [encoder]() { return !encoder->jobs.empty() || encoder->closing; });
+		if (encoder->jobs.empty())
+			break;
+		oshu::encoder_job job = std::move(encoder->jobs.front());
+		encoder->jobs.pop_front();
+		bool failed = encoder->failed;
+		lock.unlock();
+		int rc = failed ? 0 : encode_job(encoder, &job);
+		lock.lock();
+		if (rc < 0)
+			encoder->failed = true;
+		encoder->spare.push_back(std::move(job.pixels));
+		encoder->signal.notify_all();
+	}
+}
+
+static int open_video(oshu::encoder *encoder, int fps)
+{
+	enum AVCodecID id = encoder->muxer->oformat->video_codec;
+	const AVCodec *codec = avcodec_find_encoder(id);
+	if (!codec) {
+		oshu_log_error("no encoder for the video stream");
+		return -1;
+	}
+	encoder->video_stream = avformat_new_stream(encoder->muxer, NULL);
+	encoder->video = avcodec_alloc_context3(codec);
+	if (!encoder->video_stream || !encoder->video)
+		return -1;
+	AVCodecContext *video = encoder->video;
+	video->width = encoder->width;
+	video->height = encoder->height;
+	video->time_base = AVRational {1, fps};
+	video->framerate = AVRational {fps, 1};
+	video->pix_fmt = codec->pix_fmts ? codec->pix_fmts[0] : AV_PIX_FMT_YUV420P;
+	if (codec->pix_fmts) {
+		for (const enum AVPixelFormat *f = codec->pix_fmts; *f != AV_PIX_FMT_NONE; ++f) {
+			if (*f == AV_PIX_FMT_YUV420P)
+				video->pix_fmt = *f;
+		}
+	}
+	/* Let the codec use every core. */
+	video->thread_count = 0;
+	if (encoder->muxer->oformat->flags & AVFMT_GLOBALHEADER)
+		video->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+	int rc = avcodec_open2(video, codec, NULL);
+	if (rc < 0) {
+		oshu_log_error("error opening the video encoder");
+		log_av_error(rc);
+		return -1;
+	}
+	encoder->video_stream->time_base = video->time_base;
+	if (avcodec_parameters_from_context(encoder->video_stream->codecpar, video) < 0)
+		return -1;
+
+	encoder->picture = av_frame_alloc();
+	if (!encoder->picture)
+		return -1;
+	encoder->picture->format = video->pix_fmt;
+	encoder->picture->width = video->width;
+	encoder->picture->height = video->height;
+	if (av_frame_get_buffer(encoder->picture, 0) < 0)
+		return -1;
+	encoder->scaler = sws_getContext(
+		encoder->width, encoder->height, AV_PIX_FMT_RGBA,
+		encoder->width, encoder->height, video->pix_fmt,
+		SWS_BILINEAR, NULL, NULL, NULL
+	);
+	if (!encoder->scaler) {
+		oshu_log_error("error allocating the pixel converter");
+		return -1;
+	}
+	return 0;
+}
+
+static int open_sound(oshu::encoder *encoder, int sample_rate)
+{
+	enum AVCodecID id = encoder->muxer->oformat->audio_codec;
+	const AVCodec *codec = avcodec_find_encoder(id);
+	if (!codec) {
+		oshu_log_error("no encoder for the audio stream");
+		return -1;
+	}
+	encoder->audio_stream = avformat_new_stream(encoder->muxer, NULL);
+	encoder->audio = avcodec_alloc_context3(codec);
+	if (!encoder->audio_stream || !encoder->audio)
+		return -1;
+	AVCodecContext *audio = encoder->audio;
+	audio->sample_fmt = codec->sample_fmts ? codec->sample_fmts[0] : AV_SAMPLE_FMT_FLTP;
+	audio->sample_rate = sample_rate;
+	audio->channel_layout = AV_CH_LAYOUT_STEREO;
+	audio->channels = channels;
+	audio->time_base = AVRational {1, sample_rate};
+	if (encoder->muxer->oformat->flags & AVFMT_GLOBALHEADER)
+		audio->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+	int rc = avcodec_open2(audio, codec, NULL);
+	if (rc < 0) {
+		oshu_log_error("error opening the audio encoder");
+		log_av_error(rc);
+		return -1;
+	}
+	/* Codecs with a variable frame size get chunks of a reasonable size. */
+	if (audio->frame_size <= 0)
+		audio->frame_size = 1024;
+	encoder->audio_stream->time_base = audio->time_base;
+	if (avcodec_parameters_from_context(encoder->audio_stream->codecpar, audio) < 0)
+		return -1;
+
+	encoder->sound = av_frame_alloc();
+	if (!encoder->sound)
+		return -1;
+	encoder->sound->format = audio->sample_fmt;
+	encoder->sound->channel_layout = audio->channel_layout;
+	encoder->sound->sample_rate = sample_rate;
+	encoder->sound->nb_samples = audio->frame_size;
+	if (av_frame_get_buffer(encoder->sound, 0) < 0)
+		return -1;
+	encoder->resampler = swr_alloc_set_opts(
+		NULL,
+		AV_CH_LAYOUT_STEREO, audio->sample_fmt, sample_rate,
+		AV_CH_LAYOUT_STEREO, AV_SAMPLE_FMT_FLT, sample_rate,
+		0, NULL
+	);
+	if (!encoder->resampler || swr_init(encoder->resampler) < 0) {
+		oshu_log_error("error initializing the audio converter");
+		return -1;
+	}
+	return 0;
+}
+
+int oshu::open_encoder(const char *path, oshu::size size, int fps, int sample_rate, oshu::encoder *encoder)
+{
+	encoder->width = std::real(size);
+	encoder->height = std::imag(size);
+	int rc = avformat_alloc_output_context2(&encoder->muxer, NULL, NULL, path);
+	if (rc < 0) {
+		oshu_log_error("unknown format for %s", path);
+		log_av_error(rc);
+		return -1;
+	}
+	if (encoder->width > 0 && open_video(encoder, fps) < 0)
+		return -1;
+	if (open_sound(encoder, sample_rate) < 0)
+		return -1;
+	rc = avio_open(&encoder->muxer->pb, path, AVIO_FLAG_WRITE);
+	if (rc < 0) {
+		oshu_log_error("could not create %s", path);
+		log_av_error(rc);
+		return -1;
+	}
+	rc = avformat_write_header(encoder->muxer, NULL);
+	if (rc < 0) {
+		oshu_log_error("error writing the video header");
+		log_av_error(rc);
+		return -1;
+	}
+	encoder->closing = false;
+	encoder->failed = false;
+	try {
+		encoder->thread = std::thread(run_encoder, encoder);
+	} catch (std::system_error &e) {
+		oshu_log_error("could not start the encoder thread: %s", e.what());
+		return -1;
+	}
+	return 0;
+}
+
+std::vector<uint8_t> oshu::take_frame_buffer(oshu::encoder *encoder)
+{
+	std::vector<uint8_t> pixels;
+	{
+		std::lock_guard<std::mutex> lock(encoder->mutex);
+		if (!encoder->spare.empty()) {
+			pixels = std::move(encoder->spare.back());
+			encoder->spare.pop_back();
+		}
+	}
+	pixels.resize(encoder->width * encoder->height * 4);
+	return pixels;
+}
+
+int oshu::encode_frame(oshu::encoder *encoder, std::vector<uint8_t> &&pixels, std::vector<float> &&samples)
+{
+	assert (pixels.size() == (size_t) encoder->width * encoder->height * 4);
+	std::unique_lock<std::mutex> lock(encoder->mutex);
+	encoder->signal.wait(lock, [encoder]() { return encoder->jobs.size() < oshu::max_queued_frames; });
+	if (encoder->failed)
+		return -1;
+	encoder->jobs.push_back(oshu::encoder_job {std::move(pixels), std::move(samples)});
+	encoder->signal.notify_all();
+	return 0;
+}
+
+int oshu::close_encoder(oshu::encoder *encoder)
+{
+	int rc = 0;
+	if (encoder->thread.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(encoder->mutex);
+			encoder->closing = true;
+		}
+		encoder->signal.notify_all();
+		encoder->thread.join();
+		if (encoder->failed
+		    || encode_sound(encoder, true) < 0
+		    || (encoder->video && send_frame(encoder, encoder->video, encoder->video_stream, NULL) < 0)
+		    || send_frame(encoder, encoder->audio, encoder->audio_stream, NULL) < 0
+		    || av_write_trailer(encoder->muxer) < 0)
+			rc = -1;
+	} else {
+		rc = -1;
+	}
+	if (encoder->muxer && encoder->muxer->pb)
+		avio_closep(&encoder->muxer->pb);
+	avformat_free_context(encoder->muxer);
+	encoder->muxer = NULL;
+	avcodec_free_context(&encoder->video);
+	avcodec_free_context(&encoder->audio);
+	av_frame_free(&encoder->picture);
+	av_frame_free(&encoder->sound);
+	sws_freeContext(encoder->scaler);
+	encoder->scaler = NULL;
+	swr_free(&encoder->resampler);
+	encoder->jobs.clear();
+	encoder->spare.clear();
+	return rc;
+}
@@ -0,0 +1,94 @@
+/**
+ * \file video/layer.cc
+ * \ingroup video_layer
+ */
+
+#include "video/layer.h"
+
+#include "core/log.h"
+#include "video/display.h"
+#include "video/texture.h"
+
+#include <SDL2/SDL.h>
+
+/**
+ * Create the target texture, unless it exists with the right size.
+ *
+ * On failure, switch the layer to direct drawing.
+ */
+static int create_target(oshu::display *display, oshu::layer *layer)
+{
+	int width, height;
+	if (SDL_GetRendererOutputSize(display->renderer, &width, &height) < 0)
+		return -1;
+	if (layer->target && layer->width == width && layer->height == height)
+		return 0;
+	oshu::destroy_layer(layer);
+	if (!SDL_RenderTargetSupported(display->renderer)) {
+		oshu_log_debug("render targets are not supported, drawing the layers directly");
+		layer->direct = true;
+		return -1;
+	}
+	layer->target = SDL_CreateTexture(display->renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET, width, height);
+	oshu::track_texture(layer->target);
+	if (!layer->target) {
+		oshu_log_debug("could not create a layer, drawing it directly: %s", SDL_GetError());
+		layer->direct = true;
+		return -1;
+	}
+	SDL_SetTextureBlendMode(layer->target, layer->opaque ? SDL_BLENDMODE_NONE : SDL_BLENDMODE_BLEND);
+	layer->width = width;
+	layer->height = height;
+	return 0;
+}
+
+bool oshu::begin_layer(oshu::display *display, oshu::layer *layer, uint64_t key)
+{
+	if (layer->direct || create_target(display, layer) < 0)
+		return true;
+	if (layer->valid && layer->key == key)
+		return false;
+	layer->previous = SDL_GetRenderTarget(display->renderer);
+	if (SDL_SetRenderTarget(display->renderer, layer->target) < 0) {
+		oshu_log_debug("could not draw on a layer, drawing it directly: %s", SDL_GetError());
+		oshu::destroy_layer(layer);
+		layer->direct = true;
+		return true;
+	}
+	Uint8 r, g, b, a;
+	SDL_GetRenderDrawColor(display->renderer, &r, &g, &b, &a);
+	SDL_SetRenderDrawColor(display->renderer, 0, 0, 0, layer->opaque ? 255 : 0);
+	SDL_RenderClear(display->renderer);
+	SDL_SetRenderDrawColor(display->renderer, r, g, b, a);
+	layer->key = key;
+	layer->valid = true;
+	return true;
+}
+
+void oshu::end_layer(oshu::display *display, oshu::layer *layer)
+{
+	if (layer->direct)
+		return;
+	SDL_SetRenderTarget(display->renderer, layer->previous);
+	layer->previous = nullptr;
+}
+
+void oshu::show_layer(oshu::display *display, oshu::layer *layer)
+{
+	if (layer->direct || !layer->valid)
+		return;
+	SDL_RenderCopy(display->renderer, layer->target, NULL, NULL);
+}
+
+void oshu::invalidate_layer(oshu::layer *layer)
+{
+	layer->valid = false;
+}
+
+void oshu::destroy_layer(oshu::layer *layer)
+{
+	oshu::release_texture(layer->target);
+	layer->target = nullptr;
+	layer->width = layer->height = 0;
+	layer->valid = false;
+}
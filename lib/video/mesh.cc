@@ -0,0 +1,170 @@
+/**
+ * \file video/mesh.cc
+ * \ingroup video_mesh
+ */
+
+#include "video/mesh.h"
+
+#include "core/log.h"
+#include "video/display.h"
+
+#include <SDL2/SDL.h>
+
+#include <algorithm>
+#include <math.h>
+
+/**
+ * Length of the segments approximating circles, in physical pixels.
+ */
+static const double chord_length = 4.;
+
+/**
+ * Joins sharper than this angle, in radians, are rounded with a full disc.
+ * Smoother ones are filled with a wedge, which is indistinguishable.
+ */
+static const double sharp_join = .25;
+
+static oshu::mesh_color color_at(const oshu::mesh_paint &paint, oshu::point p)
+{
+	double t = paint.radius > 0 ? std::abs(p - paint.center) / paint.radius : 1.;
+	if (t > 1.)
+		t = 1.;
+	return oshu::mesh_color {
+		(float) (paint.inner.red + (paint.outer.red - paint.inner.red) * t),
+		(float) (paint.inner.green + (paint.outer.green - paint.inner.green) * t),
+		(float) (paint.inner.blue + (paint.outer.blue - paint.inner.blue) * t),
+	};
+}
+
+static int add_vertex(oshu::mesh *mesh, oshu::point p, const oshu::mesh_paint &paint)
+{
+	mesh->vertices.push_back(oshu::mesh_vertex {
+		(float) std::real(p), (float) std::imag(p), color_at(paint, p),
+	});
+	return mesh->vertices.size() - 1;
+}
+
+static void add_triangle(oshu::mesh *mesh, int a, int b, int c)
+{
+	mesh->indices.push_back(a);
+	mesh->indices.push_back(b);
+	mesh->indices.push_back(c);
+}
+
+static int circle_segments(oshu::mesh *mesh, double radius)
+{
+	int n = 2. * M_PI * radius * mesh->zoom / chord_length;
+	return std::max(12, std::min(n, 128));
+}
+
+void oshu::fill_circle(oshu::mesh *mesh, oshu::point center, double radius, const oshu::mesh_paint &paint)
+{
+	int n = circle_segments(mesh, radius);
+	int c = add_vertex(mesh, center, paint);
+	int first = mesh->vertices.size();
+	for (int i = 0; i < n; ++i)
+		add_vertex(mesh, center + std::polar(radius, 2. * M_PI * i / n), paint);
+	for (int i = 0; i < n; ++i)
+		add_triangle(mesh, c, first + i, first + (i + 1) % n);
+}
+
+void oshu::stroke_circle(oshu::mesh *mesh, oshu::point center, double radius, double width, const oshu::mesh_paint &paint)
+{
+	int n = circle_segments(mesh, radius + width / 2.);
+	double inner = std::max(0., radius - width / 2.);
+	double outer = radius + width / 2.;
+	int first = mesh->vertices.size();
+	for (int i = 0; i < n; ++i) {
+		oshu::vector u = std::polar(1., 2. * M_PI * i / n);
+		add_vertex(mesh, center + u * inner, paint);
+		add_vertex(mesh, center + u * outer, paint);
+	}
+	for (int i = 0; i < n; ++i) {
+		int a = first + 2 * i, b = first + 2 * ((i + 1) % n);
+		add_triangle(mesh, a, a + 1, b + 1);
+		add_triangle(mesh, a, b + 1, b);
+	}
+}
+
+void oshu::stroke_polyline(oshu::mesh *mesh, const std::vector<oshu::point> &points, double width, const oshu::mesh_paint &paint)
+{
+	double half = width / 2.;
+	if (points.empty())
+		return;
+	oshu::fill_circle(mesh, points.front(), half, paint);
+	oshu::vector previous = 0;
+	for (size_t i = 1; i < points.size(); ++i) {
+		oshu::point a = points[i - 1], b = points[i];
+		double length = std::abs(b - a);
+		if (length == 0)
+			continue;
+		oshu::vector normal = (b - a) / length * oshu::vector(0, 1) * half;
+		if (previous != 0.) {
+			double turn = std::abs(std::arg(normal / previous));
+			if (turn > sharp_join) {
+				oshu::fill_circle(mesh, a, half, paint);
+			} else {
+				int c = add_vertex(mesh, a, paint);
+				add_triangle(mesh, c, add_vertex(mesh, a + previous, paint), add_vertex(mesh, a + normal, paint));
+				add_triangle(mesh, c, add_vertex(mesh, a - previous, paint), add_vertex(mesh, a - normal, paint));
+			}
+		}
+		int v0 = add_vertex(mesh, a + normal, paint);
+		int v1 = add_vertex(mesh, a - normal, paint);
+		int v2 = add_vertex(mesh, b - normal, paint);
+		int v3 = add_vertex(mesh, b + normal, paint);
+		add_triangle(mesh, v0, v1, v2);
+		add_triangle(mesh, v0, v2, v3);
+		previous = normal;
+	}
+	oshu::fill_circle(mesh, points.back(), half, paint);
+}
+
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+
+bool oshu::mesh_supported(oshu::display *display)
+{
+	return SDL_RenderTargetSupported(display->renderer);
+}
+
+/**
+ * Scratch buffer for #oshu::draw_mesh, kept to avoid allocating at every call.
+ */
+static std::vector<SDL_Vertex> vertices;
+
+int oshu::draw_mesh(oshu::display *display, oshu::mesh *mesh, oshu::point origin)
+{
+	vertices.clear();
+	vertices.reserve(mesh->vertices.size());
+	float ox = std::real(origin), oy = std::imag(origin), zoom = mesh->zoom;
+	for (oshu::mesh_vertex &v : mesh->vertices) {
+		SDL_Color color = {
+			(Uint8) (v.color.red * 255), (Uint8) (v.color.green * 255), (Uint8) (v.color.blue * 255), 255,
+		};
+		vertices.push_back({{(v.x - ox) * zoom, (v.y - oy) * zoom}, color, {0, 0}});
+	}
+	SDL_BlendMode blend;
+	SDL_GetRenderDrawBlendMode(display->renderer, &blend);
+	SDL_SetRenderDrawBlendMode(display->renderer, SDL_BLENDMODE_NONE);
+	int rc = SDL_RenderGeometry(display->renderer, NULL, vertices.data(), vertices.size(),
+	                            mesh->indices.data(), mesh->indices.size());
+	SDL_SetRenderDrawBlendMode(display->renderer, blend);
+	if (rc < 0)
+		oshu_log_error("could not draw a mesh: %s", SDL_GetError());
+	return rc;
+}
+
+#else
+
+bool oshu::mesh_supported(oshu::display *display)
+{
+	return false;
+}
+
+int oshu::draw_mesh(oshu::display *display, oshu::mesh *mesh, oshu::point origin)
+{
+	oshu_log_error("drawing meshes requires SDL 2.0.18");
+	return -1;
+}
+
+#endif
@@ -0,0 +1,549 @@
+/**
+ * \file video/movie.cc
+ * \ingroup video_movie
+ */
+
+#include "video/movie.h"
+
+#include "core/log.h"
+#include "core/memory.h"
+#include "core/vfs.h"
+#include "video/display.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/hwcontext.h>
+#include <libswscale/swscale.h>
+}
+
+#include <SDL2/SDL.h>
+
+#include <algorithm>
+#include <cmath>
+#include <string.h>
+#include <system_error>
+
+/**
+ * Size of the buffer for the archived videos.
+ */
+static const int io_buffer_size = 32768;
+
+/**
+ * When the clock moves by more than that between two updates, in seconds, the
+ * movie seeks instead of decoding its way to the new time.
+ */
+static const double max_skip = 1.;
+
+/**
+ * Spew an error message according to the return value of a call to one of
+ * ffmpeg's functions.
+ */
+static void log_av_error(int rc)
+{
+	char errbuf[256];
+	av_strerror(rc, errbuf, sizeof(errbuf));
+	oshu_log_error("ffmpeg error: %s", errbuf);
+}
+
+/* Demuxer ********************************************************************/
+
+/**
+ * An archived file, read in place like #oshu::stream_source.
+ */
+struct oshu::movie_source {
+	oshu::file_view file;
+	size_t position;
+};
+
+static int read_source(void *opaque, uint8_t *buf, int size)
+{
+	oshu::movie_source *source = (oshu::movie_source*) opaque;
+	size_t left = source->file.size - source->position;
+	if (left == 0)
+		return AVERROR_EOF;
+	size_t count = std::min<size_t>(size, left);
+	memcpy(buf, source->file.data + source->position, count);
+	source->position += count;
+	return count;
+}
+
+static int64_t seek_source(void *opaque, int64_t offset, int whence)
+{
+	oshu::movie_source *source = (oshu::movie_source*) opaque;
+	int64_t base;
+	switch (whence & ~AVSEEK_FORCE) {
+	case AVSEEK_SIZE: return source->file.size;
+	case SEEK_SET:    base = 0; break;
+	case SEEK_CUR:    base = source->position; break;
+	case SEEK_END:    base = source->file.size; break;
+	default:          return -1;
+	}
+	if (base + offset < 0 || base + offset > (int64_t) source->file.size)
+		return -1;
+	source->position = base + offset;
+	return source->position;
+}
+
+/**
+ * Prepare a demuxer reading from an archived file, with #oshu::movie::io.
+ */
+static int open_source(const char *path, oshu::movie *movie)
+{
+	movie->source = new oshu::movie_source {};
+	if (oshu::open_file(path, &movie->source->file) < 0)
+		return -1;
+	unsigned char *buffer = (unsigned char*) av_malloc(io_buffer_size);
+	if (!buffer)
+		return -1;
+	movie->io = avio_alloc_context(buffer, io_buffer_size, 0, movie->source, read_source, NULL, seek_source);
+	if (!movie->io) {
+		av_free(buffer);
+		oshu_log_error("could not allocate the I/O context");
+		return -1;
+	}
+	movie->demuxer = avformat_alloc_context();
+	if (!movie->demuxer)
+		return -1;
+	movie->demuxer->pb = movie->io;
+	return 0;
+}
+
+static int open_demuxer(const char *path, oshu::movie *movie)
+{
+	if (oshu::in_archive(path) && open_source(path, movie) < 0)
+		return -1;
+	int rc = avformat_open_input(&movie->demuxer, path, NULL, NULL);
+	if (rc < 0) {
+		oshu_log_error("failed opening the video file %s", path);
+		log_av_error(rc);
+		return -1;
+	}
+	rc = avformat_find_stream_info(movie->demuxer, NULL);
+	if (rc < 0) {
+		oshu_log_error("error reading the video stream information");
+		log_av_error(rc);
+		return -1;
+	}
+	return 0;
+}
+
+/* Decoder ********************************************************************/
+
+/**
+ * Pick the hardware format when the decoder offers it, which it doesn't when
+ * the device can't decode this particular video.
+ */
+static enum AVPixelFormat get_format(AVCodecContext *decoder, const enum AVPixelFormat *formats)
+{
+	oshu::movie *movie = (oshu::movie*) decoder->opaque;
+	for (const enum AVPixelFormat *f = formats; *f != AV_PIX_FMT_NONE; ++f) {
+		if (*f == movie->hw_format)
+			return *f;
+	}
+	oshu_log_debug("the video can't be decoded by the hardware");
+	return avcodec_default_get_format(decoder, formats);
+}
+
+/**
+ * Attach the first hardware device that works with the codec to the decoder.
+ *
+ * Without one, the video is decoded in software, which is fine too.
+ */
+static void open_hw_device(oshu::movie *movie, const AVCodec *codec)
+{
+#if LIBAVCODEC_VERSION_MAJOR >= 58
+	for (int i = 0;; ++i) {
+		const AVCodecHWConfig *config = avcodec_get_hw_config(codec, i);
+		if (!config)
+			break;
+		if (!(config->methods & AV_CODEC_HW_CONFIG_METHOD_HW_DEVICE_CTX))
+			continue;
+		if (av_hwdevice_ctx_create(&movie->hw_device, config->device_type, NULL, NULL, 0) < 0)
+			continue;
+		movie->hw_format = config->pix_fmt;
+		movie->decoder->hw_device_ctx = av_buffer_ref(movie->hw_device);
+		movie->decoder->get_format = get_format;
+		oshu_log_debug("decoding the video with %s", av_hwdevice_get_type_name(config->device_type));
+		return;
+	}
+#endif
+	oshu_log_debug("decoding the video in software");
+}
+
+static int open_decoder(oshu::movie *movie)
+{
+	int index = av_find_best_stream(movie->demuxer, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+	if (index < 0) {
+		oshu_log_error("found no video stream");
+		return -1;
+	}
+	AVStream *stream = movie->demuxer->streams[index];
+	movie->stream_index = index;
+	movie->time_base = av_q2d(stream->time_base);
+	movie->start_time = stream->start_time == AV_NOPTS_VALUE ? 0 : stream->start_time;
+	AVRational rate = av_guess_frame_rate(movie->demuxer, stream, NULL);
+	movie->frame_duration = rate.num > 0 ? av_q2d(av_inv_q(rate)) : 1. / 30;
+	const AVCodec *codec = avcodec_find_decoder(stream->codecpar->codec_id);
+	if (!codec) {
+		oshu_log_error("unsupported video codec");
+		return -1;
+	}
+	movie->decoder = avcodec_alloc_context3(codec);
+	if (!movie->decoder)
+		return -1;
+	int rc = avcodec_parameters_to_context(movie->decoder, stream->codecpar);
+	if (rc < 0) {
+		log_av_error(rc);
+		return -1;
+	}
+	movie->decoder->opaque = movie;
+	movie->decoder->thread_count = 0;
+	movie->hw_format = AV_PIX_FMT_NONE;
+	open_hw_device(movie, codec);
+	rc = avcodec_open2(movie->decoder, codec, NULL);
+	if (rc < 0) {
+		oshu_log_error("error opening the video decoder");
+		log_av_error(rc);
+		return -1;
+	}
+	oshu_log_debug("video: %s, %dx%d", codec->long_name, movie->decoder->width, movie->decoder->height);
+	return 0;
+}
+
+/* Worker *********************************************************************/
+
+/**
+ * Read packets until the decoder yields a frame.
+ *
+ * \return 0 on success, 1 at the end of the video, -1 on error.
+ */
+static int decode_frame(oshu::movie *movie, AVFrame *frame)
+{
+	for (;;) {
+		int rc = avcodec_receive_frame(movie->decoder, frame);
+		if (rc == 0)
+			return 0;
+		else if (rc == AVERROR_EOF)
+			return 1;
+		if (rc == AVERROR(EAGAIN)) {
+			AVPacket packet;
+			rc = av_read_frame(movie->demuxer, &packet);
+			if (rc == AVERROR_EOF) {
+				avcodec_send_packet(movie->decoder, NULL);
+				continue;
+			} else if (rc >= 0) {
+				if (packet.stream_index == movie->stream_index)
+					rc = avcodec_send_packet(movie->decoder, &packet);
+				av_packet_unref(&packet);
+				/* a broken packet only spoils a few frames */
+				if (rc >= 0 || rc == AVERROR_INVALIDDATA)
+					continue;
+			}
+		}
+		oshu_log_error("error decoding the video");
+		log_av_error(rc);
+		return -1;
+	}
+}
+
+/**
+ * Whether the frames in this format can be uploaded as they are.
+ *
+ * The full-range YUVJ frames are shown with the range of the other ones, which
+ * is a bit off, but not worth a conversion.
+ */
+static bool texture_format(int format)
+{
+	switch (format) {
+	case AV_PIX_FMT_YUV420P:
+	case AV_PIX_FMT_YUVJ420P:
+#if SDL_VERSION_ATLEAST(2, 0, 16)
+	case AV_PIX_FMT_NV12:
+#endif
+		return true;
+	default:
+		return false;
+	}
+}
+
+/**
+ * Replace *frame* by another, keeping its properties.
+ */
+static void swap_frame(AVFrame **frame, AVFrame *other)
+{
+	av_frame_copy_props(other, *frame);
+	av_frame_free(frame);
+	*frame = other;
+}
+
+/**
+ * Get the frame into memory, in a format the texture takes.
+ *
+ * The hardware frames are copied back as NV12, which most GPUs use, since SDL
+ * can't draw them from the GPU memory in a portable way.
+ *
+ * \return 0 on success, -1 on error, in which case the frame should be
+ * skipped.
+ */
+static int prepare_frame(oshu::movie *movie, AVFrame **frame)
+{
+	int rc;
+	if ((*frame)->format == movie->hw_format) {
+		AVFrame *copy = av_frame_alloc();
+		if (!copy)
+			return -1;
+		if ((rc = av_hwframe_transfer_data(copy, *frame, 0)) < 0) {
+			av_frame_free(&copy);
+			goto fail;
+		}
+		swap_frame(frame, copy);
+	}
+	if (!texture_format((*frame)->format)) {
+		AVFrame *source = *frame;
+		movie->converter = sws_getCachedContext(
+			movie->converter,
+			source->width, source->height, (enum AVPixelFormat) source->format,
+			source->width, source->height, AV_PIX_FMT_YUV420P,
+			SWS_BILINEAR, NULL, NULL, NULL
+		);
+		if (!movie->converter) {
+			oshu_log_error("unsupported video pixel format");
+			return -1;
+		}
+		AVFrame *converted = av_frame_alloc();
+		if (!converted)
+			return -1;
+		converted->format = AV_PIX_FMT_YUV420P;
+		converted->width = source->width;
+		converted->height = source->height;
+		if ((rc = av_frame_get_buffer(converted, 0)) < 0) {
+			av_frame_free(&converted);
+			goto fail;
+		}
+		sws_scale(movie->converter, source->data, source->linesize, 0, source->height, converted->data, converted->linesize);
+		swap_frame(frame, converted);
+	}
+	return 0;
+fail:
+	oshu_log_error("error transferring a video frame");
+	log_av_error(rc);
+	return -1;
+}
+
+/**
+ * Queue a decoded frame, with the mutex held.
+ */
+static void push_frame(oshu::movie *movie, AVFrame *frame, double time)
+{
+	size_t bytes = 0;
+	for (AVBufferRef *buffer : frame->buf) {
+		if (buffer)
+			bytes += buffer->size;
+	}
+	oshu::track_allocation(oshu::VIDEO_MEMORY_CATEGORY, bytes);
+	movie->frames.push_back({frame, time, bytes});
+}
+
+static void free_frame(oshu::movie_frame *frame)
+{
+	oshu::track_release(oshu::VIDEO_MEMORY_CATEGORY, frame->bytes);
+	av_frame_free(&frame->frame);
+}
+
+static void clear_frames(oshu::movie *movie)
+{
+	for (oshu::movie_frame &f : movie->frames)
+		free_frame(&f);
+	movie->frames.clear();
+}
+
+/**
+ * Seek to the key frame before *target*, from which the worker decodes and
+ * drops the frames until it reaches *target*.
+ */
+static void seek_movie(oshu::movie *movie, double target)
+{
+	int64_t timestamp = std::max(0., target) / movie->time_base + movie->start_time;
+	int rc = av_seek_frame(movie->demuxer, movie->stream_index, timestamp, AVSEEK_FLAG_BACKWARD);
+	if (rc < 0) {
+		oshu_log_error("error seeking the video");
+		log_av_error(rc);
+	}
+	avcodec_flush_buffers(movie->decoder);
+}
+
+/**
+ * Keep the queue full until the movie is closed.
+ *
+ * The mutex is only held to touch the queue, not while decoding.
+ */
+static void run_worker(oshu::movie *movie)
+{
+	double last_time = 0;
+	std::unique_lock<std::mutex> lock(movie->mutex);
+	for (;;) {
+		movie->wake.wait(lock, [movie] {
+			return movie->stop || !std::isnan(movie->seek_target)
+			       || (!movie->finished && movie->frames.size() < oshu::movie_queue_size);
+		});
+		if (movie->stop)
+			break;
+		if (!std::isnan(movie->seek_target)) {
+			double target = movie->seek_target;
+			movie->seek_target = NAN;
+			movie->finished = false;
+			clear_frames(movie);
+			lock.unlock();
+			seek_movie(movie, target);
+			lock.lock();
+			continue;
+		}
+		double now = movie->now;
+		lock.unlock();
+		AVFrame *frame = av_frame_alloc();
+		int rc = frame ? decode_frame(movie, frame) : -1;
+		if (rc == 0) {
+			int64_t timestamp = frame->best_effort_timestamp;
+			last_time = timestamp == AV_NOPTS_VALUE ? last_time + movie->frame_duration : (timestamp - movie->start_time) * movie->time_base;
+		}
+		bool late = rc == 0 && last_time + movie->frame_duration < now;
+		if (rc == 0 && !late && prepare_frame(movie, &frame) < 0)
+			late = true;
+		lock.lock();
+		if (rc != 0) {
+			av_frame_free(&frame);
+			movie->finished = true;
+		} else if (!std::isnan(movie->seek_target)) {
+			av_frame_free(&frame);
+		} else if (late) {
+			av_frame_free(&frame);
+			++movie->dropped;
+		} else {
+			push_frame(movie, frame, last_time);
+		}
+	}
+}
+
+/* Public interface ***********************************************************/
+
+int oshu::open_movie(oshu::display *display, const char *path, oshu::movie *movie)
+{
+	movie->display = display;
+	if (open_demuxer(path, movie) < 0 || open_decoder(movie) < 0)
+		return -1;
+	try {
+		movie->worker = std::thread(run_worker, movie);
+	} catch (std::system_error &e) {
+		oshu_log_error("could not start the video decoder: %s", e.what());
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Copy a frame into the streaming texture, which is created again when the
+ * format or size of the frames changes.
+ */
+static int upload_frame(oshu::movie *movie, AVFrame *frame)
+{
+	oshu::texture *picture = &movie->picture;
+	if (picture->texture && (movie->picture_format != frame->format || picture->size != oshu::size(frame->width, frame->height)))
+		oshu::destroy_texture(picture);
+	if (!picture->texture) {
+		Uint32 format = SDL_PIXELFORMAT_IYUV;
+#if SDL_VERSION_ATLEAST(2, 0, 16)
+		if (frame->format == AV_PIX_FMT_NV12)
+			format = SDL_PIXELFORMAT_NV12;
+#endif
+		picture->texture = SDL_CreateTexture(movie->display->renderer, format, SDL_TEXTUREACCESS_STREAMING, frame->width, frame->height);
+		if (!picture->texture) {
+			oshu_log_error("could not create the video texture: %s", SDL_GetError());
+			return -1;
+		}
+		oshu::track_texture(picture->texture);
+		picture->size = oshu::size(frame->width, frame->height);
+		picture->origin = 0;
+		movie->picture_format = frame->format;
+	}
+	int rc;
+#if SDL_VERSION_ATLEAST(2, 0, 16)
+	if (frame->format == AV_PIX_FMT_NV12)
+		rc = SDL_UpdateNVTexture(picture->texture, NULL, frame->data[0], frame->linesize[0], frame->data[1], frame->linesize[1]);
+	else
+#endif
+	rc = SDL_UpdateYUVTexture(picture->texture, NULL, frame->data[0], frame->linesize[0], frame->data[1], frame->linesize[1], frame->data[2], frame->linesize[2]);
+	if (rc < 0) {
+		oshu_log_error("could not upload a video frame: %s", SDL_GetError());
+		return -1;
+	}
+	return 0;
+}
+
+bool oshu::update_movie(oshu::movie *movie, double t)
+{
+	if (!movie->worker.joinable() || t < 0)
+		return false;
+	oshu::movie_frame latest = {nullptr, 0, 0};
+	{
+		std::lock_guard<std::mutex> lock(movie->mutex);
+		movie->now = t;
+		if (t < movie->last_update || t > movie->last_update + max_skip) {
+			movie->seek_target = t;
+			clear_frames(movie);
+			movie->wake.notify_one();
+		}
+		while (!movie->frames.empty() && movie->frames.front().time <= t) {
+			if (latest.frame) {
+				free_frame(&latest);
+				++movie->dropped;
+			}
+			latest = movie->frames.front();
+			movie->frames.pop_front();
+		}
+		if (latest.frame)
+			movie->wake.notify_one();
+	}
+	movie->last_update = t;
+	if (latest.frame) {
+		if (upload_frame(movie, latest.frame) == 0)
+			movie->shown = latest.time;
+		free_frame(&latest);
+	}
+	return movie->picture.texture && movie->shown > -INFINITY;
+}
+
+void oshu::close_movie(oshu::movie *movie)
+{
+	if (movie->worker.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(movie->mutex);
+			movie->stop = true;
+		}
+		movie->wake.notify_one();
+		movie->worker.join();
+	}
+	clear_frames(movie);
+	if (movie->dropped)
+		oshu_log_debug("dropped %llu video frames", (unsigned long long) movie->dropped);
+	oshu::destroy_texture(&movie->picture);
+	if (movie->converter) {
+		sws_freeContext(movie->converter);
+		movie->converter = nullptr;
+	}
+	if (movie->decoder)
+		avcodec_free_context(&movie->decoder);
+	if (movie->hw_device)
+		av_buffer_unref(&movie->hw_device);
+	if (movie->demuxer)
+		avformat_close_input(&movie->demuxer);
+	if (movie->io) {
+		av_freep(&movie->io->buffer);
+		avio_context_free(&movie->io);
+	}
+	if (movie->source) {
+		oshu::close_file(&movie->source->file);
+		delete movie->source;
+		movie->source = nullptr;
+	}
+}
@@ -0,0 +1,68 @@
+/**
+ * \file video/pacing.cc
+ * \ingroup video_pacing
+ */
+
+#include "video/pacing.h"
+
+#include "core/metrics.h"
+#include "video/display.h"
+
+#include <SDL2/SDL.h>
+
+/**
+ * How long before the deadline the pacer stops sleeping and starts spinning,
+ * in milliseconds.
+ *
+ * It has to cover the imprecision of `SDL_Delay`, which depends on the
+ * system's scheduler.
+ */
+static const uint64_t spin_margin = 2;
+
+void oshu::start_pacing(oshu::frame_pacer *pacer, oshu::display *display)
+{
+	pacer->frequency = SDL_GetPerformanceFrequency();
+	if (display->vsync || display->frame_duration <= 0)
+		pacer->period = 0;
+	else
+		pacer->period = display->frame_duration * pacer->frequency;
+	pacer->deadline = 0;
+	pacer->missed_frames = 0;
+}
+
+int oshu::wait_event(oshu::frame_pacer *pacer, union SDL_Event *event)
+{
+	if (pacer->period == 0 || pacer->deadline == 0)
+		return 0;
+	uint64_t margin = spin_margin * pacer->frequency / 1000;
+	uint64_t now = SDL_GetPerformanceCounter();
+	if (now + margin >= pacer->deadline)
+		return 0;
+	int timeout = (pacer->deadline - now - margin) * 1000 / pacer->frequency;
+	if (timeout <= 0)
+		return 0;
+	return SDL_WaitEventTimeout(event, timeout);
+}
+
+int oshu::wait_frame(oshu::frame_pacer *pacer)
+{
+	if (pacer->period == 0)
+		return 0;
+	uint64_t now = SDL_GetPerformanceCounter();
+	if (pacer->deadline == 0) {
+		pacer->deadline = now + pacer->period;
+		return 0;
+	} else if (now > pacer->deadline) {
+		pacer->missed_frames++;
+		oshu::count(oshu::MISSED_FRAMES);
+		pacer->deadline = now + pacer->period;
+		return -1;
+	}
+	uint64_t margin = spin_margin * pacer->frequency / 1000;
+	if (pacer->deadline > now + margin)
+		SDL_Delay((pacer->deadline - now - margin) * 1000 / pacer->frequency);
+	while (SDL_GetPerformanceCounter() < pacer->deadline)
+		;
+	pacer->deadline += pacer->period;
+	return 0;
+}
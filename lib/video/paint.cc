@@ -23,25 +23,27 @@ static void destroy_painter(oshu::painter *painter)
 		painter->surface = NULL;
 	}
 	if (painter->destination) {
-		SDL_FreeSurface(painter->destination);
+		oshu::free_surface(painter->destination);
 		painter->destination = NULL;
 	}
 }
 
 int oshu::start_painting(oshu::display *display, oshu::size size, oshu::painter *painter)
+{
+	int rc = oshu::start_painting(display->view.zoom, size, painter);
+	painter->display = display;
+	return rc;
+}
+
+int oshu::start_painting(double zoom, oshu::size size, oshu::painter *painter)
 {
 	cairo_status_t s;
 	*painter = {};
-	painter->display = display;
 	painter->size = size;
-
-	double zoom = display->view.zoom;
 	size *= zoom;
 
 	/* 1. SDL */
-	painter->destination = SDL_CreateRGBSurface(
-		0, std::real(size), std::imag(size), 32,
-		0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000);
+	painter->destination = oshu::create_surface(std::real(size), std::imag(size));
 	if (!painter->destination) {
 		oshu_log_error("could not create a painting surface: %s", SDL_GetError());
 		goto fail;
@@ -77,42 +79,113 @@ fail:
 	return -1;
 }
 
+/**
+ * Reciprocals of the alpha values in 16.16 fixed point, such that
+ * `c * reciprocals[a] >> 16 == c * 255 / a` for every `c <= a`.
+ */
+struct reciprocal_table {
+	uint32_t values[256];
+	reciprocal_table()
+	{
+		values[0] = 0;
+		for (uint32_t a = 1; a < 256; ++a)
+			values[a] = ((255u << 16) + a - 1) / a;
+	}
+};
+
+static const reciprocal_table reciprocals;
+
 /**
  * Cairo uses pre-multiplied alpha channels.
  *
  * What this means is that a bright red (0xFF0000) at alpha 50% is stored as
  * 0x800000. We need to divide by the alpha to restore the initial color.
  *
- * This is required for Cairo → SDL interoperability.
+ * This is required for Cairo → SDL interoperability, unless the texture is
+ * drawn with a premultiplied blend mode. See #oshu::painter::premultiplied.
+ *
+ * The divisions are replaced by a multiplication with a reciprocal from a
+ * lookup table, which yields the exact same result. Opaque and transparent
+ * pixels, which make up most of a texture, are left untouched.
  */
 static void unpremultiply(SDL_Surface *surface)
 {
-	uint8_t *pixels = (uint8_t*) surface->pixels;
 	assert (surface->pitch % 4 == 0);
 	assert (surface->pitch == 4 * surface->w);
-	uint8_t *end = pixels + surface->h * surface->pitch;
-	for (uint8_t *c = pixels; c < end; c += 4) {
-		uint8_t alpha = c[3];
-		if (alpha == 0)
+	uint32_t *pixels = (uint32_t*) surface->pixels;
+	uint32_t *end = pixels + surface->h * surface->w;
+	for (uint32_t *p = pixels; p < end; ++p) {
+		uint32_t alpha = *p >> 24;
+		if (alpha == 0 || alpha == 255)
 			continue;
-		c[0] = (unsigned int) c[0] * 255 / alpha;
-		c[1] = (unsigned int) c[1] * 255 / alpha;
-		c[2] = (unsigned int) c[2] * 255 / alpha;
+		uint32_t r = reciprocals.values[alpha];
+		uint32_t c0 = (*p & 0xFF) * r >> 16;
+		uint32_t c1 = (*p >> 8 & 0xFF) * r >> 16;
+		uint32_t c2 = (*p >> 16 & 0xFF) * r >> 16;
+		*p = alpha << 24 | c2 << 16 | c1 << 8 | c0;
 	}
 }
 
-int oshu::finish_painting(oshu::painter *painter, oshu::texture *texture)
+/**
+ * The blend mode for textures with premultiplied colors.
+ */
+static SDL_BlendMode premultiplied_blend()
 {
-	int rc = 0;
-	unpremultiply(painter->destination);
+	return SDL_ComposeCustomBlendMode(
+		SDL_BLENDFACTOR_ONE, SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA, SDL_BLENDOPERATION_ADD,
+		SDL_BLENDFACTOR_ONE, SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA, SDL_BLENDOPERATION_ADD);
+}
+
+bool oshu::premultiplied_supported(oshu::display *display)
+{
+	SDL_Texture *probe = SDL_CreateTexture(display->renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, 1, 1);
+	if (!probe)
+		return false;
+	int rc = SDL_SetTextureBlendMode(probe, premultiplied_blend());
+	SDL_DestroyTexture(probe);
+	return rc == 0;
+}
+
+void oshu::set_premultiplied_blend(struct SDL_Texture *texture)
+{
+	SDL_SetTextureBlendMode(texture, premultiplied_blend());
+}
+
+void oshu::finish_surface(oshu::painter *painter)
+{
+	cairo_destroy(painter->cr);
+	painter->cr = NULL;
+	cairo_surface_destroy(painter->surface);
+	painter->surface = NULL;
+	if (!painter->premultiplied)
+		unpremultiply(painter->destination);
 	SDL_UnlockSurface(painter->destination);
+}
+
+int oshu::upload_painting(oshu::painter *painter, oshu::display *display, oshu::texture *texture)
+{
+	int rc = 0;
 	texture->size = painter->size;
 	texture->origin = 0;
-	texture->texture = SDL_CreateTextureFromSurface(painter->display->renderer, painter->destination);
+	texture->texture = SDL_CreateTextureFromSurface(display->renderer, painter->destination);
+	oshu::track_texture(texture->texture);
 	if (!texture->texture) {
 		oshu_log_error("error uploading texture: %s", SDL_GetError());
 		rc = -1;
+	} else if (painter->premultiplied) {
+		oshu::set_premultiplied_blend(texture->texture);
 	}
 	destroy_painter(painter);
 	return rc;
 }
+
+int oshu::finish_painting(oshu::painter *painter, oshu::texture *texture)
+{
+	oshu::finish_surface(painter);
+	return oshu::upload_painting(painter, painter->display, texture);
+}
+
+void oshu::discard_painting(oshu::painter *painter)
+{
+	destroy_painter(painter);
+}
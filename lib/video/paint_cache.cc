@@ -0,0 +1,119 @@
+/**
+ * \file video/paint_cache.cc
+ * \ingroup video_paint_cache
+ */
+
+#include "video/paint_cache.h"
+
+#include "core/home.h"
+#include "core/log.h"
+#include "video/display.h"
+#include "video/paint.h"
+#include "video/texture.h"
+
+#include <SDL2/SDL.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * Header of the painting files, followed by the ARGB pixels, row by row.
+ */
+struct painting_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t premultiplied;
+};
+
+static const char painting_magic[8] = {'o', 's', 'h', 'u', 'p', 'n', 't', '\0'};
+static const uint32_t painting_version = 1;
+
+std::string oshu::paint_cache_path(uint64_t key)
+{
+	std::string directory;
+	try {
+		directory = oshu::get_cache_directory("paintings");
+	} catch (std::exception &e) {
+		oshu_log_debug("paint cache unavailable: %s", e.what());
+		return "";
+	}
+	char name[32];
+	snprintf(name, sizeof(name), "/%016llx.argb", (unsigned long long) key);
+	return directory + name;
+}
+
+int oshu::load_painting(const std::string &path, oshu::display *display, oshu::size size, oshu::texture *texture)
+{
+	if (path.empty())
+		return -1;
+	FILE *file = fopen(path.c_str(), "rb");
+	if (!file)
+		return -1;
+	int rc = -1;
+	SDL_Surface *surface = nullptr;
+	painting_header header;
+	if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, painting_magic, sizeof(painting_magic))
+	    || header.version != painting_version || header.width == 0 || header.height == 0
+	    || header.width > 16384 || header.height > 16384) {
+		oshu_log_debug("ignoring the invalid painting %s", path.c_str());
+		goto done;
+	}
+	surface = oshu::create_surface(header.width, header.height);
+	if (!surface)
+		goto done;
+	for (uint32_t row = 0; row < header.height; ++row) {
+		if (fread((char*) surface->pixels + row * surface->pitch, 4, header.width, file) != header.width) {
+			oshu_log_debug("ignoring the truncated painting %s", path.c_str());
+			goto done;
+		}
+	}
+	texture->size = size;
+	texture->origin = 0;
+	texture->texture = SDL_CreateTextureFromSurface(display->renderer, surface);
+	oshu::track_texture(texture->texture);
+	if (!texture->texture) {
+		oshu_log_error("error uploading texture: %s", SDL_GetError());
+		goto done;
+	}
+	if (header.premultiplied)
+		oshu::set_premultiplied_blend(texture->texture);
+	rc = 0;
+
+done:
+	if (surface)
+		oshu::free_surface(surface);
+	fclose(file);
+	return rc;
+}
+
+void oshu::save_painting(const std::string &path, oshu::painter *painter)
+{
+	if (path.empty() || !painter->destination)
+		return;
+	SDL_Surface *surface = painter->destination;
+	std::string tmp = path + ".tmp" + std::to_string(getpid());
+	FILE *file = fopen(tmp.c_str(), "wb");
+	if (!file) {
+		oshu_log_debug("could not create %s: %s", tmp.c_str(), strerror(errno));
+		return;
+	}
+	painting_header header {};
+	memcpy(header.magic, painting_magic, sizeof(painting_magic));
+	header.version = painting_version;
+	header.width = surface->w;
+	header.height = surface->h;
+	header.premultiplied = painter->premultiplied;
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	for (int row = 0; ok && row < surface->h; ++row)
+		ok = fwrite((char*) surface->pixels + row * surface->pitch, 4, surface->w, file) == (size_t) surface->w;
+	if (fclose(file) != 0)
+		ok = false;
+	if (!ok || rename(tmp.c_str(), path.c_str()) < 0) {
+		oshu_log_debug("could not cache the painting %s", path.c_str());
+		unlink(tmp.c_str());
+	}
+}
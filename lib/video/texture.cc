@@ -7,12 +7,16 @@
 
 #include "video/display.h"
 #include "core/log.h"
+#include "core/memory.h"
+#include "core/metrics.h"
 
 #include <SDL2/SDL_image.h>
+#include <stdlib.h>
 
 int oshu::load_texture(oshu::display *display, const char *filename, oshu::texture *texture)
 {
 	texture->texture = IMG_LoadTexture(display->renderer, filename);
+	oshu::track_texture(texture->texture);
 	if (!texture->texture) {
 		oshu_log_error("error loading image: %s", IMG_GetError());
 		return -1;
@@ -27,11 +31,77 @@ int oshu::load_texture(oshu::display *display, const char *filename, oshu::textu
 void oshu::destroy_texture(oshu::texture *texture)
 {
 	if (texture->texture) {
-		SDL_DestroyTexture(texture->texture);
+		oshu::release_texture(texture->texture);
 		texture->texture = NULL;
 	}
 }
 
+size_t oshu::texture_bytes(SDL_Texture *texture)
+{
+	int w, h;
+	if (!texture || SDL_QueryTexture(texture, NULL, NULL, &w, &h) < 0)
+		return 0;
+	return (size_t) w * h * 4;
+}
+
+void oshu::track_texture(SDL_Texture *texture)
+{
+	if (!texture)
+		return;
+	int64_t bytes = oshu::texture_bytes(texture);
+	int64_t usage = oshu::metrics[oshu::VIDEO_MEMORY].fetch_add(bytes, std::memory_order_relaxed) + bytes;
+	oshu::raise_gauge(oshu::VIDEO_MEMORY_MAX, usage);
+}
+
+void oshu::release_texture(SDL_Texture *texture)
+{
+	if (!texture)
+		return;
+	oshu::count(oshu::VIDEO_MEMORY, - (int64_t) oshu::texture_bytes(texture));
+	SDL_DestroyTexture(texture);
+}
+
+SDL_Surface* oshu::create_surface(int width, int height)
+{
+	SDL_Surface *surface = SDL_CreateRGBSurface(
+		0, width, height, 32,
+		0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000);
+	if (surface)
+		oshu::track_allocation(oshu::VIDEO_MEMORY_CATEGORY, (size_t) surface->pitch * surface->h);
+	return surface;
+}
+
+void oshu::free_surface(SDL_Surface *surface)
+{
+	if (!surface)
+		return;
+	oshu::track_release(oshu::VIDEO_MEMORY_CATEGORY, (size_t) surface->pitch * surface->h);
+	SDL_FreeSurface(surface);
+}
+
+size_t oshu::video_memory_budget()
+{
+	static size_t budget = [] {
+		const char *value = getenv("OSHU_VIDEO_MEMORY");
+		if (!value || !*value)
+			return (size_t) 0;
+		char *end;
+		long mib = strtol(value, &end, 10);
+		if (*end || mib <= 0) {
+			oshu_log_warning("invalid OSHU_VIDEO_MEMORY value: %s", value);
+			return (size_t) 0;
+		}
+		return (size_t) mib << 20;
+	}();
+	return budget;
+}
+
+bool oshu::over_video_memory_budget()
+{
+	size_t budget = oshu::video_memory_budget();
+	return budget > 0 && (size_t) oshu::metrics[oshu::VIDEO_MEMORY].load(std::memory_order_relaxed) > budget;
+}
+
 void oshu::draw_scaled_texture(oshu::display *display, oshu::texture *texture, oshu::point p, double ratio)
 {
 	oshu::point top_left = oshu::project(&display->view, p - texture->origin * ratio);
@@ -0,0 +1,65 @@
+/**
+ * \file video/texture_cache.cc
+ * \ingroup video_texture_cache
+ */
+
+#include "video/texture_cache.h"
+
+#include "core/log.h"
+#include "core/metrics.h"
+#include "video/texture.h"
+
+#include <SDL2/SDL.h>
+#include <stdlib.h>
+
+static void evict(oshu::texture_cache *cache, std::list<oshu::cached_texture>::iterator it)
+{
+	oshu::texture **owner = it->owner;
+	oshu::destroy_texture(*owner);
+	free(*owner);
+	*owner = NULL;
+	cache->usage -= it->bytes;
+	cache->index.erase(owner);
+	cache->entries.erase(it);
+}
+
+void oshu::insert_texture(oshu::texture_cache *cache, oshu::texture **owner)
+{
+	auto found = cache->index.find(owner);
+	if (found != cache->index.end()) {
+		cache->usage -= found->second->bytes;
+		cache->entries.erase(found->second);
+	}
+	size_t bytes = oshu::texture_bytes((*owner)->texture);
+	cache->entries.push_front(oshu::cached_texture {owner, bytes, cache->frame});
+	cache->index[owner] = cache->entries.begin();
+	cache->usage += bytes;
+}
+
+void oshu::touch_texture(oshu::texture_cache *cache, oshu::texture **owner)
+{
+	auto found = cache->index.find(owner);
+	if (found == cache->index.end())
+		return;
+	found->second->frame = cache->frame;
+	cache->entries.splice(cache->entries.begin(), cache->entries, found->second);
+}
+
+void oshu::trim_textures(oshu::texture_cache *cache)
+{
+	while ((cache->usage > cache->budget || oshu::over_video_memory_budget()) && !cache->entries.empty()) {
+		auto last = std::prev(cache->entries.end());
+		if (last->frame == cache->frame)
+			break;
+		oshu_log_verbose("evicting a %zu KiB texture from the cache", last->bytes >> 10);
+		evict(cache, last);
+		oshu::count(oshu::TEXTURE_EVICTIONS);
+	}
+	++cache->frame;
+}
+
+void oshu::clear_texture_cache(oshu::texture_cache *cache)
+{
+	while (!cache->entries.empty())
+		evict(cache, cache->entries.begin());
+}
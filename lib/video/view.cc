@@ -45,6 +45,33 @@ oshu::point oshu::unproject(oshu::view *view, oshu::point p)
 	return (p - view->origin) / view->zoom;
 }
 
+/*
+ * std::complex<double> is laid out as an array of two doubles, the real part
+ * first, so an array of points is an array of interleaved coordinates.
+ */
+
+void oshu::project(oshu::view *view, oshu::point *points, size_t count)
+{
+	double *xy = reinterpret_cast<double*>(points);
+	double zoom = view->zoom;
+	double ox = std::real(view->origin), oy = std::imag(view->origin);
+	for (size_t i = 0; i < 2 * count; i += 2) {
+		xy[i] = xy[i] * zoom + ox;
+		xy[i + 1] = xy[i + 1] * zoom + oy;
+	}
+}
+
+void oshu::unproject(oshu::view *view, oshu::point *points, size_t count)
+{
+	double *xy = reinterpret_cast<double*>(points);
+	double scale = 1. / view->zoom;
+	double ox = std::real(view->origin), oy = std::imag(view->origin);
+	for (size_t i = 0; i < 2 * count; i += 2) {
+		xy[i] = (xy[i] - ox) * scale;
+		xy[i + 1] = (xy[i + 1] - oy) * scale;
+	}
+}
+
 void oshu::reset_view(oshu::display *display)
 {
 	int w, h;
@@ -0,0 +1,43 @@
+/*
+ * Search the sets of the library from the landing page of the HTML index.
+ *
+ * The sets are listed in index.json, as [artist, title, shard, anchor]. Every
+ * word typed must appear in the artist or the title of a set.
+ */
+
+var input = document.getElementById('search');
+var results = document.getElementById('results');
+var sets = [];
+var shown_results = 100;
+
+function search() {
+	var words = input.value.toLowerCase().split(/\s+/).filter(function (w) { return w; });
+	results.textContent = '';
+	if (!words.length)
+		return;
+	var count = 0;
+	for (var i = 0; i < sets.length && count < shown_results; ++i) {
+		var set = sets[i];
+		var text = (set[0] + ' ' + set[1]).toLowerCase();
+		if (!words.every(function (w) { return text.indexOf(w) >= 0; }))
+			continue;
+		var link = document.createElement('a');
+		link.href = 'index-' + set[2] + '.html#' + set[3];
+		link.textContent = set[0] + ' - ' + set[1];
+		var item = document.createElement('li');
+		item.appendChild(link);
+		results.appendChild(item);
+		++count;
+	}
+}
+
+fetch('index.json')
+	.then(function (response) { return response.json(); })
+	.then(function (index) { sets = index.sets; search(); })
+	.catch(function () {
+		/* Browsers won't fetch local files, so the search needs a web server. */
+		input.disabled = true;
+		input.placeholder = 'Serve this directory over HTTP to search';
+	});
+
+input.addEventListener('input', search);
@@ -1,19 +1,21 @@
 /**
  * \file src/oshu-library/build_index.cc
  *
- * Command for generating the HTML beatmap index.
+ * Command for generating the HTML beatmap index, along with the binary index
+ * used by the search command.
  */
 
 #include <cstdlib>
-#include <fstream>
 #include <getopt.h>
 #include <iostream>
-#include <sys/stat.h>
 #include <unistd.h>
 
+#include "core/home.h"
 #include "core/log.h"
+#include "core/memory.h"
 #include "library/beatmaps.h"
 #include "library/html.h"
+#include "library/index.h"
 
 #include "./command.h"
 
@@ -28,17 +30,6 @@ static struct option options[] = {
 
 static const char *flags = "v";
 
-static void ensure_directory(const std::string &path)
-{
-	if (mkdir(path.c_str(), S_IRWXU | S_IRWXG | S_IRWXO) < 0) {
-		if (errno == EEXIST)
-			return;
-		throw std::system_error(errno, std::system_category(), "could not create directory " + path);
-	} else {
-		oshu::debug_log() << "created directory " << path << std::endl;
-	}
-}
-
 static void change_directory(const std::string &path)
 {
 	if (chdir(path.c_str()) < 0)
@@ -47,37 +38,25 @@ static void change_directory(const std::string &path)
 		oshu::debug_log() << "moving to " << path << std::endl;
 }
 
-/**
- * Read the oshu! beatmap library location from the environment.
- *
- * By order of priority:
- *
- * 1. If OSHU_HOME is set, use it.
- * 2. If HOME is set, append `/.oshu/` at the end.
- * 3. Otherwise, throw an exception.
- *
- */
-static std::string get_oshu_home()
-{
-	const char *home = std::getenv("OSHU_HOME");
-	if (home && *home)
-		return home;
-	home = std::getenv("HOME");
-	if (home && *home)
-		return std::string(home) + "/.oshu";
-	throw std::runtime_error("could not locate the oshu! home");
-}
-
 static void do_build_index()
 {
-	std::string home = get_oshu_home();
+	std::string home = oshu::get_oshu_home();
 	oshu::info_log() << "oshu! home directory: " << home << std::endl;
-	ensure_directory(home);
-	ensure_directory(home + "/web");
+	oshu::ensure_directory(home);
+	oshu::ensure_directory(home + "/web");
 	change_directory(home + "/web");
-	auto sets = oshu::find_beatmap_sets("../beatmaps");
-	std::ofstream index("index.html");
-	oshu::generate_html_beatmap_set_listing(sets, index);
+	std::string cache = oshu::get_cache_directory("library");
+	oshu::html_index listing;
+	listing.previews = oshu::load_preview_map("previews/index");
+	std::vector<oshu::beatmap_entry> entries;
+	oshu::scan_beatmap_sets("../beatmaps", cache + "/manifest", [&](oshu::beatmap_set &&set) {
+		listing.update(set);
+		entries.insert(entries.end(), set.entries.begin(), set.entries.end());
+	});
+	size_t written = listing.write_shards(".");
+	oshu::debug_log() << "rewrote " << written << " files of the HTML index" << std::endl;
+	oshu::save_beatmap_index(cache + "/index", std::move(entries));
+	oshu::log_memory_usage();
 	std::cout << home << "/web/index.html" << std::endl;
 }
 
@@ -27,6 +27,12 @@ struct command {
 
 extern command build_index;
 extern command help;
+extern command rejudge;
+extern command previews;
+extern command render;
+extern command search;
+extern command simulate;
+extern command watch;
 
 /**
  * List of all the registered commands.
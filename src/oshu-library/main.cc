@@ -38,6 +38,12 @@ command help {
 command commands[] = {
 	build_index,
 	help,
+	rejudge,
+	previews,
+	render,
+	search,
+	simulate,
+	watch,
 	{},
 };
 
@@ -0,0 +1,301 @@
+/**
+ * \file src/oshu-library/previews.cc
+ *
+ * Command for cutting a short audio preview out of the music of every beatmap
+ * set, for the HTML index.
+ */
+
+#include <SDL2/SDL.h>
+
+#include <algorithm>
+#include <atomic>
+#include <errno.h>
+#include <getopt.h>
+#include <iostream>
+#include <math.h>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <unistd.h>
+#include <vector>
+
+#include "audio/stream.h"
+#include "beatmap/beatmap.h"
+#include "core/hash.h"
+#include "core/home.h"
+#include "core/log.h"
+#include "library/beatmaps.h"
+#include "library/html.h"
+#include "video/encoder.h"
+
+#include "./command.h"
+
+enum option_values {
+	OPT_VERBOSE = 'v',
+	OPT_LENGTH = 0x10000,
+	OPT_FORMAT,
+};
+
+static struct option options[] = {
+	{"verbose", no_argument, 0, OPT_VERBOSE},
+	{"length", required_argument, 0, OPT_LENGTH},
+	{"format", required_argument, 0, OPT_FORMAT},
+	{0, 0, 0, 0},
+};
+
+static const char *flags = "v";
+
+/**
+ * Length of the clips in seconds, set by `--length`.
+ */
+static double clip_length = 10;
+
+/**
+ * Extension of the clips, which picks the container and its default audio
+ * codec, set by `--format`.
+ */
+static std::string clip_format = "m4a";
+
+/**
+ * Duration of the fades at both ends of the clips, in seconds.
+ */
+static const double fade_length = .5;
+
+/**
+ * Where the clip starts in songs whose beatmaps have no preview time, as a
+ * fraction of the song. Choruses tend to be around there.
+ */
+static const double default_preview_position = .4;
+
+/**
+ * A clip to cut, shared by every set with the same music.
+ */
+struct preview_job {
+	std::string audio;
+	double preview_time;
+	/**
+	 * Name of the clip in the previews directory.
+	 */
+	std::string clip;
+	/**
+	 * Sets using the clip.
+	 */
+	std::vector<std::string> sets;
+};
+
+/**
+ * Find the music and the preview time of a set, from its first beatmap.
+ */
+static int read_set(const oshu::beatmap_set &set, std::string *audio, double *preview_time)
+{
+	std::string path = set.entries.front().path.str();
+	oshu::beatmap beatmap;
+	if (oshu::load_beatmap_headers(path.c_str(), &beatmap) < 0)
+		return -1;
+	int rc = -1;
+	if (beatmap.audio_filename) {
+		size_t slash = path.rfind('/');
+		std::string directory = slash == std::string::npos ? "." : path.substr(0, slash);
+		*audio = directory + "/" + beatmap.audio_filename;
+		*preview_time = beatmap.preview_time;
+		rc = 0;
+	}
+	oshu::destroy_beatmap(&beatmap);
+	return rc;
+}
+
+/**
+ * Fade the ends of the clip in and out.
+ */
+static void fade(std::vector<float> *samples, int sample_rate)
+{
+	size_t frames = samples->size() / 2;
+	size_t fade_frames = std::min<size_t>(fade_length * sample_rate, frames / 2);
+	for (size_t i = 0; i < fade_frames; ++i) {
+		float gain = (float) i / fade_frames;
+		for (int c = 0; c < 2; ++c) {
+			(*samples)[2 * i + c] *= gain;
+			(*samples)[2 * (frames - 1 - i) + c] *= gain;
+		}
+	}
+}
+
+/**
+ * Decode the few seconds of the clip, and encode them.
+ *
+ * Only the clip is decoded, after seeking in the stream, and the clip is
+ * written under a temporary name first, so that an interrupted run leaves no
+ * partial clip behind.
+ */
+static int cut_clip(const preview_job &job, const std::string &directory)
+{
+	oshu::stream stream {};
+	if (oshu::open_stream(job.audio.c_str(), &stream) < 0)
+		return -1;
+	double start = job.preview_time;
+	if (start <= 0 || start >= stream.duration)
+		start = stream.duration * default_preview_position;
+	start = std::max(0., std::min(start, stream.duration - clip_length));
+	if (start > 0 && oshu::seek_stream(&stream, start) < 0) {
+		oshu::close_stream(&stream);
+		return -1;
+	}
+	std::vector<float> samples(lrint(clip_length * stream.sample_rate) * 2);
+	int count = oshu::read_stream(&stream, samples.data(), samples.size() / 2);
+	int sample_rate = stream.sample_rate;
+	oshu::close_stream(&stream);
+	if (count <= 0)
+		return -1;
+	samples.resize(count * 2);
+	fade(&samples, sample_rate);
+
+	std::string path = directory + "/" + job.clip;
+	std::string tmp = directory + "/tmp-" + job.clip;
+	oshu::encoder encoder {};
+	int rc = oshu::open_encoder(tmp.c_str(), 0, 0, sample_rate, &encoder);
+	if (rc == 0)
+		rc = oshu::encode_frame(&encoder, {}, std::move(samples));
+	if (oshu::close_encoder(&encoder) < 0)
+		rc = -1;
+	if (rc == 0 && rename(tmp.c_str(), path.c_str()) < 0)
+		rc = -1;
+	if (rc < 0)
+		unlink(tmp.c_str());
+	return rc;
+}
+
+static bool file_exists(const std::string &path)
+{
+	struct stat s;
+	return stat(path.c_str(), &s) == 0;
+}
+
+/**
+ * Cut the preview of every set that has none yet.
+ *
+ * The sets come from the library scan, shared with `build-index`. Sets
+ * already in the previews list are skipped without reading their music, as
+ * long as their clip is still there. The music of the other sets is hashed to
+ * cut only one clip per song, and the clips are cut in parallel, one per core.
+ */
+static int make_previews()
+{
+	std::string home = oshu::get_oshu_home();
+	std::string web = home + "/web";
+	oshu::ensure_directory(web);
+	/* Scan from the same place as build-index, for the set paths to match. */
+	if (chdir(web.c_str()) < 0)
+		throw std::system_error(errno, std::system_category(), "could not chdir to " + web);
+	std::string directory = "previews";
+	oshu::ensure_directory(directory);
+	std::string cache = oshu::get_cache_directory("library");
+	std::string map_path = directory + "/index";
+	std::unordered_map<std::string, std::string> previews = oshu::load_preview_map(map_path);
+
+	std::vector<preview_job> jobs;
+	std::unordered_map<uint64_t, size_t> by_hash;
+	std::unordered_map<std::string, std::string> kept;
+	oshu::scan_beatmap_sets("../beatmaps", cache + "/manifest", [&](oshu::beatmap_set &&set) {
+		auto known = previews.find(set.path);
+		if (known != previews.end() && file_exists(known->second)) {
+			kept.insert(*known);
+			return;
+		}
+		std::string audio;
+		double preview_time;
+		uint64_t hash;
+		if (read_set(set, &audio, &preview_time) < 0 || oshu::hash_file(audio.c_str(), &hash) < 0) {
+			oshu::warning_log() << "no music for " << set.path << std::endl;
+			return;
+		}
+		auto same = by_hash.find(hash);
+		if (same != by_hash.end()) {
+			jobs[same->second].sets.push_back(set.path);
+			return;
+		}
+		char clip[32];
+		snprintf(clip, sizeof(clip), "%016llx.", (unsigned long long) hash);
+		by_hash[hash] = jobs.size();
+		jobs.push_back(preview_job {audio, preview_time, clip + clip_format, {set.path}});
+	});
+	oshu::info_log() << kept.size() << " sets already have a preview, " << jobs.size() << " clips to cut" << std::endl;
+
+	std::atomic<size_t> next {0};
+	std::mutex mutex;
+	int failures = 0;
+	auto work = [&]() {
+		for (size_t i; (i = next++) < jobs.size();) {
+			preview_job &job = jobs[i];
+			bool done = file_exists(directory + "/" + job.clip) || cut_clip(job, directory) == 0;
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!done) {
+				oshu::warning_log() << "could not cut a preview out of " << job.audio << std::endl;
+				++failures;
+				continue;
+			}
+			oshu::debug_log() << "cut " << job.clip << " out of " << job.audio << std::endl;
+			for (const std::string &set : job.sets)
+				kept[set] = directory + "/" + job.clip;
+		}
+	};
+	size_t count = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), jobs.size());
+	std::vector<std::thread> workers;
+	for (size_t i = 0; i < count; ++i)
+		workers.emplace_back(work);
+	for (std::thread &t : workers)
+		t.join();
+
+	oshu::save_preview_map(map_path, kept);
+	std::cout << web << "/" << directory << std::endl;
+	return failures > 0 ? -1 : 0;
+}
+
+static int run(int argc, char **argv)
+{
+	char *end;
+	for (;;) {
+		int c = getopt_long(argc, argv, flags, options, NULL);
+		if (c == -1)
+			break;
+		switch (c) {
+		case OPT_VERBOSE:
+			--oshu::log_priority;
+			break;
+		case OPT_LENGTH:
+			clip_length = strtod(optarg, &end);
+			if (*end || clip_length <= 2 * fade_length || clip_length > 60) {
+				std::cerr << "invalid clip length: " << optarg << std::endl;
+				return 2;
+			}
+			break;
+		case OPT_FORMAT:
+			clip_format = optarg;
+			break;
+		default:
+			return 2;
+		}
+	}
+	if (argc - optind != 0) {
+		std::cerr << "Usage: oshu-library previews [-v] [--length=SECONDS] [--format=EXTENSION]" << std::endl;
+		std::cerr << "       oshu-library --help" << std::endl;
+		return 2;
+	}
+	SDL_LogSetAllPriority(SDL_LOG_PRIORITY_WARN);
+	SDL_LogSetPriority(SDL_LOG_CATEGORY_APPLICATION, static_cast<SDL_LogPriority>(oshu::log_priority));
+	try {
+		return make_previews() < 0 ? 1 : 0;
+	} catch (std::exception &e) {
+		oshu::error_log() << e.what() << std::endl;
+		return 1;
+	}
+}
+
+command previews {
+	.name = "previews",
+	.run = run,
+};
@@ -0,0 +1,89 @@
+/**
+ * \file src/oshu-library/rejudge.cc
+ *
+ * Command for judging replays again with the current game logic.
+ */
+
+#include <cstdio>
+#include <getopt.h>
+#include <iostream>
+
+#include "beatmap/beatmap.h"
+#include "core/hash.h"
+#include "core/log.h"
+#include "game/osu.h"
+#include "game/replay.h"
+#include "game/simulation.h"
+
+#include "./command.h"
+
+enum option_values {
+	OPT_VERBOSE = 'v',
+};
+
+static struct option options[] = {
+	{"verbose", no_argument, 0, OPT_VERBOSE},
+	{0, 0, 0, 0},
+};
+
+static const char *flags = "v";
+
+/**
+ * Play a replay on a fresh headless game, and print its score.
+ */
+static int rejudge_replay(const char *beatmap_path, uint64_t beatmap_hash, const char *replay_path)
+{
+	oshu::replay replay;
+	if (oshu::load_replay(replay_path, &replay) < 0)
+		return -1;
+	if (replay.beatmap_hash != beatmap_hash) {
+		oshu::error_log() << replay_path << " was recorded on another beatmap" << std::endl;
+		return -1;
+	}
+	try {
+		oshu::osu_game game(beatmap_path, true);
+		if (oshu::simulate(&game, replay.events) < 0)
+			return -1;
+		printf("%.4f\t%s\n", oshu::score(&game.beatmap), replay_path);
+		return 0;
+	} catch (std::exception &e) {
+		oshu::error_log() << beatmap_path << ": " << e.what() << std::endl;
+		return -1;
+	}
+}
+
+static int run(int argc, char **argv)
+{
+	for (;;) {
+		int c = getopt_long(argc, argv, flags, options, NULL);
+		if (c == -1)
+			break;
+		switch (c) {
+		case OPT_VERBOSE:
+			--oshu::log_priority;
+			break;
+		}
+	}
+	if (argc - optind < 2) {
+		std::cerr << "Usage: oshu-library rejudge [-v] BEATMAP REPLAY..." << std::endl;
+		std::cerr << "       oshu-library --help" << std::endl;
+		return 2;
+	}
+	SDL_LogSetAllPriority(SDL_LOG_PRIORITY_WARN);
+	SDL_LogSetPriority(SDL_LOG_CATEGORY_APPLICATION, static_cast<SDL_LogPriority>(oshu::log_priority));
+	const char *beatmap_path = argv[optind];
+	uint64_t beatmap_hash;
+	if (oshu::hash_file(beatmap_path, &beatmap_hash) < 0)
+		return 1;
+	int rc = 0;
+	for (int i = optind + 1; i < argc; ++i) {
+		if (rejudge_replay(beatmap_path, beatmap_hash, argv[i]) < 0)
+			rc = 1;
+	}
+	return rc;
+}
+
+command rejudge {
+	.name = "rejudge",
+	.run = run,
+};
@@ -0,0 +1,266 @@
+/**
+ * \file src/oshu-library/render.cc
+ *
+ * Command for recording autoplay runs into video files, faster than real time.
+ */
+
+#include <SDL2/SDL.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <getopt.h>
+#include <iostream>
+#include <math.h>
+#include <memory>
+#include <stdlib.h>
+#include <vector>
+
+#include "audio/library.h"
+#include "core/log.h"
+#include "core/trace.h"
+#include "game/clock.h"
+#include "game/osu.h"
+#include "ui/osu.h"
+#include "ui/shell.h"
+#include "video/display.h"
+#include "video/encoder.h"
+
+#include "./command.h"
+
+enum option_values {
+	OPT_VERBOSE = 'v',
+	OPT_OUTPUT = 'o',
+	OPT_SIZE = 0x10000,
+	OPT_FPS,
+	OPT_DURATION,
+};
+
+static struct option options[] = {
+	{"verbose", no_argument, 0, OPT_VERBOSE},
+	{"output", required_argument, 0, OPT_OUTPUT},
+	{"size", required_argument, 0, OPT_SIZE},
+	{"fps", required_argument, 0, OPT_FPS},
+	{"duration", required_argument, 0, OPT_DURATION},
+	{0, 0, 0, 0},
+};
+
+static const char *flags = "vo:";
+
+/**
+ * Size of the video, set by `--size`.
+ */
+static oshu::size video_size {960, 720};
+
+/**
+ * Frame rate of the video, set by `--fps`.
+ */
+static int video_fps = 60;
+
+/**
+ * Maximum length of the video in seconds, set by `--duration`, or 0 to
+ * record the whole beatmap and its score screen.
+ */
+static double video_duration = 0;
+
+/**
+ * Most samples per channel mixed at once, which must fit in the audio ring.
+ */
+static const int mix_chunk = 4096;
+
+/**
+ * Move the game clock to *t*, like #oshu::simulate does.
+ *
+ * The system clock, which drives the animations, starts at 0 like the process
+ * time does when the game is started.
+ */
+static void advance(oshu::game_base *game, double t, double start)
+{
+	oshu::clock *clock = &game->clock;
+	clock->before = clock->now;
+	clock->now = t;
+	clock->audio = t;
+	clock->system = t - start;
+}
+
+/**
+ * Mix the audio from sample *from* to sample *to*, counted from the start of
+ * the game, into *samples*.
+ *
+ * The music starts at *music_start*, and is preceded by silence, like the
+ * audio device is paused until the game clock reaches 0.
+ */
+static void mix(oshu::audio *audio, long from, long to, long music_start, std::vector<float> *samples)
+{
+	samples->assign((to - from) * 2, 0.f);
+	for (long s = std::max(from, music_start); s < to;) {
+		int count = std::min<long>(mix_chunk, to - s);
+		oshu::render_audio(audio, samples->data() + (s - from) * 2, count);
+		s += count;
+	}
+}
+
+/**
+ * Open the music without an audio device, and load the hit sounds.
+ *
+ * The game is created headless, so that it doesn't open the audio device
+ * itself.
+ */
+static int open_offline_sounds(oshu::osu_game *game)
+{
+	if (!game->beatmap.audio_filename) {
+		oshu_log_error("the beatmap has no music");
+		return -1;
+	}
+	std::string music = game->asset_path(game->beatmap.audio_filename);
+	if (oshu::open_offline_audio(music.c_str(), &game->audio) < 0)
+		return -1;
+	oshu::open_sound_library(&game->library, &game->audio.device_spec);
+	game->library.beatmap_directory = game->directory;
+	oshu::populate_library(&game->library, &game->beatmap);
+	return 0;
+}
+
+/**
+ * Play a beatmap with autoplay on a synthetic clock, and encode every frame
+ * the shell draws, with the audio mixed during it.
+ *
+ * The shell, the osu!standard view and the audio mixer are the ones of the
+ * game, so that the video looks and sounds like the real thing.
+ */
+static int render_beatmap(const char *path, const char *output)
+{
+	int64_t begin = oshu::trace_clock();
+	oshu::encoder encoder {};
+	long frame = 0;
+	try {
+		oshu::osu_game game(path, true);
+		game.autoplay = true;
+		if (open_offline_sounds(&game) < 0)
+			return -1;
+		oshu::display display(video_size);
+		int rate = game.audio.device_spec.freq;
+		if (oshu::open_encoder(output, video_size, video_fps, rate, &encoder) < 0) {
+			oshu::close_encoder(&encoder);
+			return -1;
+		}
+
+		std::unique_ptr<oshu::osu_ui> view = std::make_unique<oshu::osu_ui>(&display, game);
+		oshu::shell shell(display, game);
+		shell.game_view = std::move(view);
+		shell.continuous = true;
+		/* The background is loaded in the background, but must be in the
+		 * first frame. */
+		if (shell.background.loader.valid())
+			shell.background.loader.wait();
+
+		oshu::initialize_clock(&game);
+		double start = game.clock.now;
+		long music_start = lrint(-start * rate);
+		long mixed = 0;
+		int width = std::real(video_size);
+		for (; !shell.finished; ++frame) {
+			double t = start + (double) frame / video_fps;
+			if (video_duration > 0 && t - start >= video_duration)
+				break;
+			advance(&game, t, start);
+			shell.step();
+			std::vector<uint8_t> pixels = oshu::take_frame_buffer(&encoder);
+			if (SDL_RenderReadPixels(display.renderer, NULL, SDL_PIXELFORMAT_RGBA32, pixels.data(), width * 4) < 0) {
+				oshu_log_error("could not read the frame back: %s", SDL_GetError());
+				break;
+			}
+			long next = lrint((double) (frame + 1) / video_fps * rate);
+			std::vector<float> samples;
+			mix(&game.audio, mixed, next, music_start, &samples);
+			mixed = next;
+			if (oshu::encode_frame(&encoder, std::move(pixels), std::move(samples)) < 0)
+				break;
+		}
+	} catch (std::exception &e) {
+		oshu::error_log() << path << ": " << e.what() << std::endl;
+		oshu::close_encoder(&encoder);
+		return -1;
+	}
+	if (oshu::close_encoder(&encoder) < 0)
+		return -1;
+	double elapsed = (oshu::trace_clock() - begin) / 1e9;
+	oshu_log_info("rendered %ld frames in %.1f seconds, %.1f× real time",
+	              frame, elapsed, frame / (double) video_fps / elapsed);
+	return 0;
+}
+
+/**
+ * Parse a `WxH` size, with even dimensions for the video codecs.
+ */
+static int parse_size(const char *value, oshu::size *size)
+{
+	char *x, *end;
+	long width = strtol(value, &x, 10);
+	if (*x != 'x')
+		return -1;
+	long height = strtol(x + 1, &end, 10);
+	if (*end || width < 2 || height < 2 || width % 2 || height % 2)
+		return -1;
+	*size = oshu::size(width, height);
+	return 0;
+}
+
+static int run(int argc, char **argv)
+{
+	const char *output = nullptr;
+	char *end;
+	for (;;) {
+		int c = getopt_long(argc, argv, flags, options, NULL);
+		if (c == -1)
+			break;
+		switch (c) {
+		case OPT_VERBOSE:
+			--oshu::log_priority;
+			break;
+		case OPT_OUTPUT:
+			output = optarg;
+			break;
+		case OPT_SIZE:
+			if (parse_size(optarg, &video_size) < 0) {
+				std::cerr << "invalid size: " << optarg << ", expected WIDTHxHEIGHT with even numbers" << std::endl;
+				return 2;
+			}
+			break;
+		case OPT_FPS:
+			video_fps = strtol(optarg, &end, 10);
+			if (*end || video_fps < 1 || video_fps > 240) {
+				std::cerr << "invalid frame rate: " << optarg << std::endl;
+				return 2;
+			}
+			break;
+		case OPT_DURATION:
+			video_duration = strtod(optarg, &end);
+			if (*end || video_duration <= 0) {
+				std::cerr << "invalid duration: " << optarg << std::endl;
+				return 2;
+			}
+			break;
+		default:
+			return 2;
+		}
+	}
+	if (argc - optind != 1 || !output) {
+		std::cerr << "Usage: oshu-library render [-v] [--size=WxH] [--fps=FPS] [--duration=SECONDS] -o VIDEO BEATMAP" << std::endl;
+		std::cerr << "       oshu-library --help" << std::endl;
+		return 2;
+	}
+	SDL_LogSetAllPriority(SDL_LOG_PRIORITY_WARN);
+	SDL_LogSetPriority(SDL_LOG_CATEGORY_APPLICATION, static_cast<SDL_LogPriority>(oshu::log_priority));
+	if (SDL_Init(SDL_INIT_VIDEO) < 0) {
+		oshu_log_error("SDL initialization error: %s", SDL_GetError());
+		return 1;
+	}
+	int rc = render_beatmap(argv[optind], output);
+	SDL_Quit();
+	return rc < 0 ? 1 : 0;
+}
+
+command render {
+	.name = "render",
+	.run = run,
+};
@@ -0,0 +1,75 @@
+/**
+ * \file src/oshu-library/search.cc
+ *
+ * Command for searching the beatmap index.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <getopt.h>
+#include <iostream>
+
+#include "core/home.h"
+#include "core/log.h"
+#include "library/index.h"
+
+#include "./command.h"
+
+enum option_values {
+	OPT_VERBOSE = 'v',
+};
+
+static struct option options[] = {
+	{"verbose", no_argument, 0, OPT_VERBOSE},
+	{0, 0, 0, 0},
+};
+
+static const char *flags = "v";
+
+static int do_search(const std::string &query)
+{
+	std::string path = oshu::get_cache_directory("library") + "/index";
+	try {
+		oshu::beatmap_index index (path);
+		auto start = std::chrono::steady_clock::now();
+		std::vector<uint32_t> results = index.search(query);
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		oshu::debug_log() << results.size() << " matches among " << index.size() << " beatmaps in " << elapsed.count() << " ms" << std::endl;
+		for (uint32_t i : results) {
+			oshu::beatmap_entry entry = index.entry(i);
+			char stars[16];
+			snprintf(stars, sizeof(stars), "%.2f", entry.stars);
+			std::cout << entry.artist << " - " << entry.title << " [" << entry.version << "] " << stars << "★\t" << entry.path << std::endl;
+		}
+		return results.empty() ? 1 : 0;
+	} catch (std::runtime_error &e) {
+		oshu::error_log() << e.what() << std::endl;
+		oshu::error_log() << "run oshu-library build-index first" << std::endl;
+		return 2;
+	}
+}
+
+static int run(int argc, char **argv)
+{
+	for (;;) {
+		int c = getopt_long(argc, argv, flags, options, NULL);
+		if (c == -1)
+			break;
+		switch (c) {
+		case OPT_VERBOSE:
+			--oshu::log_priority;
+			break;
+		}
+	}
+	std::string query;
+	for (int i = optind; i < argc; ++i)
+		query += std::string(argv[i]) + " ";
+	SDL_LogSetAllPriority(SDL_LOG_PRIORITY_WARN);
+	SDL_LogSetPriority(SDL_LOG_CATEGORY_APPLICATION, static_cast<SDL_LogPriority>(oshu::log_priority));
+	return do_search(query);
+}
+
+command search {
+	.name = "search",
+	.run = run,
+};
@@ -0,0 +1,77 @@
+/**
+ * \file src/oshu-library/simulate.cc
+ *
+ * Command for checking beatmaps by playing them without a window.
+ */
+
+#include <cstdio>
+#include <getopt.h>
+#include <iostream>
+
+#include "beatmap/beatmap.h"
+#include "core/log.h"
+#include "game/osu.h"
+#include "game/simulation.h"
+
+#include "./command.h"
+
+enum option_values {
+	OPT_VERBOSE = 'v',
+};
+
+static struct option options[] = {
+	{"verbose", no_argument, 0, OPT_VERBOSE},
+	{0, 0, 0, 0},
+};
+
+static const char *flags = "v";
+
+/**
+ * Play a beatmap with autoplay, and print its score.
+ */
+static int simulate_beatmap(const char *path)
+{
+	try {
+		oshu::osu_game game(path, true);
+		game.autoplay = true;
+		if (oshu::simulate(&game, {}) < 0)
+			return -1;
+		printf("%.4f\t%s\n", oshu::score(&game.beatmap), path);
+		return 0;
+	} catch (std::exception &e) {
+		oshu::error_log() << path << ": " << e.what() << std::endl;
+		return -1;
+	}
+}
+
+static int run(int argc, char **argv)
+{
+	for (;;) {
+		int c = getopt_long(argc, argv, flags, options, NULL);
+		if (c == -1)
+			break;
+		switch (c) {
+		case OPT_VERBOSE:
+			--oshu::log_priority;
+			break;
+		}
+	}
+	if (argc - optind < 1) {
+		std::cerr << "Usage: oshu-library simulate [-v] BEATMAP..." << std::endl;
+		std::cerr << "       oshu-library --help" << std::endl;
+		return 2;
+	}
+	SDL_LogSetAllPriority(SDL_LOG_PRIORITY_WARN);
+	SDL_LogSetPriority(SDL_LOG_CATEGORY_APPLICATION, static_cast<SDL_LogPriority>(oshu::log_priority));
+	int rc = 0;
+	for (int i = optind; i < argc; ++i) {
+		if (simulate_beatmap(argv[i]) < 0)
+			rc = 1;
+	}
+	return rc;
+}
+
+command simulate {
+	.name = "simulate",
+	.run = run,
+};
@@ -0,0 +1,186 @@
+/**
+ * \file src/oshu-library/watch.cc
+ *
+ * Command for keeping the HTML and binary beatmap indexes up to date.
+ */
+
+#include <csignal>
+#include <getopt.h>
+#include <iostream>
+#include <map>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "core/home.h"
+#include "core/log.h"
+#include "core/memory.h"
+#include "library/beatmaps.h"
+#include "library/html.h"
+#include "library/index.h"
+#include "library/watch.h"
+
+#include "./command.h"
+
+enum option_values {
+	OPT_VERBOSE = 'v',
+};
+
+static struct option options[] = {
+	{"verbose", no_argument, 0, OPT_VERBOSE},
+	{0, 0, 0, 0},
+};
+
+static const char *flags = "v";
+
+/**
+ * How long the library must stay still before the index is rewritten, in
+ * seconds.
+ *
+ * Copying or extracting a set generates a burst of events, and there's no
+ * point rebuilding the index for every file of it.
+ */
+static const double quiet_period = 1.;
+
+static void change_directory(const std::string &path)
+{
+	if (chdir(path.c_str()) < 0)
+		throw std::system_error(errno, std::system_category(), "could not chdir to " + path);
+	else
+		oshu::debug_log() << "moving to " << path << std::endl;
+}
+
+/**
+ * The state of the library, by set path.
+ */
+struct library {
+	oshu::html_index listing;
+	std::map<std::string, std::vector<oshu::beatmap_entry>> entries;
+	void update(const oshu::beatmap_set &set);
+	void remove(const std::string &path);
+};
+
+void library::update(const oshu::beatmap_set &set)
+{
+	listing.update(set);
+	if (set.empty())
+		entries.erase(set.path);
+	else
+		entries[set.path] = set.entries;
+}
+
+void library::remove(const std::string &path)
+{
+	listing.remove(path);
+	entries.erase(path);
+}
+
+/**
+ * Write the HTML index, which only rewrites the shards of the sets that
+ * changed, each atomically so that a web browser never sees a partial page.
+ * The binary index is saved atomically too.
+ */
+static void write_indexes(const library &lib, const std::string &cache)
+{
+	size_t written = lib.listing.write_shards(".");
+	std::vector<oshu::beatmap_entry> all;
+	for (auto &set : lib.entries)
+		all.insert(all.end(), set.second.begin(), set.second.end());
+	oshu::save_beatmap_index(cache + "/index", std::move(all));
+	oshu::debug_log() << "wrote the index of " << lib.listing.size() << " beatmap sets, rewriting "
+	                  << written << " HTML files" << std::endl;
+}
+
+/**
+ * Parse a set again, or drop it from the library if it is gone.
+ */
+static void rescan_set(library &lib, const std::string &path)
+{
+	struct stat s;
+	if (stat(path.c_str(), &s) < 0) {
+		oshu::info_log() << "removed " << path << std::endl;
+		lib.remove(path);
+		return;
+	}
+	try {
+		oshu::beatmap_set set(path);
+		oshu::info_log() << "updated " << path << std::endl;
+		lib.update(set);
+	} catch (std::system_error &e) {
+		oshu::debug_log() << e.what() << std::endl;
+		lib.remove(path);
+	}
+}
+
+static volatile std::sig_atomic_t stop = 0;
+
+static void signal_handler(int)
+{
+	stop = 1;
+}
+
+static void do_watch()
+{
+	std::string home = oshu::get_oshu_home();
+	oshu::info_log() << "oshu! home directory: " << home << std::endl;
+	oshu::ensure_directory(home);
+	oshu::ensure_directory(home + "/web");
+	change_directory(home + "/web");
+	std::string cache = oshu::get_cache_directory("library");
+	std::string manifest = cache + "/manifest";
+	std::string beatmaps = "../beatmaps";
+
+	/* Watch before scanning, so that no change is missed in-between. */
+	oshu::library_watcher watcher(beatmaps);
+	library lib;
+	lib.listing.previews = oshu::load_preview_map("previews/index");
+	oshu::scan_beatmap_sets(beatmaps, manifest, [&](oshu::beatmap_set &&set) { lib.update(set); });
+	write_indexes(lib, cache);
+	std::cout << home << "/web/index.html" << std::endl;
+
+	std::signal(SIGINT, signal_handler);
+	std::signal(SIGTERM, signal_handler);
+	while (!stop) {
+		oshu::library_changes changes;
+		if (!watcher.wait(&changes, quiet_period))
+			continue;
+		if (changes.overflow) {
+			oshu::warning_log() << "too many changes, scanning the whole library again" << std::endl;
+			lib = library();
+			oshu::scan_beatmap_sets(beatmaps, manifest, [&](oshu::beatmap_set &&set) { lib.update(set); });
+		} else {
+			for (const std::string &path : changes.sets)
+				rescan_set(lib, path);
+		}
+		write_indexes(lib, cache);
+	}
+	oshu::log_memory_usage();
+	oshu::info_log() << "stopping" << std::endl;
+}
+
+static int run(int argc, char **argv)
+{
+	for (;;) {
+		int c = getopt_long(argc, argv, flags, options, NULL);
+		if (c == -1)
+			break;
+		switch (c) {
+		case OPT_VERBOSE:
+			--oshu::log_priority;
+			break;
+		}
+	}
+	if (argc - optind != 0) {
+		std::cerr << "Usage: oshu-library watch [-v]" << std::endl;
+		std::cerr << "       oshu-library --help" << std::endl;
+		return 2;
+	}
+	SDL_LogSetAllPriority(SDL_LOG_PRIORITY_WARN);
+	SDL_LogSetPriority(SDL_LOG_CATEGORY_APPLICATION, static_cast<SDL_LogPriority>(oshu::log_priority));
+	do_watch();
+	return 0;
+}
+
+command watch {
+	.name = "watch",
+	.run = run,
+};
@@ -9,11 +9,18 @@
 
 #include "config.h"
 
+#include "core/hash.h"
 #include "core/log.h"
+#include "core/trace.h"
+#include "core/vfs.h"
 #include "game/base.h"
+#include "game/mania.h"
 #include "game/osu.h"
-#include "ui/shell.h"
+#include "game/replay.h"
+#include "game/spectator.h"
+#include "ui/mania.h"
 #include "ui/osu.h"
+#include "ui/shell.h"
 #include "video/display.h"
 
 extern "C" {
@@ -23,10 +30,15 @@ extern "C" {
 #include <SDL2/SDL.h>
 
 #include <errno.h>
+#include <future>
 #include <getopt.h>
 #include <signal.h>
+#include <stdexcept>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string>
 #include <unistd.h>
+#include <vector>
 
 enum option_values {
 	OPT_AUTOPLAY = 0x10000,
@@ -34,12 +46,22 @@ enum option_values {
 	OPT_PAUSE = 0x10001,
 	OPT_VERBOSE = 'v',
 	OPT_VERSION = 0x10002,
+	OPT_RECORD = 0x10003,
+	OPT_RATE = 0x10004,
+	OPT_KEEP_PITCH = 0x10005,
+	OPT_BROADCAST = 0x10006,
+	OPT_SPECTATE = 0x10007,
 };
 
 static struct option options[] = {
 	{"autoplay", no_argument, 0, OPT_AUTOPLAY},
+	{"broadcast", required_argument, 0, OPT_BROADCAST},
 	{"help", no_argument, 0, OPT_HELP},
+	{"keep-pitch", no_argument, 0, OPT_KEEP_PITCH},
 	{"pause", no_argument, 0, OPT_PAUSE},
+	{"rate", required_argument, 0, OPT_RATE},
+	{"record", required_argument, 0, OPT_RECORD},
+	{"spectate", required_argument, 0, OPT_SPECTATE},
 	{"verbose", no_argument, 0, OPT_VERBOSE},
 	{"version", no_argument, 0, OPT_VERSION},
 	{0, 0, 0, 0},
@@ -48,7 +70,7 @@ static struct option options[] = {
 static const char *flags = "vh";
 
 static const char *usage =
-	"Usage: oshu [OPTION]... BEATMAP.osu\n"
+	"Usage: oshu [OPTION]... BEATMAP.osu...\n"
 	"       oshu --help\n"
 ;
 
@@ -59,6 +81,11 @@ static const char *help =
 	"  --version           Output version information.\n"
 	"  --autoplay          Perform a perfect run.\n"
 	"  --pause             Start the game paused.\n"
+	"  --record=FILE       Save a replay of the game in FILE.\n"
+	"  --rate=RATE         Play the music RATE times faster, from 0.5 to 2.\n"
+	"  --keep-pitch        Keep the pitch of the music with --rate.\n"
+	"  --broadcast=ADDRESS Stream the game live to a spectator at ADDRESS.\n"
+	"  --spectate=ADDRESS  Watch the game streamed to ADDRESS.\n"
 	"\n"
 	"Check the man page oshu(1) for details.\n"
 ;
@@ -79,26 +106,140 @@ static void signal_handler(int signum)
 		w->close();
 }
 
-int run(const char *beatmap_path, int autoplay, int pause)
+/**
+ * Tempo of the music, set by `--rate`, and whether `--keep-pitch` was
+ * passed.
+ */
+static double music_rate = 1.;
+static bool keep_pitch = false;
+
+/**
+ * Create the game of the beatmap's mode, after peeking at its headers.
+ */
+static std::unique_ptr<oshu::game_base> open_game(const char *path)
+{
+	oshu::beatmap headers {};
+	if (oshu::load_beatmap_headers(path, &headers) < 0)
+		throw std::runtime_error("could not load the beatmap");
+	enum oshu::mode mode = headers.mode;
+	oshu::destroy_beatmap(&headers);
+	if (mode == oshu::MANIA_MODE)
+		return std::make_unique<oshu::mania_game>(path);
+	return std::make_unique<oshu::osu_game>(path);
+}
+
+/**
+ * Load a game on another thread, and prepare its background for a view of
+ * size *screen*, unless it is zero.
+ *
+ * For the game to play right after the previous one, everything that takes
+ * time is done here: parsing the beatmap, opening the audio, which starts
+ * decoding it at the #music_rate, loading the samples, and scaling the
+ * background.
+ */
+static std::future<std::unique_ptr<oshu::game_base>> prefetch(const std::string &path, oshu::size screen)
+{
+	return std::async(std::launch::async, [path, screen]() {
+		std::unique_ptr<oshu::game_base> game = open_game(path.c_str());
+		if (music_rate != 1. && oshu::set_music_rate(&game->audio, music_rate, keep_pitch) < 0)
+			throw std::runtime_error("could not change the rate of the music");
+		if (game->beatmap.background_filename && screen != 0.)
+			oshu::prefetch_background(game->asset_path(game->beatmap.background_filename).c_str(), screen);
+		return game;
+	});
+}
+
+/**
+ * Play the beatmaps one after the other, in the same window.
+ *
+ * Every beatmap is loaded while the previous one plays. When the user quits a
+ * game, the playlist stops.
+ *
+ * The replay can only be recorded when there's a single beatmap, and only a
+ * single beatmap may be spectated.
+ */
+int run(const std::vector<std::string> &beatmap_paths, int autoplay, int pause, const char *record_path,
+        const char *broadcast_address, const char *spectate_address)
 {
 	int rc = 0;
 
+	int64_t start = oshu::trace_clock();
 	if (SDL_Init(SDL_INIT_VIDEO|SDL_INIT_AUDIO) < 0) {
 		oshu_log_error("SDL initialization error: %s", SDL_GetError());
 		return -1;
 	}
+	oshu::log_startup("initializing SDL", start);
 
 	try {
-		oshu::osu_game game(beatmap_path);
-		game.autoplay = autoplay;
-		if (pause)
-			game.pause();
-
+		/* Open the window while the first beatmap loads. */
+		std::future<std::unique_ptr<oshu::game_base>> next = prefetch(beatmap_paths[0], 0);
+		start = oshu::trace_clock();
 		oshu::display display;
-		std::shared_ptr<oshu::shell> shell = std::make_shared<oshu::shell>(display, game);
-		shell->game_view = std::make_unique<oshu::osu_ui>(&display, game);
-		current_shell = shell;
-		shell->open();
+		oshu::reset_view(&display);
+		oshu::log_startup("opening the window", start);
+		oshu::size screen = display.view.size;
+		for (size_t i = 0; i < beatmap_paths.size(); ++i) {
+			std::unique_ptr<oshu::game_base> game;
+			try {
+				game = next.get();
+			} catch (std::exception &e) {
+				oshu::error_log() << beatmap_paths[i] << ": " << e.what() << std::endl;
+				rc = -1;
+			}
+			if (i + 1 < beatmap_paths.size())
+				next = prefetch(beatmap_paths[i + 1], screen);
+			if (!game)
+				continue;
+
+			game->autoplay = autoplay;
+			if (pause && i == 0)
+				game->pause();
+			uint64_t beatmap_hash = 0;
+			if (record_path || broadcast_address || spectate_address)
+				oshu::hash_file(beatmap_paths[i].c_str(), &beatmap_hash);
+			oshu::replay replay;
+			if (record_path) {
+				replay.beatmap_hash = beatmap_hash;
+				game->recording = &replay;
+			}
+
+			/* Start painting the sprites in the background before the
+			 * shell paints its own textures. */
+			std::unique_ptr<oshu::widget> view;
+			if (game->beatmap.mode == oshu::MANIA_MODE)
+				view = std::make_unique<oshu::mania_ui>(&display, static_cast<oshu::mania_game&>(*game));
+			else
+				view = std::make_unique<oshu::osu_ui>(&display, static_cast<oshu::osu_game&>(*game));
+			std::shared_ptr<oshu::shell> shell = std::make_shared<oshu::shell>(display, *game);
+			shell->game_view = std::move(view);
+			shell->continuous = i + 1 < beatmap_paths.size();
+			current_shell = shell;
+			oshu::publisher publisher;
+			if (broadcast_address) {
+				if (oshu::open_publisher(broadcast_address, beatmap_hash, &publisher) < 0) {
+					rc = -1;
+					break;
+				}
+				game->publishing = &publisher;
+			}
+			oshu::spectator spectator;
+			if (spectate_address) {
+				if (oshu::open_spectator(spectate_address, beatmap_hash, &spectator) < 0) {
+					oshu::close_publisher(&publisher);
+					rc = -1;
+					break;
+				}
+				game->spectating = &spectator;
+				game->mouse = spectator.mouse;
+			}
+			shell->open();
+			oshu::close_publisher(&publisher);
+			oshu::close_spectator(&spectator);
+			if (record_path && oshu::save_replay(&replay, record_path) < 0)
+				rc = -1;
+			if (!shell->finished)
+				break;
+		}
 	} catch (std::exception &e) {
 		oshu::critical_log() << e.what() << std::endl;
 		rc = -1;
@@ -108,10 +249,30 @@ int run(const char *beatmap_path, int autoplay, int pause)
 	return rc;
 }
 
+/**
+ * Make a path absolute, following the archive it goes through, if any.
+ *
+ * \return an empty string if the file doesn't exist.
+ */
+static std::string absolute_path(const char *path)
+{
+	std::string archive, member;
+	bool archived = oshu::split_archive_path(path, &archive, &member);
+	char *real = realpath(archived ? archive.c_str() : path, NULL);
+	if (!real)
+		return "";
+	std::string result = real;
+	free(real);
+	return archived ? result + "/" + member : result;
+}
+
 int main(int argc, char **argv)
 {
 	int autoplay = 0;
 	int pause = 0;
+	std::string record_path;
+	std::string broadcast_address;
+	std::string spectate_address;
 
 	for (;;) {
 		int c = getopt_long(argc, argv, flags, options, NULL);
@@ -131,6 +292,25 @@ int main(int argc, char **argv)
 		case OPT_PAUSE:
 			pause = 1;
 			break;
+		case OPT_RECORD:
+			record_path = optarg;
+			break;
+		case OPT_BROADCAST:
+			broadcast_address = optarg;
+			break;
+		case OPT_SPECTATE:
+			spectate_address = optarg;
+			break;
+		case OPT_RATE:
+			music_rate = atof(optarg);
+			if (music_rate < .5 || music_rate > 2.) {
+				oshu_log_error("the rate must be between 0.5 and 2");
+				return 2;
+			}
+			break;
+		case OPT_KEEP_PITCH:
+			keep_pitch = true;
+			break;
 		case OPT_VERSION:
 			fputs(version, stdout);
 			return 0;
@@ -140,37 +320,87 @@ int main(int argc, char **argv)
 		}
 	}
 
-	if (argc - optind != 1) {
+	if (argc - optind < 1) {
 		fputs(usage, stderr);
 		return 2;
 	}
+	if (argc - optind > 1 && !record_path.empty()) {
+		oshu_log_error("a replay can only be recorded for a single beatmap");
+		return 2;
+	}
+	if (!spectate_address.empty() && (argc - optind > 1 || autoplay)) {
+		oshu_log_error("--spectate takes a single beatmap, and no --autoplay");
+		return 2;
+	}
 
 	SDL_LogSetAllPriority(SDL_LOG_PRIORITY_WARN);
 	SDL_LogSetPriority(SDL_LOG_CATEGORY_APPLICATION, static_cast<SDL_LogPriority>(oshu::log_priority));
 	av_log_set_level(oshu::log_priority <= oshu::log_level::debug ? AV_LOG_INFO : AV_LOG_ERROR);
 
-	char *beatmap_path = realpath(argv[optind], NULL);
-	if (beatmap_path == NULL) {
-		oshu_log_error("cannot locate %s", argv[optind]);
-		return 3;
+	/* The replay path must not be relative to the beatmap's directory, nor
+	 * the socket paths. */
+	for (std::string *path : {&record_path, &broadcast_address, &spectate_address}) {
+		bool file = path == &record_path || path->find('/') != std::string::npos;
+		if (!path->empty() && file && (*path)[0] != '/') {
+			char *cwd = getcwd(NULL, 0);
+			if (cwd) {
+				*path = std::string(cwd) + "/" + *path;
+				free(cwd);
+			}
+		}
 	}
 
-	char *beatmap_file = beatmap_path;
-	char *slash = strrchr(beatmap_path, '/');
-	if (slash) {
-		*slash = '\0';
-		oshu_log_debug("changing the current directory to %s", beatmap_path);
-		if (chdir(beatmap_path) < 0) {
-			oshu_log_error("error while changing directory: %s", strerror(errno));
+	std::vector<std::string> beatmap_files;
+	char *beatmap_path = nullptr;
+	std::string archive, member;
+	if (argc - optind > 1) {
+		/* Playlists don't change the current directory, since it would
+		 * disturb the game playing while the next one loads. The
+		 * assets are resolved against the beatmaps' absolute path
+		 * instead. */
+		for (int i = optind; i < argc; ++i) {
+			std::string path = absolute_path(argv[i]);
+			if (path.empty()) {
+				oshu_log_error("cannot locate %s", argv[i]);
+				return 3;
+			}
+			beatmap_files.push_back(path);
+		}
+	} else {
+		/* For a beatmap inside an .osz, the archive acts as the directory. */
+		bool archived = oshu::split_archive_path(argv[optind], &archive, &member);
+
+		beatmap_path = realpath(archived ? archive.c_str() : argv[optind], NULL);
+		if (beatmap_path == NULL) {
+			oshu_log_error("cannot locate %s", argv[optind]);
 			return 3;
 		}
-		beatmap_file = slash + 1;
+		if (archived && oshu::enter_archive(beatmap_path) < 0)
+			return 3;
+
+		const char *beatmap_file = beatmap_path;
+		char *slash = strrchr(beatmap_path, '/');
+		if (slash) {
+			*slash = '\0';
+			oshu_log_debug("changing the current directory to %s", beatmap_path);
+			if (chdir(beatmap_path) < 0) {
+				oshu_log_error("error while changing directory: %s", strerror(errno));
+				return 3;
+			}
+			beatmap_file = slash + 1;
+		}
+		if (archived)
+			beatmap_file = member.c_str();
+		beatmap_files.push_back(beatmap_file);
 	}
 
 	signal(SIGTERM, signal_handler);
 	signal(SIGINT, signal_handler);
 
-	if (run(beatmap_file, autoplay, pause) < 0) {
+	const char *record = record_path.empty() ? NULL : record_path.c_str();
+	const char *broadcast = broadcast_address.empty() ? NULL : broadcast_address.c_str();
+	const char *spectate = spectate_address.empty() ? NULL : spectate_address.c_str();
+	if (run(beatmap_files, autoplay, pause, record, broadcast, spectate) < 0) {
 		if (!isatty(fileno(stdout)))
 			SDL_ShowSimpleMessageBox(
 				SDL_MESSAGEBOX_ERROR,
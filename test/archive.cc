@@ -0,0 +1,175 @@
+/**
+ * \file test/archive.cc
+ *
+ * Write a small .osz archive with a stored beatmap and a deflated text file,
+ * then read them through the virtual filesystem.
+ */
+
+#include "beatmap/beatmap.h"
+#include "core/vfs.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include <zlib.h>
+
+static const char *zerotokei = "Kaori Oda - Zero Tokei (Short ver.) (ShogunMoon) [Shining].osu";
+static const char *archive_path = "test.osz";
+
+static void put16(std::string &out, uint16_t value)
+{
+	out += (char) (value & 0xFF);
+	out += (char) (value >> 8);
+}
+
+static void put32(std::string &out, uint32_t value)
+{
+	put16(out, value & 0xFFFF);
+	put16(out, value >> 16);
+}
+
+struct member {
+	std::string name;
+	std::string contents;
+	bool deflate;
+};
+
+/**
+ * Compress to a raw deflate stream, like zip archives store it.
+ */
+static std::string deflate_raw(const std::string &data)
+{
+	std::string out (compressBound(data.size()), '\0');
+	z_stream z {};
+	deflateInit2(&z, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+	z.next_in = (Bytef*) data.data();
+	z.avail_in = data.size();
+	z.next_out = (Bytef*) &out[0];
+	z.avail_out = out.size();
+	deflate(&z, Z_FINISH);
+	out.resize(z.total_out);
+	deflateEnd(&z);
+	return out;
+}
+
+/**
+ * Write a zip archive, with the local headers, the central directory and its
+ * end record.
+ */
+static void write_zip(const char *path, const std::vector<member> &members)
+{
+	std::string zip, central;
+	for (const member &m : members) {
+		std::string data = m.deflate ? deflate_raw(m.contents) : m.contents;
+		uint32_t crc = crc32(0, (const Bytef*) m.contents.data(), m.contents.size());
+		uint32_t offset = zip.size();
+		put32(zip, 0x04034b50);
+		put16(zip, 20);
+		put16(zip, 0);
+		put16(zip, m.deflate ? Z_DEFLATED : 0);
+		put32(zip, 0);
+		put32(zip, crc);
+		put32(zip, data.size());
+		put32(zip, m.contents.size());
+		put16(zip, m.name.size());
+		put16(zip, 0);
+		zip += m.name;
+		zip += data;
+		put32(central, 0x02014b50);
+		put16(central, 20);
+		put16(central, 20);
+		put16(central, 0);
+		put16(central, m.deflate ? Z_DEFLATED : 0);
+		put32(central, 0);
+		put32(central, crc);
+		put32(central, data.size());
+		put32(central, m.contents.size());
+		put16(central, m.name.size());
+		put16(central, 0);
+		put16(central, 0);
+		put16(central, 0);
+		put16(central, 0);
+		put32(central, 0);
+		put32(central, offset);
+		central += m.name;
+	}
+	uint32_t central_offset = zip.size();
+	zip += central;
+	put32(zip, 0x06054b50);
+	put16(zip, 0);
+	put16(zip, 0);
+	put16(zip, members.size());
+	put16(zip, members.size());
+	put32(zip, central.size());
+	put32(zip, central_offset);
+	put16(zip, 0);
+	std::ofstream out(path, std::ios::binary);
+	out << zip;
+}
+
+/**
+ * Open a member, and compare it with what was archived.
+ */
+static int check_member(const char *path, const std::string &expected, bool inflated)
+{
+	oshu::file_view file;
+	if (oshu::open_file(path, &file) < 0) {
+		std::cerr << "could not open " << path << std::endl;
+		return 1;
+	}
+	int failures = 0;
+	if (std::string(file.data, file.size) != expected) {
+		std::cerr << "unexpected contents for " << path << std::endl;
+		++failures;
+	}
+	if (!file.archive || (file.buffer != nullptr) != inflated) {
+		std::cerr << path << " should be " << (inflated ? "inflated" : "read in place") << std::endl;
+		++failures;
+	}
+	oshu::close_file(&file);
+	return failures;
+}
+
+int main()
+{
+	std::string beatmap;
+	{
+		std::ifstream in(zerotokei, std::ios::binary);
+		beatmap.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	}
+	std::string text;
+	for (int i = 0; i < 100; ++i)
+		text += "Zero Tokei, line " + std::to_string(i) + "\n";
+	write_zip(archive_path, {
+		{"Map.osu", beatmap, false},
+		{"sub\\Notes.txt", text, true},
+	});
+
+	int failures = 0;
+	failures += check_member("test.osz/Map.osu", beatmap, false);
+	failures += check_member("test.osz/map.OSU", beatmap, false);
+	failures += check_member("test.osz/SUB/notes.txt", text, true);
+	if (!oshu::in_archive("test.osz/sub/notes.txt") || oshu::file_exists("test.osz/missing.txt")) {
+		std::cerr << "wrong member lookup" << std::endl;
+		++failures;
+	}
+	oshu::beatmap b;
+	if (oshu::load_beatmap("test.osz/Map.osu", &b) < 0) {
+		std::cerr << "could not load the archived beatmap" << std::endl;
+		++failures;
+	} else {
+		if (std::strcmp(b.metadata.title, "Zero Tokei (Short ver.)")) {
+			std::cerr << "unexpected title: " << b.metadata.title << std::endl;
+			++failures;
+		}
+		oshu::destroy_beatmap(&b);
+	}
+	unlink(archive_path);
+	if (failures > 0)
+		std::cerr << "Total: " << failures << " failed tests." << std::endl;
+	return failures;
+}
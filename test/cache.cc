@@ -0,0 +1,158 @@
+/**
+ * \file test/cache.cc
+ *
+ * Write the Zero Tokei beatmap to a cache file, load it back, and compare it
+ * with a fresh parse. Then make sure stale and corrupt caches are rejected.
+ */
+
+#include "beatmap/beatmap.h"
+#include "beatmap/cache.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <unistd.h>
+
+static const char *zerotokei = "Kaori Oda - Zero Tokei (Short ver.) (ShogunMoon) [Shining].osu";
+static const char *other = "../bench/corpus/negative-repeat.osu";
+static const char *cache_path = "test.oshub";
+
+static int compare_hits(oshu::hit *a, oshu::hit *b)
+{
+	int count = 0;
+	for (a = a->next, b = b->next; a->next && b->next; a = a->next, b = b->next, ++count) {
+		if (a->time != b->time || a->type != b->type || a->p != b->p
+		    || a->combo != b->combo || a->combo_seq != b->combo_seq
+		    || a->timing_point->offset != b->timing_point->offset
+		    || a->color->red != b->color->red) {
+			std::cerr << "hit #" << count << " differs" << std::endl;
+			return 1;
+		}
+		if (a->type & oshu::SLIDER_HIT) {
+			if (a->slider.repeat != b->slider.repeat || a->slider.duration != b->slider.duration
+			    || oshu::end_point(a) != oshu::end_point(b)
+			    || oshu::path_at(&a->slider.path, .5) != oshu::path_at(&b->slider.path, .5)) {
+				std::cerr << "slider #" << count << " differs" << std::endl;
+				return 1;
+			}
+		}
+	}
+	if (a->next || b->next) {
+		std::cerr << "different hit counts" << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+static int compare(oshu::beatmap *a, oshu::beatmap *b)
+{
+	int failures = 0;
+	if (std::strcmp(a->metadata.title, b->metadata.title)
+	    || std::strcmp(a->metadata.version, b->metadata.version)
+	    || std::strcmp(a->audio_filename, b->audio_filename)) {
+		std::cerr << "different metadata" << std::endl;
+		++failures;
+	}
+	if (a->difficulty.circle_radius != b->difficulty.circle_radius
+	    || a->difficulty.approach_time != b->difficulty.approach_time
+	    || a->difficulty.overall_difficulty != b->difficulty.overall_difficulty) {
+		std::cerr << "different difficulty" << std::endl;
+		++failures;
+	}
+	if (a->timing_point_count != b->timing_point_count || a->color_count != b->color_count) {
+		std::cerr << "different timing point or colour counts" << std::endl;
+		++failures;
+	}
+	for (int i = 0; i < a->timing_point_count && i < b->timing_point_count; ++i) {
+		oshu::timing_point *ta = a->timing_index[i], *tb = b->timing_index[i];
+		if (ta->offset != tb->offset || ta->beat_duration != tb->beat_duration) {
+			std::cerr << "timing point #" << i << " differs" << std::endl;
+			++failures;
+			break;
+		}
+	}
+	failures += compare_hits(a->hits, b->hits);
+	return failures;
+}
+
+static int test_round_trip()
+{
+	oshu::beatmap parsed, cached;
+	if (oshu::load_beatmap(zerotokei, &parsed) < 0)
+		return 1;
+	int failures = 0;
+	if (oshu::save_beatmap_cache(cache_path, zerotokei, &parsed) < 0) {
+		std::cerr << "could not save the cache" << std::endl;
+		++failures;
+	} else if (oshu::load_beatmap_cache(cache_path, zerotokei, &cached) < 0) {
+		std::cerr << "could not load the cache" << std::endl;
+		++failures;
+	} else {
+		failures += compare(&parsed, &cached);
+		oshu::destroy_beatmap(&cached);
+	}
+	oshu::destroy_beatmap(&parsed);
+	return failures;
+}
+
+/**
+ * The cache was built from Zero Tokei, so it is stale for any other file.
+ */
+static int test_stale()
+{
+	oshu::beatmap b;
+	if (oshu::load_beatmap_cache(cache_path, other, &b) == 0) {
+		std::cerr << "a stale cache was accepted" << std::endl;
+		oshu::destroy_beatmap(&b);
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * Flip a byte at *offset* from the end of the cache, or truncate the cache
+ * by that many bytes.
+ */
+static int test_corrupt(size_t offset, bool truncate)
+{
+	std::string data;
+	{
+		std::ifstream in(cache_path, std::ios::binary);
+		data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	}
+	std::string corrupt = data;
+	if (truncate)
+		corrupt.resize(corrupt.size() - offset);
+	else
+		corrupt[corrupt.size() - offset] ^= 0x40;
+	{
+		std::ofstream out(cache_path, std::ios::binary);
+		out << corrupt;
+	}
+	int failures = 0;
+	oshu::beatmap b;
+	if (oshu::load_beatmap_cache(cache_path, zerotokei, &b) == 0) {
+		std::cerr << "a corrupt cache was accepted" << std::endl;
+		oshu::destroy_beatmap(&b);
+		++failures;
+	}
+	std::ofstream out(cache_path, std::ios::binary);
+	out << data;
+	return failures;
+}
+
+int main()
+{
+	int failures = 0;
+	failures += test_round_trip();
+	failures += test_stale();
+	failures += test_corrupt(1, false);
+	failures += test_corrupt(100, false);
+	failures += test_corrupt(8, true);
+	unlink(cache_path);
+	if (failures > 0)
+		std::cerr << "Total: " << failures << " failed tests." << std::endl;
+	return failures;
+}
@@ -0,0 +1,124 @@
+/**
+ * \file test/hit_index.cc
+ *
+ * Compare #oshu::hit_range and #oshu::find_hit_at with linear walks of the
+ * hits of the Zero Tokei beatmap.
+ */
+
+#include "beatmap/beatmap.h"
+#include "beatmap/hit_index.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+static const char *zerotokei = "Kaori Oda - Zero Tokei (Short ver.) (ShogunMoon) [Shining].osu";
+
+/**
+ * Check that the hits overlapping [*start*, *end*] are all in the range
+ * returned by #oshu::hit_range, and that the hits out of the range don't
+ * overlap the window.
+ */
+static int check_range(oshu::beatmap *beatmap, oshu::hit_index *index, double start, double end)
+{
+	int first, last;
+	oshu::hit_range(index, start, end, &first, &last);
+	int i = 1;
+	for (oshu::hit *hit = beatmap->hits->next; hit->next; hit = hit->next, ++i) {
+		bool overlaps = oshu::hit_end_time(hit) >= start && hit->time <= end;
+		bool inside = i >= first && i < last;
+		if (overlaps && !inside) {
+			std::cerr << "hit #" << i << " overlaps [" << start << ", " << end
+			          << "] but is not in [" << first << ", " << last << ")" << std::endl;
+			return 1;
+		}
+		if (!inside && hit->time <= end && i >= last) {
+			std::cerr << "hit #" << i << " starts before " << end
+			          << " but is after the range" << std::endl;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * The reference for #oshu::find_hit_at: walk the list from the first hit that
+ * ends after *start*, or is preceded by one that does.
+ */
+static oshu::hit* walk(oshu::beatmap *beatmap, oshu::point p, double radius, double start, double end)
+{
+	double max_end = -INFINITY;
+	for (oshu::hit *hit = beatmap->hits->next; hit->next; hit = hit->next) {
+		max_end = std::max(max_end, oshu::hit_end_time(hit));
+		if (max_end < start)
+			continue;
+		if (hit->time > end)
+			break;
+		if (!(hit->type & (oshu::CIRCLE_HIT | oshu::SLIDER_HIT)) || hit->state != oshu::INITIAL_HIT)
+			continue;
+		if (std::abs(hit->p - p) <= radius)
+			return hit;
+	}
+	return NULL;
+}
+
+static int check_find(oshu::beatmap *beatmap, oshu::hit_index *index, oshu::point p, double start, double end)
+{
+	double radius = beatmap->difficulty.circle_radius;
+	oshu::hit *expected = walk(beatmap, p, radius, start, end);
+	oshu::hit *got = oshu::find_hit_at(index, p, radius, start, end);
+	if (got != expected) {
+		std::cerr << "find_hit_at(" << p << ", " << start << ", " << end << "): expected the hit at "
+		          << (expected ? expected->time : -1) << ", got " << (got ? got->time : -1) << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * Look for hits at the center of every hit, and half a radius and a radius
+ * and a half away from it, in a window around its start time.
+ */
+static int test_find(oshu::beatmap *beatmap, oshu::hit_index *index)
+{
+	int failures = 0;
+	double radius = beatmap->difficulty.circle_radius;
+	double window = beatmap->difficulty.leniency;
+	for (oshu::hit *hit = beatmap->hits->next; hit->next && failures < 10; hit = hit->next) {
+		oshu::point offsets[] = {0, radius / 2, oshu::point(0, -radius * 1.5)};
+		for (oshu::point offset : offsets)
+			failures += check_find(beatmap, index, hit->p + offset, hit->time - window, hit->time + window);
+	}
+	failures += check_find(beatmap, index, oshu::point(-100, -100), -INFINITY, INFINITY);
+	failures += check_find(beatmap, index, oshu::point(256, 192), -INFINITY, INFINITY);
+	return failures;
+}
+
+int main()
+{
+	oshu::beatmap b;
+	if (oshu::load_beatmap(zerotokei, &b) < 0)
+		return 1;
+	oshu::hit_index index;
+	oshu::build_hit_index(&b, &index);
+	int failures = 0;
+	double last = index.times[index.times.size() - 2];
+	for (double t = -1; t < last + 1 && failures < 10; t += .05) {
+		failures += check_range(&b, &index, t, t + .1);
+		failures += check_range(&b, &index, t, t + 1);
+	}
+	failures += test_find(&b, &index);
+	/* Play every other hit, and look again. */
+	int i = 0;
+	for (oshu::hit *hit = b.hits->next; hit->next; hit = hit->next, ++i) {
+		if (i % 2 == 0) {
+			hit->state = oshu::GOOD_HIT;
+			oshu::sync_hit_state(&index, hit);
+		}
+	}
+	failures += test_find(&b, &index);
+	oshu::destroy_beatmap(&b);
+	if (failures > 0)
+		std::cerr << "Total: " << failures << " failed tests." << std::endl;
+	return failures;
+}
@@ -0,0 +1,109 @@
+/**
+ * \file test/index.cc
+ *
+ * Build a small beatmap index, search it, and make sure a corrupted index is
+ * rejected.
+ */
+
+#include "library/index.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+
+static const char *index_path = "test.oshui";
+
+static oshu::beatmap_entry make_entry(const char *artist, const char *title, const char *version, uint64_t hash)
+{
+	oshu::beatmap_entry e;
+	e.artist = artist;
+	e.title = title;
+	e.version = version;
+	e.path = std::string(title) + ".osu";
+	e.hash = hash;
+	return e;
+}
+
+static int test_search(const oshu::beatmap_index &index, const char *query, size_t expected)
+{
+	std::vector<uint32_t> results = index.search(query);
+	if (results.size() != expected) {
+		std::cerr << "search \"" << query << "\": expected " << expected
+		          << " results, got " << results.size() << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+static int test_build()
+{
+	int failures = 0;
+	std::vector<oshu::beatmap_entry> entries;
+	entries.push_back(make_entry("Kaori Oda", "Zero Tokei (Short ver.)", "Shining", 1));
+	entries.push_back(make_entry("Kaori Oda", "Zero Tokei (Short ver.)", "Easy", 2));
+	entries.push_back(make_entry("Unknown", "Silence", "Normal", 3));
+	/* the same beatmap in another directory, indexed once */
+	entries.push_back(make_entry("Kaori Oda", "Zero Tokei (Short ver.)", "Shining", 1));
+	entries.back().path = "copy.osu";
+	oshu::save_beatmap_index(index_path, entries);
+	oshu::beatmap_index index (index_path);
+	if (index.size() != 3) {
+		std::cerr << "expected 3 entries, got " << index.size() << std::endl;
+		return 1;
+	}
+	oshu::beatmap_entry first = index.entry(0);
+	if (first.artist.str() != "Kaori Oda" || first.version.str() != "Easy") {
+		std::cerr << "unexpected first entry: " << first.artist << " [" << first.version << "]" << std::endl;
+		++failures;
+	}
+	failures += test_search(index, "", 3);
+	failures += test_search(index, "tokei", 2);
+	failures += test_search(index, "ODA shining", 1);
+	failures += test_search(index, "silence", 1);
+	failures += test_search(index, "nothing", 0);
+	failures += test_search(index, "to", 2);
+	return failures;
+}
+
+/**
+ * Offset the trigram count of the header by 2³¹, which a size computation on
+ * 32 bits wouldn't notice, and expect the index to be rejected.
+ */
+static int test_corrupted()
+{
+	std::string data;
+	{
+		std::ifstream in(index_path, std::ios::binary);
+		data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	}
+	uint32_t count;
+	memcpy(&count, &data[12], sizeof(count));
+	count += 1u << 31;
+	memcpy(&data[12], &count, sizeof(count));
+	{
+		std::ofstream out(index_path, std::ios::binary);
+		out << data;
+	}
+	try {
+		oshu::beatmap_index index (index_path);
+	} catch (std::runtime_error &e) {
+		return 0;
+	}
+	std::cerr << "a corrupted index was accepted" << std::endl;
+	return 1;
+}
+
+int main()
+{
+	int failures = 0;
+	failures += test_build();
+	failures += test_corrupted();
+	unlink(index_path);
+	if (failures > 0)
+		std::cerr << "Total: " << failures << " failed tests." << std::endl;
+	return failures;
+}
@@ -0,0 +1,173 @@
+/**
+ * \file test/path.cc
+ *
+ * Compare the bounding boxes of slider paths with the extrema of densely
+ * sampled points, for the sliders of Zero Tokei and a few Bézier curves of
+ * higher degrees.
+ */
+
+#include "beatmap/beatmap.h"
+#include "beatmap/path.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+static const char *zerotokei = "Kaori Oda - Zero Tokei (Short ver.) (ShogunMoon) [Shining].osu";
+
+static const char *curves = R"(osu file format v14
+
+[General]
+AudioFilename: audio.mp3
+
+[Metadata]
+Title:Curves
+Artist:oshu!
+Version:Test
+
+[Difficulty]
+SliderMultiplier:1.4
+
+[TimingPoints]
+0,500,4,2,0,100,1,0
+
+[HitObjects]
+256,192,1000,2,0,B|256:50|400:192,1,200
+256,192,2000,2,0,B|300:100|400:300|450:200,1,300
+256,192,3000,2,0,B|200:50|300:350|350:20|420:380|480:100|300:200,1,400
+256,192,4000,2,0,B|300:100|350:150|350:150|450:250|400:300,1,250
+256,192,5000,2,0,B|300:100|400:300|450:200,1,600
+256,192,6000,2,0,P|300:100|350:192,1,150
+256,192,7000,2,0,L|400:300,1,100
+)";
+
+static const int samples = 10000;
+
+/**
+ * Evaluate a Bézier curve with de Casteljau's algorithm.
+ */
+static oshu::point casteljau(std::vector<oshu::point> points, double t)
+{
+	for (size_t l = points.size(); l > 1; --l) {
+		for (size_t j = 0; j + 1 < l; ++j)
+			points[j] = (1. - t) * points[j] + t * points[j + 1];
+	}
+	return points[0];
+}
+
+/**
+ * Sample the segments of a Bézier path from their control points, until the
+ * length of the slider, independently of the path's LUT and polyline.
+ *
+ * The distance along each segment is measured by its chords, scaled to the
+ * segment's #oshu::bezier::lengths, so that the path is cut where the game
+ * cuts it.
+ */
+static void sample_bezier(oshu::bezier *bezier, std::vector<oshu::point> *out)
+{
+	for (size_t i = 0; i + 1 < bezier->indices.size(); ++i) {
+		std::vector<oshu::point> points (
+			bezier->control_points.begin() + bezier->indices[i],
+			bezier->control_points.begin() + bezier->indices[i + 1]);
+		std::vector<oshu::point> segment;
+		std::vector<double> chords {0};
+		for (int k = 0; k <= samples; ++k) {
+			segment.push_back(casteljau(points, (double) k / samples));
+			if (k > 0)
+				chords.push_back(chords.back() + std::abs(segment[k] - segment[k - 1]));
+		}
+		double start = bezier->lengths[i], length = bezier->lengths[i + 1] - start;
+		for (int k = 0; k <= samples; ++k) {
+			if (start + chords[k] / chords.back() * length > bezier->length)
+				return;
+			out->push_back(segment[k]);
+		}
+	}
+}
+
+/**
+ * The box must contain every sample, and each of its sides must be no further
+ * from the extreme samples than the distance between two samples.
+ *
+ * Bézier paths and arcs are sampled from their definition, rather than from
+ * the polyline #oshu::path_at follows, whose chords cut the curves. Lines are
+ * their own polyline.
+ */
+static int check_box(oshu::hit *hit)
+{
+	oshu::path *path = &hit->slider.path;
+	oshu::point top_left, bottom_right;
+	oshu::path_bounding_box(path, &top_left, &bottom_right);
+	std::vector<oshu::point> points;
+	if (path->type == oshu::BEZIER_PATH) {
+		sample_bezier(&path->bezier, &points);
+	} else if (path->type == oshu::PERFECT_PATH) {
+		oshu::arc *arc = &path->arc;
+		for (int i = 0; i <= samples; ++i) {
+			double t = (double) i / samples;
+			double angle = (1 - t) * arc->start_angle + t * arc->end_angle;
+			points.push_back(arc->center + std::polar(arc->radius, angle));
+		}
+	} else {
+		for (int i = 0; i <= samples; ++i)
+			points.push_back(oshu::path_at(path, (double) i / samples));
+	}
+	double min_x = INFINITY, min_y = INFINITY, max_x = -INFINITY, max_y = -INFINITY;
+	for (oshu::point p : points) {
+		min_x = std::min(min_x, std::real(p));
+		min_y = std::min(min_y, std::imag(p));
+		max_x = std::max(max_x, std::real(p));
+		max_y = std::max(max_y, std::imag(p));
+	}
+	double epsilon = 1e-6, slack = .05;
+	bool contains = std::real(top_left) <= min_x + epsilon && std::imag(top_left) <= min_y + epsilon
+	                && std::real(bottom_right) >= max_x - epsilon && std::imag(bottom_right) >= max_y - epsilon;
+	bool tight = std::real(top_left) >= min_x - slack && std::imag(top_left) >= min_y - slack
+	             && std::real(bottom_right) <= max_x + slack && std::imag(bottom_right) <= max_y + slack;
+	if (!contains || !tight) {
+		std::cerr << "slider at " << hit->time << ": box " << top_left << " " << bottom_right
+		          << ", sampled " << oshu::point(min_x, min_y) << " " << oshu::point(max_x, max_y) << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+static int check_sliders(oshu::beatmap *beatmap)
+{
+	int failures = 0;
+	int count = 0;
+	for (oshu::hit *hit = beatmap->hits->next; hit->next; hit = hit->next) {
+		if (hit->type & oshu::SLIDER_HIT) {
+			failures += check_box(hit);
+			++count;
+		}
+	}
+	if (count == 0) {
+		std::cerr << "no slider to check" << std::endl;
+		++failures;
+	}
+	return failures;
+}
+
+int main()
+{
+	int failures = 0;
+	oshu::beatmap b;
+	if (oshu::load_beatmap(zerotokei, &b) < 0)
+		return 1;
+	failures += check_sliders(&b);
+	oshu::destroy_beatmap(&b);
+	std::string data = curves;
+	if (oshu::parse_beatmap(data.data(), data.size(), "curves.osu", &b) < 0) {
+		std::cerr << "could not parse the curves" << std::endl;
+		++failures;
+	} else {
+		failures += check_sliders(&b);
+		oshu::destroy_beatmap(&b);
+	}
+	if (failures > 0)
+		std::cerr << "Total: " << failures << " failed tests." << std::endl;
+	return failures;
+}
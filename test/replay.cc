@@ -0,0 +1,82 @@
+/**
+ * \file test/replay.cc
+ *
+ * Record a scripted game of Zero Tokei, save the replay, load it back, and
+ * judge it again on a fresh game. Both games must end the same.
+ */
+
+#include "core/hash.h"
+#include "game/osu.h"
+#include "game/replay.h"
+#include "game/simulation.h"
+#include "script.h"
+
+#include <cmath>
+#include <iostream>
+#include <unistd.h>
+
+static const char *zerotokei = "Kaori Oda - Zero Tokei (Short ver.) (ShogunMoon) [Shining].osu";
+static const char *replay_path = "test.replay";
+
+static int compare_events(const oshu::replay *a, const oshu::replay *b)
+{
+	if (a->beatmap_hash != b->beatmap_hash || a->events.size() != b->events.size()) {
+		std::cerr << "the loaded replay differs from the recorded one" << std::endl;
+		return 1;
+	}
+	for (size_t i = 0; i < a->events.size(); ++i) {
+		const oshu::input_event &x = a->events[i], &y = b->events[i];
+		if (std::abs(x.time - y.time) > 1e-6 || x.type != y.type || x.key != y.key
+		    || std::abs(x.position - y.position) > 1e-3) {
+			std::cerr << "event #" << i << " differs after loading the replay" << std::endl;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int compare_games(oshu::game_base *a, oshu::game_base *b)
+{
+	int i = 0;
+	for (oshu::hit *x = a->beatmap.hits->next, *y = b->beatmap.hits->next; x->next; x = x->next, y = y->next, ++i) {
+		if (x->state != y->state || (x->state == oshu::GOOD_HIT && std::abs(x->offset - y->offset) > 1e-5)) {
+			std::cerr << "hit #" << i << " was judged differently by the replay" << std::endl;
+			return 1;
+		}
+	}
+	double expected = oshu::score(&a->beatmap), got = oshu::score(&b->beatmap);
+	if (std::abs(expected - got) > 1e-9) {
+		std::cerr << "the replay scored " << got << " instead of " << expected << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+int main()
+{
+	int failures = 0;
+	oshu::replay recorded;
+	if (oshu::hash_file(zerotokei, &recorded.beatmap_hash) < 0)
+		return 1;
+	oshu::osu_game original(zerotokei, true);
+	original.recording = &recorded;
+	oshu::simulate(&original, script(&original.beatmap));
+	if (recorded.events.empty()) {
+		std::cerr << "no input was recorded" << std::endl;
+		return 1;
+	}
+	oshu::replay loaded;
+	if (oshu::save_replay(&recorded, replay_path) < 0 || oshu::load_replay(replay_path, &loaded) < 0) {
+		std::cerr << "could not save and load the replay" << std::endl;
+		++failures;
+	} else {
+		failures += compare_events(&recorded, &loaded);
+		oshu::osu_game replayed(zerotokei, true);
+		oshu::simulate(&replayed, loaded.events);
+		failures += compare_games(&original, &replayed);
+	}
+	unlink(replay_path);
+	if (failures > 0)
+		std::cerr << "Total: " << failures << " failed tests." << std::endl;
+	return failures;
+}
@@ -0,0 +1,118 @@
+/**
+ * \file test/rewind.cc
+ *
+ * Play Zero Tokei with a script of good, early, late and missed hits, then
+ * rewind it step by step, and check the running tally always agrees with
+ * #oshu::score.
+ */
+
+#include "game/checkpoint.h"
+#include "game/osu.h"
+#include "game/simulation.h"
+#include "script.h"
+
+#include <cmath>
+#include <iostream>
+
+static const char *zerotokei = "Kaori Oda - Zero Tokei (Short ver.) (ShogunMoon) [Shining].osu";
+
+/**
+ * Compare the tally with the states of the hits, and its score with
+ * #oshu::score.
+ */
+static int check_tally(oshu::game_base *game, const char *when)
+{
+	int great = 0, early = 0, late = 0, missed = 0;
+	double leniency = game->beatmap.difficulty.leniency;
+	for (oshu::hit *hit = game->beatmap.hits->next; hit->next; hit = hit->next) {
+		if (hit->state == oshu::MISSED_HIT)
+			++missed;
+		else if (hit->state != oshu::GOOD_HIT)
+			continue;
+		else if (hit->offset < - leniency / 2)
+			++early;
+		else if (hit->offset > leniency / 2)
+			++late;
+		else
+			++great;
+	}
+	oshu::tally *tally = &game->tally;
+	int failures = 0;
+	if (tally->great != great || tally->early != early || tally->late != late || tally->missed != missed) {
+		std::cerr << when << ": the tally counts " << tally->great << "/" << tally->early << "/"
+		          << tally->late << "/" << tally->missed << " great/early/late/missed hits, expected "
+		          << great << "/" << early << "/" << late << "/" << missed << std::endl;
+		++failures;
+	}
+	double expected = oshu::score(&game->beatmap);
+	double got = oshu::tally_score(tally);
+	if (std::isnan(expected) ? !std::isnan(got) : std::abs(got - expected) > 1e-9) {
+		std::cerr << when << ": the tally scores " << got << ", expected " << expected << std::endl;
+		++failures;
+	}
+	int combo = tally->checkpoints.empty() ? 0 : tally->checkpoints.back().combo;
+	if (tally->combo != combo || tally->combo > tally->max_combo) {
+		std::cerr << when << ": inconsistent combo " << tally->combo << std::endl;
+		++failures;
+	}
+	return failures;
+}
+
+/**
+ * Rewind to *time*, and check no judgment made later remains.
+ */
+static int check_rewind(oshu::osu_game *game, double time)
+{
+	if (oshu::restore_checkpoint(game, time) < 0) {
+		std::cerr << "could not rewind to " << time << std::endl;
+		return 1;
+	}
+	int failures = 0;
+	for (const oshu::judgment &entry : game->timeline.journal) {
+		if (entry.time > time) {
+			std::cerr << "a judgment at " << entry.time << " survived the rewind to " << time << std::endl;
+			++failures;
+			break;
+		}
+	}
+	std::string when = "after rewinding to " + std::to_string(time);
+	return failures + check_tally(game, when.c_str());
+}
+
+/**
+ * Undo the last judgments with #oshu::judge_hit directly, in reverse order.
+ */
+static int check_undo(oshu::osu_game *game)
+{
+	std::vector<oshu::judgment> &journal = game->timeline.journal;
+	int failures = 0;
+	for (size_t i = journal.size(); i > journal.size() / 2; --i) {
+		oshu::judgment &entry = journal[i - 1];
+		oshu::judge_hit(&game->tally, &game->beatmap, entry.hit, entry.previous_state);
+		entry.hit->offset = entry.previous_offset;
+		if (i % 8 == 0)
+			failures += check_tally(game, "after undoing judgments");
+	}
+	return failures + check_tally(game, "after undoing judgments");
+}
+
+int main()
+{
+	oshu::osu_game game(zerotokei, true);
+	if (oshu::simulate(&game, script(&game.beatmap)) < 0)
+		return 1;
+	int failures = check_tally(&game, "after the game");
+	if (game.tally.great == 0 || game.tally.early + game.tally.late == 0 || game.tally.missed == 0) {
+		std::cerr << "the script should make every kind of judgment" << std::endl;
+		++failures;
+	}
+	double end = game.timeline.journal.back().time;
+	for (double t = end; t > 0; t -= 3.7)
+		failures += check_rewind(&game, t);
+	oshu::osu_game other(zerotokei, true);
+	oshu::simulate(&other, script(&other.beatmap));
+	failures += check_undo(&other);
+	if (failures > 0)
+		std::cerr << "Total: " << failures << " failed tests." << std::endl;
+	return failures;
+}
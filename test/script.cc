@@ -0,0 +1,22 @@
+/**
+ * \file test/script.cc
+ */
+
+#include "script.h"
+
+std::vector<oshu::input_event> script(oshu::beatmap *beatmap)
+{
+	std::vector<oshu::input_event> events;
+	double leniency = beatmap->difficulty.leniency;
+	double offsets[] = {0, -.6 * leniency, .6 * leniency};
+	int i = 0;
+	for (oshu::hit *hit = beatmap->hits->next; hit->next; hit = hit->next, ++i) {
+		if (!(hit->type & (oshu::CIRCLE_HIT | oshu::SLIDER_HIT)) || i % 4 == 0)
+			continue;
+		double t = hit->time + offsets[i % 3];
+		events.push_back({t - .05, oshu::input_event::MOVE, oshu::UNKNOWN_KEY, hit->p});
+		events.push_back({t, oshu::input_event::PRESS, oshu::LEFT_INDEX, hit->p});
+		events.push_back({t + .01, oshu::input_event::RELEASE, oshu::LEFT_INDEX, hit->p});
+	}
+	return events;
+}
@@ -0,0 +1,20 @@
+/**
+ * \file test/script.h
+ *
+ * Input scripts shared by the tests that simulate games.
+ */
+
+#pragma once
+
+#include "beatmap/beatmap.h"
+#include "game/simulation.h"
+
+#include <vector>
+
+/**
+ * Move to every circle and slider, and click it, a bit early or late for some
+ * of them. Skip every fourth to miss it.
+ *
+ * The result makes every kind of judgment: great, early, late and missed.
+ */
+std::vector<oshu::input_event> script(oshu::beatmap *beatmap);
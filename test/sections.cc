@@ -0,0 +1,103 @@
+/**
+ * \file test/sections.cc
+ *
+ * Parse the Zero Tokei beatmap with some of its sections removed, and the
+ * malformed beatmaps of the fuzzing corpus.
+ */
+
+#include "beatmap/beatmap.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+static const char *zerotokei = "Kaori Oda - Zero Tokei (Short ver.) (ShogunMoon) [Shining].osu";
+
+/**
+ * Read the test beatmap, without the lines equal to *skipped*.
+ */
+static std::string read_without(const char *skipped)
+{
+	std::ifstream in(zerotokei);
+	std::ostringstream out;
+	std::string line;
+	while (std::getline(in, line)) {
+		if (line.compare(0, std::strlen(skipped), skipped) != 0)
+			out << line << '\n';
+	}
+	return out.str();
+}
+
+/**
+ * Without the [TimingPoints] header, the timing points end up in the
+ * [Events] section, so the hits have no timing point and are dropped, but the
+ * colours and the metadata are still there.
+ */
+static int test_no_timing_points()
+{
+	int failures = 0;
+	std::string data = read_without("[TimingPoints]");
+	oshu::beatmap b;
+	if (oshu::parse_beatmap(data.data(), data.size(), "no-timing-points.osu", &b) < 0) {
+		std::cerr << "could not parse a beatmap without timing points" << std::endl;
+		return 1;
+	}
+	if (b.timing_point_count != 0) {
+		std::cerr << "unexpected timing points: " << b.timing_point_count << std::endl;
+		++failures;
+	}
+	if (b.hits->next->next) {
+		std::cerr << "unexpected hits without timing points" << std::endl;
+		++failures;
+	}
+	if (b.color_count == 0) {
+		std::cerr << "missing colours" << std::endl;
+		++failures;
+	}
+	if (std::strcmp(b.metadata.title, "Zero Tokei (Short ver.)")) {
+		std::cerr << "unexpected title: " << b.metadata.title << std::endl;
+		++failures;
+	}
+	oshu::destroy_beatmap(&b);
+	return failures;
+}
+
+/**
+ * A slider with a negative repeat count is dropped, instead of allocating a
+ * negative number of hit sounds.
+ */
+static int test_negative_repeat()
+{
+	oshu::beatmap b;
+	if (oshu::load_beatmap("../bench/corpus/negative-repeat.osu", &b) < 0) {
+		std::cerr << "could not parse the beatmap with a negative repeat" << std::endl;
+		return 1;
+	}
+	int failures = 0;
+	int count = 0;
+	for (oshu::hit *hit = b.hits->next; hit->next; hit = hit->next) {
+		++count;
+		if (hit->type & oshu::SLIDER_HIT) {
+			std::cerr << "unexpected slider with a negative repeat" << std::endl;
+			++failures;
+		}
+	}
+	if (count != 1) {
+		std::cerr << "expected 1 hit, got " << count << std::endl;
+		++failures;
+	}
+	oshu::destroy_beatmap(&b);
+	return failures;
+}
+
+int main()
+{
+	int failures = 0;
+	failures += test_no_timing_points();
+	failures += test_negative_repeat();
+	if (failures > 0)
+		std::cerr << "Total: " << failures << " failed tests." << std::endl;
+	return failures;
+}
@@ -0,0 +1,69 @@
+/**
+ * \file test/timing.cc
+ *
+ * Compare #oshu::timing_at with a linear walk of the timing points of the
+ * Zero Tokei beatmap, with and without hints.
+ */
+
+#include "beatmap/beatmap.h"
+
+#include <iostream>
+
+static const char *zerotokei = "Kaori Oda - Zero Tokei (Short ver.) (ShogunMoon) [Shining].osu";
+
+/**
+ * The reference: the last timing point not after *t*, or the first one.
+ */
+static oshu::timing_point* walk(oshu::beatmap *beatmap, double t)
+{
+	oshu::timing_point *found = beatmap->timing_points;
+	for (oshu::timing_point *tp = beatmap->timing_points; tp; tp = tp->next) {
+		if (tp->offset <= t)
+			found = tp;
+	}
+	return found;
+}
+
+static int check(oshu::beatmap *beatmap, double t, oshu::timing_point *hint, const char *what)
+{
+	oshu::timing_point *expected = walk(beatmap, t);
+	oshu::timing_point *got = oshu::timing_at(beatmap, t, hint);
+	if (got != expected) {
+		std::cerr << what << " at " << t << ": expected the timing point at "
+		          << expected->offset << ", got " << (got ? got->offset : -1) << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+int main()
+{
+	oshu::beatmap b;
+	if (oshu::load_beatmap(zerotokei, &b) < 0)
+		return 1;
+	int failures = 0;
+	if (b.timing_point_count < 2) {
+		std::cerr << "expected several timing points" << std::endl;
+		++failures;
+	}
+	double first = b.timing_points->offset;
+	double last = b.timing_index[b.timing_point_count - 1]->offset;
+	/* Increasing times, like the game does, with every kind of hint. */
+	oshu::timing_point *previous = nullptr;
+	for (double t = first - 1; t < last + 1 && failures < 10; t += .01) {
+		failures += check(&b, t, nullptr, "no hint");
+		failures += check(&b, t, b.timing_points, "first hint");
+		failures += check(&b, t, previous, "previous hint");
+		previous = oshu::timing_at(&b, t, previous);
+	}
+	/* Exactly on, and right before, every timing point. */
+	for (oshu::timing_point *tp = b.timing_points; tp; tp = tp->next) {
+		failures += check(&b, tp->offset, nullptr, "no hint");
+		failures += check(&b, tp->offset, tp, "exact hint");
+		failures += check(&b, tp->offset - 1e-6, tp, "late hint");
+	}
+	oshu::destroy_beatmap(&b);
+	if (failures > 0)
+		std::cerr << "Total: " << failures << " failed tests." << std::endl;
+	return failures;
+}